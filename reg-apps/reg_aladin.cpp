@@ -10,6 +10,7 @@
  */
 
 #include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteAsync.h"
 #include "_reg_ReadWriteMatrix.h"
 #include "_reg_aladin_sym.h"
 #include "_reg_tools.h"
@@ -78,6 +79,8 @@ void Usage(char *exec)
    reg_print_info(exec, "\t-pv <int>\t\tPercentage of blocks to use in the optimisation scheme. [50]");
    reg_print_info(exec, "\t-pi <int>\t\tPercentage of blocks to consider as inlier in the optimisation scheme. [50]");
    reg_print_info(exec, "\t-speeeeed\t\tGo faster");
+   reg_print_info(exec, "\t-hbm\t\t\tUse a coarse-to-fine block matching search instead of an exhaustive one (3D and CPU platform only)");
+   reg_print_info(exec, "\t-nativeFlo\t\tKeep an integer floating image in its datatype at the finest level (-noSym and CPU platform only)");
 #if defined(_USE_CUDA) && defined(_USE_OPENCL)
    reg_print_info(exec, "\t-platf <uint>\t\tChoose platform: CPU=0 | Cuda=1 | OpenCL=2 [0]");
 #else
@@ -102,6 +105,8 @@ void Usage(char *exec)
    reg_print_info(exec, text);
 #endif
    reg_print_info(exec, "\t-voff\t\t\tTurns verbose off [on]");
+   reg_print_info(exec, "\t-timing\t\t\tPrint the duration of the registration stages of every level");
+   reg_print_info(exec, "\t-trace <filename>\tSave the timed registration stages as a Chrome trace-event file");
    reg_print_info(exec, "");
    reg_print_info(exec, "\t--version\t\tPrint current version and exit");
    sprintf(text, "\t\t\t\t(%s)",NR_VERSION);
@@ -168,7 +173,10 @@ int main(int argc, char **argv)
 
    bool iso=false;
    bool verbose=true;
+   char *traceFileName=NULL;
    int captureRangeVox = 3;
+   bool hierarchicalSearch = false;
+   bool nativeFinestFloating = false;
    unsigned int platformFlag = NR_PLATFORM_CPU;
    unsigned gpuIdx = 999;
 
@@ -307,6 +315,14 @@ int main(int argc, char **argv)
       {
          blockStepSize=2;
       }
+      else if(strcmp(argv[i], "-hbm")==0 || strcmp(argv[i], "--hbm")==0)
+      {
+         hierarchicalSearch=true;
+      }
+      else if(strcmp(argv[i], "-nativeFlo")==0 || strcmp(argv[i], "--nativeFlo")==0)
+      {
+         nativeFinestFloating=true;
+      }
       else if(strcmp(argv[i], "-interp")==0 || strcmp(argv[i], "--interp")==0)
       {
          interpolation=atoi(argv[++i]);
@@ -366,6 +382,15 @@ int main(int argc, char **argv)
       {
           captureRangeVox=atoi(argv[++i]);
       }
+      else if(strcmp(argv[i], "-timing")==0 || strcmp(argv[i], "--timing")==0)
+      {
+         reg_timer_enable();
+      }
+      else if(strcmp(argv[i], "-trace")==0 || strcmp(argv[i], "--trace")==0)
+      {
+         traceFileName=argv[++i];
+         reg_timer_enable(true);
+      }
       else if(strcmp(argv[i], "-omp")==0 || strcmp(argv[i], "--omp")==0)
       {
 #if defined (_OPENMP)
@@ -428,8 +453,17 @@ int main(int argc, char **argv)
       }
    }
 
+   /* All the input images are read concurrently in the background */
+   reg_io_AsyncReader imageReader;
+   imageReader.Request(referenceImageName);
+   imageReader.Request(floatingImageName);
+   if(referenceMaskFlag)
+      imageReader.Request(referenceMaskName);
+   if(floatingMaskFlag && symFlag)
+      imageReader.Request(floatingMaskName);
+
    /* Read the reference image and check its dimension */
-   nifti_image *referenceHeader = reg_io_ReadImageFile(referenceImageName);
+   nifti_image *referenceHeader = imageReader.Get(referenceImageName);
    if(referenceHeader == NULL)
    {
       sprintf(text,"Error when reading the reference image: %s", referenceImageName);
@@ -438,7 +472,7 @@ int main(int argc, char **argv)
    }
 
    /* Read the floating image and check its dimension */
-   nifti_image *floatingHeader = reg_io_ReadImageFile(floatingImageName);
+   nifti_image *floatingHeader = imageReader.Get(floatingImageName);
    if(floatingHeader == NULL)
    {
       sprintf(text,"Error when reading the floating image: %s", floatingImageName);
@@ -468,7 +502,7 @@ int main(int argc, char **argv)
    nifti_image *isoRefMaskImage=NULL;
    if(referenceMaskFlag)
    {
-      referenceMaskImage = reg_io_ReadImageFile(referenceMaskName);
+      referenceMaskImage = imageReader.Get(referenceMaskName);
       if(referenceMaskImage == NULL)
       {
          sprintf(text,"Error when reading the reference mask image: %s", referenceMaskName);
@@ -497,7 +531,7 @@ int main(int argc, char **argv)
    nifti_image *isoFloMaskImage=NULL;
    if(floatingMaskFlag && symFlag)
    {
-      floatingMaskImage = reg_io_ReadImageFile(floatingMaskName);
+      floatingMaskImage = imageReader.Get(floatingMaskName);
       if(floatingMaskImage == NULL)
       {
          sprintf(text,"Error when reading the floating mask image: %s", floatingMaskName);
@@ -532,6 +566,20 @@ int main(int argc, char **argv)
    REG->SetPerformAffine(affineFlag);
    REG->SetPerformRigid(rigidFlag);
    REG->SetBlockStepSize(blockStepSize);
+   if(hierarchicalSearch && platformFlag!=NR_PLATFORM_CPU)
+   {
+      reg_print_msg_warn("The coarse-to-fine block matching search is only implemented on the CPU platform");
+      reg_print_msg_warn("The \'-hbm\' flag is ignored");
+      hierarchicalSearch=false;
+   }
+   REG->SetHierarchicalSearch(hierarchicalSearch);
+   if(nativeFinestFloating && (symFlag || platformFlag!=NR_PLATFORM_CPU))
+   {
+      reg_print_msg_warn("The integer floating image is only kept at the finest level by the non-symmetric CPU registration");
+      reg_print_msg_warn("The \'-nativeFlo\' flag is ignored");
+      nativeFinestFloating=false;
+   }
+   REG->SetNativeFinestFloating(nativeFinestFloating);
    REG->SetBlockPercentage(blockPercentage);
    REG->SetInlierLts(inlierLts);
    REG->SetInterpolation(interpolation);
@@ -583,6 +631,10 @@ int main(int argc, char **argv)
    // Run the registration
    REG->Run();
 
+   // Save the timed stages of the registration
+   if(traceFileName!=NULL)
+      reg_timer_writeTrace(traceFileName);
+
    // The warped image is saved
    if(iso)
    {
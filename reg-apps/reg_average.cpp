@@ -12,6 +12,7 @@
 #include "reg_average.h"
 
 #include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteAsync.h"
 #include "_reg_ReadWriteMatrix.h"
 #include "_reg_tools.h"
 #include "_reg_resampling.h"
@@ -389,8 +390,21 @@ int compute_average_image(nifti_image *averageImage,
    // Create an image to store the defined value number
    nifti_image *definedValue = nifti_copy_nim_info(averageImage);
    definedValue->data = (void *)calloc(averageImage->nvox, averageImage->nbyper);
+   // The inputs of the next image are read in the background while the
+   // current one is processed
+   reg_io_AsyncReader imageReader;
+   if(imageNumber>0){
+      if(inputNRRName!=NULL)
+         imageReader.Request(inputNRRName[0]);
+      imageReader.Request(inputImageName[0]);
+   }
    // Loop over all input images
    for(size_t i=0; i<imageNumber; ++i){
+      if(i+1<imageNumber){
+         if(inputNRRName!=NULL)
+            imageReader.Request(inputNRRName[i+1]);
+         imageReader.Request(inputImageName[i+1]);
+      }
       // Generate a deformation field defined by the average final
       nifti_image *deformationField=nifti_copy_nim_info(averageImage);
       deformationField->ndim=deformationField->dim[0]=5;
@@ -413,7 +427,7 @@ int compute_average_image(nifti_image *averageImage,
       reg_getDeformationFromDisplacement(deformationField);
       // Compute the transformation if required
       if(inputNRRName!=NULL){
-         nifti_image *current_transformation = reg_io_ReadImageFile(inputNRRName[i]);
+         nifti_image *current_transformation = imageReader.Get(inputNRRName[i]);
          switch(static_cast<int>(current_transformation->intent_p1)){
          case DISP_FIELD:
             reg_getDeformationFromDisplacement(current_transformation);
@@ -473,7 +487,7 @@ int compute_average_image(nifti_image *averageImage,
       warpedImage->nbyper = sizeof(float);
       warpedImage->data = (void *)malloc(warpedImage->nvox*warpedImage->nbyper);
       // Read the input image
-      nifti_image *current_input_image = reg_io_ReadImageFile(inputImageName[i]);
+      nifti_image *current_input_image = imageReader.Get(inputImageName[i]);
       reg_tools_changeDatatype<PrecisionTYPE>(current_input_image);
       // Apply the transformation
       reg_resampleImage(current_input_image, warpedImage, deformationField, NULL, 3, std::numeric_limits<float>::quiet_NaN());
@@ -722,7 +736,7 @@ int main(int argc, char **argv)
          referenceImageName=input_image_names[0];
       avg_output_image = reg_io_ReadImageFile(referenceImageName);
       // clean the data and reallocate them
-      free(avg_output_image->data);
+      nifti_free_data(avg_output_image->data);
       avg_output_image->scl_slope=1.f;
       avg_output_image->scl_inter=0.f;
       avg_output_image->datatype=NIFTI_TYPE_FLOAT32;
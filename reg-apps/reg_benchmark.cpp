@@ -1,908 +1,596 @@
-/*
-*  benchmark.cpp
-*
-*
-*  Created by Marc Modat on 15/11/2009.
-*  Copyright (c) 2009, University College London. All rights reserved.
-*  Centre for Medical Image Computing (CMIC)
-*  See the LICENSE.txt file in the nifty_reg root folder
-*
-*/
-
+/**
+ * @file reg_benchmark.cpp
+ * @brief Micro-benchmark of the main registration kernels
+ *
+ * Every kernel is timed on generated phantoms for several image sizes and
+ * OpenMP thread numbers. The median, variance and minimal durations are
+ * reported as JSON or CSV to compare the performance between releases.
+ *
+ *  Copyright (c) 2009, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#include "_reg_ReadWriteImage.h"
 #include "_reg_resampling.h"
-#include "_reg_affineTransformation.h"
-#include "_reg_bspline.h"
-#include "_reg_bspline_comp.h"
-#include "_reg_mutualinformation.h"
-#include "_reg_ssd.h"
-#include "_reg_tools.h"
+#include "_reg_localTrans.h"
+#include "_reg_localTrans_jac.h"
+#include "_reg_localTrans_regul.h"
 #include "_reg_blockMatching.h"
-
-#ifdef _USE_CUDA
-#include "_reg_cudaCommon.h"
-#include "_reg_resampling_gpu.h"
-#include "_reg_affineTransformation_gpu.h"
-#include "_reg_bspline_gpu.h"
-#include "_reg_mutualinformation_gpu.h"
-#include "_reg_tools_gpu.h"
-#include "_reg_blockMatching_gpu.h"
-#endif
-
-#ifdef _WINDOWS
-#include <time.h>
-#endif
-
-void Usage(char *);
-
-int main(int argc, char **argv)
+#include "_reg_tools.h"
+#include "_reg_timer.h"
+#include "_reg_nmi.h"
+#include "_reg_ssd.h"
+#include "_reg_lncc.h"
+#include "_reg_kld.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* *************************************************************** */
+/// @brief Images and objects shared by all the benchmarked kernels
+typedef struct
 {
-   int dimension = 100;
-   float gridSpacing = 10.0f;
-   unsigned int binning = 68;
-   char *outputFileName = (char *)"benchmark_result.txt";
-   bool runGPU=1;
-
-   for(int i=1; i<argc; i++)
-   {
-      if(strcmp(argv[i], "-help")==0 || strcmp(argv[i], "-Help")==0 ||
-            strcmp(argv[i], "-HELP")==0 || strcmp(argv[i], "-h")==0 ||
-            strcmp(argv[i], "--h")==0 || strcmp(argv[i], "--help")==0)
-      {
-         Usage(argv[0]);
-         return 0;
-      }
-      else if(strcmp(argv[i], "-dim") == 0)
-      {
-         dimension=atoi(argv[++i]);
-      }
-      else if(strcmp(argv[i], "-sp") == 0)
-      {
-         gridSpacing=atof(argv[++i]);
-      }
-      else if(strcmp(argv[i], "-bin") == 0)
-      {
-         binning=atoi(argv[++i]);
-      }
-      else if(strcmp(argv[i], "-o") == 0)
-      {
-         outputFileName=argv[++i];
-      }
-      else if(strcmp(argv[i], "-cpu") == 0)
-      {
-         runGPU=0;
-      }
-      else
-      {
-         fprintf(stderr,"Err:\tParameter %s unknown.\n",argv[i]);
-         Usage(argv[0]);
-         return 1;
-      }
-   }
-
-   // The target, source and result images are created
-   int dim_img[8];
-   dim_img[0]=3;
-   dim_img[1]=dimension;
-   dim_img[2]=dimension;
-   dim_img[3]=dimension;
-   dim_img[4]=dim_img[5]=dim_img[6]=dim_img[7]=1;
-   nifti_image *targetImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   nifti_image *sourceImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   nifti_image *resultImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   targetImage->sform_code=0;
-   sourceImage->sform_code=0;
-   resultImage->sform_code=0;
-   int *maskImage = (int *)malloc(targetImage->nvox*sizeof(int));
-
-   // The target and source images are filled with random number
-   float *targetPtr=static_cast<float *>(targetImage->data);
-   float *sourcePtr=static_cast<float *>(sourceImage->data);
-   srand((unsigned)time(0));
-   for(unsigned int i=0; i<targetImage->nvox; ++i)
-   {
-      *targetPtr++ = (float)(binning-4)*(float)rand()/(float)RAND_MAX + 2.0f;
-      *sourcePtr++ = (float)(binning-4)*(float)rand()/(float)RAND_MAX + 2.0f;
-      maskImage[i]=i;
-   }
-
-   // Deformation field image is created
-   dim_img[0]=5;
-   dim_img[1]=dimension;
-   dim_img[2]=dimension;
-   dim_img[3]=dimension;
-   dim_img[5]=3;
-   dim_img[4]=dim_img[6]=dim_img[7]=1;
-   nifti_image *deformationFieldImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-
-   // Joint histogram creation
-   double *probaJointHistogram=(double *)malloc(binning*(binning+2)*sizeof(double));
-   double *logJointHistogram=(double *)malloc(binning*(binning+2)*sizeof(double));
-
-
-   // A control point image is created
-   dim_img[0]=5;
-   dim_img[1]=(int)floor(targetImage->nx*targetImage->dx/gridSpacing)+4;
-   dim_img[2]=(int)floor(targetImage->ny*targetImage->dy/gridSpacing)+4;
-   dim_img[3]=(int)floor(targetImage->nz*targetImage->dz/gridSpacing)+4;
-   dim_img[5]=3;
-   dim_img[4]=dim_img[6]=dim_img[7]=1;
-   nifti_image *controlPointImage = nifti_make_new_nim(dim_img, NIFTI_TYPE_FLOAT32, true);
-   controlPointImage->cal_min=0;
-   controlPointImage->cal_max=0;
-   controlPointImage->pixdim[0]=1.0f;
-   controlPointImage->pixdim[1]=controlPointImage->dx=gridSpacing;
-   controlPointImage->pixdim[2]=controlPointImage->dy=gridSpacing;
-   controlPointImage->pixdim[3]=controlPointImage->dz=gridSpacing;
-   controlPointImage->pixdim[4]=controlPointImage->dt=1.0f;
-   controlPointImage->pixdim[5]=controlPointImage->du=1.0f;
-   controlPointImage->pixdim[6]=controlPointImage->dv=1.0f;
-   controlPointImage->pixdim[7]=controlPointImage->dw=1.0f;
-   controlPointImage->qform_code=targetImage->qform_code;
-   controlPointImage->sform_code=targetImage->sform_code;
-   float qb, qc, qd, qx, qy, qz, dx, dy, dz, qfac;
-   nifti_mat44_to_quatern( targetImage->qto_xyz, &qb, &qc, &qd, &qx, &qy, &qz, &dx, &dy, &dz, &qfac);
-   controlPointImage->quatern_b=qb;
-   controlPointImage->quatern_c=qc;
-   controlPointImage->quatern_d=qd;
-   controlPointImage->qfac=qfac;
-   controlPointImage->qto_xyz = nifti_quatern_to_mat44(qb, qc, qd, qx, qy, qz,
-                                controlPointImage->dx, controlPointImage->dy, controlPointImage->dz, qfac);
-   float originIndex[3];
-   float originReal[3];
-   originIndex[0] = -1.0f;
-   originIndex[1] = -1.0f;
-   originIndex[2] = -1.0f;
-   reg_mat44_mul(&(controlPointImage->qto_xyz), originIndex, originReal);
-   controlPointImage->qto_xyz.m[0][3] = controlPointImage->qoffset_x = originReal[0];
-   controlPointImage->qto_xyz.m[1][3] = controlPointImage->qoffset_y = originReal[1];
-   controlPointImage->qto_xyz.m[2][3] = controlPointImage->qoffset_z = originReal[2];
-   controlPointImage->qto_ijk = nifti_mat44_inverse(controlPointImage->qto_xyz);
-
-   // Velocity field image
-   nifti_image *velocityFieldImage = nifti_copy_nim_info(controlPointImage);
-   velocityFieldImage->datatype = NIFTI_TYPE_FLOAT32;
-   velocityFieldImage->nbyper = sizeof(float);
-   velocityFieldImage->data = (void *)calloc(velocityFieldImage->nvox, velocityFieldImage->nbyper);
-
-   // Different gradient images
-   nifti_image *resultGradientImage = nifti_copy_nim_info(deformationFieldImage);
-   resultGradientImage->datatype = NIFTI_TYPE_FLOAT32;
-   resultGradientImage->nbyper = sizeof(float);
-   resultGradientImage->data = (void *)calloc(resultGradientImage->nvox, resultGradientImage->nbyper);
-   nifti_image *voxelNMIGradientImage = nifti_copy_nim_info(deformationFieldImage);
-   voxelNMIGradientImage->datatype = NIFTI_TYPE_FLOAT32;
-   voxelNMIGradientImage->nbyper = sizeof(float);
-   voxelNMIGradientImage->data = (void *)calloc(voxelNMIGradientImage->nvox, voxelNMIGradientImage->nbyper);
-   nifti_image *nodeNMIGradientImage = nifti_copy_nim_info(controlPointImage);
-   nodeNMIGradientImage->datatype = NIFTI_TYPE_FLOAT32;
-   nodeNMIGradientImage->nbyper = sizeof(float);
-   nodeNMIGradientImage->data = (void *)calloc(nodeNMIGradientImage->nvox, nodeNMIGradientImage->nbyper);
-
-#ifdef _USE_CUDA
-   float *targetImageArray_d;
-   cudaArray *sourceImageArray_d;
-   int *targetMask_d;
-   float4 *deformationFieldImageArray_d;
-   if(runGPU)
+   nifti_image *reference;
+   nifti_image *floating;
+   nifti_image *warped;
+   nifti_image *deformationField;
+   nifti_image *warpedGradient;
+   nifti_image *voxelBasedGradient;
+   nifti_image *controlPointGrid;
+   nifti_image *nodeGradient;
+   nifti_image *smoothedImage;
+   int *mask;
+   reg_nmi *nmi;
+   reg_ssd *ssd;
+   reg_lncc *lncc;
+   reg_kld *kld;
+   _reg_blockMatchingParam *blockMatchingParams;
+   mat44 transformation;
+} DATA;
+/* *************************************************************** */
+typedef struct
+{
+   const char *name;
+   void (*function)(DATA *);
+} KERNEL;
+/* *************************************************************** */
+typedef struct
+{
+   std::string kernel;
+   int size;
+   int threads;
+   double median;
+   double variance;
+   double minimum;
+} RESULT;
+/* *************************************************************** */
+/* *************************************************************** */
+static void resampleNearest(DATA *d)
+{
+   reg_resampleImage(d->floating, d->warped, d->deformationField, d->mask, 0, 0.f);
+}
+static void resampleLinear(DATA *d)
+{
+   reg_resampleImage(d->floating, d->warped, d->deformationField, d->mask, 1, 0.f);
+}
+static void resampleCubic(DATA *d)
+{
+   reg_resampleImage(d->floating, d->warped, d->deformationField, d->mask, 3, 0.f);
+}
+static void imageGradientLinear(DATA *d)
+{
+   reg_getImageGradient(d->floating, d->warpedGradient, d->deformationField, d->mask, 1, 0.f, 0);
+}
+static void imageGradientCubic(DATA *d)
+{
+   reg_getImageGradient(d->floating, d->warpedGradient, d->deformationField, d->mask, 3, 0.f, 0);
+}
+static void splineDeformationField(DATA *d)
+{
+   reg_spline_getDeformationField(d->controlPointGrid, d->deformationField, d->mask, false, true);
+}
+static void measureGradient(DATA *d, reg_measure *measure)
+{
+   // As in reg_base, the voxel-based gradient is reset before being accumulated
+   memset(d->voxelBasedGradient->data, 0, d->voxelBasedGradient->nvox*d->voxelBasedGradient->nbyper);
+   measure->GetVoxelBasedSimilarityMeasureGradient(0);
+}
+static void nmiValue(DATA *d)
+{
+   d->nmi->GetSimilarityMeasureValue();
+}
+static void nmiGradient(DATA *d)
+{
+   measureGradient(d, d->nmi);
+}
+static void ssdValue(DATA *d)
+{
+   d->ssd->GetSimilarityMeasureValue();
+}
+static void ssdGradient(DATA *d)
+{
+   measureGradient(d, d->ssd);
+}
+static void lnccValue(DATA *d)
+{
+   d->lncc->GetSimilarityMeasureValue();
+}
+static void lnccGradient(DATA *d)
+{
+   measureGradient(d, d->lncc);
+}
+static void kldValue(DATA *d)
+{
+   d->kld->GetSimilarityMeasureValue();
+}
+static void kldGradient(DATA *d)
+{
+   measureGradient(d, d->kld);
+}
+static void bendingEnergyValue(DATA *d)
+{
+   reg_spline_approxBendingEnergy(d->controlPointGrid);
+}
+static void bendingEnergyGradient(DATA *d)
+{
+   reg_spline_approxBendingEnergyGradient(d->controlPointGrid, d->nodeGradient, 1.f);
+}
+static void jacobianPenaltyValue(DATA *d)
+{
+   reg_spline_getJacobianPenaltyTerm(d->controlPointGrid, d->reference, true);
+}
+static void jacobianPenaltyGradient(DATA *d)
+{
+   reg_spline_getJacobianPenaltyTermGradient(d->controlPointGrid, d->reference, d->nodeGradient, 1.f, true);
+}
+static void convolution(DATA *d, int kernelType)
+{
+   float sigma=2.f;
+   reg_tools_kernelConvolution(d->smoothedImage, &sigma, kernelType);
+}
+static void convolutionMean(DATA *d)
+{
+   convolution(d, MEAN_KERNEL);
+}
+static void convolutionGaussian(DATA *d)
+{
+   convolution(d, GAUSSIAN_KERNEL);
+}
+static void convolutionIIRGaussian(DATA *d)
+{
+   convolution(d, IIR_GAUSSIAN_KERNEL);
+}
+static void blockMatching(DATA *d)
+{
+   block_matching_method(d->reference, d->warped, d->blockMatchingParams, d->mask);
+}
+static void ltsRigid(DATA *d)
+{
+   reg_mat44_eye(&d->transformation);
+   optimize(d->blockMatchingParams, &d->transformation, false);
+}
+static void ltsAffine(DATA *d)
+{
+   reg_mat44_eye(&d->transformation);
+   optimize(d->blockMatchingParams, &d->transformation, true);
+}
+/* *************************************************************** */
+static const KERNEL kernelList[] =
+{
+   {"resampling_nearest", resampleNearest},
+   {"resampling_linear", resampleLinear},
+   {"resampling_cubic", resampleCubic},
+   {"image_gradient_linear", imageGradientLinear},
+   {"image_gradient_cubic", imageGradientCubic},
+   {"spline_deformation_field", splineDeformationField},
+   {"nmi_value", nmiValue},
+   {"nmi_gradient", nmiGradient},
+   {"ssd_value", ssdValue},
+   {"ssd_gradient", ssdGradient},
+   {"lncc_value", lnccValue},
+   {"lncc_gradient", lnccGradient},
+   {"kld_value", kldValue},
+   {"kld_gradient", kldGradient},
+   {"bending_energy_value", bendingEnergyValue},
+   {"bending_energy_gradient", bendingEnergyGradient},
+   {"jacobian_penalty_value", jacobianPenaltyValue},
+   {"jacobian_penalty_gradient", jacobianPenaltyGradient},
+   {"convolution_mean", convolutionMean},
+   {"convolution_gaussian", convolutionGaussian},
+   {"convolution_iir_gaussian", convolutionIIRGaussian},
+   {"block_matching", blockMatching},
+   {"lts_rigid", ltsRigid},
+   {"lts_affine", ltsAffine}
+};
+static const size_t kernelNumber=sizeof(kernelList)/sizeof(KERNEL);
+/* *************************************************************** */
+/* *************************************************************** */
+/// @brief Create a cubic image with a smooth deterministic intensity pattern
+static nifti_image *CreatePhantom(int size, float shift)
+{
+   int dim[8]= {3, size, size, size, 1, 1, 1, 1};
+   nifti_image *image=nifti_make_new_nim(dim, NIFTI_TYPE_FLOAT32, true);
+   // The dimensions above dim[0] are not initialised by nifti_make_new_nim
+   for(int i=4; i<8; ++i)
    {
-      if(cudaCommon_allocateArrayToDevice<float>(&targetImageArray_d, targetImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float>(&targetImageArray_d, targetImage)) return 1;
-      if(cudaCommon_allocateArrayToDevice<float>(&sourceImageArray_d, sourceImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float>(&sourceImageArray_d,sourceImage)) return 1;
-      CUDA_SAFE_CALL(cudaMalloc((void **)&targetMask_d, targetImage->nvox*sizeof(int)));
-      CUDA_SAFE_CALL(cudaMemcpy(targetMask_d, maskImage, targetImage->nvox*sizeof(int), cudaMemcpyHostToDevice));
-      CUDA_SAFE_CALL(cudaMalloc((void **)&deformationFieldImageArray_d, targetImage->nvox*sizeof(float4)));
+      image->dim[i]=1;
+      image->pixdim[i]=1.f;
    }
-#endif
-
-   time_t start,end;
-   int minutes, seconds, cpuTime, maxIt;
-#ifdef _USE_CUDA
-   int gpuTime
-#endif
-
-   FILE *outputFile;
-   outputFile=fopen(outputFileName, "w");
-
-   /* Functions to be tested
-   	- affine deformation field
-   	- spline deformation field
-   	- linear interpolation
-   	- block matching computation
-   	- spatial gradient computation
-   	- voxel-based NMI gradient computation
-   	- node-based NMI gradient computation
-        - bending-energy computation
-        - bending-energy gradient computation
-
-        - Jacobian-based penalty term computation from CPP
-        - Jacobian-based gradient computation from CPP
-        - Folding correction from CPP
-        - Approximated Jacobian-based penalty term computation from CPP
-        - Approximated Jacobian-based gradient computation from CPP
-        - Approximated Folding correction from CPP
-   */
-
-   // AFFINE DEFORMATION FIELD CREATION
+   image->nt=image->nu=image->nv=image->nw=1;
+   image->dt=image->du=image->dv=image->dw=1.f;
+   image->qform_code=1;
+   image->sform_code=0;
+   image->qto_xyz=nifti_quatern_to_mat44(0.f, 0.f, 0.f, 0.f, 0.f, 0.f,
+                                        1.f, 1.f, 1.f, 1.f);
+   image->qto_ijk=nifti_mat44_inverse(image->qto_xyz);
+   float *imagePtr=static_cast<float *>(image->data);
+   const float frequency=2.f*(float)M_PI/(float)size;
+   const float centre=0.5f*(float)(size-1);
+   size_t index=0;
+   for(int z=0; z<size; ++z)
    {
-      maxIt=500000 / dimension;
-//        maxIt=1;
-      mat44 *affineTransformation = (mat44 *)calloc(1,sizeof(mat44));
-      affineTransformation->m[0][0]=1.0;
-      affineTransformation->m[1][1]=1.0;
-      affineTransformation->m[2][2]=1.0;
-      affineTransformation->m[3][3]=1.0;
-      if(reg_bspline_initialiseControlPointGridWithAffine(affineTransformation, controlPointImage))
-         return 1;
-
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      for(int y=0; y<size; ++y)
       {
-         reg_affine_positionField(   affineTransformation,
-                                     targetImage,
-                                     deformationFieldImage);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf( "CPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
+         for(int x=0; x<size; ++x)
          {
-            reg_affine_positionField_gpu(   affineTransformation,
-                                            targetImage,
-                                            &deformationFieldImageArray_d);
+            // A shifted pattern with a central sphere mimics a misaligned floating image
+            const float px=(float)x+shift, py=(float)y-0.5f*shift, pz=(float)z+0.25f*shift;
+            float value=100.f +
+                        30.f*sinf(2.f*frequency*px)*cosf(3.f*frequency*py) +
+                        20.f*sinf(5.f*frequency*pz);
+            if(reg_pow2(px-centre)+reg_pow2(py-centre)+reg_pow2(pz-centre) < reg_pow2(0.3f*(float)size))
+               value += 60.f;
+            imagePtr[index++]=value;
          }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i affine deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Affine deformation field ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Affine deformation field ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
       }
-#endif
-      printf("Affine deformation done\n\n");
    }
-
-   // SPLINE DEFORMATION FIELD CREATION
-#ifdef _USE_CUDA
-   float4 *controlPointImageArray_d;
-   if(runGPU)
+   return image;
+}
+/* *************************************************************** */
+/// @brief Create a vector image defined on the reference space, as in reg_base
+static nifti_image *CreateVectorImage(nifti_image *reference)
+{
+   nifti_image *image=nifti_copy_nim_info(reference);
+   image->dim[0]=image->ndim=5;
+   image->dim[4]=image->nt=1;
+   image->dim[5]=image->nu=reference->nz>1?3:2;
+   image->nvox=(size_t)image->nx*image->ny*image->nz*image->nu;
+   image->datatype=NIFTI_TYPE_FLOAT32;
+   image->nbyper=sizeof(float);
+   image->data=(void *)calloc(image->nvox, image->nbyper);
+   image->intent_code=NIFTI_INTENT_VECTOR;
+   memset(image->intent_name, 0, 16);
+   strcpy(image->intent_name,"NREG_TRANS");
+   image->intent_p1=DEF_FIELD;
+   return image;
+}
+/* *************************************************************** */
+static nifti_image *CopyImage(nifti_image *image)
+{
+   nifti_image *copy=nifti_copy_nim_info(image);
+   copy->data=(void *)malloc(copy->nvox*copy->nbyper);
+   memcpy(copy->data, image->data, copy->nvox*copy->nbyper);
+   return copy;
+}
+/* *************************************************************** */
+/// @brief InitialiseMeasure is not virtual and is called on the derived class
+template <class MEASURE>
+static void InitialiseMeasure(MEASURE *measure, DATA *d)
+{
+   measure->SetTimepointWeight(0, 1.0);
+   measure->InitialiseMeasure(d->reference,
+                              d->floating,
+                              d->mask,
+                              d->warped,
+                              d->warpedGradient,
+                              d->voxelBasedGradient,
+                              NULL);
+}
+/* *************************************************************** */
+static void InitialiseData(DATA *d, int size, float spacing, int binning)
+{
+   d->reference=CreatePhantom(size, 0.f);
+   d->floating=CreatePhantom(size, 1.5f);
+   d->warped=CopyImage(d->reference);
+   d->smoothedImage=CopyImage(d->reference);
+   d->mask=(int *)calloc(d->reference->nvox, sizeof(int));
+   d->deformationField=CreateVectorImage(d->reference);
+   d->warpedGradient=CreateVectorImage(d->reference);
+   d->voxelBasedGradient=CreateVectorImage(d->reference);
+
+   // The control point grid is a random perturbation of an identity transformation
+   float gridSpacing[3]= {spacing, spacing, spacing};
+   d->controlPointGrid=NULL;
+   reg_createControlPointGrid<float>(&d->controlPointGrid, d->reference, gridSpacing);
+   float *gridPtr=static_cast<float *>(d->controlPointGrid->data);
+   srand(0);
+   for(size_t i=0; i<d->controlPointGrid->nvox; ++i)
+      gridPtr[i]=0.2f*spacing*((float)rand()/(float)RAND_MAX-0.5f);
+   d->controlPointGrid->intent_p1=DISP_FIELD;
+   reg_getDeformationFromDisplacement(d->controlPointGrid);
+   d->controlPointGrid->intent_p1=CUB_SPLINE_GRID;
+   d->nodeGradient=CopyImage(d->controlPointGrid);
+   memset(d->nodeGradient->data, 0, d->nodeGradient->nvox*d->nodeGradient->nbyper);
+   reg_spline_getDeformationField(d->controlPointGrid, d->deformationField, d->mask, false, true);
+
+   // The NMI rescales the input intensities and is thus initialised first
+   d->nmi=new reg_nmi();
+   d->ssd=new reg_ssd();
+   d->lncc=new reg_lncc();
+   d->kld=new reg_kld();
+   d->nmi->SetRefAndFloatBinNumbers(binning, binning, 0);
+   InitialiseMeasure(d->nmi, d);
+   InitialiseMeasure(d->ssd, d);
+   InitialiseMeasure(d->lncc, d);
+   InitialiseMeasure(d->kld, d);
+   reg_resampleImage(d->floating, d->warped, d->deformationField, d->mask, 1, 0.f);
+   reg_getImageGradient(d->floating, d->warpedGradient, d->deformationField, d->mask, 1, 0.f, 0);
+   // Some gradients depend on statistics computed along with the values
+   reg_measure *measures[4]= {d->nmi, d->ssd, d->lncc, d->kld};
+   for(int m=0; m<4; ++m)
+      measures[m]->GetSimilarityMeasureValue();
+
+   // The block matching uses the default parameters of reg_aladin
+   d->blockMatchingParams=new _reg_blockMatchingParam();
+   initialise_block_matching_method(d->reference, d->blockMatchingParams, 50, 50, 1, d->mask);
+   block_matching_method(d->reference, d->warped, d->blockMatchingParams, d->mask);
+   reg_mat44_eye(&d->transformation);
+}
+/* *************************************************************** */
+static void ClearData(DATA *d)
+{
+   delete d->blockMatchingParams;
+   delete d->nmi;
+   delete d->ssd;
+   delete d->lncc;
+   delete d->kld;
+   nifti_image_free(d->reference);
+   nifti_image_free(d->floating);
+   nifti_image_free(d->warped);
+   nifti_image_free(d->smoothedImage);
+   nifti_image_free(d->deformationField);
+   nifti_image_free(d->warpedGradient);
+   nifti_image_free(d->voxelBasedGradient);
+   nifti_image_free(d->controlPointGrid);
+   nifti_image_free(d->nodeGradient);
+   free(d->mask);
+}
+/* *************************************************************** */
+/// @brief Time a kernel and compute the statistics of its durations in milliseconds
+static void TimeKernel(const KERNEL &kernel, DATA *d, int repetition, RESULT &result)
+{
+   // A first call is performed to exclude any allocation or cache effect
+   kernel.function(d);
+   std::vector<double> durations(repetition);
+   for(int r=0; r<repetition; ++r)
    {
-      if(cudaCommon_allocateArrayToDevice<float4>(&controlPointImageArray_d, controlPointImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float4>(&controlPointImageArray_d,controlPointImage)) return 1;
+      double start=reg_timer_getTime();
+      kernel.function(d);
+      durations[r]=1.e-3*(reg_timer_getTime()-start);
    }
-#endif
+   std::sort(durations.begin(), durations.end());
+   result.kernel=kernel.name;
+   result.minimum=durations[0];
+   result.median=repetition%2==1?durations[repetition/2]:
+                 0.5*(durations[repetition/2-1]+durations[repetition/2]);
+   double mean=0;
+   for(int r=0; r<repetition; ++r)
+      mean += durations[r];
+   mean /= (double)repetition;
+   result.variance=0;
+   for(int r=0; r<repetition; ++r)
+      result.variance += reg_pow2(durations[r]-mean);
+   result.variance = repetition>1?result.variance/(double)(repetition-1):0.;
+}
+/* *************************************************************** */
+/// @brief Parse a comma separated list of positive integers
+static bool ParseList(const char *text, std::vector<int> &values)
+{
+   values.clear();
+   std::string list(text);
+   size_t start=0;
+   while(start<=list.size())
    {
-      maxIt=50000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_bspline<float>( controlPointImage,
-                             targetImage,
-                             deformationFieldImage,
-                             maskImage,
-                             0);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_gpu(controlPointImage,
-                            targetImage,
-                            &controlPointImageArray_d,
-                            &deformationFieldImageArray_d,
-                            &targetMask_d,
-                            targetImage->nvox);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i spline deformation field computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Spline deformation field ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Spline deformation field ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("Spline deformation done\n\n");
+      size_t end=list.find(',', start);
+      if(end==std::string::npos) end=list.size();
+      int value=atoi(list.substr(start, end-start).c_str());
+      if(value<1) return false;
+      values.push_back(value);
+      start=end+1;
    }
-
-   // SCALING-AND-SQUARING APPROACH
-#ifdef _USE_CUDA
-   float4 *velocityFieldImageArray_d;
-   if(runGPU)
+   return !values.empty();
+}
+/* *************************************************************** */
+static void WriteResults(FILE *file, const std::vector<RESULT> &results, int repetition, bool csv)
+{
+   if(csv)
    {
-      if(cudaCommon_allocateArrayToDevice<float4>(&velocityFieldImageArray_d, velocityFieldImage->dim)) return 1;
-      if(cudaCommon_transferNiftiToArrayOnDevice<float4>(&velocityFieldImageArray_d,velocityFieldImage)) return 1;
+      fprintf(file, "kernel,size,threads,median_ms,variance_ms2,min_ms\n");
+      for(size_t i=0; i<results.size(); ++i)
+         fprintf(file, "%s,%i,%i,%.6g,%.6g,%.6g\n",
+                 results[i].kernel.c_str(), results[i].size, results[i].threads,
+                 results[i].median, results[i].variance, results[i].minimum);
+      return;
    }
-#endif
+   fprintf(file, "{\n  \"version\": \"%s\",\n  \"repetitions\": %i,\n  \"results\": [", NR_VERSION, repetition);
+   for(size_t i=0; i<results.size(); ++i)
    {
-      maxIt=20000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_spline_scaling_squaring(velocityFieldImage,
-                                     controlPointImage);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i scaling-and-squaring - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i scaling-and-squarings - %i min %i sec\n", maxIt, minutes, seconds);
-      time(&start);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_spline_scaling_squaring_gpu(velocityFieldImage,
-                                            controlPointImage,
-                                            &velocityFieldImageArray_d,
-                                            &controlPointImageArray_d);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i scaling-and-squaring - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i scaling-and-squarings - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Scaling-and-squarings ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Scaling-and-squarings ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("scaling-and-squarings done\n\n");
+      fprintf(file, "%s\n    {\"kernel\": \"%s\", \"size\": %i, \"threads\": %i, "
+              "\"median_ms\": %.6g, \"variance_ms2\": %.6g, \"min_ms\": %.6g}",
+              i==0?"":",",
+              results[i].kernel.c_str(), results[i].size, results[i].threads,
+              results[i].median, results[i].variance, results[i].minimum);
    }
-
-   // LINEAR INTERPOLATION
-#ifdef _USE_CUDA
-   float *resultImageArray_d;
-   if(runGPU)
-      if(cudaCommon_allocateArrayToDevice<float>(&resultImageArray_d, targetImage->dim)) return 1;
+   fprintf(file, "\n  ]\n}\n");
+}
+/* *************************************************************** */
+/* *************************************************************** */
+void Usage(char *exec)
+{
+   printf("\n");
+   printf("Usage:\t%s [OPTIONS]\n", exec);
+   printf("\tTime the main registration kernels on generated 3D phantoms.\n");
+   printf("\tOne line of statistics is reported per kernel, image size and thread number.\n");
+   printf("* * OPTIONS * *\n");
+   printf("\t-dim <int,...>\tComma separated sizes of the cubic images [64,128]\n");
+   printf("\t-sp <float>\tControl point spacing in voxel [5]\n");
+   printf("\t-bin <int>\tNumber of histogram bins used by the NMI [68]\n");
+#if defined (_OPENMP)
+   printf("\t-omp <int,...>\tComma separated numbers of thread [1,%i]\n", omp_get_num_procs());
 #endif
-   {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_resampleSourceImage<float>( targetImage,
-                                         sourceImage,
-                                         resultImage,
-                                         deformationFieldImage,
-                                         maskImage,
-                                         1,
-                                         0);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_resampleSourceImage_gpu(resultImage,
-                                        sourceImage,
-                                        &resultImageArray_d,
-                                        &sourceImageArray_d,
-                                        &deformationFieldImageArray_d,
-                                        &targetMask_d,
-                                        targetImage->nvox,
-                                        0);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i linear interpolation computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Linear interpolation ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Linear interpolation ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
+   printf("\t-rep <int>\tNumber of timed repetitions per kernel [7]\n");
+   printf("\t-k <string>\tOnly time the kernels whose name contains the string\n");
+   printf("\t-csv\t\tReport the results as CSV instead of JSON\n");
+   printf("\t-o <filename>\tFilename of the report [stdout]\n");
+   printf("\t-list\t\tList the kernel names and exit\n");
+   printf("\t--version\tPrint current version and exit (%s)\n", NR_VERSION);
+   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
+   return;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   std::vector<int> sizes;
+   sizes.push_back(64);
+   sizes.push_back(128);
+   std::vector<int> threads(1, 1);
+#if defined (_OPENMP)
+   if(omp_get_num_procs()>1)
+      threads.push_back(omp_get_num_procs());
 #endif
-      printf("Linear interpolation done\n\n");
-   }
+   float spacing=5.f;
+   int binning=68;
+   int repetition=7;
+   const char *filter=NULL;
+   const char *outputFileName=NULL;
+   bool csv=false;
 
-   // SPATIAL GRADIENT COMPUTATION
-#ifdef _USE_CUDA
-   float4 *resultGradientArray_d;
-   CUDA_SAFE_CALL(cudaMalloc((void **)&resultGradientArray_d, targetImage->nvox*sizeof(float4)));
-#endif
+   for(int i=1; i<argc; i++)
    {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      if(strcmp(argv[i], "-help")==0 || strcmp(argv[i], "-Help")==0 ||
+            strcmp(argv[i], "-HELP")==0 || strcmp(argv[i], "-h")==0 ||
+            strcmp(argv[i], "--h")==0 || strcmp(argv[i], "--help")==0)
       {
-         reg_getSourceImageGradient<float>(  targetImage,
-                                             sourceImage,
-                                             resultGradientImage,
-                                             deformationFieldImage,
-                                             maskImage,
-                                             1);
+         Usage(argv[0]);
+         return EXIT_SUCCESS;
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "--version")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_getSourceImageGradient_gpu( targetImage,
-                                            sourceImage,
-                                            &sourceImageArray_d,
-                                            &deformationFieldImageArray_d,
-                                            &resultGradientArray_d,
-                                            targetImage->nvox);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i spatial gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Spatial gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Spatial gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-         cudaCommon_free( &sourceImageArray_d );
+         printf("%s\n",NR_VERSION);
+         return EXIT_SUCCESS;
       }
-#endif
-      printf("Spatial gradient done\n\n");
-   }
-   nifti_image_free(sourceImage);
-
-#ifdef _USE_CUDA
-   if(runGPU)
-   {
-      cudaCommon_free( (void **)&deformationFieldImageArray_d );
-   }
-#endif
-
-   // JOINT HISTOGRAM COMPUTATION
-   double entropies[4];
-   {
-      reg_getEntropies<double>(   targetImage,
-                                  resultImage,
-                                  2,
-                                  &binning,
-                                  &binning,
-                                  probaJointHistogram,
-                                  logJointHistogram,
-                                  entropies,
-                                  maskImage);
-   }
-
-   // VOXEL-BASED NMI GRADIENT COMPUTATION
-#ifdef _USE_CUDA
-   float4 *voxelNMIGradientArray_d;
-   if(runGPU)
-   {
-      if(cudaCommon_allocateArrayToDevice(&voxelNMIGradientArray_d, resultImage->dim)) return 1;
-   }
-#endif
-   {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-list")==0)
       {
-         reg_getVoxelBasedNMIGradientUsingPW<double>(targetImage,
-               resultImage,
-               2,
-               resultGradientImage,
-               &binning,
-               &binning,
-               logJointHistogram,
-               entropies,
-               voxelNMIGradientImage,
-               maskImage);
+         for(size_t k=0; k<kernelNumber; ++k)
+            printf("%s\n", kernelList[k].name);
+         return EXIT_SUCCESS;
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      float *logJointHistogram_d;
-      if(runGPU)
+      else if(strcmp(argv[i], "-dim")==0 && i+1<argc)
       {
-         CUDA_SAFE_CALL(cudaMalloc((void **)&logJointHistogram_d, binning*(binning+2)*sizeof(float)));
-         float *tempB=(float *)malloc(binning*(binning+2)*sizeof(float));
-         for(int i=0; i<binning*(binning+2); i++)
-         {
-            tempB[i]=(float)logJointHistogram[i];
-         }
-         CUDA_SAFE_CALL(cudaMemcpy(logJointHistogram_d, tempB, binning*(binning+2)*sizeof(float), cudaMemcpyHostToDevice));
-         free(tempB);
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
+         if(!ParseList(argv[++i], sizes))
          {
-            reg_getVoxelBasedNMIGradientUsingPW_gpu(targetImage,
-                                                    resultImage,
-                                                    &targetImageArray_d,
-                                                    &resultImageArray_d,
-                                                    &resultGradientArray_d,
-                                                    &logJointHistogram_d,
-                                                    &voxelNMIGradientArray_d,
-                                                    &targetMask_d,
-                                                    targetImage->nvox,
-                                                    entropies,
-                                                    binning);
+            reg_print_msg_error("The image sizes are expected to be positive integers");
+            return EXIT_FAILURE;
          }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i voxel-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Voxel-based NMI gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Voxel-based NMI gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-         cudaCommon_free((void **)&logJointHistogram_d);
       }
-      CUDA_SAFE_CALL(cudaFree(targetMask_d));
-#endif
-      printf("Voxel-based NMI gradient done\n\n");
-   }
-
-#ifdef _USE_CUDA
-   if(runGPU)
-   {
-      cudaCommon_free((void **)&resultGradientArray_d);
-   }
-#endif
-
-   // NODE-BASED NMI GRADIENT COMPUTATION
-#ifdef _USE_CUDA
-   float4 *nodeNMIGradientArray_d;
-   if(runGPU)
-   {
-      if(cudaCommon_allocateArrayToDevice(&nodeNMIGradientArray_d, controlPointImage->dim)) return 1;
-   }
-#endif
-   {
-      maxIt=10000 / dimension;
-//        maxIt=1;
-      int smoothingRadius[3];
-      smoothingRadius[0] = (int)floor( 2.0*controlPointImage->dx/targetImage->dx );
-      smoothingRadius[1] = (int)floor( 2.0*controlPointImage->dy/targetImage->dy );
-      smoothingRadius[2] = (int)floor( 2.0*controlPointImage->dz/targetImage->dz );
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-sp")==0 && i+1<argc)
       {
-         reg_smoothImageForCubicSpline<float>(voxelNMIGradientImage,smoothingRadius);
-         reg_voxelCentric2NodeCentric(nodeNMIGradientImage,voxelNMIGradientImage,1.0f);
+         spacing=atof(argv[++i]);
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_smoothImageForCubicSpline_gpu(  resultImage,
-                                                &voxelNMIGradientArray_d,
-                                                smoothingRadius);
-            reg_voxelCentric2NodeCentric_gpu(   targetImage,
-                                                controlPointImage,
-                                                &voxelNMIGradientArray_d,
-                                                &nodeNMIGradientArray_d,
-                                                1.0f);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i node-based NMI gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Node-based NMI gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Node-based NMI gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("Node-based NMI gradient done\n\n");
-   }
-
-#ifdef _USE_CUDA
-   if(runGPU)
-   {
-      cudaCommon_free((void **)&voxelNMIGradientArray_d);
-      cudaCommon_free((void **)&nodeNMIGradientArray_d);
-   }
-#endif
-
-   // APPROXIMATED BENDING ENERGY PENALTY TERM COMPUTATION
-   {
-      maxIt=100000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-bin")==0 && i+1<argc)
       {
-         reg_bspline_bendingEnergy<float>(controlPointImage, targetImage,1);
+         binning=atoi(argv[++i]);
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-omp")==0 && i+1<argc)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
+         if(!ParseList(argv[++i], threads))
          {
-            reg_bspline_ApproxBendingEnergy_gpu(controlPointImage,
-                                                &controlPointImageArray_d);
+            reg_print_msg_error("The thread numbers are expected to be positive integers");
+            return EXIT_FAILURE;
          }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i BE computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("BE  ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "BE  ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-      }
-#endif
-      printf("BE done\n\n");
-   }
-
-   // APPROXIMATED BENDING ENERGY GRADIENT COMPUTATION
-   {
-      maxIt=1000000 / dimension;
-//        maxIt=1;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         reg_bspline_bendingEnergyGradient<float>(   controlPointImage,
-               targetImage,
-               nodeNMIGradientImage,
-               0.01f);
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-rep")==0 && i+1<argc)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ApproxBendingEnergyGradient_gpu(targetImage,
-                  controlPointImage,
-                  &controlPointImageArray_d,
-                  &nodeNMIGradientArray_d,
-                  0.01f);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i BE gradient computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("BE gradient ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "BE gradient ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
+         repetition=atoi(argv[++i]);
       }
-#endif
-      printf("BE gradient done\n\n");
-   }
-
-   // JACOBIAN DETERMINANT PENALTY TERM COMPUTATION
-   {
-      maxIt=10000 / dimension;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-k")==0 && i+1<argc)
       {
-         reg_bspline_jacobian<float>(controlPointImage,targetImage,0);
+         filter=argv[++i];
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else if(strcmp(argv[i], "-csv")==0)
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ComputeJacobianPenaltyTerm_gpu(targetImage,controlPointImage,&controlPointImageArray_d,0);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("|Jac| penalty term ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "|Jac| penalty term ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
+         csv=true;
       }
-#endif
-      printf("|Jac| penalty term done\n\n");
-   }
-
-   // APPROXIMATED JACOBIAN DETERMINANT PENALTY TERM COMPUTATION
-   {
-      maxIt=1000000 / dimension;
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
+      else if(strcmp(argv[i], "-o")==0 && i+1<argc)
       {
-         reg_bspline_jacobian<float>(controlPointImage,targetImage,1);
+         outputFileName=argv[++i];
       }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
+      else
       {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
-         {
-            reg_bspline_ComputeJacobianPenaltyTerm_gpu(targetImage,controlPointImage,&controlPointImageArray_d,1);
-         }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i Approx. |Jac| penalty term computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Approx. |Jac| penalty term ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Approx. |Jac| penalty term ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
+         char text[255];
+         sprintf(text,"Err:\tParameter %s unknown.",argv[i]);
+         reg_print_msg_error(text);
+         Usage(argv[0]);
+         return EXIT_FAILURE;
       }
-#endif
-      printf("Approx. |Jac| penalty term done\n\n");
    }
-
-#ifdef _USE_CUDA
-   if(runGPU)
+   if(repetition<1 || spacing<=0.f || binning<8)
    {
-      cudaCommon_free( (void **)&controlPointImageArray_d );
+      reg_print_msg_error("The repetition number, spacing or bin number is invalid");
+      return EXIT_FAILURE;
    }
+#if !defined (_OPENMP)
+   if(threads.size()>1 || threads[0]>1)
+      reg_print_msg_warn("NiftyReg has not been compiled with OpenMP, the \'-omp\' flag is ignored");
+   threads.assign(1, 1);
 #endif
 
-   // BLOCK MATCHING
+   std::vector<RESULT> results;
+   for(size_t s=0; s<sizes.size(); ++s)
    {
-      maxIt=2000 / dimension;
-//        maxIt=1;
-      _reg_blockMatchingParam blockMatchingParams;
-      initialise_block_matching_method(   targetImage,
-                                          &blockMatchingParams,
-                                          100,    // percentage of block kept
-                                          50,     // percentage of inlier in the optimisation process
-                                          maskImage);
-#ifdef _USE_CUDA
-      int *activeBlock_d;
-      float *targetPosition_d;
-      float *resultPosition_d;
-      if(runGPU)
+      DATA data;
+      InitialiseData(&data, sizes[s], spacing, binning);
+      for(size_t t=0; t<threads.size(); ++t)
       {
-         CUDA_SAFE_CALL(cudaMalloc((void **)&activeBlock_d,
-                                   blockMatchingParams.blockNumber[0]*blockMatchingParams.blockNumber[1]*blockMatchingParams.blockNumber[2]*sizeof(int)));
-         CUDA_SAFE_CALL(cudaMemcpy(activeBlock_d, blockMatchingParams.activeBlock,
-                                   blockMatchingParams.blockNumber[0]*blockMatchingParams.blockNumber[1]*blockMatchingParams.blockNumber[2]*sizeof(int),
-                                   cudaMemcpyHostToDevice));
-         CUDA_SAFE_CALL(cudaMalloc((void **)&targetPosition_d, blockMatchingParams.activeBlockNumber*3*sizeof(float)));
-         CUDA_SAFE_CALL(cudaMalloc((void **)&resultPosition_d, blockMatchingParams.activeBlockNumber*3*sizeof(float)));
-      }
+#if defined (_OPENMP)
+         omp_set_num_threads(threads[t]);
 #endif
-      time(&start);
-      for(int i=0; i<maxIt; ++i)
-      {
-         block_matching_method<float>(   targetImage,
-                                         resultImage,
-                                         &blockMatchingParams,
-                                         maskImage);
-      }
-      time(&end);
-      cpuTime=(end-start);
-      minutes = (int)floorf(float(cpuTime)/60.0f);
-      seconds = (int)(cpuTime - 60*minutes);
-      printf("CPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-      fprintf(outputFile, "CPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-#ifdef _USE_CUDA
-      if(runGPU)
-      {
-         time(&start);
-         for(int i=0; i<maxIt; ++i)
+         for(size_t k=0; k<kernelNumber; ++k)
          {
-            block_matching_method_gpu(  targetImage,
-                                        resultImage,
-                                        &blockMatchingParams,
-                                        &targetImageArray_d,
-                                        &resultImageArray_d,
-                                        &targetPosition_d,
-                                        &resultPosition_d,
-                                        &activeBlock_d);
+            if(filter!=NULL && strstr(kernelList[k].name, filter)==NULL)
+               continue;
+            RESULT result;
+            TimeKernel(kernelList[k], &data, repetition, result);
+            result.size=sizes[s];
+            result.threads=threads[t];
+            results.push_back(result);
+            // The progress is only displayed when the report is not printed out
+            if(outputFileName==NULL)
+               continue;
+            char text[255];
+            sprintf(text, "%s - size %i - %i thread(s) - median %g ms",
+                    result.kernel.c_str(), result.size, result.threads, result.median);
+            reg_print_info(argv[0], text);
          }
-         time(&end);
-         gpuTime=(end-start);
-         minutes = (int)floorf(float(gpuTime)/60.0f);
-         seconds = (int)(gpuTime - 60*minutes);
-         printf("GPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-         fprintf(outputFile, "GPU - %i block matching computations - %i min %i sec\n", maxIt, minutes, seconds);
-         printf("Block-Matching ratio - %g time(s)\n", (float)cpuTime/(float)gpuTime);
-         fprintf(outputFile, "Block-Matching ratio - %g time(s)\n\n", (float)cpuTime/(float)gpuTime);
-         cudaCommon_free((void **)&targetPosition_d);
-         cudaCommon_free((void **)&resultPosition_d);
-         cudaCommon_free((void **)&activeBlock_d);
       }
-#endif
-      printf("Block-matching done\n");
+      ClearData(&data);
    }
 
-   fclose(outputFile);
-
-   /* Monsieur Propre */
-   nifti_image_free(targetImage);
-   nifti_image_free(resultImage);
-   nifti_image_free(controlPointImage);
-   nifti_image_free(deformationFieldImage);
-   nifti_image_free(resultGradientImage);
-   nifti_image_free(voxelNMIGradientImage);
-   nifti_image_free(nodeNMIGradientImage);
-   free(maskImage);
-   free(probaJointHistogram);
-   free(logJointHistogram);
-
-#ifdef _USE_CUDA
-   if(runGPU)
+   FILE *outputFile=stdout;
+   if(outputFileName!=NULL)
    {
-      cudaCommon_free( (void **)&targetImageArray_d );
-      cudaCommon_free( (void **)&resultImageArray_d );
+      outputFile=fopen(outputFileName, "w");
+      if(outputFile==NULL)
+      {
+         reg_print_msg_error("The output file can not be written:");
+         reg_print_msg_error(outputFileName);
+         return EXIT_FAILURE;
+      }
    }
-#endif
-
-   return 0;
-}
-
-void Usage(char *exec)
-{
-   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
-   printf("Usage:\t%s [OPTIONS].\n",exec);
-   printf("\t-dim <int>\tImage dimension [100]\n");
-   printf("\t-bin <int>\tBin number [68]\n");
-   printf("\t-sp <float>\tControl point grid spacing [10]\n");
-   printf("\t-o <char*>\t Output file name [benchmark_result.txt]\n");
-   printf("\t-cpu\t\t Run only the CPU function\n");
-   printf("* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\n");
-   return;
+   WriteResults(outputFile, results, repetition, csv);
+   if(outputFile!=stdout)
+      fclose(outputFile);
+   return EXIT_SUCCESS;
 }
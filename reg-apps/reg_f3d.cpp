@@ -10,6 +10,7 @@
  */
 
 #include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteAsync.h"
 #include "_reg_ReadWriteMatrix.h"
 #include "_reg_f3d2.h"
 #include "reg_f3d.h"
@@ -95,6 +96,7 @@ void Usage(char *exec)
    reg_print_info(exec, "\t-fbn <tp> <int>\t\tNMI. Number of bin to use for the floating image histogram for the specified time point");
    reg_print_info(exec, "\t--lncc <float>\t\tLNCC. Standard deviation of the Gaussian kernel. Identical value for every timepoint");
    reg_print_info(exec, "\t-lncc <tp> <float>\tLNCC. Standard deviation of the Gaussian kernel for the specified timepoint");
+   reg_print_info(exec, "\t-lnccIIR\t\tLNCC. Use a recursive approximation of the Gaussian kernel, faster for large kernels");
    reg_print_info(exec, "\t--ssd \t\t\tSSD. Used for all time points - images are normalized between 0 and 1 before computing the measure");
    reg_print_info(exec, "\t-ssd <tp> \t\tSSD. Used for the specified timepoint - images are normalized between 0 and 1 before computing the measure");
    reg_print_info(exec, "\t--ssdn \t\t\tSSD. Used for all time points - images are NOT normalized between 0 and 1 before computing the measure");
@@ -160,8 +162,13 @@ void Usage(char *exec)
    reg_print_info(exec, "");
    reg_print_info(exec, "*** Other options:");
    reg_print_info(exec, "\t-smoothGrad <float>\tTo smooth the metric derivative (in mm) [0]");
+   reg_print_info(exec, "\t-smoothGradIIR\t\tTo smooth the metric derivative with a recursive approximation of the Gaussian kernel");
    reg_print_info(exec, "\t-pad <float>\t\tPadding value [nan]");
    reg_print_info(exec, "\t-voff\t\t\tTo turn verbose off");
+   reg_print_info(exec, "\t-mem\t\t\tPrint the estimated peak memory usage in MB and exit");
+   reg_print_info(exec, "\t\t\t\tOnly the headers of the input images are read");
+   reg_print_info(exec, "\t-timing\t\t\tPrint the duration of the registration stages of every level");
+   reg_print_info(exec, "\t-trace <filename>\tSave the timed registration stages as a Chrome trace-event file");
    reg_print_info(exec, "\t--version\t\tPrint current version and exit");
    sprintf(text, "\t\t\t\t(%s)",NR_VERSION);
    reg_print_info(exec, text);
@@ -169,6 +176,16 @@ void Usage(char *exec)
    return;
 }
 
+nifti_image *ReadInputImage(reg_io_AsyncReader &reader,
+                            const char *filename,
+                            bool headerOnly)
+{
+   // Only the header is required to estimate the memory usage
+   if(headerOnly)
+      return reg_io_ReadImageHeader(filename);
+   return reader.Get(filename);
+}
+
 int main(int argc, char **argv)
 {
    if(argc==1)
@@ -179,6 +196,8 @@ int main(int argc, char **argv)
    time_t start;
    time(&start);
    int verbose=true;
+   bool checkMemory=false;
+   char *traceFileName=NULL;
 
 #if defined (_OPENMP)
    // Set the default number of thread
@@ -234,6 +253,12 @@ int main(int argc, char **argv)
          printf("%s\n",NR_VERSION);
          return EXIT_SUCCESS;
       }
+      if(strcmp(argv[i], "-mem")==0 || strcmp(argv[i], "--mem")==0)
+      {
+         // Only the estimated memory usage is printed out
+         checkMemory=true;
+         verbose=false;
+      }
    }
    //\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/
    // Output the command line
@@ -253,6 +278,21 @@ int main(int argc, char **argv)
    }
 #endif
 
+   //\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/
+   // All the input images are read concurrently in the background
+   reg_io_AsyncReader imageReader;
+   for(int i=1; i<argc-1 && !checkMemory; i++)
+   {
+      if(strcmp(argv[i],"-ref")==0 || strcmp(argv[i],"-target")==0 || strcmp(argv[i],"--ref")==0 ||
+         strcmp(argv[i],"-flo")==0 || strcmp(argv[i],"-source")==0 || strcmp(argv[i],"--flo")==0 ||
+         strcmp(argv[i],"-incpp")==0 || strcmp(argv[i],"--incpp")==0 ||
+         strcmp(argv[i],"-rmask")==0 || strcmp(argv[i],"-tmask")==0 || strcmp(argv[i],"--rmask")==0 ||
+         strcmp(argv[i],"-fmask")==0 || strcmp(argv[i],"-smask")==0 ||
+         strcmp(argv[i],"--fmask")==0 || strcmp(argv[i],"--smask")==0 ||
+         strcmp(argv[i],"-wSim")==0 || strcmp(argv[i],"--wSim")==0)
+         imageReader.Request(argv[++i]);
+   }
+
    //\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/
    // Read the reference and floating image
    nifti_image *referenceImage=NULL;
@@ -261,7 +301,7 @@ int main(int argc, char **argv)
    {
       if((strcmp(argv[i],"-ref")==0) || (strcmp(argv[i],"-target")==0) || (strcmp(argv[i],"--ref")==0))
       {
-         referenceImage=reg_io_ReadImageFile(argv[++i]);
+         referenceImage=ReadInputImage(imageReader, argv[++i], checkMemory);
          if(referenceImage==NULL)
          {
             reg_print_msg_error("Error when reading the reference image:");
@@ -271,7 +311,7 @@ int main(int argc, char **argv)
       }
       if((strcmp(argv[i],"-flo")==0) || (strcmp(argv[i],"-source")==0) || (strcmp(argv[i],"--flo")==0))
       {
-         floatingImage=reg_io_ReadImageFile(argv[++i]);
+         floatingImage=ReadInputImage(imageReader, argv[++i], checkMemory);
          if(floatingImage==NULL)
          {
             reg_print_msg_error("Error when reading the floating image:");
@@ -326,6 +366,7 @@ int main(int argc, char **argv)
    char *outputWarpedImageName=NULL;
    char *outputCPPImageName=NULL;
    bool useMeanLNCC=false;
+   bool useIIRLNCC=false;
    int refBinNumber=0;
    int floBinNumber=0;
 
@@ -366,7 +407,7 @@ int main(int argc, char **argv)
       }
       else if(strcmp(argv[i], "-incpp")==0 || (strcmp(argv[i],"--incpp")==0))
       {
-         inputCCPImage=reg_io_ReadImageFile(argv[++i]);
+         inputCCPImage=ReadInputImage(imageReader, argv[++i], checkMemory);
          if(inputCCPImage==NULL)
          {
             reg_print_msg_error("Error when reading the input control point grid image:");
@@ -377,7 +418,7 @@ int main(int argc, char **argv)
       }
       else if((strcmp(argv[i],"-rmask")==0) || (strcmp(argv[i],"-tmask")==0) || (strcmp(argv[i],"--rmask")==0))
       {
-         referenceMaskImage=reg_io_ReadImageFile(argv[++i]);
+         referenceMaskImage=ReadInputImage(imageReader, argv[++i], checkMemory);
          if(referenceMaskImage==NULL)
          {
             reg_print_msg_error("Error when reading the reference mask image:");
@@ -585,6 +626,10 @@ int main(int argc, char **argv)
       {
          REG->SetGradientSmoothingSigma(atof(argv[++i]));
       }
+      else if(strcmp(argv[i], "-smoothGradIIR")==0)
+      {
+         REG->SetGradientSmoothingKernelType(IIR_GAUSSIAN_KERNEL);
+      }
       else if(strcmp(argv[i], "-ssd")==0)
       {
          int timepoint = atoi(argv[++i]);
@@ -662,6 +707,10 @@ int main(int argc, char **argv)
       {
          useMeanLNCC=true;
       }
+      else if(strcmp(argv[i], "-lnccIIR")==0)
+      {
+         useIIRLNCC=true;
+      }
       else if(strcmp(argv[i], "-dti")==0 || strcmp(argv[i], "--dti")==0)
       {
          bool *timePoint = new bool[referenceImage->nt];
@@ -705,7 +754,7 @@ int main(int argc, char **argv)
       }
       else if(strcmp(argv[i], "-wSim") == 0 || strcmp(argv[i], "--wSim") == 0)
       {
-         refLocalWeightSim = reg_io_ReadImageFile(argv[++i]);
+         refLocalWeightSim = ReadInputImage(imageReader, argv[++i], checkMemory);
          REG->SetLocalWeightSim(refLocalWeightSim);
       }
       else if (strcmp(argv[i], "-pad") == 0 || strcmp(argv[i], "--pad") == 0)
@@ -743,7 +792,7 @@ int main(int argc, char **argv)
       else if((strcmp(argv[i],"-fmask")==0) || (strcmp(argv[i],"-smask")==0) ||
               (strcmp(argv[i],"--fmask")==0) || (strcmp(argv[i],"--smask")==0))
       {
-         floatingMaskImage=reg_io_ReadImageFile(argv[++i]);
+         floatingMaskImage=ReadInputImage(imageReader, argv[++i], checkMemory);
          if(floatingMaskImage==NULL)
          {
             reg_print_msg_error("Error when reading the floating mask image:");
@@ -785,6 +834,15 @@ int main(int argc, char **argv)
          REG->UseBCHUpdate(atoi(argv[++i]));
       }
 
+      else if(strcmp(argv[i], "-timing")==0 || strcmp(argv[i], "--timing")==0)
+      {
+         reg_timer_enable();
+      }
+      else if(strcmp(argv[i], "-trace")==0 || strcmp(argv[i], "--trace")==0)
+      {
+         traceFileName=argv[++i];
+         reg_timer_enable(true);
+      }
       else if(strcmp(argv[i], "-omp")==0 || strcmp(argv[i], "--omp")==0)
       {
 #if defined (_OPENMP)
@@ -802,6 +860,7 @@ int main(int argc, char **argv)
               strcmp(argv[i], "-Version")!=0 && strcmp(argv[i], "-V")!=0 &&
               strcmp(argv[i], "-v")!=0 && strcmp(argv[i], "--v")!=0 &&
               strcmp(argv[i], "-gpu")!=0 && strcmp(argv[i], "--gpu")!=0 &&
+              strcmp(argv[i], "-mem")!=0 && strcmp(argv[i], "--mem")!=0 &&
               strcmp(argv[i], "-vel")!=0 && strcmp(argv[i], "-sym")!=0)
       {
          reg_print_msg_error("\tParameter unknown:");
@@ -812,6 +871,24 @@ int main(int argc, char **argv)
    }
    if(useMeanLNCC)
       REG->SetLNCCKernelType(2);
+   if(useIIRLNCC)
+      REG->SetLNCCKernelType(IIR_GAUSSIAN_KERNEL);
+
+   // Print the estimated peak memory usage in MB without running the registration
+   if(checkMemory)
+   {
+      printf("%i\n", REG->CheckMemoryMB());
+      delete REG;
+      free(referenceLandmark);
+      free(floatingLandmark);
+      if(refLocalWeightSim!=NULL) nifti_image_free(refLocalWeightSim);
+      nifti_image_free(referenceImage);
+      nifti_image_free(floatingImage);
+      if(inputCCPImage!=NULL) nifti_image_free(inputCCPImage);
+      if(referenceMaskImage!=NULL) nifti_image_free(referenceMaskImage);
+      if(floatingMaskImage!=NULL) nifti_image_free(floatingMaskImage);
+      return EXIT_SUCCESS;
+   }
 
 #ifndef NDEBUG
    reg_print_msg_debug("*******************************************");
@@ -835,6 +912,13 @@ int main(int argc, char **argv)
    // Run the registration
    REG->Run();
 
+   // Save the timed stages of the registration
+   if(traceFileName!=NULL)
+      reg_timer_writeTrace(traceFileName);
+
+   // The output images are saved in the background while the next ones are computed
+   reg_io_AsyncWriter imageWriter;
+
    // Save the control point image
    nifti_image *outputControlPointGridImage = REG->GetControlPointPositionImage();
    if(outputCPPImageName==NULL) outputCPPImageName=(char *)"outputCPP.nii";
@@ -842,8 +926,7 @@ int main(int argc, char **argv)
    strcpy (outputControlPointGridImage->descrip,"Control point position from NiftyReg (reg_f3d)");
    if(strcmp("NiftyReg F3D2", REG->GetExecutableName())==0)
       strcpy (outputControlPointGridImage->descrip,"Velocity field grid from NiftyReg (reg_f3d2)");
-   reg_io_WriteImageFile(outputControlPointGridImage,outputCPPImageName);
-   nifti_image_free(outputControlPointGridImage);
+   imageWriter.Write(outputControlPointGridImage,outputCPPImageName);
    outputControlPointGridImage=NULL;
 
    // Save the backward control point image
@@ -871,8 +954,7 @@ int main(int argc, char **argv)
       strcpy (outputBackwardControlPointGridImage->descrip,"Backward Control point position from NiftyReg (reg_f3d)");
       if(strcmp("NiftyReg F3D2", REG->GetExecutableName())==0)
          strcpy (outputBackwardControlPointGridImage->descrip,"Backward velocity field grid from NiftyReg (reg_f3d2)");
-      reg_io_WriteImageFile(outputBackwardControlPointGridImage,b.c_str());
-      nifti_image_free(outputBackwardControlPointGridImage);
+      imageWriter.Write(outputBackwardControlPointGridImage,b.c_str());
       outputBackwardControlPointGridImage=NULL;
    }
 
@@ -910,12 +992,11 @@ int main(int argc, char **argv)
          else if(b.find( ".nrrd") != std::string::npos)
             b.replace(b.find( ".nrrd"),5,"_backward.nrrd");
          else b.append("_backward.nii");
-         reg_io_WriteImageFile(outputWarpedImage[1],b.c_str());
+         imageWriter.Write(outputWarpedImage[1],b.c_str());
+         outputWarpedImage[1]=NULL;
       }
    }
-   reg_io_WriteImageFile(outputWarpedImage[0],outputWarpedImageName);
-   if(outputWarpedImage[0]!=NULL)
-      nifti_image_free(outputWarpedImage[0]);
+   imageWriter.Write(outputWarpedImage[0],outputWarpedImageName);
    outputWarpedImage[0]=NULL;
    if(outputWarpedImage[1]!=NULL)
       nifti_image_free(outputWarpedImage[1]);
@@ -937,6 +1018,9 @@ int main(int argc, char **argv)
    if(referenceMaskImage!=NULL) nifti_image_free(referenceMaskImage);
    if(floatingMaskImage!=NULL) nifti_image_free(floatingMaskImage);
 
+   // Wait for all the output images to be saved
+   imageWriter.Wait();
+
 #ifdef NDEBUG
    if(verbose)
    {
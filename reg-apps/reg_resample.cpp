@@ -11,6 +11,7 @@
  */
 
 #include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteAsync.h"
 #include "_reg_ReadWriteMatrix.h"
 #include "_reg_resampling.h"
 #include "_reg_globalTrans.h"
@@ -251,6 +252,12 @@ int main(int argc, char **argv)
       return EXIT_FAILURE;
    }
 
+   /* The floating image and the transformation are read in the background */
+   reg_io_AsyncReader imageReader;
+   imageReader.Request(param->floatingImageName);
+   if(flag->inputTransFlag && reg_isAnImageFileName(param->inputTransName))
+      imageReader.Request(param->inputTransName);
+
    /* Read the reference image */
    nifti_image *referenceImage = reg_io_ReadImageHeader(param->referenceImageName);
    if(referenceImage == NULL)
@@ -261,7 +268,7 @@ int main(int argc, char **argv)
    }
 
    /* Read the floating image */
-   nifti_image *floatingImage = reg_io_ReadImageFile(param->floatingImageName);
+   nifti_image *floatingImage = imageReader.Get(param->floatingImageName);
    if(floatingImage == NULL)
    {
       fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
@@ -298,7 +305,7 @@ int main(int argc, char **argv)
       // First check if the input filename is an image
       if(reg_isAnImageFileName(param->inputTransName))
       {
-         inputTransformationImage=reg_io_ReadImageFile(param->inputTransName);
+         inputTransformationImage=imageReader.Get(param->inputTransName);
          if(inputTransformationImage==NULL)
          {
             fprintf(stderr, "[NiftyReg ERROR] Error when reading the provided transformation: %s\n",
@@ -32,6 +32,7 @@ typedef struct
    char *input2TransName;
    char *outputTransName;
    float affTransParam[12];
+   float invertTolerance;
 } PARAM;
 typedef struct
 {
@@ -45,6 +46,7 @@ typedef struct
    bool halfTransFlag;
    bool invertAffFlag;
    bool invertNRRFlag;
+   bool invertNewtonFlag;
    bool flirtAff2NRFlag;
    bool makeAffFlag;
    bool aff2rigFlag;
@@ -110,6 +112,13 @@ void Usage(char *exec)
    printf("\t\tNote that the cubic b-spline grid parametrisations can not be inverted without approximation,\n");
    printf("\t\tas a result, they are converted into deformation fields before inversion.\n\n");
 
+   printf("\t-invNewton\n");
+   printf("\t\tDense deformation and displacement fields are inverted with Newton's method (-invNrr).\n");
+   printf("\t\tIt is much faster than the default simplex optimisation for smooth fields.\n\n");
+
+   printf("\t-invTol <float>\n");
+   printf("\t\tTolerance of the dense field inversion (-invNrr). [1e-6]\n\n");
+
    printf("\t-half <filename1> <filename2>\n");
    printf("\t\tThe input transformation is halfed and stored using the same transformation type.\n");
    printf("\t\tfilename1 - Input transformation file name\n");
@@ -162,6 +171,7 @@ int main(int argc, char **argv)
    // Set the variables used to store the parsed data
    PARAM *param = (PARAM *)calloc(1,sizeof(PARAM));
    FLAG *flag = (FLAG *)calloc(1,sizeof(FLAG));
+   param->invertTolerance=1.0e-6f;
 
 #if defined (_OPENMP)
    // Set the default number of thread
@@ -267,6 +277,14 @@ int main(int argc, char **argv)
          param->input2TransName=argv[++i];
          param->outputTransName=argv[++i];
       }
+      else if(strcmp(argv[i],"-invNewton")==0 || strcmp(argv[i],"--invNewton")==0)
+      {
+         flag->invertNewtonFlag=true;
+      }
+      else if(strcmp(argv[i],"-invTol")==0 || strcmp(argv[i],"--invTol")==0)
+      {
+         param->invertTolerance=static_cast<float>(atof(argv[++i]));
+      }
       else if(strcmp(argv[i],"-makeAff")==0 || strcmp(argv[i],"--makeAff")==0)
       {
          flag->makeAffFlag=true;
@@ -1092,13 +1110,13 @@ int main(int argc, char **argv)
       switch(reg_round(inputTransImage->intent_p1))
       {
       case DEF_FIELD:
-         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
+         reg_defFieldInvert(inputTransImage,outputTransImage,param->invertTolerance,flag->invertNewtonFlag);
 		 memset(outputTransImage->descrip, 0, 80);
 		 strcpy(outputTransImage->descrip, "Deformation field from NiftyReg (reg_transform -invNrr)");
          break;
       case DISP_FIELD:
          reg_getDeformationFromDisplacement(inputTransImage);
-         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
+         reg_defFieldInvert(inputTransImage,outputTransImage,param->invertTolerance,flag->invertNewtonFlag);
 		 reg_getDisplacementFromDeformation(outputTransImage);
 		 memset(outputTransImage->descrip, 0, 80);
 		 strcpy(outputTransImage->descrip, "Displacement field from NiftyReg (reg_transform -invNrr)");
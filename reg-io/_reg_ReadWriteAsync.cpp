@@ -0,0 +1,257 @@
+/*
+ *  _reg_ReadWriteAsync.cpp
+ *
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_READWRITEASYNC_CPP
+#define _REG_READWRITEASYNC_CPP
+
+#include "_reg_ReadWriteAsync.h"
+#include "_reg_maths.h"
+
+/* *************************************************************** */
+/* *************************************************************** */
+reg_io_AsyncReader::reg_io_AsyncReader(int threadNumber)
+{
+   this->maxThreadNumber=threadNumber>0?threadNumber:1;
+#ifndef _WIN32
+   pthread_mutex_init(&this->mutex,NULL);
+   pthread_cond_init(&this->condition,NULL);
+   this->stopping=false;
+#endif
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_io_AsyncReader constructor called");
+#endif
+}
+/* *************************************************************** */
+reg_io_AsyncReader::~reg_io_AsyncReader()
+{
+#ifndef _WIN32
+   pthread_mutex_lock(&this->mutex);
+   this->stopping=true;
+   pthread_cond_broadcast(&this->condition);
+   pthread_mutex_unlock(&this->mutex);
+   for(size_t i=0; i<this->threads.size(); ++i)
+      pthread_join(this->threads[i],NULL);
+   pthread_cond_destroy(&this->condition);
+   pthread_mutex_destroy(&this->mutex);
+#endif
+   for(size_t i=0; i<this->entries.size(); ++i)
+   {
+      if(!this->entries[i]->retrieved && this->entries[i]->image!=NULL)
+         nifti_image_free(this->entries[i]->image);
+      delete this->entries[i];
+   }
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_io_AsyncReader destructor called");
+#endif
+}
+/* *************************************************************** */
+void reg_io_AsyncReader::Request(const char *filename)
+{
+   Entry *entry=new Entry;
+   entry->filename=filename;
+   entry->image=NULL;
+   entry->started=false;
+   entry->done=false;
+   entry->retrieved=false;
+#ifndef _WIN32
+   pthread_mutex_lock(&this->mutex);
+   this->entries.push_back(entry);
+   // A new I/O thread is created for every request until the pool is full
+   if((int)this->threads.size()<this->maxThreadNumber)
+   {
+      pthread_t thread;
+      if(pthread_create(&thread,NULL,&reg_io_AsyncReader::ThreadFunction,this)==0)
+         this->threads.push_back(thread);
+   }
+   pthread_cond_broadcast(&this->condition);
+   pthread_mutex_unlock(&this->mutex);
+#else
+   // Without threads the image is read straight away
+   entry->image=reg_io_ReadImageFile(filename);
+   entry->started=entry->done=true;
+   this->entries.push_back(entry);
+#endif
+}
+/* *************************************************************** */
+nifti_image *reg_io_AsyncReader::Get(const char *filename)
+{
+   std::string name(filename);
+   Entry *entry=NULL;
+#ifndef _WIN32
+   pthread_mutex_lock(&this->mutex);
+#endif
+   for(size_t i=0; i<this->entries.size(); ++i)
+   {
+      if(!this->entries[i]->retrieved && this->entries[i]->filename==name)
+      {
+         entry=this->entries[i];
+         entry->retrieved=true;
+         break;
+      }
+   }
+   bool readHere=entry==NULL || !entry->started;
+   if(entry!=NULL)
+      entry->started=true;
+#ifndef _WIN32
+   // Wait for an I/O thread that already reads the image
+   while(!readHere && !entry->done)
+      pthread_cond_wait(&this->condition,&this->mutex);
+   pthread_mutex_unlock(&this->mutex);
+#endif
+   if(readHere)
+      return reg_io_ReadImageFile(filename);
+   return entry->image;
+}
+/* *************************************************************** */
+#ifndef _WIN32
+void *reg_io_AsyncReader::ThreadFunction(void *reader)
+{
+   static_cast<reg_io_AsyncReader *>(reader)->ReadEntries();
+   return NULL;
+}
+/* *************************************************************** */
+void reg_io_AsyncReader::ReadEntries()
+{
+   pthread_mutex_lock(&this->mutex);
+   while(true)
+   {
+      // The requests are processed in order
+      Entry *entry=NULL;
+      for(size_t i=0; i<this->entries.size(); ++i)
+      {
+         if(!this->entries[i]->started)
+         {
+            entry=this->entries[i];
+            break;
+         }
+      }
+      if(entry==NULL)
+      {
+         if(this->stopping)
+            break;
+         pthread_cond_wait(&this->condition,&this->mutex);
+         continue;
+      }
+      entry->started=true;
+      pthread_mutex_unlock(&this->mutex);
+      nifti_image *image=reg_io_ReadImageFile(entry->filename.c_str());
+      pthread_mutex_lock(&this->mutex);
+      entry->image=image;
+      entry->done=true;
+      pthread_cond_broadcast(&this->condition);
+   }
+   pthread_mutex_unlock(&this->mutex);
+}
+#endif
+/* *************************************************************** */
+/* *************************************************************** */
+reg_io_AsyncWriter::reg_io_AsyncWriter()
+{
+#ifndef _WIN32
+   pthread_mutex_init(&this->mutex,NULL);
+   pthread_cond_init(&this->condition,NULL);
+   this->running=false;
+   this->busy=false;
+   this->stopping=false;
+#endif
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_io_AsyncWriter constructor called");
+#endif
+}
+/* *************************************************************** */
+reg_io_AsyncWriter::~reg_io_AsyncWriter()
+{
+#ifndef _WIN32
+   pthread_mutex_lock(&this->mutex);
+   this->stopping=true;
+   pthread_cond_broadcast(&this->condition);
+   pthread_mutex_unlock(&this->mutex);
+   // The thread saves all the queued images before stopping
+   if(this->running)
+      pthread_join(this->thread,NULL);
+   pthread_cond_destroy(&this->condition);
+   pthread_mutex_destroy(&this->mutex);
+#endif
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_io_AsyncWriter destructor called");
+#endif
+}
+/* *************************************************************** */
+void reg_io_AsyncWriter::Write(nifti_image *image, const char *filename)
+{
+   if(image==NULL)
+      return;
+#ifndef _WIN32
+   pthread_mutex_lock(&this->mutex);
+   this->queue.push_back(std::make_pair(image,std::string(filename)));
+   if(!this->running)
+   {
+      if(pthread_create(&this->thread,NULL,&reg_io_AsyncWriter::ThreadFunction,this)==0)
+         this->running=true;
+   }
+   pthread_cond_broadcast(&this->condition);
+   pthread_mutex_unlock(&this->mutex);
+   if(this->running)
+      return;
+   // The image is saved synchronously if the thread could not be created
+   pthread_mutex_lock(&this->mutex);
+   this->queue.pop_back();
+   pthread_mutex_unlock(&this->mutex);
+#endif
+   reg_io_WriteImageFile(image,filename);
+   nifti_image_free(image);
+}
+/* *************************************************************** */
+void reg_io_AsyncWriter::Wait()
+{
+#ifndef _WIN32
+   pthread_mutex_lock(&this->mutex);
+   while(!this->queue.empty() || this->busy)
+      pthread_cond_wait(&this->condition,&this->mutex);
+   pthread_mutex_unlock(&this->mutex);
+#endif
+}
+/* *************************************************************** */
+#ifndef _WIN32
+void *reg_io_AsyncWriter::ThreadFunction(void *writer)
+{
+   static_cast<reg_io_AsyncWriter *>(writer)->WriteImages();
+   return NULL;
+}
+/* *************************************************************** */
+void reg_io_AsyncWriter::WriteImages()
+{
+   pthread_mutex_lock(&this->mutex);
+   while(true)
+   {
+      if(this->queue.empty())
+      {
+         if(this->stopping)
+            break;
+         pthread_cond_wait(&this->condition,&this->mutex);
+         continue;
+      }
+      std::pair<nifti_image *, std::string> item=this->queue.front();
+      this->queue.pop_front();
+      this->busy=true;
+      pthread_mutex_unlock(&this->mutex);
+      reg_io_WriteImageFile(item.first,item.second.c_str());
+      nifti_image_free(item.first);
+      pthread_mutex_lock(&this->mutex);
+      this->busy=false;
+      pthread_cond_broadcast(&this->condition);
+   }
+   pthread_mutex_unlock(&this->mutex);
+}
+#endif
+/* *************************************************************** */
+/* *************************************************************** */
+
+#endif
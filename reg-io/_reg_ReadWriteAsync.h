@@ -0,0 +1,117 @@
+/**
+ * @file _reg_ReadWriteAsync.h
+ * @brief Asynchronous reading and writing of images on background threads
+ *
+ * The reader loads all the requested images concurrently on a small pool of
+ * I/O threads while the calling thread can already process the images that
+ * have arrived. The writer saves images on a background thread so that the
+ * output files are written while the remaining outputs are computed.
+ * POSIX threads are used. On Windows, both classes fall back to synchronous
+ * reading and writing.
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_READWRITEASYNC_H
+#define _REG_READWRITEASYNC_H
+
+#include "_reg_ReadWriteImage.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* *************************************************************** */
+/** @class reg_io_AsyncReader
+ * @brief Prefetch images on a pool of I/O threads
+ *
+ * The images are requested with Request as soon as their filenames are known
+ * and are retrieved with Get, which waits for the image to be read if required.
+ * An image that is retrieved before an I/O thread starts reading it is read by
+ * the calling thread. The images that are never retrieved are freed by the
+ * destructor. The registration classes build their pyramids once all their
+ * inputs are set, the reading thus only overlaps with the processing done by
+ * the applications themselves.
+ */
+class reg_io_AsyncReader
+{
+public:
+   /// @brief Constructor
+   /// @param threadNumber Maximal number of I/O threads
+   reg_io_AsyncReader(int threadNumber=4);
+   /// @brief Destructor, wait for the I/O threads and free the images that were never retrieved
+   ~reg_io_AsyncReader();
+   /// @brief Start reading an image in the background
+   /// @param filename Filename of the image, the same file can be requested several times
+   void Request(const char *filename);
+   /** @brief Return an image read with reg_io_ReadImageFile
+    * @param filename Filename of the image. If the image has not been
+    * requested, it is read synchronously
+    * @return Image, owned by the caller, or NULL if it can not be read
+    */
+   nifti_image *Get(const char *filename);
+
+private:
+   struct Entry
+   {
+      std::string filename;
+      nifti_image *image;
+      bool started;
+      bool done;
+      bool retrieved;
+   };
+   std::vector<Entry *> entries;
+   int maxThreadNumber;
+#ifndef _WIN32
+   std::vector<pthread_t> threads;
+   pthread_mutex_t mutex;
+   pthread_cond_t condition;
+   bool stopping;
+   static void *ThreadFunction(void *reader);
+   void ReadEntries();
+#endif
+};
+/* *************************************************************** */
+/** @class reg_io_AsyncWriter
+ * @brief Save images on a background thread
+ *
+ * The images are written in the order they are queued using
+ * reg_io_WriteImageFile. The writer takes the ownership of the images and
+ * frees them once saved. The destructor waits for all the pending writes.
+ */
+class reg_io_AsyncWriter
+{
+public:
+   /// @brief Constructor
+   reg_io_AsyncWriter();
+   /// @brief Destructor, wait for all the images to be saved
+   ~reg_io_AsyncWriter();
+   /// @brief Queue an image to be saved and freed
+   /// @param image Image to save, the writer takes its ownership
+   /// @param filename Filename of the output image
+   void Write(nifti_image *image, const char *filename);
+   /// @brief Wait for all the queued images to be saved
+   void Wait();
+
+private:
+#ifndef _WIN32
+   std::deque<std::pair<nifti_image *, std::string> > queue;
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t condition;
+   bool running;
+   bool busy;
+   bool stopping;
+   static void *ThreadFunction(void *writer);
+   void WriteImages();
+#endif
+};
+/* *************************************************************** */
+
+#endif
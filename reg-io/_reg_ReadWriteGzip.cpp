@@ -0,0 +1,353 @@
+/*
+ *  _reg_ReadWriteGzip.cpp
+ *
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_READWRITEGZIP_CPP
+#define _REG_READWRITEGZIP_CPP
+
+#include "_reg_ReadWriteGzip.h"
+#include "_reg_maths.h"
+#include <zlib.h>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+/// Number of uncompressed bytes stored in every gzip member
+#define REG_GZIP_CHUNK_SIZE 1048576
+/// Size of the member header: fixed header, extra field length and the NR subfield
+#define REG_GZIP_HEADER_SIZE 20
+/// Size of the member trailer: CRC32 and uncompressed size
+#define REG_GZIP_TRAILER_SIZE 8
+
+/* *************************************************************** */
+static void reg_gzip_setInt(unsigned char *buffer, unsigned int value)
+{
+   buffer[0] = (unsigned char)(value & 0xff);
+   buffer[1] = (unsigned char)((value >> 8) & 0xff);
+   buffer[2] = (unsigned char)((value >> 16) & 0xff);
+   buffer[3] = (unsigned char)((value >> 24) & 0xff);
+}
+/* *************************************************************** */
+static unsigned int reg_gzip_getInt(const unsigned char *buffer)
+{
+   return (unsigned int)buffer[0] |
+         ((unsigned int)buffer[1] << 8) |
+         ((unsigned int)buffer[2] << 16) |
+         ((unsigned int)buffer[3] << 24);
+}
+/* *************************************************************** */
+/** Compress a chunk into a complete gzip member. The header holds an extra
+ * field, with the NR identifier, that stores the total size of the member.
+ * The size of the member is returned, or 0 if the compression failed.
+ */
+static size_t reg_gzip_compressChunk(const unsigned char *input,
+                                     size_t inputSize,
+                                     unsigned char *output,
+                                     size_t outputCapacity)
+{
+   z_stream stream;
+   memset(&stream, 0, sizeof(z_stream));
+   if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+      return 0;
+   stream.next_in = (Bytef *)input;
+   stream.avail_in = (uInt)inputSize;
+   stream.next_out = (Bytef *)(output + REG_GZIP_HEADER_SIZE);
+   stream.avail_out = (uInt)(outputCapacity - REG_GZIP_HEADER_SIZE - REG_GZIP_TRAILER_SIZE);
+   int status = deflate(&stream, Z_FINISH);
+   size_t compressedSize = stream.total_out;
+   deflateEnd(&stream);
+   if(status != Z_STREAM_END)
+      return 0;
+
+   size_t memberSize = REG_GZIP_HEADER_SIZE + compressedSize + REG_GZIP_TRAILER_SIZE;
+   // ID1, ID2, deflate, FEXTRA flag, no time stamp, no extra flag, unknown OS
+   const unsigned char header[12] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0};
+   memcpy(output, header, 12);
+   // NR subfield of 4 bytes that holds the member size
+   output[12] = 'N';
+   output[13] = 'R';
+   output[14] = 4;
+   output[15] = 0;
+   reg_gzip_setInt(&output[16], (unsigned int)memberSize);
+   unsigned char *trailer = output + REG_GZIP_HEADER_SIZE + compressedSize;
+   reg_gzip_setInt(trailer, (unsigned int)crc32(crc32(0L, Z_NULL, 0), input, (uInt)inputSize));
+   reg_gzip_setInt(trailer + 4, (unsigned int)inputSize);
+   return memberSize;
+}
+/* *************************************************************** */
+/** Check if the buffer starts with a gzip member whose size is stored in its
+ * header, either in a NR subfield or in a BGZF (BC) subfield. The member size
+ * and the offset of its compressed data are returned. A null size is returned
+ * when the member is not indexed or exceeds the buffer.
+ */
+static size_t reg_gzip_indexedMemberSize(const unsigned char *buffer,
+                                         size_t available,
+                                         size_t *dataOffset)
+{
+   if(available < 12 || buffer[0] != 0x1f || buffer[1] != 0x8b || buffer[2] != 8)
+      return 0;
+   // Only the extra field is expected, the name, comment and header CRC are not
+   if((buffer[3] & 4) == 0 || (buffer[3] & (2 | 8 | 16)) != 0)
+      return 0;
+   size_t extraLength = (size_t)buffer[10] | ((size_t)buffer[11] << 8);
+   if(available < 12 + extraLength)
+      return 0;
+   size_t memberSize = 0;
+   size_t position = 12;
+   while(position + 4 <= 12 + extraLength)
+   {
+      size_t subfieldLength = (size_t)buffer[position + 2] | ((size_t)buffer[position + 3] << 8);
+      if(position + 4 + subfieldLength > 12 + extraLength)
+         break;
+      if(buffer[position] == 'N' && buffer[position + 1] == 'R' && subfieldLength == 4)
+         memberSize = reg_gzip_getInt(&buffer[position + 4]);
+      else if(buffer[position] == 'B' && buffer[position + 1] == 'C' && subfieldLength == 2)
+         memberSize = ((size_t)buffer[position + 4] | ((size_t)buffer[position + 5] << 8)) + 1;
+      position += 4 + subfieldLength;
+   }
+   *dataOffset = 12 + extraLength;
+   if(memberSize < *dataOffset + REG_GZIP_TRAILER_SIZE || memberSize > available)
+      return 0;
+   return memberSize;
+}
+/* *************************************************************** */
+/** Decompress the deflate stream of a member and check its CRC32 */
+static bool reg_gzip_decompressMember(const unsigned char *member,
+                                      size_t memberSize,
+                                      size_t dataOffset,
+                                      unsigned char *output,
+                                      size_t outputSize)
+{
+   z_stream stream;
+   memset(&stream, 0, sizeof(z_stream));
+   if(inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      return false;
+   stream.next_in = (Bytef *)(member + dataOffset);
+   stream.avail_in = (uInt)(memberSize - dataOffset - REG_GZIP_TRAILER_SIZE);
+   stream.next_out = (Bytef *)output;
+   stream.avail_out = (uInt)outputSize;
+   int status = inflate(&stream, Z_FINISH);
+   size_t decompressedSize = stream.total_out;
+   inflateEnd(&stream);
+   if((status != Z_STREAM_END && outputSize > 0) || decompressedSize != outputSize)
+      return false;
+   unsigned int crc = (unsigned int)crc32(crc32(0L, Z_NULL, 0), output, (uInt)outputSize);
+   return crc == reg_gzip_getInt(member + memberSize - REG_GZIP_TRAILER_SIZE);
+}
+/* *************************************************************** */
+nifti_image *reg_io_readGzipNifti(const char *filename)
+{
+   if(filename == NULL || !nifti_is_gzfile(filename))
+      return NULL;
+
+   // Check that the first member is indexed before reading the whole file
+   FILE *file = fopen(filename, "rb");
+   if(file == NULL)
+      return NULL;
+   unsigned char firstBytes[12];
+   size_t dataOffset;
+   if(fread(firstBytes, 1, 12, file) != 12 ||
+         firstBytes[0] != 0x1f || firstBytes[1] != 0x8b || (firstBytes[3] & 4) == 0)
+   {
+      fclose(file);
+      return NULL;
+   }
+   std::vector<unsigned char> compressed(firstBytes, firstBytes + 12);
+   std::vector<unsigned char> readBuffer(REG_GZIP_CHUNK_SIZE);
+   size_t readSize;
+   while((readSize = fread(&readBuffer[0], 1, REG_GZIP_CHUNK_SIZE, file)) > 0)
+      compressed.insert(compressed.end(), readBuffer.begin(), readBuffer.begin() + readSize);
+   fclose(file);
+   std::vector<unsigned char>().swap(readBuffer);
+
+   // Locate all the members and the position of their content in the stream
+   std::vector<size_t> memberStart, memberSize, memberDataOffset, streamStart;
+   size_t position = 0, streamSize = 0;
+   while(position < compressed.size())
+   {
+      size_t size = reg_gzip_indexedMemberSize(&compressed[position],
+                                               compressed.size() - position,
+                                               &dataOffset);
+      if(size == 0)
+         return NULL;
+      memberStart.push_back(position);
+      memberSize.push_back(size);
+      memberDataOffset.push_back(dataOffset);
+      streamStart.push_back(streamSize);
+      streamSize += reg_gzip_getInt(&compressed[position + size - 4]);
+      position += size;
+   }
+   streamStart.push_back(streamSize);
+
+   // The header and extensions are read by the nifti library, which may
+   // resolve the filename to another file, an uncompressed one for example
+   nifti_image *image = nifti_image_read(filename, false);
+   if(image == NULL)
+      return NULL;
+   size_t offset = static_cast<size_t>(image->iname_offset);
+   size_t dataSize = nifti_get_volsize(image);
+   if(image->nifti_type != NIFTI_FTYPE_NIFTI1_1 ||
+         image->iname == NULL || strcmp(image->iname, filename) != 0 ||
+         image->byteorder != nifti_short_order() ||
+         streamSize < offset + dataSize || dataSize == 0)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+   image->data = malloc(dataSize);
+   if(image->data == NULL)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+
+   // The members are decompressed in parallel. The members that lie entirely
+   // within the voxel data are decompressed in place
+   unsigned char *data = static_cast<unsigned char *>(image->data);
+   const unsigned char *compressedPtr = &compressed[0];
+   const size_t *memberStartPtr = &memberStart[0];
+   const size_t *memberSizePtr = &memberSize[0];
+   const size_t *memberDataOffsetPtr = &memberDataOffset[0];
+   const size_t *streamStartPtr = &streamStart[0];
+   long memberNumber = (long)memberStart.size();
+   long m;
+   int failure = 0;
+#if defined (_OPENMP)
+   #pragma omp parallel for default(none) schedule(dynamic) \
+   shared(data, compressedPtr, memberStartPtr, memberSizePtr, memberDataOffsetPtr, \
+   streamStartPtr, memberNumber, offset, dataSize) \
+   private(m) \
+   reduction(+:failure)
+#endif
+   for(m = 0; m < memberNumber; ++m)
+   {
+      size_t begin = streamStartPtr[m];
+      size_t end = streamStartPtr[m + 1];
+      if(end <= offset || begin >= offset + dataSize || end == begin)
+         continue;
+      const unsigned char *member = compressedPtr + memberStartPtr[m];
+      if(begin >= offset && end <= offset + dataSize)
+      {
+         if(!reg_gzip_decompressMember(member, memberSizePtr[m], memberDataOffsetPtr[m],
+                                       data + (begin - offset), end - begin))
+            ++failure;
+      }
+      else
+      {
+         unsigned char *buffer = (unsigned char *)malloc(end - begin);
+         if(!reg_gzip_decompressMember(member, memberSizePtr[m], memberDataOffsetPtr[m],
+                                       buffer, end - begin))
+            ++failure;
+         else
+         {
+            size_t first = begin > offset ? begin : offset;
+            size_t last = end < offset + dataSize ? end : offset + dataSize;
+            memcpy(data + (first - offset), buffer + (first - begin), last - first);
+         }
+         free(buffer);
+      }
+   }
+   if(failure > 0)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+   return image;
+}
+/* *************************************************************** */
+bool reg_io_writeGzipNifti(nifti_image *image)
+{
+   if(image == NULL || image->data == NULL || image->fname == NULL)
+      return false;
+   if(image->nifti_type != NIFTI_FTYPE_NIFTI1_1 || !nifti_is_gzfile(image->fname) ||
+         image->num_ext > 0)
+      return false;
+
+   // The header is followed by an empty extender and the voxel data
+   nifti_set_iname_offset(image);
+   nifti_1_header header = nifti_convert_nim2nhdr(image);
+   size_t offset = static_cast<size_t>(image->iname_offset);
+   if(offset < sizeof(nifti_1_header) + 4 || offset >= REG_GZIP_CHUNK_SIZE)
+      return false;
+   size_t dataSize = nifti_get_volsize(image);
+   size_t streamSize = offset + dataSize;
+   size_t chunkNumber = (streamSize + REG_GZIP_CHUNK_SIZE - 1) / REG_GZIP_CHUNK_SIZE;
+
+   FILE *file = fopen(image->fname, "wb");
+   if(file == NULL)
+      return false;
+
+   // The first chunk gathers the header and the beginning of the data
+   size_t firstChunkSize = streamSize < REG_GZIP_CHUNK_SIZE ? streamSize : REG_GZIP_CHUNK_SIZE;
+   unsigned char *firstChunk = (unsigned char *)calloc(firstChunkSize, 1);
+   memcpy(firstChunk, &header, sizeof(nifti_1_header));
+   memcpy(firstChunk + offset, image->data, firstChunkSize - offset);
+
+   // The chunks are compressed in parallel by batches to bound the memory
+   int threadNumber = 1;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   size_t batchSize = 4 * (size_t)threadNumber;
+   size_t memberCapacity = compressBound(REG_GZIP_CHUNK_SIZE) +
+         REG_GZIP_HEADER_SIZE + REG_GZIP_TRAILER_SIZE;
+   unsigned char *members = (unsigned char *)malloc(batchSize * memberCapacity);
+   size_t *memberSizes = (size_t *)malloc(batchSize * sizeof(size_t));
+   const unsigned char *data = static_cast<const unsigned char *>(image->data);
+   bool success = members != NULL && memberSizes != NULL;
+
+   for(size_t firstIndex = 0; firstIndex < chunkNumber && success; firstIndex += batchSize)
+   {
+      long currentBatch = (long)(chunkNumber - firstIndex < batchSize ?
+                                    chunkNumber - firstIndex : batchSize);
+      long c;
+#if defined (_OPENMP)
+      #pragma omp parallel for default(none) schedule(dynamic) \
+      shared(currentBatch, firstIndex, streamSize, offset, firstChunk, data, \
+      members, memberSizes, memberCapacity) \
+      private(c)
+#endif
+      for(c = 0; c < currentBatch; ++c)
+      {
+         size_t start = (firstIndex + c) * REG_GZIP_CHUNK_SIZE;
+         size_t chunkSize = streamSize - start < REG_GZIP_CHUNK_SIZE ?
+                  streamSize - start : REG_GZIP_CHUNK_SIZE;
+         const unsigned char *chunk = start == 0 ? firstChunk : data + (start - offset);
+         memberSizes[c] = reg_gzip_compressChunk(chunk, chunkSize,
+                                                 members + c * memberCapacity,
+                                                 memberCapacity);
+      }
+      for(c = 0; c < currentBatch; ++c)
+      {
+         if(memberSizes[c] == 0 ||
+               fwrite(members + c * memberCapacity, 1, memberSizes[c], file) != memberSizes[c])
+         {
+            success = false;
+            break;
+         }
+      }
+   }
+   free(firstChunk);
+   free(members);
+   free(memberSizes);
+   if(fclose(file) != 0)
+      success = false;
+   if(!success)
+   {
+      reg_print_fct_error("reg_io_writeGzipNifti");
+      std::string text = std::string("Error when writing the compressed image ") + image->fname;
+      reg_print_msg_error(text.c_str());
+      reg_exit();
+   }
+   return true;
+}
+/* *************************************************************** */
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * @file _reg_ReadWriteGzip.h
+ * @brief Multi-threaded reading and writing of compressed nifti files (.nii.gz)
+ *
+ * The compressed files are written as a concatenation of independent gzip
+ * members, in the same fashion as pigz or the BGZF format. Such files remain
+ * valid gzip files that any gzip tool or library can decompress. The size of
+ * every member is stored in an extra field of its gzip header so that the
+ * members can be located and decompressed in parallel when read back.
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_READWRITEGZIP_H
+#define _REG_READWRITEGZIP_H
+
+#include "nifti1_io.h"
+
+/* *************************************************************** */
+/** The function reads a compressed single file nifti image (.nii.gz) whose
+  * gzip members are indexed, as written by reg_io_writeGzipNifti or by bgzip.
+  * The members are decompressed in parallel directly into the data array.
+  * @param filename Filename of the input image
+  * @return Image as a nifti image or NULL if the file is not made of indexed
+  * members, in which case nifti_image_read has to be used instead
+  */
+extern "C++"
+nifti_image *reg_io_readGzipNifti(const char *filename);
+/* *************************************************************** */
+/** The function writes a nifti image into a compressed single file
+  * (.nii.gz) using the image fname. The header and data are split into
+  * chunks that are compressed in parallel as independent gzip members.
+  * @param image Image to save
+  * @return true if the image has been saved and false if the image can not be
+  * saved this way, for example when it holds extensions or is not a
+  * compressed single file image, in which case nifti_image_write has to be
+  * used instead
+  */
+extern "C++"
+bool reg_io_writeGzipNifti(nifti_image *image);
+/* *************************************************************** */
+
+#endif
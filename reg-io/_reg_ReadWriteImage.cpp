@@ -13,8 +13,18 @@
 #define _REG_READWRITEIMAGE_CPP
 
 #include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteGzip.h"
 #include "_reg_tools.h"
 #include "_reg_stringFormat.h"
+#include <map>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
 /* *************************************************************** */
 void reg_hack_filename(nifti_image *image, const char *filename)
@@ -66,6 +76,136 @@ int reg_io_checkFileFormat(const char *filename)
    return NR_NII_FORMAT;
 }
 /* *************************************************************** */
+#ifdef __linux__
+/// @brief Memory mapping that backs the data array of an image
+struct reg_io_mappedFile
+{
+   void *address;
+   size_t length;
+   dev_t device;
+   ino_t inode;
+};
+/// Mappings indexed by the data pointer stored in the nifti images
+static std::map<void *, reg_io_mappedFile> reg_io_mappedData;
+/// Guard of the mappings as images can be read and freed by several threads
+static pthread_mutex_t reg_io_mappedDataMutex = PTHREAD_MUTEX_INITIALIZER;
+/* *************************************************************** */
+/// Release the memory mapped data, used by nifti_free_data
+static int reg_io_releaseMappedData(void *data)
+{
+   pthread_mutex_lock(&reg_io_mappedDataMutex);
+   std::map<void *, reg_io_mappedFile>::iterator it = reg_io_mappedData.find(data);
+   if(it == reg_io_mappedData.end())
+   {
+      pthread_mutex_unlock(&reg_io_mappedDataMutex);
+      return 0;
+   }
+   munmap(it->second.address, it->second.length);
+   reg_io_mappedData.erase(it);
+   pthread_mutex_unlock(&reg_io_mappedDataMutex);
+   return 1;
+}
+/* *************************************************************** */
+/** Read an uncompressed nifti file whose voxel data are mapped in memory
+ * instead of being read in a buffer. The mapping is private, the data can
+ * thus be modified without altering the file. NULL is returned if the file
+ * can not be mapped, for example if it is compressed or if its byte order
+ * differs from the one of the CPU.
+ */
+static nifti_image *reg_io_mapNiftiFile(const char *filename)
+{
+   std::string name(filename);
+   if(name.size() < 4 || name.compare(name.size() - 4, 4, ".nii") != 0)
+      return NULL;
+
+   nifti_image *image = nifti_image_read(filename, false);
+   if(image == NULL)
+      return NULL;
+   size_t dataSize = nifti_get_volsize(image);
+   size_t offset = static_cast<size_t>(image->iname_offset);
+   if(image->nifti_type != NIFTI_FTYPE_NIFTI1_1 ||
+      image->byteorder != nifti_short_order() ||
+      image->nbyper < 1 || offset % image->nbyper != 0 || dataSize == 0)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+
+   int fd = open(image->iname, O_RDONLY);
+   if(fd < 0)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+   struct stat fileStat;
+   void *address = MAP_FAILED;
+   if(fstat(fd, &fileStat) == 0 && (size_t)fileStat.st_size >= offset + dataSize)
+      address = mmap(NULL, offset + dataSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(address == MAP_FAILED)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+
+   reg_io_mappedFile mapping;
+   mapping.address = address;
+   mapping.length = offset + dataSize;
+   mapping.device = fileStat.st_dev;
+   mapping.inode = fileStat.st_ino;
+   image->data = static_cast<char *>(address) + offset;
+   pthread_mutex_lock(&reg_io_mappedDataMutex);
+   if(reg_io_mappedData.empty())
+      nifti_set_data_free_function(&reg_io_releaseMappedData);
+   reg_io_mappedData[image->data] = mapping;
+   pthread_mutex_unlock(&reg_io_mappedDataMutex);
+   return image;
+}
+/* *************************************************************** */
+/** The mappings of a file that is about to be overwritten are replaced by
+ * anonymous memory that holds the same values at the same address. The copy
+ * is populated elsewhere and then moved over the file mapping in a single
+ * mremap call, so another thread reading the data never sees a partial copy.
+ * The data pointers stay valid and the truncation of the file can not affect
+ * them.
+ */
+static void reg_io_detachMappedFile(const char *filename)
+{
+   struct stat fileStat;
+   if(filename == NULL || stat(filename, &fileStat) != 0)
+      return;
+   pthread_mutex_lock(&reg_io_mappedDataMutex);
+   std::map<void *, reg_io_mappedFile>::iterator it;
+   for(it = reg_io_mappedData.begin(); it != reg_io_mappedData.end(); ++it)
+   {
+      reg_io_mappedFile &mapping = it->second;
+      if(mapping.device != fileStat.st_dev || mapping.inode != fileStat.st_ino)
+         continue;
+      void *copy = mmap(NULL, mapping.length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(copy != MAP_FAILED)
+      {
+         memcpy(copy, mapping.address, mapping.length);
+         if(mremap(copy, mapping.length, mapping.length,
+                   MREMAP_MAYMOVE | MREMAP_FIXED, mapping.address) == MAP_FAILED)
+         {
+            munmap(copy, mapping.length);
+            copy = MAP_FAILED;
+         }
+      }
+      if(copy == MAP_FAILED)
+      {
+         reg_print_fct_error("reg_io_detachMappedFile");
+         reg_print_msg_error("The memory mapped image could not be detached from its file");
+         reg_exit();
+      }
+      mapping.device = 0;
+      mapping.inode = 0;
+   }
+   pthread_mutex_unlock(&reg_io_mappedDataMutex);
+}
+#endif
+/* *************************************************************** */
 nifti_image *reg_io_ReadImageFile(const char *filename)
 {
    // First read the fileformat in order to use the correct library
@@ -78,7 +218,15 @@ nifti_image *reg_io_ReadImageFile(const char *filename)
    switch(fileFormat)
    {
    case NR_NII_FORMAT:
-      image=nifti_image_read(filename,true);
+      // Uncompressed files are mapped in memory rather than read and compressed
+      // files made of indexed members are decompressed in parallel
+#ifdef __linux__
+      image=reg_io_mapNiftiFile(filename);
+      if(image==NULL)
+#endif
+         image=reg_io_readGzipNifti(filename);
+      if(image==NULL)
+         image=nifti_image_read(filename,true);
       reg_hack_filename(image,filename);
       break;
    case NR_PNG_FORMAT:
@@ -133,6 +281,188 @@ nifti_image *reg_io_ReadImageHeader(const char *filename)
    return image;
 }
 /* *************************************************************** */
+/** Create an image without data that describes a spatial region of interest of
+ * the provided image. The origins of the qform and sform are moved to the first
+ * voxel of the region. NULL is returned if the region lies outside the image.
+ */
+static nifti_image *reg_io_createROIHeader(nifti_image *image,
+                                           const int start[3],
+                                           const int size[3])
+{
+   int imageDim[3]={image->nx, image->ny, image->nz};
+   for(int i=0; i<3; ++i)
+   {
+      if(start[i]<0 || size[i]<1 || start[i]+size[i]>imageDim[i])
+      {
+         reg_print_fct_error("reg_io_ReadImageROI");
+         char text[255];
+         sprintf(text, "The region [%i,%i,%i]+[%i,%i,%i] does not fit in the image [%i,%i,%i]",
+                 start[0], start[1], start[2], size[0], size[1], size[2],
+                 imageDim[0], imageDim[1], imageDim[2]);
+         reg_print_msg_error(text);
+         return NULL;
+      }
+   }
+   nifti_image *roi=nifti_copy_nim_info(image);
+   roi->dim[1]=roi->nx=size[0];
+   roi->dim[2]=roi->ny=size[1];
+   roi->dim[3]=roi->nz=size[2];
+   roi->nvox=(size_t)roi->nx*roi->ny*roi->nz*roi->nt*roi->nu*roi->nv*roi->nw;
+   roi->data=NULL;
+
+   // The origins are shifted to the first voxel of the region
+   for(int r=0; r<3; ++r)
+   {
+      roi->sto_xyz.m[r][3]=image->sto_xyz.m[r][0]*start[0] +
+            image->sto_xyz.m[r][1]*start[1] +
+            image->sto_xyz.m[r][2]*start[2] +
+            image->sto_xyz.m[r][3];
+   }
+   roi->sto_ijk=nifti_mat44_inverse(roi->sto_xyz);
+   float qoffset[3];
+   for(int r=0; r<3; ++r)
+   {
+      qoffset[r]=image->qto_xyz.m[r][0]*start[0] +
+            image->qto_xyz.m[r][1]*start[1] +
+            image->qto_xyz.m[r][2]*start[2] +
+            image->qto_xyz.m[r][3];
+   }
+   roi->qoffset_x=qoffset[0];
+   roi->qoffset_y=qoffset[1];
+   roi->qoffset_z=qoffset[2];
+   roi->qto_xyz=nifti_quatern_to_mat44(roi->quatern_b,
+                                       roi->quatern_c,
+                                       roi->quatern_d,
+                                       roi->qoffset_x,
+                                       roi->qoffset_y,
+                                       roi->qoffset_z,
+                                       roi->dx,
+                                       roi->dy,
+                                       roi->dz,
+                                       roi->qfac);
+   roi->qto_ijk=nifti_mat44_inverse(roi->qto_xyz);
+   return roi;
+}
+/* *************************************************************** */
+nifti_image *reg_io_ReadImageROI(const char *filename,
+                                 const int start[3],
+                                 const int size[3])
+{
+   // Only the nifti files can be partially read, the other formats are read
+   // entirely before the region is extracted
+   if(reg_io_checkFileFormat(filename)!=NR_NII_FORMAT)
+   {
+      nifti_image *image=reg_io_ReadImageFile(filename);
+      if(image==NULL)
+         return NULL;
+      nifti_image *roi=reg_io_createROIHeader(image,start,size);
+      if(roi!=NULL)
+      {
+         roi->data=malloc(roi->nvox*roi->nbyper);
+         size_t rowBytes=(size_t)size[0]*image->nbyper;
+         size_t volumeNumber=image->nvox/((size_t)image->nx*image->ny*image->nz);
+         char *inputPtr=static_cast<char *>(image->data);
+         char *outputPtr=static_cast<char *>(roi->data);
+         for(size_t v=0; v<volumeNumber; ++v)
+         {
+            for(int z=start[2]; z<start[2]+size[2]; ++z)
+            {
+               for(int y=start[1]; y<start[1]+size[1]; ++y)
+               {
+                  size_t index=((v*image->nz+z)*image->ny+y)*image->nx+start[0];
+                  memcpy(outputPtr, &inputPtr[index*image->nbyper], rowBytes);
+                  outputPtr+=rowBytes;
+               }
+            }
+         }
+      }
+      nifti_image_free(image);
+      return roi;
+   }
+
+   nifti_image *image=nifti_image_read(filename,false);
+   if(image==NULL)
+      return NULL;
+   reg_checkAndCorrectDimension(image);
+   nifti_image *roi=reg_io_createROIHeader(image,start,size);
+   if(roi==NULL)
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+   roi->data=malloc(roi->nvox*roi->nbyper);
+   if(roi->data==NULL)
+   {
+      reg_print_fct_error("reg_io_ReadImageROI");
+      reg_print_msg_error("The region of interest could not be allocated");
+      nifti_image_free(roi);
+      nifti_image_free(image);
+      return NULL;
+   }
+
+   // The rows of the region are read one after another in increasing file order.
+   // Consecutive rows that are contiguous in the file are read at once, a whole
+   // slab when the region spans the full width and height of the image. The
+   // compressed files are thus decompressed as a stream and only the parts
+   // outside of the region are discarded
+   znzFile file=znzopen(image->iname,"rb",nifti_is_gzfile(image->iname));
+   if(znz_isnull(file))
+   {
+      reg_print_fct_error("reg_io_ReadImageROI");
+      reg_print_msg_error("The image file could not be opened");
+      nifti_image_free(roi);
+      nifti_image_free(image);
+      return NULL;
+   }
+   size_t runVoxelNumber=size[0];
+   int yStep=1, zStep=1;
+   if(size[0]==image->nx)
+   {
+      runVoxelNumber*=size[1];
+      yStep=size[1];
+      if(size[1]==image->ny)
+      {
+         runVoxelNumber*=size[2];
+         zStep=size[2];
+      }
+   }
+   size_t runBytes=runVoxelNumber*image->nbyper;
+   size_t volumeNumber=image->nvox/((size_t)image->nx*image->ny*image->nz);
+   char *outputPtr=static_cast<char *>(roi->data);
+   bool success=true;
+   for(size_t v=0; v<volumeNumber && success; ++v)
+   {
+      for(int z=start[2]; z<start[2]+size[2] && success; z+=zStep)
+      {
+         for(int y=start[1]; y<start[1]+size[1] && success; y+=yStep)
+         {
+            size_t index=((v*image->nz+z)*image->ny+y)*image->nx+start[0];
+            long position=(long)(image->iname_offset+index*image->nbyper);
+            if(znzseek(file,position,SEEK_SET)<0 ||
+                  znzread(outputPtr,1,runBytes,file)!=runBytes)
+               success=false;
+            outputPtr+=runBytes;
+         }
+      }
+   }
+   znzclose(file);
+   if(!success)
+   {
+      reg_print_fct_error("reg_io_ReadImageROI");
+      reg_print_msg_error("The region of interest could not be read from the file");
+      nifti_image_free(roi);
+      nifti_image_free(image);
+      return NULL;
+   }
+   if(image->byteorder!=nifti_short_order() && roi->swapsize>1)
+      nifti_swap_Nbytes(roi->nvox,roi->swapsize,roi->data);
+   roi->byteorder=nifti_short_order();
+   nifti_image_free(image);
+   reg_hack_filename(roi,filename);
+   reg_checkAndCorrectDimension(roi);
+   return roi;
+}
+/* *************************************************************** */
 void reg_io_WriteImageFile(nifti_image *image, const char *filename)
 {
    // First read the fileformat in order to use the correct library
@@ -162,7 +492,13 @@ void reg_io_WriteImageFile(nifti_image *image, const char *filename)
    {
    case NR_NII_FORMAT:
       nifti_set_filenames(image,filename,0,0);
-      nifti_image_write(image);
+#ifdef __linux__
+      reg_io_detachMappedFile(image->fname);
+      reg_io_detachMappedFile(image->iname);
+#endif
+      // Compressed files are written as multiple members in parallel
+      if(!reg_io_writeGzipNifti(image))
+         nifti_image_write(image);
       break;
    case NR_PNG_FORMAT:
       reg_io_writePNGfile(image,filename);
@@ -43,6 +43,13 @@ int reg_io_checkFileFormat(const char *filename);
 /** The function expects a filename and returns a nifti_image structure
   * The function will use to correct library and will return a NULL image
   * if the image can not be read
+  * On Linux, the data of uncompressed nifti files (.nii) are mapped in memory
+  * rather than read. They have to be released using nifti_image_free or
+  * nifti_free_data. The mapping is detached from the file before
+  * reg_io_WriteImageFile overwrites it, but the file must not be truncated by
+  * another process while the image is in use.
+  * The compressed nifti files (.nii.gz) written by reg_io_WriteImageFile are
+  * decompressed in parallel.
   * @param filename Filename of the input images
   * @return Image as a nifti image
   */
@@ -57,9 +64,26 @@ nifti_image *reg_io_ReadImageFile(const char *filename);
   */
 nifti_image *reg_io_ReadImageHeader(const char *filename);
 /* *************************************************************** */
+/** The function expects a filename and returns a nifti_image structure that
+  * only contains a spatial region of interest of the image, all time points
+  * and vector components included. Only the region is read from the nifti
+  * files, slab by slab for uncompressed files and as a stream for compressed
+  * files. The qform and sform origins are moved to the first voxel of the region.
+  * A NULL image is returned if the region can not be read
+  * @param filename Filename of the input images
+  * @param start Index of the first voxel of the region along x, y and z
+  * @param size Number of voxels of the region along x, y and z
+  * @return Region of interest as a nifti image
+  */
+nifti_image *reg_io_ReadImageROI(const char *filename,
+                                 const int start[3],
+                                 const int size[3]);
+/* *************************************************************** */
 /** The function expects a filename and nifti_image structure
   * The image will be converted to the format specified in the
   * filename before being saved
+  * The compressed nifti files (.nii.gz) are written as a concatenation of
+  * gzip members that are compressed in parallel
   * @param image Nifti image to be saved
   * @param filename Filename of the output images
   */
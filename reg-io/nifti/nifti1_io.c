@@ -5012,11 +5012,38 @@ size_t nifti_read_buffer(znzFile fp, void* dataptr, size_t ntot,
 void nifti_image_unload( nifti_image *nim )
 {
    if( nim != NULL && nim->data != NULL ){
-     free(nim->data) ; nim->data = NULL ;
+     nifti_free_data(nim->data) ; nim->data = NULL ;
    }
    return ;
 }
 
+/*--------------------------------------------------------------------------*/
+/*! function used to release the image data that were not allocated using
+    malloc (e.g. memory mapped files), it returns 1 if it released the data
+*//*------------------------------------------------------------------------*/
+static int (*g_data_free_function)(void *) = NULL ;
+
+/*--------------------------------------------------------------------------*/
+/*! set the function used to release the data not allocated using malloc
+
+    \param fn  function that returns 1 if it released the data, 0 if the
+                data have to be released using free, or NULL
+*//*------------------------------------------------------------------------*/
+void nifti_set_data_free_function( int (*fn)(void *) )
+{
+   g_data_free_function = fn ;
+}
+
+/*--------------------------------------------------------------------------*/
+/*! release the data array of a nifti_image struct
+*//*------------------------------------------------------------------------*/
+void nifti_free_data( void *data )
+{
+   if( data == NULL ) return ;
+   if( g_data_free_function != NULL && g_data_free_function(data) ) return ;
+   free(data) ;
+}
+
 /*--------------------------------------------------------------------------*/
 /*! free 'everything' about a nifti_image struct (including the passed struct)
 
@@ -5032,7 +5059,7 @@ void nifti_image_free( nifti_image *nim )
    if( nim == NULL ) return ;
    if( nim->fname != NULL ) free(nim->fname) ;
    if( nim->iname != NULL ) free(nim->iname) ;
-   if( nim->data  != NULL ) free(nim->data ) ;
+   if( nim->data  != NULL ) nifti_free_data(nim->data ) ;
    (void)nifti_free_extensions( nim ) ;
    free(nim) ; return ;
 }
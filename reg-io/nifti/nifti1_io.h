@@ -296,6 +296,8 @@ extern "C" {
    int          nifti_image_load    ( nifti_image *nim ) ;
    void         nifti_image_unload  ( nifti_image *nim ) ;
    void         nifti_image_free    ( nifti_image *nim ) ;
+   void         nifti_free_data     ( void *data ) ;
+   void         nifti_set_data_free_function( int (*fn)(void *) ) ;
 
    int          nifti_read_collapsed_image( nifti_image * nim, const int dims [8],
          void ** data );
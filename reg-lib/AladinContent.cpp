@@ -1,4 +1,5 @@
 #include "AladinContent.h"
+#include "_reg_tools.h"
 
 using namespace std;
 
@@ -94,12 +95,15 @@ AladinContent::~AladinContent()
 {
    ClearWarpedImage();
    ClearDeformationField();
+   if (this->CurrentSparseMask != NULL)
+      free(this->CurrentSparseMask);
    if (this->blockMatchingParams != NULL)
       delete this->blockMatchingParams;
 }
 /* *************************************************************** */
 void AladinContent::initVars()
 {
+   this->CurrentSparseMask = NULL;
    if (this->CurrentFloating != NULL && this->CurrentReference != NULL) {
       this->AllocateWarpedImage();
    }
@@ -155,6 +159,14 @@ void AladinContent::AllocateWarpedImage()
 	this->CurrentWarped->nvox = (size_t) this->CurrentWarped->nx * (size_t) this->CurrentWarped->ny * (size_t) this->CurrentWarped->nz * (size_t) this->CurrentWarped->nt;
 	this->CurrentWarped->datatype = this->CurrentFloating->datatype;
 	this->CurrentWarped->nbyper = this->CurrentFloating->nbyper;
+	// An integer floating image is warped with the reference precision as the
+	// warped image is compared to the reference by the block matching
+	if (this->blockMatchingParams != NULL &&
+		 this->CurrentFloating->datatype != this->CurrentReference->datatype &&
+		 reg_tools_hasNativeIntegerIntensities(this->CurrentFloating)) {
+		this->CurrentWarped->datatype = this->CurrentReference->datatype;
+		this->CurrentWarped->nbyper = this->CurrentReference->nbyper;
+	}
 	this->CurrentWarped->data = (void *) calloc(this->CurrentWarped->nvox, this->CurrentWarped->nbyper);
 	//this->floatingDatatype = this->CurrentFloating->datatype;
 }
@@ -202,6 +214,24 @@ void AladinContent::AllocateDeformationField(size_t bytes)
 void AladinContent::setCaptureRange(const int voxelCaptureRangeIn)
 {
 	this->blockMatchingParams->voxelCaptureRange = voxelCaptureRangeIn;
+	// The support of the block matching depends on the capture range
+	if (this->CurrentSparseMask != NULL)
+		this->setSparseWarping(true);
+}
+/* *************************************************************** */
+void AladinContent::setSparseWarping(const bool sparseWarpingIn)
+{
+	if (this->CurrentSparseMask != NULL) {
+		free(this->CurrentSparseMask);
+		this->CurrentSparseMask = NULL;
+	}
+	if (sparseWarpingIn && this->blockMatchingParams != NULL) {
+		this->CurrentSparseMask = (int *) malloc(this->CurrentReference->nx * this->CurrentReference->ny * this->CurrentReference->nz * sizeof(int));
+		block_matching_support_mask(this->CurrentReference,
+											 this->blockMatchingParams,
+											 this->CurrentReferenceMask,
+											 this->CurrentSparseMask);
+	}
 }
 /* *************************************************************** */
 void AladinContent::ClearDeformationField()
@@ -71,6 +71,12 @@ public:
 	{
 		return this->CurrentReferenceMask;
 	}
+	/// Mask restricted to the voxels read by the block matching, NULL if
+	/// the whole reference space has to be warped
+	int *getCurrentSparseMask()
+	{
+		return this->CurrentSparseMask;
+	}
 	mat44 *getTransformationMatrix()
 	{
 		return this->transformationMatrix;
@@ -94,6 +100,7 @@ public:
 
 	virtual void setCurrentReferenceMask(int *, size_t) {}
 	void setCaptureRange(const int captureRangeIn);
+	void setSparseWarping(const bool sparseWarpingIn);
 	//
 	virtual void setBlockMatchingParams(_reg_blockMatchingParam* bmp) {
 		blockMatchingParams = bmp;
@@ -105,6 +112,7 @@ protected:
 	nifti_image *CurrentReference;
 	nifti_image *CurrentFloating;
 	int *CurrentReferenceMask;
+	int *CurrentSparseMask;
 
 	nifti_image *CurrentDeformationField;
 	nifti_image *CurrentWarped;
@@ -55,6 +55,8 @@ template<class T> reg_aladin<T>::reg_aladin()
   this->PerformAffine = 1;
 
   this->BlockStepSize = 1;
+  this->HierarchicalSearch = false;
+  this->SparseWarping = true;
   this->BlockPercentage = 50;
   this->InlierLts = 50;
 
@@ -75,6 +77,10 @@ template<class T> reg_aladin<T>::reg_aladin()
   this->funcProgressCallback = NULL;
   this->paramsProgressCallback = NULL;
 
+  // The integer floating intensities of the finest level can be converted on
+  // the fly by the resampling
+  this->NativeFinestFloating = false;
+
   this->platformCode = NR_PLATFORM_CPU;
   this->CurrentLevel = 0;
   this->gpuIdx = 999;
@@ -94,7 +100,7 @@ template<class T> reg_aladin<T>::~reg_aladin()
     for (unsigned int l = 0; l < this->LevelsToPerform; ++l)
     {
       if(this->ReferencePyramid[l] != NULL)
-        nifti_image_free(this->ReferencePyramid[l]);
+        reg_tools_freeTrackedImage(this->ReferencePyramid[l]);
       this->ReferencePyramid[l] = NULL;
     }
     free(this->ReferencePyramid);
@@ -104,7 +110,7 @@ template<class T> reg_aladin<T>::~reg_aladin()
     for (unsigned int l = 0; l < this->LevelsToPerform; ++l)
     {
       if(this->FloatingPyramid[l] != NULL)
-        nifti_image_free(this->FloatingPyramid[l]);
+        reg_tools_freeTrackedImage(this->FloatingPyramid[l]);
       this->FloatingPyramid[l] = NULL;
     }
     free(this->FloatingPyramid);
@@ -114,7 +120,7 @@ template<class T> reg_aladin<T>::~reg_aladin()
     for (unsigned int l = 0; l < this->LevelsToPerform; ++l)
     {
       if(this->ReferenceMaskPyramid[l] != NULL)
-        free(this->ReferenceMaskPyramid[l]);
+        reg_tools_trackedFree(this->ReferenceMaskPyramid[l]);
       this->ReferenceMaskPyramid[l] = NULL;
     }
     free(this->ReferenceMaskPyramid);
@@ -236,6 +242,8 @@ int reg_aladin<T>::Print()
     reg_print_info(this->executableName, text.c_str());
     text = stringFormat("Percentage of blocks: %i %%", this->BlockPercentage);
     reg_print_info(this->executableName, text.c_str());
+    if(this->HierarchicalSearch)
+      reg_print_info(this->executableName, "Hierarchical block matching search");
     reg_print_info(this->executableName, "* * * * * * * * * * * * * * * * * * * * * * * * * * * * * *");
 #ifdef NDEBUG
   }
@@ -263,69 +271,15 @@ void reg_aladin<T>::InitialiseRegistration()
   this->Print();
 
   // CREATE THE PYRAMID IMAGES
+  // The levels are only generated when they are registered
   this->ReferencePyramid = (nifti_image **) malloc(this->LevelsToPerform * sizeof(nifti_image *));
   this->FloatingPyramid = (nifti_image **) malloc(this->LevelsToPerform * sizeof(nifti_image *));
   this->ReferenceMaskPyramid = (int **) malloc(this->LevelsToPerform * sizeof(int *));
   this->activeVoxelNumber = (int *) malloc(this->LevelsToPerform * sizeof(int));
-
-  // FINEST LEVEL OF REGISTRATION
-  reg_createImagePyramid<T>(this->InputReference,
-                            this->ReferencePyramid,
-                            this->NumberOfLevels,
-                            this->LevelsToPerform);
-  reg_createImagePyramid<T>(this->InputFloating,
-                            this->FloatingPyramid,
-                            this->NumberOfLevels,
-                            this->LevelsToPerform);
-
-  if (this->InputReferenceMask != NULL)
-    reg_createMaskPyramid<T>(this->InputReferenceMask,
-                             this->ReferenceMaskPyramid,
-                             this->NumberOfLevels,
-                             this->LevelsToPerform,
-                             this->activeVoxelNumber);
-  else {
-    for (unsigned int l = 0; l < this->LevelsToPerform; ++l) {
-      this->activeVoxelNumber[l] = this->ReferencePyramid[l]->nx * this->ReferencePyramid[l]->ny * this->ReferencePyramid[l]->nz;
-      this->ReferenceMaskPyramid[l] = (int *) calloc(activeVoxelNumber[l], sizeof(int));
-    }
-  }
-
-  Kernel *convolutionKernel = this->platform->createKernel(ConvolutionKernel::getName(), NULL);
-  // SMOOTH THE INPUT IMAGES IF REQUIRED
-  for (unsigned int l = 0; l < this->LevelsToPerform; l++) {
-    if (this->ReferenceSigma != 0.0) {
-      // Only the first image is smoothed
-      bool *active = new bool[this->ReferencePyramid[l]->nt];
-      float *sigma = new float[this->ReferencePyramid[l]->nt];
-      active[0] = true;
-      for (int i = 1; i < this->ReferencePyramid[l]->nt; ++i)
-        active[i] = false;
-      sigma[0] = this->ReferenceSigma;
-      convolutionKernel->castTo<ConvolutionKernel>()->calculate(this->ReferencePyramid[l], sigma, 0, NULL, active);
-      delete[] active;
-      delete[] sigma;
-    }
-    if (this->FloatingSigma != 0.0) {
-      // Only the first image is smoothed
-      bool *active = new bool[this->FloatingPyramid[l]->nt];
-      float *sigma = new float[this->FloatingPyramid[l]->nt];
-      active[0] = true;
-      for (int i = 1; i < this->FloatingPyramid[l]->nt; ++i)
-        active[i] = false;
-      sigma[0] = this->FloatingSigma;
-      convolutionKernel->castTo<ConvolutionKernel>()->calculate(this->FloatingPyramid[l], sigma, 0, NULL, active);
-      delete[] active;
-      delete[] sigma;
-    }
-  }
-  delete convolutionKernel;
-
-  // THRESHOLD THE INPUT IMAGES IF REQUIRED
-  for(unsigned int l=0; l<this->LevelsToPerform; l++)
-  {
-    reg_thresholdImage<T>(this->ReferencePyramid[l],this->ReferenceLowerThreshold, this->ReferenceUpperThreshold);
-    reg_thresholdImage<T>(this->FloatingPyramid[l],this->FloatingLowerThreshold, this->FloatingUpperThreshold);
+  for (unsigned int l = 0; l < this->LevelsToPerform; ++l) {
+    this->ReferencePyramid[l] = NULL;
+    this->FloatingPyramid[l] = NULL;
+    this->ReferenceMaskPyramid[l] = NULL;
   }
 
   // Initialise the transformation
@@ -379,15 +333,96 @@ void reg_aladin<T>::InitialiseRegistration()
 }
 /* *************************************************************** */
 template<class T>
+void reg_aladin<T>::InitialisePyramidLevel(unsigned int level)
+{
+#ifndef NDEBUG
+  reg_print_fct_debug("reg_aladin::InitialisePyramidLevel()");
+#endif
+  if (this->ReferencePyramid[level] != NULL)
+    return;
+
+  // The finest floating image keeps its integer datatype when it is only
+  // read by the CPU resampling, which halves its memory footprint. The
+  // coarser levels are always converted
+  bool nativeFloating = this->NativeFinestFloating &&
+      this->platformCode == NR_PLATFORM_CPU &&
+      this->FloatingSigma == 0.0 &&
+      this->FloatingUpperThreshold == static_cast<float>(std::numeric_limits<T>::max()) &&
+      this->FloatingLowerThreshold == static_cast<float>(-std::numeric_limits<T>::max());
+
+  // The level is generated from the full resolution images
+  this->ReferencePyramid[level] = reg_createImagePyramidLevel<T>(this->InputReference,
+                                                                 this->NumberOfLevels,
+                                                                 this->LevelsToPerform,
+                                                                 level);
+  this->FloatingPyramid[level] = reg_createImagePyramidLevel<T>(this->InputFloating,
+                                                                this->NumberOfLevels,
+                                                                this->LevelsToPerform,
+                                                                level,
+                                                                nativeFloating);
+  reg_tools_trackImage(this->ReferencePyramid[level]);
+  reg_tools_trackImage(this->FloatingPyramid[level]);
+
+  if (this->InputReferenceMask != NULL) {
+    this->ReferenceMaskPyramid[level] = reg_createMaskPyramidLevel<T>(this->InputReferenceMask,
+                                                                      this->NumberOfLevels,
+                                                                      level,
+                                                                      &this->activeVoxelNumber[level]);
+    reg_tools_trackBuffer(this->ReferenceMaskPyramid[level],
+                          (size_t)this->ReferencePyramid[level]->nx * this->ReferencePyramid[level]->ny *
+                          this->ReferencePyramid[level]->nz * sizeof(int));
+  }
+  else {
+    this->activeVoxelNumber[level] = this->ReferencePyramid[level]->nx * this->ReferencePyramid[level]->ny * this->ReferencePyramid[level]->nz;
+    this->ReferenceMaskPyramid[level] = (int *) reg_tools_trackedCalloc(activeVoxelNumber[level], sizeof(int));
+  }
+
+  // SMOOTH THE INPUT IMAGES IF REQUIRED
+  if (this->ReferenceSigma != 0.0 || this->FloatingSigma != 0.0) {
+    Kernel *convolutionKernel = this->platform->createKernel(ConvolutionKernel::getName(), NULL);
+    if (this->ReferenceSigma != 0.0) {
+      // Only the first image is smoothed
+      bool *active = new bool[this->ReferencePyramid[level]->nt];
+      float *sigma = new float[this->ReferencePyramid[level]->nt];
+      active[0] = true;
+      for (int i = 1; i < this->ReferencePyramid[level]->nt; ++i)
+        active[i] = false;
+      sigma[0] = this->ReferenceSigma;
+      convolutionKernel->castTo<ConvolutionKernel>()->calculate(this->ReferencePyramid[level], sigma, 0, NULL, active);
+      delete[] active;
+      delete[] sigma;
+    }
+    if (this->FloatingSigma != 0.0) {
+      // Only the first image is smoothed
+      bool *active = new bool[this->FloatingPyramid[level]->nt];
+      float *sigma = new float[this->FloatingPyramid[level]->nt];
+      active[0] = true;
+      for (int i = 1; i < this->FloatingPyramid[level]->nt; ++i)
+        active[i] = false;
+      sigma[0] = this->FloatingSigma;
+      convolutionKernel->castTo<ConvolutionKernel>()->calculate(this->FloatingPyramid[level], sigma, 0, NULL, active);
+      delete[] active;
+      delete[] sigma;
+    }
+    delete convolutionKernel;
+  }
+
+  // THRESHOLD THE INPUT IMAGES IF REQUIRED
+  reg_thresholdImage<T>(this->ReferencePyramid[level],this->ReferenceLowerThreshold, this->ReferenceUpperThreshold);
+  if (!nativeFloating)
+    reg_thresholdImage<T>(this->FloatingPyramid[level],this->FloatingLowerThreshold, this->FloatingUpperThreshold);
+}
+/* *************************************************************** */
+template<class T>
 void reg_aladin<T>::ClearCurrentInputImage()
 {
-  nifti_image_free(this->ReferencePyramid[this->CurrentLevel]);
+  reg_tools_freeTrackedImage(this->ReferencePyramid[this->CurrentLevel]);
   this->ReferencePyramid[this->CurrentLevel] = NULL;
 
-  nifti_image_free(this->FloatingPyramid[this->CurrentLevel]);
+  reg_tools_freeTrackedImage(this->FloatingPyramid[this->CurrentLevel]);
   this->FloatingPyramid[this->CurrentLevel] = NULL;
 
-  free(this->ReferenceMaskPyramid[this->CurrentLevel]);
+  reg_tools_trackedFree(this->ReferenceMaskPyramid[this->CurrentLevel]);
   this->ReferenceMaskPyramid[this->CurrentLevel] = NULL;
 }
 /* *************************************************************** */
@@ -419,12 +454,14 @@ void reg_aladin<T>::clearKernels()
 template<class T>
 void reg_aladin<T>::GetDeformationField()
 {
+  reg_stageTimer timer("GetDeformationField");
   this->affineTransformation3DKernel->template castTo<AffineDeformationFieldKernel>()->calculate();
 }
 /* *************************************************************** */
 template<class T>
 void reg_aladin<T>::GetWarpedImage(int interp)
 {
+  reg_stageTimer timer("WarpFloatingImage");
   this->GetDeformationField();
   this->resamplingKernel->template castTo<ResampleImageKernel>()->calculate(interp, std::numeric_limits<T>::quiet_NaN());
 }
@@ -432,8 +469,12 @@ void reg_aladin<T>::GetWarpedImage(int interp)
 template<class T>
 void reg_aladin<T>::UpdateTransformationMatrix(int type)
 {
+  reg_stageTimer blockMatchingTimer("BlockMatching");
   this->blockMatchingKernel->template castTo<BlockMatchingKernel>()->calculate();
+  blockMatchingTimer.Stop();
+  reg_stageTimer optimiseTimer("LTSOptimisation");
   this->optimiseKernel->template castTo<OptimiseKernel>()->calculate(type);
+  optimiseTimer.Stop();
 
 #ifndef NDEBUG
   reg_mat44_disp(this->TransformationMatrix, (char *) "[NiftyReg DEBUG] updated forward matrix");
@@ -461,6 +502,9 @@ void reg_aladin<T>::initAladinContent(nifti_image *ref,
     this->con = new ClAladinContent(ref, flo, mask,transMat, bytes, blockPercentage, inlierLts, blockStepSize);
 #endif
   this->blockMatchingParams = this->con->AladinContent::getBlockMatchingParams();
+  this->blockMatchingParams->hierarchicalSearch = this->HierarchicalSearch;
+  if (this->platformCode == NR_PLATFORM_CPU)
+    this->con->setSparseWarping(this->SparseWarping);
 }
 /* *************************************************************** */
 template<class T>
@@ -516,6 +560,15 @@ void reg_aladin<T>::Run()
   //Main loop over the levels:
   for (this->CurrentLevel = 0; this->CurrentLevel < this->LevelsToPerform; this->CurrentLevel++)
   {
+    // Create the current level images
+    reg_tools_resetLevelPeakTrackedMemory();
+    char levelName[32];
+    sprintf(levelName, "Level %u", this->CurrentLevel+1);
+    reg_stageTimer levelTimer(levelName);
+    reg_stageTimer pyramidTimer("InitialisePyramidLevel");
+    this->InitialisePyramidLevel(this->CurrentLevel);
+    pyramidTimer.Stop();
+
     this->initAladinContent(this->ReferencePyramid[CurrentLevel], this->FloatingPyramid[CurrentLevel],
                             this->ReferenceMaskPyramid[CurrentLevel], this->TransformationMatrix, sizeof(T), this->BlockPercentage,
                             this->InlierLts, this->BlockStepSize);
@@ -530,6 +583,7 @@ void reg_aladin<T>::Run()
     {
 #endif
       this->DebugPrintLevelInfoStart();
+      reg_tools_printTrackedMemory(this->executableName, "level images");
 #ifdef NDEBUG
     }
 #endif
@@ -565,11 +619,16 @@ void reg_aladin<T>::Run()
     this->clearAladinContent();
     this->ClearCurrentInputImage();
 
+    levelTimer.Stop();
+    if(reg_timer_isEnabled())
+      reg_timer_printLevelStatistics(this->executableName, this->CurrentLevel+1);
+
 #ifdef NDEBUG
     if(this->Verbose)
     {
 #endif
       this->DebugPrintLevelInfoEnd();
+      reg_tools_printTrackedMemory(this->executableName, "level");
       reg_print_info(this->executableName, "- - - - - - - - - - - - - - - - - - - - - - - - - - - - - -");
 #ifdef NDEBUG
     }
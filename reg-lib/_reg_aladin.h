@@ -21,6 +21,7 @@
 #include "_reg_nmi.h"
 #include "_reg_ssd.h"
 #include "_reg_tools.h"
+#include "_reg_timer.h"
 #include "float.h"
 #include <limits>
 
@@ -85,6 +86,9 @@ class reg_aladin
         int BlockPercentage;
         int InlierLts;
         int BlockStepSize;
+        bool HierarchicalSearch;
+        bool SparseWarping;
+        bool NativeFinestFloating;
         _reg_blockMatchingParam *blockMatchingParams;
 
         bool AlignCentre;
@@ -107,6 +111,7 @@ class reg_aladin
         bool TestMatrixConvergence(mat44 *mat);
 
         virtual void InitialiseRegistration();
+        virtual void InitialisePyramidLevel(unsigned int level);
         virtual void ClearCurrentInputImage();
 
         virtual void GetDeformationField();
@@ -202,6 +207,15 @@ class reg_aladin
         SetMacro(BlockStepSize,int)
         GetMacro(BlockStepSize,int)
 
+        SetMacro(HierarchicalSearch,bool)
+        GetMacro(HierarchicalSearch,bool)
+
+        SetMacro(SparseWarping,bool)
+        GetMacro(SparseWarping,bool)
+
+        SetMacro(NativeFinestFloating,bool)
+        GetMacro(NativeFinestFloating,bool)
+
         SetMacro(InlierLts,float)
         GetMacro(InlierLts,float)
 
@@ -49,7 +49,7 @@ reg_aladin_sym<T>::~reg_aladin_sym()
          if(this->FloatingMaskPyramid[i]!=NULL)
          {
            if(this->FloatingMaskPyramid!=NULL)
-             free(this->FloatingMaskPyramid[i]);
+             reg_tools_trackedFree(this->FloatingMaskPyramid[i]);
             this->FloatingMaskPyramid[i]=NULL;
          }
       }
@@ -82,70 +82,8 @@ void reg_aladin_sym<T>::InitialiseRegistration()
    reg_aladin<T>::InitialiseRegistration();
    this->FloatingMaskPyramid = (int **) malloc(this->LevelsToPerform*sizeof(int *));
    this->BackwardActiveVoxelNumber= (int *)malloc(this->LevelsToPerform*sizeof(int));
-   if (this->InputFloatingMask!=NULL)
-   {
-      reg_createMaskPyramid<T>(this->InputFloatingMask,
-                               this->FloatingMaskPyramid,
-                               this->NumberOfLevels,
-                               this->LevelsToPerform,
-                               this->BackwardActiveVoxelNumber);
-   }
-   else
-   {
-      for(unsigned int l=0; l<this->LevelsToPerform; ++l)
-      {
-         this->BackwardActiveVoxelNumber[l]=this->FloatingPyramid[l]->nx*this->FloatingPyramid[l]->ny*this->FloatingPyramid[l]->nz;
-         this->FloatingMaskPyramid[l]=(int *)calloc(this->BackwardActiveVoxelNumber[l],sizeof(int));
-      }
-   }
-
-   // CHECK THE THRESHOLD VALUES TO UPDATE THE MASK
-   if(this->FloatingUpperThreshold!=std::numeric_limits<T>::max())
-   {
-      for(unsigned int l=0; l<this->LevelsToPerform; ++l)
-      {
-         T *refPtr = static_cast<T *>(this->FloatingPyramid[l]->data);
-         int *mskPtr = this->FloatingMaskPyramid[l];
-         size_t removedVoxel=0;
-         for(size_t i=0;
-               i<(size_t)this->FloatingPyramid[l]->nx*this->FloatingPyramid[l]->ny*this->FloatingPyramid[l]->nz;
-               ++i)
-         {
-            if(mskPtr[i]>-1)
-            {
-               if(refPtr[i]>this->FloatingUpperThreshold)
-               {
-                  ++removedVoxel;
-                  mskPtr[i]=-1;
-               }
-            }
-         }
-         this->BackwardActiveVoxelNumber[l] -= removedVoxel;
-      }
-   }
-   if(this->FloatingLowerThreshold!=-std::numeric_limits<T>::max())
-   {
-      for(unsigned int l=0; l<this->LevelsToPerform; ++l)
-      {
-         T *refPtr = static_cast<T *>(this->FloatingPyramid[l]->data);
-         int *mskPtr = this->FloatingMaskPyramid[l];
-         size_t removedVoxel=0;
-         for(size_t i=0;
-               i<(size_t)this->FloatingPyramid[l]->nx*this->FloatingPyramid[l]->ny*this->FloatingPyramid[l]->nz;
-               ++i)
-         {
-            if(mskPtr[i]>-1)
-            {
-               if(refPtr[i]<this->FloatingLowerThreshold)
-               {
-                  ++removedVoxel;
-                  mskPtr[i]=-1;
-               }
-            }
-         }
-         this->BackwardActiveVoxelNumber[l] -= removedVoxel;
-      }
-   }
+   for(unsigned int l=0; l<this->LevelsToPerform; ++l)
+      this->FloatingMaskPyramid[l]=NULL;
 
    if(this->AlignCentreGravity && this->InputTransformName==NULL)
    {
@@ -212,14 +150,89 @@ void reg_aladin_sym<T>::InitialiseRegistration()
 }
 /* *************************************************************** */
 template <class T>
+void reg_aladin_sym<T>::InitialisePyramidLevel(unsigned int level)
+{
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_aladin_sym::InitialisePyramidLevel() called");
+#endif
+
+   // The floating image is also used as the backward reference image and
+   // is thus always converted
+   this->NativeFinestFloating=false;
+   reg_aladin<T>::InitialisePyramidLevel(level);
+   if(this->FloatingMaskPyramid[level]!=NULL)
+      return;
+
+   if (this->InputFloatingMask!=NULL)
+   {
+      this->FloatingMaskPyramid[level]=reg_createMaskPyramidLevel<T>(this->InputFloatingMask,
+                                                                     this->NumberOfLevels,
+                                                                     level,
+                                                                     &this->BackwardActiveVoxelNumber[level]);
+      reg_tools_trackBuffer(this->FloatingMaskPyramid[level],
+                            (size_t)this->FloatingPyramid[level]->nx*this->FloatingPyramid[level]->ny*
+                            this->FloatingPyramid[level]->nz*sizeof(int));
+   }
+   else
+   {
+      this->BackwardActiveVoxelNumber[level]=this->FloatingPyramid[level]->nx*this->FloatingPyramid[level]->ny*this->FloatingPyramid[level]->nz;
+      this->FloatingMaskPyramid[level]=(int *)reg_tools_trackedCalloc(this->BackwardActiveVoxelNumber[level],sizeof(int));
+   }
+
+   // CHECK THE THRESHOLD VALUES TO UPDATE THE MASK
+   if(this->FloatingUpperThreshold!=std::numeric_limits<T>::max())
+   {
+      T *refPtr = static_cast<T *>(this->FloatingPyramid[level]->data);
+      int *mskPtr = this->FloatingMaskPyramid[level];
+      size_t removedVoxel=0;
+      for(size_t i=0;
+            i<(size_t)this->FloatingPyramid[level]->nx*this->FloatingPyramid[level]->ny*this->FloatingPyramid[level]->nz;
+            ++i)
+      {
+         if(mskPtr[i]>-1)
+         {
+            if(refPtr[i]>this->FloatingUpperThreshold)
+            {
+               ++removedVoxel;
+               mskPtr[i]=-1;
+            }
+         }
+      }
+      this->BackwardActiveVoxelNumber[level] -= removedVoxel;
+   }
+   if(this->FloatingLowerThreshold!=-std::numeric_limits<T>::max())
+   {
+      T *refPtr = static_cast<T *>(this->FloatingPyramid[level]->data);
+      int *mskPtr = this->FloatingMaskPyramid[level];
+      size_t removedVoxel=0;
+      for(size_t i=0;
+            i<(size_t)this->FloatingPyramid[level]->nx*this->FloatingPyramid[level]->ny*this->FloatingPyramid[level]->nz;
+            ++i)
+      {
+         if(mskPtr[i]>-1)
+         {
+            if(refPtr[i]<this->FloatingLowerThreshold)
+            {
+               ++removedVoxel;
+               mskPtr[i]=-1;
+            }
+         }
+      }
+      this->BackwardActiveVoxelNumber[level] -= removedVoxel;
+   }
+}
+/* *************************************************************** */
+template <class T>
 void reg_aladin_sym<T>::GetBackwardDeformationField()
 {
+   reg_stageTimer timer("GetDeformationField");
    this->bAffineTransformation3DKernel->template castTo<AffineDeformationFieldKernel>()->calculate();
 }
 /* *************************************************************** */
 template <class T>
 void reg_aladin_sym<T>::GetWarpedImage(int interp)
 {
+   reg_stageTimer timer("WarpFloatingImage");
    reg_aladin<T>::GetWarpedImage(interp);
    this->GetBackwardDeformationField();
    this->bResamplingKernel->template castTo<ResampleImageKernel>()->calculate(interp, std::numeric_limits<T>::quiet_NaN());
@@ -232,8 +245,12 @@ void reg_aladin_sym<T>::UpdateTransformationMatrix(int type){
   reg_aladin<T>::UpdateTransformationMatrix(type);
 
   // Update now the backward transformation matrix
+  reg_stageTimer blockMatchingTimer("BlockMatching");
   this->bBlockMatchingKernel->template castTo<BlockMatchingKernel>()->calculate();
+  blockMatchingTimer.Stop();
+  reg_stageTimer optimiseTimer("LTSOptimisation");
   this->bOptimiseKernel->template castTo<OptimiseKernel>()->calculate(type);
+  optimiseTimer.Stop();
 
 #ifndef NDEBUG
    reg_mat44_disp(this->TransformationMatrix, (char *)"[NiftyReg DEBUG] pre-updated forward transformation matrix");
@@ -315,6 +332,9 @@ void reg_aladin_sym<T>::initAladinContent(nifti_image *ref,
   this->backCon = new ClAladinContent(flo, ref, this->FloatingMaskPyramid[this->CurrentLevel],this->BackwardTransformationMatrix,bytes, blockPercentage, inlierLts, blockStepSize);
 #endif
   this->BackwardBlockMatchingParams = backCon->AladinContent::getBlockMatchingParams();
+  this->BackwardBlockMatchingParams->hierarchicalSearch = this->HierarchicalSearch;
+  if (this->platformCode == NR_PLATFORM_CPU)
+    this->backCon->setSparseWarping(this->SparseWarping);
 }
 /* *************************************************************** */
 template <class T>
@@ -322,7 +342,7 @@ void reg_aladin_sym<T>::ClearCurrentInputImage()
 {
    reg_aladin<T>::ClearCurrentInputImage();
    if(this->FloatingMaskPyramid[this->CurrentLevel]!=NULL)
-      free(this->FloatingMaskPyramid[this->CurrentLevel]);
+      reg_tools_trackedFree(this->FloatingMaskPyramid[this->CurrentLevel]);
    this->FloatingMaskPyramid[this->CurrentLevel]=NULL;
 }
 /* *************************************************************** */
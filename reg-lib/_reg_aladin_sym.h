@@ -55,6 +55,7 @@ protected:
   virtual void DebugPrintLevelInfoStart();
   virtual void DebugPrintLevelInfoEnd();
   virtual void InitialiseRegistration();
+  virtual void InitialisePyramidLevel(unsigned int level);
   virtual void GetWarpedImage(int);
 
 public:
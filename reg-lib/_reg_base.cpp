@@ -74,6 +74,7 @@ reg_base<T>::reg_base(int refTimePoint,int floTimePoint)
    this->levelNumber=3;
    this->levelToPerform=0;
    this->gradientSmoothingSigma=0;
+   this->gradientSmoothingKernelType=GAUSSIAN_KERNEL;
    this->verbose=true;
    this->usePyramid=true;
    this->forwardJacobianMatrix=NULL;
@@ -119,7 +120,7 @@ reg_base<T>::~reg_base()
          {
             if(referencePyramid[i]!=NULL)
             {
-               nifti_image_free(referencePyramid[i]);
+               reg_tools_freeTrackedImage(referencePyramid[i]);
                referencePyramid[i]=NULL;
             }
          }
@@ -128,7 +129,7 @@ reg_base<T>::~reg_base()
       {
          if(referencePyramid[0]!=NULL)
          {
-            nifti_image_free(referencePyramid[0]);
+            reg_tools_freeTrackedImage(referencePyramid[0]);
             referencePyramid[0]=NULL;
          }
       }
@@ -143,7 +144,7 @@ reg_base<T>::~reg_base()
          {
             if(this->maskPyramid[i]!=NULL)
             {
-               free(this->maskPyramid[i]);
+               reg_tools_trackedFree(this->maskPyramid[i]);
                this->maskPyramid[i]=NULL;
             }
          }
@@ -152,7 +153,7 @@ reg_base<T>::~reg_base()
       {
          if(this->maskPyramid[0]!=NULL)
          {
-            free(this->maskPyramid[0]);
+            reg_tools_trackedFree(this->maskPyramid[0]);
             this->maskPyramid[0]=NULL;
          }
       }
@@ -167,7 +168,7 @@ reg_base<T>::~reg_base()
          {
             if(floatingPyramid[i]!=NULL)
             {
-               nifti_image_free(floatingPyramid[i]);
+               reg_tools_freeTrackedImage(floatingPyramid[i]);
                floatingPyramid[i]=NULL;
             }
          }
@@ -176,7 +177,7 @@ reg_base<T>::~reg_base()
       {
          if(floatingPyramid[0]!=NULL)
          {
-            nifti_image_free(floatingPyramid[0]);
+            reg_tools_freeTrackedImage(floatingPyramid[0]);
             floatingPyramid[0]=NULL;
          }
       }
@@ -419,6 +420,21 @@ void reg_base<T>::SetGradientSmoothingSigma(T g)
 }
 /* *************************************************************** */
 template<class T>
+void reg_base<T>::SetGradientSmoothingKernelType(int type)
+{
+   if(type!=GAUSSIAN_KERNEL && type!=IIR_GAUSSIAN_KERNEL)
+   {
+      reg_print_fct_error("reg_base<T>::SetGradientSmoothingKernelType");
+      reg_print_msg_error("The gradient can only be smoothed using a Gaussian or a recursive Gaussian kernel");
+      reg_exit();
+   }
+   this->gradientSmoothingKernelType = type;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::SetGradientSmoothingKernelType");
+#endif
+}
+/* *************************************************************** */
+template<class T>
 void reg_base<T>::UseConjugateGradient()
 {
    this->useConjGradient = true;
@@ -528,7 +544,7 @@ void reg_base<T>::ClearCurrentInputImage()
    this->currentMask=NULL;
    this->currentFloating=NULL;
    if(this->localWeightSimCurrent!=NULL)
-      nifti_image_free(this->localWeightSimCurrent);
+      reg_tools_freeTrackedImage(this->localWeightSimCurrent);
    this->localWeightSimCurrent=NULL;
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::ClearCurrentInputImage");
@@ -559,7 +575,7 @@ void reg_base<T>::AllocateWarped()
    this->warped->scl_inter=0.f;
    this->warped->datatype = this->currentFloating->datatype;
    this->warped->nbyper = this->currentFloating->nbyper;
-   this->warped->data = (void *)calloc(this->warped->nvox, this->warped->nbyper);
+   this->warped->data = (void *)reg_tools_trackedCalloc(this->warped->nvox, this->warped->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::AllocateWarped");
 #endif
@@ -569,7 +585,7 @@ template <class T>
 void reg_base<T>::ClearWarped()
 {
    if(this->warped!=NULL)
-      nifti_image_free(this->warped);
+      reg_tools_freeTrackedImage(this->warped);
    this->warped=NULL;
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::ClearWarped");
@@ -612,7 +628,7 @@ void reg_base<T>::AllocateDeformationField()
    if(sizeof(T)==sizeof(float))
       this->deformationFieldImage->datatype = NIFTI_TYPE_FLOAT32;
    else this->deformationFieldImage->datatype = NIFTI_TYPE_FLOAT64;
-   this->deformationFieldImage->data = (void *)calloc(this->deformationFieldImage->nvox,
+   this->deformationFieldImage->data = (void *)reg_tools_trackedCalloc(this->deformationFieldImage->nvox,
                                        this->deformationFieldImage->nbyper);
    this->deformationFieldImage->intent_code=NIFTI_INTENT_VECTOR;
    memset(this->deformationFieldImage->intent_name, 0, 16);
@@ -622,7 +638,7 @@ void reg_base<T>::AllocateDeformationField()
    this->deformationFieldImage->scl_inter=0.f;
 
    if(this->measure_dti!=NULL)
-      this->forwardJacobianMatrix=(mat33 *)malloc(
+      this->forwardJacobianMatrix=(mat33 *)reg_tools_trackedMalloc(
                                      this->deformationFieldImage->nx *
                                      this->deformationFieldImage->ny *
                                      this->deformationFieldImage->nz *
@@ -637,11 +653,11 @@ void reg_base<T>::ClearDeformationField()
 {
    if(this->deformationFieldImage!=NULL)
    {
-      nifti_image_free(this->deformationFieldImage);
+      reg_tools_freeTrackedImage(this->deformationFieldImage);
       this->deformationFieldImage=NULL;
    }
    if(this->forwardJacobianMatrix!=NULL)
-      free(this->forwardJacobianMatrix);
+      reg_tools_trackedFree(this->forwardJacobianMatrix);
    this->forwardJacobianMatrix=NULL;
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::ClearDeformationField");
@@ -659,7 +675,7 @@ void reg_base<T>::AllocateWarpedGradient()
    }
    reg_base<T>::ClearWarpedGradient();
    this->warImgGradient = nifti_copy_nim_info(this->deformationFieldImage);
-   this->warImgGradient->data = (void *)calloc(this->warImgGradient->nvox,
+   this->warImgGradient->data = (void *)reg_tools_trackedCalloc(this->warImgGradient->nvox,
                                      this->warImgGradient->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::AllocateWarpedGradient");
@@ -671,7 +687,7 @@ void reg_base<T>::ClearWarpedGradient()
 {
    if(this->warImgGradient!=NULL)
    {
-      nifti_image_free(this->warImgGradient);
+      reg_tools_freeTrackedImage(this->warImgGradient);
       this->warImgGradient=NULL;
    }
 #ifndef NDEBUG
@@ -690,7 +706,7 @@ void reg_base<T>::AllocateVoxelBasedMeasureGradient()
    }
    reg_base<T>::ClearVoxelBasedMeasureGradient();
    this->voxelBasedMeasureGradient = nifti_copy_nim_info(this->deformationFieldImage);
-   this->voxelBasedMeasureGradient->data = (void *)calloc(this->voxelBasedMeasureGradient->nvox,
+   this->voxelBasedMeasureGradient->data = (void *)reg_tools_trackedCalloc(this->voxelBasedMeasureGradient->nvox,
          this->voxelBasedMeasureGradient->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::AllocateVoxelBasedMeasureGradient");
@@ -702,7 +718,7 @@ void reg_base<T>::ClearVoxelBasedMeasureGradient()
 {
    if(this->voxelBasedMeasureGradient!=NULL)
    {
-      nifti_image_free(this->voxelBasedMeasureGradient);
+      reg_tools_freeTrackedImage(this->voxelBasedMeasureGradient);
       this->voxelBasedMeasureGradient=NULL;
    }
 #ifndef NDEBUG
@@ -910,7 +926,7 @@ void reg_base<T>::InitialiseSimilarity()
 
    if(this->localWeightSimInput!=NULL){
       if(this->localWeightSimCurrent!=NULL)
-         nifti_image_free(this->localWeightSimCurrent);
+         reg_tools_freeTrackedImage(this->localWeightSimCurrent);
       this->localWeightSimCurrent=nifti_copy_nim_info(this->currentReference);
       this->localWeightSimCurrent->dim[0]=this->localWeightSimCurrent->ndim=this->localWeightSimInput->dim[0];
       this->localWeightSimCurrent->dim[4]=this->localWeightSimCurrent->nt=this->localWeightSimInput->dim[4];
@@ -918,7 +934,7 @@ void reg_base<T>::InitialiseSimilarity()
       this->localWeightSimCurrent->nvox = (size_t)this->localWeightSimCurrent->nx *
             this->localWeightSimCurrent->ny * this->localWeightSimCurrent->nz *
             this->localWeightSimCurrent->nt * this->localWeightSimCurrent->nu;
-      this->localWeightSimCurrent->data = (void *)malloc(this->localWeightSimCurrent->nvox *
+      this->localWeightSimCurrent->data = (void *)reg_tools_trackedMalloc(this->localWeightSimCurrent->nvox *
                                                          this->localWeightSimCurrent->nbyper);
       reg_tools_multiplyValueToImage(this->voxelBasedMeasureGradient,
                                      this->voxelBasedMeasureGradient,
@@ -1072,78 +1088,101 @@ void reg_base<T>::Initialise()
       nifti_image_free(temp_floating);
    }
 
-   // FINEST LEVEL OF REGISTRATION
-   if(this->usePyramid)
+   // The pyramid levels are only created when required
+   unsigned int pyramidalLevelNumber=1;
+   if(this->usePyramid) pyramidalLevelNumber=this->levelToPerform;
+   for(unsigned int l=0; l<pyramidalLevelNumber; l++)
    {
-      reg_createImagePyramid<T>(this->inputReference, this->referencePyramid, this->levelNumber, this->levelToPerform);
-      reg_createImagePyramid<T>(this->inputFloating, this->floatingPyramid, this->levelNumber, this->levelToPerform);
-      if (this->maskImage!=NULL)
-         reg_createMaskPyramid<T>(this->maskImage, this->maskPyramid, this->levelNumber, this->levelToPerform, this->activeVoxelNumber);
-      else
-      {
-         for(unsigned int l=0; l<this->levelToPerform; ++l)
-         {
-            this->activeVoxelNumber[l]=this->referencePyramid[l]->nx*this->referencePyramid[l]->ny*this->referencePyramid[l]->nz;
-            this->maskPyramid[l]=(int *)calloc(activeVoxelNumber[l],sizeof(int));
-         }
-      }
+      this->referencePyramid[l]=NULL;
+      this->floatingPyramid[l]=NULL;
+      this->maskPyramid[l]=NULL;
+   }
+   // The first level is used to initialise the transformation
+   this->InitialisePyramidLevel(0);
+
+   this->initialised=true;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::Initialise");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template<class T>
+void reg_base<T>::InitialisePyramidLevel(unsigned int level)
+{
+   // Without pyramid, the full resolution images are used by all levels
+   unsigned int index=level;
+   unsigned int levelNumber=this->levelNumber;
+   unsigned int levelToPerform=this->levelToPerform;
+   if(!this->usePyramid)
+   {
+      index=0;
+      levelNumber=1;
+      levelToPerform=1;
+   }
+   if(this->referencePyramid[index]!=NULL)
+      return;
+
+   // The level is generated from the full resolution images
+   this->referencePyramid[index]=reg_createImagePyramidLevel<T>(this->inputReference,
+                                                                levelNumber,
+                                                                levelToPerform,
+                                                                index);
+   this->floatingPyramid[index]=reg_createImagePyramidLevel<T>(this->inputFloating,
+                                                               levelNumber,
+                                                               levelToPerform,
+                                                               index);
+   reg_tools_trackImage(this->referencePyramid[index]);
+   reg_tools_trackImage(this->floatingPyramid[index]);
+   if (this->maskImage!=NULL)
+   {
+      this->maskPyramid[index]=reg_createMaskPyramidLevel<T>(this->maskImage,
+                                                             levelNumber,
+                                                             index,
+                                                             &this->activeVoxelNumber[index]);
+      reg_tools_trackBuffer(this->maskPyramid[index],
+                            (size_t)this->referencePyramid[index]->nx*this->referencePyramid[index]->ny*
+                            this->referencePyramid[index]->nz*sizeof(int));
    }
    else
    {
-      reg_createImagePyramid<T>(this->inputReference, this->referencePyramid, 1, 1);
-      reg_createImagePyramid<T>(this->inputFloating, this->floatingPyramid, 1, 1);
-      if (this->maskImage!=NULL)
-         reg_createMaskPyramid<T>(this->maskImage, this->maskPyramid, 1, 1, this->activeVoxelNumber);
-      else
-      {
-         this->activeVoxelNumber[0]=this->referencePyramid[0]->nx*this->referencePyramid[0]->ny*this->referencePyramid[0]->nz;
-         this->maskPyramid[0]=(int *)calloc(activeVoxelNumber[0],sizeof(int));
-      }
+      this->activeVoxelNumber[index]=this->referencePyramid[index]->nx*this->referencePyramid[index]->ny*this->referencePyramid[index]->nz;
+      this->maskPyramid[index]=(int *)reg_tools_trackedCalloc(activeVoxelNumber[index],sizeof(int));
    }
 
-   unsigned int pyramidalLevelNumber=1;
-   if(this->usePyramid) pyramidalLevelNumber=this->levelToPerform;
-
    // SMOOTH THE INPUT IMAGES IF REQUIRED
-   for(unsigned int l=0; l<this->levelToPerform; l++)
+   if(this->referenceSmoothingSigma!=0.0)
    {
-      if(this->referenceSmoothingSigma!=0.0)
-      {
-         bool *active = new bool[this->referencePyramid[l]->nt];
-         float *sigma = new float[this->referencePyramid[l]->nt];
-         active[0]=true;
-         for(int i=1; i<this->referencePyramid[l]->nt; ++i)
-            active[i]=false;
-         sigma[0]=this->referenceSmoothingSigma;
-         reg_tools_kernelConvolution(this->referencePyramid[l], sigma, GAUSSIAN_KERNEL, NULL, active);
-         delete []active;
-         delete []sigma;
-      }
-      if(this->floatingSmoothingSigma!=0.0)
-      {
-         // Only the first image is smoothed
-         bool *active = new bool[this->floatingPyramid[l]->nt];
-         float *sigma = new float[this->floatingPyramid[l]->nt];
-         active[0]=true;
-         for(int i=1; i<this->floatingPyramid[l]->nt; ++i)
-            active[i]=false;
-         sigma[0]=this->floatingSmoothingSigma;
-         reg_tools_kernelConvolution(this->floatingPyramid[l], sigma, GAUSSIAN_KERNEL, NULL, active);
-         delete []active;
-         delete []sigma;
-      }
+      bool *active = new bool[this->referencePyramid[index]->nt];
+      float *sigma = new float[this->referencePyramid[index]->nt];
+      active[0]=true;
+      for(int i=1; i<this->referencePyramid[index]->nt; ++i)
+         active[i]=false;
+      sigma[0]=this->referenceSmoothingSigma;
+      reg_tools_kernelConvolution(this->referencePyramid[index], sigma, GAUSSIAN_KERNEL, NULL, active);
+      delete []active;
+      delete []sigma;
    }
-
-   // THRESHOLD THE INPUT IMAGES IF REQUIRED
-   for(unsigned int l=0; l<pyramidalLevelNumber; l++)
+   if(this->floatingSmoothingSigma!=0.0)
    {
-      reg_thresholdImage<T>(this->referencePyramid[l],this->referenceThresholdLow[0], this->referenceThresholdUp[0]);
-      reg_thresholdImage<T>(this->floatingPyramid[l],this->referenceThresholdLow[0], this->referenceThresholdUp[0]);
+      // Only the first image is smoothed
+      bool *active = new bool[this->floatingPyramid[index]->nt];
+      float *sigma = new float[this->floatingPyramid[index]->nt];
+      active[0]=true;
+      for(int i=1; i<this->floatingPyramid[index]->nt; ++i)
+         active[i]=false;
+      sigma[0]=this->floatingSmoothingSigma;
+      reg_tools_kernelConvolution(this->floatingPyramid[index], sigma, GAUSSIAN_KERNEL, NULL, active);
+      delete []active;
+      delete []sigma;
    }
 
-   this->initialised=true;
+   // THRESHOLD THE INPUT IMAGES IF REQUIRED
+   reg_thresholdImage<T>(this->referencePyramid[index],this->referenceThresholdLow[0], this->referenceThresholdUp[0]);
+   reg_thresholdImage<T>(this->floatingPyramid[index],this->referenceThresholdLow[0], this->referenceThresholdUp[0]);
+
 #ifndef NDEBUG
-   reg_print_fct_debug("reg_base<T>::Initialise");
+   reg_print_fct_debug("reg_base<T>::InitialisePyramidLevel");
 #endif
 }
 /* *************************************************************** */
@@ -1163,6 +1202,7 @@ void reg_base<T>::SetOptimiser()
 template <class T>
 double reg_base<T>::ComputeSimilarityMeasure()
 {
+   reg_stageTimer timer("ComputeSimilarityMeasure");
    double measure=0.;
    if(this->measure_nmi!=NULL)
       measure += this->measure_nmi->GetSimilarityMeasureValue();
@@ -1195,6 +1235,7 @@ double reg_base<T>::ComputeSimilarityMeasure()
 template <class T>
 void reg_base<T>::GetVoxelBasedGradient()
 {
+   reg_stageTimer timer("GetVoxelBasedGradient");
    // The voxel based gradient image is filled with zeros
    reg_tools_multiplyValueToImage(this->voxelBasedMeasureGradient,
                                   this->voxelBasedMeasureGradient,
@@ -1457,6 +1498,7 @@ void reg_base<T>::SetLocalWeightSim(nifti_image *i)
 template <class T>
 void reg_base<T>::WarpFloatingImage(int inter)
 {
+   reg_stageTimer timer("WarpFloatingImage");
    // Compute the deformation field
    this->GetDeformationField();
 
@@ -1491,6 +1533,82 @@ void reg_base<T>::WarpFloatingImage(int inter)
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+void reg_base<T>::GetFinestLevelDim(nifti_image *image,
+                                    int dim[3],
+                                    float pixdim[3])
+{
+   unsigned int levelToPerform=this->levelToPerform;
+   if(levelToPerform==0 || levelToPerform>this->levelNumber)
+      levelToPerform=this->levelNumber;
+   if(this->usePyramid)
+      reg_getPyramidLevelDim(image, this->levelNumber, levelToPerform-1, dim, pixdim);
+   else reg_getPyramidLevelDim(image, 1, 0, dim, pixdim);
+}
+/* *************************************************************** */
+template <class T>
+size_t reg_base<T>::EstimateMeasureMemory(size_t voxelNumber,
+                                          int timePointNumber,
+                                          int dimNumber)
+{
+   size_t memory=0;
+   // Correlation, local means and standard deviations and masks
+   if(this->measure_lncc!=NULL)
+      memory += voxelNumber * ((3+2*timePointNumber)*sizeof(T) + 2*sizeof(int));
+   // Descriptors of the reference and warped images
+   if(this->measure_mind!=NULL)
+      memory += 2 * voxelNumber * (dimNumber==3?6:4) * sizeof(T);
+   if(this->measure_mindssc!=NULL)
+      memory += 2 * voxelNumber * (dimNumber==3?12:4) * sizeof(T);
+   return memory;
+}
+/* *************************************************************** */
+template <class T>
+size_t reg_base<T>::EstimatePeakMemory()
+{
+   if(this->inputReference==NULL || this->inputFloating==NULL)
+   {
+      reg_print_fct_error("reg_base<T>::EstimatePeakMemory()");
+      reg_print_msg_error("The reference and floating images have to be defined");
+      reg_exit();
+   }
+   // The finest level holds the largest images
+   int referenceDim[3], floatingDim[3];
+   float referencePixdim[3], floatingPixdim[3];
+   this->GetFinestLevelDim(this->inputReference, referenceDim, referencePixdim);
+   this->GetFinestLevelDim(this->inputFloating, floatingDim, floatingPixdim);
+   size_t referenceVoxelNumber=(size_t)referenceDim[0]*referenceDim[1]*referenceDim[2];
+   size_t floatingVoxelNumber=(size_t)floatingDim[0]*floatingDim[1]*floatingDim[2];
+   int dimNumber=referenceDim[2]>1?3:2;
+
+   // Input images
+   size_t memory=this->inputReference->nvox * this->inputReference->nbyper +
+                 this->inputFloating->nvox * this->inputFloating->nbyper;
+   if(this->maskImage!=NULL)
+      memory += this->maskImage->nvox * this->maskImage->nbyper;
+   if(this->localWeightSimInput!=NULL)
+      memory += this->localWeightSimInput->nvox * this->localWeightSimInput->nbyper +
+                referenceVoxelNumber * this->localWeightSimInput->nt * sizeof(T);
+
+   // Current level images and mask
+   memory += referenceVoxelNumber * this->inputReference->nt * sizeof(T);
+   memory += floatingVoxelNumber * this->inputFloating->nt * sizeof(T);
+   memory += referenceVoxelNumber * sizeof(int);
+
+   // Warped image, deformation field, warped image gradient and
+   // voxel-based measure gradient
+   memory += referenceVoxelNumber * this->inputFloating->nt * sizeof(T);
+   memory += 3 * referenceVoxelNumber * dimNumber * sizeof(T);
+   if(this->measure_dti!=NULL)
+      memory += referenceVoxelNumber * sizeof(mat33);
+
+   memory += this->EstimateMeasureMemory(referenceVoxelNumber,
+                                         this->inputReference->nt,
+                                         dimNumber);
+   return memory;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 void reg_base<T>::Run()
 {
 #ifndef NDEBUG
@@ -1518,6 +1636,23 @@ void reg_base<T>::Run()
          this->currentLevel++)
    {
 
+      // The memory peak is reported for every level
+      reg_tools_resetLevelPeakTrackedMemory();
+
+      // The whole level is timed along with its stages
+      char levelName[32];
+      sprintf(levelName, "Level %u", this->currentLevel+1);
+      reg_stageTimer levelTimer(levelName);
+
+      // Create the current level images if they have not been yet
+      reg_stageTimer pyramidTimer("InitialisePyramidLevel");
+      this->InitialisePyramidLevel(this->currentLevel);
+      pyramidTimer.Stop();
+#ifdef NDEBUG
+      if(this->verbose)
+#endif
+         reg_tools_printTrackedMemory(this->executableName, "level images");
+
       // Set the current input images
       if(this->usePyramid)
       {
@@ -1553,6 +1688,10 @@ void reg_base<T>::Run()
 
       // initialise the optimiser
       this->SetOptimiser();
+#ifdef NDEBUG
+      if(this->verbose)
+#endif
+         reg_tools_printTrackedMemory(this->executableName, "level allocation");
 
       // Loop over the number of perturbation to do
       for(size_t perturbation=0;
@@ -1576,16 +1715,22 @@ void reg_base<T>::Run()
             }
 
             // Compute the objective function gradient
+            reg_stageTimer gradientTimer("GetObjectiveFunctionGradient");
             this->GetObjectiveFunctionGradient();
+            gradientTimer.Stop();
 
             // Normalise the gradient
+            reg_stageTimer normalisationTimer("NormaliseGradient");
             this->NormaliseGradient();
+            normalisationTimer.Stop();
 
             // Initialise the line search initial step size
             currentSize=currentSize>maxStepSize?maxStepSize:currentSize;
 
             // A line search is performed
+            reg_stageTimer optimiseTimer("Optimise");
             this->optimiser->Optimise(maxStepSize,smallestSize,currentSize);
+            optimiseTimer.Stop();
 
             // Update the obecjtive function variables and print some information
             this->PrintCurrentObjFunctionValue(currentSize);
@@ -1614,6 +1759,10 @@ void reg_base<T>::Run()
 
       // Final folding correction
       this->CorrectTransformation();
+#ifdef NDEBUG
+      if(this->verbose)
+#endif
+         reg_tools_printTrackedMemory(this->executableName, "level optimisation");
 
       // Some cleaning is performed
       delete this->optimiser;
@@ -1625,24 +1774,28 @@ void reg_base<T>::Run()
       this->ClearTransformationGradient();
       if(this->usePyramid)
       {
-         nifti_image_free(this->referencePyramid[this->currentLevel]);
+         reg_tools_freeTrackedImage(this->referencePyramid[this->currentLevel]);
          this->referencePyramid[this->currentLevel]=NULL;
-         nifti_image_free(this->floatingPyramid[this->currentLevel]);
+         reg_tools_freeTrackedImage(this->floatingPyramid[this->currentLevel]);
          this->floatingPyramid[this->currentLevel]=NULL;
-         free(this->maskPyramid[this->currentLevel]);
+         reg_tools_trackedFree(this->maskPyramid[this->currentLevel]);
          this->maskPyramid[this->currentLevel]=NULL;
       }
       else if(this->currentLevel==this->levelToPerform-1)
       {
-         nifti_image_free(this->referencePyramid[0]);
+         reg_tools_freeTrackedImage(this->referencePyramid[0]);
          this->referencePyramid[0]=NULL;
-         nifti_image_free(this->floatingPyramid[0]);
+         reg_tools_freeTrackedImage(this->floatingPyramid[0]);
          this->floatingPyramid[0]=NULL;
-         free(this->maskPyramid[0]);
+         reg_tools_trackedFree(this->maskPyramid[0]);
          this->maskPyramid[0]=NULL;
       }
       this->ClearCurrentInputImage();
 
+      levelTimer.Stop();
+      if(reg_timer_isEnabled())
+         reg_timer_printLevelStatistics(this->executableName, this->currentLevel+1);
+
 #ifdef NDEBUG
       if(this->verbose)
       {
@@ -1655,6 +1808,10 @@ void reg_base<T>::Run()
       // Update the number of level for the next level
       this->maxiterationNumber /= 2;
    } // level this->levelToPerform
+#ifdef NDEBUG
+   if(this->verbose)
+#endif
+      reg_tools_printTrackedMemory(this->executableName, "registration");
 
 #ifndef NDEBUG
    reg_print_fct_debug("reg_base<T>::Run");
@@ -24,6 +24,7 @@
 #include "_reg_kld.h"
 #include "_reg_lncc.h"
 #include "_reg_tools.h"
+#include "_reg_timer.h"
 #include "_reg_ReadWriteImage.h"
 #include "_reg_stringFormat.h"
 #include "_reg_optimiser.h"
@@ -81,6 +82,7 @@ protected:
    unsigned int levelNumber;
    unsigned int levelToPerform;
    T gradientSmoothingSigma;
+   int gradientSmoothingKernelType;
    T similarityWeight;
    bool additive_mc_nmi;
    bool useConjGradient;
@@ -128,7 +130,18 @@ protected:
    {
       return 0.;
    }
+   /// @brief Create the images of a pyramid level if they do not exist yet
+   virtual void InitialisePyramidLevel(unsigned int level);
    virtual void ClearCurrentInputImage();
+   /// @brief Compute the dimension of the finest level to perform for an input image
+   void GetFinestLevelDim(nifti_image *image, int dim[3], float pixdim[3]);
+   /// @brief Estimate the memory in bytes allocated by the measures of similarity for one image
+   size_t EstimateMeasureMemory(size_t voxelNumber, int timePointNumber, int dimNumber);
+   /** @brief Estimate the peak memory in bytes required by the registration.
+    * The estimation only relies on the input image headers and on the options,
+    * the image data do not have to be loaded.
+    */
+   virtual size_t EstimatePeakMemory();
 
    virtual void WarpFloatingImage(int);
    virtual double ComputeSimilarityMeasure();
@@ -262,6 +275,7 @@ public:
    void SetReferenceSmoothingSigma(T);
    void SetFloatingSmoothingSigma(T);
    void SetGradientSmoothingSigma(T);
+   void SetGradientSmoothingKernelType(int);
    void SetReferenceThresholdUp(unsigned int,T);
    void SetReferenceThresholdLow(unsigned int,T);
    void SetFloatingThresholdUp(unsigned int, T);
@@ -40,6 +40,8 @@ reg_f3d<T>::reg_f3d(int refTimePoint,int floTimePoint)
 
    this->gridRefinement=true;
 
+   this->basisTable=NULL;
+
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::reg_f3d");
 #endif
@@ -50,9 +52,10 @@ template <class T>
 reg_f3d<T>::~reg_f3d()
 {
    this->ClearTransformationGradient();
+   reg_f3d<T>::ClearBasisTables();
    if(this->controlPointGrid!=NULL)
    {
-      nifti_image_free(this->controlPointGrid);
+      reg_tools_freeTrackedImage(this->controlPointGrid);
       this->controlPointGrid=NULL;
    }
 #ifndef NDEBUG
@@ -140,11 +143,17 @@ T reg_f3d<T>::InitialiseCurrentLevel()
       }
       else
       {
+         // The refinement reallocates the grid
+         reg_tools_untrackImage(this->controlPointGrid);
          reg_spline_refineControlPointGrid(this->controlPointGrid,this->currentReference);
+         reg_tools_trackImage(this->controlPointGrid);
          this->bendingEnergyWeight = this->bendingEnergyWeight * static_cast<T>(16);
       }
    }
 
+   // The basis values are tabulated once for the whole level
+   this->InitialiseBasisTables();
+
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::InitialiseCurrentLevel");
 #endif
@@ -152,6 +161,30 @@ T reg_f3d<T>::InitialiseCurrentLevel()
 }
 /* *************************************************************** */
 template <class T>
+void reg_f3d<T>::InitialiseBasisTables()
+{
+   reg_f3d<T>::ClearBasisTables();
+   this->basisTable = new reg_splineBasisTable(this->controlPointGrid,
+                                               this->currentReference);
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::InitialiseBasisTables");
+#endif
+}
+/* *************************************************************** */
+template <class T>
+void reg_f3d<T>::ClearBasisTables()
+{
+   if(this->basisTable!=NULL)
+   {
+      delete this->basisTable;
+      this->basisTable=NULL;
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::ClearBasisTables");
+#endif
+}
+/* *************************************************************** */
+template <class T>
 void reg_f3d<T>::AllocateTransformationGradient()
 {
    if(this->controlPointGrid==NULL)
@@ -162,7 +195,7 @@ void reg_f3d<T>::AllocateTransformationGradient()
    }
    reg_f3d<T>::ClearTransformationGradient();
    this->transformationGradient = nifti_copy_nim_info(this->controlPointGrid);
-   this->transformationGradient->data = (void *)calloc(this->transformationGradient->nvox,
+   this->transformationGradient->data = (void *)reg_tools_trackedCalloc(this->transformationGradient->nvox,
                                                        this->transformationGradient->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::AllocateTransformationGradient");
@@ -174,7 +207,7 @@ void reg_f3d<T>::ClearTransformationGradient()
 {
    if(this->transformationGradient!=NULL)
    {
-      nifti_image_free(this->transformationGradient);
+      reg_tools_freeTrackedImage(this->transformationGradient);
       this->transformationGradient=NULL;
    }
 #ifndef NDEBUG
@@ -269,6 +302,7 @@ void reg_f3d<T>::Initialise()
       if(this->controlPointGrid->nz>1)
          this->spacing[2] = this->controlPointGrid->dz / powf(2.0f, (float)(this->levelNumber-1));
    }
+   reg_tools_trackImage(this->controlPointGrid);
 #ifdef NDEBUG
    if(this->verbose)
    {
@@ -411,11 +445,14 @@ void reg_f3d<T>::Initialise()
 template <class T>
 void reg_f3d<T>::GetDeformationField()
 {
+   reg_stageTimer timer("GetDeformationField");
    reg_spline_getDeformationField(this->controlPointGrid,
                                   this->deformationFieldImage,
                                   this->currentMask,
                                   false, //composition
-                                  true // bspline
+                                  true, // bspline
+                                  false, // force_no_lut
+                                  this->basisTable
                                   );
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::GetDeformationField");
@@ -428,19 +465,24 @@ double reg_f3d<T>::ComputeJacobianBasedPenaltyTerm(int type)
 {
    if(this->jacobianLogWeight<=0) return 0.;
 
+   reg_stageTimer timer("ComputeJacobianBasedPenaltyTerm");
    double value=0.;
 
    if(type==2)
    {
       value = reg_spline_getJacobianPenaltyTerm(this->controlPointGrid,
                                                 this->currentReference,
-                                                false);
+                                                false,
+                                                false,
+                                                this->basisTable);
    }
    else
    {
       value = reg_spline_getJacobianPenaltyTerm(this->controlPointGrid,
                                                 this->currentReference,
-                                                this->jacobianLogApproximation);
+                                                this->jacobianLogApproximation,
+                                                false,
+                                                this->basisTable);
    }
    unsigned int maxit=5;
    if(type>0) maxit=20;
@@ -495,6 +537,7 @@ double reg_f3d<T>::ComputeBendingEnergyPenaltyTerm()
 {
    if(this->bendingEnergyWeight<=0) return 0.;
 
+   reg_stageTimer timer("ComputeBendingEnergyPenaltyTerm");
    double value = reg_spline_approxBendingEnergy(this->controlPointGrid);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::ComputeBendingEnergyPenaltyTerm");
@@ -509,6 +552,7 @@ double reg_f3d<T>::ComputeLinearEnergyPenaltyTerm()
    if(this->linearEnergyWeight<=0)
       return 0.;
 
+   reg_stageTimer timer("ComputeLinearEnergyPenaltyTerm");
    double value = reg_spline_approxLinearEnergy(this->controlPointGrid);
 
 #ifndef NDEBUG
@@ -524,6 +568,7 @@ double reg_f3d<T>::ComputeLandmarkDistancePenaltyTerm()
    if(this->landmarkRegWeight<=0)
       return 0.;
 
+   reg_stageTimer timer("ComputeLandmarkDistancePenaltyTerm");
    double value = reg_spline_getLandmarkDistance(this->controlPointGrid,
                                                  this->landmarkRegNumber,
                                                  this->landmarkReference,
@@ -603,6 +648,7 @@ void reg_f3d<T>::GetBendingEnergyGradient()
 {
    if(this->bendingEnergyWeight<=0) return;
 
+   reg_stageTimer timer("GetBendingEnergyGradient");
    reg_spline_approxBendingEnergyGradient(this->controlPointGrid,
                                           this->transformationGradient,
                                           this->bendingEnergyWeight);
@@ -617,6 +663,7 @@ void reg_f3d<T>::GetLinearEnergyGradient()
 {
    if(this->linearEnergyWeight<=0) return;
 
+   reg_stageTimer timer("GetLinearEnergyGradient");
    reg_spline_approxLinearEnergyGradient(this->controlPointGrid,
                                          this->transformationGradient,
                                          this->linearEnergyWeight);
@@ -631,6 +678,7 @@ void reg_f3d<T>::GetJacobianBasedGradient()
 {
    if(this->jacobianLogWeight<=0) return;
 
+   reg_stageTimer timer("GetJacobianBasedGradient");
    reg_spline_getJacobianPenaltyTermGradient(this->controlPointGrid,
                                              this->currentReference,
                                              this->transformationGradient,
@@ -647,6 +695,7 @@ void reg_f3d<T>::GetLandmarkDistanceGradient()
 {
    if(this->landmarkRegWeight<=0) return;
 
+   reg_stageTimer timer("GetLandmarkDistanceGradient");
    reg_spline_getLandmarkDistanceGradient(this->controlPointGrid,
                                           this->transformationGradient,
                                           this->landmarkRegNumber,
@@ -828,6 +877,15 @@ void reg_f3d<T>::DisplayCurrentLevelParameters()
               this->controlPointGrid->dx, this->controlPointGrid->dy,
               this->controlPointGrid->dz);
       reg_print_info(this->executableName, text);
+      if(this->basisTable!=NULL)
+      {
+         sprintf(text, "\t* basis value tables: %s x %s x %s, %.1f KB",
+                 this->basisTable->IsCompact(0)?"compact":"full",
+                 this->basisTable->IsCompact(1)?"compact":"full",
+                 this->basisTable->IsCompact(2)?"compact":"full",
+                 (double)this->basisTable->GetMemoryUsage()/1024.0);
+         reg_print_info(this->executableName, text);
+      }
 #ifdef NDEBUG
    }
 #endif
@@ -888,6 +946,7 @@ double reg_f3d<T>::GetObjectiveFunctionValue()
 template <class T>
 void reg_f3d<T>::UpdateParameters(float scale)
 {
+   reg_stageTimer timer("UpdateParameters");
    T *currentDOF=this->optimiser->GetCurrentDOF();
    T *bestDOF=this->optimiser->GetBestDOF();
    T *gradient=this->optimiser->GetGradient();
@@ -970,10 +1029,12 @@ void reg_f3d<T>::SmoothGradient()
    // The gradient is smoothed using a Gaussian kernel if it is required
    if(this->gradientSmoothingSigma!=0)
    {
-      float kernel = fabs(this->gradientSmoothingSigma);
+      // One standard deviation is required per gradient component
+      float kernel[3];
+      kernel[0]=kernel[1]=kernel[2]=fabs(this->gradientSmoothingSigma);
       reg_tools_kernelConvolution(this->transformationGradient,
-                                  &kernel,
-                                  GAUSSIAN_KERNEL);
+                                  kernel,
+                                  this->gradientSmoothingKernelType);
    }
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::SmoothGradient");
@@ -984,6 +1045,11 @@ void reg_f3d<T>::SmoothGradient()
 template <class T>
 void reg_f3d<T>::GetApproximatedGradient()
 {
+   if(this->CanLocaliseApproximatedGradient())
+   {
+      this->GetLocalisedApproximatedGradient();
+      return;
+   }
    // Loop over every control point
    T *gridPtr = static_cast<T *>(this->controlPointGrid->data);
    T *gradPtr = static_cast<T *>(this->transformationGradient->data);
@@ -1004,6 +1070,268 @@ void reg_f3d<T>::GetApproximatedGradient()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template <class T>
+bool reg_f3d<T>::CanLocaliseApproximatedGradient()
+{
+   // The deformation field has to be linear in every control point position
+   if(this->currentReference->nz<2 ||
+         this->controlPointGrid->num_ext>0 ||
+         this->controlPointGrid->intent_p1==LIN_SPLINE_GRID ||
+         this->basisTable==NULL ||
+         this->measure_dti!=NULL)
+      return false;
+   // Every measure has to be updated from the support of a control point
+   reg_measure *measures[6]= {this->measure_nmi, this->measure_ssd, this->measure_kld,
+                              this->measure_lncc, this->measure_mind, this->measure_mindssc
+                             };
+   for(int i=0; i<6; ++i)
+   {
+      if(measures[i]!=NULL && !measures[i]->IsLocallyDecomposable())
+         return false;
+   }
+   return true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+/** The finite differences of the similarity measure are computed from the
+ * support of every control point only. The deformation field being linear in
+ * the control point positions, a perturbation of a control point adds the
+ * perturbation weighted by the basis values to the deformation of the voxels
+ * of its 4x4x4 cells. Only these voxels are resampled and the measure value
+ * is updated from the region. The control points are processed in parallel.
+ */
+template <class T>
+void reg_f3d<T>::GetLocalisedApproximatedGradient()
+{
+   reg_stageTimer timer("GetLocalisedApproximatedGradient");
+   T *gridPtr = static_cast<T *>(this->controlPointGrid->data);
+   T *gradPtr = static_cast<T *>(this->transformationGradient->data);
+   T eps = this->controlPointGrid->dx / 100.f;
+   memset(gradPtr, 0, this->transformationGradient->nvox*this->transformationGradient->nbyper);
+
+   // The central differences of the bending and linear energies are computed
+   // from the 3x3x3 neighbourhood of every control point
+   if(this->bendingEnergyWeight>0)
+      reg_spline_approxBendingEnergyCentralDifferences(this->controlPointGrid,
+                                                       this->transformationGradient,
+                                                       this->bendingEnergyWeight,
+                                                       eps);
+   if(this->linearEnergyWeight>0)
+      reg_spline_approxLinearEnergyCentralDifferences(this->controlPointGrid,
+                                                      this->transformationGradient,
+                                                      this->linearEnergyWeight,
+                                                      eps);
+   // The other penalty terms only depend on the grid and are computed globally
+   if(this->jacobianLogWeight>0 || this->landmarkRegWeight>0)
+   {
+      for(size_t i=0; i<this->controlPointGrid->nvox; ++i)
+      {
+         T currentValue = this->optimiser->GetBestDOF()[i];
+         double penalty[2];
+         for(int s=0; s<2; ++s)
+         {
+            gridPtr[i] = s==0 ? currentValue + eps : currentValue - eps;
+            penalty[s] = this->ComputeJacobianBasedPenaltyTerm(1) +
+                  this->ComputeLandmarkDistancePenaltyTerm();
+         }
+         gridPtr[i] = currentValue;
+         gradPtr[i] += (T)((penalty[0] - penalty[1]) / (2.0*eps));
+      }
+   }
+   if(this->similarityWeight<=0)
+      return;
+
+   // The current warped image and measure values are used as reference
+   this->WarpFloatingImage(this->interpolation);
+   this->ComputeSimilarityMeasure();
+   std::vector<reg_measure *> measures;
+   if(this->measure_nmi!=NULL) measures.push_back(this->measure_nmi);
+   if(this->measure_ssd!=NULL) measures.push_back(this->measure_ssd);
+   if(this->measure_kld!=NULL) measures.push_back(this->measure_kld);
+   if(this->measure_lncc!=NULL) measures.push_back(this->measure_lncc);
+   if(this->measure_mind!=NULL) measures.push_back(this->measure_mind);
+   if(this->measure_mindssc!=NULL) measures.push_back(this->measure_mindssc);
+   int measureNumber=(int)measures.size();
+
+   // The voxel range and basis values covered by every control point along every axis
+   int *pre[3], *rangeStart[3], *rangeEnd[3], maxRange[3];
+   T *basisValues[3];
+   for(int a=0; a<3; ++a)
+   {
+      int dim=this->currentReference->dim[a+1];
+      int gridDim=this->controlPointGrid->dim[a+1];
+      pre[a]=(int *)malloc(dim*sizeof(int));
+      basisValues[a]=(T *)malloc(4*dim*sizeof(T));
+      rangeStart[a]=(int *)malloc(gridDim*sizeof(int));
+      rangeEnd[a]=(int *)calloc(gridDim,sizeof(int));
+      for(int p=0; p<gridDim; ++p)
+         rangeStart[a][p]=dim;
+      for(int v=0; v<dim; ++v)
+      {
+         pre[a][v]=this->basisTable->template GetBasisValues<T>(a, v, &basisValues[a][4*v]);
+         for(int k=0; k<4; ++k)
+         {
+            int p=pre[a][v]+k;
+            if(p<0 || p>=gridDim) continue;
+            if(v<rangeStart[a][p]) rangeStart[a][p]=v;
+            rangeEnd[a][p]=v+1;
+         }
+      }
+      // The 3D resampling requires at least two slices
+      maxRange[a]=2;
+      for(int p=0; p<gridDim; ++p)
+         maxRange[a]=rangeEnd[a][p]-rangeStart[a][p]>maxRange[a]?rangeEnd[a][p]-rangeStart[a][p]:maxRange[a];
+   }
+   size_t maxRegionVoxelNumber=(size_t)maxRange[0]*maxRange[1]*maxRange[2];
+
+   // Every thread uses its own region images
+   int threadNumber=1;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   nifti_image **regionField=(nifti_image **)malloc(threadNumber*sizeof(nifti_image *));
+   nifti_image **regionWarped=(nifti_image **)malloc(threadNumber*sizeof(nifti_image *));
+   size_t **regionVoxels=(size_t **)malloc(threadNumber*sizeof(size_t *));
+   int **regionMask=(int **)malloc(threadNumber*sizeof(int *));
+   T **regionWeight=(T **)malloc(threadNumber*sizeof(T *));
+   T **regionBaseField=(T **)malloc(threadNumber*sizeof(T *));
+   for(int t=0; t<threadNumber; ++t)
+   {
+      regionField[t]=nifti_copy_nim_info(this->deformationFieldImage);
+      regionField[t]->data=malloc(3*maxRegionVoxelNumber*regionField[t]->nbyper);
+      regionWarped[t]=nifti_copy_nim_info(this->warped);
+      regionWarped[t]->data=malloc(regionWarped[t]->nt*maxRegionVoxelNumber*regionWarped[t]->nbyper);
+      regionVoxels[t]=(size_t *)malloc(maxRegionVoxelNumber*sizeof(size_t));
+      regionMask[t]=(int *)malloc(maxRegionVoxelNumber*sizeof(int));
+      regionWeight[t]=(T *)malloc(maxRegionVoxelNumber*sizeof(T));
+      regionBaseField[t]=(T *)malloc(3*maxRegionVoxelNumber*sizeof(T));
+   }
+
+   nifti_image *reference=this->currentReference;
+   nifti_image *floating=this->currentFloating;
+   int *mask=this->currentMask;
+   int interpolation=this->interpolation;
+   float paddingValue=(float)this->warpedPaddingValue;
+   double weight=(double)this->similarityWeight;
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   T *fieldPtr=static_cast<T *>(this->deformationFieldImage->data);
+   int gridDim[3]= {this->controlPointGrid->nx, this->controlPointGrid->ny, this->controlPointGrid->nz};
+   int nodeNumber=gridDim[0]*gridDim[1]*gridDim[2];
+   int node, tid, start[3], end[3], coord[3], a, c, s, x, y, z, m;
+   size_t i, regionVoxelNumber;
+   double value[2];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(nodeNumber, gridDim, rangeStart, rangeEnd, pre, basisValues, reference, floating, \
+   mask, fieldPtr, voxelNumber, regionField, regionWarped, regionVoxels, regionMask, \
+   regionWeight, regionBaseField, measures, measureNumber, interpolation, paddingValue, \
+   weight, eps, gradPtr) \
+   private(node, tid, start, end, coord, a, c, s, x, y, z, m, i, regionVoxelNumber, value) \
+   schedule(dynamic, 1)
+#endif
+   for(node=0; node<nodeNumber; ++node)
+   {
+      tid=0;
+#if defined (_OPENMP)
+      tid=omp_get_thread_num();
+#endif
+      coord[0]=node%gridDim[0];
+      coord[1]=(node/gridDim[0])%gridDim[1];
+      coord[2]=node/(gridDim[0]*gridDim[1]);
+      bool emptySupport=false;
+      for(a=0; a<3; ++a)
+      {
+         start[a]=rangeStart[a][coord[a]];
+         end[a]=rangeEnd[a][coord[a]];
+         if(start[a]>=end[a]) emptySupport=true;
+      }
+      if(emptySupport) continue;
+      // A voxel with a null weight is added to a region with a single slice
+      if(end[2]-start[2]==1)
+      {
+         if(start[2]>0) --start[2];
+         else ++end[2];
+      }
+      // The region voxels, their basis weight and current deformation are extracted
+      i=0;
+      for(z=start[2]; z<end[2]; ++z)
+      {
+         for(y=start[1]; y<end[1]; ++y)
+         {
+            for(x=start[0]; x<end[0]; ++x)
+            {
+               size_t index=((size_t)z*reference->ny+y)*reference->nx+x;
+               regionVoxels[tid][i]=index;
+               regionMask[tid][i]=mask!=NULL?mask[index]:0;
+               int px=coord[0]-pre[0][x], py=coord[1]-pre[1][y], pz=coord[2]-pre[2][z];
+               regionWeight[tid][i]=(px<0 || px>3 || py<0 || py>3 || pz<0 || pz>3) ? 0 :
+                     basisValues[0][4*x+px] * basisValues[1][4*y+py] * basisValues[2][4*z+pz];
+               ++i;
+            }
+         }
+      }
+      regionVoxelNumber=i;
+      for(c=0; c<3; ++c)
+         for(i=0; i<regionVoxelNumber; ++i)
+            regionBaseField[tid][c*regionVoxelNumber+i]=fieldPtr[c*voxelNumber+regionVoxels[tid][i]];
+      nifti_image *field=regionField[tid];
+      nifti_image *warped=regionWarped[tid];
+      field->nx=field->dim[1]=warped->nx=warped->dim[1]=end[0]-start[0];
+      field->ny=field->dim[2]=warped->ny=warped->dim[2]=end[1]-start[1];
+      field->nz=field->dim[3]=warped->nz=warped->dim[3]=end[2]-start[2];
+      field->nvox=3*regionVoxelNumber;
+      warped->nvox=warped->nt*regionVoxelNumber;
+      T *regionFieldPtr=static_cast<T *>(field->data);
+      for(c=0; c<3; ++c)
+      {
+         for(s=0; s<2; ++s)
+         {
+            T step = s==0 ? eps : -eps;
+            memcpy(regionFieldPtr, regionBaseField[tid], 3*regionVoxelNumber*sizeof(T));
+            for(i=0; i<regionVoxelNumber; ++i)
+               regionFieldPtr[c*regionVoxelNumber+i] += step * regionWeight[tid][i];
+            reg_resampleImage(floating,
+                              warped,
+                              field,
+                              regionMask[tid],
+                              interpolation,
+                              paddingValue);
+            value[s]=0.;
+            for(m=0; m<measureNumber; ++m)
+               value[s] += measures[m]->GetRegionSimilarityMeasureValue(warped, regionVoxels[tid]);
+         }
+         gradPtr[c*nodeNumber+node] -= (T)(weight * (value[0] - value[1]) / (2.0*eps));
+      }
+   }
+
+   for(int t=0; t<threadNumber; ++t)
+   {
+      nifti_image_free(regionField[t]);
+      nifti_image_free(regionWarped[t]);
+      free(regionVoxels[t]);
+      free(regionMask[t]);
+      free(regionWeight[t]);
+      free(regionBaseField[t]);
+   }
+   free(regionField);
+   free(regionWarped);
+   free(regionVoxels);
+   free(regionMask);
+   free(regionWeight);
+   free(regionBaseField);
+   for(int a=0; a<3; ++a)
+   {
+      free(pre[a]);
+      free(basisValues[a]);
+      free(rangeStart[a]);
+      free(rangeEnd[a]);
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::GetLocalisedApproximatedGradient");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template<class T>
 nifti_image **reg_f3d<T>::GetWarpedImage()
 {
@@ -1164,6 +1492,64 @@ void reg_f3d<T>::CorrectTransformation()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template<class T>
+size_t reg_f3d<T>::EstimateControlPointNumber(nifti_image *image)
+{
+   unsigned int levelToPerform=this->levelToPerform;
+   if(levelToPerform==0 || levelToPerform>this->levelNumber)
+      levelToPerform=this->levelNumber;
+   // The grid spacing is halved at every level when the grid is refined
+   float refinementRatio=this->gridRefinement?powf(2.0f, (float)(levelToPerform-1)):1.0f;
+   int dimNumber=image->nz>1?3:2;
+   size_t controlPointNumber=1;
+   for(int i=0; i<dimNumber; ++i)
+   {
+      if(this->inputControlPointGrid!=NULL)
+         controlPointNumber *= (size_t)((this->inputControlPointGrid->dim[i+1]-3)*refinementRatio+3.f);
+      else
+      {
+         float spacing=this->spacing[i]==this->spacing[i]?this->spacing[i]:this->spacing[0];
+         if(spacing<0) spacing *= -1.0f * this->inputReference->pixdim[i+1];
+         spacing *= powf(2.0f, (float)(this->levelNumber-1)) / refinementRatio;
+         controlPointNumber *= (size_t)(reg_ceil(image->dim[i+1]*image->pixdim[i+1]/spacing)+3.f);
+      }
+   }
+   return controlPointNumber;
+}
+/* *************************************************************** */
+template<class T>
+size_t reg_f3d<T>::EstimatePeakMemory()
+{
+   size_t memory=reg_base<T>::EstimatePeakMemory();
+
+   int referenceDim[3];
+   float referencePixdim[3];
+   this->GetFinestLevelDim(this->inputReference, referenceDim, referencePixdim);
+   size_t referenceVoxelNumber=(size_t)referenceDim[0]*referenceDim[1]*referenceDim[2];
+   int dimNumber=referenceDim[2]>1?3:2;
+
+   if(this->inputControlPointGrid!=NULL)
+      memory += this->inputControlPointGrid->nvox * this->inputControlPointGrid->nbyper;
+
+   // Control point grid, transformation gradient and the optimiser copies
+   // of the parameters: best position and conjugate gradient directions
+   size_t gridSize=this->EstimateControlPointNumber(this->inputReference) * dimNumber * sizeof(T);
+   memory += gridSize * (this->useConjGradient?5:3);
+
+   // Jacobian matrices and determinants, the final folding correction
+   // is always performed without approximation
+   if(this->jacobianLogWeight>0)
+      memory += referenceVoxelNumber * (sizeof(mat33) + sizeof(T));
+   return memory;
+}
+/* *************************************************************** */
+template<class T>
+int reg_f3d<T>::CheckMemoryMB()
+{
+   return (int)ceil((double)this->EstimatePeakMemory() / (1024.0*1024.0));
+}
+/* *************************************************************** */
+/* *************************************************************** */
 
 template class reg_f3d<float>;
 #endif
@@ -29,6 +29,7 @@ protected:
 
    nifti_image *transformationGradient;
    bool gridRefinement;
+   reg_splineBasisTable *basisTable;
 
    double currentWJac;
    double currentWBE;
@@ -40,6 +41,8 @@ protected:
    virtual void AllocateTransformationGradient();
    virtual void ClearTransformationGradient();
    virtual T InitialiseCurrentLevel();
+   virtual void InitialiseBasisTables();
+   virtual void ClearBasisTables();
 
    virtual double ComputeBendingEnergyPenaltyTerm();
    virtual double ComputeLinearEnergyPenaltyTerm();
@@ -55,6 +58,8 @@ protected:
    virtual void SmoothGradient();
    virtual void GetObjectiveFunctionGradient();
    virtual void GetApproximatedGradient();
+   virtual bool CanLocaliseApproximatedGradient();
+   void GetLocalisedApproximatedGradient();
    void GetSimilarityMeasureGradient();
 
    virtual void GetDeformationField();
@@ -70,6 +75,10 @@ protected:
 
    virtual void CorrectTransformation();
 
+   /// @brief Estimate the number of control points of the finest grid defined on an image
+   size_t EstimateControlPointNumber(nifti_image *image);
+   virtual size_t EstimatePeakMemory();
+
    void (*funcProgressCallback)(float pcntProgress, void *params);
    void *paramsProgressCallback;
 
@@ -129,11 +138,8 @@ public:
       return NULL;
    }
 
-   // F3D_gpu specific option
-   virtual int CheckMemoryMB()
-   {
-      return EXIT_SUCCESS;
-   }
+   /// @brief Estimate the peak memory usage in MB from the input image headers and the options
+   virtual int CheckMemoryMB();
 
    virtual void CheckParameters();
    virtual void Initialise();
@@ -26,6 +26,8 @@ reg_f3d2<T>::reg_f3d2(int refTimePoint,int floTimePoint)
    this->BCHUpdate=false;
    this->useGradientCumulativeExp=true;
    this->BCHUpdateValue=0;
+   this->flowFieldImage=NULL;
+   this->backwardFlowFieldImage=NULL;
 
 #ifndef NDEBUG
    reg_print_msg_debug("reg_f3d2 constructor called");
@@ -36,6 +38,12 @@ reg_f3d2<T>::reg_f3d2(int refTimePoint,int floTimePoint)
 template <class T>
 reg_f3d2<T>::~reg_f3d2()
 {
+   if(this->flowFieldImage!=NULL)
+      reg_tools_freeTrackedImage(this->flowFieldImage);
+   this->flowFieldImage=NULL;
+   if(this->backwardFlowFieldImage!=NULL)
+      reg_tools_freeTrackedImage(this->backwardFlowFieldImage);
+   this->backwardFlowFieldImage=NULL;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_f3d2 destructor called");
 #endif
@@ -86,8 +94,47 @@ void reg_f3d2<T>::Initialise()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+void reg_f3d2<T>::AllocateDeformationField()
+{
+   reg_f3d_sym<T>::AllocateDeformationField();
+
+   // The flow fields share the geometry of the deformation fields
+   this->flowFieldImage = nifti_copy_nim_info(this->deformationFieldImage);
+   this->flowFieldImage->data = (void *)reg_tools_trackedCalloc(this->flowFieldImage->nvox,
+                                                                this->flowFieldImage->nbyper);
+   this->backwardFlowFieldImage = nifti_copy_nim_info(this->backwardDeformationFieldImage);
+   this->backwardFlowFieldImage->data = (void *)reg_tools_trackedCalloc(this->backwardFlowFieldImage->nvox,
+                                                                        this->backwardFlowFieldImage->nbyper);
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d2<T>::AllocateDeformationField");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
+void reg_f3d2<T>::ClearDeformationField()
+{
+   reg_f3d_sym<T>::ClearDeformationField();
+   if(this->flowFieldImage!=NULL)
+   {
+      reg_tools_freeTrackedImage(this->flowFieldImage);
+      this->flowFieldImage=NULL;
+   }
+   if(this->backwardFlowFieldImage!=NULL)
+   {
+      reg_tools_freeTrackedImage(this->backwardFlowFieldImage);
+      this->backwardFlowFieldImage=NULL;
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d2<T>::ClearDeformationField");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 void reg_f3d2<T>::GetDeformationField()
 {
+   reg_stageTimer timer("GetDeformationField");
    // By default the number of steps is automatically updated
    bool updateStepNumber=true;
    // The provided step number is used for the final resampling
@@ -101,7 +148,8 @@ void reg_f3d2<T>::GetDeformationField()
    // The forward transformation is computed using the scaling-and-squaring approach
    reg_spline_getDefFieldFromVelocityGrid(this->controlPointGrid,
                                           this->deformationFieldImage,
-                                          updateStepNumber
+                                          updateStepNumber,
+                                          this->flowFieldImage
                                           );
 #ifndef NDEBUG
    sprintf(text, "Velocity integration backward. Step number update=%i",updateStepNumber);
@@ -112,7 +160,8 @@ void reg_f3d2<T>::GetDeformationField()
    // The backward transformation is computed using the scaling-and-squaring approach
    reg_spline_getDefFieldFromVelocityGrid(this->backwardControlPointGrid,
                                           this->backwardDeformationFieldImage,
-                                          false
+                                          false,
+                                          this->backwardFlowFieldImage
                                           );
    return;
 }
@@ -153,6 +202,7 @@ void reg_f3d2<T>::GetInverseConsistencyGradient()
 template <class T>
 void reg_f3d2<T>::GetVoxelBasedGradient()
 {
+   reg_stageTimer timer("GetVoxelBasedGradient");
    reg_f3d_sym<T>::GetVoxelBasedGradient();
 
    // Exponentiate the gradients if required
@@ -165,6 +215,7 @@ void reg_f3d2<T>::ExponentiateGradient()
 {
    if(!this->useGradientCumulativeExp) return;
 
+   reg_stageTimer timer("ExponentiateGradient");
    /* /\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\/\ */
    // Exponentiate the forward gradient using the backward transformation
 #ifndef NDEBUG
@@ -177,7 +228,7 @@ void reg_f3d2<T>::ExponentiateGradient()
    for(unsigned int i=0; i<=(unsigned int)fabs(this->backwardControlPointGrid->intent_p2); ++i)
    {
       tempDef[i]=nifti_copy_nim_info(this->deformationFieldImage);
-      tempDef[i]->data=(void *)malloc(tempDef[i]->nvox*tempDef[i]->nbyper);
+      tempDef[i]->data=(void *)reg_tools_trackedMalloc(tempDef[i]->nvox*tempDef[i]->nbyper);
    }
    // Generate all intermediate deformation fields
    reg_spline_getIntermediateDefFieldFromVelGrid(this->backwardControlPointGrid,
@@ -187,7 +238,7 @@ void reg_f3d2<T>::ExponentiateGradient()
    nifti_image *affine_disp=NULL;
    if(this->affineTransformation!=NULL){
       affine_disp=nifti_copy_nim_info(this->deformationFieldImage);
-      affine_disp->data=(void *)malloc(affine_disp->nvox*affine_disp->nbyper);
+      affine_disp->data=(void *)reg_tools_trackedMalloc(affine_disp->nvox*affine_disp->nbyper);
       mat44 backwardAffineTransformation=nifti_mat44_inverse(*this->affineTransformation);
       reg_affine_getDeformationField(&backwardAffineTransformation,
                                      affine_disp);
@@ -197,7 +248,7 @@ void reg_f3d2<T>::ExponentiateGradient()
    /* Allocate a temporary gradient image to store the backward gradient */
    nifti_image *tempGrad=nifti_copy_nim_info(this->voxelBasedMeasureGradient);
 
-   tempGrad->data=(void *)malloc(tempGrad->nvox*tempGrad->nbyper);
+   tempGrad->data=(void *)reg_tools_trackedMalloc(tempGrad->nvox*tempGrad->nbyper);
    for(int i=0; i<(int)fabsf(this->backwardControlPointGrid->intent_p2); ++i)
    {
       if(affine_disp!=NULL)
@@ -217,17 +268,17 @@ void reg_f3d2<T>::ExponentiateGradient()
    // Free the temporary deformation fields
    for(int i=0; i<=(int)fabsf(this->backwardControlPointGrid->intent_p2); ++i)
    {
-      nifti_image_free(tempDef[i]);
+      reg_tools_freeTrackedImage(tempDef[i]);
       tempDef[i]=NULL;
    }
    free(tempDef);
    tempDef=NULL;
    // Free the temporary gradient image
-   nifti_image_free(tempGrad);
+   reg_tools_freeTrackedImage(tempGrad);
    tempGrad=NULL;
    // Free the temporary affine displacement field
    if(affine_disp!=NULL)
-      nifti_image_free(affine_disp);
+      reg_tools_freeTrackedImage(affine_disp);
    affine_disp=NULL;
    // Normalise the forward gradient
    reg_tools_divideValueToImage(this->voxelBasedMeasureGradient, // in
@@ -241,13 +292,13 @@ void reg_f3d2<T>::ExponentiateGradient()
 #endif
    // Allocate a temporary gradient image to store the backward gradient
    tempGrad=nifti_copy_nim_info(this->backwardVoxelBasedMeasureGradientImage);
-   tempGrad->data=(void *)malloc(tempGrad->nvox*tempGrad->nbyper);
+   tempGrad->data=(void *)reg_tools_trackedMalloc(tempGrad->nvox*tempGrad->nbyper);
    // Create all deformation field images needed for resampling
    tempDef=(nifti_image **)malloc((unsigned int)(fabs(this->controlPointGrid->intent_p2)+1) * sizeof(nifti_image *));
    for(unsigned int i=0; i<=(unsigned int)fabs(this->controlPointGrid->intent_p2); ++i)
    {
       tempDef[i]=nifti_copy_nim_info(this->backwardDeformationFieldImage);
-      tempDef[i]->data=(void *)malloc(tempDef[i]->nvox*tempDef[i]->nbyper);
+      tempDef[i]->data=(void *)reg_tools_trackedMalloc(tempDef[i]->nvox*tempDef[i]->nbyper);
    }
    // Generate all intermediate deformation fields
    reg_spline_getIntermediateDefFieldFromVelGrid(this->controlPointGrid,
@@ -256,7 +307,7 @@ void reg_f3d2<T>::ExponentiateGradient()
    // Remove the affine component
    if(this->affineTransformation!=NULL){
       affine_disp=nifti_copy_nim_info(this->backwardDeformationFieldImage);
-      affine_disp->data=(void *)malloc(affine_disp->nvox*affine_disp->nbyper);
+      affine_disp->data=(void *)reg_tools_trackedMalloc(affine_disp->nvox*affine_disp->nbyper);
       reg_affine_getDeformationField(this->affineTransformation,
                                      affine_disp);
       reg_getDisplacementFromDeformation(affine_disp);
@@ -281,17 +332,17 @@ void reg_f3d2<T>::ExponentiateGradient()
    // Free the temporary deformation field
    for(int i=0; i<=(int)fabsf(this->controlPointGrid->intent_p2); ++i)
    {
-      nifti_image_free(tempDef[i]);
+      reg_tools_freeTrackedImage(tempDef[i]);
       tempDef[i]=NULL;
    }
    free(tempDef);
    tempDef=NULL;
    // Free the temporary gradient image
-   nifti_image_free(tempGrad);
+   reg_tools_freeTrackedImage(tempGrad);
    tempGrad=NULL;
    // Free the temporary affine displacement field
    if(affine_disp!=NULL)
-      nifti_image_free(affine_disp);
+      reg_tools_freeTrackedImage(affine_disp);
    affine_disp=NULL;
    // Normalise the backward gradient
    reg_tools_divideValueToImage(this->backwardVoxelBasedMeasureGradientImage, // in
@@ -305,6 +356,7 @@ void reg_f3d2<T>::ExponentiateGradient()
 template <class T>
 void reg_f3d2<T>::UpdateParameters(float scale)
 {
+   reg_stageTimer timer("UpdateParameters");
    // Restore the last successfull control point grids
    this->optimiser->RestoreBestDOF();
 
@@ -313,7 +365,7 @@ void reg_f3d2<T>::UpdateParameters(float scale)
    /************************/
    // Scale the gradient image
    nifti_image *forwardScaledGradient=nifti_copy_nim_info(this->transformationGradient);
-   forwardScaledGradient->data=(void *)malloc(forwardScaledGradient->nvox*forwardScaledGradient->nbyper);
+   forwardScaledGradient->data=(void *)reg_tools_trackedMalloc(forwardScaledGradient->nvox*forwardScaledGradient->nbyper);
    reg_tools_multiplyValueToImage(this->transformationGradient,
                                   forwardScaledGradient,
                                   scale); // *(scale)
@@ -344,7 +396,7 @@ void reg_f3d2<T>::UpdateParameters(float scale)
                                 this->controlPointGrid); // out
    }
    // Clean the temporary nifti_images
-   nifti_image_free(forwardScaledGradient);
+   reg_tools_freeTrackedImage(forwardScaledGradient);
    forwardScaledGradient=NULL;
 
    /************************/
@@ -352,7 +404,7 @@ void reg_f3d2<T>::UpdateParameters(float scale)
    /************************/
    // Scale the gradient image
    nifti_image *backwardScaledGradient=nifti_copy_nim_info(this->backwardTransformationGradient);
-   backwardScaledGradient->data=(void *)malloc(backwardScaledGradient->nvox*backwardScaledGradient->nbyper);
+   backwardScaledGradient->data=(void *)reg_tools_trackedMalloc(backwardScaledGradient->nvox*backwardScaledGradient->nbyper);
    reg_tools_multiplyValueToImage(this->backwardTransformationGradient,
                                   backwardScaledGradient,
                                   scale); // *(scale)
@@ -383,7 +435,7 @@ void reg_f3d2<T>::UpdateParameters(float scale)
                                 this->backwardControlPointGrid); // out
    }
    // Clean the temporary nifti_images
-   nifti_image_free(backwardScaledGradient);
+   reg_tools_freeTrackedImage(backwardScaledGradient);
    backwardScaledGradient=NULL;
 
    /****************************/
@@ -394,9 +446,9 @@ void reg_f3d2<T>::UpdateParameters(float scale)
    // are averaged in both image spaces: reference and floating
    /****************************/
    nifti_image *warpedForwardTrans = nifti_copy_nim_info(this->backwardControlPointGrid);
-   warpedForwardTrans->data=(void *)malloc(warpedForwardTrans->nvox*warpedForwardTrans->nbyper);
+   warpedForwardTrans->data=(void *)reg_tools_trackedMalloc(warpedForwardTrans->nvox*warpedForwardTrans->nbyper);
    nifti_image *warpedBackwardTrans = nifti_copy_nim_info(this->controlPointGrid);
-   warpedBackwardTrans->data=(void *)malloc(warpedBackwardTrans->nvox*warpedBackwardTrans->nbyper);
+   warpedBackwardTrans->data=(void *)reg_tools_trackedMalloc(warpedBackwardTrans->nvox*warpedBackwardTrans->nbyper);
 
    // Both parametrisations are converted into displacement
    reg_getDisplacementFromDeformation(this->controlPointGrid);
@@ -421,9 +473,9 @@ void reg_f3d2<T>::UpdateParameters(float scale)
                                   this->controlPointGrid, // displacement
                                   0.5f); // *(0.5)
    // Clean the temporary allocated velocity fields
-   nifti_image_free(warpedForwardTrans);
+   reg_tools_freeTrackedImage(warpedForwardTrans);
    warpedForwardTrans=NULL;
-   nifti_image_free(warpedBackwardTrans);
+   reg_tools_freeTrackedImage(warpedBackwardTrans);
    warpedBackwardTrans=NULL;
 
    // Convert the velocity field from displacement to deformation
@@ -493,5 +545,37 @@ nifti_image **reg_f3d2<T>::GetWarpedImage()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template<class T>
+size_t reg_f3d2<T>::EstimatePeakMemory()
+{
+   size_t memory=reg_f3d_sym<T>::EstimatePeakMemory();
+
+   int referenceDim[3], floatingDim[3];
+   float referencePixdim[3], floatingPixdim[3];
+   this->GetFinestLevelDim(this->inputReference, referenceDim, referencePixdim);
+   this->GetFinestLevelDim(this->inputFloating, floatingDim, floatingPixdim);
+   size_t referenceVoxelNumber=(size_t)referenceDim[0]*referenceDim[1]*referenceDim[2];
+   size_t floatingVoxelNumber=(size_t)floatingDim[0]*floatingDim[1]*floatingDim[2];
+   size_t voxelNumber=referenceVoxelNumber>floatingVoxelNumber?
+            referenceVoxelNumber:floatingVoxelNumber;
+   int dimNumber=referenceDim[2]>1?3:2;
+
+   // The forward and backward flow fields are kept as workspaces of the
+   // velocity field exponentiation. The gradient exponentiation stores all
+   // the intermediate deformation fields along with a temporary gradient
+   // and the affine displacement field
+   size_t fieldNumber=2;
+   if(this->useGradientCumulativeExp)
+   {
+      // The number of squaring steps depends on the velocity field, the
+      // minimal number is used
+      const size_t squaringNumber=6;
+      fieldNumber += squaringNumber + 2 + (this->affineTransformation!=NULL?1:0);
+   }
+   memory += fieldNumber * voxelNumber * dimNumber * sizeof(T);
+   return memory;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template class reg_f3d2<float>;
 #endif
@@ -23,7 +23,12 @@ protected:
    bool BCHUpdate;
    bool useGradientCumulativeExp;
    int BCHUpdateValue;
+   // Workspaces of the scaling-and-squaring, kept for the whole level
+   nifti_image *flowFieldImage;
+   nifti_image *backwardFlowFieldImage;
 
+   virtual void AllocateDeformationField();
+   virtual void ClearDeformationField();
    virtual void GetDeformationField();
    virtual void GetInverseConsistencyErrorField(bool forceAll);
    virtual void GetInverseConsistencyGradient();
@@ -33,6 +38,7 @@ protected:
    virtual void UseBCHUpdate(int);
    virtual void UseGradientCumulativeExp();
    virtual void DoNotUseGradientCumulativeExp();
+   virtual size_t EstimatePeakMemory();
 
 public:
    reg_f3d2(int refTimePoint,int floTimePoint);
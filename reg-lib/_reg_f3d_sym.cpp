@@ -28,6 +28,7 @@ reg_f3d_sym<T>::reg_f3d_sym(int refTimePoint,int floTimePoint)
    this->backwardDeformationFieldImage=NULL;
    this->backwardVoxelBasedMeasureGradientImage=NULL;
    this->backwardTransformationGradient=NULL;
+   this->backwardBasisTable=NULL;
 
    this->backwardProbaJointHistogram=NULL;
    this->backwardLogJointHistogram=NULL;
@@ -50,9 +51,11 @@ reg_f3d_sym<T>::reg_f3d_sym(int refTimePoint,int floTimePoint)
 template <class T>
 reg_f3d_sym<T>::~reg_f3d_sym()
 {
+   reg_f3d_sym<T>::ClearBasisTables();
+
    if(this->backwardControlPointGrid!=NULL)
    {
-      nifti_image_free(this->backwardControlPointGrid);
+      reg_tools_freeTrackedImage(this->backwardControlPointGrid);
       this->backwardControlPointGrid=NULL;
    }
 
@@ -64,7 +67,7 @@ reg_f3d_sym<T>::~reg_f3d_sym()
          {
             if(this->floatingMaskPyramid[i]!=NULL)
             {
-               free(this->floatingMaskPyramid[i]);
+               reg_tools_trackedFree(this->floatingMaskPyramid[i]);
                this->floatingMaskPyramid[i]=NULL;
             }
          }
@@ -73,7 +76,7 @@ reg_f3d_sym<T>::~reg_f3d_sym()
       {
          if(this->floatingMaskPyramid[0]!=NULL)
          {
-            free(this->floatingMaskPyramid[0]);
+            reg_tools_trackedFree(this->floatingMaskPyramid[0]);
             this->floatingMaskPyramid[0]=NULL;
          }
       }
@@ -127,8 +130,13 @@ T reg_f3d_sym<T>::InitialiseCurrentLevel()
       }
       else
       {
+         // The refinement reallocates the grids
+         reg_tools_untrackImage(this->controlPointGrid);
+         reg_tools_untrackImage(this->backwardControlPointGrid);
          reg_spline_refineControlPointGrid(this->controlPointGrid);
          reg_spline_refineControlPointGrid(this->backwardControlPointGrid);
+         reg_tools_trackImage(this->controlPointGrid);
+         reg_tools_trackImage(this->backwardControlPointGrid);
          this->bendingEnergyWeight = this->bendingEnergyWeight * static_cast<T>(16);
          this->linearEnergyWeight = this->linearEnergyWeight * static_cast<T>(3);
       }
@@ -156,6 +164,10 @@ T reg_f3d_sym<T>::InitialiseCurrentLevel()
       maxStepSize = (this->currentReference->dz>maxStepSize)?this->currentReference->dz:maxStepSize;
       maxStepSize = (this->currentFloating->dz>maxStepSize)?this->currentFloating->dz:maxStepSize;
    }
+
+   // The basis values are tabulated once for the whole level
+   this->InitialiseBasisTables();
+
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::InitialiseCurrentLevel");
 #endif
@@ -163,9 +175,84 @@ T reg_f3d_sym<T>::InitialiseCurrentLevel()
 }
 /* *************************************************************** */
 template <class T>
+void reg_f3d_sym<T>::InitialiseBasisTables()
+{
+   reg_f3d<T>::InitialiseBasisTables();
+   if(this->backwardBasisTable!=NULL)
+      delete this->backwardBasisTable;
+   this->backwardBasisTable = new reg_splineBasisTable(this->backwardControlPointGrid,
+                                                       this->currentFloating);
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d_sym<T>::InitialiseBasisTables");
+#endif
+}
+/* *************************************************************** */
+template <class T>
+void reg_f3d_sym<T>::ClearBasisTables()
+{
+   reg_f3d<T>::ClearBasisTables();
+   if(this->backwardBasisTable!=NULL)
+   {
+      delete this->backwardBasisTable;
+      this->backwardBasisTable=NULL;
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d_sym<T>::ClearBasisTables");
+#endif
+}
+/* *************************************************************** */
+template <class T>
+void reg_f3d_sym<T>::InitialisePyramidLevel(unsigned int level)
+{
+   reg_f3d<T>::InitialisePyramidLevel(level);
+
+   // The floating mask arrays are allocated with the first level
+   unsigned int pyramidalLevelNumber=this->usePyramid?this->levelToPerform:1;
+   if(this->floatingMaskPyramid==NULL)
+   {
+      this->floatingMaskPyramid = (int **)malloc(pyramidalLevelNumber*sizeof(int *));
+      this->backwardActiveVoxelNumber= (int *)malloc(pyramidalLevelNumber*sizeof(int));
+      for(unsigned int l=0; l<pyramidalLevelNumber; ++l)
+         this->floatingMaskPyramid[l]=NULL;
+   }
+
+   // Set the floating mask image of the level
+   unsigned int index=this->usePyramid?level:0;
+   if(this->floatingMaskPyramid[index]!=NULL)
+      return;
+   if (this->floatingMaskImage!=NULL)
+   {
+      if(this->usePyramid)
+         this->floatingMaskPyramid[index]=reg_createMaskPyramidLevel<T>(this->floatingMaskImage,
+                                                                        this->levelNumber,
+                                                                        index,
+                                                                        &this->backwardActiveVoxelNumber[index]);
+      else this->floatingMaskPyramid[index]=reg_createMaskPyramidLevel<T>(this->floatingMaskImage,
+                                                                           1, 0,
+                                                                           &this->backwardActiveVoxelNumber[index]);
+      reg_tools_trackBuffer(this->floatingMaskPyramid[index],
+                            (size_t)this->floatingPyramid[index]->nx*this->floatingPyramid[index]->ny*
+                            this->floatingPyramid[index]->nz*sizeof(int));
+   }
+   else
+   {
+      this->backwardActiveVoxelNumber[index]=this->floatingPyramid[index]->nx*this->floatingPyramid[index]->ny*this->floatingPyramid[index]->nz;
+      this->floatingMaskPyramid[index]=(int *)reg_tools_trackedCalloc(backwardActiveVoxelNumber[index],sizeof(int));
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d_sym<T>::InitialisePyramidLevel");
+#endif
+}
+/* *************************************************************** */
+template <class T>
 void reg_f3d_sym<T>::ClearCurrentInputImage()
 {
    reg_f3d<T>::ClearCurrentInputImage();
+   if(this->usePyramid)
+   {
+      reg_tools_trackedFree(this->floatingMaskPyramid[this->currentLevel]);
+      this->floatingMaskPyramid[this->currentLevel]=NULL;
+   }
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::ClearCurrentInputImage");
 #endif
@@ -196,7 +283,7 @@ void reg_f3d_sym<T>::AllocateWarped()
          (size_t)this->backwardWarped->nt;
    this->backwardWarped->datatype = this->currentReference->datatype;
    this->backwardWarped->nbyper = this->currentReference->nbyper;
-   this->backwardWarped->data = (void *)calloc(this->backwardWarped->nvox, this->backwardWarped->nbyper);
+   this->backwardWarped->data = (void *)reg_tools_trackedCalloc(this->backwardWarped->nvox, this->backwardWarped->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::AllocateWarped");
 #endif
@@ -209,7 +296,7 @@ void reg_f3d_sym<T>::ClearWarped()
    reg_f3d<T>::ClearWarped();
    if(this->backwardWarped!=NULL)
    {
-      nifti_image_free(this->backwardWarped);
+      reg_tools_freeTrackedImage(this->backwardWarped);
       this->backwardWarped=NULL;
    }
 #ifndef NDEBUG
@@ -260,7 +347,7 @@ void reg_f3d_sym<T>::AllocateDeformationField()
          (size_t)this->backwardDeformationFieldImage->nu;
    this->backwardDeformationFieldImage->nbyper = this->backwardControlPointGrid->nbyper;
    this->backwardDeformationFieldImage->datatype = this->backwardControlPointGrid->datatype;
-   this->backwardDeformationFieldImage->data = (void *)calloc(this->backwardDeformationFieldImage->nvox,
+   this->backwardDeformationFieldImage->data = (void *)reg_tools_trackedCalloc(this->backwardDeformationFieldImage->nvox,
                                                               this->backwardDeformationFieldImage->nbyper);
    this->backwardDeformationFieldImage->intent_code=NIFTI_INTENT_VECTOR;
    memset(this->backwardDeformationFieldImage->intent_name, 0, 16);
@@ -270,7 +357,7 @@ void reg_f3d_sym<T>::AllocateDeformationField()
    this->backwardDeformationFieldImage->scl_inter=0.f;
 
    if(this->measure_dti!=NULL)
-      this->backwardJacobianMatrix=(mat33 *)malloc(
+      this->backwardJacobianMatrix=(mat33 *)reg_tools_trackedMalloc(
             this->backwardDeformationFieldImage->nx *
             this->backwardDeformationFieldImage->ny *
             this->backwardDeformationFieldImage->nz *
@@ -288,12 +375,12 @@ void reg_f3d_sym<T>::ClearDeformationField()
    reg_f3d<T>::ClearDeformationField();
    if(this->backwardDeformationFieldImage!=NULL)
    {
-      nifti_image_free(this->backwardDeformationFieldImage);
+      reg_tools_freeTrackedImage(this->backwardDeformationFieldImage);
       this->backwardDeformationFieldImage=NULL;
    }
    if(this->backwardJacobianMatrix!=NULL)
    {
-      free(this->backwardJacobianMatrix);
+      reg_tools_trackedFree(this->backwardJacobianMatrix);
       this->backwardJacobianMatrix=NULL;
    }
 #ifndef NDEBUG
@@ -316,7 +403,7 @@ void reg_f3d_sym<T>::AllocateWarpedGradient()
       reg_exit();
    }
    this->backwardWarpedGradientImage = nifti_copy_nim_info(this->backwardDeformationFieldImage);
-   this->backwardWarpedGradientImage->data = (void *)calloc(this->backwardWarpedGradientImage->nvox,
+   this->backwardWarpedGradientImage->data = (void *)reg_tools_trackedCalloc(this->backwardWarpedGradientImage->nvox,
                                                             this->backwardWarpedGradientImage->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::AllocateWarpedGradient");
@@ -330,7 +417,7 @@ void reg_f3d_sym<T>::ClearWarpedGradient()
    reg_f3d<T>::ClearWarpedGradient();
    if(this->backwardWarpedGradientImage!=NULL)
    {
-      nifti_image_free(this->backwardWarpedGradientImage);
+      reg_tools_freeTrackedImage(this->backwardWarpedGradientImage);
       this->backwardWarpedGradientImage=NULL;
    }
 #ifndef NDEBUG
@@ -354,7 +441,7 @@ void reg_f3d_sym<T>::AllocateVoxelBasedMeasureGradient()
    }
    this->backwardVoxelBasedMeasureGradientImage = nifti_copy_nim_info(this->backwardDeformationFieldImage);
    this->backwardVoxelBasedMeasureGradientImage->data =
-         (void *)calloc(this->backwardVoxelBasedMeasureGradientImage->nvox,
+         (void *)reg_tools_trackedCalloc(this->backwardVoxelBasedMeasureGradientImage->nvox,
                         this->backwardVoxelBasedMeasureGradientImage->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::AllocateVoxelBasedMeasureGradient");
@@ -368,7 +455,7 @@ void reg_f3d_sym<T>::ClearVoxelBasedMeasureGradient()
    reg_f3d<T>::ClearVoxelBasedMeasureGradient();
    if(this->backwardVoxelBasedMeasureGradientImage!=NULL)
    {
-      nifti_image_free(this->backwardVoxelBasedMeasureGradientImage);
+      reg_tools_freeTrackedImage(this->backwardVoxelBasedMeasureGradientImage);
       this->backwardVoxelBasedMeasureGradientImage=NULL;
    }
 #ifndef NDEBUG
@@ -392,7 +479,7 @@ void reg_f3d_sym<T>::AllocateTransformationGradient()
    }
    this->backwardTransformationGradient = nifti_copy_nim_info(this->backwardControlPointGrid);
    this->backwardTransformationGradient->data =
-         (void *)calloc(this->backwardTransformationGradient->nvox,
+         (void *)reg_tools_trackedCalloc(this->backwardTransformationGradient->nvox,
                         this->backwardTransformationGradient->nbyper);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::AllocateTransformationGradient");
@@ -405,7 +492,7 @@ void reg_f3d_sym<T>::ClearTransformationGradient()
 {
    reg_f3d<T>::ClearTransformationGradient();
    if(this->backwardTransformationGradient!=NULL)
-      nifti_image_free(this->backwardTransformationGradient);
+      reg_tools_freeTrackedImage(this->backwardTransformationGradient);
    this->backwardTransformationGradient=NULL;
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::ClearTransformationGradient");
@@ -463,6 +550,8 @@ void reg_f3d_sym<T>::Initialise()
 {
    reg_f3d<T>::Initialise();
 
+   // The forward grid created by reg_f3d is replaced
+   reg_tools_untrackImage(this->controlPointGrid);
    if(this->inputControlPointGrid==NULL){
       // Define the spacing for the first level
       float gridSpacing[3] = {this->spacing[0],this->spacing[1],this->spacing[2]};
@@ -517,46 +606,8 @@ void reg_f3d_sym<T>::Initialise()
                 sizeof(mat44));
       }
    }
-
-   // Set the floating mask image pyramid
-   if(this->usePyramid)
-   {
-      this->floatingMaskPyramid = (int **)malloc(this->levelToPerform*sizeof(int *));
-      this->backwardActiveVoxelNumber= (int *)malloc(this->levelToPerform*sizeof(int));
-   }
-   else
-   {
-      this->floatingMaskPyramid = (int **)malloc(sizeof(int *));
-      this->backwardActiveVoxelNumber= (int *)malloc(sizeof(int));
-   }
-
-   if(this->usePyramid)
-   {
-      if (this->floatingMaskImage!=NULL)
-         reg_createMaskPyramid<T>(this->floatingMaskImage,
-                                  this->floatingMaskPyramid,
-                                  this->levelNumber,
-                                  this->levelToPerform,
-                                  this->backwardActiveVoxelNumber);
-      else
-      {
-         for(unsigned int l=0; l<this->levelToPerform; ++l)
-         {
-            this->backwardActiveVoxelNumber[l]=this->floatingPyramid[l]->nx*this->floatingPyramid[l]->ny*this->floatingPyramid[l]->nz;
-            this->floatingMaskPyramid[l]=(int *)calloc(backwardActiveVoxelNumber[l],sizeof(int));
-         }
-      }
-   }
-   else  // no pyramid
-   {
-      if (this->floatingMaskImage!=NULL)
-         reg_createMaskPyramid<T>(this->floatingMaskImage, this->floatingMaskPyramid, 1, 1, this->backwardActiveVoxelNumber);
-      else
-      {
-         this->backwardActiveVoxelNumber[0]=this->floatingPyramid[0]->nx*this->floatingPyramid[0]->ny*this->floatingPyramid[0]->nz;
-         this->floatingMaskPyramid[0]=(int *)calloc(backwardActiveVoxelNumber[0],sizeof(int));
-      }
-   }
+   reg_tools_trackImage(this->controlPointGrid);
+   reg_tools_trackImage(this->backwardControlPointGrid);
 
 #ifdef NDEBUG
    if(this->verbose)
@@ -582,17 +633,22 @@ void reg_f3d_sym<T>::Initialise()
 template <class T>
 void reg_f3d_sym<T>::GetDeformationField()
 {
+   reg_stageTimer timer("GetDeformationField");
    reg_spline_getDeformationField(this->controlPointGrid,
                                   this->deformationFieldImage,
                                   this->currentMask,
                                   false, //composition
-                                  true // bspline
+                                  true, // bspline
+                                  false, // force_no_lut
+                                  this->basisTable
                                   );
    reg_spline_getDeformationField(this->backwardControlPointGrid,
                                   this->backwardDeformationFieldImage,
                                   this->currentFloatingMask,
                                   false, //composition
-                                  true // bspline
+                                  true, // bspline
+                                  false, // force_no_lut
+                                  this->backwardBasisTable
                                   );
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::GetDeformationField");
@@ -604,6 +660,7 @@ void reg_f3d_sym<T>::GetDeformationField()
 template <class T>
 void reg_f3d_sym<T>::WarpFloatingImage(int inter)
 {
+   reg_stageTimer timer("WarpFloatingImage");
    // Compute the deformation fields
    this->GetDeformationField();
 
@@ -668,6 +725,7 @@ double reg_f3d_sym<T>::ComputeJacobianBasedPenaltyTerm(int type)
 {
    if (this->jacobianLogWeight<=0) return 0.;
 
+   reg_stageTimer timer("ComputeJacobianBasedPenaltyTerm");
    double forwardPenaltyTerm=reg_f3d<T>::ComputeJacobianBasedPenaltyTerm(type);
 
    double backwardPenaltyTerm=0.;
@@ -676,13 +734,17 @@ double reg_f3d_sym<T>::ComputeJacobianBasedPenaltyTerm(int type)
    {
       backwardPenaltyTerm = reg_spline_getJacobianPenaltyTerm(this->backwardControlPointGrid,
                                                               this->currentFloating,
-                                                              false);
+                                                              false,
+                                                              false,
+                                                              this->backwardBasisTable);
    }
    else
    {
       backwardPenaltyTerm = reg_spline_getJacobianPenaltyTerm(this->backwardControlPointGrid,
                                                               this->currentFloating,
-                                                              this->jacobianLogApproximation);
+                                                              this->jacobianLogApproximation,
+                                                              false,
+                                                              this->backwardBasisTable);
    }
    unsigned int maxit=5;
    if(type>0) maxit=20;
@@ -744,6 +806,7 @@ double reg_f3d_sym<T>::ComputeBendingEnergyPenaltyTerm()
 {
    if (this->bendingEnergyWeight<=0) return 0.;
 
+   reg_stageTimer timer("ComputeBendingEnergyPenaltyTerm");
    double forwardPenaltyTerm=reg_f3d<T>::ComputeBendingEnergyPenaltyTerm();
 
    double value = reg_spline_approxBendingEnergy(this->backwardControlPointGrid);
@@ -759,6 +822,7 @@ double reg_f3d_sym<T>::ComputeLinearEnergyPenaltyTerm()
 {
    if(this->linearEnergyWeight<=0) return 0.;
 
+   reg_stageTimer timer("ComputeLinearEnergyPenaltyTerm");
    double forwardPenaltyTerm=reg_f3d<T>::ComputeLinearEnergyPenaltyTerm();
 
    double backwardPenaltyTerm = this->linearEnergyWeight*reg_spline_approxLinearEnergy(this->backwardControlPointGrid);
@@ -775,6 +839,7 @@ double reg_f3d_sym<T>::ComputeLandmarkDistancePenaltyTerm()
 {
    if(this->landmarkRegWeight<=0) return 0.;
 
+   reg_stageTimer timer("ComputeLandmarkDistancePenaltyTerm");
    double forwardPenaltyTerm=reg_f3d<T>::ComputeLandmarkDistancePenaltyTerm();
 
    double backwardPenaltyTerm = this->landmarkRegWeight*reg_spline_getLandmarkDistance(this->backwardControlPointGrid,
@@ -792,6 +857,7 @@ double reg_f3d_sym<T>::ComputeLandmarkDistancePenaltyTerm()
 template <class T>
 void reg_f3d_sym<T>::GetVoxelBasedGradient()
 {
+   reg_stageTimer timer("GetVoxelBasedGradient");
    // The voxel based gradient image is initialised with zeros
    reg_tools_multiplyValueToImage(this->voxelBasedMeasureGradient,
                                   this->voxelBasedMeasureGradient,
@@ -936,6 +1002,7 @@ void reg_f3d_sym<T>::GetJacobianBasedGradient()
 {
    if(this->jacobianLogWeight<=0) return;
 
+   reg_stageTimer timer("GetJacobianBasedGradient");
    reg_f3d<T>::GetJacobianBasedGradient();
 
    reg_spline_getJacobianPenaltyTermGradient(this->backwardControlPointGrid,
@@ -955,6 +1022,7 @@ void reg_f3d_sym<T>::GetBendingEnergyGradient()
 {
    if(this->bendingEnergyWeight<=0) return;
 
+   reg_stageTimer timer("GetBendingEnergyGradient");
    reg_f3d<T>::GetBendingEnergyGradient();
    reg_spline_approxBendingEnergyGradient(this->backwardControlPointGrid,
                                           this->backwardTransformationGradient,
@@ -971,6 +1039,7 @@ void reg_f3d_sym<T>::GetLinearEnergyGradient()
 {
    if(this->linearEnergyWeight<=0) return;
 
+   reg_stageTimer timer("GetLinearEnergyGradient");
    reg_f3d<T>::GetLinearEnergyGradient();
 
    reg_spline_approxLinearEnergyGradient(this->backwardControlPointGrid,
@@ -988,6 +1057,7 @@ void reg_f3d_sym<T>::GetLandmarkDistanceGradient()
 {
    if(this->landmarkRegWeight<=0) return;
 
+   reg_stageTimer timer("GetLandmarkDistanceGradient");
    reg_f3d<T>::GetLandmarkDistanceGradient();
 
    reg_spline_getLandmarkDistanceGradient(this->backwardControlPointGrid,
@@ -1025,10 +1095,12 @@ void reg_f3d_sym<T>::SmoothGradient()
    {
       reg_f3d<T>::SmoothGradient();
       // The gradient is smoothed using a Gaussian kernel if it is required
-      float kernel = fabs(this->gradientSmoothingSigma);
+      // One standard deviation is required per gradient component
+      float kernel[3];
+      kernel[0]=kernel[1]=kernel[2]=fabs(this->gradientSmoothingSigma);
       reg_tools_kernelConvolution(this->backwardTransformationGradient,
-                                  &kernel,
-                                  GAUSSIAN_KERNEL);
+                                  kernel,
+                                  this->gradientSmoothingKernelType);
    }
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::SmoothGradient");
@@ -1188,6 +1260,15 @@ void reg_f3d_sym<T>::DisplayCurrentLevelParameters()
              this->backwardControlPointGrid->dx, this->backwardControlPointGrid->dy,
              this->backwardControlPointGrid->dz);
       reg_print_info(this->executableName, text);
+      if(this->backwardBasisTable!=NULL)
+      {
+         sprintf(text, "\t* basis value tables: %s x %s x %s, %.1f KB",
+                 this->backwardBasisTable->IsCompact(0)?"compact":"full",
+                 this->backwardBasisTable->IsCompact(1)?"compact":"full",
+                 this->backwardBasisTable->IsCompact(2)?"compact":"full",
+                 (double)this->backwardBasisTable->GetMemoryUsage()/1024.0);
+         reg_print_info(this->executableName, text);
+      }
 #ifdef NDEBUG
    }
 #endif
@@ -1317,6 +1398,7 @@ void reg_f3d_sym<T>::GetInverseConsistencyGradient()
 {
    if(this->inverseConsistencyWeight<=0) return;
 
+   reg_stageTimer timer("GetInverseConsistencyGradient");
    // Note: I simplified the gradient computation in order to include
    // only d(B(F(x)))/d(forwardNode) and d(F(B(x)))/d(backwardNode)
    // I ignored d(F(B(x)))/d(forwardNode) and d(B(F(x)))/d(backwardNode)
@@ -1456,6 +1538,7 @@ void reg_f3d_sym<T>::GetInverseConsistencyGradient()
 template <class T>
 void reg_f3d_sym<T>::UpdateParameters(float scale)
 {
+   reg_stageTimer timer("UpdateParameters");
    // Update first the forward transformation
    reg_f3d<T>::UpdateParameters(scale);
 
@@ -1823,5 +1906,47 @@ nifti_image * reg_f3d_sym<T>::GetBackwardControlPointPositionImage()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template<class T>
+size_t reg_f3d_sym<T>::EstimatePeakMemory()
+{
+   size_t memory=reg_f3d<T>::EstimatePeakMemory();
+
+   int referenceDim[3], floatingDim[3];
+   float referencePixdim[3], floatingPixdim[3];
+   this->GetFinestLevelDim(this->inputReference, referenceDim, referencePixdim);
+   this->GetFinestLevelDim(this->inputFloating, floatingDim, floatingPixdim);
+   size_t floatingVoxelNumber=(size_t)floatingDim[0]*floatingDim[1]*floatingDim[2];
+   int dimNumber=referenceDim[2]>1?3:2;
+
+   // Floating mask
+   if(this->floatingMaskImage!=NULL)
+      memory += this->floatingMaskImage->nvox * this->floatingMaskImage->nbyper;
+   memory += floatingVoxelNumber * sizeof(int);
+
+   // Backward warped image, deformation field, warped image gradient and
+   // voxel-based measure gradient
+   memory += floatingVoxelNumber * this->inputReference->nt * sizeof(T);
+   memory += 3 * floatingVoxelNumber * dimNumber * sizeof(T);
+   if(this->measure_dti!=NULL)
+      memory += floatingVoxelNumber * sizeof(mat33);
+   memory += this->EstimateMeasureMemory(floatingVoxelNumber,
+                                         this->inputFloating->nt,
+                                         dimNumber);
+
+   // Both grids cover the largest field of view of the two images. The
+   // forward grid defined on the reference image is already accounted for
+   size_t referenceControlPointNumber=this->EstimateControlPointNumber(this->inputReference);
+   size_t floatingControlPointNumber=this->EstimateControlPointNumber(this->inputFloating);
+   size_t controlPointNumber=referenceControlPointNumber>floatingControlPointNumber?
+            referenceControlPointNumber:floatingControlPointNumber;
+   memory += (2*controlPointNumber-referenceControlPointNumber) *
+             dimNumber * sizeof(T) * (this->useConjGradient?5:3);
+
+   if(this->jacobianLogWeight>0)
+      memory += floatingVoxelNumber * (sizeof(mat33) + sizeof(T));
+   return memory;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template class reg_f3d_sym<float>;
 #endif
@@ -33,6 +33,7 @@ protected:
    nifti_image *backwardWarpedGradientImage;
    nifti_image *backwardVoxelBasedMeasureGradientImage;
    nifti_image *backwardTransformationGradient;
+   reg_splineBasisTable *backwardBasisTable;
 
    double *backwardProbaJointHistogram;
    double *backwardLogJointHistogram;
@@ -55,6 +56,9 @@ protected:
    virtual void AllocateTransformationGradient();
    virtual void ClearTransformationGradient();
    virtual T InitialiseCurrentLevel();
+   virtual void InitialisePyramidLevel(unsigned int level);
+   virtual void InitialiseBasisTables();
+   virtual void ClearBasisTables();
    virtual void ClearCurrentInputImage();
 
    virtual double ComputeBendingEnergyPenaltyTerm();
@@ -74,6 +78,11 @@ protected:
    virtual T NormaliseGradient();
    virtual void SmoothGradient();
    virtual void GetApproximatedGradient();
+   // The symmetric objective function is always evaluated globally
+   virtual bool CanLocaliseApproximatedGradient()
+   {
+      return false;
+   }
    virtual void DisplayCurrentLevelParameters();
    virtual void PrintInitialObjFunctionValue();
    virtual void PrintCurrentObjFunctionValue(T);
@@ -86,6 +95,7 @@ protected:
 
    virtual void UpdateParameters(float);
    virtual void InitialiseSimilarity();
+   virtual size_t EstimatePeakMemory();
 
 public:
    virtual void SetFloatingMask(nifti_image *);
@@ -5,9 +5,21 @@ CPUAffineDeformationFieldKernel::CPUAffineDeformationFieldKernel(AladinContent *
     this->deformationFieldImage = con->getCurrentDeformationField();
     this->affineTransformation = con->getTransformationMatrix();
     this->mask = con->getCurrentReferenceMask();
+    this->sparseMask = con->getCurrentSparseMask();
 }
 
 void CPUAffineDeformationFieldKernel::calculate(bool compose) {
+   if (this->sparseMask != NULL && !compose) {
+      // 3D images are directly resampled using the affine transformation
+      // while only the block matching support is required in 2D
+      if (this->deformationFieldImage->nz > 1)
+         return;
+      reg_affine_getDeformationField(this->affineTransformation,
+                                     this->deformationFieldImage,
+                                     false,
+                                     this->sparseMask);
+      return;
+   }
    reg_affine_getDeformationField(this->affineTransformation,
                                   this->deformationFieldImage,
                                   compose,
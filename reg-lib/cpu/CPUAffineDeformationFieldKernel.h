@@ -15,6 +15,7 @@ public:
         mat44 *affineTransformation;
         nifti_image *deformationFieldImage;
         int *mask;
+        int *sparseMask;
 };
 
 #endif // AFFINEDEFORMATIONFIELDKERNEL_H
@@ -6,6 +6,8 @@ CPUResampleImageKernel::CPUResampleImageKernel(AladinContent *con, std::string n
    warpedImage = con->getCurrentWarped();
    deformationField = con->getCurrentDeformationField();
    mask = con->getCurrentReferenceMask();
+   sparseMask = con->getCurrentSparseMask();
+   affineTransformation = con->getTransformationMatrix();
 }
 
 void CPUResampleImageKernel::calculate(int interp,
@@ -13,6 +15,23 @@ void CPUResampleImageKernel::calculate(int interp,
                                        bool *dti_timepoint,
                                        mat33 * jacMat)
 {
+   if (this->sparseMask != NULL && dti_timepoint == NULL) {
+      // Only the voxels used by the block matching are resampled
+      if (this->warpedImage->nz > 1)
+         reg_resampleImage_affine(this->floatingImage,
+                                  this->warpedImage,
+                                  this->affineTransformation,
+                                  this->sparseMask,
+                                  interp,
+                                  paddingValue);
+      else reg_resampleImage(this->floatingImage,
+                             this->warpedImage,
+                             this->deformationField,
+                             this->sparseMask,
+                             interp,
+                             paddingValue);
+      return;
+   }
    reg_resampleImage(this->floatingImage,
                      this->warpedImage,
                      this->deformationField,
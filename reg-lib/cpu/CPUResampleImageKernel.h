@@ -13,6 +13,8 @@ class CPUResampleImageKernel : public ResampleImageKernel
         nifti_image *warpedImage;
         nifti_image *deformationField;
         int *mask;
+        int *sparseMask;
+        mat44 *affineTransformation;
 
         void calculate(int interp, float paddingValue, bool *dti_timepoint = NULL, mat33 * jacMat = NULL);
 };
@@ -12,9 +12,21 @@
 #include "_reg_blockMatching.h"
 #include "_reg_globalTrans.h"
 #include <map>
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 /* *************************************************************** */
+/// @brief Order the block indices by decreasing variance
+struct _reg_block_variance_compare
+{
+   const float *variance;
+   _reg_block_variance_compare(const float *v) : variance(v) {}
+   bool operator()(int a, int b) const
+   {
+      return variance[a] > variance[b];
+   }
+};
+/* *************************************************************** */
 template<class DTYPE>
 void _reg_set_active_blocks(nifti_image *referenceImage, _reg_blockMatchingParam *params, int *mask, bool runningOnGPU) {
 
@@ -24,144 +36,158 @@ void _reg_set_active_blocks(nifti_image *referenceImage, _reg_blockMatchingParam
    int *maskPtr = &mask[0];
 
    int unusableBlock = 0;
-   size_t index;
-   DTYPE *referenceValues = NULL;
-   if (referenceImage->nz > 1) {
-      referenceValues = (DTYPE *)malloc(BLOCK_3D_SIZE * sizeof(DTYPE));
-   }
-   else {
-      referenceValues = (DTYPE *)malloc(BLOCK_2D_SIZE * sizeof(DTYPE));
-   }
    DTYPE *referencePtr = static_cast<DTYPE *>(referenceImage->data);
-   int blockIndex = 0;
+   int blockIndex;
 
+   // The variance of every block is computed independently and stored in its
+   // own slot of the variance array
    if (referenceImage->nz > 1) {
       // Version using 3D blocks
-      for (unsigned int k = 0; k < params->blockNumber[2]; k++) {
-         for (unsigned int j = 0; j < params->blockNumber[1]; j++) {
-            for (unsigned int i = 0; i < params->blockNumber[0]; i++) {
-
-               for (unsigned int n = 0; n < BLOCK_3D_SIZE; n++)
-                  referenceValues[n] = (DTYPE)std::numeric_limits<float>::quiet_NaN();
-
-               float mean = 0.0f;
-               float voxelNumber = 0.0f;
-               int coord = 0;
-               for (unsigned int z = k * BLOCK_WIDTH; z < (k + 1) * BLOCK_WIDTH; z++) {
-                  if (z < (unsigned int)referenceImage->nz) {
-                     index = z * referenceImage->nx * referenceImage->ny;
-                     DTYPE *referencePtrZ = &referencePtr[index];
-                     int *maskPtrZ = &maskPtr[index];
-                     for (unsigned int y = j * BLOCK_WIDTH; y < (j + 1) * BLOCK_WIDTH; y++) {
-                        if (y < (unsigned int)referenceImage->ny) {
-                           index = y * referenceImage->nx + i * BLOCK_WIDTH;
-                           DTYPE *referencePtrXYZ = &referencePtrZ[index];
-                           int *maskPtrXYZ = &maskPtrZ[index];
-                           for (unsigned int x = i * BLOCK_WIDTH; x < (i + 1) * BLOCK_WIDTH; x++) {
-                              if (x < (unsigned int)referenceImage->nx) {
-                                 referenceValues[coord] = *referencePtrXYZ;
-                                 if (referenceValues[coord] == referenceValues[coord] && *maskPtrXYZ > -1) {
-                                    mean += (float)referenceValues[coord];
-                                    voxelNumber++;
-                                 }
-                              }
-                              referencePtrXYZ++;
-                              maskPtrXYZ++;
-                              coord++;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(params, referenceImage, referencePtr, maskPtr, varianceArray, indexArray) \
+   private(blockIndex) \
+   reduction(+:unusableBlock)
+#endif
+      for (blockIndex = 0; blockIndex < params->totalBlockNumber; blockIndex++) {
+         unsigned int i = blockIndex % params->blockNumber[0];
+         unsigned int j = (blockIndex / params->blockNumber[0]) % params->blockNumber[1];
+         unsigned int k = blockIndex / (params->blockNumber[0] * params->blockNumber[1]);
+
+         DTYPE referenceValues[BLOCK_3D_SIZE];
+         for (unsigned int n = 0; n < BLOCK_3D_SIZE; n++)
+            referenceValues[n] = (DTYPE)std::numeric_limits<float>::quiet_NaN();
+
+         float mean = 0.0f;
+         float voxelNumber = 0.0f;
+         int coord = 0;
+         size_t index;
+         for (unsigned int z = k * BLOCK_WIDTH; z < (k + 1) * BLOCK_WIDTH; z++) {
+            if (z < (unsigned int)referenceImage->nz) {
+               index = z * referenceImage->nx * referenceImage->ny;
+               DTYPE *referencePtrZ = &referencePtr[index];
+               int *maskPtrZ = &maskPtr[index];
+               for (unsigned int y = j * BLOCK_WIDTH; y < (j + 1) * BLOCK_WIDTH; y++) {
+                  if (y < (unsigned int)referenceImage->ny) {
+                     index = y * referenceImage->nx + i * BLOCK_WIDTH;
+                     DTYPE *referencePtrXYZ = &referencePtrZ[index];
+                     int *maskPtrXYZ = &maskPtrZ[index];
+                     for (unsigned int x = i * BLOCK_WIDTH; x < (i + 1) * BLOCK_WIDTH; x++) {
+                        if (x < (unsigned int)referenceImage->nx) {
+                           referenceValues[coord] = *referencePtrXYZ;
+                           if (referenceValues[coord] == referenceValues[coord] && *maskPtrXYZ > -1) {
+                              mean += (float)referenceValues[coord];
+                              voxelNumber++;
                            }
                         }
+                        referencePtrXYZ++;
+                        maskPtrXYZ++;
+                        coord++;
                      }
                   }
                }
-               mean /= voxelNumber;
+            }
+         }
+         mean /= voxelNumber;
 
-               //Let's calculate the variance of the block
-               float variance = 0.0f;
-               for (int i = 0; i < BLOCK_3D_SIZE; i++) {
-                  if (referenceValues[i] == referenceValues[i])
-                     variance += (mean - (float)referenceValues[i]) * (mean - (float)referenceValues[i]);
-               }
-               variance /= voxelNumber;
+         //Let's calculate the variance of the block
+         float variance = 0.0f;
+         for (int n = 0; n < BLOCK_3D_SIZE; n++) {
+            if (referenceValues[n] == referenceValues[n])
+               variance += (mean - (float)referenceValues[n]) * (mean - (float)referenceValues[n]);
+         }
+         variance /= voxelNumber;
 
-               if (voxelNumber > BLOCK_3D_SIZE / 2 && variance > 0) {
-                  varianceArray[blockIndex] = variance;
-               }
-               else {
-                  varianceArray[blockIndex] = -1;
-                  unusableBlock++;
-               }
-               indexArray[blockIndex] = blockIndex;
-               blockIndex++;
-            }
+         if (voxelNumber > BLOCK_3D_SIZE / 2 && variance > 0) {
+            varianceArray[blockIndex] = variance;
          }
+         else {
+            varianceArray[blockIndex] = -1;
+            unusableBlock++;
+         }
+         indexArray[blockIndex] = blockIndex;
       }
    }
    else {
       // Version using 2D blocks
-      for (unsigned int j = 0; j < params->blockNumber[1]; j++) {
-         for (unsigned int i = 0; i < params->blockNumber[0]; i++) {
-
-            for (unsigned int n = 0; n < BLOCK_2D_SIZE; n++)
-               referenceValues[n] = (DTYPE)std::numeric_limits<float>::quiet_NaN();
-
-            float mean = 0.0f;
-            float voxelNumber = 0.0f;
-            int coord = 0;
-
-            for (unsigned int y = j * BLOCK_WIDTH; y < (j + 1) * BLOCK_WIDTH; y++) {
-               if (y < (unsigned )referenceImage->ny) {
-                  index = y * referenceImage->nx + i * BLOCK_WIDTH;
-                  DTYPE *referencePtrXY = &referencePtr[index];
-                  int *maskPtrXY = &maskPtr[index];
-                  for (unsigned int x = i * BLOCK_WIDTH; x < (i + 1) * BLOCK_WIDTH; x++) {
-                     if (x < (unsigned)referenceImage->nx) {
-                        referenceValues[coord] = *referencePtrXY;
-                        if (referenceValues[coord] == referenceValues[coord] && *maskPtrXY > -1) {
-                           mean += (float)referenceValues[coord];
-                           voxelNumber++;
-                        }
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(params, referenceImage, referencePtr, maskPtr, varianceArray, indexArray) \
+   private(blockIndex) \
+   reduction(+:unusableBlock)
+#endif
+      for (blockIndex = 0; blockIndex < params->totalBlockNumber; blockIndex++) {
+         unsigned int i = blockIndex % params->blockNumber[0];
+         unsigned int j = blockIndex / params->blockNumber[0];
+
+         DTYPE referenceValues[BLOCK_2D_SIZE];
+         for (unsigned int n = 0; n < BLOCK_2D_SIZE; n++)
+            referenceValues[n] = (DTYPE)std::numeric_limits<float>::quiet_NaN();
+
+         float mean = 0.0f;
+         float voxelNumber = 0.0f;
+         int coord = 0;
+         size_t index;
+
+         for (unsigned int y = j * BLOCK_WIDTH; y < (j + 1) * BLOCK_WIDTH; y++) {
+            if (y < (unsigned )referenceImage->ny) {
+               index = y * referenceImage->nx + i * BLOCK_WIDTH;
+               DTYPE *referencePtrXY = &referencePtr[index];
+               int *maskPtrXY = &maskPtr[index];
+               for (unsigned int x = i * BLOCK_WIDTH; x < (i + 1) * BLOCK_WIDTH; x++) {
+                  if (x < (unsigned)referenceImage->nx) {
+                     referenceValues[coord] = *referencePtrXY;
+                     if (referenceValues[coord] == referenceValues[coord] && *maskPtrXY > -1) {
+                        mean += (float)referenceValues[coord];
+                        voxelNumber++;
                      }
-                     referencePtrXY++;
-                     maskPtrXY++;
-                     coord++;
                   }
+                  referencePtrXY++;
+                  maskPtrXY++;
+                  coord++;
                }
             }
-            mean /= voxelNumber;
+         }
+         mean /= voxelNumber;
 
-            //Let's calculate the variance of the block
-            float variance = 0.0f;
-            for (int i = 0; i < BLOCK_2D_SIZE; i++) {
-               if (referenceValues[i] == referenceValues[i])
-                  variance += (mean - (float)referenceValues[i]) * (mean - (float)referenceValues[i]);
-            }
-            variance /= voxelNumber;
+         //Let's calculate the variance of the block
+         float variance = 0.0f;
+         for (int n = 0; n < BLOCK_2D_SIZE; n++) {
+            if (referenceValues[n] == referenceValues[n])
+               variance += (mean - (float)referenceValues[n]) * (mean - (float)referenceValues[n]);
+         }
+         variance /= voxelNumber;
 
-            if (voxelNumber > BLOCK_2D_SIZE / 2 && variance > 0) {
-               varianceArray[blockIndex] = variance;
-            }
-            else {
-               varianceArray[blockIndex] = -1;
-               unusableBlock++;
-            }
-            indexArray[blockIndex] = blockIndex;
-            blockIndex++;
+         if (voxelNumber > BLOCK_2D_SIZE / 2 && variance > 0) {
+            varianceArray[blockIndex] = variance;
          }
+         else {
+            varianceArray[blockIndex] = -1;
+            unusableBlock++;
+         }
+         indexArray[blockIndex] = blockIndex;
       }
    }
-   free(referenceValues);
 
    params->activeBlockNumber = params->activeBlockNumber < ((int)params->totalBlockNumber - unusableBlock) ? params->activeBlockNumber : (params->totalBlockNumber - unusableBlock);
    //params->activeBlockNumber = params->totalBlockNumber - unusableBlock;
 
-   reg_heapSort(varianceArray, indexArray, params->totalBlockNumber);
-   int *indexArrayPtr = &indexArray[params->totalBlockNumber - 1];
-   int count = 0;
+   // Only the blocks with the highest variances are required, they are
+   // selected without sorting all the blocks and are then stored in their
+   // original order
+   std::nth_element(indexArray, indexArray + params->activeBlockNumber,
+                    indexArray + params->totalBlockNumber,
+                    _reg_block_variance_compare(varianceArray));
+   for (int i = 0; i < params->totalBlockNumber; ++i) {
+      params->totalBlock[i] = -1;
+   }
    for (int i = 0; i < params->activeBlockNumber; i++) {
-      params->totalBlock[*indexArrayPtr--] = count++;
+      params->totalBlock[indexArray[i]] = 0;
    }
-   for (int i=params->activeBlockNumber; i<params->totalBlockNumber; ++i) {
-      params->totalBlock[*indexArrayPtr--] = -1;
+   int count = 0;
+   for (int i = 0; i < params->totalBlockNumber; ++i) {
+      if (params->totalBlock[i] == 0)
+         params->totalBlock[i] = count++;
    }
 
    count = 0;
@@ -255,6 +281,99 @@ void initialise_block_matching_method(nifti_image * reference,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/** Normalised cross-correlation between a reference and a warped block.
+ * The overlap arrays contain one for the voxels to consider and zero
+ * otherwise, and the values of the discarded voxels are expected to be zero,
+ * so that all sums are computed without branching. Returns false when no
+ * more than half of the block overlaps.
+ */
+template<class DTYPE>
+static inline bool reg_getBlockCorrelation(const DTYPE *referenceValues,
+                                           const DTYPE *referenceOverlap,
+                                           const DTYPE *warpedValues,
+                                           const DTYPE *warpedOverlap,
+                                           int blockSize,
+                                           DTYPE &localCC) {
+   DTYPE voxelNumber = 0.0, referenceMean = 0.0, warpedMean = 0.0;
+   for (int a = 0; a < blockSize; a++) {
+      DTYPE overlap = referenceOverlap[a] * warpedOverlap[a];
+      voxelNumber += overlap;
+      referenceMean += overlap * referenceValues[a];
+      warpedMean += overlap * warpedValues[a];
+   }
+   if (voxelNumber <= blockSize / 2)
+      return false;
+   referenceMean /= voxelNumber;
+   warpedMean /= voxelNumber;
+
+   DTYPE referenceVar = 0.0, warpedVar = 0.0, correlation = 0.0;
+   for (int a = 0; a < blockSize; a++) {
+      DTYPE overlap = referenceOverlap[a] * warpedOverlap[a];
+      DTYPE referenceTemp = overlap * (referenceValues[a] - referenceMean);
+      DTYPE warpedTemp = overlap * (warpedValues[a] - warpedMean);
+      referenceVar += referenceTemp * referenceTemp;
+      warpedVar += warpedTemp * warpedTemp;
+      correlation += referenceTemp * warpedTemp;
+   }
+   localCC = (referenceVar * warpedVar) > 0.0 ? fabs(correlation / sqrt(referenceVar * warpedVar)) : 0.0;
+   return true;
+}
+/* *************************************************************** */
+#ifdef _USE_SSE
+static inline float reg_getSSESum(__m128 value) {
+   union {
+      __m128 m;
+      float f[4];
+   } sum;
+   sum.m = value;
+   return sum.f[0] + sum.f[1] + sum.f[2] + sum.f[3];
+}
+/* *************************************************************** */
+/** Single precision version processing four voxels at a time. The block
+ * sizes are multiples of four.
+ */
+template<>
+inline bool reg_getBlockCorrelation<float>(const float *referenceValues,
+                                           const float *referenceOverlap,
+                                           const float *warpedValues,
+                                           const float *warpedOverlap,
+                                           int blockSize,
+                                           float &localCC) {
+   __m128 overlap_sse, reference_sse, warped_sse;
+   __m128 voxelNumber_sse = _mm_setzero_ps();
+   __m128 referenceSum_sse = _mm_setzero_ps();
+   __m128 warpedSum_sse = _mm_setzero_ps();
+   for (int a = 0; a < blockSize; a += 4) {
+      overlap_sse = _mm_mul_ps(_mm_loadu_ps(&referenceOverlap[a]), _mm_loadu_ps(&warpedOverlap[a]));
+      voxelNumber_sse = _mm_add_ps(voxelNumber_sse, overlap_sse);
+      referenceSum_sse = _mm_add_ps(referenceSum_sse, _mm_mul_ps(overlap_sse, _mm_loadu_ps(&referenceValues[a])));
+      warpedSum_sse = _mm_add_ps(warpedSum_sse, _mm_mul_ps(overlap_sse, _mm_loadu_ps(&warpedValues[a])));
+   }
+   float voxelNumber = reg_getSSESum(voxelNumber_sse);
+   if (voxelNumber <= blockSize / 2)
+      return false;
+   __m128 referenceMean_sse = _mm_set1_ps(reg_getSSESum(referenceSum_sse) / voxelNumber);
+   __m128 warpedMean_sse = _mm_set1_ps(reg_getSSESum(warpedSum_sse) / voxelNumber);
+
+   __m128 referenceVar_sse = _mm_setzero_ps();
+   __m128 warpedVar_sse = _mm_setzero_ps();
+   __m128 correlation_sse = _mm_setzero_ps();
+   for (int a = 0; a < blockSize; a += 4) {
+      overlap_sse = _mm_mul_ps(_mm_loadu_ps(&referenceOverlap[a]), _mm_loadu_ps(&warpedOverlap[a]));
+      reference_sse = _mm_mul_ps(overlap_sse, _mm_sub_ps(_mm_loadu_ps(&referenceValues[a]), referenceMean_sse));
+      warped_sse = _mm_mul_ps(overlap_sse, _mm_sub_ps(_mm_loadu_ps(&warpedValues[a]), warpedMean_sse));
+      referenceVar_sse = _mm_add_ps(referenceVar_sse, _mm_mul_ps(reference_sse, reference_sse));
+      warpedVar_sse = _mm_add_ps(warpedVar_sse, _mm_mul_ps(warped_sse, warped_sse));
+      correlation_sse = _mm_add_ps(correlation_sse, _mm_mul_ps(reference_sse, warped_sse));
+   }
+   float referenceVar = reg_getSSESum(referenceVar_sse);
+   float warpedVar = reg_getSSESum(warpedVar_sse);
+   float correlation = reg_getSSESum(correlation_sse);
+   localCC = (referenceVar * warpedVar) > 0.0 ? fabs(correlation / sqrt(referenceVar * warpedVar)) : 0.0;
+   return true;
+}
+#endif
+/* *************************************************************** */
 template<typename DTYPE>
 void block_matching_method2D(nifti_image * reference, nifti_image * warped, _reg_blockMatchingParam *params, int *mask) {
    DTYPE *referencePtr = static_cast<DTYPE *>(reference->data);
@@ -266,171 +385,141 @@ void block_matching_method2D(nifti_image * reference, nifti_image * warped, _reg
    else
       referenceMatrix_xyz = &(reference->qto_xyz);
 
-   unsigned int referenceIndex_start_x;
-   unsigned int referenceIndex_start_y;
-   unsigned int referenceIndex_end_x;
-   unsigned int referenceIndex_end_y;
+   int referenceIndex_start_x;
+   int referenceIndex_start_y;
+   int referenceIndex_end_x;
+   int referenceIndex_end_y;
    int warpedIndex_start_x;
    int warpedIndex_start_y;
    int warpedIndex_end_x;
    int warpedIndex_end_y;
 
-   unsigned int referenceIndex;
-   unsigned int warpedIndex;
-
-   unsigned int blockIndex = 0;
+   int referenceIndex;
+   int warpedIndex;
 
-   int index, l, m, x, y, z = 0;
-   unsigned int i, j;
-   int *maskPtr_XY;
-   DTYPE *referencePtr_XY, *warpedPtr_XY;
-   DTYPE value, bestCC, referenceMean, warpedMean, referenceVar, warpedVar;
-   DTYPE voxelNumber, localCC, referenceTemp, warpedTemp;
+   int blockIndex, index, i, j, l, m, x, y, z;
+   DTYPE value, bestCC, localCC;
    float bestDisplacement[3], referencePosition_temp[3], tempPosition[3];
 
+   // Every thread has its own copy of the block values
    DTYPE referenceValues[BLOCK_2D_SIZE];
-   bool referenceOverlap[BLOCK_2D_SIZE];
+   DTYPE referenceOverlap[BLOCK_2D_SIZE];
    DTYPE warpedValues[BLOCK_2D_SIZE];
-   bool warpedOverlap[BLOCK_2D_SIZE];
-
-   params->definedActiveBlockNumber = 0;
+   DTYPE warpedOverlap[BLOCK_2D_SIZE];
 
-   for (j = 0; j < params->blockNumber[1]; j++) {
+   int currentDefinedActiveBlockNumber = 0;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(params, reference, warped, referencePtr, warpedPtr, mask, referenceMatrix_xyz) \
+   private(blockIndex, index, i, j, l, m, x, y, z, value, bestCC, localCC, \
+   bestDisplacement, referencePosition_temp, tempPosition, \
+   referenceIndex_start_x, referenceIndex_start_y, referenceIndex_end_x, referenceIndex_end_y, \
+   warpedIndex_start_x, warpedIndex_start_y, warpedIndex_end_x, warpedIndex_end_y, \
+   referenceIndex, warpedIndex, referenceValues, referenceOverlap, warpedValues, warpedOverlap) \
+   reduction(+:currentDefinedActiveBlockNumber) \
+   schedule(dynamic, 1)
+#endif
+   for (blockIndex = 0; blockIndex < params->totalBlockNumber; blockIndex++) {
+      if (params->totalBlock[blockIndex] < 0)
+         continue;
+      i = blockIndex % params->blockNumber[0];
+      j = blockIndex / params->blockNumber[0];
+      referenceIndex_start_x = i * BLOCK_WIDTH;
+      referenceIndex_end_x = referenceIndex_start_x + BLOCK_WIDTH;
       referenceIndex_start_y = j * BLOCK_WIDTH;
       referenceIndex_end_y = referenceIndex_start_y + BLOCK_WIDTH;
 
-      for (i = 0; i < params->blockNumber[0]; i++) {
-         referenceIndex_start_x = i * BLOCK_WIDTH;
-         referenceIndex_end_x = referenceIndex_start_x + BLOCK_WIDTH;
-
-         if (params->totalBlock[blockIndex] > -1) {
-
-            referenceIndex = 0;
-            memset(referenceOverlap, 0, BLOCK_2D_SIZE * sizeof(bool));
-
-            for (y = (int) referenceIndex_start_y; y < (int) referenceIndex_end_y; y++) {
-               if (y < reference->ny) {
-                  index = y * reference->nx + referenceIndex_start_x;
-                  for (x = (int) referenceIndex_start_x; x < (int) referenceIndex_end_x; x++) {
-                     if (x < reference->nx) {
-                        referencePtr_XY = &referencePtr[index];
-                        maskPtr_XY = &mask[index];
-                        value = *referencePtr_XY;
-                        if (value == value && *maskPtr_XY > -1) {
-                           referenceValues[referenceIndex] = value;
-                           referenceOverlap[referenceIndex] = 1;
+      referenceIndex = 0;
+      memset(referenceValues, 0, BLOCK_2D_SIZE * sizeof(DTYPE));
+      memset(referenceOverlap, 0, BLOCK_2D_SIZE * sizeof(DTYPE));
+      for (y = referenceIndex_start_y; y < referenceIndex_end_y; y++) {
+         if (y < reference->ny) {
+            index = y * reference->nx + referenceIndex_start_x;
+            for (x = referenceIndex_start_x; x < referenceIndex_end_x; x++) {
+               if (x < reference->nx) {
+                  value = referencePtr[index];
+                  if (value == value && mask[index] > -1) {
+                     referenceValues[referenceIndex] = value;
+                     referenceOverlap[referenceIndex] = 1;
+                  }
+               }
+               index++;
+               referenceIndex++;
+            }
+         }
+         else
+            referenceIndex += BLOCK_WIDTH;
+      }
+      bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0;
+      bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
+      bestDisplacement[1] = 0.f;
+      bestDisplacement[2] = 0.f;
+
+      // iteration over the warped blocks
+      for (m = -1 * params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
+         warpedIndex_start_y = referenceIndex_start_y + m;
+         warpedIndex_end_y = warpedIndex_start_y + BLOCK_WIDTH;
+         for (l = -1 * params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
+            warpedIndex_start_x = referenceIndex_start_x + l;
+            warpedIndex_end_x = warpedIndex_start_x + BLOCK_WIDTH;
+
+            warpedIndex = 0;
+            memset(warpedValues, 0, BLOCK_2D_SIZE * sizeof(DTYPE));
+            memset(warpedOverlap, 0, BLOCK_2D_SIZE * sizeof(DTYPE));
+            for (y = warpedIndex_start_y; y < warpedIndex_end_y; y++) {
+               if (-1 < y && y < warped->ny) {
+                  index = y * warped->nx + warpedIndex_start_x;
+                  for (x = warpedIndex_start_x; x < warpedIndex_end_x; x++) {
+                     if (-1 < x && x < warped->nx) {
+                        value = warpedPtr[index];
+                        if (value == value && mask[index] > -1) {
+                           warpedValues[warpedIndex] = value;
+                           warpedOverlap[warpedIndex] = 1;
                         }
                      }
                      index++;
-                     referenceIndex++;
+                     warpedIndex++;
                   }
                }
                else
-                  referenceIndex += BLOCK_WIDTH;
+                  warpedIndex += BLOCK_WIDTH;
             }
-            bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0;
-            bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
-            bestDisplacement[1] = 0.f;
-            bestDisplacement[2] = 0.f;
-
-            // iteration over the warped blocks
-            for (m = -1 * params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
-               warpedIndex_start_y = referenceIndex_start_y + m;
-               warpedIndex_end_y = warpedIndex_start_y + BLOCK_WIDTH;
-               for (l = -1 * params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
-                  warpedIndex_start_x = referenceIndex_start_x + l;
-                  warpedIndex_end_x = warpedIndex_start_x + BLOCK_WIDTH;
-
-                  warpedIndex = 0;
-                  memset(warpedOverlap, 0, BLOCK_2D_SIZE * sizeof(bool));
-
-                  for (y = warpedIndex_start_y; y < warpedIndex_end_y; y++) {
-                     if (-1 < y && y < warped->ny) {
-                        index = y * warped->nx + warpedIndex_start_x;
-                        for (x = warpedIndex_start_x; x < warpedIndex_end_x; x++) {
-                           if (-1 < x && x < warped->nx) {
-                              warpedPtr_XY = &warpedPtr[index];
-                              value = *warpedPtr_XY;
-                              maskPtr_XY = &mask[index];
-                              if (value == value && *maskPtr_XY > -1) {
-                                 warpedValues[warpedIndex] = value;
-                                 warpedOverlap[warpedIndex] = 1;
-                              }
-                           }
-                           index++;
-                           warpedIndex++;
-                        }
-                     }
-                     else
-                        warpedIndex += BLOCK_WIDTH;
-                  }
-                  referenceMean = 0.0;
-                  warpedMean = 0.0;
-                  voxelNumber = 0.0;
-                  for (int a = 0; a < BLOCK_2D_SIZE; a++) {
-                     if (referenceOverlap[a] && warpedOverlap[a]) {
-                        referenceMean += referenceValues[a];
-                        warpedMean += warpedValues[a];
-                        voxelNumber++;
-                     }
-                  }
-
-                  if (voxelNumber > BLOCK_2D_SIZE / 2) {
-                     referenceMean /= voxelNumber;
-                     warpedMean /= voxelNumber;
-
-                     referenceVar = 0.0;
-                     warpedVar = 0.0;
-                     localCC = 0.0;
-
-                     for (int a = 0; a < BLOCK_2D_SIZE; a++) {
-                        if (referenceOverlap[a] && warpedOverlap[a]) {
-                           referenceTemp = (referenceValues[a] - referenceMean);
-                           warpedTemp = (warpedValues[a] - warpedMean);
-                           referenceVar += (referenceTemp)* (referenceTemp);
-                           warpedVar += (warpedTemp)* (warpedTemp);
-                           localCC += (referenceTemp)* (warpedTemp);
-                        }
-                     }
-
-                     localCC = (referenceVar * warpedVar) > 0.0 ? fabs(localCC / sqrt(referenceVar * warpedVar)) : 0.0;
-                     //localCC = fabs(localCC / sqrt(referenceVar * warpedVar));
-
-                     if (localCC > bestCC) {
-                        bestCC = localCC + 1.0e-7f;
-                        bestDisplacement[0] = (float)l;
-                        bestDisplacement[1] = (float)m;
-                     }
-                  }
+            if (reg_getBlockCorrelation<DTYPE>(referenceValues, referenceOverlap,
+                                               warpedValues, warpedOverlap,
+                                               BLOCK_2D_SIZE, localCC)) {
+               if (localCC > bestCC) {
+                  bestCC = localCC + 1.0e-7f;
+                  bestDisplacement[0] = (float)l;
+                  bestDisplacement[1] = (float)m;
                }
             }
+         }
+      }
 
-            referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
-            referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
-            referencePosition_temp[2] = 0.0f;
+      referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
+      referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
+      referencePosition_temp[2] = 0.0f;
 
-            bestDisplacement[0] += referencePosition_temp[0];
-            bestDisplacement[1] += referencePosition_temp[1];
-            bestDisplacement[2] = 0.0f;
+      bestDisplacement[0] += referencePosition_temp[0];
+      bestDisplacement[1] += referencePosition_temp[1];
+      bestDisplacement[2] = 0.0f;
 
-            reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
-            z = 2 * params->totalBlock[blockIndex];
+      // Every block writes its result in its own slot
+      reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
+      z = 2 * params->totalBlock[blockIndex];
 
-            params->referencePosition[z] = tempPosition[0];
-            params->referencePosition[z + 1] = tempPosition[1];
+      params->referencePosition[z] = tempPosition[0];
+      params->referencePosition[z + 1] = tempPosition[1];
 
-            reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
+      reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
 
-            params->warpedPosition[z] = tempPosition[0];
-            params->warpedPosition[z + 1] = tempPosition[1];
-            if (bestDisplacement[0] == bestDisplacement[0]) {
-               params->definedActiveBlockNumber++;
-            }
-         }
-         blockIndex++;
+      params->warpedPosition[z] = tempPosition[0];
+      params->warpedPosition[z + 1] = tempPosition[1];
+      if (bestDisplacement[0] == bestDisplacement[0]) {
+         currentDefinedActiveBlockNumber++;
       }
    }
-
+   params->definedActiveBlockNumber = currentDefinedActiveBlockNumber;
 }
 /* *************************************************************** */
 template<typename DTYPE>
@@ -447,12 +536,12 @@ void block_matching_method3D(nifti_image * reference,
    else
       referenceMatrix_xyz = &(reference->qto_xyz);
 
-   unsigned int referenceIndex_start_x;
-   unsigned int referenceIndex_start_y;
-   unsigned int referenceIndex_start_z;
-   unsigned int referenceIndex_end_x;
-   unsigned int referenceIndex_end_y;
-   unsigned int referenceIndex_end_z;
+   int referenceIndex_start_x;
+   int referenceIndex_start_y;
+   int referenceIndex_start_z;
+   int referenceIndex_end_x;
+   int referenceIndex_end_y;
+   int referenceIndex_end_z;
    int warpedIndex_start_x;
    int warpedIndex_start_y;
    int warpedIndex_start_z;
@@ -460,213 +549,518 @@ void block_matching_method3D(nifti_image * reference,
    int warpedIndex_end_y;
    int warpedIndex_end_z;
 
-   int index, l, m, n, x, y, z;
+   int blockIndex, index, l, m, n, x, y, z;
    int i, j, k; //Need to be int for VC++ compiler and OpenMP
-   int *maskPtr_Z, *maskPtr_XYZ;
-   DTYPE *referencePtr_Z, *referencePtr_XYZ, *warpedPtr_Z, *warpedPtr_XYZ;
-   DTYPE value, bestCC, referenceMean, warpedMean, referenceVar, warpedVar;
-   DTYPE voxelNumber, localCC, referenceTemp, warpedTemp;
+   int *maskPtr_Z;
+   DTYPE *referencePtr_Z, *warpedPtr_Z;
+   DTYPE value, bestCC, localCC;
    float bestDisplacement[3], referencePosition_temp[3], tempPosition[3];
-   size_t referenceIndex, warpedIndex, blockIndex, tid = 0;
+   int referenceIndex, warpedIndex;
 
-#if defined (_OPENMP)
-   int threadNumber = omp_get_max_threads();
-   if (threadNumber > 16)
-      omp_set_num_threads(16);
-   DTYPE referenceValues[16][BLOCK_3D_SIZE];
-   DTYPE warpedValues[16][BLOCK_3D_SIZE];
-   bool referenceOverlap[16][BLOCK_3D_SIZE];
-   bool warpedOverlap[16][BLOCK_3D_SIZE];
-#else
-   DTYPE referenceValues[1][BLOCK_3D_SIZE];
-   DTYPE warpedValues[1][BLOCK_3D_SIZE];
-   bool referenceOverlap[1][BLOCK_3D_SIZE];
-   bool warpedOverlap[1][BLOCK_3D_SIZE];
-#endif
+   // Every thread has its own copy of the block values
+   DTYPE referenceValues[BLOCK_3D_SIZE];
+   DTYPE referenceOverlap[BLOCK_3D_SIZE];
+   DTYPE warpedValues[BLOCK_3D_SIZE];
+   DTYPE warpedOverlap[BLOCK_3D_SIZE];
 
    int currentDefinedActiveBlockNumber = 0;
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(params, reference, warped, referencePtr, warpedPtr, mask, referenceMatrix_xyz, \
-   referenceOverlap, warpedOverlap, referenceValues, warpedValues) \
-   private(i, j, k, l, m, n, x, y, z, blockIndex, referenceIndex, \
-   index, tid, referencePtr_Z, referencePtr_XYZ, warpedPtr_Z, warpedPtr_XYZ, \
-   maskPtr_Z, maskPtr_XYZ, value, bestCC, bestDisplacement, \
+   shared(params, reference, warped, referencePtr, warpedPtr, mask, referenceMatrix_xyz) \
+   private(blockIndex, i, j, k, l, m, n, x, y, z, referenceIndex, \
+   index, referencePtr_Z, warpedPtr_Z, maskPtr_Z, value, bestCC, localCC, bestDisplacement, \
    referenceIndex_start_x, referenceIndex_start_y, referenceIndex_start_z, \
    referenceIndex_end_x, referenceIndex_end_y, referenceIndex_end_z, \
    warpedIndex_start_x, warpedIndex_start_y, warpedIndex_start_z, \
    warpedIndex_end_x, warpedIndex_end_y, warpedIndex_end_z, \
-   warpedIndex, referencePosition_temp, tempPosition, referenceTemp, warpedTemp, \
-   referenceMean, referenceVar, warpedMean, warpedVar, voxelNumber,localCC) \
-   reduction(+:currentDefinedActiveBlockNumber)
+   warpedIndex, referencePosition_temp, tempPosition, \
+   referenceValues, referenceOverlap, warpedValues, warpedOverlap) \
+   reduction(+:currentDefinedActiveBlockNumber) \
+   schedule(dynamic, 1)
 #endif
-   for (k = 0; k < (int)params->blockNumber[2]; k++) {
-#if defined (_OPENMP)
-      tid = omp_get_thread_num();
-#endif
-      blockIndex = k * params->blockNumber[0] * params->blockNumber[1];
+   for (blockIndex = 0; blockIndex < params->totalBlockNumber; blockIndex++) {
+      if (params->totalBlock[blockIndex] < 0)
+         continue;
+      i = blockIndex % params->blockNumber[0];
+      j = (blockIndex / params->blockNumber[0]) % params->blockNumber[1];
+      k = blockIndex / (params->blockNumber[0] * params->blockNumber[1]);
+      referenceIndex_start_x = i * BLOCK_WIDTH;
+      referenceIndex_end_x = referenceIndex_start_x + BLOCK_WIDTH;
+      referenceIndex_start_y = j * BLOCK_WIDTH;
+      referenceIndex_end_y = referenceIndex_start_y + BLOCK_WIDTH;
       referenceIndex_start_z = k * BLOCK_WIDTH;
       referenceIndex_end_z = referenceIndex_start_z + BLOCK_WIDTH;
 
-      for (j = 0; j < (int)params->blockNumber[1]; j++) {
-         referenceIndex_start_y = j * BLOCK_WIDTH;
-         referenceIndex_end_y = referenceIndex_start_y + BLOCK_WIDTH;
-
-         for (i = 0; i < (int)params->blockNumber[0]; i++) {
-            referenceIndex_start_x = i * BLOCK_WIDTH;
-            referenceIndex_end_x = referenceIndex_start_x + BLOCK_WIDTH;
-
-            if (params->totalBlock[blockIndex] > -1) {
-               referenceIndex = 0;
-               memset(referenceOverlap[tid], 0, BLOCK_3D_SIZE * sizeof(bool));
-               for (z = (int)referenceIndex_start_z; z < (int)referenceIndex_end_z; z++) {
-                  if (z < reference->nz) {
-                     index = z * reference->nx * reference->ny;
-                     referencePtr_Z = &referencePtr[index];
+      referenceIndex = 0;
+      memset(referenceValues, 0, BLOCK_3D_SIZE * sizeof(DTYPE));
+      memset(referenceOverlap, 0, BLOCK_3D_SIZE * sizeof(DTYPE));
+      for (z = referenceIndex_start_z; z < referenceIndex_end_z; z++) {
+         if (z < reference->nz) {
+            index = z * reference->nx * reference->ny;
+            referencePtr_Z = &referencePtr[index];
+            maskPtr_Z = &mask[index];
+            for (y = referenceIndex_start_y; y < referenceIndex_end_y; y++) {
+               if (y < reference->ny) {
+                  index = y * reference->nx + referenceIndex_start_x;
+                  for (x = referenceIndex_start_x; x < referenceIndex_end_x; x++) {
+                     if (x < reference->nx) {
+                        value = referencePtr_Z[index];
+                        if (value == value && maskPtr_Z[index] > -1) {
+                           referenceValues[referenceIndex] = value;
+                           referenceOverlap[referenceIndex] = 1;
+                        }
+                     }
+                     index++;
+                     referenceIndex++;
+                  }
+               }
+               else
+                  referenceIndex += BLOCK_WIDTH;
+            }
+         }
+         else
+            referenceIndex += BLOCK_WIDTH * BLOCK_WIDTH;
+      }
+      bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0; //only when misaligned images are registered
+      bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
+      bestDisplacement[1] = 0.f;
+      bestDisplacement[2] = 0.f;
+
+      // iteration over the warped blocks
+      for (n = -1 * params->voxelCaptureRange; n <= params->voxelCaptureRange; n += params->stepSize) {
+         warpedIndex_start_z = referenceIndex_start_z + n;
+         warpedIndex_end_z = warpedIndex_start_z + BLOCK_WIDTH;
+         for (m = -1 * params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
+            warpedIndex_start_y = referenceIndex_start_y + m;
+            warpedIndex_end_y = warpedIndex_start_y + BLOCK_WIDTH;
+            for (l = -1 * params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
+               warpedIndex_start_x = referenceIndex_start_x + l;
+               warpedIndex_end_x = warpedIndex_start_x + BLOCK_WIDTH;
+
+               warpedIndex = 0;
+               memset(warpedValues, 0, BLOCK_3D_SIZE * sizeof(DTYPE));
+               memset(warpedOverlap, 0, BLOCK_3D_SIZE * sizeof(DTYPE));
+               for (z = warpedIndex_start_z; z < warpedIndex_end_z; z++) {
+                  if (-1 < z && z < warped->nz) {
+                     index = z * warped->nx * warped->ny;
+                     warpedPtr_Z = &warpedPtr[index];
                      maskPtr_Z = &mask[index];
-                     for (y = (int)referenceIndex_start_y; y < (int)referenceIndex_end_y; y++) {
-                        if (y < reference->ny) {
-                           index = y * reference->nx + referenceIndex_start_x;
-                           for (x = (int)referenceIndex_start_x; x < (int)referenceIndex_end_x; x++) {
-                              if (x < reference->nx) {
-                                 referencePtr_XYZ = &referencePtr_Z[index];
-                                 maskPtr_XYZ = &maskPtr_Z[index];
-                                 value = *referencePtr_XYZ;
-                                 if (value == value && *maskPtr_XYZ > -1) {
-                                    referenceValues[tid][referenceIndex] = value;
-                                    referenceOverlap[tid][referenceIndex] = 1;
+                     for (y = warpedIndex_start_y; y < warpedIndex_end_y; y++) {
+                        if (-1 < y && y < warped->ny) {
+                           index = y * warped->nx + warpedIndex_start_x;
+                           for (x = warpedIndex_start_x; x < warpedIndex_end_x; x++) {
+                              if (-1 < x && x < warped->nx) {
+                                 value = warpedPtr_Z[index];
+                                 if (value == value && maskPtr_Z[index] > -1) {
+                                    warpedValues[warpedIndex] = value;
+                                    warpedOverlap[warpedIndex] = 1;
                                  }
                               }
                               index++;
-                              referenceIndex++;
+                              warpedIndex++;
                            }
                         }
                         else
-                           referenceIndex += BLOCK_WIDTH;
+                           warpedIndex += BLOCK_WIDTH;
                      }
                   }
                   else
-                     referenceIndex += BLOCK_WIDTH * BLOCK_WIDTH;
+                     warpedIndex += BLOCK_WIDTH * BLOCK_WIDTH;
                }
-               bestCC = params->voxelCaptureRange > 3 ? 0.9 : 0.0; //only when misaligned images are registered
-               bestDisplacement[0] = std::numeric_limits<float>::quiet_NaN();
-               bestDisplacement[1] = 0.f;
-               bestDisplacement[2] = 0.f;
-
-               // iteration over the warped blocks
-               for (n = -1 * params->voxelCaptureRange; n <= params->voxelCaptureRange; n += params->stepSize) {
-                  warpedIndex_start_z = referenceIndex_start_z + n;
-                  warpedIndex_end_z = warpedIndex_start_z + BLOCK_WIDTH;
-                  for (m = -1 * params->voxelCaptureRange; m <= params->voxelCaptureRange; m += params->stepSize) {
-                     warpedIndex_start_y = referenceIndex_start_y + m;
-                     warpedIndex_end_y = warpedIndex_start_y + BLOCK_WIDTH;
-                     for (l = -1 * params->voxelCaptureRange; l <= params->voxelCaptureRange; l += params->stepSize) {
-
-                        warpedIndex_start_x = referenceIndex_start_x + l;
-                        warpedIndex_end_x = warpedIndex_start_x + BLOCK_WIDTH;
-                        warpedIndex = 0;
-                        memset(warpedOverlap[tid], 0, BLOCK_3D_SIZE * sizeof(bool));
-                        for (z = warpedIndex_start_z; z < warpedIndex_end_z; z++) {
-                           if (-1 < z && z < warped->nz) {
-                              index = z * warped->nx * warped->ny;
-                              warpedPtr_Z = &warpedPtr[index];
-                              maskPtr_Z = &mask[index];
-                              for (y = warpedIndex_start_y; y < warpedIndex_end_y; y++) {
-                                 if (-1 < y && y < warped->ny) {
-                                    index = y * warped->nx + warpedIndex_start_x;
-                                    for (x = warpedIndex_start_x; x < warpedIndex_end_x; x++) {
-                                       if (-1 < x && x < warped->nx) {
-                                          warpedPtr_XYZ = &warpedPtr_Z[index];
-                                          maskPtr_XYZ = &maskPtr_Z[index];
-                                          value = *warpedPtr_XYZ;
-                                          if (value == value && *maskPtr_XYZ > -1) {
-                                             warpedValues[tid][warpedIndex] = value;
-                                             warpedOverlap[tid][warpedIndex] = 1;
-                                          }
-                                       }
-                                       index++;
-                                       warpedIndex++;
-                                    }
-                                 }
-                                 else
-                                    warpedIndex += BLOCK_WIDTH;
-                              }
-                           }
-                           else
-                              warpedIndex += BLOCK_WIDTH * BLOCK_WIDTH;
-                        }
-                        referenceMean = 0.0;
-                        warpedMean = 0.0;
-                        voxelNumber = 0.0;
-                        for (int a = 0; a < BLOCK_3D_SIZE; a++) {
-                           if (referenceOverlap[tid][a] && warpedOverlap[tid][a]) {
-                              referenceMean += referenceValues[tid][a];
-                              warpedMean += warpedValues[tid][a];
-                              voxelNumber++;
-                           }
-                        }
+               if (reg_getBlockCorrelation<DTYPE>(referenceValues, referenceOverlap,
+                                                  warpedValues, warpedOverlap,
+                                                  BLOCK_3D_SIZE, localCC)) {
+                  if (localCC > bestCC) {
+                     bestCC = localCC + 1.0e-7f;
+                     bestDisplacement[0] = (float)l;
+                     bestDisplacement[1] = (float)m;
+                     bestDisplacement[2] = (float)n;
+                  }
+               }
+            }
+         }
+      }
+      referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
+      referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
+      referencePosition_temp[2] = (float)(k * BLOCK_WIDTH);
+
+      bestDisplacement[0] += referencePosition_temp[0];
+      bestDisplacement[1] += referencePosition_temp[1];
+      bestDisplacement[2] += referencePosition_temp[2];
+
+      // Every block writes its result in its own slot
+      reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
+      z = 3 * params->totalBlock[blockIndex];
+      params->referencePosition[z] = tempPosition[0];
+      params->referencePosition[z+1] = tempPosition[1];
+      params->referencePosition[z+2] = tempPosition[2];
+
+      reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
+      params->warpedPosition[z] = tempPosition[0];
+      params->warpedPosition[z + 1] = tempPosition[1];
+      params->warpedPosition[z + 2] = tempPosition[2];
+      if (bestDisplacement[0] == bestDisplacement[0]) {
+         currentDefinedActiveBlockNumber++;
+      }
+   }
+   params->definedActiveBlockNumber = currentDefinedActiveBlockNumber;
+}
+/* *************************************************************** */
+/** Workspace used by one thread for the hierarchical search of a block.
+ * The warped values of the whole search region are gathered once, together
+ * with the sum, the sum of squares and the number of defined voxels of every
+ * 4x4 slice that a candidate block can cover.
+ */
+template<typename DTYPE>
+struct _reg_blockSearchSpace
+{
+   int range;
+   int regionWidth;
+   int shiftNumber;
+   DTYPE *regionValues;
+   DTYPE *regionOverlap;
+   double *sliceStats;
+   bool *visited;
+
+   DTYPE referenceValues[BLOCK_3D_SIZE];
+   DTYPE referenceOverlap[BLOCK_3D_SIZE];
+   DTYPE warpedValues[BLOCK_3D_SIZE];
+   DTYPE warpedOverlap[BLOCK_3D_SIZE];
+   // Zero-mean and unit-norm reference values, only used when all the
+   // reference voxels are defined
+   bool fullReference;
+   double referenceNormalised[BLOCK_3D_SIZE];
+   double referenceSliceSum[BLOCK_WIDTH];
+   double referenceSliceNorm[BLOCK_WIDTH];
+
+   DTYPE bestCC;
+   int bestDisplacement[3];
+};
+/* *************************************************************** */
+/** Evaluate one displacement of the hierarchical search and update the best
+ * displacement if required. Returns true if the best displacement changed.
+ */
+template<typename DTYPE>
+static bool reg_evaluateBlockCandidate(_reg_blockSearchSpace<DTYPE> *space,
+                                       int l,
+                                       int m,
+                                       int n) {
+   int range = space->range;
+   if (l < -range || l > range || m < -range || m > range || n < -range || n > range)
+      return false;
+   int shiftNumber = space->shiftNumber;
+   int regionWidth = space->regionWidth;
+   int rx = l + range, ry = m + range, rz = n + range;
+   bool *visited = &space->visited[(rz * shiftNumber + ry) * shiftNumber + rx];
+   if (*visited)
+      return false;
+   *visited = true;
+
+   DTYPE localCC;
+   bool fullOverlap = space->fullReference;
+   double sliceSum[BLOCK_WIDTH], sliceSquare[BLOCK_WIDTH];
+   double warpedSum = 0.0, warpedSquare = 0.0;
+   for (int u = 0; u < BLOCK_WIDTH && fullOverlap; u++) {
+      double *stats = &space->sliceStats[(((rz + u) * shiftNumber + ry) * shiftNumber + rx) * 3];
+      if (stats[2] < BLOCK_2D_SIZE)
+         fullOverlap = false;
+      sliceSum[u] = stats[0];
+      sliceSquare[u] = stats[1];
+      warpedSum += stats[0];
+      warpedSquare += stats[1];
+   }
+   if (fullOverlap) {
+      // As the reference values are zero-mean and unit-norm, the correlation
+      // is the dot product with the warped values divided by their norm
+      double warpedNorm = warpedSquare - warpedSum * warpedSum / (double)BLOCK_3D_SIZE;
+      if (warpedNorm <= 0.0)
+         return false;
+      warpedNorm = sqrt(warpedNorm);
+      // Cauchy-Schwarz bound of the contribution of every slice
+      double sliceBound[BLOCK_WIDTH], remainingBound = 0.0;
+      for (int u = 0; u < BLOCK_WIDTH; u++) {
+         double sliceVar = sliceSquare[u] - sliceSum[u] * sliceSum[u] / (double)BLOCK_2D_SIZE;
+         sliceBound[u] = fabs(sliceSum[u] / (double)BLOCK_2D_SIZE * space->referenceSliceSum[u]) +
+               space->referenceSliceNorm[u] * sqrt(sliceVar > 0.0 ? sliceVar : 0.0);
+         remainingBound += sliceBound[u];
+      }
+      double bestValue = (double)space->bestCC * warpedNorm;
+      if (remainingBound <= bestValue)
+         return false;
+      double correlation = 0.0;
+      double *referenceNormalised = space->referenceNormalised;
+      for (int u = 0; u < BLOCK_WIDTH; u++) {
+         for (int y = 0; y < BLOCK_WIDTH; y++) {
+            DTYPE *regionValues = &space->regionValues[((rz + u) * regionWidth + ry + y) * regionWidth + rx];
+            for (int x = 0; x < BLOCK_WIDTH; x++)
+               correlation += *referenceNormalised++ * (double)regionValues[x];
+         }
+         remainingBound -= sliceBound[u];
+         if (fabs(correlation) + remainingBound <= bestValue)
+            return false;
+      }
+      localCC = (DTYPE)(fabs(correlation) / warpedNorm);
+   }
+   else {
+      int warpedIndex = 0;
+      for (int z = 0; z < BLOCK_WIDTH; z++) {
+         for (int y = 0; y < BLOCK_WIDTH; y++) {
+            size_t regionIndex = ((size_t)(rz + z) * regionWidth + ry + y) * regionWidth + rx;
+            for (int x = 0; x < BLOCK_WIDTH; x++) {
+               space->warpedValues[warpedIndex] = space->regionValues[regionIndex + x];
+               space->warpedOverlap[warpedIndex] = space->regionOverlap[regionIndex + x];
+               warpedIndex++;
+            }
+         }
+      }
+      if (!reg_getBlockCorrelation<DTYPE>(space->referenceValues, space->referenceOverlap,
+                                          space->warpedValues, space->warpedOverlap,
+                                          BLOCK_3D_SIZE, localCC))
+         return false;
+   }
+   if (localCC > space->bestCC) {
+      space->bestCC = localCC + 1.0e-7f;
+      space->bestDisplacement[0] = l;
+      space->bestDisplacement[1] = m;
+      space->bestDisplacement[2] = n;
+      return true;
+   }
+   return false;
+}
+/* *************************************************************** */
+template<typename DTYPE>
+void block_matching_method3D_hierarchical(nifti_image * reference,
+                                          nifti_image * warped,
+                                          _reg_blockMatchingParam *params,
+                                          int *mask) {
+   DTYPE *referencePtr = static_cast<DTYPE *>(reference->data);
+   DTYPE *warpedPtr = static_cast<DTYPE *>(warped->data);
 
-                        if (voxelNumber > BLOCK_3D_SIZE / 2) {
-                           referenceMean /= voxelNumber;
-                           warpedMean /= voxelNumber;
-
-                           referenceVar = 0.0;
-                           warpedVar = 0.0;
-                           localCC = 0.0;
-
-                           for (int a = 0; a < BLOCK_3D_SIZE; a++) {
-                              if (referenceOverlap[tid][a] && warpedOverlap[tid][a]) {
-                                 referenceTemp = (referenceValues[tid][a] - referenceMean);
-                                 warpedTemp = (warpedValues[tid][a] - warpedMean);
-                                 referenceVar += (referenceTemp)* (referenceTemp);
-                                 warpedVar += (warpedTemp)* (warpedTemp);
-                                 localCC += (referenceTemp)* (warpedTemp);
-                              }
-                           }
-                           localCC = (referenceVar * warpedVar) > 0.0 ? fabs(localCC / sqrt(referenceVar * warpedVar)) : 0.0;
+   mat44 *referenceMatrix_xyz;
+   if (reference->sform_code > 0)
+      referenceMatrix_xyz = &(reference->sto_xyz);
+   else
+      referenceMatrix_xyz = &(reference->qto_xyz);
 
-                           if (localCC > bestCC) {
-                              bestCC = localCC + 1.0e-7f;
-                              bestDisplacement[0] = (float)l;
-                              bestDisplacement[1] = (float)m;
-                              bestDisplacement[2] = (float)n;
-                           }
-                        }
-                     }
+   int range = params->voxelCaptureRange;
+   int step = params->stepSize;
+   int regionWidth = BLOCK_WIDTH + 2 * range;
+   int shiftNumber = 2 * range + 1;
+   size_t regionSize = (size_t)regionWidth * regionWidth * regionWidth;
+   size_t sliceStatSize = 3 * (size_t)regionWidth * shiftNumber * shiftNumber;
+   size_t visitedSize = (size_t)shiftNumber * shiftNumber * shiftNumber;
+   // The displacement closest to zero is tested first. The coarse lattice
+   // then uses twice the step size and is refined using the step size
+   int start = -range + step * (int)reg_round((double)range / (double)step);
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   // Every thread uses its own search space
+   _reg_blockSearchSpace<DTYPE> *spaces = new _reg_blockSearchSpace<DTYPE>[threadNumber];
+   DTYPE *regionBuffer = (DTYPE *)malloc(2 * (size_t)threadNumber * regionSize * sizeof(DTYPE));
+   double *sliceStatBuffer = (double *)malloc((size_t)threadNumber * sliceStatSize * sizeof(double));
+   double *rowStatBuffer = (double *)malloc(3 * (size_t)threadNumber * regionWidth * shiftNumber * sizeof(double));
+   bool *visitedBuffer = (bool *)malloc((size_t)threadNumber * visitedSize * sizeof(bool));
+   for (int t = 0; t < threadNumber; t++) {
+      spaces[t].range = range;
+      spaces[t].regionWidth = regionWidth;
+      spaces[t].shiftNumber = shiftNumber;
+      spaces[t].regionValues = &regionBuffer[2 * (size_t)t * regionSize];
+      spaces[t].regionOverlap = &spaces[t].regionValues[regionSize];
+      spaces[t].sliceStats = &sliceStatBuffer[(size_t)t * sliceStatSize];
+      spaces[t].visited = &visitedBuffer[(size_t)t * visitedSize];
+   }
+
+   int blockIndex, i, j, k, l, m, n, x, y, z, a, index, improved;
+   int bestDisplacement[3];
+   size_t regionIndex;
+   DTYPE value, valid;
+   double mean, norm, *rowStats, *sliceStats;
+   float displacement[3], referencePosition_temp[3], tempPosition[3];
+   _reg_blockSearchSpace<DTYPE> *space;
+
+   int currentDefinedActiveBlockNumber = 0;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(params, reference, warped, referencePtr, warpedPtr, mask, referenceMatrix_xyz, \
+   range, step, regionWidth, shiftNumber, regionSize, visitedSize, start, spaces, \
+   rowStatBuffer) \
+   private(blockIndex, tid, i, j, k, l, m, n, x, y, z, a, index, improved, bestDisplacement, \
+   regionIndex, value, valid, mean, norm, rowStats, sliceStats, displacement, \
+   referencePosition_temp, tempPosition, space) \
+   reduction(+:currentDefinedActiveBlockNumber) \
+   schedule(dynamic, 1)
+#endif
+   for (blockIndex = 0; blockIndex < params->totalBlockNumber; blockIndex++) {
+      if (params->totalBlock[blockIndex] < 0)
+         continue;
+#if defined (_OPENMP)
+      tid = omp_get_thread_num();
+#endif
+      space = &spaces[tid];
+      rowStats = &rowStatBuffer[3 * (size_t)tid * regionWidth * shiftNumber];
+      i = blockIndex % params->blockNumber[0];
+      j = (blockIndex / params->blockNumber[0]) % params->blockNumber[1];
+      k = blockIndex / (params->blockNumber[0] * params->blockNumber[1]);
+
+      // Gather the reference block
+      a = 0;
+      mean = 0.0;
+      for (z = k * BLOCK_WIDTH; z < (k + 1) * BLOCK_WIDTH; z++) {
+         for (y = j * BLOCK_WIDTH; y < (j + 1) * BLOCK_WIDTH; y++) {
+            for (x = i * BLOCK_WIDTH; x < (i + 1) * BLOCK_WIDTH; x++) {
+               space->referenceValues[a] = 0;
+               space->referenceOverlap[a] = 0;
+               if (x < reference->nx && y < reference->ny && z < reference->nz) {
+                  index = (z * reference->ny + y) * reference->nx + x;
+                  value = referencePtr[index];
+                  if (value == value && mask[index] > -1) {
+                     space->referenceValues[a] = value;
+                     space->referenceOverlap[a] = 1;
+                     mean += (double)value;
                   }
                }
-               //if (bestDisplacement[0] == bestDisplacement[0]) {
-               referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
-               referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
-               referencePosition_temp[2] = (float)(k * BLOCK_WIDTH);
-
-               bestDisplacement[0] += referencePosition_temp[0];
-               bestDisplacement[1] += referencePosition_temp[1];
-               bestDisplacement[2] += referencePosition_temp[2];
-
-               reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
-               z = 3 * params->totalBlock[blockIndex];
-               params->referencePosition[z] = tempPosition[0];
-               params->referencePosition[z+1] = tempPosition[1];
-               params->referencePosition[z+2] = tempPosition[2];
-
-               reg_mat44_mul(referenceMatrix_xyz, bestDisplacement, tempPosition);
-               params->warpedPosition[z] = tempPosition[0];
-               params->warpedPosition[z + 1] = tempPosition[1];
-               params->warpedPosition[z + 2] = tempPosition[2];
-               if (bestDisplacement[0] == bestDisplacement[0]) {
-                  currentDefinedActiveBlockNumber++;
+               a++;
+            }
+         }
+      }
+      // Normalise the reference block if it is fully defined
+      space->fullReference = true;
+      for (a = 0; a < BLOCK_3D_SIZE; a++)
+         if (space->referenceOverlap[a] == 0)
+            space->fullReference = false;
+      if (space->fullReference) {
+         mean /= (double)BLOCK_3D_SIZE;
+         norm = 0.0;
+         for (a = 0; a < BLOCK_3D_SIZE; a++) {
+            space->referenceNormalised[a] = (double)space->referenceValues[a] - mean;
+            norm += space->referenceNormalised[a] * space->referenceNormalised[a];
+         }
+         if (norm > 0.0) {
+            norm = sqrt(norm);
+            for (z = 0; z < BLOCK_WIDTH; z++) {
+               space->referenceSliceSum[z] = 0.0;
+               space->referenceSliceNorm[z] = 0.0;
+               for (a = z * BLOCK_2D_SIZE; a < (z + 1) * BLOCK_2D_SIZE; a++) {
+                  space->referenceNormalised[a] /= norm;
+                  space->referenceSliceSum[z] += space->referenceNormalised[a];
+                  space->referenceSliceNorm[z] += space->referenceNormalised[a] * space->referenceNormalised[a];
+               }
+               space->referenceSliceNorm[z] = sqrt(space->referenceSliceNorm[z]);
+            }
+         }
+         else space->fullReference = false;
+      }
+
+      // Gather the warped values of the search region
+      regionIndex = 0;
+      for (z = k * BLOCK_WIDTH - range; z < k * BLOCK_WIDTH - range + regionWidth; z++) {
+         for (y = j * BLOCK_WIDTH - range; y < j * BLOCK_WIDTH - range + regionWidth; y++) {
+            for (x = i * BLOCK_WIDTH - range; x < i * BLOCK_WIDTH - range + regionWidth; x++) {
+               value = 0;
+               valid = 0;
+               if (-1 < x && x < warped->nx && -1 < y && y < warped->ny && -1 < z && z < warped->nz) {
+                  index = (z * warped->ny + y) * warped->nx + x;
+                  if (warpedPtr[index] == warpedPtr[index] && mask[index] > -1) {
+                     value = warpedPtr[index];
+                     valid = 1;
+                  }
                }
+               space->regionValues[regionIndex] = value;
+               space->regionOverlap[regionIndex] = valid;
+               regionIndex++;
             }
-            blockIndex++;
          }
       }
+      // Compute the statistics of every 4x4 slice, first along x then along y
+      for (z = 0; z < regionWidth; z++) {
+         for (y = 0; y < regionWidth; y++) {
+            for (x = 0; x < shiftNumber; x++) {
+               regionIndex = ((size_t)z * regionWidth + y) * regionWidth + x;
+               sliceStats = &rowStats[(y * shiftNumber + x) * 3];
+               sliceStats[0] = sliceStats[1] = sliceStats[2] = 0.0;
+               for (a = 0; a < BLOCK_WIDTH; a++) {
+                  value = space->regionValues[regionIndex + a];
+                  sliceStats[0] += (double)value;
+                  sliceStats[1] += (double)value * (double)value;
+                  sliceStats[2] += (double)space->regionOverlap[regionIndex + a];
+               }
+            }
+         }
+         for (y = 0; y < shiftNumber; y++) {
+            for (x = 0; x < shiftNumber; x++) {
+               sliceStats = &space->sliceStats[((z * shiftNumber + y) * shiftNumber + x) * 3];
+               sliceStats[0] = sliceStats[1] = sliceStats[2] = 0.0;
+               for (a = 0; a < BLOCK_WIDTH; a++) {
+                  sliceStats[0] += rowStats[((y + a) * shiftNumber + x) * 3];
+                  sliceStats[1] += rowStats[((y + a) * shiftNumber + x) * 3 + 1];
+                  sliceStats[2] += rowStats[((y + a) * shiftNumber + x) * 3 + 2];
+               }
+            }
+         }
+      }
+
+      memset(space->visited, 0, visitedSize * sizeof(bool));
+      space->bestCC = range > 3 ? 0.9 : 0.0; //only when misaligned images are registered
+      space->bestDisplacement[0] = space->bestDisplacement[1] = space->bestDisplacement[2] = 0;
+      bool found = reg_evaluateBlockCandidate<DTYPE>(space, start, start, start);
+      // Coarse search
+      for (n = -range; n <= range; n += 2 * step)
+         for (m = -range; m <= range; m += 2 * step)
+            for (l = -range; l <= range; l += 2 * step)
+               found |= reg_evaluateBlockCandidate<DTYPE>(space, l, m, n);
+      // Refinement around the best displacement until it does not move
+      improved = found;
+      while (improved) {
+         improved = false;
+         bestDisplacement[0] = space->bestDisplacement[0];
+         bestDisplacement[1] = space->bestDisplacement[1];
+         bestDisplacement[2] = space->bestDisplacement[2];
+         for (n = bestDisplacement[2] - step; n <= bestDisplacement[2] + step; n += step)
+            for (m = bestDisplacement[1] - step; m <= bestDisplacement[1] + step; m += step)
+               for (l = bestDisplacement[0] - step; l <= bestDisplacement[0] + step; l += step)
+                  improved |= reg_evaluateBlockCandidate<DTYPE>(space, l, m, n);
+      }
+
+      referencePosition_temp[0] = (float)(i * BLOCK_WIDTH);
+      referencePosition_temp[1] = (float)(j * BLOCK_WIDTH);
+      referencePosition_temp[2] = (float)(k * BLOCK_WIDTH);
+      if (found) {
+         displacement[0] = (float)space->bestDisplacement[0] + referencePosition_temp[0];
+         displacement[1] = (float)space->bestDisplacement[1] + referencePosition_temp[1];
+         displacement[2] = (float)space->bestDisplacement[2] + referencePosition_temp[2];
+      }
+      else {
+         displacement[0] = std::numeric_limits<float>::quiet_NaN();
+         displacement[1] = referencePosition_temp[1];
+         displacement[2] = referencePosition_temp[2];
+      }
+
+      // Every block writes its result in its own slot
+      reg_mat44_mul(referenceMatrix_xyz, referencePosition_temp, tempPosition);
+      z = 3 * params->totalBlock[blockIndex];
+      params->referencePosition[z] = tempPosition[0];
+      params->referencePosition[z+1] = tempPosition[1];
+      params->referencePosition[z+2] = tempPosition[2];
+
+      reg_mat44_mul(referenceMatrix_xyz, displacement, tempPosition);
+      params->warpedPosition[z] = tempPosition[0];
+      params->warpedPosition[z + 1] = tempPosition[1];
+      params->warpedPosition[z + 2] = tempPosition[2];
+      if (found) {
+         currentDefinedActiveBlockNumber++;
+      }
    }
    params->definedActiveBlockNumber = currentDefinedActiveBlockNumber;
 
-#if defined (_OPENMP)
-   omp_set_num_threads(threadNumber);
-#endif
+   free(regionBuffer);
+   free(sliceStatBuffer);
+   free(rowStatBuffer);
+   free(visitedBuffer);
+   delete []spaces;
 }
 /* *************************************************************** */
 // Block matching interface function
@@ -688,6 +1082,19 @@ void block_matching_method(nifti_image * reference, nifti_image * warped, _reg_b
          reg_print_msg_error("The reference image data type is not supported");
          reg_exit();
       }
+   } else if (params->hierarchicalSearch) {
+      switch (reference->datatype) {
+      case NIFTI_TYPE_FLOAT64:
+         block_matching_method3D_hierarchical<double>(reference, warped, params, mask);
+         break;
+      case NIFTI_TYPE_FLOAT32:
+         block_matching_method3D_hierarchical<float>(reference, warped, params, mask);
+         break;
+      default:
+         reg_print_fct_error("block_matching_method");
+         reg_print_msg_error("The reference image data type is not supported");
+         reg_exit();
+      }
    } else {
       switch (reference->datatype) {
       case NIFTI_TYPE_FLOAT64:
@@ -704,6 +1111,42 @@ void block_matching_method(nifti_image * reference, nifti_image * warped, _reg_b
    }
 }
 /* *************************************************************** */
+void block_matching_support_mask(nifti_image * reference,
+                                 _reg_blockMatchingParam *params,
+                                 int *mask,
+                                 int *supportMask)
+{
+   size_t voxelNumber = (size_t)reference->nx * reference->ny * reference->nz;
+   for (size_t i = 0; i < voxelNumber; ++i)
+      supportMask[i] = -1;
+   int range = params->voxelCaptureRange;
+   int rangeZ = reference->nz > 1 ? range : 0;
+   int blockWidthZ = reference->nz > 1 ? BLOCK_WIDTH : 1;
+   for (int blockIndex = 0; blockIndex < params->totalBlockNumber; ++blockIndex) {
+      if (params->totalBlock[blockIndex] < 0)
+         continue;
+      int i = blockIndex % params->blockNumber[0];
+      int j = (blockIndex / params->blockNumber[0]) % params->blockNumber[1];
+      int k = blockIndex / (params->blockNumber[0] * params->blockNumber[1]);
+      int startX = i * BLOCK_WIDTH - range, endX = (i + 1) * BLOCK_WIDTH + range;
+      int startY = j * BLOCK_WIDTH - range, endY = (j + 1) * BLOCK_WIDTH + range;
+      int startZ = k * blockWidthZ - rangeZ, endZ = (k + 1) * blockWidthZ + rangeZ;
+      startX = startX < 0 ? 0 : startX;
+      startY = startY < 0 ? 0 : startY;
+      startZ = startZ < 0 ? 0 : startZ;
+      endX = endX > reference->nx ? reference->nx : endX;
+      endY = endY > reference->ny ? reference->ny : endY;
+      endZ = endZ > reference->nz ? reference->nz : endZ;
+      for (int z = startZ; z < endZ; ++z) {
+         for (int y = startY; y < endY; ++y) {
+            size_t index = ((size_t)z * reference->ny + y) * reference->nx + startX;
+            for (int x = startX; x < endX; ++x, ++index)
+               supportMask[index] = mask[index];
+         }
+      }
+   }
+}
+/* *************************************************************** */
 // Find the optimal transformation - affine or rigid
 void optimize(_reg_blockMatchingParam *params,
               mat44 *transformation_matrix,
@@ -57,6 +57,10 @@ struct _reg_blockMatchingParam
 
    int stepSize;
 
+   //Use a coarse-to-fine search with early termination rather than
+   //an exhaustive search of the displacements (3D images only)
+   bool hierarchicalSearch;
+
    _reg_blockMatchingParam()
        : totalBlockNumber(0),
         totalBlock(0),
@@ -66,7 +70,8 @@ struct _reg_blockMatchingParam
         warpedPosition(0),
         activeBlockNumber(0),
         voxelCaptureRange(0),
-        stepSize(0)
+        stepSize(0),
+        hierarchicalSearch(false)
    {}
 
    ~_reg_blockMatchingParam()
@@ -99,7 +104,11 @@ void initialise_block_matching_method(nifti_image * referenceImage,
                                       int *mask,
                                       bool runningOnGPU = false);
 
-/** @brief Interface for the block matching algorithm.
+/** @brief Interface for the block matching algorithm. When the
+ * hierarchicalSearch flag of the parameter structure is set, the displacements
+ * of every 3D block are first searched on a coarse lattice and then refined
+ * around the best one, and the candidates whose correlation upper bound can
+ * not beat the current best are discarded.
  * @param referenceImage Reference image in the current registration task
  * @param warpedImage Warped floating image in the currrent registration task
  * @param params Block matching parameter structure that contains all
@@ -112,6 +121,20 @@ void block_matching_method(nifti_image * referenceImage,
                            _reg_blockMatchingParam *params,
                            int *mask);
 
+/** @brief Restrict a mask to the voxels that the block matching reads in the
+ * warped image, i.e. the active blocks dilated by the capture range
+ * @param referenceImage Reference image in the current registration task
+ * @param params Block matching parameter structure that contains the active blocks
+ * @param mask Mask array where only voxel defined as active are considered
+ * @param supportMask Array that is filled with the mask values inside the
+ * active blocks support and with -1 everywhere else
+ */
+extern "C++"
+void block_matching_support_mask(nifti_image * referenceImage,
+                                 _reg_blockMatchingParam *params,
+                                 int *mask,
+                                 int *supportMask);
+
 /** @brief Find the optimal affine transformation that matches the points
  * in the reference image to the point in the warped image
  * @param params Block-matching structure that contains the relevant information
@@ -15,6 +15,7 @@
 #include "_reg_globalTrans.h"
 #include "_reg_maths.h"
 #include "_reg_maths_eigen.h"
+#include <algorithm>
 
 /* *************************************************************** */
 /* *************************************************************** */
@@ -665,23 +666,120 @@ void estimate_affine_transformation3D(float** points1, float** points2, int num_
 // estimate an affine transformation using least square
 void estimate_affine_transformation3D(std::vector<_reg_sorted_point3D> &points, mat44 * transformation)
 {
-   unsigned int num_points = points.size();
-   float** points1 = reg_matrix2DAllocate<float>(num_points, 3);
-   float** points2 = reg_matrix2DAllocate<float>(num_points, 3);
-   for (unsigned int i = 0; i < num_points; i++) {
-      points1[i][0] = points[i].reference[0];
-      points1[i][1] = points[i].reference[1];
-      points1[i][2] = points[i].reference[2];
-      points2[i][0] = points[i].warped[0];
-      points2[i][1] = points[i].warped[1];
-      points2[i][2] = points[i].warped[2];
+   // The three rows of the affine share the same design matrix. The normal
+   // equations are thus accumulated once, around the centroids, in double
+   // precision and using a parallel reduction over the points
+   int num_points = (int)points.size();
+   _reg_sorted_point3D *pointPtr = &points[0];
+   int k;
+   double refMeanX = 0., refMeanY = 0., refMeanZ = 0.;
+   double warMeanX = 0., warMeanY = 0., warMeanZ = 0.;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(num_points, pointPtr) \
+   private(k) \
+   reduction(+:refMeanX, refMeanY, refMeanZ, warMeanX, warMeanY, warMeanZ)
+#endif
+   for (k = 0; k < num_points; ++k) {
+      refMeanX += pointPtr[k].reference[0];
+      refMeanY += pointPtr[k].reference[1];
+      refMeanZ += pointPtr[k].reference[2];
+      warMeanX += pointPtr[k].warped[0];
+      warMeanY += pointPtr[k].warped[1];
+      warMeanZ += pointPtr[k].warped[2];
+   }
+   refMeanX /= (double)num_points;
+   refMeanY /= (double)num_points;
+   refMeanZ /= (double)num_points;
+   warMeanX /= (double)num_points;
+   warMeanY /= (double)num_points;
+   warMeanZ /= (double)num_points;
+
+   // Covariance of the reference positions and cross-covariance with the
+   // warped positions
+   double cXX = 0., cXY = 0., cXZ = 0., cYY = 0., cYZ = 0., cZZ = 0.;
+   double xX = 0., xY = 0., xZ = 0., yX = 0., yY = 0., yZ = 0., zX = 0., zY = 0., zZ = 0.;
+   double rx, ry, rz, wx, wy, wz;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(num_points, pointPtr, refMeanX, refMeanY, refMeanZ, warMeanX, warMeanY, warMeanZ) \
+   private(k, rx, ry, rz, wx, wy, wz) \
+   reduction(+:cXX, cXY, cXZ, cYY, cYZ, cZZ, xX, xY, xZ, yX, yY, yZ, zX, zY, zZ)
+#endif
+   for (k = 0; k < num_points; ++k) {
+      rx = pointPtr[k].reference[0] - refMeanX;
+      ry = pointPtr[k].reference[1] - refMeanY;
+      rz = pointPtr[k].reference[2] - refMeanZ;
+      wx = pointPtr[k].warped[0] - warMeanX;
+      wy = pointPtr[k].warped[1] - warMeanY;
+      wz = pointPtr[k].warped[2] - warMeanZ;
+      cXX += rx * rx; cXY += rx * ry; cXZ += rx * rz;
+      cYY += ry * ry; cYZ += ry * rz; cZZ += rz * rz;
+      xX += wx * rx; xY += wx * ry; xZ += wx * rz;
+      yX += wy * rx; yY += wy * ry; yZ += wy * rz;
+      zX += wz * rx; zY += wz * ry; zZ += wz * rz;
+   }
+
+   // Inverse of the covariance matrix using its cofactors
+   double inv[3][3];
+   inv[0][0] = cYY * cZZ - cYZ * cYZ;
+   inv[0][1] = cXZ * cYZ - cXY * cZZ;
+   inv[0][2] = cXY * cYZ - cXZ * cYY;
+   inv[1][1] = cXX * cZZ - cXZ * cXZ;
+   inv[1][2] = cXY * cXZ - cXX * cYZ;
+   inv[2][2] = cXX * cYY - cXY * cXY;
+   double det = cXX * inv[0][0] + cXY * inv[0][1] + cXZ * inv[0][2];
+   double trace = (cXX + cYY + cZZ) / 3.;
+   if (num_points < 4 || !(det > 1.0e-10 * trace * trace * trace)) {
+      // The points are (close to) degenerated, the pseudo-inverse based
+      // on the SVD is used instead
+      float** points1 = reg_matrix2DAllocate<float>(num_points, 3);
+      float** points2 = reg_matrix2DAllocate<float>(num_points, 3);
+      for (k = 0; k < num_points; k++) {
+         points1[k][0] = points[k].reference[0];
+         points1[k][1] = points[k].reference[1];
+         points1[k][2] = points[k].reference[2];
+         points2[k][0] = points[k].warped[0];
+         points2[k][1] = points[k].warped[1];
+         points2[k][2] = points[k].warped[2];
+      }
+      estimate_affine_transformation3D(points1, points2, num_points, transformation);
+      //FREE MEMORY
+      reg_matrix2DDeallocate(num_points, points1);
+      reg_matrix2DDeallocate(num_points, points2);
+      return;
+   }
+   inv[1][0] = inv[0][1];
+   inv[2][0] = inv[0][2];
+   inv[2][1] = inv[1][2];
+   double cross[3][3] = {{xX, xY, xZ}, {yX, yY, yZ}, {zX, zY, zZ}};
+   double refMean[3] = {refMeanX, refMeanY, refMeanZ};
+   double warMean[3] = {warMeanX, warMeanY, warMeanZ};
+   for (int i = 0; i < 3; ++i) {
+      double translation = warMean[i];
+      for (int j = 0; j < 3; ++j) {
+         double value = (cross[i][0] * inv[0][j] + cross[i][1] * inv[1][j] + cross[i][2] * inv[2][j]) / det;
+         transformation->m[i][j] = static_cast<float>(value);
+         translation -= value * refMean[j];
+      }
+      transformation->m[i][3] = static_cast<float>(translation);
    }
-   estimate_affine_transformation3D(points1, points2, num_points, transformation);
-   //FREE MEMORY
-   reg_matrix2DDeallocate(num_points, points1);
-   reg_matrix2DDeallocate(num_points, points2);
+   transformation->m[3][0] = 0.0f;
+   transformation->m[3][1] = 0.0f;
+   transformation->m[3][2] = 0.0f;
+   transformation->m[3][3] = 1.0f;
 }
 /* *************************************************************** */
+/// @brief Order the corresponding points by increasing distance
+template<class PointTYPE>
+struct _reg_sorted_point_compare
+{
+   bool operator()(const PointTYPE &a, const PointTYPE &b) const
+   {
+      return a.distance < b.distance;
+   }
+};
+/* *************************************************************** */
 ///LTS 2D
 void optimize_2D(float* referencePosition, float* warpedPosition,
                  unsigned int activeBlockNumber, int percent_to_keep, int max_iter, double tol,
@@ -692,8 +790,9 @@ void optimize_2D(float* referencePosition, float* warpedPosition,
 
    const unsigned num_points = activeBlockNumber;
    unsigned long num_equations = num_points * 2;
-   // Keep a sorted list of the distance measure
-   std::multimap<double, _reg_sorted_point2D> queue;
+   // All the points and their current distance. The inliers are selected
+   // by partitioning them rather than by sorting them
+   std::vector<_reg_sorted_point2D> all_points;
    std::vector<_reg_sorted_point2D> top_points;
 
    double distance = 0.0;
@@ -703,47 +802,43 @@ void optimize_2D(float* referencePosition, float* warpedPosition,
    // The initial vector with all the input points
    for (unsigned j = 0; j < num_equations; j += 2)
    {
-      top_points.push_back(_reg_sorted_point2D(&referencePosition[j], &warpedPosition[j], 0.0));
+      all_points.push_back(_reg_sorted_point2D(&referencePosition[j], &warpedPosition[j], 0.0));
    }
    if (affine) {
-      estimate_affine_transformation2D(top_points, final);
+      estimate_affine_transformation2D(all_points, final);
    }
    else {
-      estimate_rigid_transformation2D(top_points, final);
+      estimate_rigid_transformation2D(all_points, final);
    }
 
    const unsigned long num_to_keep = (unsigned long)(num_points * (percent_to_keep / 100.0f));
-   float * newWarpedPosition = new float[num_points * 2];
+   _reg_sorted_point2D *pointPtr = &all_points[0];
+   int point_number = (int)num_points;
+   int j;
+   float newWarpedPosition[2];
 
    mat44 lastTransformation;
    memset(&lastTransformation, 0, sizeof(mat44));
 
    for (int count = 0; count < max_iter; ++count)
    {
-      // Transform the points in the reference
-      for (unsigned j = 0; j < num_points * 2; j += 2)
-      {
-         reg_mat33_mul(final, &referencePosition[j], &newWarpedPosition[j]);
-      }
-      queue = std::multimap<double, _reg_sorted_point2D>();
-      for (unsigned j = 0; j < num_points * 2; j += 2)
+      // Transform the points in the reference and compute their distance
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(pointPtr, point_number, final) \
+   private(j, newWarpedPosition)
+#endif
+      for (j = 0; j < point_number; ++j)
       {
-         distance = get_square_distance2D(&newWarpedPosition[j], &warpedPosition[j]);
-         queue.insert(std::pair<double, _reg_sorted_point2D>(distance,
-                                                             _reg_sorted_point2D(&referencePosition[j], &warpedPosition[j], distance)));
+         reg_mat33_mul(final, pointPtr[j].reference, newWarpedPosition);
+         pointPtr[j].distance = get_square_distance2D(newWarpedPosition, pointPtr[j].warped);
       }
+      std::nth_element(all_points.begin(), all_points.begin() + num_to_keep, all_points.end(),
+                       _reg_sorted_point_compare<_reg_sorted_point2D>());
 
       distance = 0.0;
-      i = 0;
-      top_points.clear();
-
-      for (std::multimap<double, _reg_sorted_point2D>::iterator it = queue.begin();
-           it != queue.end(); ++it, ++i)
-      {
-         if (i >= num_to_keep) break;
-         top_points.push_back((*it).second);
-         distance += (*it).first;
-      }
+      for (i = 0; i < num_to_keep; ++i)
+         distance += all_points[i].distance;
 
       // If the change is not substantial, we return
       if ((distance > lastDistance) || (lastDistance - distance) < tol)
@@ -754,6 +849,7 @@ void optimize_2D(float* referencePosition, float* warpedPosition,
       }
       lastDistance = distance;
       memcpy(&lastTransformation, final, sizeof(mat44));
+      top_points.assign(all_points.begin(), all_points.begin() + num_to_keep);
       if (affine) {
          estimate_affine_transformation2D(top_points, final);
       }
@@ -761,8 +857,6 @@ void optimize_2D(float* referencePosition, float* warpedPosition,
          estimate_rigid_transformation2D(top_points, final);
       }
    }
-   delete[] newWarpedPosition;
-
 }
 /* *************************************************************** */
 ///LTS 3D
@@ -775,8 +869,9 @@ void optimize_3D(float *referencePosition, float *warpedPosition,
 
    const unsigned num_points = activeBlockNumber;
    unsigned long num_equations = num_points * 3;
-   // Keep a sorted list of the distance measure
-   std::multimap<double, _reg_sorted_point3D> queue;
+   // All the points and their current distance. The inliers are selected
+   // by partitioning them rather than by sorting them
+   std::vector<_reg_sorted_point3D> all_points;
    std::vector<_reg_sorted_point3D> top_points;
    double distance = 0.0;
    double lastDistance = std::numeric_limits<double>::max();
@@ -784,47 +879,42 @@ void optimize_3D(float *referencePosition, float *warpedPosition,
 
    // The initial vector with all the input points
    for (unsigned j = 0; j < num_equations; j+=3) {
-      top_points.push_back(_reg_sorted_point3D(&referencePosition[j],
+      all_points.push_back(_reg_sorted_point3D(&referencePosition[j],
                                                &warpedPosition[j],
                                                0.0));
    }
    if (affine) {
-      estimate_affine_transformation3D(top_points, final);
+      estimate_affine_transformation3D(all_points, final);
    } else {
-      estimate_rigid_transformation3D(top_points, final);
+      estimate_rigid_transformation3D(all_points, final);
    }
    unsigned long num_to_keep = (unsigned long)(num_points * (percent_to_keep/100.0f));
-   float* newWarpedPosition = new float[num_points*3];
+   _reg_sorted_point3D *pointPtr = &all_points[0];
+   int point_number = (int)num_points;
+   int j;
+   float newWarpedPosition[3];
 
    mat44 lastTransformation;
    memset(&lastTransformation,0,sizeof(mat44));
 
    for (int count = 0; count < max_iter; ++count)
    {
-      // Transform the points in the reference
-      for (unsigned j = 0; j < num_points * 3; j+=3) {
-         reg_mat44_mul(final, &referencePosition[j], &newWarpedPosition[j]);
-      }
-      queue = std::multimap<double, _reg_sorted_point3D>();
-      for (unsigned j = 0; j < num_points * 3; j+= 3)
-      {
-         distance = get_square_distance3D(&newWarpedPosition[j], &warpedPosition[j]);
-         queue.insert(std::pair<double,
-                      _reg_sorted_point3D>(distance,
-                                           _reg_sorted_point3D(&referencePosition[j],
-                                                               &warpedPosition[j],
-                                                               distance)));
+      // Transform the points in the reference and compute their distance
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(pointPtr, point_number, final) \
+   private(j, newWarpedPosition)
+#endif
+      for (j = 0; j < point_number; ++j) {
+         reg_mat44_mul(final, pointPtr[j].reference, newWarpedPosition);
+         pointPtr[j].distance = get_square_distance3D(newWarpedPosition, pointPtr[j].warped);
       }
+      std::nth_element(all_points.begin(), all_points.begin() + num_to_keep, all_points.end(),
+                       _reg_sorted_point_compare<_reg_sorted_point3D>());
 
       distance = 0.0;
-      i = 0;
-      top_points.clear();
-      for (std::multimap<double, _reg_sorted_point3D>::iterator it = queue.begin();it != queue.end(); ++it, ++i)
-      {
-         if (i >= num_to_keep) break;
-         top_points.push_back((*it).second);
-         distance += (*it).first;
-      }
+      for (i = 0; i < num_to_keep; ++i)
+         distance += all_points[i].distance;
 
       // If the change is not substantial, we return
       if ((distance > lastDistance) || (lastDistance - distance) < tol)
@@ -834,13 +924,13 @@ void optimize_3D(float *referencePosition, float *warpedPosition,
       }
       lastDistance = distance;
       memcpy(&lastTransformation, final, sizeof(mat44));
+      top_points.assign(all_points.begin(), all_points.begin() + num_to_keep);
       if(affine) {
          estimate_affine_transformation3D(top_points, final);
       } else {
          estimate_rigid_transformation3D(top_points, final);
       }
    }
-   delete [] newWarpedPosition;
 }
 /* *************************************************************** */
 #endif
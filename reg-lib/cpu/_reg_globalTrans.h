@@ -95,6 +95,10 @@ void optimize_3D(float* referencePosition, float* warpedPosition,
 /* *************************************************************** */
 void estimate_affine_transformation3D(std::vector<_reg_sorted_point3D> &points, mat44* transformation);
 /* *************************************************************** */
+/// @brief Least squares affine transformation using the pseudo-inverse
+/// given by the SVD of the 3n x 12 system
+void estimate_affine_transformation3D(float** points1, float** points2, int num_points, mat44* transformation);
+/* *************************************************************** */
 void estimate_rigid_transformation3D(std::vector<_reg_sorted_point3D> &points, mat44* transformation);
 /* *************************************************************** */
 #endif
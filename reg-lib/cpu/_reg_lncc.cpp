@@ -13,6 +13,7 @@
 #define _REG_LNCC_CPP
 
 #include "_reg_lncc.h"
+#include <vector>
 
 /* *************************************************************** */
 /* *************************************************************** */
@@ -25,6 +26,7 @@ reg_lncc::reg_lncc()
    this->warpedFloatingMeanImage=NULL;
    this->warpedFloatingSdevImage=NULL;
    this->forwardMask = NULL;
+   this->forwardStatMask = NULL;
 
    this->backwardCorrelationImage=NULL;
    this->floatingMeanImage=NULL;
@@ -32,12 +34,19 @@ reg_lncc::reg_lncc()
    this->warpedReferenceMeanImage=NULL;
    this->warpedReferenceSdevImage=NULL;
    this->backwardMask = NULL;
+   this->backwardStatMask = NULL;
 
    // Gaussian kernel is used by default
    this->kernelType=GAUSSIAN_KERNEL;
 
    for(int i=0; i<255; ++i)
+   {
       kernelStandardDeviation[i]=-5.f;
+      this->forwardStatUpToDate[i]=false;
+      this->backwardStatUpToDate[i]=false;
+   }
+   this->statReuseNumber=0;
+   this->statUpdateNumber=0;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_lncc constructor called");
 #endif
@@ -46,6 +55,12 @@ reg_lncc::reg_lncc()
 /* *************************************************************** */
 reg_lncc::~reg_lncc()
 {
+#ifndef NDEBUG
+   char text[255];
+   sprintf(text, "reg_lncc - the local statistics were reused %i times and recomputed %i times",
+           this->statReuseNumber, this->statUpdateNumber);
+   reg_print_msg_debug(text);
+#endif
    if(this->forwardCorrelationImage!=NULL)
       nifti_image_free(this->forwardCorrelationImage);
    this->forwardCorrelationImage=NULL;
@@ -64,6 +79,9 @@ reg_lncc::~reg_lncc()
    if(this->forwardMask!=NULL)
       free(this->forwardMask);
    this->forwardMask=NULL;
+   if(this->forwardStatMask!=NULL)
+      free(this->forwardStatMask);
+   this->forwardStatMask=NULL;
 
    if(this->backwardCorrelationImage!=NULL)
       nifti_image_free(this->backwardCorrelationImage);
@@ -83,6 +101,177 @@ reg_lncc::~reg_lncc()
    if(this->backwardMask!=NULL)
       free(this->backwardMask);
    this->backwardMask=NULL;
+   if(this->backwardStatMask!=NULL)
+      free(this->backwardStatMask);
+   this->backwardStatMask=NULL;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class DTYPE>
+void reg_lncc::InitialiseLocalStatImages(nifti_image *refImage,
+                                         nifti_image *meanRefImage,
+                                         nifti_image *stdDevRefImage,
+                                         int *mask,
+                                         bool *upToDate,
+                                         int current_timepoint)
+{
+#ifdef _WIN32
+   long voxel;
+   long voxelNumber = (long)refImage->nx*refImage->ny*refImage->nz;
+#else
+   size_t voxel;
+   size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+#endif
+   // Only the active time points that are not up to date are computed, either
+   // all of them or the current one only
+   bool *activeTimePoint = new bool[refImage->nt];
+   bool update = false;
+   for(int t=0; t<refImage->nt; ++t)
+   {
+      activeTimePoint[t] = this->timePointWeight[t]>0.0 && !upToDate[t] &&
+            (current_timepoint<0 || t==current_timepoint);
+      update |= activeTimePoint[t];
+   }
+   if(!update)
+   {
+      delete []activeTimePoint;
+      ++this->statReuseNumber;
+      return;
+   }
+   ++this->statUpdateNumber;
+
+   DTYPE *origRefPtr = static_cast<DTYPE *>(refImage->data);
+   DTYPE *meanRefPtr = static_cast<DTYPE *>(meanRefImage->data);
+   DTYPE *sdevRefPtr = static_cast<DTYPE *>(stdDevRefImage->data);
+   for(int t=0; t<refImage->nt; ++t)
+   {
+      if(!activeTimePoint[t]) continue;
+      memcpy(&meanRefPtr[t*voxelNumber], &origRefPtr[t*voxelNumber],
+             voxelNumber*refImage->nbyper);
+      DTYPE *currentRefPtr = &origRefPtr[t*voxelNumber];
+      DTYPE *currentSdevPtr = &sdevRefPtr[t*voxelNumber];
+      for(voxel=0; voxel<voxelNumber; ++voxel)
+         currentSdevPtr[voxel] = currentRefPtr[voxel] * currentRefPtr[voxel];
+   }
+   reg_tools_kernelConvolution(meanRefImage, this->kernelStandardDeviation,
+                               this->kernelType, mask, activeTimePoint);
+   reg_tools_kernelConvolution(stdDevRefImage, this->kernelStandardDeviation,
+                               this->kernelType, mask, activeTimePoint);
+   for(int t=0; t<refImage->nt; ++t)
+   {
+      if(!activeTimePoint[t]) continue;
+      DTYPE *currentMeanPtr = &meanRefPtr[t*voxelNumber];
+      DTYPE *currentSdevPtr = &sdevRefPtr[t*voxelNumber];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(voxelNumber, currentSdevPtr, currentMeanPtr) \
+   private(voxel)
+#endif
+      for(voxel=0; voxel<voxelNumber; ++voxel)
+      {
+         // G*(I^2) - (G*I)^2
+         currentSdevPtr[voxel] = sqrt(currentSdevPtr[voxel] - reg_pow2(currentMeanPtr[voxel]));
+         // Stabilise the computation
+         if(currentSdevPtr[voxel]<1.e-06) currentSdevPtr[voxel]=static_cast<DTYPE>(0);
+      }
+      upToDate[t] = true;
+   }
+   delete []activeTimePoint;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+/** The NaN voxels of the mask are given the mean of their defined 6-neighbours,
+ * from the closest voxels to the defined region to the furthest ones. The
+ * voxels that can not be reached are set to zero.
+ */
+template <class DTYPE>
+void reg_lncc_extrapolateNaN(DTYPE *imagePtr,
+                             int *mask,
+                             const int *dim)
+{
+   const size_t voxelNumber = (size_t)dim[0]*dim[1]*dim[2];
+   const size_t offset[3] = {1, (size_t)dim[0], (size_t)dim[0]*dim[1]};
+   // 0: defined, 1: to be filled, 2: to be filled and queued, 3: ignored
+   std::vector<unsigned char> state(voxelNumber);
+   std::vector<size_t> front, next;
+   for(size_t i=0; i<voxelNumber; ++i)
+   {
+      if(imagePtr[i]==imagePtr[i]) state[i]=0;
+      else if(mask[i]>-1) state[i]=1;
+      else state[i]=3;
+   }
+   // The first front contains the voxels to fill next to a defined voxel
+   int position[3];
+   for(size_t i=0; i<voxelNumber; ++i)
+   {
+      if(state[i]!=1) continue;
+      position[0]=i%dim[0];
+      position[1]=(i/dim[0])%dim[1];
+      position[2]=i/offset[2];
+      for(int n=0; n<3 && state[i]==1; ++n)
+      {
+         if(position[n]>0 && state[i-offset[n]]==0) state[i]=2;
+         if(position[n]<dim[n]-1 && state[i+offset[n]]==0) state[i]=2;
+      }
+      if(state[i]==2) front.push_back(i);
+   }
+   std::vector<DTYPE> values;
+   while(!front.empty())
+   {
+      values.resize(front.size());
+      for(size_t f=0; f<front.size(); ++f)
+      {
+         size_t i=front[f];
+         position[0]=i%dim[0];
+         position[1]=(i/dim[0])%dim[1];
+         position[2]=i/offset[2];
+         double sum=0.;
+         int number=0;
+         for(int n=0; n<3; ++n)
+         {
+            if(position[n]>0 && state[i-offset[n]]==0)
+            {
+               sum += imagePtr[i-offset[n]];
+               ++number;
+            }
+            if(position[n]<dim[n]-1 && state[i+offset[n]]==0)
+            {
+               sum += imagePtr[i+offset[n]];
+               ++number;
+            }
+         }
+         values[f]=static_cast<DTYPE>(sum/number);
+      }
+      next.clear();
+      for(size_t f=0; f<front.size(); ++f)
+      {
+         imagePtr[front[f]]=values[f];
+         state[front[f]]=0;
+      }
+      for(size_t f=0; f<front.size(); ++f)
+      {
+         size_t i=front[f];
+         position[0]=i%dim[0];
+         position[1]=(i/dim[0])%dim[1];
+         position[2]=i/offset[2];
+         for(int n=0; n<3; ++n)
+         {
+            if(position[n]>0 && state[i-offset[n]]==1)
+            {
+               state[i-offset[n]]=2;
+               next.push_back(i-offset[n]);
+            }
+            if(position[n]<dim[n]-1 && state[i+offset[n]]==1)
+            {
+               state[i+offset[n]]=2;
+               next.push_back(i+offset[n]);
+            }
+         }
+      }
+      front.swap(next);
+   }
+   for(size_t i=0; i<voxelNumber; ++i)
+      if(state[i]==1) imagePtr[i]=static_cast<DTYPE>(0);
 }
 /* *************************************************************** */
 /* *************************************************************** */
@@ -93,11 +282,12 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
                                      nifti_image *meanWarImage,
                                      nifti_image *stdDevRefImage,
                                      nifti_image *stdDevWarImage,
-                                     int *refMask,
+                                     nifti_image *correlationImage,
+                                     int *statMask,
                                      int *combinedMask,
+                                     bool *upToDate,
                                      int current_timepoint)
 {
-   // Generate the foward mask to ignore all NaN values
 #ifdef _WIN32
    long voxel;
    long voxelNumber = (long)refImage->nx*refImage->ny*refImage->nz;
@@ -105,49 +295,74 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
    size_t voxel;
    size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
 #endif
-   memcpy(combinedMask, refMask, voxelNumber*sizeof(int));
-   reg_tools_removeNanFromMask(refImage, combinedMask);
+   // Generate the foward mask to ignore all NaN values
+   memcpy(combinedMask, statMask, voxelNumber*sizeof(int));
    reg_tools_removeNanFromMask(warImage, combinedMask);
 
-   DTYPE *origRefPtr = static_cast<DTYPE *>(refImage->data);
-   DTYPE *meanRefPtr = static_cast<DTYPE *>(meanRefImage->data);
-   DTYPE *sdevRefPtr = static_cast<DTYPE *>(stdDevRefImage->data);
-   memcpy(meanRefPtr, &origRefPtr[current_timepoint*voxelNumber],
-         voxelNumber*refImage->nbyper);
-   memcpy(sdevRefPtr, &origRefPtr[current_timepoint*voxelNumber],
-         voxelNumber*refImage->nbyper);
-
-   reg_tools_multiplyImageToImage(stdDevRefImage, stdDevRefImage, stdDevRefImage);
-   reg_tools_kernelConvolution(meanRefImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
-   reg_tools_kernelConvolution(stdDevRefImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
+   // The reference statistics only depend on the reference image and its
+   // mask. They are computed once per level and reused afterwards
+   this->InitialiseLocalStatImages<DTYPE>(refImage,
+                                          meanRefImage,
+                                          stdDevRefImage,
+                                          statMask,
+                                          upToDate,
+                                          current_timepoint);
 
+   // The warped statistics are computed over the same support as the
+   // reference ones. The NaN voxels of the warped image, outside of the
+   // floating field of view, are extrapolated from their neighbours and the
+   // combined mask is only applied once the local statistics are known
+   DTYPE *origRefPtr = static_cast<DTYPE *>(refImage->data);
+   DTYPE *currentRefPtr = &origRefPtr[current_timepoint*voxelNumber];
    DTYPE *origWarPtr = static_cast<DTYPE *>(warImage->data);
    DTYPE *meanWarPtr = static_cast<DTYPE *>(meanWarImage->data);
    DTYPE *sdevWarPtr = static_cast<DTYPE *>(stdDevWarImage->data);
+   DTYPE *correlaPtr = static_cast<DTYPE *>(correlationImage->data);
    memcpy(meanWarPtr, &origWarPtr[current_timepoint*voxelNumber],
-         voxelNumber*warImage->nbyper);
-   memcpy(sdevWarPtr, &origWarPtr[current_timepoint*voxelNumber],
-         voxelNumber*warImage->nbyper);
-
-   reg_tools_multiplyImageToImage(stdDevWarImage, stdDevWarImage, stdDevWarImage);
-   reg_tools_kernelConvolution(meanWarImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
-   reg_tools_kernelConvolution(stdDevWarImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
+          voxelNumber*warImage->nbyper);
+   int imageDim[3]= {refImage->nx, refImage->ny, refImage->nz};
+   reg_lncc_extrapolateNaN<DTYPE>(meanWarPtr, statMask, imageDim);
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(voxelNumber, statMask, currentRefPtr, meanWarPtr, sdevWarPtr, correlaPtr) \
+   private(voxel)
+#endif
+   for(voxel=0; voxel<voxelNumber; ++voxel)
+   {
+      if(statMask[voxel]>-1)
+      {
+         sdevWarPtr[voxel] = meanWarPtr[voxel] * meanWarPtr[voxel];
+         correlaPtr[voxel] = currentRefPtr[voxel] * meanWarPtr[voxel];
+      }
+      else meanWarPtr[voxel]=sdevWarPtr[voxel]=correlaPtr[voxel]=static_cast<DTYPE>(0);
+   }
+   if(this->kernelType==MEAN_KERNEL)
+   {
+      // The three box filters share the same normalisation
+      nifti_image *statImages[3]= {meanWarImage, stdDevWarImage, correlationImage};
+      reg_tools_meanFilter(statImages, 3,
+                           this->kernelStandardDeviation[current_timepoint],
+                           statMask);
+   }
+   else
+   {
+      reg_tools_kernelConvolution(meanWarImage, &this->kernelStandardDeviation[current_timepoint],
+                                  this->kernelType, statMask);
+      reg_tools_kernelConvolution(stdDevWarImage, &this->kernelStandardDeviation[current_timepoint],
+                                  this->kernelType, statMask);
+      reg_tools_kernelConvolution(correlationImage, &this->kernelStandardDeviation[current_timepoint],
+                                  this->kernelType, statMask);
+   }
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(voxelNumber, sdevRefPtr, meanRefPtr, sdevWarPtr, meanWarPtr) \
+   shared(voxelNumber, sdevWarPtr, meanWarPtr) \
    private(voxel)
 #endif
    for(voxel=0; voxel<voxelNumber; ++voxel)
    {
       // G*(I^2) - (G*I)^2
-      sdevRefPtr[voxel] = sqrt(sdevRefPtr[voxel] - reg_pow2(meanRefPtr[voxel]));
       sdevWarPtr[voxel] = sqrt(sdevWarPtr[voxel] - reg_pow2(meanWarPtr[voxel]));
       // Stabilise the computation
-      if(sdevRefPtr[voxel]<1.e-06) sdevRefPtr[voxel]=static_cast<DTYPE>(0);
       if(sdevWarPtr[voxel]<1.e-06) sdevWarPtr[voxel]=static_cast<DTYPE>(0);
    }
 }
@@ -226,9 +441,15 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
    if(this->forwardMask!=NULL)
       free(this->forwardMask);
    this->forwardMask=NULL;
+   if(this->forwardStatMask!=NULL)
+      free(this->forwardStatMask);
+   this->forwardStatMask=NULL;
    if(this->backwardMask!=NULL)
       free(this->backwardMask);
    this->backwardMask=NULL;
+   if(this->backwardStatMask!=NULL)
+      free(this->backwardStatMask);
+   this->backwardStatMask=NULL;
 
    //
    size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
@@ -243,11 +464,12 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
                                                       this->forwardCorrelationImage->nbyper);
 
    // Allocate the required images to store mean and stdev of the reference image
-   this->referenceMeanImage=nifti_copy_nim_info(this->forwardCorrelationImage);
+   // for every time point
+   this->referenceMeanImage=nifti_copy_nim_info(this->referenceImagePointer);
    this->referenceMeanImage->data=(void *)malloc(this->referenceMeanImage->nvox *
                                                  this->referenceMeanImage->nbyper);
 
-   this->referenceSdevImage=nifti_copy_nim_info(this->forwardCorrelationImage);
+   this->referenceSdevImage=nifti_copy_nim_info(this->referenceImagePointer);
    this->referenceSdevImage->data=(void *)malloc(this->referenceSdevImage->nvox *
                                                  this->referenceSdevImage->nbyper);
 
@@ -275,11 +497,12 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
                                                           this->backwardCorrelationImage->nbyper);
 
       // Allocate the required images to store mean and stdev of the floating image
-      this->floatingMeanImage=nifti_copy_nim_info(this->backwardCorrelationImage);
+      // for every time point
+      this->floatingMeanImage=nifti_copy_nim_info(this->floatingImagePointer);
       this->floatingMeanImage->data=(void *)malloc(this->floatingMeanImage->nvox *
                                                    this->floatingMeanImage->nbyper);
 
-      this->floatingSdevImage=nifti_copy_nim_info(this->backwardCorrelationImage);
+      this->floatingSdevImage=nifti_copy_nim_info(this->floatingImagePointer);
       this->floatingSdevImage->data=(void *)malloc(this->floatingSdevImage->nvox *
                                                    this->floatingSdevImage->nbyper);
 
@@ -295,6 +518,65 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
       // Allocate the array to store the mask of the backward image
       this->backwardMask=(int *)malloc(voxelNumber*sizeof(int));
    }
+
+   // Compute the local statistics of the reference and floating images for
+   // the current level, over their masks without the NaN voxels. They are
+   // reused by every evaluation of the measure at this level
+   voxelNumber = (size_t)this->referenceImagePointer->nx *
+         this->referenceImagePointer->ny * this->referenceImagePointer->nz;
+   this->forwardStatMask=(int *)malloc(voxelNumber*sizeof(int));
+   memcpy(this->forwardStatMask, this->referenceMaskPointer, voxelNumber*sizeof(int));
+   reg_tools_removeNanFromMask(this->referenceImagePointer, this->forwardStatMask);
+   for(int t=0; t<this->referenceImagePointer->nt; ++t)
+      this->forwardStatUpToDate[t]=false;
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      this->InitialiseLocalStatImages<float>(this->referenceImagePointer,
+                                             this->referenceMeanImage,
+                                             this->referenceSdevImage,
+                                             this->forwardStatMask,
+                                             this->forwardStatUpToDate,
+                                             -1);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      this->InitialiseLocalStatImages<double>(this->referenceImagePointer,
+                                              this->referenceMeanImage,
+                                              this->referenceSdevImage,
+                                              this->forwardStatMask,
+                                              this->forwardStatUpToDate,
+                                              -1);
+      break;
+   }
+   if(this->isSymmetric)
+   {
+      voxelNumber = (size_t)this->floatingImagePointer->nx *
+            this->floatingImagePointer->ny * this->floatingImagePointer->nz;
+      this->backwardStatMask=(int *)malloc(voxelNumber*sizeof(int));
+      memcpy(this->backwardStatMask, this->floatingMaskPointer, voxelNumber*sizeof(int));
+      reg_tools_removeNanFromMask(this->floatingImagePointer, this->backwardStatMask);
+      for(int t=0; t<this->floatingImagePointer->nt; ++t)
+         this->backwardStatUpToDate[t]=false;
+      switch(this->floatingImagePointer->datatype)
+      {
+      case NIFTI_TYPE_FLOAT32:
+         this->InitialiseLocalStatImages<float>(this->floatingImagePointer,
+                                                this->floatingMeanImage,
+                                                this->floatingSdevImage,
+                                                this->backwardStatMask,
+                                                this->backwardStatUpToDate,
+                                                -1);
+         break;
+      case NIFTI_TYPE_FLOAT64:
+         this->InitialiseLocalStatImages<double>(this->floatingImagePointer,
+                                                 this->floatingMeanImage,
+                                                 this->floatingSdevImage,
+                                                 this->backwardStatMask,
+                                                 this->backwardStatUpToDate,
+                                                 -1);
+         break;
+      }
+   }
 #ifndef NDEBUG
    char text[255];
    reg_print_msg_debug("reg_lncc::InitialiseMeasure().");
@@ -308,46 +590,33 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
 /* *************************************************************** */
 /* *************************************************************** */
 template<class DTYPE>
-double reg_getLNCCValue(nifti_image *referenceImage,
-                        nifti_image *referenceMeanImage,
+double reg_getLNCCValue(nifti_image *referenceMeanImage,
                         nifti_image *referenceSdevImage,
-                        nifti_image *warpedImage,
                         nifti_image *warpedMeanImage,
                         nifti_image *warpedSdevImage,
-                        int *combinedMask,
-                        float *kernelStandardDeviation,
                         nifti_image *correlationImage,
-                        int kernelType,
+                        int *combinedMask,
                         int current_timepoint)
 {
 #ifdef _WIN32
    long voxel;
-   long voxelNumber=(long)referenceImage->nx*
-         referenceImage->ny*referenceImage->nz;
+   long voxelNumber=(long)referenceMeanImage->nx*
+         referenceMeanImage->ny*referenceMeanImage->nz;
 #else
    size_t voxel;
-   size_t voxelNumber=(size_t)referenceImage->nx*
-         referenceImage->ny*referenceImage->nz;
+   size_t voxelNumber=(size_t)referenceMeanImage->nx*
+         referenceMeanImage->ny*referenceMeanImage->nz;
 #endif
 
-   // Compute the local correlation
-   DTYPE *refImagePtr=static_cast<DTYPE *>(referenceImage->data);
-   DTYPE *currentRefPtr = &refImagePtr[current_timepoint*voxelNumber];
-
-   DTYPE *warImagePtr=static_cast<DTYPE *>(warpedImage->data);
-   DTYPE *currentWarPtr = &warImagePtr[current_timepoint*voxelNumber];
-
+   // The reference statistics are stored for every time point
    DTYPE *refMeanPtr=static_cast<DTYPE *>(referenceMeanImage->data);
+   refMeanPtr = &refMeanPtr[current_timepoint*voxelNumber];
    DTYPE *warMeanPtr=static_cast<DTYPE *>(warpedMeanImage->data);
    DTYPE *refSdevPtr=static_cast<DTYPE *>(referenceSdevImage->data);
+   refSdevPtr = &refSdevPtr[current_timepoint*voxelNumber];
    DTYPE *warSdevPtr=static_cast<DTYPE *>(warpedSdevImage->data);
    DTYPE *correlaPtr=static_cast<DTYPE *>(correlationImage->data);
 
-   for(size_t i=0; i<voxelNumber; ++i)
-      correlaPtr[i] = currentRefPtr[i] * currentWarPtr[i];
-
-   reg_tools_kernelConvolution(correlationImage, kernelStandardDeviation, kernelType, combinedMask);
-
    double lncc_value_sum  = 0., lncc_value;
    double activeVoxel_num = 0.;
 
@@ -401,8 +670,10 @@ double reg_lncc::GetSimilarityMeasureValue()
                this->warpedFloatingMeanImage,
                this->referenceSdevImage,
                this->warpedFloatingSdevImage,
-               this->referenceMaskPointer,
+               this->forwardCorrelationImage,
+               this->forwardStatMask,
                this->forwardMask,
+               this->forwardStatUpToDate,
                current_timepoint);
             break;
          case NIFTI_TYPE_FLOAT64:
@@ -412,8 +683,10 @@ double reg_lncc::GetSimilarityMeasureValue()
                this->warpedFloatingMeanImage,
                this->referenceSdevImage,
                this->warpedFloatingSdevImage,
-               this->referenceMaskPointer,
+               this->forwardCorrelationImage,
+               this->forwardStatMask,
                this->forwardMask,
+               this->forwardStatUpToDate,
                current_timepoint);
             break;
          }
@@ -422,29 +695,21 @@ double reg_lncc::GetSimilarityMeasureValue()
 			switch (this->referenceImagePointer->datatype)
 			{
 			case NIFTI_TYPE_FLOAT32:
-				tp_value += reg_getLNCCValue<float>(this->referenceImagePointer,
-					this->referenceMeanImage,
+				tp_value += reg_getLNCCValue<float>(this->referenceMeanImage,
 					this->referenceSdevImage,
-					this->warpedFloatingImagePointer,
 					this->warpedFloatingMeanImage,
 					this->warpedFloatingSdevImage,
-					this->forwardMask,
-					this->kernelStandardDeviation,
 					this->forwardCorrelationImage,
-					this->kernelType,
+					this->forwardMask,
 					current_timepoint);
 				break;
 			case NIFTI_TYPE_FLOAT64:
-				tp_value += reg_getLNCCValue<double>(this->referenceImagePointer,
-					this->referenceMeanImage,
+				tp_value += reg_getLNCCValue<double>(this->referenceMeanImage,
 					this->referenceSdevImage,
-					this->warpedFloatingImagePointer,
 					this->warpedFloatingMeanImage,
 					this->warpedFloatingSdevImage,
-					this->forwardMask,
-					this->kernelStandardDeviation,
 					this->forwardCorrelationImage,
-					this->kernelType,
+					this->forwardMask,
 					current_timepoint);
 				break;
 			}
@@ -460,8 +725,10 @@ double reg_lncc::GetSimilarityMeasureValue()
 						this->warpedReferenceMeanImage,
 						this->floatingSdevImage,
 						this->warpedReferenceSdevImage,
-						this->floatingMaskPointer,
+						this->backwardCorrelationImage,
+						this->backwardStatMask,
 						this->backwardMask,
+						this->backwardStatUpToDate,
 						current_timepoint);
 					break;
 				case NIFTI_TYPE_FLOAT64:
@@ -471,8 +738,10 @@ double reg_lncc::GetSimilarityMeasureValue()
 						this->warpedReferenceMeanImage,
 						this->floatingSdevImage,
 						this->warpedReferenceSdevImage,
-						this->floatingMaskPointer,
+						this->backwardCorrelationImage,
+						this->backwardStatMask,
 						this->backwardMask,
+						this->backwardStatUpToDate,
 						current_timepoint);
 					break;
 				}
@@ -480,29 +749,21 @@ double reg_lncc::GetSimilarityMeasureValue()
 				switch (this->floatingImagePointer->datatype)
 				{
 				case NIFTI_TYPE_FLOAT32:
-					tp_value += reg_getLNCCValue<float>(this->floatingImagePointer,
-						this->floatingMeanImage,
+					tp_value += reg_getLNCCValue<float>(this->floatingMeanImage,
 						this->floatingSdevImage,
-						this->warpedReferenceImagePointer,
 						this->warpedReferenceMeanImage,
 						this->warpedReferenceSdevImage,
-						this->backwardMask,
-						this->kernelStandardDeviation,
 						this->backwardCorrelationImage,
-						this->kernelType,
+						this->backwardMask,
 						current_timepoint);
 					break;
 				case NIFTI_TYPE_FLOAT64:
-					tp_value += reg_getLNCCValue<double>(this->floatingImagePointer,
-						this->floatingMeanImage,
+					tp_value += reg_getLNCCValue<double>(this->floatingMeanImage,
 						this->floatingSdevImage,
-						this->warpedReferenceImagePointer,
 						this->warpedReferenceMeanImage,
 						this->warpedReferenceSdevImage,
-						this->backwardMask,
-						this->kernelStandardDeviation,
 						this->backwardCorrelationImage,
-						this->kernelType,
+						this->backwardMask,
 						current_timepoint);
 					break;
 				}
@@ -521,6 +782,7 @@ void reg_getVoxelBasedLNCCGradient(nifti_image *referenceImage,
                                    nifti_image *warpedImage,
                                    nifti_image *warpedMeanImage,
                                    nifti_image *warpedSdevImage,
+                                   int *statMask,
                                    int *combinedMask,
                                    float *kernelStandardDeviation,
                                    nifti_image *correlationImage,
@@ -540,24 +802,22 @@ void reg_getVoxelBasedLNCCGradient(nifti_image *referenceImage,
          referenceImage->ny*referenceImage->nz;
 #endif
 
-   // Compute the local correlation
    DTYPE *refImagePtr=static_cast<DTYPE *>(referenceImage->data);
    DTYPE *currentRefPtr = &refImagePtr[current_timepoint*voxelNumber];
 
    DTYPE *warImagePtr=static_cast<DTYPE *>(warpedImage->data);
    DTYPE *currentWarPtr = &warImagePtr[current_timepoint*voxelNumber];
 
+   // The reference statistics are stored for every time point
    DTYPE *refMeanPtr=static_cast<DTYPE *>(referenceMeanImage->data);
+   refMeanPtr = &refMeanPtr[current_timepoint*voxelNumber];
    DTYPE *warMeanPtr=static_cast<DTYPE *>(warpedMeanImage->data);
    DTYPE *refSdevPtr=static_cast<DTYPE *>(referenceSdevImage->data);
+   refSdevPtr = &refSdevPtr[current_timepoint*voxelNumber];
    DTYPE *warSdevPtr=static_cast<DTYPE *>(warpedSdevImage->data);
+   // The local correlation is smoothed with the other local statistics
    DTYPE *correlaPtr=static_cast<DTYPE *>(correlationImage->data);
 
-   for(size_t i=0; i<voxelNumber; ++i)
-      correlaPtr[i] = currentRefPtr[i] * currentWarPtr[i];
-
-   reg_tools_kernelConvolution(correlationImage, kernelStandardDeviation, kernelType, combinedMask);
-
    double refMeanValue, warMeanValue, refSdevValue,
          warSdevValue, correlaValue;
    double temp1, temp2, temp3;
@@ -616,9 +876,18 @@ void reg_getVoxelBasedLNCCGradient(nifti_image *referenceImage,
    double adjusted_weight = timepoint_weight / activeVoxel_num;
 
    // Smooth the newly computed values
-   reg_tools_kernelConvolution(warpedMeanImage, kernelStandardDeviation, kernelType, combinedMask);
-   reg_tools_kernelConvolution(warpedSdevImage, kernelStandardDeviation, kernelType, combinedMask);
-   reg_tools_kernelConvolution(correlationImage, kernelStandardDeviation, kernelType, combinedMask);
+   if(kernelType==MEAN_KERNEL)
+   {
+      // The three box filters share the same normalisation
+      nifti_image *smoothedImages[3]= {warpedMeanImage, warpedSdevImage, correlationImage};
+      reg_tools_meanFilter(smoothedImages, 3, kernelStandardDeviation[0], statMask);
+   }
+   else
+   {
+      reg_tools_kernelConvolution(warpedMeanImage, kernelStandardDeviation, kernelType, statMask);
+      reg_tools_kernelConvolution(warpedSdevImage, kernelStandardDeviation, kernelType, statMask);
+      reg_tools_kernelConvolution(correlationImage, kernelStandardDeviation, kernelType, statMask);
+   }
    DTYPE *measureGradPtrX = static_cast<DTYPE *>(measureGradientImage->data);
    DTYPE *measureGradPtrY = &measureGradPtrX[voxelNumber];
    DTYPE *measureGradPtrZ = NULL;
@@ -694,8 +963,10 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                          this->warpedFloatingMeanImage,
                                          this->referenceSdevImage,
                                          this->warpedFloatingSdevImage,
-                                         this->referenceMaskPointer,
+                                         this->forwardCorrelationImage,
+                                         this->forwardStatMask,
                                          this->forwardMask,
+                                         this->forwardStatUpToDate,
                                          current_timepoint);
       break;
    case NIFTI_TYPE_FLOAT64:
@@ -705,8 +976,10 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                           this->warpedFloatingMeanImage,
                                           this->referenceSdevImage,
                                           this->warpedFloatingSdevImage,
-                                          this->referenceMaskPointer,
+                                          this->forwardCorrelationImage,
+                                          this->forwardStatMask,
                                           this->forwardMask,
+                                          this->forwardStatUpToDate,
                                           current_timepoint);
       break;
    }
@@ -721,8 +994,9 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                            this->warpedFloatingImagePointer,
                                            this->warpedFloatingMeanImage,
                                            this->warpedFloatingSdevImage,
+                                           this->forwardStatMask,
                                            this->forwardMask,
-                                           this->kernelStandardDeviation,
+                                           &this->kernelStandardDeviation[current_timepoint],
                                            this->forwardCorrelationImage,
                                            this->warpedFloatingGradientImagePointer,
                                            this->forwardVoxelBasedGradientImagePointer,
@@ -737,8 +1011,9 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                             this->warpedFloatingImagePointer,
                                             this->warpedFloatingMeanImage,
                                             this->warpedFloatingSdevImage,
+                                            this->forwardStatMask,
                                             this->forwardMask,
-                                            this->kernelStandardDeviation,
+                                            &this->kernelStandardDeviation[current_timepoint],
                                             this->forwardCorrelationImage,
                                             this->warpedFloatingGradientImagePointer,
                                             this->forwardVoxelBasedGradientImagePointer,
@@ -759,8 +1034,10 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                             this->warpedReferenceMeanImage,
                                             this->floatingSdevImage,
                                             this->warpedReferenceSdevImage,
-                                            this->floatingMaskPointer,
+                                            this->backwardCorrelationImage,
+                                            this->backwardStatMask,
                                             this->backwardMask,
+                                            this->backwardStatUpToDate,
                                             current_timepoint);
          break;
       case NIFTI_TYPE_FLOAT64:
@@ -770,8 +1047,10 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                              this->warpedReferenceMeanImage,
                                              this->floatingSdevImage,
                                              this->warpedReferenceSdevImage,
-                                             this->floatingMaskPointer,
+                                             this->backwardCorrelationImage,
+                                             this->backwardStatMask,
                                              this->backwardMask,
+                                             this->backwardStatUpToDate,
                                              current_timepoint);
          break;
       }
@@ -785,8 +1064,9 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                               this->warpedReferenceImagePointer,
                                               this->warpedReferenceMeanImage,
                                               this->warpedReferenceSdevImage,
+                                              this->backwardStatMask,
                                               this->backwardMask,
-                                              this->kernelStandardDeviation,
+                                              &this->kernelStandardDeviation[current_timepoint],
                                               this->backwardCorrelationImage,
                                               this->warpedReferenceGradientImagePointer,
                                               this->backwardVoxelBasedGradientImagePointer,
@@ -801,8 +1081,9 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                                this->warpedReferenceImagePointer,
                                                this->warpedReferenceMeanImage,
                                                this->warpedReferenceSdevImage,
+                                               this->backwardStatMask,
                                                this->backwardMask,
-                                               this->kernelStandardDeviation,
+                                               &this->kernelStandardDeviation[current_timepoint],
                                                this->backwardCorrelationImage,
                                                this->warpedReferenceGradientImagePointer,
                                                this->backwardVoxelBasedGradientImagePointer,
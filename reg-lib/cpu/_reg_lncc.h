@@ -57,6 +57,7 @@ protected:
    nifti_image *warpedFloatingMeanImage;
    nifti_image *warpedFloatingSdevImage;
    int *forwardMask;
+   int *forwardStatMask;
 
    nifti_image *backwardCorrelationImage;
    nifti_image *floatingMeanImage;
@@ -64,9 +65,25 @@ protected:
    nifti_image *warpedReferenceMeanImage;
    nifti_image *warpedReferenceSdevImage;
    int *backwardMask;
+   int *backwardStatMask;
 
    int kernelType;
 
+   // Time points whose reference and floating statistics are computed for
+   // the current level, over the stat masks
+   bool forwardStatUpToDate[255];
+   bool backwardStatUpToDate[255];
+   // Number of times the statistics have been reused or recomputed
+   int statReuseNumber;
+   int statUpdateNumber;
+
+   template <class DTYPE>
+   void InitialiseLocalStatImages(nifti_image *refImage,
+                                  nifti_image *meanRefImage,
+                                  nifti_image *stdDevRefImage,
+                                  int *mask,
+                                  bool *upToDate,
+                                  int current_timepoint);
    template <class DTYPE>
    void UpdateLocalStatImages(nifti_image *refImage,
                               nifti_image *warImage,
@@ -74,32 +91,36 @@ protected:
                               nifti_image *meanWarImage,
                               nifti_image *stdDevRefImage,
                               nifti_image *stdDevWarImage,
-                              int *refMask,
-                              int *mask,
+                              nifti_image *correlationImage,
+                              int *statMask,
+                              int *combinedMask,
+                              bool *upToDate,
                               int current_timepoint);
 };
 /* *************************************************************** */
 /* *************************************************************** */
-/** @brief Copmutes and returns the LNCC between two input image
- * @param referenceImage First input image to use to compute the metric
- * @param warpedImage Second input image to use to compute the metric
- * @param gaussianStandardDeviation Standard deviation of the Gaussian kernel
- * to use.
- * @param mask Array that contains a mask to specify which voxel
- * should be considered. If set to NULL, all voxels are considered
+/** @brief Copmutes and returns the LNCC between two input image from
+ * their local statistics
+ * @param referenceMeanImage Local mean of the reference image, for every
+ * time point
+ * @param referenceStdDevImage Local standard deviation of the reference
+ * image, for every time point
+ * @param warpedMeanImage Local mean of the warped image
+ * @param warpedStdDevImage Local standard deviation of the warped image
+ * @param correlationImage Local mean of the product of both images
+ * @param combinedMask Mask of the reference image without the NaN voxels
+ * of both images. Only its voxels contribute to the LNCC
+ * @param current_timepoint Time point of the reference statistics to use
  * @return Returns the computed LNCC
  */
 extern "C++" template<class DTYPE>
-double reg_getLNCCValue(nifti_image *referenceImage,
-                        nifti_image *referenceMeanImage,
+double reg_getLNCCValue(nifti_image *referenceMeanImage,
                         nifti_image *referenceStdDevImage,
-                        nifti_image *warpedImage,
                         nifti_image *warpedMeanImage,
                         nifti_image *warpedStdDevImage,
-                        int *combinedMask,
-                        float *kernelStdDev,
                         nifti_image *correlationImage,
-                        int kernelType);
+                        int *combinedMask,
+                        int current_timepoint);
 
 /* *************************************************************** */
 /** @brief Compute a voxel based gradient of the LNCC.
@@ -110,8 +131,12 @@ double reg_getLNCCValue(nifti_image *referenceImage,
  *  value of the LNCC gradient
  *  @param gaussianStandardDeviation Standard deviation of the Gaussian kernel
  *  to use.
- *  @param mask Array that contains a mask to specify which voxel
- *  should be considered. If set to NULL, all voxels are considered
+ *  @param statMask Mask of the reference image, without its NaN voxels,
+ *  over which the local statistics are computed
+ *  @param combinedMask Stat mask without the NaN voxels of the warped image.
+ *  Only its voxels contribute to the LNCC
+ *  @param correlationImage Local mean of the product of both images. It is
+ *  used as workspace and its content is overwritten
  */
 extern "C++" template <class DTYPE>
 void reg_getVoxelBasedLNCCGradient(nifti_image *referenceImage,
@@ -120,6 +145,7 @@ void reg_getVoxelBasedLNCCGradient(nifti_image *referenceImage,
                                    nifti_image *warpedImage,
                                    nifti_image *warpedMeanImage,
                                    nifti_image *warpedStdDevImage,
+                                   int *statMask,
                                    int *combinedMask,
                                    float *kernelStdDev,
                                    nifti_image *correlationImage,
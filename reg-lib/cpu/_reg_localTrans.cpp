@@ -12,6 +12,7 @@
 #include <cmath>
 #include "_reg_localTrans.h"
 #include "_reg_maths_eigen.h"
+#include "_reg_timer.h"
 
 /* *************************************************************** */
 /* *************************************************************** */
@@ -919,13 +920,210 @@ void reg_cubic_spline_getDeformationField2D(nifti_image *splineControlPoint,
    return;
 }
 /* *************************************************************** */
+/** Compute, for every voxel along one axis, the index of the first control
+ * point of its cell and the four basis values. The voxel ranges covered by
+ * the successive cells are returned through cellStart, which contains
+ * cellNumber+1 entries.
+ */
+template<class DTYPE>
+int reg_cubic_spline_getAxisBasis(int voxelNumber,
+                                  DTYPE gridVoxelSpacing,
+                                  bool bspline,
+                                  int *pre,
+                                  DTYPE *basisValues,
+                                  int *cellStart)
+{
+   int cellNumber=0;
+   for(int v=0; v<voxelNumber; ++v)
+   {
+      pre[v]=static_cast<int>(static_cast<DTYPE>(v)/gridVoxelSpacing);
+      DTYPE basis=static_cast<DTYPE>(v)/gridVoxelSpacing-static_cast<DTYPE>(pre[v]);
+      if(basis<0.0) basis=0.0; //rounding error
+      if(bspline) get_BSplineBasisValues<DTYPE>(basis, &basisValues[4*v]);
+      else get_SplineBasisValues<DTYPE>(basis, &basisValues[4*v]);
+      if(v==0 || pre[v]!=pre[v-1])
+         cellStart[cellNumber++]=v;
+   }
+   cellStart[cellNumber]=voxelNumber;
+   return cellNumber;
+}
+/* *************************************************************** */
+/** Compute a dense deformation field from a cubic spline parametrisation
+ * one control point cell at a time. The 4x4x4 control points of a cell are
+ * read once and the field is evaluated for all the voxels of the cell using
+ * the separability of the tensor-product basis: the control points are first
+ * contracted along z, then along y, and the four remaining values are
+ * combined with the x basis values of every voxel of the row.
+ */
+template<class DTYPE>
+void reg_cubic_spline_getDeformationField3D_tiled(nifti_image *splineControlPoint,
+                                                  nifti_image *deformationField,
+                                                  int *mask,
+                                                  bool bspline,
+                                                  const reg_splineBasisTable *basisTable)
+{
+   DTYPE *controlPointPtrX = static_cast<DTYPE *>(splineControlPoint->data);
+   DTYPE *controlPointPtrY = &controlPointPtrX[splineControlPoint->nx*splineControlPoint->ny*splineControlPoint->nz];
+   DTYPE *controlPointPtrZ = &controlPointPtrY[splineControlPoint->nx*splineControlPoint->ny*splineControlPoint->nz];
+
+   size_t voxelNumber = (size_t)deformationField->nx*deformationField->ny*deformationField->nz;
+   DTYPE *fieldPtrX=static_cast<DTYPE *>(deformationField->data);
+   DTYPE *fieldPtrY=&fieldPtrX[voxelNumber];
+   DTYPE *fieldPtrZ=&fieldPtrY[voxelNumber];
+
+   // The basis values are computed once per axis
+   int *pre[3], *cellStart[3], cellNumber[3];
+   DTYPE *basisValues[3];
+   DTYPE gridVoxelSpacing[3];
+   gridVoxelSpacing[0] = splineControlPoint->dx / deformationField->dx;
+   gridVoxelSpacing[1] = splineControlPoint->dy / deformationField->dy;
+   gridVoxelSpacing[2] = splineControlPoint->dz / deformationField->dz;
+   for(int i=0; i<3; ++i)
+   {
+      int dim=deformationField->dim[i+1];
+      pre[i]=(int *)malloc(dim*sizeof(int));
+      cellStart[i]=(int *)malloc((dim+1)*sizeof(int));
+      basisValues[i]=(DTYPE *)malloc(4*dim*sizeof(DTYPE));
+      if(basisTable!=NULL)
+      {
+         // The basis values are copied from the tables of the current level
+         cellNumber[i]=0;
+         for(int v=0; v<dim; ++v)
+         {
+            pre[i][v]=basisTable->GetBasisValues<DTYPE>(i, v, &basisValues[i][4*v]);
+            if(v==0 || pre[i][v]!=pre[i][v-1])
+               cellStart[i][cellNumber[i]++]=v;
+         }
+         cellStart[i][cellNumber[i]]=dim;
+      }
+      else cellNumber[i]=reg_cubic_spline_getAxisBasis<DTYPE>(dim,
+                                                              gridVoxelSpacing[i],
+                                                              bspline,
+                                                              pre[i],
+                                                              basisValues[i],
+                                                              cellStart[i]);
+   }
+   int totalCellNumber=cellNumber[0]*cellNumber[1]*cellNumber[2];
+
+   int cell, xCell, yCell, zCell, x, y, z, a, b, i;
+   size_t index;
+   DTYPE xControlPointCoordinates[64];
+   DTYPE yControlPointCoordinates[64];
+   DTYPE zControlPointCoordinates[64];
+   DTYPE xzContraction[16], yzContraction[16], zzContraction[16];
+   DTYPE xyContraction[4], yyContraction[4], zyContraction[4];
+   DTYPE *xBasis, *yBasis, *zBasis;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   private(cell, xCell, yCell, zCell, x, y, z, a, b, i, index, \
+   xControlPointCoordinates, yControlPointCoordinates, zControlPointCoordinates, \
+   xzContraction, yzContraction, zzContraction, xyContraction, yyContraction, zyContraction, \
+   xBasis, yBasis, zBasis) \
+   shared(totalCellNumber, cellNumber, cellStart, pre, basisValues, splineControlPoint, \
+   deformationField, controlPointPtrX, controlPointPtrY, controlPointPtrZ, \
+   fieldPtrX, fieldPtrY, fieldPtrZ, mask) \
+   schedule(dynamic, 1)
+#endif // _OPENMP
+   for(cell=0; cell<totalCellNumber; ++cell)
+   {
+      xCell=cell%cellNumber[0];
+      yCell=(cell/cellNumber[0])%cellNumber[1];
+      zCell=cell/(cellNumber[0]*cellNumber[1]);
+
+      // The 64 control points of the cell are only read once
+      get_GridValues<DTYPE>(pre[0][cellStart[0][xCell]],
+                            pre[1][cellStart[1][yCell]],
+                            pre[2][cellStart[2][zCell]],
+                            splineControlPoint,
+                            controlPointPtrX,
+                            controlPointPtrY,
+                            controlPointPtrZ,
+                            xControlPointCoordinates,
+                            yControlPointCoordinates,
+                            zControlPointCoordinates,
+                            false, // no approximation
+                            false // not a deformation field
+                            );
+
+      for(z=cellStart[2][zCell]; z<cellStart[2][zCell+1]; ++z)
+      {
+         zBasis=&basisValues[2][4*z];
+         for(i=0; i<16; ++i)
+         {
+            xzContraction[i] = xControlPointCoordinates[i] * zBasis[0] +
+                  xControlPointCoordinates[16+i] * zBasis[1] +
+                  xControlPointCoordinates[32+i] * zBasis[2] +
+                  xControlPointCoordinates[48+i] * zBasis[3];
+            yzContraction[i] = yControlPointCoordinates[i] * zBasis[0] +
+                  yControlPointCoordinates[16+i] * zBasis[1] +
+                  yControlPointCoordinates[32+i] * zBasis[2] +
+                  yControlPointCoordinates[48+i] * zBasis[3];
+            zzContraction[i] = zControlPointCoordinates[i] * zBasis[0] +
+                  zControlPointCoordinates[16+i] * zBasis[1] +
+                  zControlPointCoordinates[32+i] * zBasis[2] +
+                  zControlPointCoordinates[48+i] * zBasis[3];
+         }
+         for(y=cellStart[1][yCell]; y<cellStart[1][yCell+1]; ++y)
+         {
+            yBasis=&basisValues[1][4*y];
+            for(a=0; a<4; ++a)
+            {
+               xyContraction[a]=0;
+               yyContraction[a]=0;
+               zyContraction[a]=0;
+               for(b=0; b<4; ++b)
+               {
+                  xyContraction[a] += xzContraction[4*b+a] * yBasis[b];
+                  yyContraction[a] += yzContraction[4*b+a] * yBasis[b];
+                  zyContraction[a] += zzContraction[4*b+a] * yBasis[b];
+               }
+            }
+            index=((size_t)z*deformationField->ny+y)*deformationField->nx+cellStart[0][xCell];
+            for(x=cellStart[0][xCell]; x<cellStart[0][xCell+1]; ++x)
+            {
+               if(mask[index]>-1)
+               {
+                  xBasis=&basisValues[0][4*x];
+                  fieldPtrX[index] = xyContraction[0] * xBasis[0] +
+                        xyContraction[1] * xBasis[1] +
+                        xyContraction[2] * xBasis[2] +
+                        xyContraction[3] * xBasis[3];
+                  fieldPtrY[index] = yyContraction[0] * xBasis[0] +
+                        yyContraction[1] * xBasis[1] +
+                        yyContraction[2] * xBasis[2] +
+                        yyContraction[3] * xBasis[3];
+                  fieldPtrZ[index] = zyContraction[0] * xBasis[0] +
+                        zyContraction[1] * xBasis[1] +
+                        zyContraction[2] * xBasis[2] +
+                        zyContraction[3] * xBasis[3];
+               }
+               else
+               {
+                  fieldPtrX[index] = 0;
+                  fieldPtrY[index] = 0;
+                  fieldPtrZ[index] = 0;
+               }
+               ++index;
+            } // x
+         } // y
+      } // z
+   } // cell
+
+   for(i=0; i<3; ++i)
+   {
+      free(pre[i]);
+      free(cellStart[i]);
+      free(basisValues[i]);
+   }
+}
+/* *************************************************************** */
 template<class DTYPE>
 void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
                                             nifti_image *deformationField,
                                             int *mask,
                                             bool composition,
                                             bool bspline,
-                                            bool force_no_lut=false)
+                                            const reg_splineBasisTable *basisTable)
 {
 #if _USE_SSE
    union
@@ -933,11 +1131,10 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
       __m128 m;
       float f[4];
    } val;
-   __m128 tempX, tempY, tempZ, tempCurrent;
+   __m128 tempX, tempY, tempZ;
    __m128 xBasis_sse, yBasis_sse, zBasis_sse, temp_basis_sse, basis_sse;
 
 #ifdef _WIN32
-   __declspec(align(16)) DTYPE temp[4];
    __declspec(align(16)) DTYPE zBasis[4];
    union
    {
@@ -955,7 +1152,6 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
       __declspec(align(16)) DTYPE f[16];
    } zControlPointCoordinates;
 #else // _WIN32
-   DTYPE temp[4] __attribute__((aligned(16)));
    DTYPE zBasis[4] __attribute__((aligned(16)));
    union
    {
@@ -974,7 +1170,6 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
    } zControlPointCoordinates;
 #endif // _WIN32
 #else // _USE_SSE
-   DTYPE temp[4];
    DTYPE zBasis[4];
    DTYPE xControlPointCoordinates[64];
    DTYPE yControlPointCoordinates[64];
@@ -990,7 +1185,7 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
    DTYPE *fieldPtrY=&fieldPtrX[deformationField->nx*deformationField->ny*deformationField->nz];
    DTYPE *fieldPtrZ=&fieldPtrY[deformationField->nx*deformationField->ny*deformationField->nz];
 
-   DTYPE basis, oldBasis=(DTYPE)(1.1);
+   DTYPE basis;
 
    int x, y, z, a, b, c, oldPreX, oldPreY, oldPreZ, xPre, yPre, zPre, index;
    DTYPE real[3];
@@ -1196,422 +1391,12 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
    }//Composition of deformation
    else  // !composition
    {
-      DTYPE gridVoxelSpacing[3];
-      gridVoxelSpacing[0] = splineControlPoint->dx / deformationField->dx;
-      gridVoxelSpacing[1] = splineControlPoint->dy / deformationField->dy;
-      gridVoxelSpacing[2] = splineControlPoint->dz / deformationField->dz;
-
-#ifdef _USE_SSE
-#ifdef _WIN32
-      union u1
-      {
-         __m128 m[4];
-         __declspec(align(16)) DTYPE f[16];
-      } yzBasis;
-      union u2
-      {
-         __m128 m[16];
-         __declspec(align(16)) DTYPE f[64];
-      } xyzBasis;
-#else // _WIN32
-      union
-      {
-         __m128 m[4];
-         DTYPE f[16] __attribute__((aligned(16)));
-      } yzBasis;
-      union
-      {
-         __m128 m[16];
-         DTYPE f[64] __attribute__((aligned(16)));
-      } xyzBasis;
-#endif // _WIN32
-#else // _USE_SSE
-      DTYPE yzBasis[16], xyzBasis[64];
-#endif // _USE_SSE
-
-      // Assess if lookup table can be used
-      if(gridVoxelSpacing[0]==5. && gridVoxelSpacing[0]==5. && gridVoxelSpacing[0]==5. && force_no_lut==false){
-
-          // Assign a single array that will contain all coefficients
-         DTYPE *coefficients = (DTYPE *)malloc(125*64*sizeof(DTYPE));
-          // Compute and store all required coefficients
-          int coeff_index;
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma omp parallel for default(none) \
-    private(x, y, z, a, b, c, coeff_index, basis, zBasis, temp, \
-    val, tempCurrent, yzBasis) \
-    shared(coefficients, bspline)
-#else //  _USE_SSE
-#pragma omp parallel for default(none) \
-    private(x, y, z, a, b, c, coeff_index, basis, zBasis, temp, \
-    yzBasis, coord) \
-    shared(coefficients, bspline)
-#endif // _USE_SSE
-#endif // _OPENMP
-          for(z=0;z<5;++z){
-             coeff_index=z*5*5*64;
-              basis=(DTYPE)z/5.;
-              if(bspline) get_BSplineBasisValues<DTYPE>(basis, zBasis);
-              else get_SplineBasisValues<DTYPE>(basis, zBasis);
-              for(y=0;y<5;++y){
-                  basis=(DTYPE)y/5.;
-                  if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-                  else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-                  val.f[0] = temp[0];
-                  val.f[1] = temp[1];
-                  val.f[2] = temp[2];
-                  val.f[3] = temp[3];
-                  tempCurrent=val.m;
-                  for(a=0; a<4; a++)
-                  {
-                      val.m=_mm_set_ps1(zBasis[a]);
-                      yzBasis.m[a] = _mm_mul_ps(tempCurrent,val.m);
-                  }
-#else
-                  coord=0;
-                  for(a=0; a<4; a++)
-                  {
-                      yzBasis[coord++]=temp[0]*zBasis[a];
-                      yzBasis[coord++]=temp[1]*zBasis[a];
-                      yzBasis[coord++]=temp[2]*zBasis[a];
-                      yzBasis[coord++]=temp[3]*zBasis[a];
-                  }
-#endif
-
-                  for(x=0;x<5;++x){
-                      basis=(DTYPE)x/5.;
-                      if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-                      else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-
-                      val.f[0] = temp[0];
-                      val.f[1] = temp[1];
-                      val.f[2] = temp[2];
-                      val.f[3] = temp[3];
-                      tempCurrent=val.m;
-                      for(a=0; a<16; ++a)
-                      {
-                          val.m=_mm_set_ps1(yzBasis.f[a]);
-                          val.m=_mm_mul_ps(tempCurrent,val.m);
-                          coefficients[coeff_index++]=val.f[0];
-                          coefficients[coeff_index++]=val.f[1];
-                          coefficients[coeff_index++]=val.f[2];
-                          coefficients[coeff_index++]=val.f[3];
-                      }
-#else
-                      for(a=0; a<16; a++)
-                      {
-                          coefficients[coeff_index++]=temp[0]*yzBasis[a];
-                          coefficients[coeff_index++]=temp[1]*yzBasis[a];
-                          coefficients[coeff_index++]=temp[2]*yzBasis[a];
-                          coefficients[coeff_index++]=temp[3]*yzBasis[a];
-                      }
-#endif
-                  } //x
-              } // y
-          } // z
-
-          // Loop over block of 5x5x5 voxels
-#if _USE_SSE
-          int coord;
-#endif // USE_SSE
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma omp parallel for default(none) \
-   private(x, y, z, a, b, c, xPre, yPre, zPre, real, \
-   index, xyzBasis, temp, coeff_index, coord, tempX, tempY, tempZ, val,\
-   xControlPointCoordinates, yControlPointCoordinates, zControlPointCoordinates) \
-   shared(deformationField, fieldPtrX, fieldPtrY, fieldPtrZ, splineControlPoint, mask, \
-   gridVoxelSpacing, bspline, controlPointPtrX, controlPointPtrY, controlPointPtrZ, \
-   coefficients)
-#else //  _USE_SSE
-#pragma omp parallel for default(none) \
-   private(x, y, z, a, b, c, xPre, yPre, zPre, real, \
-   index, xyzBasis, temp, coeff_index, coord, basis, \
-   xControlPointCoordinates, yControlPointCoordinates, zControlPointCoordinates) \
-   shared(deformationField, fieldPtrX, fieldPtrY, fieldPtrZ, splineControlPoint, mask, \
-   gridVoxelSpacing, bspline, controlPointPtrX, controlPointPtrY, controlPointPtrZ, \
-   coefficients)
-#endif // _USE_SSE
-#endif // _OPENMP
-          for(zPre=0; zPre<splineControlPoint->nz-3; zPre++)
-          {
-              for(yPre=0; yPre<splineControlPoint->ny-3; yPre++)
-              {
-                  for(xPre=0; xPre<splineControlPoint->nx-3; xPre++)
-                  {
-#if _USE_SSE
-                      get_GridValues<DTYPE>(xPre,
-                                            yPre,
-                                            zPre,
-                                            splineControlPoint,
-                                            controlPointPtrX,
-                                            controlPointPtrY,
-                                            controlPointPtrZ,
-                                            xControlPointCoordinates.f,
-                                            yControlPointCoordinates.f,
-                                            zControlPointCoordinates.f,
-                                            false, // no approximation
-                                            false // not a deformation field
-                                            );
-#else // _USE_SSE
-                      get_GridValues<DTYPE>(xPre,
-                                            yPre,
-                                            zPre,
-                                            splineControlPoint,
-                                            controlPointPtrX,
-                                            controlPointPtrY,
-                                            controlPointPtrZ,
-                                            xControlPointCoordinates,
-                                            yControlPointCoordinates,
-                                            zControlPointCoordinates,
-                                            false, // no approximation
-                                            false // not a deformation field
-                                            );
-#endif // _USE_SSE
-                      coeff_index=0;
-                      for(c=0;c<5;++c){
-                          z = zPre*5+c;
-                          if(z<deformationField->nz){
-                              for(b=0;b<5;++b){
-                                  y = yPre*5+b;
-                                  if(y<deformationField->ny){
-                                      index = (z*deformationField->ny+y)*deformationField->nx+xPre*5;
-                                      for(a=0;a<5;++a){
-                                          x = xPre*5+a;
-                                          if(x<deformationField->nx && mask[index]>-1){
-#if _USE_SSE
-                                              tempX =  _mm_set_ps1(0.0);
-                                              tempY =  _mm_set_ps1(0.0);
-                                              tempZ =  _mm_set_ps1(0.0);
-                                              for(coord=0;coord<16;++coord){
-                                                  val.m = _mm_set_ps(coefficients[coeff_index+3],
-                                                        coefficients[coeff_index+2],
-                                                        coefficients[coeff_index+1],
-                                                        coefficients[coeff_index]);
-                                                  coeff_index+=4;
-                                                  tempX = _mm_add_ps(_mm_mul_ps(val.m,
-                                                                                xControlPointCoordinates.m[coord]),
-                                                                     tempX );
-                                                  tempY = _mm_add_ps(_mm_mul_ps(val.m,
-                                                                                yControlPointCoordinates.m[coord]),
-                                                                     tempY );
-                                                  tempZ = _mm_add_ps(_mm_mul_ps(val.m,
-                                                                                zControlPointCoordinates.m[coord]),
-                                                                     tempZ );
-                                              }
-                                              //the values stored in SSE variables are transfered to normal float
-#ifdef __SSE3__
-                                              val.m = _mm_hadd_ps(tempX, tempY);
-                                              val.m = _mm_hadd_ps(val.m, tempZ);
-                                              real[0] = val.f[0];
-                                              real[1] = val.f[1];
-                                              real[2] = val.f[2]+val.f[3];
-#else
-                                              val.m=tempX;
-                                              real[0]=val.f[0]+val.f[1]+val.f[2]+val.f[3];
-                                              val.m=tempY;
-                                              real[1]= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-                                              val.m=tempZ;
-                                              real[2]= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-#endif
-#else // _USE_SSE
-                                              real[0]=real[1]=real[2]=0;
-                                              for(coord=0;coord<64;++coord){
-                                                  basis = coefficients[coeff_index++];
-                                                  real[0] += xControlPointCoordinates[coord] * basis;
-                                                  real[1] += yControlPointCoordinates[coord] * basis;
-                                                  real[2] += zControlPointCoordinates[coord] * basis;
-                                              }
-#endif // _USE_SSE
-                                              fieldPtrX[index] = real[0];
-                                              fieldPtrY[index] = real[1];
-                                              fieldPtrZ[index] = real[2];
-                                          } // x defined
-                                          else coeff_index += 64;
-                                          index++;
-                                      } // a
-                                  } // y defined
-                                  else coeff_index += 5*64;
-                              } // b
-                          } // z defined
-                          else coeff_index += 5*5*64;
-                      } // c
-                  } // xPre
-              } // yPre
-          } // zPre
-          free(coefficients);
-      } // if spacings==5 voxels
-      else{
-
-#if defined (_OPENMP)
-#ifdef _USE_SSE
-#pragma omp parallel for default(none) \
-    private(x, y, z, a, b, c, oldPreX, oldPreY, oldPreZ, xPre, yPre, zPre, real, \
-    index, basis, xyzBasis, yzBasis, zBasis, temp, xControlPointCoordinates, \
-    yControlPointCoordinates, zControlPointCoordinates, oldBasis, \
-    tempX, tempY, tempZ, xBasis_sse, yBasis_sse, zBasis_sse, \
-    temp_basis_sse, basis_sse, val, tempCurrent) \
-    shared(deformationField, fieldPtrX, fieldPtrY, fieldPtrZ, splineControlPoint, mask, \
-    gridVoxelSpacing, bspline, controlPointPtrX, controlPointPtrY, controlPointPtrZ)
-#else //  _USE_SSE
-#pragma omp parallel for default(none) \
-    private(x, y, z, a, b, c, oldPreX, oldPreY, oldPreZ, xPre, yPre, zPre, real, \
-    index, basis, xyzBasis, yzBasis, zBasis, temp, xControlPointCoordinates, \
-    yControlPointCoordinates, zControlPointCoordinates, oldBasis, coord) \
-    shared(deformationField, fieldPtrX, fieldPtrY, fieldPtrZ, splineControlPoint, mask, \
-    gridVoxelSpacing, bspline, controlPointPtrX, controlPointPtrY, controlPointPtrZ)
-#endif // _USE_SSE
-#endif // _OPENMP
-          for(z=0; z<deformationField->nz; z++)
-          {
-
-              index=z*deformationField->nx*deformationField->ny;
-              oldBasis=1.1;
-
-              zPre=static_cast<int>(static_cast<DTYPE>(z)/gridVoxelSpacing[2]);
-              basis=static_cast<DTYPE>(z)/gridVoxelSpacing[2]-static_cast<DTYPE>(zPre);
-              if(basis<0.0) basis=0.0; //rounding error
-              if(bspline) get_BSplineBasisValues<DTYPE>(basis, zBasis);
-              else get_SplineBasisValues<DTYPE>(basis, zBasis);
-
-              for(y=0; y<deformationField->ny; y++)
-              {
-
-                  yPre=static_cast<int>(static_cast<DTYPE>(y)/gridVoxelSpacing[1]);
-                  basis=static_cast<DTYPE>(y)/gridVoxelSpacing[1]-static_cast<DTYPE>(yPre);
-                  if(basis<0.0) basis=0.0; //rounding error
-                  if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-                  else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-                  val.f[0] = temp[0];
-                  val.f[1] = temp[1];
-                  val.f[2] = temp[2];
-                  val.f[3] = temp[3];
-                  tempCurrent=val.m;
-                  for(a=0; a<4; a++)
-                  {
-                      val.m=_mm_set_ps1(zBasis[a]);
-                      yzBasis.m[a] = _mm_mul_ps(tempCurrent,val.m);
-                  }
-#else
-                  coord=0;
-                  for(a=0; a<4; a++)
-                  {
-                      yzBasis[coord++]=temp[0]*zBasis[a];
-                      yzBasis[coord++]=temp[1]*zBasis[a];
-                      yzBasis[coord++]=temp[2]*zBasis[a];
-                      yzBasis[coord++]=temp[3]*zBasis[a];
-                  }
-#endif
-
-                  for(x=0; x<deformationField->nx; x++)
-                  {
-
-                      xPre=static_cast<int>(static_cast<DTYPE>(x)/gridVoxelSpacing[0]);
-                      basis=static_cast<DTYPE>(x)/gridVoxelSpacing[0]-static_cast<DTYPE>(xPre);
-                      if(basis<0.0) basis=0.0; //rounding error
-                      if(bspline) get_BSplineBasisValues<DTYPE>(basis, temp);
-                      else get_SplineBasisValues<DTYPE>(basis, temp);
-#if _USE_SSE
-
-                      val.f[0] = temp[0];
-                      val.f[1] = temp[1];
-                      val.f[2] = temp[2];
-                      val.f[3] = temp[3];
-                      tempCurrent=val.m;
-                      for(a=0; a<16; ++a)
-                      {
-                          val.m=_mm_set_ps1(yzBasis.f[a]);
-                          xyzBasis.m[a]=_mm_mul_ps(tempCurrent,val.m);
-                      }
-#else
-                      coord=0;
-                      for(a=0; a<16; a++)
-                      {
-                          xyzBasis[coord++]=temp[0]*yzBasis[a];
-                          xyzBasis[coord++]=temp[1]*yzBasis[a];
-                          xyzBasis[coord++]=temp[2]*yzBasis[a];
-                          xyzBasis[coord++]=temp[3]*yzBasis[a];
-                      }
-#endif
-                      if(basis<=oldBasis || x==0)
-                      {
-#ifdef _USE_SSE
-                          get_GridValues<DTYPE>(xPre,
-                                                yPre,
-                                                zPre,
-                                                splineControlPoint,
-                                                controlPointPtrX,
-                                                controlPointPtrY,
-                                                controlPointPtrZ,
-                                                xControlPointCoordinates.f,
-                                                yControlPointCoordinates.f,
-                                                zControlPointCoordinates.f,
-                                                false, // no approximation
-                                                false // not a deformation field
-                                                );
-#else // _USE_SSE
-                          get_GridValues<DTYPE>(xPre,
-                                                yPre,
-                                                zPre,
-                                                splineControlPoint,
-                                                controlPointPtrX,
-                                                controlPointPtrY,
-                                                controlPointPtrZ,
-                                                xControlPointCoordinates,
-                                                yControlPointCoordinates,
-                                                zControlPointCoordinates,
-                                                false, // no approximation
-                                                false // not a deformation field
-                                                );
-#endif // _USE_SSE
-                      }
-                      oldBasis=basis;
-
-                      real[0]=0.0;
-                      real[1]=0.0;
-                      real[2]=0.0;
-
-                      if(mask[index]>-1)
-                      {
-#if _USE_SSE
-                          tempX =  _mm_set_ps1(0.0);
-                          tempY =  _mm_set_ps1(0.0);
-                          tempZ =  _mm_set_ps1(0.0);
-                          //addition and multiplication of the 64 basis value and CP displacement for each axis
-                          for(a=0; a<16; a++)
-                          {
-                              tempX = _mm_add_ps(_mm_mul_ps(xyzBasis.m[a], xControlPointCoordinates.m[a]), tempX );
-                              tempY = _mm_add_ps(_mm_mul_ps(xyzBasis.m[a], yControlPointCoordinates.m[a]), tempY );
-                              tempZ = _mm_add_ps(_mm_mul_ps(xyzBasis.m[a], zControlPointCoordinates.m[a]), tempZ );
-                          }
-                          //the values stored in SSE variables are transfered to normal float
-                          val.m=tempX;
-                          real[0]=val.f[0]+val.f[1]+val.f[2]+val.f[3];
-                          val.m=tempY;
-                          real[1]= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-                          val.m=tempZ;
-                          real[2]= val.f[0]+val.f[1]+val.f[2]+val.f[3];
-#else
-                          for(a=0; a<64; a++)
-                          {
-                              real[0] += xControlPointCoordinates[a] * xyzBasis[a];
-                              real[1] += yControlPointCoordinates[a] * xyzBasis[a];
-                              real[2] += zControlPointCoordinates[a] * xyzBasis[a];
-                          }
-#endif
-                      }// mask
-                      fieldPtrX[index] = real[0];
-                      fieldPtrY[index] = real[1];
-                      fieldPtrZ[index] = real[2];
-                      index++;
-                  } // x
-              } // y
-          } // z
-      } // else spacing==5
+      // The field is evaluated one control point cell at a time
+      reg_cubic_spline_getDeformationField3D_tiled<DTYPE>(splineControlPoint,
+                                                          deformationField,
+                                                          mask,
+                                                          bspline,
+                                                          basisTable);
    }// from a deformation field
 
    return;
@@ -1622,7 +1407,8 @@ void reg_spline_getDeformationField(nifti_image *splineControlPoint,
                                     int *mask,
                                     bool composition,
                                     bool bspline,
-                                    bool force_no_lut)
+                                    bool /*force_no_lut*/,
+                                    const reg_splineBasisTable *basisTable)
 {
    if(splineControlPoint->datatype != deformationField->datatype)
    {
@@ -1704,13 +1490,16 @@ void reg_spline_getDeformationField(nifti_image *splineControlPoint,
       }
       else
       {
+         // The precomputed basis values are only used if they match the current field
+         if(basisTable!=NULL && (bspline==false || basisTable->IsValid(splineControlPoint, deformationField)==false))
+            basisTable=NULL;
          switch(deformationField->datatype)
          {
          case NIFTI_TYPE_FLOAT32:
-            reg_cubic_spline_getDeformationField3D<float>(splineControlPoint, deformationField, mask, composition, bspline, force_no_lut);
+            reg_cubic_spline_getDeformationField3D<float>(splineControlPoint, deformationField, mask, composition, bspline, basisTable);
             break;
          case NIFTI_TYPE_FLOAT64:
-            reg_cubic_spline_getDeformationField3D<double>(splineControlPoint, deformationField, mask, composition, bspline, force_no_lut);
+            reg_cubic_spline_getDeformationField3D<double>(splineControlPoint, deformationField, mask, composition, bspline, basisTable);
             break;
          default:
             reg_print_fct_error("reg_spline_getDeformationField");
@@ -1922,6 +1711,7 @@ void reg_voxelCentric2NodeCentric(nifti_image *nodeImage,
                                   mat44 *voxelToMillimeter
                                   )
 {
+   reg_stageTimer timer("voxelCentric2NodeCentric");
    if(nodeImage->datatype!=voxelImage->datatype)
    {
       reg_print_fct_error("reg_voxelCentric2NodeCentric");
@@ -1971,7 +1761,7 @@ void reg_spline_refineControlPointGrid2D(nifti_image *splineControlPoint,
    SplineTYPE *oldGrid = (SplineTYPE *)malloc(splineControlPoint->nvox*splineControlPoint->nbyper);
    SplineTYPE *gridPtrX = static_cast<SplineTYPE *>(splineControlPoint->data);
    memcpy(oldGrid, gridPtrX, splineControlPoint->nvox*splineControlPoint->nbyper);
-   if(splineControlPoint->data!=NULL) free(splineControlPoint->data);
+   if(splineControlPoint->data!=NULL) nifti_free_data(splineControlPoint->data);
    int oldDim[4];
    oldDim[0]=splineControlPoint->dim[0];
    oldDim[1]=splineControlPoint->dim[1];
@@ -2079,7 +1869,7 @@ void reg_spline_refineControlPointGrid3D(nifti_image *splineControlPoint, nifti_
    SplineTYPE *oldGrid = (SplineTYPE *)malloc(splineControlPoint->nvox*splineControlPoint->nbyper);
    SplineTYPE *gridPtrX = static_cast<SplineTYPE *>(splineControlPoint->data);
    memcpy(oldGrid, gridPtrX, splineControlPoint->nvox*splineControlPoint->nbyper);
-   if(splineControlPoint->data!=NULL) free(splineControlPoint->data);
+   if(splineControlPoint->data!=NULL) nifti_free_data(splineControlPoint->data);
    int oldDim[4];
    oldDim[0]=splineControlPoint->dim[0];
    oldDim[1]=splineControlPoint->dim[1];
@@ -2551,7 +2341,8 @@ void reg_spline_refineControlPointGrid(nifti_image *controlPointGrid,
 template <class DTYPE>
 void reg_defField_compose2D(nifti_image *deformationField,
                             nifti_image *dfToUpdate,
-                            int *mask)
+                            int *mask,
+                            DTYPE *composedPtrX)
 {
    size_t DFVoxelNumber=(size_t)deformationField->nx*deformationField->ny;
 #ifdef _WIN32
@@ -2567,6 +2358,8 @@ void reg_defField_compose2D(nifti_image *deformationField,
    DTYPE *resPtrX = static_cast<DTYPE *>(dfToUpdate->data);
    DTYPE *resPtrY = &resPtrX[warVoxelNumber];
 
+   DTYPE *composedPtrY = &composedPtrX[warVoxelNumber];
+
    mat44 *df_real2Voxel=NULL;
    mat44 *df_voxel2Real=NULL;
    if(deformationField->sform_code>0)
@@ -2587,13 +2380,13 @@ void reg_defField_compose2D(nifti_image *deformationField,
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
    shared(warVoxelNumber, mask, df_real2Voxel, df_voxel2Real, \
-   deformationField, defPtrX, defPtrY, resPtrX, resPtrY) \
+   deformationField, defPtrX, defPtrY, resPtrX, resPtrY, composedPtrX, composedPtrY) \
    private(i, a, b, index, pre,realDefX, realDefY, voxelX, voxelY, \
    defX, defY, relX, relY, basis)
 #endif
    for(i=0; i<warVoxelNumber; ++i)
    {
-      if(mask[i]>-1)
+      if(mask==NULL || mask[i]>-1)
       {
          realDefX = resPtrX[i];
          realDefY = resPtrY[i];
@@ -2645,8 +2438,8 @@ void reg_defField_compose2D(nifti_image *deformationField,
                realDefY += defY * basis;
             }
          }
-         resPtrX[i]=realDefX;
-         resPtrY[i]=realDefY;
+         composedPtrX[i]=realDefX;
+         composedPtrY[i]=realDefY;
       }// mask
    }// loop over every voxel
 }
@@ -2654,7 +2447,8 @@ void reg_defField_compose2D(nifti_image *deformationField,
 template <class DTYPE>
 void reg_defField_compose3D(nifti_image *deformationField,
                             nifti_image *dfToUpdate,
-                            int *mask)
+                            int *mask,
+                            DTYPE *composedPtrX)
 {
    const int DefFieldDim[3]= {deformationField->nx,deformationField->ny,deformationField->nz};
    const size_t DFVoxelNumber=(size_t)DefFieldDim[0]*DefFieldDim[1]*DefFieldDim[2];
@@ -2676,6 +2470,9 @@ void reg_defField_compose3D(nifti_image *deformationField,
    DTYPE *resPtrY = &resPtrX[warVoxelNumber];
    DTYPE *resPtrZ = &resPtrY[warVoxelNumber];
 
+   DTYPE *composedPtrY = &composedPtrX[warVoxelNumber];
+   DTYPE *composedPtrZ = &composedPtrY[warVoxelNumber];
+
 #ifdef _WIN32
    __declspec(align(16))mat44 df_real2Voxel;
 #else
@@ -2701,13 +2498,14 @@ void reg_defField_compose3D(nifti_image *deformationField,
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
    shared(warVoxelNumber, mask, df_real2Voxel, df_voxel2Real, DefFieldDim, \
-   defPtrX, defPtrY, defPtrZ, resPtrX, resPtrY, resPtrZ, deformationField) \
+   defPtrX, defPtrY, defPtrZ, resPtrX, resPtrY, resPtrZ, deformationField, \
+   composedPtrX, composedPtrY, composedPtrZ) \
    private(i, a, b, c, currentX, currentY, currentZ, index, tempIndex, pre, \
    realDef, voxel, tempBasis, defX, defY, defZ, relX, relY, relZ, basis, inY, inZ)
 #endif
    for(i=0; i<warVoxelNumber; ++i)
    {
-      if(mask[i]>-1)
+      if(mask==NULL || mask[i]>-1)
       {
          // Conversion from real to voxel in the deformation field
          realDef[0] = resPtrX[i];
@@ -2789,16 +2587,20 @@ void reg_defField_compose3D(nifti_image *deformationField,
                } // a loop
             } // b loop
          } // c loop
-         resPtrX[i] = realDef[0];
-         resPtrY[i] = realDef[1];
-         resPtrZ[i] = realDef[2];
+         composedPtrX[i] = realDef[0];
+         composedPtrY[i] = realDef[1];
+         composedPtrZ[i] = realDef[2];
       }// mask
    }// loop over every voxel
 }
 /* *************************************************************** */
-void reg_defField_compose(nifti_image *deformationField,
-                          nifti_image *dfToUpdate,
-                          int *mask)
+/* Internal routine: the positions of dfToUpdate are composed with
+ * deformationField and the result is stored in composedData, which can be
+ * the data array of any of the two fields. A NULL mask includes all voxels */
+static void reg_defField_composeToBuffer(nifti_image *deformationField,
+                                         nifti_image *dfToUpdate,
+                                         void *composedData,
+                                         int *mask)
 {
    if(deformationField->datatype != dfToUpdate->datatype)
    {
@@ -2807,25 +2609,17 @@ void reg_defField_compose(nifti_image *deformationField,
       reg_exit();
    }
 
-   bool freeMask=false;
-   if(mask==NULL)
-   {
-      mask=(int *)calloc(dfToUpdate->nx*
-                         dfToUpdate->ny*
-                         dfToUpdate->nz,
-                         sizeof(int));
-      freeMask=true;
-   }
-
    if(dfToUpdate->nu==2)
    {
       switch(deformationField->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
-         reg_defField_compose2D<float>(deformationField,dfToUpdate,mask);
+         reg_defField_compose2D<float>(deformationField,dfToUpdate,mask,
+                                       static_cast<float *>(composedData));
          break;
       case NIFTI_TYPE_FLOAT64:
-         reg_defField_compose2D<double>(deformationField,dfToUpdate,mask);
+         reg_defField_compose2D<double>(deformationField,dfToUpdate,mask,
+                                        static_cast<double *>(composedData));
          break;
       default:
          reg_print_fct_error("reg_defField_compose");
@@ -2838,10 +2632,12 @@ void reg_defField_compose(nifti_image *deformationField,
       switch(deformationField->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
-         reg_defField_compose3D<float>(deformationField,dfToUpdate,mask);
+         reg_defField_compose3D<float>(deformationField,dfToUpdate,mask,
+                                       static_cast<float *>(composedData));
          break;
       case NIFTI_TYPE_FLOAT64:
-         reg_defField_compose3D<double>(deformationField,dfToUpdate,mask);
+         reg_defField_compose3D<double>(deformationField,dfToUpdate,mask,
+                                        static_cast<double *>(composedData));
          break;
       default:
          reg_print_fct_error("reg_defField_compose");
@@ -2849,8 +2645,17 @@ void reg_defField_compose(nifti_image *deformationField,
          reg_exit();
       }
    }
-
-   if(freeMask==true) free(mask);
+}
+/* *************************************************************** */
+void reg_defField_compose(nifti_image *deformationField,
+                          nifti_image *dfToUpdate,
+                          int *mask)
+{
+   // The positions are only read by the thread that overwrites them
+   reg_defField_composeToBuffer(deformationField,
+                                dfToUpdate,
+                                dfToUpdate->data,
+                                mask);
 }
 /* *************************************************************** */
 /* *************************************************************** */
@@ -3431,9 +3236,282 @@ void reg_defFieldInvert3D(nifti_image *inputDeformationField,
    }
 }
 /* *************************************************************** */
+/* Internal routine: trilinear interpolation of the deformation field at the
+ * world position (x,y,z) and of its Jacobian matrix with respect to the world
+ * coordinates. The field is extrapolated outside of its domain as in FastWarp */
+template<class FieldTYPE>
+static void FastWarpJacobian(const double *world,
+                             nifti_image *deformationField,
+                             mat44 *deformationFieldIJKMatrix,
+                             double *warped,
+                             double jacobian[3][3])
+{
+   const int dxw = deformationField->nx;
+   const int dxyw = dxw * deformationField->ny;
+   const int dxyzw = dxyw * deformationField->nz;
+
+   double position[3];
+   for(int i=0; i<3; ++i)
+      position[i] = deformationFieldIJKMatrix->m[i][0] * world[0] +
+            deformationFieldIJKMatrix->m[i][1] * world[1] +
+            deformationFieldIJKMatrix->m[i][2] * world[2] +
+            deformationFieldIJKMatrix->m[i][3];
+
+   int xw = (int)position[0];
+   int yw = (int)position[1];
+   int zw = (int)position[2];
+   if (xw<0) xw=0;
+   if (yw<0) yw=0;
+   if (zw<0) zw=0;
+   if (xw>deformationField->nx-2) xw = deformationField->nx-2;
+   if (yw>deformationField->ny-2) yw = deformationField->ny-2;
+   if (zw>deformationField->nz-2) zw = deformationField->nz-2;
+   const double wxf = position[0]-xw;
+   const double wyf = position[1]-yw;
+   const double wzf = position[2]-zw;
+
+   const FieldTYPE *wp = static_cast<FieldTYPE *>(deformationField->data) +
+         zw*dxyw + yw*dxw + xw;
+   double voxelJacobian[3][3];
+   for(int c=0; c<3; ++c)
+   {
+      const double wa = wp[0];
+      const double wb = wp[1]                - wa;
+      const double wc = wp[dxw]              - wa;
+      const double wd = wp[dxyw]             - wa;
+      const double we = wp[dxyw + dxw]       - wa - wc - wd;
+      const double wf = wp[dxyw + 1]         - wa - wb - wd;
+      const double wg = wp[dxw + 1]          - wa - wb - wc;
+      const double wh = wp[dxyw + dxw + 1]   - wp[dxw + 1] - wd - we - wf;
+      warped[c] = wa + wb*wxf + wc*wyf + wd*wzf + we*wyf*wzf +
+            wf*wxf*wzf + wg*wxf*wyf + wh*wxf*wyf*wzf;
+      voxelJacobian[c][0] = wb + wf*wzf + wg*wyf + wh*wyf*wzf;
+      voxelJacobian[c][1] = wc + we*wzf + wg*wxf + wh*wxf*wzf;
+      voxelJacobian[c][2] = wd + we*wyf + wf*wxf + wh*wxf*wyf;
+      wp += dxyzw;
+   }
+   // Chain rule from the voxel to the world coordinates
+   for(int c=0; c<3; ++c)
+      for(int i=0; i<3; ++i)
+         jacobian[c][i] = voxelJacobian[c][0] * deformationFieldIJKMatrix->m[0][i] +
+               voxelJacobian[c][1] * deformationFieldIJKMatrix->m[1][i] +
+               voxelJacobian[c][2] * deformationFieldIJKMatrix->m[2][i];
+}
+/* *************************************************************** */
+/* Internal routine: solve deformation(point)=target with damped Newton
+ * iterations starting from point. The step falls back to a fixed-point
+ * update when the Jacobian matrix is singular. Returns true on convergence */
+template<class FieldTYPE>
+static bool NewtonInvert(double *point,
+                         const double *target,
+                         nifti_image *deformationField,
+                         mat44 *deformationFieldIJKMatrix,
+                         double tolerance)
+{
+   const int maxIterationNumber = 50;
+   const double squaredTolerance = tolerance * tolerance;
+   double warped[3], jacobian[3][3], residual[3], step[3], trial[3];
+   FastWarpJacobian<FieldTYPE>(point, deformationField, deformationFieldIJKMatrix, warped, jacobian);
+   for(int i=0; i<3; ++i) residual[i] = warped[i] - target[i];
+   double squaredNorm = residual[0]*residual[0] + residual[1]*residual[1] + residual[2]*residual[2];
+   for(int iteration=0; iteration<maxIterationNumber; ++iteration)
+   {
+      if(squaredNorm<=squaredTolerance)
+         return true;
+      if(squaredNorm!=squaredNorm)
+         return false;
+      // Solve jacobian * step = residual using the cofactor matrix
+      const double c00 = jacobian[1][1]*jacobian[2][2] - jacobian[1][2]*jacobian[2][1];
+      const double c01 = jacobian[1][2]*jacobian[2][0] - jacobian[1][0]*jacobian[2][2];
+      const double c02 = jacobian[1][0]*jacobian[2][1] - jacobian[1][1]*jacobian[2][0];
+      const double det = jacobian[0][0]*c00 + jacobian[0][1]*c01 + jacobian[0][2]*c02;
+      if(det>1.e-6)
+      {
+         const double c10 = jacobian[0][2]*jacobian[2][1] - jacobian[0][1]*jacobian[2][2];
+         const double c11 = jacobian[0][0]*jacobian[2][2] - jacobian[0][2]*jacobian[2][0];
+         const double c12 = jacobian[0][1]*jacobian[2][0] - jacobian[0][0]*jacobian[2][1];
+         const double c20 = jacobian[0][1]*jacobian[1][2] - jacobian[0][2]*jacobian[1][1];
+         const double c21 = jacobian[0][2]*jacobian[1][0] - jacobian[0][0]*jacobian[1][2];
+         const double c22 = jacobian[0][0]*jacobian[1][1] - jacobian[0][1]*jacobian[1][0];
+         step[0] = (c00*residual[0] + c10*residual[1] + c20*residual[2]) / det;
+         step[1] = (c01*residual[0] + c11*residual[1] + c21*residual[2]) / det;
+         step[2] = (c02*residual[0] + c12*residual[1] + c22*residual[2]) / det;
+      }
+      else
+      {
+         // Folding or degenerated field, the fixed-point update is used instead
+         step[0] = residual[0];
+         step[1] = residual[1];
+         step[2] = residual[2];
+      }
+      // The step is halved until the residual decreases
+      double trialNorm = squaredNorm;
+      double trialWarped[3], trialJacobian[3][3];
+      for(int halving=0; halving<10; ++halving)
+      {
+         for(int i=0; i<3; ++i) trial[i] = point[i] - step[i];
+         FastWarpJacobian<FieldTYPE>(trial, deformationField, deformationFieldIJKMatrix, trialWarped, trialJacobian);
+         trialNorm = 0;
+         for(int i=0; i<3; ++i)
+            trialNorm += (trialWarped[i]-target[i]) * (trialWarped[i]-target[i]);
+         if(trialNorm<squaredNorm)
+            break;
+         step[0] *= 0.5;
+         step[1] *= 0.5;
+         step[2] *= 0.5;
+      }
+      if(!(trialNorm<squaredNorm))
+         return false;
+      for(int i=0; i<3; ++i)
+      {
+         point[i] = trial[i];
+         residual[i] = trialWarped[i] - target[i];
+         for(int j=0; j<3; ++j)
+            jacobian[i][j] = trialJacobian[i][j];
+      }
+      squaredNorm = trialNorm;
+   }
+   return squaredNorm<=squaredTolerance;
+}
+/* *************************************************************** */
+template <class DTYPE>
+void reg_defFieldInvert3D_newton(nifti_image *inputDeformationField,
+                                 nifti_image *outputDeformationField,
+                                 float tolerance)
+{
+   const int outputVoxelNumber = outputDeformationField->nx *
+         outputDeformationField->ny *
+         outputDeformationField->nz;
+
+   mat44 *OutXYZMatrix;
+   if(outputDeformationField->sform_code>0)
+      OutXYZMatrix=&(outputDeformationField->sto_xyz);
+   else OutXYZMatrix=&(outputDeformationField->qto_xyz);
+   mat44 *InXYZMatrix, *InIJKMatrix;
+   if(inputDeformationField->sform_code>0)
+   {
+      InXYZMatrix=&(inputDeformationField->sto_xyz);
+      InIJKMatrix=&(inputDeformationField->sto_ijk);
+   }
+   else
+   {
+      InXYZMatrix=&(inputDeformationField->qto_xyz);
+      InIJKMatrix=&(inputDeformationField->qto_ijk);
+   }
+
+   // The global shift of the field is used as initial guess when no
+   // neighbouring solution is available, as in the simplex approach
+   float center[4], center2[4];
+   double centerout[4], delta[4];
+   center[0] = inputDeformationField->nx / 2;
+   center[1] = inputDeformationField->ny / 2;
+   center[2] = inputDeformationField->nz / 2;
+   center[3] = 1;
+   reg_mat44_mul(InXYZMatrix, center, center2);
+   FastWarp<DTYPE>(center2[0], center2[1], center2[2], inputDeformationField, &centerout[0], &centerout[1], &centerout[2]);
+   delta[0] = center2[0]-centerout[0];
+   delta[1] = center2[1]-centerout[1];
+   delta[2] = center2[2]-centerout[2];
+
+   size_t fallbackNumber=0;
+   int i,x,y,z;
+   double position[4], target[4], pars[4], arrayy[4][3];
+   double previousTarget[3], previousSolution[3], rowTarget[3], rowSolution[3];
+   bool previousConverged, rowConverged;
+   struct ddata dat;
+   DTYPE *outData;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(outputDeformationField,tolerance,outputVoxelNumber, \
+   inputDeformationField, OutXYZMatrix, InIJKMatrix, delta) \
+   private(i,x,y,z,dat,outData,position,target,pars,arrayy, \
+   previousTarget, previousSolution, rowTarget, rowSolution, \
+   previousConverged, rowConverged) \
+   schedule(dynamic,1) \
+   reduction(+:fallbackNumber)
+#endif
+   for (z=0; z<outputDeformationField->nz; ++z)
+   {
+      dat.deformationField = inputDeformationField;
+      for(i=0; i<4; ++i)
+         dat.arrayy[i]= arrayy[i];
+
+      outData = (DTYPE *)(outputDeformationField->data) +
+            outputDeformationField->nx * outputDeformationField->ny * z;
+
+      rowConverged=false;
+      for(i=0; i<3; ++i)
+         rowTarget[i]=rowSolution[i]=0;
+      for(y=0; y<outputDeformationField->ny; ++y)
+      {
+         // The first voxel of a row is initialised from the first voxel of the previous row
+         previousConverged=rowConverged;
+         for(i=0; i<3; ++i)
+         {
+            previousTarget[i]=rowTarget[i];
+            previousSolution[i]=rowSolution[i];
+         }
+         for(x=0; x<outputDeformationField->nx; ++x)
+         {
+            position[0] = x;
+            position[1] = y;
+            position[2] = z;
+            position[3] = 1;
+            reg_mat44_mul(OutXYZMatrix, position, target);
+
+            // Warm start: the previous solution is shifted by the target displacement
+            for(i=0; i<3; ++i)
+               pars[i] = previousConverged ?
+                     previousSolution[i] + target[i] - previousTarget[i] :
+                     target[i] + delta[i];
+
+            previousConverged = NewtonInvert<DTYPE>(pars, target, inputDeformationField,
+                                                    InIJKMatrix, tolerance);
+            if(!previousConverged)
+            {
+               // The simplex optimisation is used when Newton's method fails
+               dat.gx = target[0];
+               dat.gy = target[1];
+               dat.gz = target[2];
+               for(i=0; i<3; ++i)
+                  pars[i] = target[i] + delta[i];
+               optimize(cost_function, pars, (void *)&dat, tolerance);
+               ++fallbackNumber;
+            }
+            for(i=0; i<3; ++i)
+            {
+               previousTarget[i]=target[i];
+               previousSolution[i]=pars[i];
+            }
+            if(x==0)
+            {
+               rowConverged=previousConverged;
+               for(i=0; i<3; ++i)
+               {
+                  rowTarget[i]=target[i];
+                  rowSolution[i]=pars[i];
+               }
+            }
+
+            outData[0]        = pars[0];
+            outData[outputVoxelNumber]   = pars[1];
+            outData[outputVoxelNumber*2] = pars[2];
+            ++outData;
+         }
+      }
+   }
+#ifndef NDEBUG
+   char text[255];
+   sprintf(text, "Newton's method did not converge for %lu/%i voxels, the simplex optimisation has been used",
+           (unsigned long)fallbackNumber, outputVoxelNumber);
+   reg_print_msg_debug(text);
+#endif
+}
+/* *************************************************************** */
 void reg_defFieldInvert(nifti_image *inputDeformationField,
                         nifti_image *outputDeformationField,
-                        float tolerance)
+                        float tolerance,
+                        bool useNewton)
 {
    // Check the input image data types
    if(inputDeformationField->datatype!=outputDeformationField->datatype)
@@ -3450,15 +3528,25 @@ void reg_defFieldInvert(nifti_image *inputDeformationField,
       reg_exit();
    }
 
+   if(tolerance!=tolerance)
+      tolerance=1.0e-6f;
+
    switch(inputDeformationField->datatype)
    {
    case NIFTI_TYPE_FLOAT32:
-      reg_defFieldInvert3D<float>
+      if(useNewton)
+         reg_defFieldInvert3D_newton<float>
+               (inputDeformationField,outputDeformationField,tolerance);
+      else reg_defFieldInvert3D<float>
             (inputDeformationField,outputDeformationField,tolerance);
       break;
    case NIFTI_TYPE_FLOAT64:
-      reg_defFieldInvert3D<double>
+      if(useNewton)
+         reg_defFieldInvert3D_newton<double>
+               (inputDeformationField,outputDeformationField,tolerance);
+      else reg_defFieldInvert3D<double>
             (inputDeformationField,outputDeformationField,tolerance);
+      break;
    default:
       reg_print_fct_error("reg_defFieldInvert");
       reg_print_msg_error("Deformation field pixel type unsupported");
@@ -3999,6 +4087,196 @@ void reg_spline_getFlowFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    velocityFieldGrid->num_ext=oldNumExt;
 }
 /* *************************************************************** */
+/* Internal routine: the origin of a field is the affine transformation
+ * when provided and the identity otherwise. The returned matrix maps the
+ * voxel indices of the field to the origin positions */
+static mat44 reg_defField_getOriginMatrix(nifti_image *field,
+                                          mat44 *affineTransformation)
+{
+   mat44 *voxel2Real;
+   if(field->sform_code>0)
+      voxel2Real=&(field->sto_xyz);
+   else voxel2Real=&(field->qto_xyz);
+   if(affineTransformation==NULL)
+      return *voxel2Real;
+   return reg_mat44_mul(affineTransformation, voxel2Real);
+}
+/* *************************************************************** */
+template <class DTYPE>
+static double reg_defField_getMaxDisplacementNorm(nifti_image *field,
+                                                  mat44 *origin)
+{
+   const size_t voxelNumber = (size_t)field->nx*field->ny*field->nz;
+   const int dimNumber = field->nu==2?2:3;
+   const mat44 originMatrix = reg_defField_getOriginMatrix(field, origin);
+   mat44 *real2Voxel;
+   if(field->sform_code>0)
+      real2Voxel=&(field->sto_ijk);
+   else real2Voxel=&(field->qto_ijk);
+
+   const DTYPE *ptr[3];
+   ptr[0] = static_cast<DTYPE *>(field->data);
+   ptr[1] = &ptr[0][voxelNumber];
+   ptr[2] = dimNumber==3?&ptr[1][voxelNumber]:NULL;
+
+   // Every row stores its largest norm, the rows are then reduced serially
+   const int rowNumber = field->ny*field->nz;
+   double *rowMaxSquaredNorm = (double *)malloc(rowNumber*sizeof(double));
+   int row, x, y, z, d;
+   size_t index;
+   double displacement[3], squaredNorm, voxelDisp;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(field, originMatrix, real2Voxel, ptr, dimNumber, rowNumber, \
+   rowMaxSquaredNorm) \
+   private(row, x, y, z, d, index, displacement, squaredNorm, voxelDisp)
+#endif
+   for(row=0; row<rowNumber; ++row)
+   {
+      y = row % field->ny;
+      z = row / field->ny;
+      index = (size_t)row * field->nx;
+      rowMaxSquaredNorm[row] = 0;
+      for(x=0; x<field->nx; ++x)
+      {
+         displacement[0]=displacement[1]=displacement[2]=0;
+         for(d=0; d<dimNumber; ++d)
+            displacement[d] = (double)ptr[d][index] - (
+                     (double)originMatrix.m[d][0] * x +
+                     (double)originMatrix.m[d][1] * y +
+                     (double)originMatrix.m[d][2] * z +
+                     (double)originMatrix.m[d][3]);
+         // The displacement is expressed in voxel
+         squaredNorm=0;
+         for(d=0; d<dimNumber; ++d)
+         {
+            voxelDisp =
+                  (double)real2Voxel->m[d][0] * displacement[0] +
+                  (double)real2Voxel->m[d][1] * displacement[1] +
+                  (double)real2Voxel->m[d][2] * displacement[2];
+            squaredNorm += voxelDisp * voxelDisp;
+         }
+         if(squaredNorm>rowMaxSquaredNorm[row])
+            rowMaxSquaredNorm[row]=squaredNorm;
+         ++index;
+      }
+   }
+   double maxSquaredNorm=0;
+   for(row=0; row<rowNumber; ++row)
+      if(rowMaxSquaredNorm[row]>maxSquaredNorm)
+         maxSquaredNorm=rowMaxSquaredNorm[row];
+   free(rowMaxSquaredNorm);
+   return sqrt(maxSquaredNorm);
+}
+/* *************************************************************** */
+template <class DTYPE>
+static void reg_defField_changeOrigin(nifti_image *inputField,
+                                      nifti_image *outputField,
+                                      mat44 *inputOrigin,
+                                      mat44 *outputOrigin,
+                                      double scaling)
+{
+   const size_t voxelNumber = (size_t)outputField->nx*outputField->ny*outputField->nz;
+   const int dimNumber = outputField->nu==2?2:3;
+   const mat44 inputMatrix = reg_defField_getOriginMatrix(outputField, inputOrigin);
+   const mat44 outputMatrix = reg_defField_getOriginMatrix(outputField, outputOrigin);
+
+   DTYPE *inPtr = static_cast<DTYPE *>(inputField->data);
+   DTYPE *outPtr = static_cast<DTYPE *>(outputField->data);
+
+   // The rows are distributed so that 2D fields are also processed in parallel
+   const int rowNumber = outputField->ny*outputField->nz;
+   int row, x, y, z, d;
+   size_t index;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(outputField, inputMatrix, outputMatrix, inPtr, outPtr, \
+   voxelNumber, dimNumber, rowNumber, scaling) \
+   private(row, x, y, z, d, index)
+#endif
+   for(row=0; row<rowNumber; ++row)
+   {
+      y = row % outputField->ny;
+      z = row / outputField->ny;
+      index = (size_t)row * outputField->nx;
+      for(x=0; x<outputField->nx; ++x)
+      {
+         for(d=0; d<dimNumber; ++d)
+         {
+            const double inPosition =
+                  (double)inputMatrix.m[d][0] * x +
+                  (double)inputMatrix.m[d][1] * y +
+                  (double)inputMatrix.m[d][2] * z +
+                  (double)inputMatrix.m[d][3];
+            const double outPosition =
+                  (double)outputMatrix.m[d][0] * x +
+                  (double)outputMatrix.m[d][1] * y +
+                  (double)outputMatrix.m[d][2] * z +
+                  (double)outputMatrix.m[d][3];
+            const size_t i = index + d*voxelNumber;
+            outPtr[i] = static_cast<DTYPE>(((double)inPtr[i] - inPosition) / scaling + outPosition);
+         }
+         ++index;
+      }
+   }
+}
+/* *************************************************************** */
+/* Internal routine: outputField = (inputField - inputOrigin) / scaling + outputOrigin
+ * in a single pass, where a NULL origin stands for the identity. Both fields
+ * share the same geometry and can be the same image */
+static void reg_defField_changeOrigin(nifti_image *inputField,
+                                      nifti_image *outputField,
+                                      mat44 *inputOrigin,
+                                      mat44 *outputOrigin,
+                                      double scaling)
+{
+   switch(outputField->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_defField_changeOrigin<float>(inputField,outputField,inputOrigin,outputOrigin,scaling);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_defField_changeOrigin<double>(inputField,outputField,inputOrigin,outputOrigin,scaling);
+      break;
+   default:
+      reg_print_fct_error("reg_defField_changeOrigin");
+      reg_print_msg_error("Only single or double floating precision have been implemented");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/* Internal routine: the number of squaring steps is the smallest one that
+ * scales the largest velocity down to half a voxel. At least 6 steps are
+ * used as the gradient exponentiation of reg_f3d2 is scaled by 2 to the
+ * power of the step number, which would otherwise change the balance with
+ * the regularisation */
+static int reg_defField_getSquaringNumber(nifti_image *flowFieldImage,
+                                          mat44 *affineOnly)
+{
+   double maxNorm=0;
+   switch(flowFieldImage->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      maxNorm=reg_defField_getMaxDisplacementNorm<float>(flowFieldImage,affineOnly);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      maxNorm=reg_defField_getMaxDisplacementNorm<double>(flowFieldImage,affineOnly);
+      break;
+   default:
+      reg_print_fct_error("reg_defField_getSquaringNumber");
+      reg_print_msg_error("Only single or double floating precision have been implemented");
+      reg_exit();
+   }
+   int squaringNumber=0;
+   // The step number is bounded in case of infinite velocity
+   while(maxNorm>0.5 && squaringNumber<32)
+   {
+      maxNorm *= 0.5;
+      ++squaringNumber;
+   }
+   return squaringNumber<6?6:squaringNumber;
+}
+/* *************************************************************** */
 void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
                                                    nifti_image *deformationFieldImage,
                                                    bool updateStepNumber)
@@ -4010,47 +4288,24 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
       reg_print_msg_error("The provide field is not a velocity field");
       reg_exit();
    }
-
-   // Remove the affine component from the flow field
-   nifti_image *affineOnly=NULL;
-   if(flowFieldImage->num_ext>0)
+   if(flowFieldImage->datatype!=deformationFieldImage->datatype ||
+         flowFieldImage->nvox!=deformationFieldImage->nvox)
    {
-      if(flowFieldImage->ext_list[0].edata!=NULL)
-      {
-         // Create a field that contains the affine component only
-         affineOnly = nifti_copy_nim_info(deformationFieldImage);
-         affineOnly->data = (void *)calloc(affineOnly->nvox,affineOnly->nbyper);
-         reg_affine_getDeformationField(reinterpret_cast<mat44 *>(flowFieldImage->ext_list[0].edata),
-               affineOnly,
-               false);
-         reg_tools_substractImageToImage(flowFieldImage,affineOnly,flowFieldImage);
-      }
+      reg_print_fct_error("reg_defField_getDeformationFieldFromFlowField");
+      reg_print_msg_error("The flow and deformation fields are expected to have the same size and type");
+      reg_exit();
    }
-   else reg_getDisplacementFromDeformation(flowFieldImage);
+
+   // The affine component of the flow field is removed instead of the identity
+   mat44 *affineOnly=NULL;
+   if(flowFieldImage->num_ext>0 && flowFieldImage->ext_list[0].edata!=NULL)
+      affineOnly=reinterpret_cast<mat44 *>(flowFieldImage->ext_list[0].edata);
 
    // Compute the number of scaling value to ensure unfolded transformation
-   int squaringNumber = 1;
+   int squaringNumber;
    if(updateStepNumber || flowFieldImage->intent_p2==0)
    {
-      // Check the largest value
-      float extrema = fabsf(reg_tools_getMinValue(flowFieldImage, -1));
-      float temp = reg_tools_getMaxValue(flowFieldImage, -1);
-      extrema=extrema>temp?extrema:temp;
-      // Check the values for scaling purpose
-      float maxLength;
-      if(deformationFieldImage->nz>1)
-         // 0.2888675 = sqrt(0.5^2/3)
-         maxLength=0.28;
-      // 0.3535533 = sqrt(0.5^2/2)
-      else maxLength=0.35;
-      while(true)
-      {
-         if( (extrema/pow(2.0f,squaringNumber)) >= maxLength)
-            squaringNumber++;
-         else break;
-      }
-      // The minimal number of step is set to 6 by default
-      squaringNumber=squaringNumber<6?6:squaringNumber;
+      squaringNumber=reg_defField_getSquaringNumber(flowFieldImage,affineOnly);
       // Set the number of squaring step in the flow field
       if(fabs(flowFieldImage->intent_p2)!=squaringNumber)
       {
@@ -4068,49 +4323,46 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
    }
    else squaringNumber=static_cast<int>(fabsf(flowFieldImage->intent_p2));
 
-   // The displacement field is scaled
-   float scalingValue = pow(2.0f,std::abs((float)squaringNumber));
+   // The backward deformation field is scaled down by a negative value
+   double scalingValue = pow(2.0,(double)squaringNumber);
    if(flowFieldImage->intent_p2<0)
-      // backward deformation field is scaled down
-      reg_tools_divideValueToImage(flowFieldImage,
-                                   flowFieldImage,
-                                   -scalingValue); // (/-scalingValue)
-   else
-      // forward deformation field is scaled down
-      reg_tools_divideValueToImage(flowFieldImage,
-                                   flowFieldImage,
-                                   scalingValue); // (/scalingValue)
-
-   // Conversion from displacement to deformation
-   reg_getDeformationFromDisplacement(flowFieldImage);
-
-   // The computed scaled deformation field is copied over
-   memcpy(deformationFieldImage->data, flowFieldImage->data,
-          deformationFieldImage->nvox*deformationFieldImage->nbyper);
+      scalingValue = -scalingValue;
+
+   // The flow field is used as workspace and every squaring step writes in the
+   // other field. The scaled field is stored so that the last step writes in
+   // the deformation field. It is converted from displacement to deformation
+   // while being scaled
+   nifti_image *currentField = squaringNumber%2==1?flowFieldImage:deformationFieldImage;
+   reg_defField_changeOrigin(flowFieldImage,
+                             currentField,
+                             affineOnly,
+                             NULL,
+                             scalingValue);
 
    // The deformation field is squared
-   for(unsigned short i=0; i<squaringNumber; ++i)
+   for(int i=0; i<squaringNumber; ++i)
    {
+      nifti_image *nextField = currentField==flowFieldImage?deformationFieldImage:flowFieldImage;
       // The deformation field is applied to itself
-      reg_defField_compose(deformationFieldImage,
-                           flowFieldImage,
-                           NULL);
-      // The computed scaled deformation field is copied over
-      memcpy(deformationFieldImage->data, flowFieldImage->data,
-             deformationFieldImage->nvox*deformationFieldImage->nbyper);
+      reg_defField_composeToBuffer(currentField,
+                                   currentField,
+                                   nextField->data,
+                                   NULL);
+      currentField=nextField;
 #ifndef NDEBUG
       char text[255];
-      sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber);
+      sprintf(text, "Squaring (composition) step %i/%i", i+1, squaringNumber);
       reg_print_msg_debug(text);
 #endif
    }
    // The affine conponent of the transformation is restored
    if(affineOnly!=NULL)
    {
-      reg_getDisplacementFromDeformation(deformationFieldImage);
-      reg_tools_addImageToImage(deformationFieldImage,affineOnly,deformationFieldImage);
-      nifti_image_free(affineOnly);
-      affineOnly=NULL;
+      reg_defField_changeOrigin(deformationFieldImage,
+                                deformationFieldImage,
+                                NULL,
+                                affineOnly,
+                                1.);
    }
    deformationFieldImage->intent_p1=DEF_FIELD;
    deformationFieldImage->intent_p2=0;
@@ -4125,7 +4377,8 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
 /* *************************************************************** */
 void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                             nifti_image *deformationFieldImage,
-                                            bool updateStepNumber)
+                                            bool updateStepNumber,
+                                            nifti_image *flowFieldWorkspace)
 {
    // Clean any extension in the deformation field as it is unexpected
    nifti_free_extensions(deformationFieldImage);
@@ -4143,14 +4396,26 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    }
    else if(velocityFieldGrid->intent_p1 == SPLINE_VEL_GRID)
    {
-      // Create an image to store the flow field
-      nifti_image *flowField = nifti_copy_nim_info(deformationFieldImage);
-      flowField->data = (void *)calloc(flowField->nvox,flowField->nbyper);
+      // Create an image to store the flow field unless a workspace is provided
+      nifti_image *flowField = flowFieldWorkspace;
+      if(flowField==NULL)
+      {
+         flowField = nifti_copy_nim_info(deformationFieldImage);
+         flowField->data = (void *)calloc(flowField->nvox,flowField->nbyper);
+      }
+      else if(flowField->datatype!=deformationFieldImage->datatype ||
+              flowField->nvox!=deformationFieldImage->nvox)
+      {
+         reg_print_fct_error("reg_spline_getDeformationFieldFromVelocityGrid");
+         reg_print_msg_error("The flow field workspace and the deformation field are expected to have the same size and type");
+         reg_exit();
+      }
       flowField->intent_code=NIFTI_INTENT_VECTOR;
       memset(flowField->intent_name, 0, 16);
       strcpy(flowField->intent_name,"NREG_TRANS");
       flowField->intent_p1=DEF_VEL_FIELD;
       flowField->intent_p2=velocityFieldGrid->intent_p2;
+      nifti_free_extensions(flowField);
       if(velocityFieldGrid->num_ext>0)
          nifti_copy_extensions(flowField, velocityFieldGrid);
 
@@ -4164,7 +4429,8 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
       // Update the number of step required. No action otherwise
       velocityFieldGrid->intent_p2=flowField->intent_p2;
       // Clear the allocated flow field
-      nifti_image_free(flowField);
+      if(flowFieldWorkspace==NULL)
+         nifti_image_free(flowField);
    }
    else
    {
@@ -4182,87 +4448,53 @@ void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGri
    // Check if the velocity field is actually a velocity field
    if(velocityFieldGrid->intent_p1 == SPLINE_VEL_GRID)
    {
-      // Create an image to store the flow field
-      nifti_image *flowFieldImage = nifti_copy_nim_info(deformationFieldImage[0]);
-      flowFieldImage->data = (void *)calloc(flowFieldImage->nvox,flowFieldImage->nbyper);
-      flowFieldImage->intent_code=NIFTI_INTENT_VECTOR;
-      memset(flowFieldImage->intent_name, 0, 16);
-      strcpy(flowFieldImage->intent_name,"NREG_TRANS");
-      flowFieldImage->intent_p1=DEF_VEL_FIELD;
-      flowFieldImage->intent_p2=velocityFieldGrid->intent_p2;
-      if(velocityFieldGrid->num_ext>0 && flowFieldImage->ext_list==NULL)
-         nifti_copy_extensions(flowFieldImage, velocityFieldGrid);
-
-      // Generate the velocity field
+      // The flow field is generated in the first deformation field
       reg_spline_getFlowFieldFromVelocityGrid(velocityFieldGrid,
-                                              flowFieldImage);
-      // Remove the affine component from the flow field
-      nifti_image *affineOnly=NULL;
-      if(flowFieldImage->num_ext>0)
-      {
-         if(flowFieldImage->ext_list[0].edata!=NULL)
-         {
-            // Create a field that contains the affine component only
-            affineOnly = nifti_copy_nim_info(deformationFieldImage[0]);
-            affineOnly->data = (void *)calloc(affineOnly->nvox,affineOnly->nbyper);
-            reg_affine_getDeformationField(reinterpret_cast<mat44 *>(flowFieldImage->ext_list[0].edata),
-                  affineOnly,
-                  false);
-            reg_tools_substractImageToImage(flowFieldImage,affineOnly,flowFieldImage);
-         }
-      }
-      else reg_getDisplacementFromDeformation(flowFieldImage);
+                                              deformationFieldImage[0]);
+      // The affine component of the flow field is removed instead of the identity
+      mat44 *affineOnly=NULL;
+      if(velocityFieldGrid->num_ext>0 && velocityFieldGrid->ext_list[0].edata!=NULL)
+         affineOnly=reinterpret_cast<mat44 *>(velocityFieldGrid->ext_list[0].edata);
 
       // Compute the number of scaling value to ensure unfolded transformation
       int squaringNumber = static_cast<int>(fabsf(velocityFieldGrid->intent_p2));
 
-      // The displacement field is scaled
-      float scalingValue = pow(2.0f,std::abs((float)squaringNumber));
+      // The displacement field is scaled and converted into a deformation
+      // field in place. The backward field is scaled down by a negative value
+      double scalingValue = pow(2.0,(double)squaringNumber);
       if(velocityFieldGrid->intent_p2<0)
-         // backward deformation field is scaled down
-         reg_tools_divideValueToImage(flowFieldImage,
-                                      deformationFieldImage[0],
-                                      -scalingValue); // (/-scalingValue)
-      else
-         // forward deformation field is scaled down
-         reg_tools_divideValueToImage(flowFieldImage,
-                                      deformationFieldImage[0],
-                                      scalingValue); // (/scalingValue)
-
-      // Clear the allocated flow field
-      nifti_image_free(flowFieldImage);
-      flowFieldImage=NULL;
-
-      // Conversion from displacement to deformation
-      reg_getDeformationFromDisplacement(deformationFieldImage[0]);
+         scalingValue = -scalingValue;
+      reg_defField_changeOrigin(deformationFieldImage[0],
+                                deformationFieldImage[0],
+                                affineOnly,
+                                NULL,
+                                scalingValue);
 
       // The deformation field is squared
-      for(unsigned short i=0; i<squaringNumber; ++i)
+      for(int i=0; i<squaringNumber; ++i)
       {
-         // The computed scaled deformation field is copied over
-         memcpy(deformationFieldImage[i+1]->data, deformationFieldImage[i]->data,
-               deformationFieldImage[i]->nvox*deformationFieldImage[i]->nbyper);
          // The deformation field is applied to itself
-         reg_defField_compose(deformationFieldImage[i], // to apply
-                              deformationFieldImage[i+1], // to update
-               NULL);
-   #ifndef NDEBUG
+         reg_defField_composeToBuffer(deformationFieldImage[i], // to apply
+                                      deformationFieldImage[i], // positions
+                                      deformationFieldImage[i+1]->data, // result
+                                      NULL);
+#ifndef NDEBUG
          char text[255];
-         sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber);
+         sprintf(text, "Squaring (composition) step %i/%i", i+1, squaringNumber);
          reg_print_msg_debug(text);
-   #endif
+#endif
       }
-      // The affine conponent of the transformation is restored
-      if(affineOnly!=NULL)
+      for(int i=0; i<=squaringNumber; ++i)
       {
-         for(unsigned short i=0; i<=squaringNumber; ++i){
-            reg_getDisplacementFromDeformation(deformationFieldImage[i]);
-            reg_tools_addImageToImage(deformationFieldImage[i],affineOnly,deformationFieldImage[i]);
-            deformationFieldImage[i]->intent_p1=DEF_FIELD;
-            deformationFieldImage[i]->intent_p2=0;
-         }
-         nifti_image_free(affineOnly);
-         affineOnly=NULL;
+         // The affine conponent of the transformation is restored
+         if(affineOnly!=NULL)
+            reg_defField_changeOrigin(deformationFieldImage[i],
+                                      deformationFieldImage[i],
+                                      NULL,
+                                      affineOnly,
+                                      1.);
+         deformationFieldImage[i]->intent_p1=DEF_FIELD;
+         deformationFieldImage[i]->intent_p2=0;
       }
       // If required an affine component is composed
       if(velocityFieldGrid->num_ext>1)
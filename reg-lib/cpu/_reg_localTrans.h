@@ -60,6 +60,11 @@ void reg_createSymmetricControlPointGrids(nifti_image **forwardGridImage,
  * the deformation is starting from a blank grid otherwise.
  * @param bspline A cubic B-Spline scheme is used if the value is set to true,
  * a cubic spline scheme is used otherwise (interpolant spline).
+ * @param force_no_lut Unused. It is kept for compatibility since the 3D
+ * field is now always evaluated one control point cell at a time.
+ * @param basisTable Basis values precomputed for the grid and the
+ * deformation field. They are used by the 3D cubic B-Spline evaluation
+ * when valid and ignored otherwise.
  */
 extern "C++"
 void reg_spline_getDeformationField(nifti_image *controlPointGridImage,
@@ -67,7 +72,8 @@ void reg_spline_getDeformationField(nifti_image *controlPointGridImage,
                                     int *mask = NULL,
                                     bool composition = false,
                                     bool bspline = true,
-                                    bool force_no_lut = false);
+                                    bool force_no_lut = false,
+                                    const reg_splineBasisTable *basisTable = NULL);
 /* *************************************************************** */
 /** @brief Upsample an image from voxel space to node space using
  * millimiter correspendences.
@@ -147,12 +153,31 @@ void reg_defField_compose(nifti_image *deformationField,
  * of the input deformation field
  * @param tolerance Tolerance value for the optimisation. Set to nan
  * for the default value.
+ * @param useNewton The inverse is computed with Newton's method using
+ * the Jacobian matrices of the input field, warm-started from the
+ * neighbouring voxels, instead of a simplex optimisation at every voxel.
+ * The tolerance is then the maximal distance in mm between the deformed
+ * inverse and the identity. The simplex optimisation is still used for
+ * the voxels where Newton's method does not converge, e.g. where the
+ * field folds.
  */
 extern "C++"
 void reg_defFieldInvert(nifti_image *inputDeformationField,
                         nifti_image *outputDeformationField,
-                        float tolerance);
+                        float tolerance,
+                        bool useNewton=false);
 /* *************************************************************** */
+/** @brief The deformation field is computed by exponentiating a flow
+ * field with the scaling-and-squaring approach
+ * @param flowFieldImage Velocity field. It is used as workspace and
+ * its content is overwritten
+ * @param deformationFieldImage Deformation field image with the same
+ * size and data type as the flow field
+ * @param updateStepNumber The number of squaring steps is chosen so
+ * that the largest scaled velocity is below half a voxel, with a minimum
+ * of 6 steps, if set to true. The number stored in the flow field is
+ * used otherwise
+ */
 extern "C++"
 void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
                                                    nifti_image *deformationFieldImage,
@@ -165,11 +190,18 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
  * parametrised using a grid of control points
  * @param deformationFieldImage Deformation field image that will
  * be filled using the exponentiation of the velocity field.
+ * @param updateStepNumber The number of squaring steps is updated from
+ * the largest velocity if set to true
+ * @param flowFieldWorkspace Image with the same size and data type as
+ * the deformation field, used to store the flow field and the squaring
+ * steps. Its content is overwritten. It is allocated and freed
+ * internally when set to NULL
  */
 extern "C++"
 void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                             nifti_image *deformationFieldImage,
-                                            bool updateStepNumber);
+                                            bool updateStepNumber,
+                                            nifti_image *flowFieldWorkspace=NULL);
 /* *************************************************************** */
 extern "C++"
 void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGrid,
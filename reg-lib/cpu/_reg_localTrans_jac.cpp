@@ -543,7 +543,8 @@ void reg_cubic_spline_jacobian3D(nifti_image *splineControlPoint,
                            mat33 *JacobianMatrices,
                            DTYPE *JacobianDeterminants,
                            bool approximation,
-                           bool useHeaderInformation)
+                           bool useHeaderInformation,
+                           const reg_splineBasisTable *basisTable=NULL)
 {
    if(JacobianMatrices==NULL && JacobianDeterminants==NULL)
    {
@@ -1006,7 +1007,7 @@ void reg_cubic_spline_jacobian3D(nifti_image *splineControlPoint,
 #ifdef _OPENMP
 #ifdef _USE_SSE
 #pragma omp parallel for default(none) \
-   shared(referenceImage, gridVoxelSpacing, splineControlPoint, \
+   shared(referenceImage, gridVoxelSpacing, splineControlPoint, basisTable, \
    coeffPtrX, coeffPtrY, coeffPtrZ,reorientation, JacobianMatrices, \
    JacobianDeterminants) \
    private(x, y, z, pre, oldPre, basis, val, \
@@ -1018,7 +1019,7 @@ void reg_cubic_spline_jacobian3D(nifti_image *splineControlPoint,
    tempX_x, tempX_y, tempX_z, tempY_x, tempY_y, tempY_z, tempZ_x, tempZ_y, tempZ_z)
 #else // _USE_SEE
 #pragma omp parallel for default(none) \
-   shared(referenceImage, gridVoxelSpacing, splineControlPoint, \
+   shared(referenceImage, gridVoxelSpacing, splineControlPoint, basisTable, \
    coeffPtrX, coeffPtrY, coeffPtrZ, reorientation, JacobianMatrices, \
    JacobianDeterminants) \
    private(x, y, z, pre, oldPre, basis, \
@@ -1033,18 +1034,28 @@ void reg_cubic_spline_jacobian3D(nifti_image *splineControlPoint,
             voxelIndex=z*referenceImage->nx*referenceImage->ny;
             oldPre[0]=oldPre[1]=oldPre[2]=999999;
 
-            pre[2]=(int)((DTYPE)z/gridVoxelSpacing[2]);
-            basis=(DTYPE)z/gridVoxelSpacing[2]-(DTYPE)pre[2];
-            if(basis<0.0) basis=0.0; //rounding error
-            get_BSplineBasisValues<DTYPE>(basis, zBasis, zFirst);
+            if(basisTable!=NULL)
+               pre[2]=basisTable->GetBasisValues<DTYPE>(2, z, zBasis, zFirst);
+            else
+            {
+               pre[2]=(int)((DTYPE)z/gridVoxelSpacing[2]);
+               basis=(DTYPE)z/gridVoxelSpacing[2]-(DTYPE)pre[2];
+               if(basis<0.0) basis=0.0; //rounding error
+               get_BSplineBasisValues<DTYPE>(basis, zBasis, zFirst);
+            }
 
             for(y=0; y<referenceImage->ny; y++)
             {
 
-               pre[1]=(int)((DTYPE)y/gridVoxelSpacing[1]);
-               basis=(DTYPE)y/gridVoxelSpacing[1]-(DTYPE)pre[1];
-               if(basis<0.0) basis=0.0; //rounding error
-               get_BSplineBasisValues<DTYPE>(basis, yBasis, yFirst);
+               if(basisTable!=NULL)
+                  pre[1]=basisTable->GetBasisValues<DTYPE>(1, y, yBasis, yFirst);
+               else
+               {
+                  pre[1]=(int)((DTYPE)y/gridVoxelSpacing[1]);
+                  basis=(DTYPE)y/gridVoxelSpacing[1]-(DTYPE)pre[1];
+                  if(basis<0.0) basis=0.0; //rounding error
+                  get_BSplineBasisValues<DTYPE>(basis, yBasis, yFirst);
+               }
 
 #if _USE_SSE
                val.f[0]=yBasis[0];
@@ -1081,10 +1092,15 @@ void reg_cubic_spline_jacobian3D(nifti_image *splineControlPoint,
                for(x=0; x<referenceImage->nx; x++)
                {
 
-                  pre[0]=(int)((DTYPE)x/gridVoxelSpacing[0]);
-                  basis=(DTYPE)x/gridVoxelSpacing[0]-(DTYPE)pre[0];
-                  if(basis<0.0) basis=0.0; //rounding error
-                  get_BSplineBasisValues<DTYPE>(basis, xBasis, xFirst);
+                  if(basisTable!=NULL)
+                     pre[0]=basisTable->GetBasisValues<DTYPE>(0, x, xBasis, xFirst);
+                  else
+                  {
+                     pre[0]=(int)((DTYPE)x/gridVoxelSpacing[0]);
+                     basis=(DTYPE)x/gridVoxelSpacing[0]-(DTYPE)pre[0];
+                     if(basis<0.0) basis=0.0; //rounding error
+                     get_BSplineBasisValues<DTYPE>(basis, xBasis, xFirst);
+                  }
 
 #if _USE_SSE
                   val.f[0]=xBasis[0];
@@ -1235,9 +1251,15 @@ extern "C++"
 double reg_spline_getJacobianPenaltyTerm(nifti_image *splineControlPoint,
                                          nifti_image *referenceImage,
                                          bool approximation,
-                                         bool useHeaderInformation
+                                         bool useHeaderInformation,
+                                         const reg_splineBasisTable *basisTable
                                          )
 {
+   // The precomputed basis values are only used if they match the reference image
+   if(basisTable!=NULL && (approximation || useHeaderInformation ||
+                           basisTable->IsValid(splineControlPoint, referenceImage)==false))
+      basisTable=NULL;
+
    // An array to store the Jacobian determinant is created
    size_t detNumber=0;
    if(approximation)
@@ -1250,7 +1272,7 @@ double reg_spline_getJacobianPenaltyTerm(nifti_image *splineControlPoint,
    else detNumber = (size_t)referenceImage->nx *
          referenceImage->ny * referenceImage->nz;
 
-   void *JacobianDetermiantArray=(void *)malloc(detNumber*splineControlPoint->nbyper);
+   void *JacobianDetermiantArray=reg_tools_trackedMalloc(detNumber*splineControlPoint->nbyper);
 
    // The jacobian determinants are computed
    if(splineControlPoint->nz==1)
@@ -1289,7 +1311,8 @@ double reg_spline_getJacobianPenaltyTerm(nifti_image *splineControlPoint,
                                       NULL,
                                       static_cast<float *>(JacobianDetermiantArray),
                                       approximation,
-                                      useHeaderInformation);
+                                      useHeaderInformation,
+                                      basisTable);
          break;
       case NIFTI_TYPE_FLOAT64:
          reg_cubic_spline_jacobian3D<double>(splineControlPoint,
@@ -1297,7 +1320,8 @@ double reg_spline_getJacobianPenaltyTerm(nifti_image *splineControlPoint,
                                        NULL,
                                        static_cast<double *>(JacobianDetermiantArray),
                                        approximation,
-                                       useHeaderInformation);
+                                       useHeaderInformation,
+                                       basisTable);
          break;
       default:
          reg_print_fct_error("reg_spline_getJacobianPenaltyTerm");
@@ -1340,7 +1364,7 @@ double reg_spline_getJacobianPenaltyTerm(nifti_image *splineControlPoint,
    }
    // The allocated array is free'ed
    if(JacobianDetermiantArray)
-      free(JacobianDetermiantArray);
+      reg_tools_trackedFree(JacobianDetermiantArray);
    JacobianDetermiantArray=NULL;
    // The penalty term value is normalised and returned
    return penaltySum/(double)detNumber;
@@ -1362,8 +1386,8 @@ void reg_spline_jacobianDetGradient2D(nifti_image *splineControlPoint,
    else arraySize = (size_t)referenceImage->nx *
          referenceImage->ny;
    // Allocate arrays to store determinants and matrices
-   mat33 *jacobianMatrices=(mat33 *)malloc(arraySize * sizeof(mat33));
-   DTYPE *jacobianDeterminant=(DTYPE *)malloc(arraySize * sizeof(DTYPE));
+   mat33 *jacobianMatrices=(mat33 *)reg_tools_trackedMalloc(arraySize * sizeof(mat33));
+   DTYPE *jacobianDeterminant=(DTYPE *)reg_tools_trackedMalloc(arraySize * sizeof(DTYPE));
 
    // Compute all the required Jacobian determinants and matrices
    reg_cubic_spline_jacobian2D<DTYPE>(splineControlPoint,
@@ -1582,8 +1606,8 @@ void reg_spline_jacobianDetGradient2D(nifti_image *splineControlPoint,
       }
    }
    // Allocated arrays are free'ed
-   free(jacobianMatrices);
-   free(jacobianDeterminant);
+   reg_tools_trackedFree(jacobianMatrices);
+   reg_tools_trackedFree(jacobianDeterminant);
 }
 /* *************************************************************** */
 template<class DTYPE>
@@ -1601,8 +1625,8 @@ void reg_spline_jacobianDetGradient3D(nifti_image *splineControlPoint,
    else arraySize = (size_t)referenceImage->nx *
          referenceImage->ny*referenceImage->nz;
    // Allocate arrays to store determinants and matrices
-   mat33 *jacobianMatrices=(mat33 *)malloc(arraySize * sizeof(mat33));
-   DTYPE *jacobianDeterminant=(DTYPE *)malloc(arraySize * sizeof(DTYPE));
+   mat33 *jacobianMatrices=(mat33 *)reg_tools_trackedMalloc(arraySize * sizeof(mat33));
+   DTYPE *jacobianDeterminant=(DTYPE *)reg_tools_trackedMalloc(arraySize * sizeof(DTYPE));
 
    // Compute all the required Jacobian determinants and matrices
    reg_cubic_spline_jacobian3D<DTYPE>(splineControlPoint,
@@ -1867,8 +1891,8 @@ void reg_spline_jacobianDetGradient3D(nifti_image *splineControlPoint,
       }
    }
    // Allocated arrays are free'ed
-   free(jacobianMatrices);
-   free(jacobianDeterminant);
+   reg_tools_trackedFree(jacobianMatrices);
+   reg_tools_trackedFree(jacobianDeterminant);
 }
 /* *************************************************************** */
 extern "C++"
@@ -1961,8 +1985,8 @@ double reg_spline_correctFolding2D(nifti_image *splineControlPoint,
       jacobianNumber = (size_t)(splineControlPoint->nx-2)*(splineControlPoint->ny-2);
    else jacobianNumber = (size_t)referenceImage->nx*referenceImage->ny;
 #endif
-   mat33 *jacobianMatrices=(mat33 *)malloc(jacobianNumber*sizeof(mat33));
-   DTYPE *jacobianDeterminant=(DTYPE *)malloc(jacobianNumber*sizeof(DTYPE));
+   mat33 *jacobianMatrices=(mat33 *)reg_tools_trackedMalloc(jacobianNumber*sizeof(mat33));
+   DTYPE *jacobianDeterminant=(DTYPE *)reg_tools_trackedMalloc(jacobianNumber*sizeof(DTYPE));
 
    reg_cubic_spline_jacobian2D(splineControlPoint,
                          referenceImage,
@@ -1990,8 +2014,8 @@ double reg_spline_correctFolding2D(nifti_image *splineControlPoint,
    }
    if(penaltyTerm==penaltyTerm)
    {
-      free(jacobianDeterminant);
-      free(jacobianMatrices);
+      reg_tools_trackedFree(jacobianDeterminant);
+      reg_tools_trackedFree(jacobianMatrices);
       return penaltyTerm/(double)(jacobianNumber);
    }
 
@@ -2187,8 +2211,8 @@ double reg_spline_correctFolding2D(nifti_image *splineControlPoint,
          }
       }
    }
-   free(jacobianDeterminant);
-   free(jacobianMatrices);
+   reg_tools_trackedFree(jacobianDeterminant);
+   reg_tools_trackedFree(jacobianMatrices);
    return std::numeric_limits<double>::quiet_NaN();
 }
 /* *************************************************************** */
@@ -2211,8 +2235,8 @@ double reg_spline_correctFolding3D(nifti_image *splineControlPoint,
       jacobianNumber = (size_t)(splineControlPoint->nx-2)*(splineControlPoint->ny-2)*(splineControlPoint->nz-2);
    else jacobianNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
 #endif
-   mat33 *jacobianMatrices=(mat33 *)malloc(jacobianNumber*sizeof(mat33));
-   DTYPE *jacobianDeterminant=(DTYPE *)malloc(jacobianNumber*sizeof(DTYPE));
+   mat33 *jacobianMatrices=(mat33 *)reg_tools_trackedMalloc(jacobianNumber*sizeof(mat33));
+   DTYPE *jacobianDeterminant=(DTYPE *)reg_tools_trackedMalloc(jacobianNumber*sizeof(DTYPE));
 
    reg_cubic_spline_jacobian3D(splineControlPoint,
                          referenceImage,
@@ -2240,8 +2264,8 @@ double reg_spline_correctFolding3D(nifti_image *splineControlPoint,
    }
    if(penaltyTerm==penaltyTerm)
    {
-      free(jacobianDeterminant);
-      free(jacobianMatrices);
+      reg_tools_trackedFree(jacobianDeterminant);
+      reg_tools_trackedFree(jacobianMatrices);
       return penaltyTerm/(double)(jacobianNumber);
    }
 
@@ -2481,8 +2505,8 @@ double reg_spline_correctFolding3D(nifti_image *splineControlPoint,
          }
       }
    }
-   free(jacobianDeterminant);
-   free(jacobianMatrices);
+   reg_tools_trackedFree(jacobianDeterminant);
+   reg_tools_trackedFree(jacobianMatrices);
    return std::numeric_limits<double>::quiet_NaN();
 }
 /* *************************************************************** */
@@ -2627,8 +2651,16 @@ void reg_spline_GetJacobianMap(nifti_image *splineControlPoint,
 /* *************************************************************** */
 void reg_spline_GetJacobianMatrix(nifti_image *referenceImage,
                                   nifti_image *splineControlPoint,
-                                  mat33 *jacobianMatrices)
+                                  mat33 *jacobianMatrices,
+                                  const reg_splineBasisTable *basisTable)
 {
+   // The header information is not required if the precomputed basis values
+   // match the reference image, the grid being then aligned with it
+   bool useHeaderInformation=true;
+   if(basisTable!=NULL && basisTable->IsValid(splineControlPoint, referenceImage))
+      useHeaderInformation=false;
+   else basisTable=NULL;
+
    if(splineControlPoint->nz==1)
    {
       switch(splineControlPoint->datatype)
@@ -2665,7 +2697,8 @@ void reg_spline_GetJacobianMatrix(nifti_image *referenceImage,
                                       jacobianMatrices,
                                       NULL,
                                       false,
-                                      true);
+                                      useHeaderInformation,
+                                      basisTable);
          break;
       case NIFTI_TYPE_FLOAT64:
          reg_cubic_spline_jacobian3D<double>(splineControlPoint,
@@ -2673,7 +2706,8 @@ void reg_spline_GetJacobianMatrix(nifti_image *referenceImage,
                                        jacobianMatrices,
                                        NULL,
                                        false,
-                                       true);
+                                       useHeaderInformation,
+                                       basisTable);
          break;
       default:
          reg_print_fct_error("reg_spline_GetJacobianMatrix");
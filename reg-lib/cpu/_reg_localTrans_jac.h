@@ -35,12 +35,15 @@ void reg_spline_GetJacobianMap(nifti_image *controlPointGridImage,
  * @param approx Approximate the average Jacobian determinant by using
  * only the information from the control point if the value is set to true;
  * all voxels are considered if the value is set to false.
+ * @param basisTable Basis values precomputed for the grid and the reference
+ * image. They are used when all voxels are considered and ignored otherwise.
  */
 extern "C++"
 double reg_spline_getJacobianPenaltyTerm(nifti_image *controlPointGridImage,
                                          nifti_image *referenceImage,
                                          bool approx,
-                                         bool useHeaderInformation=false
+                                         bool useHeaderInformation=false,
+                                         const reg_splineBasisTable *basisTable=NULL
       );
 /* *************************************************************** */
 /** @brief Compute the gradient at every control point position of the
@@ -77,11 +80,15 @@ void reg_spline_getJacobianPenaltyTermGradient(nifti_image *controlPointGridImag
  * the cubic B-Spline parametrisation
  * @param jacobianImage Array that is filled with the Jacobian matrices
  * for every voxel.
+ * @param basisTable Basis values precomputed for the grid and the reference
+ * image. When valid, the grid is assumed to be aligned with the reference
+ * image and the header information is not used.
  */
 extern "C++"
 void reg_spline_GetJacobianMatrix(nifti_image *referenceImage,
                                   nifti_image *controlPointGridImage,
-                                  mat33 *jacobianImage
+                                  mat33 *jacobianImage,
+                                  const reg_splineBasisTable *basisTable=NULL
                                   );
 /* *************************************************************** */
 /** @brief Correct the folding in the transformation parametrised through
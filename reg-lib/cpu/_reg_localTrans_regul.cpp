@@ -539,6 +539,138 @@ void reg_spline_approxBendingEnergyGradient(nifti_image *splineControlPoint,
    }
 }
 /* *************************************************************** */
+template <class DTYPE>
+void reg_spline_approxBendingEnergyCentralDifferences3D(nifti_image *splineControlPoint,
+                                                        nifti_image *gradientImage,
+                                                        float weight,
+                                                        float step)
+{
+   int nx=splineControlPoint->nx, ny=splineControlPoint->ny, nz=splineControlPoint->nz;
+   int nodeNumber = nx*ny*nz;
+   int a, b, c, x, y, z, X, Y, Z, i, index, node, comp, s;
+
+   // Create pointers to the spline coefficients and gradient values
+   DTYPE *splinePtr = static_cast<DTYPE *>(splineControlPoint->data);
+   DTYPE *gradientPtr = static_cast<DTYPE *>(gradientImage->data);
+
+   // get the constant basis values
+   DTYPE basisXX[27], basisYY[27], basisZZ[27], basisXY[27], basisYZ[27], basisXZ[27];
+   set_second_order_bspline_basis_values(basisXX, basisYY, basisZZ, basisXY, basisYZ, basisXZ);
+   DTYPE *basis[6]= {basisXX, basisYY, basisZZ, basisXY, basisYZ, basisXZ};
+   // The cross derivatives are counted twice in the bending energy
+   double basisFactor[6]= {1., 1., 1., 2., 2., 2.};
+
+   // The second order derivatives of every component are computed once for
+   // the nodes where the bending energy is evaluated
+   DTYPE *derivativeValues = (DTYPE *)calloc(18*nodeNumber, sizeof(DTYPE));
+   DTYPE *derivativePtr;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, nz, nodeNumber, splinePtr, basis, derivativeValues) \
+   private(x, y, z, a, b, c, i, index, comp, derivativePtr)
+#endif
+   for(z=1; z<nz-1; ++z)
+   {
+      for(y=1; y<ny-1; ++y)
+      {
+         for(x=1; x<nx-1; ++x)
+         {
+            derivativePtr = &derivativeValues[18*((z*ny+y)*nx+x)];
+            i=0;
+            for(c=-1; c<2; c++){
+               for(b=-1; b<2; b++){
+                  for(a=-1; a<2; a++){
+                     index = ((z+c)*ny+y+b)*nx+x+a;
+                     for(comp=0; comp<3; ++comp)
+                        for(int d=0; d<6; ++d)
+                           derivativePtr[6*comp+d] += basis[d][i]*splinePtr[comp*nodeNumber+index];
+                     ++i;
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   // The energy of a node only depends on its 3x3x3 neighbourhood. The central
+   // differences are thus computed from the energy of the neighbours only
+   double approxRatio = (double)weight / (double)splineControlPoint->nvox;
+   double energy[2], value;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, nz, nodeNumber, basis, basisFactor, derivativeValues, gradientPtr, \
+   approxRatio, step) \
+   private(node, x, y, z, X, Y, Z, i, comp, s, derivativePtr, energy, value)
+#endif
+   for(node=0; node<nodeNumber; ++node)
+   {
+      x=node%nx;
+      y=(node/nx)%ny;
+      z=node/(nx*ny);
+      for(comp=0; comp<3; ++comp)
+      {
+         for(s=0; s<2; ++s)
+         {
+            energy[s]=0.;
+            for(Z=z-1; Z<z+2; Z++){
+               for(Y=y-1; Y<y+2; Y++){
+                  for(X=x-1; X<x+2; X++){
+                     if(X<1 || Y<1 || Z<1 || X>nx-2 || Y>ny-2 || Z>nz-2)
+                        continue;
+                     // Index of the perturbed node in the neighbourhood of (X,Y,Z)
+                     i=((z-Z+1)*3+y-Y+1)*3+x-X+1;
+                     derivativePtr = &derivativeValues[18*((Z*ny+Y)*nx+X)+6*comp];
+                     // Only the terms of the perturbed component are modified
+                     for(int d=0; d<6; ++d)
+                     {
+                        value = (double)derivativePtr[d] + (s==0?step:-step) * (double)basis[d][i];
+                        energy[s] += basisFactor[d] * value * value;
+                     }
+                  }
+               }
+            }
+         }
+         gradientPtr[comp*nodeNumber+node] += (DTYPE)(approxRatio * (energy[0]-energy[1]) / (2.0*step));
+      }
+   }
+   free(derivativeValues);
+}
+/* *************************************************************** */
+extern "C++"
+void reg_spline_approxBendingEnergyCentralDifferences(nifti_image *splineControlPoint,
+                                                      nifti_image *gradientImage,
+                                                      float weight,
+                                                      float step)
+{
+   if(splineControlPoint->datatype != gradientImage->datatype)
+   {
+      reg_print_fct_error("reg_spline_approxBendingEnergyCentralDifferences");
+      reg_print_msg_error("The input images are expected to have the same type");
+      reg_exit();
+   }
+   if(splineControlPoint->nz==1)
+   {
+      reg_print_fct_error("reg_spline_approxBendingEnergyCentralDifferences");
+      reg_print_msg_error("Only implemented for 3D control point grids");
+      reg_exit();
+   }
+   switch(splineControlPoint->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_spline_approxBendingEnergyCentralDifferences3D<float>
+            (splineControlPoint, gradientImage, weight, step);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_spline_approxBendingEnergyCentralDifferences3D<double>
+            (splineControlPoint, gradientImage, weight, step);
+      break;
+   default:
+      reg_print_fct_error("reg_spline_approxBendingEnergyCentralDifferences");
+      reg_print_msg_error("Only implemented for single or double precision images");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 template <class DTYPE>
 double reg_spline_approxLinearEnergyValue2D(nifti_image *splineControlPoint)
@@ -618,6 +750,29 @@ double reg_spline_approxLinearEnergyValue2D(nifti_image *splineControlPoint)
    return constraintValue / static_cast<double>(splineControlPoint->nvox);
 }
 /* *************************************************************** */
+/// @brief Return the linear energy of a node from its position derivatives
+static double reg_spline_approxLinearEnergyNodeValue(mat33 matrix,
+                                                     const mat33 &reorientation)
+{
+   // Convert from mm to voxel
+   matrix = nifti_mat33_mul(reorientation, matrix);
+   // Removing the rotation component
+   mat33 R = nifti_mat33_inverse(nifti_mat33_polar(matrix));
+   matrix = nifti_mat33_mul(R, matrix);
+   // Convert to displacement
+   --matrix.m[0][0];
+   --matrix.m[1][1];
+   --matrix.m[2][2];
+
+   double value = 0.;
+   for(int b=0; b<3; b++){
+      for(int a=0; a<3; a++){
+         value += reg_pow2(0.5*(matrix.m[a][b]+matrix.m[b][a])); // symmetric part
+      }
+   }
+   return value;
+}
+/* *************************************************************** */
 template <class DTYPE>
 double reg_spline_approxLinearEnergyValue3D(nifti_image *splineControlPoint)
 {
@@ -626,7 +781,6 @@ double reg_spline_approxLinearEnergyValue3D(nifti_image *splineControlPoint)
    int a, b, c, x, y, z, i, index;
 
    double constraintValue = 0.;
-   double currentValue;
 
    // Create pointers to the spline coefficients
    DTYPE *splinePtrX = static_cast<DTYPE *>(splineControlPoint->data);
@@ -642,7 +796,7 @@ double reg_spline_approxLinearEnergyValue3D(nifti_image *splineControlPoint)
    DTYPE splineCoeffY;
    DTYPE splineCoeffZ;
 
-   mat33 matrix, R;
+   mat33 matrix;
 
    // Matrix to use to convert the gradient from mm to voxel
    mat33 reorientation;
@@ -654,8 +808,8 @@ double reg_spline_approxLinearEnergyValue3D(nifti_image *splineControlPoint)
 #pragma omp parallel for default(none) \
    shared(splinePtrX, splinePtrY, splinePtrZ, splineControlPoint, \
    basisX, basisY, basisZ, reorientation) \
-   private(x, y, z, a, b, c, i, index, matrix, R, \
-   splineCoeffX, splineCoeffY, splineCoeffZ, currentValue) \
+   private(x, y, z, a, b, c, i, index, matrix, \
+   splineCoeffX, splineCoeffY, splineCoeffZ) \
    reduction(+:constraintValue)
 #endif
    for(z=1; z<splineControlPoint->nz-1; ++z){
@@ -688,23 +842,7 @@ double reg_spline_approxLinearEnergyValue3D(nifti_image *splineControlPoint)
                   }
                }
             }
-            // Convert from mm to voxel
-            matrix = nifti_mat33_mul(reorientation, matrix);
-            // Removing the rotation component
-            R = nifti_mat33_inverse(nifti_mat33_polar(matrix));
-            matrix = nifti_mat33_mul(R, matrix);
-            // Convert to displacement
-            --matrix.m[0][0];
-            --matrix.m[1][1];
-            --matrix.m[2][2];
-
-            currentValue = 0.;
-            for(b=0; b<3; b++){
-               for(a=0; a<3; a++){
-                  currentValue += reg_pow2(0.5*(matrix.m[a][b]+matrix.m[b][a])); // symmetric part
-               }
-            }
-            constraintValue += currentValue;
+            constraintValue += reg_spline_approxLinearEnergyNodeValue(matrix, reorientation);
          }
       }
    }
@@ -1525,6 +1663,144 @@ void reg_spline_approxLinearEnergyGradient(nifti_image *splineControlPoint,
    }
 }
 /* *************************************************************** */
+template <class DTYPE>
+void reg_spline_approxLinearEnergyCentralDifferences3D(nifti_image *splineControlPoint,
+                                                       nifti_image *gradientImage,
+                                                       float weight,
+                                                       float step)
+{
+   int nx=splineControlPoint->nx, ny=splineControlPoint->ny, nz=splineControlPoint->nz;
+   int nodeNumber = nx*ny*nz;
+   int a, b, c, x, y, z, X, Y, Z, i, index, node, comp, s;
+
+   // Create pointers to the spline coefficients and gradient values
+   DTYPE *splinePtr = static_cast<DTYPE *>(splineControlPoint->data);
+   DTYPE *gradientPtr = static_cast<DTYPE *>(gradientImage->data);
+
+   // Store the basis values since they are constant as the value is approximated
+   // at the control point positions only
+   DTYPE basisX[27], basisY[27], basisZ[27];
+   set_first_order_basis_values(basisX, basisY, basisZ);
+
+   // Matrix to use to convert the gradient from mm to voxel
+   mat33 reorientation;
+   if(splineControlPoint->sform_code>0)
+      reorientation = reg_mat44_to_mat33(&splineControlPoint->sto_ijk);
+   else reorientation = reg_mat44_to_mat33(&splineControlPoint->qto_ijk);
+
+   // The first order derivatives are computed once for the nodes where the
+   // linear energy is evaluated
+   mat33 *matrices = (mat33 *)calloc(nodeNumber, sizeof(mat33));
+   mat33 *matrix;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, nz, nodeNumber, splinePtr, basisX, basisY, basisZ, matrices) \
+   private(x, y, z, a, b, c, i, index, comp, matrix)
+#endif
+   for(z=1; z<nz-1; ++z)
+   {
+      for(y=1; y<ny-1; ++y)
+      {
+         for(x=1; x<nx-1; ++x)
+         {
+            matrix = &matrices[(z*ny+y)*nx+x];
+            i=0;
+            for(c=-1; c<2; c++){
+               for(b=-1; b<2; b++){
+                  for(a=-1; a<2; a++){
+                     index = ((z+c)*ny+y+b)*nx+x+a;
+                     for(comp=0; comp<3; ++comp)
+                     {
+                        matrix->m[0][comp] += basisX[i]*splinePtr[comp*nodeNumber+index];
+                        matrix->m[1][comp] += basisY[i]*splinePtr[comp*nodeNumber+index];
+                        matrix->m[2][comp] += basisZ[i]*splinePtr[comp*nodeNumber+index];
+                     }
+                     ++i;
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   // The energy of a node only depends on its 3x3x3 neighbourhood. The central
+   // differences are thus computed from the energy of the neighbours only
+   double approxRatio = (double)weight / (double)splineControlPoint->nvox;
+   double energy[2];
+   mat33 perturbed;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, nz, nodeNumber, basisX, basisY, basisZ, matrices, reorientation, \
+   gradientPtr, approxRatio, step) \
+   private(node, x, y, z, X, Y, Z, i, comp, s, energy, perturbed)
+#endif
+   for(node=0; node<nodeNumber; ++node)
+   {
+      x=node%nx;
+      y=(node/nx)%ny;
+      z=node/(nx*ny);
+      for(comp=0; comp<3; ++comp)
+      {
+         for(s=0; s<2; ++s)
+         {
+            energy[s]=0.;
+            for(Z=z-1; Z<z+2; Z++){
+               for(Y=y-1; Y<y+2; Y++){
+                  for(X=x-1; X<x+2; X++){
+                     if(X<1 || Y<1 || Z<1 || X>nx-2 || Y>ny-2 || Z>nz-2)
+                        continue;
+                     // Index of the perturbed node in the neighbourhood of (X,Y,Z)
+                     i=((z-Z+1)*3+y-Y+1)*3+x-X+1;
+                     perturbed = matrices[(Z*ny+Y)*nx+X];
+                     perturbed.m[0][comp] += (s==0?step:-step) * basisX[i];
+                     perturbed.m[1][comp] += (s==0?step:-step) * basisY[i];
+                     perturbed.m[2][comp] += (s==0?step:-step) * basisZ[i];
+                     energy[s] += reg_spline_approxLinearEnergyNodeValue(perturbed, reorientation);
+                  }
+               }
+            }
+         }
+         gradientPtr[comp*nodeNumber+node] += (DTYPE)(approxRatio * (energy[0]-energy[1]) / (2.0*step));
+      }
+   }
+   free(matrices);
+}
+/* *************************************************************** */
+extern "C++"
+void reg_spline_approxLinearEnergyCentralDifferences(nifti_image *splineControlPoint,
+                                                     nifti_image *gradientImage,
+                                                     float weight,
+                                                     float step)
+{
+   if(splineControlPoint->datatype != gradientImage->datatype)
+   {
+      reg_print_fct_error("reg_spline_approxLinearEnergyCentralDifferences");
+      reg_print_msg_error("The input images are expected to have the same type");
+      reg_exit();
+   }
+   if(splineControlPoint->nz==1)
+   {
+      reg_print_fct_error("reg_spline_approxLinearEnergyCentralDifferences");
+      reg_print_msg_error("Only implemented for 3D control point grids");
+      reg_exit();
+   }
+   switch(splineControlPoint->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_spline_approxLinearEnergyCentralDifferences3D<float>
+            (splineControlPoint, gradientImage, weight, step);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_spline_approxLinearEnergyCentralDifferences3D<double>
+            (splineControlPoint, gradientImage, weight, step);
+      break;
+   default:
+      reg_print_fct_error("reg_spline_approxLinearEnergyCentralDifferences");
+      reg_print_msg_error("Only implemented for single or double precision images");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 template <class DTYPE>
 double reg_defField_linearEnergyValue2D(nifti_image *deformationField)
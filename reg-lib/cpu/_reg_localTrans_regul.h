@@ -41,6 +41,25 @@ void reg_spline_approxBendingEnergyGradient(nifti_image *controlPointGridImage,
                                             float weight
                                             );
 /* *************************************************************** */
+/** @brief Compute the central differences of the approximated bending energy
+ * with respect to every control point coordinate. As the energy of a node
+ * only depends on its 3x3x3 neighbourhood, only the energy of the neighbours
+ * of the perturbed node is recomputed. Only implemented for 3D grids.
+ * @param controlPointGridImage Image that contains the control point
+ * grid used to parametrise the transformation
+ * @param gradientImage Image of identical size that the control
+ * point grid image. The central differences will be added at every
+ * control point position.
+ * @param weight Scalar which will be multiplied by the central differences
+ * @param step Perturbation applied to every control point coordinate
+ */
+extern "C++"
+void reg_spline_approxBendingEnergyCentralDifferences(nifti_image *controlPointGridImage,
+                                                      nifti_image *gradientImage,
+                                                      float weight,
+                                                      float step
+                                                      );
+/* *************************************************************** */
 /** @brief Compute and return the linear elastic energy terms.
  * @param controlPointGridImage Image that contains the transformation
  * parametrisation
@@ -93,6 +112,24 @@ void reg_spline_approxLinearEnergyGradient(nifti_image *controlPointGridImage,
                                            float weight
                                            );
 /* *************************************************************** */
+/** @brief Compute the central differences of the linear elastic energy terms
+ * approximated at the control point positions only, with respect to every
+ * control point coordinate. Only the energy of the 3x3x3 neighbours of the
+ * perturbed node is recomputed. Only implemented for 3D grids.
+ * @param controlPointGridImage Image that contains the transformation
+ * parametrisation
+ * @param gradientImage Image of similar size than the control point
+ * grid. The central differences are added to the current values
+ * @param weight Weight to apply to the term of the penalty
+ * @param step Perturbation applied to every control point coordinate
+ */
+extern "C++"
+void reg_spline_approxLinearEnergyCentralDifferences(nifti_image *controlPointGridImage,
+                                                     nifti_image *gradientImage,
+                                                     float weight,
+                                                     float step
+                                                     );
+/* *************************************************************** */
 /** @brief Compute and return the linear elastic energy terms.
  * @param deformationField Image that contains the transformation.
  * @return The normalised linear energy. Normalised by the number of voxel
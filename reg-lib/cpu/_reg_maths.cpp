@@ -977,6 +977,39 @@ double get_square_distance2D(float * first_point2D, float * second_point2D) {
           reg_pow2(first_point2D[1] - second_point2D[1]));
 }
 /* *************************************************************** */
+static int reg_detectSIMDLevel()
+{
+#if defined(_USE_AVX) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return NR_SIMD_AVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return NR_SIMD_AVX2;
+#endif
+    return NR_SIMD_NONE;
+}
+static int reg_simdLevel = -1;
+/* *************************************************************** */
+int reg_getSIMDLevel()
+{
+    int level;
+    // The level is detected on first use, which can happen in concurrent code
+#pragma omp critical(reg_simdLevel)
+    {
+        if(reg_simdLevel<0)
+            reg_simdLevel = reg_detectSIMDLevel();
+        level = reg_simdLevel;
+    }
+    return level;
+}
+/* *************************************************************** */
+void reg_setSIMDLevel(int level)
+{
+    int hostLevel = reg_detectSIMDLevel();
+#pragma omp critical(reg_simdLevel)
+    reg_simdLevel = level<hostLevel ? (level<NR_SIMD_NONE ? NR_SIMD_NONE : level) : hostLevel;
+}
+/* *************************************************************** */
 // Calculate pythagorean distance
 template<class T>
 T pythag(T a, T b)
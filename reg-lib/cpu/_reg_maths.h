@@ -43,6 +43,13 @@ typedef enum
    LIN_SPLINE_GRID
 } NREG_TRANS_TYPE;
 
+typedef enum
+{
+   NR_SIMD_NONE,
+   NR_SIMD_AVX2,
+   NR_SIMD_AVX512
+} NREG_SIMD_TYPE;
+
 /* *************************************************************** */
 #define reg_pow2(a) ((a)*(a))
 #define reg_ceil(a) (ceil(a))
@@ -276,4 +283,18 @@ double get_square_distance3D(float * first_point3D, float * second_point3D);
 /* *************************************************************** */
 double get_square_distance2D(float * first_point2D, float * second_point2D);
 /* *************************************************************** */
+/** @brief Return the widest vector instruction set that can be used by
+ * the explicitly vectorised kernels. The host CPU is queried on the first
+ * call and the result can be capped using reg_setSIMDLevel.
+ * @return NR_SIMD_NONE, NR_SIMD_AVX2 or NR_SIMD_AVX512
+ */
+int reg_getSIMDLevel();
+/* *************************************************************** */
+/** @brief Restrict the vector instruction set used by the explicitly
+ * vectorised kernels. A level higher than the one supported by the host
+ * is ignored. NR_SIMD_NONE forces the scalar implementations.
+ * @param level Highest level to use
+ */
+void reg_setSIMDLevel(int level);
+/* *************************************************************** */
 #endif // _REG_MATHS_H
@@ -67,6 +67,26 @@ public:
    }
    /// @brief Here
    virtual void GetDiscretisedValue(nifti_image *, float *, int , int) {}
+   /// @brief Returns true if the measure value can be updated from a region
+   /// of the warped floating image using GetRegionSimilarityMeasureValue
+   virtual bool IsLocallyDecomposable()
+   {
+      return false;
+   }
+   /** @brief Returns the measure value obtained when the intensities of a region
+    * of the warped floating image are replaced, without modifying the object.
+    * The value is updated from the last call to GetSimilarityMeasureValue and
+    * the function can thus be called concurrently.
+    * @param warpedRegion Image that contains the new warped intensities of the region
+    * @param regionVoxels Index in the reference image of every voxel of the region
+    */
+   virtual double GetRegionSimilarityMeasureValue(nifti_image *, const size_t *)
+   {
+      reg_print_fct_error("reg_measure::GetRegionSimilarityMeasureValue");
+      reg_print_msg_error("The measure value can not be updated from a region");
+      reg_exit();
+      return 0.;
+   }
    void SetTimepointWeight(int timepoint, double weight)
    {
       this->timePointWeight[timepoint]=weight;
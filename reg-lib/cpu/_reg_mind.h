@@ -46,6 +46,11 @@ public:
    virtual double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based gradient
    virtual void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief The descriptors depend on a neighbourhood of every voxel
+   virtual bool IsLocallyDecomposable()
+   {
+      return false;
+   }
    /// @brief
    void SetDescriptorOffset(int);
    int GetDescriptorOffset();
@@ -283,6 +283,17 @@ void reg_getNMIValue(nifti_image *referenceImage,
    size_t voxelNumber = (size_t)referenceImage->nx *
          referenceImage->ny *
          referenceImage->nz;
+   // Each thread fills its own joint histogram over a contiguous range of
+   // voxels. The histograms only store integer counts so that their sum
+   // does not depend on the number of thread nor on the summation order
+   int threadNumber=1;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   int tid, r, f, it, index;
+   size_t voxel, voxelStart, voxelEnd;
+   double value, valPro, valLog;
+   double *ptrHisto;
    // Iterate over all active time points
    for(int t=0; t<referenceImage->nt; ++t)
    {
@@ -293,153 +304,233 @@ void reg_getNMIValue(nifti_image *referenceImage,
          sprintf(text, "Computing NMI for time point %i",t);
          reg_print_msg_debug(text);
 #endif
+         int refBinNumber = referenceBinNumber[t];
+         int floBinNumber = floatingBinNumber[t];
+         int jointBinNumber = refBinNumber * floBinNumber;
          // Define some pointers to the current histograms
          double *jointHistoProPtr = jointhistogramPro[t];
          double *jointHistoLogPtr = jointHistogramLog[t];
-         // Empty the joint histogram
-         memset(jointHistoProPtr,0,totalBinNumber[t]*sizeof(double));
+         // Allocate the per-thread histograms and the per-row partial sums
+         double *threadHistoPtr = (double *)calloc((size_t)threadNumber*jointBinNumber,
+                                                   sizeof(double));
+         double *rowSumPtr = (double *)malloc(floBinNumber*sizeof(double));
          // Fill the joint histograms using an approximation
          DTYPE *refPtr = &refImagePtr[t*voxelNumber];
          DTYPE *warPtr = &warImagePtr[t*voxelNumber];
-         for(size_t voxel=0; voxel<voxelNumber; ++voxel)
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(threadNumber, voxelNumber, threadHistoPtr, jointBinNumber, referenceMask, \
+   refPtr, warPtr, refBinNumber, floBinNumber) \
+   private(tid, voxel, voxelStart, voxelEnd, ptrHisto)
+#endif // _OPENMP
+         for(tid=0; tid<threadNumber; ++tid)
          {
-            if(referenceMask[voxel]>-1)
+            voxelStart = voxelNumber * tid / threadNumber;
+            voxelEnd = voxelNumber * (tid+1) / threadNumber;
+            ptrHisto = &threadHistoPtr[(size_t)tid*jointBinNumber];
+            for(voxel=voxelStart; voxel<voxelEnd; ++voxel)
             {
-               DTYPE refValue=refPtr[voxel];
-               DTYPE warValue=warPtr[voxel];
-               if(refValue==refValue && warValue==warValue &&
-                     refValue>=0 && warValue>=0 &&
-                     refValue<referenceBinNumber[t] &&
-                     warValue<floatingBinNumber[t])
+               if(referenceMask[voxel]>-1)
                {
-                  ++jointHistoProPtr[static_cast<int>(refValue) +
-                        static_cast<int>(warValue) * referenceBinNumber[t]];
+                  DTYPE refValue=refPtr[voxel];
+                  DTYPE warValue=warPtr[voxel];
+                  if(refValue==refValue && warValue==warValue &&
+                        refValue>=0 && warValue>=0 &&
+                        refValue<refBinNumber &&
+                        warValue<floBinNumber)
+                  {
+                     ++ptrHisto[static_cast<int>(refValue) +
+                           static_cast<int>(warValue) * refBinNumber];
+                  }
                }
             }
          }
+         // Reduce the per-thread histograms into the joint histogram
+         memset(jointHistoProPtr,0,totalBinNumber[t]*sizeof(double));
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(threadNumber, threadHistoPtr, jointBinNumber, jointHistoProPtr) \
+   private(index, tid, value)
+#endif // _OPENMP
+         for(index=0; index<jointBinNumber; ++index)
+         {
+            value=0.;
+            for(tid=0; tid<threadNumber; ++tid)
+               value += threadHistoPtr[(size_t)tid*jointBinNumber+index];
+            jointHistoProPtr[index]=value;
+         }
+         free(threadHistoPtr);
          // Convolve the histogram with a cubic B-spline kernel
          double kernel[3];
          kernel[0]=kernel[2]=GetBasisSplineValue(-1.);
          kernel[1]=GetBasisSplineValue(0.);
          // Histogram is first smooth along the reference axis
          memset(jointHistoLogPtr,0,totalBinNumber[t]*sizeof(double));
-         for(int f=0; f<floatingBinNumber[t]; ++f)
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(refBinNumber, floBinNumber, jointHistoProPtr, jointHistoLogPtr, kernel) \
+   private(f, r, it, index, value, ptrHisto)
+#endif // _OPENMP
+         for(f=0; f<floBinNumber; ++f)
          {
-            for(int r=0; r<referenceBinNumber[t]; ++r)
+            for(r=0; r<refBinNumber; ++r)
             {
-               double value=0.0;
-               int index = r-1;
-               double *ptrHisto = &jointHistoProPtr[index+referenceBinNumber[t]*f];
+               value=0.0;
+               index = r-1;
+               ptrHisto = &jointHistoProPtr[index+refBinNumber*f];
 
-               for(int it=0; it<3; it++)
+               for(it=0; it<3; it++)
                {
-                  if(-1<index && index<referenceBinNumber[t])
+                  if(-1<index && index<refBinNumber)
                   {
                      value += *ptrHisto * kernel[it];
                   }
                   ++ptrHisto;
                   ++index;
                }
-               jointHistoLogPtr[r+referenceBinNumber[t]*f] = value;
+               jointHistoLogPtr[r+refBinNumber*f] = value;
             }
          }
          // Histogram is then smooth along the warped floating axis
-         for(int r=0; r<referenceBinNumber[t]; ++r)
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(refBinNumber, floBinNumber, jointHistoProPtr, jointHistoLogPtr, kernel) \
+   private(f, r, it, index, value, ptrHisto)
+#endif // _OPENMP
+         for(r=0; r<refBinNumber; ++r)
          {
-            for(int f=0; f<floatingBinNumber[t]; ++f)
+            for(f=0; f<floBinNumber; ++f)
             {
-               double value=0.;
-               int index = f-1;
-               double *ptrHisto = &jointHistoLogPtr[r+referenceBinNumber[t]*index];
+               value=0.;
+               index = f-1;
+               ptrHisto = &jointHistoLogPtr[r+refBinNumber*index];
 
-               for(int it=0; it<3; it++)
+               for(it=0; it<3; it++)
                {
-                  if(-1<index && index<floatingBinNumber[t])
+                  if(-1<index && index<floBinNumber)
                   {
                      value += *ptrHisto * kernel[it];
                   }
-                  ptrHisto+=referenceBinNumber[t];
+                  ptrHisto+=refBinNumber;
                   ++index;
                }
-               jointHistoProPtr[r+referenceBinNumber[t]*f] = value;
+               jointHistoProPtr[r+refBinNumber*f] = value;
             }
          }
-         // Normalise the histogram
-         double activeVoxel=0.f;
-         for(int i=0; i<totalBinNumber[t]; ++i)
-            activeVoxel+=jointHistoProPtr[i];
+         // Normalise the histogram. The partial sums are computed per row
+         // and accumulated in a fixed order to be thread number independent
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(refBinNumber, floBinNumber, jointHistoProPtr, rowSumPtr) \
+   private(f, r, value)
+#endif // _OPENMP
+         for(f=0; f<floBinNumber; ++f)
+         {
+            value=0.;
+            for(r=0; r<refBinNumber; ++r)
+               value+=jointHistoProPtr[r+refBinNumber*f];
+            rowSumPtr[f]=value;
+         }
+         double activeVoxel=0.;
+         for(f=0; f<floBinNumber; ++f)
+            activeVoxel+=rowSumPtr[f];
          entropyValues[t][3]=activeVoxel;
-         for(int i=0; i<totalBinNumber[t]; ++i)
-            jointHistoProPtr[i]/=activeVoxel;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(jointBinNumber, jointHistoProPtr, activeVoxel) \
+   private(index)
+#endif // _OPENMP
+         for(index=0; index<jointBinNumber; ++index)
+            jointHistoProPtr[index]/=activeVoxel;
          // Marginalise over the reference axis
-         for(int r=0; r<referenceBinNumber[t]; ++r)
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(refBinNumber, floBinNumber, jointBinNumber, jointHistoProPtr) \
+   private(f, r, index, value)
+#endif // _OPENMP
+         for(r=0; r<refBinNumber; ++r)
          {
-            double sum=0.;
-            int index=r;
-            for(int f=0; f<floatingBinNumber[t]; ++f)
+            value=0.;
+            index=r;
+            for(f=0; f<floBinNumber; ++f)
             {
-               sum+=jointHistoProPtr[index];
-               index+=referenceBinNumber[t];
+               value+=jointHistoProPtr[index];
+               index+=refBinNumber;
             }
-            jointHistoProPtr[referenceBinNumber[t]*
-                  floatingBinNumber[t]+r]=sum;
+            jointHistoProPtr[jointBinNumber+r]=value;
          }
          // Marginalise over the warped floating axis
-         for(int f=0; f<floatingBinNumber[t]; ++f)
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(refBinNumber, floBinNumber, jointBinNumber, jointHistoProPtr) \
+   private(f, r, index, value)
+#endif // _OPENMP
+         for(f=0; f<floBinNumber; ++f)
          {
-            double sum=0.;
-            int index=referenceBinNumber[t]*f;
-            for(int r=0; r<referenceBinNumber[t]; ++r)
+            value=0.;
+            index=refBinNumber*f;
+            for(r=0; r<refBinNumber; ++r)
             {
-               sum+=jointHistoProPtr[index];
+               value+=jointHistoProPtr[index];
                ++index;
             }
-            jointHistoProPtr[referenceBinNumber[t]*
-                  floatingBinNumber[t]+referenceBinNumber[t]+f]=sum;
+            jointHistoProPtr[jointBinNumber+refBinNumber+f]=value;
          }
          // Set the log values to zero
          memset(jointHistoLogPtr,0,totalBinNumber[t]*sizeof(double));
          // Compute the entropy of the reference image
          double referenceEntropy=0.;
-         for(int r=0; r<referenceBinNumber[t]; ++r)
+         for(r=0; r<refBinNumber; ++r)
          {
-            double valPro=jointHistoProPtr[referenceBinNumber[t]*floatingBinNumber[t]+r];
+            valPro=jointHistoProPtr[jointBinNumber+r];
             if(valPro>0)
             {
-               double valLog=log(valPro);
+               valLog=log(valPro);
                referenceEntropy -= valPro * valLog;
-               jointHistoLogPtr[referenceBinNumber[t]*floatingBinNumber[t]+r]=valLog;
+               jointHistoLogPtr[jointBinNumber+r]=valLog;
             }
          }
          entropyValues[t][0]=referenceEntropy;
          // Compute the entropy of the warped floating image
          double warpedEntropy=0.;
-         for(int f=0; f<floatingBinNumber[t]; ++f)
+         for(f=0; f<floBinNumber; ++f)
          {
-            double valPro=jointHistoProPtr[referenceBinNumber[t]*floatingBinNumber[t]+
-                  referenceBinNumber[t]+f];
+            valPro=jointHistoProPtr[jointBinNumber+refBinNumber+f];
             if(valPro>0)
             {
-               double valLog=log(valPro);
+               valLog=log(valPro);
                warpedEntropy -= valPro * valLog;
-               jointHistoLogPtr[referenceBinNumber[t]*floatingBinNumber[t]+
-                     referenceBinNumber[t]+f]=valLog;
+               jointHistoLogPtr[jointBinNumber+refBinNumber+f]=valLog;
             }
          }
          entropyValues[t][1]=warpedEntropy;
-         // Compute the joint entropy
-         double jointEntropy=0.;
-         for(int i=0; i<referenceBinNumber[t]*floatingBinNumber[t]; ++i)
+         // Compute the joint entropy, again using per-row partial sums
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(refBinNumber, floBinNumber, jointHistoProPtr, jointHistoLogPtr, rowSumPtr) \
+   private(f, r, index, value, valPro, valLog)
+#endif // _OPENMP
+         for(f=0; f<floBinNumber; ++f)
          {
-            double valPro=jointHistoProPtr[i];
-            if(valPro>0)
+            value=0.;
+            for(r=0; r<refBinNumber; ++r)
             {
-               double valLog=log(valPro);
-               jointEntropy -= valPro * valLog;
-               jointHistoLogPtr[i]=valLog;
+               index=r+refBinNumber*f;
+               valPro=jointHistoProPtr[index];
+               if(valPro>0)
+               {
+                  valLog=log(valPro);
+                  value -= valPro * valLog;
+                  jointHistoLogPtr[index]=valLog;
+               }
             }
+            rowSumPtr[f]=value;
          }
+         double jointEntropy=0.;
+         for(f=0; f<floBinNumber; ++f)
+            jointEntropy+=rowSumPtr[f];
          entropyValues[t][2]=jointEntropy;
+         free(rowSumPtr);
       } // if active time point
    } // iterate over all time point in the reference image
 }
@@ -562,6 +653,153 @@ double reg_nmi::GetSimilarityMeasureValue()
    return nmi_value_forward+nmi_value_backward;
 }
 /* *************************************************************** */
+/** The joint histogram of the last evaluation is updated without filling it
+ * again. The histogram smoothing being linear, every voxel of the region
+ * removes the 3x3 kernel of its previous bin and adds the kernel of its new
+ * bin before the entropies are computed from the updated histogram.
+ */
+template <class DTYPE>
+double reg_getRegionNMIValue(nifti_image *referenceImage,
+                             nifti_image *warpedImage,
+                             nifti_image *warpedRegion,
+                             const size_t *regionVoxels,
+                             double *timePointWeight,
+                             unsigned short *referenceBinNumber,
+                             unsigned short *floatingBinNumber,
+                             double **jointHistogramPro,
+                             double **entropyValues,
+                             int *referenceMask)
+{
+   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   size_t regionVoxelNumber = (size_t)warpedRegion->nx*warpedRegion->ny*warpedRegion->nz;
+   double kernel[3];
+   kernel[0]=kernel[2]=GetBasisSplineValue(-1.);
+   kernel[1]=GetBasisSplineValue(0.);
+   double nmi_value=0.;
+   for(int t=0; t<referenceImage->nt; ++t)
+   {
+      if(timePointWeight[t] > 0.0)
+      {
+         int refBinNumber = referenceBinNumber[t];
+         int floBinNumber = floatingBinNumber[t];
+         int jointBinNumber = refBinNumber * floBinNumber;
+         // The smoothed histogram is recovered from the normalised one
+         double activeVoxel = entropyValues[t][3];
+         double *histoPtr = (double *)malloc((jointBinNumber+refBinNumber+floBinNumber)*sizeof(double));
+         for(int index=0; index<jointBinNumber; ++index)
+            histoPtr[index]=jointHistogramPro[t][index]*activeVoxel;
+         DTYPE *refPtr = &static_cast<DTYPE *>(referenceImage->data)[t*voxelNumber];
+         DTYPE *warPtr = &static_cast<DTYPE *>(warpedImage->data)[t*voxelNumber];
+         DTYPE *regionPtr = &static_cast<DTYPE *>(warpedRegion->data)[t*regionVoxelNumber];
+         for(size_t i=0; i<regionVoxelNumber; ++i)
+         {
+            size_t voxel=regionVoxels[i];
+            if(referenceMask[voxel]<0) continue;
+            DTYPE refValue=refPtr[voxel];
+            if(refValue!=refValue || refValue<0 || refValue>=refBinNumber) continue;
+            int bins[2];
+            for(int j=0; j<2; ++j)
+            {
+               DTYPE warValue=j==0?warPtr[voxel]:regionPtr[i];
+               bins[j]=-1;
+               if(warValue==warValue && warValue>=0 && warValue<floBinNumber)
+                  bins[j]=static_cast<int>(warValue);
+            }
+            if(bins[0]==bins[1]) continue;
+            int r=static_cast<int>(refValue);
+            for(int j=0; j<2; ++j)
+            {
+               if(bins[j]<0) continue;
+               double sign=j==0?-1.:1.;
+               for(int f=bins[j]-1; f<=bins[j]+1; ++f)
+               {
+                  if(f<0 || f>=floBinNumber) continue;
+                  for(int r2=r-1; r2<=r+1; ++r2)
+                  {
+                     if(r2<0 || r2>=refBinNumber) continue;
+                     double value=sign*kernel[r2-r+1]*kernel[f-bins[j]+1];
+                     histoPtr[r2+refBinNumber*f] += value;
+                     activeVoxel += value;
+                  }
+               }
+            }
+         }
+         // Compute the entropies of the updated histogram
+         double *refMarginalPtr = &histoPtr[jointBinNumber];
+         double *floMarginalPtr = &histoPtr[jointBinNumber+refBinNumber];
+         memset(refMarginalPtr,0,(refBinNumber+floBinNumber)*sizeof(double));
+         double jointEntropy=0.;
+         for(int f=0; f<floBinNumber; ++f)
+         {
+            for(int r=0; r<refBinNumber; ++r)
+            {
+               double valPro=histoPtr[r+refBinNumber*f]/activeVoxel;
+               refMarginalPtr[r] += valPro;
+               floMarginalPtr[f] += valPro;
+               if(valPro>0)
+                  jointEntropy -= valPro * log(valPro);
+            }
+         }
+         double referenceEntropy=0.;
+         for(int r=0; r<refBinNumber; ++r)
+            if(refMarginalPtr[r]>0)
+               referenceEntropy -= refMarginalPtr[r] * log(refMarginalPtr[r]);
+         double warpedEntropy=0.;
+         for(int f=0; f<floBinNumber; ++f)
+            if(floMarginalPtr[f]>0)
+               warpedEntropy -= floMarginalPtr[f] * log(floMarginalPtr[f]);
+         free(histoPtr);
+         nmi_value += timePointWeight[t] * (referenceEntropy + warpedEntropy) / jointEntropy;
+      }
+   }
+   return nmi_value;
+}
+/* *************************************************************** */
+double reg_nmi::GetRegionSimilarityMeasureValue(nifti_image *warpedRegion,
+                                                const size_t *regionVoxels)
+{
+   if(warpedRegion->datatype !=this->referenceImagePointer->datatype)
+   {
+      reg_print_fct_error("reg_nmi::GetRegionSimilarityMeasureValue()");
+      reg_print_msg_error("Both input images are exepected to have the same type");
+      reg_exit();
+   }
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      return reg_getRegionNMIValue<float>
+            (this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             warpedRegion,
+             regionVoxels,
+             this->timePointWeight,
+             this->referenceBinNumber,
+             this->floatingBinNumber,
+             this->forwardJointHistogramPro,
+             this->forwardEntropyValues,
+             this->referenceMaskPointer
+             );
+   case NIFTI_TYPE_FLOAT64:
+      return reg_getRegionNMIValue<double>
+            (this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             warpedRegion,
+             regionVoxels,
+             this->timePointWeight,
+             this->referenceBinNumber,
+             this->floatingBinNumber,
+             this->forwardJointHistogramPro,
+             this->forwardEntropyValues,
+             this->referenceMaskPointer
+             );
+   default:
+      reg_print_fct_error("reg_nmi::GetRegionSimilarityMeasureValue()");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+   return 0.;
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_getVoxelBasedNMIGradient2D(nifti_image *referenceImage,
                                     nifti_image *warpedImage,
@@ -41,6 +41,14 @@ public:
    double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based nmi gradient
    void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief The joint histogram can be updated when the measure is not symmetric
+   bool IsLocallyDecomposable()
+   {
+      return !this->isSymmetric;
+   }
+   /// @brief Returns the nmi value obtained when a region of the warped image is replaced
+   double GetRegionSimilarityMeasureValue(nifti_image *warpedRegion,
+                                          const size_t *regionVoxels);
    void SetRefAndFloatBinNumbers(unsigned short refBinNumber,
                                  unsigned short floBinNumber,
                                  int timepoint)
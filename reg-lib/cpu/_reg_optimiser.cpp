@@ -42,10 +42,10 @@ template <class T>
 reg_optimiser<T>::~reg_optimiser()
 {
    if(this->bestDOF!=NULL)
-      free(this->bestDOF);
+      reg_tools_trackedFree(this->bestDOF);
    this->bestDOF=NULL;
    if(this->bestDOF_b!=NULL)
-      free(this->bestDOF_b);
+      reg_tools_trackedFree(this->bestDOF_b);
    this->bestDOF_b=NULL;
 #ifndef NDEBUG
    reg_print_msg_debug("reg_optimiser<T>::~reg_optimiser() called");
@@ -77,8 +77,8 @@ void reg_optimiser<T>::Initialise(size_t nvox,
    this->maxIterationNumber=maxit;
    this->currentIterationNumber=start;
    this->currentDOF=cppData;
-   if(this->bestDOF!=NULL) free(this->bestDOF);
-   this->bestDOF=(T *)malloc(this->dofNumber*sizeof(T));
+   if(this->bestDOF!=NULL) reg_tools_trackedFree(this->bestDOF);
+   this->bestDOF=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
    memcpy(this->bestDOF,this->currentDOF,this->dofNumber*sizeof(T));
    if( gradData!=NULL)
       this->gradient=gradData;
@@ -89,8 +89,8 @@ void reg_optimiser<T>::Initialise(size_t nvox,
    {
       this->currentDOF_b=cppData_b;
       this->backward=true;
-      if(this->bestDOF_b!=NULL) free(this->bestDOF_b);
-      this->bestDOF_b=(T *)malloc(this->dofNumber_b*sizeof(T));
+      if(this->bestDOF_b!=NULL) reg_tools_trackedFree(this->bestDOF_b);
+      this->bestDOF_b=(T *)reg_tools_trackedMalloc(this->dofNumber_b*sizeof(T));
       memcpy(this->bestDOF_b,this->currentDOF_b,this->dofNumber_b*sizeof(T));
    }
    if(gradData_b!=NULL)
@@ -247,19 +247,19 @@ template <class T>
 reg_conjugateGradient<T>::~reg_conjugateGradient()
 {
    if(this->array1!=NULL)
-      free(this->array1);
+      reg_tools_trackedFree(this->array1);
    this->array1=NULL;
 
    if(this->array2!=NULL)
-      free(this->array2);
+      reg_tools_trackedFree(this->array2);
    this->array2=NULL;
 
    if(this->array1_b!=NULL)
-      free(this->array1_b);
+      reg_tools_trackedFree(this->array1_b);
    this->array1_b=NULL;
 
    if(this->array2_b!=NULL)
-      free(this->array2_b);
+      reg_tools_trackedFree(this->array2_b);
    this->array2_b=NULL;
 
 #ifndef NDEBUG
@@ -299,17 +299,17 @@ void reg_conjugateGradient<T>::Initialise(size_t nvox,
                                 gradData_b
                                );
    this->firstcall=true;
-   if(this->array1!=NULL) free(this->array1);
-   if(this->array2!=NULL) free(this->array2);
-   this->array1=(T *)malloc(this->dofNumber*sizeof(T));
-   this->array2=(T *)malloc(this->dofNumber*sizeof(T));
+   if(this->array1!=NULL) reg_tools_trackedFree(this->array1);
+   if(this->array2!=NULL) reg_tools_trackedFree(this->array2);
+   this->array1=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
+   this->array2=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
 
    if(cppData_b!=NULL && gradData_b!=NULL && nvox_b>0)
    {
-      if(this->array1_b!=NULL) free(this->array1_b);
-      if(this->array2_b!=NULL) free(this->array2_b);
-      this->array1_b=(T *)malloc(this->dofNumber_b*sizeof(T));
-      this->array2_b=(T *)malloc(this->dofNumber_b*sizeof(T));
+      if(this->array1_b!=NULL) reg_tools_trackedFree(this->array1_b);
+      if(this->array2_b!=NULL) reg_tools_trackedFree(this->array2_b);
+      this->array1_b=(T *)reg_tools_trackedMalloc(this->dofNumber_b*sizeof(T));
+      this->array2_b=(T *)reg_tools_trackedMalloc(this->dofNumber_b*sizeof(T));
    }
 
 #ifndef NDEBUG
@@ -480,18 +480,18 @@ template <class T>
 reg_lbfgs<T>::~reg_lbfgs()
 {
    if(this->oldDOF!=NULL)
-      free(this->oldDOF);
+      reg_tools_trackedFree(this->oldDOF);
    this->oldDOF=NULL;
    if(this->oldGrad!=NULL)
-      free(this->oldGrad);
+      reg_tools_trackedFree(this->oldGrad);
    this->oldGrad=NULL;
    for(size_t i=0; i<this->stepToKeep; ++i)
    {
       if(this->diffDOF[i]!=NULL)
-         free(this->diffDOF[i]);
+         reg_tools_trackedFree(this->diffDOF[i]);
       this->diffDOF[i]=NULL;
       if(this->diffGrad[i]!=NULL)
-         free(this->diffGrad[i]);
+         reg_tools_trackedFree(this->diffGrad[i]);
       this->diffGrad[i]=NULL;
    }
    if(this->diffDOF!=NULL)
@@ -536,8 +536,8 @@ void reg_lbfgs<T>::Initialise(size_t nvox,
    this->diffGrad=(T **)malloc(this->stepToKeep*sizeof(T *));
    for(size_t i=0; i<this->stepToKeep; ++i)
    {
-      this->diffDOF[i]=(T *)malloc(this->dofNumber*sizeof(T));
-      this->diffGrad[i]=(T *)malloc(this->dofNumber*sizeof(T));
+      this->diffDOF[i]=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
+      this->diffGrad[i]=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
       if(this->diffDOF[i]==NULL || this->diffGrad[i]==NULL)
       {
          reg_print_fct_error("reg_lbfgs<T>::Initialise");
@@ -545,8 +545,8 @@ void reg_lbfgs<T>::Initialise(size_t nvox,
          reg_exit();
       }
    }
-   this->oldDOF=(T *)malloc(this->dofNumber*sizeof(T));
-   this->oldGrad=(T *)malloc(this->dofNumber*sizeof(T));
+   this->oldDOF=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
+   this->oldGrad=(T *)reg_tools_trackedMalloc(this->dofNumber*sizeof(T));
    if(this->oldDOF==NULL || this->oldGrad==NULL)
    {
       reg_print_fct_error("reg_lbfgs<T>::Initialise");
@@ -7,6 +7,7 @@
 #define _REG_OPTIMISER_H
 
 #include "_reg_maths.h"
+#include "_reg_tools.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -16,6 +16,9 @@
 #include "_reg_maths.h"
 #include "_reg_maths_eigen.h"
 #include "_reg_tools.h"
+#ifdef _USE_AVX
+#include "_reg_resampling_simd.h"
+#endif
 
 #define SINC_KERNEL_RADIUS 3
 #define SINC_KERNEL_SIZE SINC_KERNEL_RADIUS*2
@@ -112,6 +115,46 @@ void interpNearestNeighKernel(double relative, double *basis)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/** The following structures expose the interpolation kernels at compile
+ * time so that the resampling loops are instantiated with a fixed kernel
+ * size and the basis computation can be inlined.
+ * size: number of basis values along each axis
+ * offset: shift from the floor of the position to the first voxel used
+ */
+struct NearestNeighbourKernel
+{
+    enum {size=2, offset=0};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpNearestNeighKernel(relative, basis);
+    }
+};
+struct LinearKernel
+{
+    enum {size=2, offset=0};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpLinearKernel(relative, basis);
+    }
+};
+struct CubicSplineKernel
+{
+    enum {size=4, offset=1};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpCubicSplineKernel(relative, basis);
+    }
+};
+struct SincKernel
+{
+    enum {size=SINC_KERNEL_SIZE, offset=SINC_KERNEL_RADIUS};
+    static inline void getBasis(double relative, double *basis)
+    {
+        interpWindowedSincKernel(relative, basis);
+    }
+};
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 void reg_dti_resampling_preprocessing(nifti_image *floatingImage,
                                       void **originalFloatingData,
@@ -355,13 +398,298 @@ void reg_dti_resampling_postprocessing(nifti_image *inputImage,
     }
 }
 /* *************************************************************** */
-template<class FloatingTYPE, class FieldTYPE>
-void ResampleImage3D(nifti_image *floatingImage,
-                     nifti_image *deformationField,
-                     nifti_image *warpedImage,
-                     int *mask,
-                     FieldTYPE paddingValue,
-                     int kernel)
+template<class FloatingTYPE>
+FloatingTYPE reg_castInterpolatedIntensity(double intensity, int datatype)
+{
+    switch(datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+    case NIFTI_TYPE_FLOAT64:
+        return static_cast<FloatingTYPE>(intensity);
+    case NIFTI_TYPE_UINT8:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
+        return static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+    case NIFTI_TYPE_UINT16:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
+        return static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+    case NIFTI_TYPE_UINT32:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
+        return static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+    default:
+        if(intensity!=intensity)
+            intensity=0;
+        return static_cast<FloatingTYPE>(reg_round(intensity));
+    }
+}
+/* *************************************************************** */
+/** Resample all the volumes of a multi-volume floating image in a single
+ * pass over the warped voxels. The floating position, the interpolation
+ * weights and the boundary check are only computed once per voxel and
+ * reused for every volume. The intensities are accessed through a voxel
+ * and a volume stride so that the same kernel handles both the nifti
+ * layout (one volume after the other) and the interleaved layout (all the
+ * volume values of a voxel stored contiguously).
+ * For every volume, the arithmetic is identical to ResampleImage3D.
+ */
+template<class FloatingTYPE, class FieldTYPE, class KernelTYPE>
+void ResampleImage3D_fused_core(nifti_image *floatingImage,
+                                nifti_image *deformationField,
+                                nifti_image *warpedImage,
+                                int *mask,
+                                FieldTYPE paddingValue,
+                                bool interleaved)
+{
+#ifdef _WIN32
+    long  index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+#else
+    size_t  index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+#endif
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    int volumeNumber = warpedImage->nt*warpedImage->nu;
+    FloatingTYPE *floatingIntensity = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensity = static_cast<FloatingTYPE *>(warpedImage->data);
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    // Define the strides used to access the intensities
+    size_t floatingVoxelStride = interleaved?volumeNumber:1;
+    size_t floatingVolumeStride = interleaved?1:floatingVoxelNumber;
+    size_t warpedVoxelStride = interleaved?volumeNumber:1;
+    size_t warpedVolumeStride = interleaved?1:(size_t)warpedVoxelNumber;
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+    // Each thread uses its own accumulation arrays, one value per volume
+    int threadNumber=1;
+    int tid=0;
+#if defined (_OPENMP)
+    threadNumber=omp_get_max_threads();
+#endif
+    double *workspace=(double *)malloc(3*threadNumber*volumeNumber*sizeof(double));
+
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "3D resampling of %i volumes in a single pass", volumeNumber);
+    reg_print_msg_debug(text);
+#endif
+
+    int a, b, c, t, X, Y, Z, previous[3];
+    bool inside, defined;
+    size_t floatingIndex;
+    FloatingTYPE *xyzPointer;
+    double xBasis[KernelTYPE::size], yBasis[KernelTYPE::size], zBasis[KernelTYPE::size], relative[3];
+    double *xTempNewValue, *yTempNewValue, *intensity;
+    float world[3], position[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, world, position, previous, xBasis, yBasis, zBasis, relative, \
+    a, b, c, t, X, Y, Z, inside, defined, floatingIndex, xyzPointer, tid, \
+    xTempNewValue, yTempNewValue, intensity) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, volumeNumber, \
+    floatingVoxelStride, floatingVolumeStride, warpedVoxelStride, warpedVolumeStride, \
+    deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, workspace, \
+    floatingIJKMatrix, floatingImage, paddingValue)
+#endif // _OPENMP
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+#if defined (_OPENMP)
+        tid=omp_get_thread_num();
+#endif
+        xTempNewValue=&workspace[3*tid*volumeNumber];
+        yTempNewValue=&xTempNewValue[volumeNumber];
+        intensity=&yTempNewValue[volumeNumber];
+
+        for(t=0; t<volumeNumber; ++t)
+            intensity[t]=paddingValue;
+
+        if((maskPtr[index])>-1)
+        {
+            world[0]=static_cast<float>(deformationFieldPtrX[index]);
+            world[1]=static_cast<float>(deformationFieldPtrY[index]);
+            world[2]=static_cast<float>(deformationFieldPtrZ[index]);
+
+            // real -> voxel; floating space
+            reg_mat44_mul(floatingIJKMatrix, world, position);
+
+            previous[0] = static_cast<int>(reg_floor(position[0]));
+            previous[1] = static_cast<int>(reg_floor(position[1]));
+            previous[2] = static_cast<int>(reg_floor(position[2]));
+
+            relative[0]=static_cast<double>(position[0])-static_cast<double>(previous[0]);
+            relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
+            relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
+
+            KernelTYPE::getBasis(relative[0], xBasis);
+            KernelTYPE::getBasis(relative[1], yBasis);
+            KernelTYPE::getBasis(relative[2], zBasis);
+            previous[0]-=KernelTYPE::offset;
+            previous[1]-=KernelTYPE::offset;
+            previous[2]-=KernelTYPE::offset;
+
+            inside = -1<(previous[0]) && (previous[0]+KernelTYPE::size-1)<floatingImage->nx &&
+                    -1<(previous[1]) && (previous[1]+KernelTYPE::size-1)<floatingImage->ny &&
+                    -1<(previous[2]) && (previous[2]+KernelTYPE::size-1)<floatingImage->nz;
+
+            for(t=0; t<volumeNumber; ++t)
+                intensity[t]=0.0;
+            for(c=0; c<KernelTYPE::size; c++)
+            {
+                Z= previous[2]+c;
+                for(t=0; t<volumeNumber; ++t)
+                    yTempNewValue[t]=0.0;
+                for(b=0; b<KernelTYPE::size; b++)
+                {
+                    Y= previous[1]+b;
+                    for(t=0; t<volumeNumber; ++t)
+                        xTempNewValue[t]=0.0;
+                    for(a=0; a<KernelTYPE::size; a++)
+                    {
+                        X= previous[0]+a;
+                        defined = inside || (-1<X && X<floatingImage->nx &&
+                                             -1<Y && Y<floatingImage->ny &&
+                                             -1<Z && Z<floatingImage->nz);
+                        if(defined)
+                        {
+                            floatingIndex=((size_t)Z*floatingImage->ny+Y)*floatingImage->nx+X;
+                            xyzPointer = &floatingIntensity[floatingIndex*floatingVoxelStride];
+                            for(t=0; t<volumeNumber; ++t)
+                            {
+                                xTempNewValue[t] += static_cast<double>(*xyzPointer) * xBasis[a];
+                                xyzPointer += floatingVolumeStride;
+                            }
+                        }
+                        else
+                        {
+                            // paddingValue
+                            for(t=0; t<volumeNumber; ++t)
+                                xTempNewValue[t] += static_cast<double>(paddingValue) * xBasis[a];
+                        }
+                    }
+                    for(t=0; t<volumeNumber; ++t)
+                        yTempNewValue[t] += xTempNewValue[t] * yBasis[b];
+                }
+                for(t=0; t<volumeNumber; ++t)
+                    intensity[t] += yTempNewValue[t] * zBasis[c];
+            }
+        }
+
+        for(t=0; t<volumeNumber; ++t)
+        {
+            warpedIntensity[index*warpedVoxelStride+t*warpedVolumeStride] =
+                    reg_castInterpolatedIntensity<FloatingTYPE>(intensity[t], floatingImage->datatype);
+        }
+    }
+    free(workspace);
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE, class KernelTYPE>
+inline double ResampleImage3D_voxel(FloatingTYPE *floatingIntensity,
+                                    nifti_image *floatingImage,
+                                    mat44 *floatingIJKMatrix,
+                                    float *world,
+                                    FieldTYPE paddingValue)
+{
+    int a, b, c, Y, Z, previous[3];
+    FloatingTYPE *zPointer, *xyzPointer;
+    double xBasis[KernelTYPE::size], yBasis[KernelTYPE::size], zBasis[KernelTYPE::size], relative[3];
+    double xTempNewValue, yTempNewValue, intensity;
+    float position[3];
+
+    // real -> voxel; floating space
+    reg_mat44_mul(floatingIJKMatrix, world, position);
+
+    previous[0] = static_cast<int>(reg_floor(position[0]));
+    previous[1] = static_cast<int>(reg_floor(position[1]));
+    previous[2] = static_cast<int>(reg_floor(position[2]));
+
+    relative[0]=static_cast<double>(position[0])-static_cast<double>(previous[0]);
+    relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
+    relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
+
+    KernelTYPE::getBasis(relative[0], xBasis);
+    KernelTYPE::getBasis(relative[1], yBasis);
+    KernelTYPE::getBasis(relative[2], zBasis);
+    previous[0]-=KernelTYPE::offset;
+    previous[1]-=KernelTYPE::offset;
+    previous[2]-=KernelTYPE::offset;
+
+    intensity=0.0;
+    if(-1<(previous[0]) && (previous[0]+KernelTYPE::size-1)<floatingImage->nx &&
+       -1<(previous[1]) && (previous[1]+KernelTYPE::size-1)<floatingImage->ny &&
+       -1<(previous[2]) && (previous[2]+KernelTYPE::size-1)<floatingImage->nz){
+       for(c=0; c<KernelTYPE::size; c++)
+       {
+          Z= previous[2]+c;
+          zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+          yTempNewValue=0.0;
+          for(b=0; b<KernelTYPE::size; b++)
+          {
+             Y= previous[1]+b;
+             xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+             xTempNewValue=0.0;
+             for(a=0; a<KernelTYPE::size; a++)
+             {
+                xTempNewValue +=  static_cast<double>(*xyzPointer++) * xBasis[a];
+             }
+             yTempNewValue += xTempNewValue * yBasis[b];
+          }
+          intensity += yTempNewValue * zBasis[c];
+       }
+    }
+    else{
+       for(c=0; c<KernelTYPE::size; c++)
+       {
+          Z= previous[2]+c;
+          zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+          yTempNewValue=0.0;
+          for(b=0; b<KernelTYPE::size; b++)
+          {
+             Y= previous[1]+b;
+             xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+             xTempNewValue=0.0;
+             for(a=0; a<KernelTYPE::size; a++)
+             {
+                if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
+                   -1<Z && Z<floatingImage->nz &&
+                   -1<Y && Y<floatingImage->ny)
+                {
+                   xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                }
+                else
+                {
+                   // paddingValue
+                   xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
+                }
+                xyzPointer++;
+             }
+             yTempNewValue += xTempNewValue * yBasis[b];
+          }
+          intensity += yTempNewValue * zBasis[c];
+       }
+    }
+    return intensity;
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE, class KernelTYPE, class WarpedTYPE>
+void ResampleImage3D_core(nifti_image *floatingImage,
+                          nifti_image *deformationField,
+                          nifti_image *warpedImage,
+                          int *mask,
+                          FieldTYPE paddingValue)
 {
 #ifdef _WIN32
     long  index;
@@ -373,7 +701,7 @@ void ResampleImage3D(nifti_image *floatingImage,
     size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
 #endif
     FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
-    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    WarpedTYPE *warpedIntensityPtr = static_cast<WarpedTYPE *>(warpedImage->data);
     FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
     FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
     FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[warpedVoxelNumber];
@@ -385,33 +713,6 @@ void ResampleImage3D(nifti_image *floatingImage,
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-    // Define the kernel to use
-    int kernel_size;
-    int kernel_offset=0;
-    void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
-
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
     {
@@ -421,22 +722,17 @@ void ResampleImage3D(nifti_image *floatingImage,
         reg_print_msg_debug(text);
 #endif
 
-        FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        WarpedTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-        int a, b, c, Y, Z, previous[3];
-
-        FloatingTYPE *zPointer, *xyzPointer;
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], zBasis[SINC_KERNEL_SIZE], relative[3];
-        double xTempNewValue, yTempNewValue, intensity;
-        float world[3], position[3];
+        double intensity;
+        float world[3];
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-    private(index, intensity, world, position, previous, xBasis, yBasis, zBasis, relative, \
-    a, b, c, Y, Z, zPointer, xyzPointer, xTempNewValue, yTempNewValue) \
-    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
+    private(index, intensity, world) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, \
     deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, \
-    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+    floatingIJKMatrix, floatingImage, warpedImage, paddingValue)
 #endif // _OPENMP
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -449,123 +745,21 @@ void ResampleImage3D(nifti_image *floatingImage,
                 world[1]=static_cast<float>(deformationFieldPtrY[index]);
                 world[2]=static_cast<float>(deformationFieldPtrZ[index]);
 
-                // real -> voxel; floating space
-                reg_mat44_mul(floatingIJKMatrix, world, position);
-
-                previous[0] = static_cast<int>(reg_floor(position[0]));
-                previous[1] = static_cast<int>(reg_floor(position[1]));
-                previous[2] = static_cast<int>(reg_floor(position[2]));
-
-                relative[0]=static_cast<double>(position[0])-static_cast<double>(previous[0]);
-                relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
-                relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
-
-                (*kernelCompFctPtr)(relative[0], xBasis);
-                (*kernelCompFctPtr)(relative[1], yBasis);
-                (*kernelCompFctPtr)(relative[2], zBasis);
-                previous[0]-=kernel_offset;
-                previous[1]-=kernel_offset;
-                previous[2]-=kernel_offset;
-
-                intensity=0.0;
-                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingImage->nx &&
-                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingImage->ny &&
-                   -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingImage->nz){
-                   for(c=0; c<kernel_size; c++)
-                   {
-                      Z= previous[2]+c;
-                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                      yTempNewValue=0.0;
-                      for(b=0; b<kernel_size; b++)
-                      {
-                         Y= previous[1]+b;
-                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                         xTempNewValue=0.0;
-                         for(a=0; a<kernel_size; a++)
-                         {
-                            xTempNewValue +=  static_cast<double>(*xyzPointer++) * xBasis[a];
-                         }
-                         yTempNewValue += xTempNewValue * yBasis[b];
-                      }
-                      intensity += yTempNewValue * zBasis[c];
-                   }
-                }
-                else{
-                   for(c=0; c<kernel_size; c++)
-                   {
-                      Z= previous[2]+c;
-                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                      yTempNewValue=0.0;
-                      for(b=0; b<kernel_size; b++)
-                      {
-                         Y= previous[1]+b;
-                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                         xTempNewValue=0.0;
-                         for(a=0; a<kernel_size; a++)
-                         {
-                            if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
-                               -1<Z && Z<floatingImage->nz &&
-                               -1<Y && Y<floatingImage->ny)
-                            {
-                               xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
-                            }
-                            else
-                            {
-                               // paddingValue
-                               xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
-                            }
-                            xyzPointer++;
-                         }
-                         yTempNewValue += xTempNewValue * yBasis[b];
-                      }
-                      intensity += yTempNewValue * zBasis[c];
-                   }
-                }
+                intensity=ResampleImage3D_voxel<FloatingTYPE,FieldTYPE,KernelTYPE>
+                        (floatingIntensity, floatingImage, floatingIJKMatrix, world, paddingValue);
             }
 
-            switch(floatingImage->datatype)
-            {
-            case NIFTI_TYPE_FLOAT32:
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            case NIFTI_TYPE_FLOAT64:
-                warpedIntensity[index]=intensity;
-                break;
-            case NIFTI_TYPE_UINT8:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT16:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT32:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            default:
-                if(intensity!=intensity)
-                    intensity=0;
-                warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                break;
-            }
+            warpedIntensity[index]=reg_castInterpolatedIntensity<WarpedTYPE>(intensity, warpedImage->datatype);
         }
     }
 }
 /* *************************************************************** */
-template<class FloatingTYPE, class FieldTYPE>
-void ResampleImage2D(nifti_image *floatingImage,
-                     nifti_image *deformationField,
-                     nifti_image *warpedImage,
-                     int *mask,
-                     FieldTYPE paddingValue,
-                     int kernel)
+template<class FloatingTYPE, class FieldTYPE, class KernelTYPE, class WarpedTYPE>
+void ResampleImage2D_core(nifti_image *floatingImage,
+                          nifti_image *deformationField,
+                          nifti_image *warpedImage,
+                          int *mask,
+                          FieldTYPE paddingValue)
 {
 #ifdef _WIN32
     long  index;
@@ -577,7 +771,7 @@ void ResampleImage2D(nifti_image *floatingImage,
     size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny;
 #endif
     FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
-    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    WarpedTYPE *warpedIntensityPtr = static_cast<WarpedTYPE *>(warpedImage->data);
     FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
     FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
 
@@ -588,32 +782,6 @@ void ResampleImage2D(nifti_image *floatingImage,
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-    int kernel_size;
-    int kernel_offset=0;
-    void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
-
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
     {
@@ -622,13 +790,13 @@ void ResampleImage2D(nifti_image *floatingImage,
         sprintf(text, "2D resampling of volume number %lu",t);
         reg_print_msg_debug(text);
 #endif
-        FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        WarpedTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
         int a, b, Y, previous[2];
 
         FloatingTYPE *xyzPointer;
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], relative[2];
+        double xBasis[KernelTYPE::size], yBasis[KernelTYPE::size], relative[2];
         double xTempNewValue, intensity;
         float world[3] = {0.0, 0.0, 0.0};
         float position[3] = {0.0, 0.0, 0.0};
@@ -638,7 +806,7 @@ void ResampleImage2D(nifti_image *floatingImage,
     a, b, Y, xyzPointer, xTempNewValue) \
     shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
     deformationFieldPtrX, deformationFieldPtrY, maskPtr, \
-    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+    floatingIJKMatrix, floatingImage, warpedImage, paddingValue)
 #endif // _OPENMP
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -659,18 +827,18 @@ void ResampleImage2D(nifti_image *floatingImage,
                 relative[0] = static_cast<double>(position[0])-static_cast<double>(previous[0]);
                 relative[1] = static_cast<double>(position[1])-static_cast<double>(previous[1]);
 
-                (*kernelCompFctPtr)(relative[0], xBasis);
-                (*kernelCompFctPtr)(relative[1], yBasis);
-                previous[0]-=kernel_offset;
-                previous[1]-=kernel_offset;
+                KernelTYPE::getBasis(relative[0], xBasis);
+                KernelTYPE::getBasis(relative[1], yBasis);
+                previous[0]-=KernelTYPE::offset;
+                previous[1]-=KernelTYPE::offset;
 
                 intensity=0.0;
-                for(b=0; b<kernel_size; b++)
+                for(b=0; b<KernelTYPE::size; b++)
                 {
                     Y= previous[1]+b;
                     xyzPointer = &floatingIntensity[Y*floatingImage->nx+previous[0]];
                     xTempNewValue=0.0;
-                    for(a=0; a<kernel_size; a++)
+                    for(a=0; a<KernelTYPE::size; a++)
                     {
                         if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
                                 -1<Y && Y<floatingImage->ny)
@@ -687,28 +855,28 @@ void ResampleImage2D(nifti_image *floatingImage,
                     intensity += xTempNewValue * yBasis[b];
                 }
 
-                switch(floatingImage->datatype)
+                switch(warpedImage->datatype)
                 {
                 case NIFTI_TYPE_FLOAT32:
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
+                    warpedIntensity[index]=static_cast<WarpedTYPE>(intensity);
                     break;
                 case NIFTI_TYPE_FLOAT64:
                     warpedIntensity[index]=intensity;
                     break;
                 case NIFTI_TYPE_UINT8:
                     intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                    warpedIntensity[index]=static_cast<WarpedTYPE>(intensity>0?reg_round(intensity):0);
                     break;
                 case NIFTI_TYPE_UINT16:
                     intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                    warpedIntensity[index]=static_cast<WarpedTYPE>(intensity>0?reg_round(intensity):0);
                     break;
                 case NIFTI_TYPE_UINT32:
                     intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                    warpedIntensity[index]=static_cast<WarpedTYPE>(intensity>0?reg_round(intensity):0);
                     break;
                 default:
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
+                    warpedIntensity[index]=static_cast<WarpedTYPE>(reg_round(intensity));
                     break;
                 }
             }
@@ -716,17 +884,246 @@ void ResampleImage2D(nifti_image *floatingImage,
     }
 }
 /* *************************************************************** */
-/* *************************************************************** */
-
-/** This function resample a floating image into the referential
- * of a reference image by applying an affine transformation and
- * a deformation field. The affine transformation has to be in
- * real coordinate and the deformation field is in mm in the space
- * of the reference image.
- * interp can be either 0, 1 or 3 meaning nearest neighbor, linear
- * or cubic spline interpolation.
- * every voxel which is not fully in the floating image takes the
- * backgreg_round value. The dtIndicies are an array of size 6
+/** The following functions select at run time the resampling function
+ * instantiated for the required interpolation kernel.
+ * 0, 1, 3 and 4 correspond to nearest neighbour, linear, cubic spline
+ * and windowed sinc interpolation respectively.
+ */
+template<class FloatingTYPE, class FieldTYPE>
+void ResampleImage3D_fused(nifti_image *floatingImage,
+                           nifti_image *deformationField,
+                           nifti_image *warpedImage,
+                           int *mask,
+                           FieldTYPE paddingValue,
+                           int kernel,
+                           bool interleaved)
+{
+    switch(kernel){
+    case 0:
+        ResampleImage3D_fused_core<FloatingTYPE,FieldTYPE,NearestNeighbourKernel>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interleaved);
+        break; // nereast-neighboor interpolation
+    case 1:
+        ResampleImage3D_fused_core<FloatingTYPE,FieldTYPE,LinearKernel>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interleaved);
+        break; // linear interpolation
+    case 4:
+        ResampleImage3D_fused_core<FloatingTYPE,FieldTYPE,SincKernel>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interleaved);
+        break; // sinc interpolation
+    default:
+        ResampleImage3D_fused_core<FloatingTYPE,FieldTYPE,CubicSplineKernel>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interleaved);
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+#ifdef _USE_AVX
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE, class WarpedTYPE>
+struct ResampleImage3D_voxelParams
+{
+    FloatingTYPE *floatingIntensity;
+    WarpedTYPE *warpedIntensity;
+    FieldTYPE *deformationFieldPtrX;
+    FieldTYPE *deformationFieldPtrY;
+    FieldTYPE *deformationFieldPtrZ;
+    nifti_image *floatingImage;
+    mat44 *floatingIJKMatrix;
+    FieldTYPE paddingValue;
+};
+/* *************************************************************** */
+/** Scalar trilinear interpolation of a single voxel, used by the vectorised
+ * kernels for the voxels that are close to the floating image boundaries */
+template<class FloatingTYPE, class FieldTYPE, class WarpedTYPE>
+void ResampleImage3D_linearVoxel(size_t index, void *params)
+{
+    ResampleImage3D_voxelParams<FloatingTYPE,FieldTYPE,WarpedTYPE> *p =
+            static_cast<ResampleImage3D_voxelParams<FloatingTYPE,FieldTYPE,WarpedTYPE> *>(params);
+    float world[3];
+    world[0]=static_cast<float>(p->deformationFieldPtrX[index]);
+    world[1]=static_cast<float>(p->deformationFieldPtrY[index]);
+    world[2]=static_cast<float>(p->deformationFieldPtrZ[index]);
+    double intensity=ResampleImage3D_voxel<FloatingTYPE,FieldTYPE,LinearKernel>
+            (p->floatingIntensity, p->floatingImage, p->floatingIJKMatrix, world, p->paddingValue);
+    // The vectorised kernels only generate single or double precision images
+    p->warpedIntensity[index]=static_cast<WarpedTYPE>(intensity);
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE, class WarpedTYPE>
+bool ResampleImage3D_linearSIMD_run(nifti_image *floatingImage,
+                                    nifti_image *deformationField,
+                                    nifti_image *warpedImage,
+                                    int *mask,
+                                    FieldTYPE paddingValue)
+{
+    int simdLevel=reg_getSIMDLevel();
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    // The vectorised kernels use 32-bit indices
+    if(simdLevel==NR_SIMD_NONE || warpedImage->nt*warpedImage->nu>1 ||
+       floatingVoxelNumber>=(size_t)std::numeric_limits<int>::max())
+        return false;
+    if(warpedImage->datatype!=NIFTI_TYPE_FLOAT32 && warpedImage->datatype!=NIFTI_TYPE_FLOAT64)
+        return false;
+
+    ResampleImage3D_voxelParams<FloatingTYPE,FieldTYPE,WarpedTYPE> params;
+    params.floatingIntensity = static_cast<FloatingTYPE *>(floatingImage->data);
+    params.warpedIntensity = static_cast<WarpedTYPE *>(warpedImage->data);
+    params.deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    params.deformationFieldPtrY = &params.deformationFieldPtrX[warpedVoxelNumber];
+    params.deformationFieldPtrZ = &params.deformationFieldPtrY[warpedVoxelNumber];
+    params.floatingImage = floatingImage;
+    if(floatingImage->sform_code>0)
+        params.floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else params.floatingIJKMatrix=&(floatingImage->qto_ijk);
+    params.paddingValue = paddingValue;
+
+    if(simdLevel==NR_SIMD_AVX512)
+        reg_simd_linearResampling3D<NR_SIMD_AVX512,FloatingTYPE,FieldTYPE,WarpedTYPE>
+                (params.floatingIntensity, &floatingImage->nx, params.floatingIJKMatrix,
+                 params.deformationFieldPtrX, params.warpedIntensity, mask, warpedVoxelNumber,
+                 static_cast<double>(paddingValue),
+                 &ResampleImage3D_linearVoxel<FloatingTYPE,FieldTYPE,WarpedTYPE>, &params);
+    else
+        reg_simd_linearResampling3D<NR_SIMD_AVX2,FloatingTYPE,FieldTYPE,WarpedTYPE>
+                (params.floatingIntensity, &floatingImage->nx, params.floatingIJKMatrix,
+                 params.deformationFieldPtrX, params.warpedIntensity, mask, warpedVoxelNumber,
+                 static_cast<double>(paddingValue),
+                 &ResampleImage3D_linearVoxel<FloatingTYPE,FieldTYPE,WarpedTYPE>, &params);
+    return true;
+}
+#endif // _USE_AVX
+/* *************************************************************** */
+/** Use the AVX2/AVX-512 trilinear kernel when the host supports it. Only
+ * the single and double precision floating images are vectorised.
+ * @return true if the image has been resampled
+ */
+template<class FloatingTYPE, class FieldTYPE>
+bool ResampleImage3D_linearSIMD(FloatingTYPE *, nifti_image *, nifti_image *,
+                                nifti_image *, int *, FieldTYPE)
+{
+    return false;
+}
+template<class FieldTYPE>
+bool ResampleImage3D_linearSIMD(float *, nifti_image *floatingImage, nifti_image *deformationField,
+                                nifti_image *warpedImage, int *mask, FieldTYPE paddingValue)
+{
+#ifdef _USE_AVX
+    return ResampleImage3D_linearSIMD_run<float,FieldTYPE,float>
+            (floatingImage, deformationField, warpedImage, mask, paddingValue);
+#else
+    return false;
+#endif
+}
+template<class FieldTYPE>
+bool ResampleImage3D_linearSIMD(double *, nifti_image *floatingImage, nifti_image *deformationField,
+                                nifti_image *warpedImage, int *mask, FieldTYPE paddingValue)
+{
+#ifdef _USE_AVX
+    return ResampleImage3D_linearSIMD_run<double,FieldTYPE,double>
+            (floatingImage, deformationField, warpedImage, mask, paddingValue);
+#else
+    return false;
+#endif
+}
+/** Use the AVX2/AVX-512 trilinear kernel to resample an integer floating
+ * image into a warped image that has the deformation field precision.
+ * @return true if the image has been resampled
+ */
+template<class FloatingTYPE, class FieldTYPE>
+bool ResampleImage3D_nativeLinearSIMD(nifti_image *floatingImage, nifti_image *deformationField,
+                                      nifti_image *warpedImage, int *mask, FieldTYPE paddingValue)
+{
+#ifdef _USE_AVX
+    return ResampleImage3D_linearSIMD_run<FloatingTYPE,FieldTYPE,FieldTYPE>
+            (floatingImage, deformationField, warpedImage, mask, paddingValue);
+#else
+    return false;
+#endif
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE>
+void ResampleImage3D(nifti_image *floatingImage,
+                     nifti_image *deformationField,
+                     nifti_image *warpedImage,
+                     int *mask,
+                     FieldTYPE paddingValue,
+                     int kernel)
+{
+    // Multi-volume images are resampled in a single pass over the voxels
+    if(warpedImage->nt*warpedImage->nu>1)
+    {
+        ResampleImage3D_fused<FloatingTYPE,FieldTYPE>(floatingImage,
+                                                      deformationField,
+                                                      warpedImage,
+                                                      mask,
+                                                      paddingValue,
+                                                      kernel,
+                                                      false);
+        return;
+    }
+    switch(kernel){
+    case 0:
+        ResampleImage3D_core<FloatingTYPE,FieldTYPE,NearestNeighbourKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // nereast-neighboor interpolation
+    case 1:
+        if(!ResampleImage3D_linearSIMD(static_cast<FloatingTYPE *>(NULL),
+                                       floatingImage,deformationField,warpedImage,mask,paddingValue))
+            ResampleImage3D_core<FloatingTYPE,FieldTYPE,LinearKernel,FloatingTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // linear interpolation
+    case 4:
+        ResampleImage3D_core<FloatingTYPE,FieldTYPE,SincKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // sinc interpolation
+    default:
+        ResampleImage3D_core<FloatingTYPE,FieldTYPE,CubicSplineKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE>
+void ResampleImage2D(nifti_image *floatingImage,
+                     nifti_image *deformationField,
+                     nifti_image *warpedImage,
+                     int *mask,
+                     FieldTYPE paddingValue,
+                     int kernel)
+{
+    switch(kernel){
+    case 0:
+        ResampleImage2D_core<FloatingTYPE,FieldTYPE,NearestNeighbourKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // nereast-neighboor interpolation
+    case 1:
+        ResampleImage2D_core<FloatingTYPE,FieldTYPE,LinearKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // linear interpolation
+    case 4:
+        ResampleImage2D_core<FloatingTYPE,FieldTYPE,SincKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // sinc interpolation
+    default:
+        ResampleImage2D_core<FloatingTYPE,FieldTYPE,CubicSplineKernel,FloatingTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue);
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+
+/** This function resample a floating image into the referential
+ * of a reference image by applying an affine transformation and
+ * a deformation field. The affine transformation has to be in
+ * real coordinate and the deformation field is in mm in the space
+ * of the reference image.
+ * interp can be either 0, 1 or 3 meaning nearest neighbor, linear
+ * or cubic spline interpolation.
+ * every voxel which is not fully in the floating image takes the
+ * backgreg_round value. The dtIndicies are an array of size 6
  * that provides the position of the DT components (if there are any)
  * these values are set to -1 if there are not
  */
@@ -781,6 +1178,94 @@ void reg_resampleImage2(nifti_image *floatingImage,
                                                     dtIndicies);
 }
 /* *************************************************************** */
+/** Resample a floating image whose intensities are stored as integers into a
+ * warped image stored with the precision of the deformation field. The
+ * integer intensities are converted on the fly by the interpolation kernels,
+ * the floating image is thus never promoted to floating point.
+ */
+template <class FieldTYPE, class FloatingTYPE>
+void reg_resampleImage_nativeFloating2(nifti_image *floatingImage,
+                                       nifti_image *warpedImage,
+                                       nifti_image *deformationField,
+                                       int *mask,
+                                       int interp,
+                                       FieldTYPE paddingValue)
+{
+    if(deformationField->nz>1)
+    {
+        switch(interp){
+        case 0:
+            ResampleImage3D_core<FloatingTYPE,FieldTYPE,NearestNeighbourKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // nereast-neighboor interpolation
+        case 1:
+            if(!ResampleImage3D_nativeLinearSIMD<FloatingTYPE,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue))
+                ResampleImage3D_core<FloatingTYPE,FieldTYPE,LinearKernel,FieldTYPE>
+                        (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // linear interpolation
+        case 4:
+            ResampleImage3D_core<FloatingTYPE,FieldTYPE,SincKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // sinc interpolation
+        default:
+            ResampleImage3D_core<FloatingTYPE,FieldTYPE,CubicSplineKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // cubic spline interpolation
+        }
+    }
+    else
+    {
+        switch(interp){
+        case 0:
+            ResampleImage2D_core<FloatingTYPE,FieldTYPE,NearestNeighbourKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // nereast-neighboor interpolation
+        case 1:
+            ResampleImage2D_core<FloatingTYPE,FieldTYPE,LinearKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // linear interpolation
+        case 4:
+            ResampleImage2D_core<FloatingTYPE,FieldTYPE,SincKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // sinc interpolation
+        default:
+            ResampleImage2D_core<FloatingTYPE,FieldTYPE,CubicSplineKernel,FieldTYPE>
+                    (floatingImage,deformationField,warpedImage,mask,paddingValue);
+            break; // cubic spline interpolation
+        }
+    }
+}
+/* *************************************************************** */
+template <class FieldTYPE>
+void reg_resampleImage_nativeFloating1(nifti_image *floatingImage,
+                                       nifti_image *warpedImage,
+                                       nifti_image *deformationField,
+                                       int *mask,
+                                       int interp,
+                                       float paddingValue)
+{
+    switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_UINT8:
+        reg_resampleImage_nativeFloating2<FieldTYPE,unsigned char>
+                (floatingImage,warpedImage,deformationField,mask,interp,(FieldTYPE)paddingValue);
+        break;
+    case NIFTI_TYPE_INT16:
+        reg_resampleImage_nativeFloating2<FieldTYPE,short>
+                (floatingImage,warpedImage,deformationField,mask,interp,(FieldTYPE)paddingValue);
+        break;
+    case NIFTI_TYPE_UINT16:
+        reg_resampleImage_nativeFloating2<FieldTYPE,unsigned short>
+                (floatingImage,warpedImage,deformationField,mask,interp,(FieldTYPE)paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImage_nativeFloating1");
+        reg_print_msg_error("The floating image data type is not supported");
+        reg_exit();
+    }
+}
+/* *************************************************************** */
 void reg_resampleImage(nifti_image *floatingImage,
                        nifti_image *warpedImage,
                        nifti_image *deformationField,
@@ -790,7 +1275,13 @@ void reg_resampleImage(nifti_image *floatingImage,
                        bool *dti_timepoint,
                        mat33 * jacMat)
 {
-    if(floatingImage->datatype != warpedImage->datatype)
+    // An integer floating image can be resampled into a warped image that has
+    // the deformation field precision
+    bool nativeFloating = floatingImage->datatype != warpedImage->datatype &&
+            reg_tools_hasNativeIntegerIntensities(floatingImage) &&
+            warpedImage->datatype == deformationField->datatype &&
+            dti_timepoint == NULL;
+    if(floatingImage->datatype != warpedImage->datatype && !nativeFloating)
     {
         reg_print_fct_error("reg_resampleImage");
         reg_print_msg_error("The floating and warped image should have the same data type");
@@ -838,6 +1329,21 @@ void reg_resampleImage(nifti_image *floatingImage,
         MrPropreRules = true;
     }
 
+    if(nativeFloating)
+    {
+        if(deformationField->datatype==NIFTI_TYPE_FLOAT32)
+            reg_resampleImage_nativeFloating1<float>(floatingImage, warpedImage, deformationField,
+                                                     mask, interp, paddingValue);
+        else reg_resampleImage_nativeFloating1<double>(floatingImage, warpedImage, deformationField,
+                                                       mask, interp, paddingValue);
+        if(MrPropreRules==true)
+        {
+            free(mask);
+            mask=NULL;
+        }
+        return;
+    }
+
     switch ( deformationField->datatype )
     {
     case NIFTI_TYPE_FLOAT32:
@@ -929,96 +1435,562 @@ void reg_resampleImage(nifti_image *floatingImage,
         }
         break;
     case NIFTI_TYPE_FLOAT64:
-        switch ( floatingImage->datatype )
-        {
-        case NIFTI_TYPE_UINT8:
-            reg_resampleImage2<double,unsigned char>(floatingImage,
-                                                     warpedImage,
-                                                     deformationField,
-                                                     mask,
-                                                     interp,
-                                                     paddingValue,
-                                                     dtIndicies,
-                                                     jacMat);
-            break;
-        case NIFTI_TYPE_INT8:
-            reg_resampleImage2<double,char>(floatingImage,
-                                            warpedImage,
-                                            deformationField,
-                                            mask,
-                                            interp,
-                                            paddingValue,
-                                            dtIndicies,
-                                            jacMat);
-            break;
-        case NIFTI_TYPE_UINT16:
-            reg_resampleImage2<double,unsigned short>(floatingImage,
-                                                      warpedImage,
-                                                      deformationField,
-                                                      mask,
-                                                      interp,
-                                                      paddingValue,
-                                                      dtIndicies,
-                                                      jacMat);
-            break;
-        case NIFTI_TYPE_INT16:
-            reg_resampleImage2<double,short>(floatingImage,
-                                             warpedImage,
-                                             deformationField,
-                                             mask,
-                                             interp,
-                                             paddingValue,
-                                             dtIndicies,
-                                             jacMat);
-            break;
-        case NIFTI_TYPE_UINT32:
-            reg_resampleImage2<double,unsigned int>(floatingImage,
-                                                    warpedImage,
-                                                    deformationField,
-                                                    mask,
-                                                    interp,
-                                                    paddingValue,
-                                                    dtIndicies,
-                                                    jacMat );
-            break;
-        case NIFTI_TYPE_INT32:
-            reg_resampleImage2<double,int>(floatingImage,
-                                           warpedImage,
-                                           deformationField,
-                                           mask,
-                                           interp,
-                                           paddingValue,
-                                           dtIndicies,
-                                           jacMat);
-            break;
-        case NIFTI_TYPE_FLOAT32:
-            reg_resampleImage2<double,float>(floatingImage,
-                                             warpedImage,
-                                             deformationField,
-                                             mask,
-                                             interp,
-                                             paddingValue,
-                                             dtIndicies,
-                                             jacMat);
-            break;
-        case NIFTI_TYPE_FLOAT64:
-            reg_resampleImage2<double,double>(floatingImage,
-                                              warpedImage,
-                                              deformationField,
-                                              mask,
-                                              interp,
-                                              paddingValue,
-                                              dtIndicies,
-                                              jacMat);
-            break;
-        default:
-            printf("floating pixel type unsupported.");
-            break;
-        }
+        switch ( floatingImage->datatype )
+        {
+        case NIFTI_TYPE_UINT8:
+            reg_resampleImage2<double,unsigned char>(floatingImage,
+                                                     warpedImage,
+                                                     deformationField,
+                                                     mask,
+                                                     interp,
+                                                     paddingValue,
+                                                     dtIndicies,
+                                                     jacMat);
+            break;
+        case NIFTI_TYPE_INT8:
+            reg_resampleImage2<double,char>(floatingImage,
+                                            warpedImage,
+                                            deformationField,
+                                            mask,
+                                            interp,
+                                            paddingValue,
+                                            dtIndicies,
+                                            jacMat);
+            break;
+        case NIFTI_TYPE_UINT16:
+            reg_resampleImage2<double,unsigned short>(floatingImage,
+                                                      warpedImage,
+                                                      deformationField,
+                                                      mask,
+                                                      interp,
+                                                      paddingValue,
+                                                      dtIndicies,
+                                                      jacMat);
+            break;
+        case NIFTI_TYPE_INT16:
+            reg_resampleImage2<double,short>(floatingImage,
+                                             warpedImage,
+                                             deformationField,
+                                             mask,
+                                             interp,
+                                             paddingValue,
+                                             dtIndicies,
+                                             jacMat);
+            break;
+        case NIFTI_TYPE_UINT32:
+            reg_resampleImage2<double,unsigned int>(floatingImage,
+                                                    warpedImage,
+                                                    deformationField,
+                                                    mask,
+                                                    interp,
+                                                    paddingValue,
+                                                    dtIndicies,
+                                                    jacMat );
+            break;
+        case NIFTI_TYPE_INT32:
+            reg_resampleImage2<double,int>(floatingImage,
+                                           warpedImage,
+                                           deformationField,
+                                           mask,
+                                           interp,
+                                           paddingValue,
+                                           dtIndicies,
+                                           jacMat);
+            break;
+        case NIFTI_TYPE_FLOAT32:
+            reg_resampleImage2<double,float>(floatingImage,
+                                             warpedImage,
+                                             deformationField,
+                                             mask,
+                                             interp,
+                                             paddingValue,
+                                             dtIndicies,
+                                             jacMat);
+            break;
+        case NIFTI_TYPE_FLOAT64:
+            reg_resampleImage2<double,double>(floatingImage,
+                                              warpedImage,
+                                              deformationField,
+                                              mask,
+                                              interp,
+                                              paddingValue,
+                                              dtIndicies,
+                                              jacMat);
+            break;
+        default:
+            printf("floating pixel type unsupported.");
+            break;
+        }
+        break;
+    default:
+        printf("Deformation field pixel type unsupported.");
+        break;
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
+/** Resample a floating image using an affine transformation without
+ * generating the deformation field. The position of every voxel is
+ * computed as in reg_affine_getDeformationField so that the warped
+ * intensities are identical to the ones obtained with the field.
+ */
+template<class FloatingTYPE, class KernelTYPE, class WarpedTYPE>
+void ResampleImage3D_affine_core(nifti_image *floatingImage,
+                                 nifti_image *warpedImage,
+                                 mat44 *affineTransformation,
+                                 int *mask,
+                                 WarpedTYPE paddingValue)
+{
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    WarpedTYPE *warpedIntensityPtr = static_cast<WarpedTYPE *>(warpedImage->data);
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+    mat44 *referenceMatrix;
+    if(warpedImage->sform_code>0)
+        referenceMatrix=&(warpedImage->sto_xyz);
+    else referenceMatrix=&(warpedImage->qto_xyz);
+    // voxel in the reference space -> real position in the floating space
+    mat44 transformationMatrix = reg_mat44_mul(affineTransformation, referenceMatrix);
+
+    for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
+    {
+#ifndef NDEBUG
+        char text[255];
+        sprintf(text, "3D affine resampling of volume number %lu",t);
+        reg_print_msg_debug(text);
+#endif
+        WarpedTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
+
+        int x, y, z;
+        size_t index;
+        double voxel[3], position[3], intensity;
+        float world[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(x, y, z, index, voxel, position, intensity, world) \
+    shared(floatingIntensity, warpedIntensity, warpedImage, mask, \
+    transformationMatrix, floatingIJKMatrix, floatingImage, paddingValue)
+#endif // _OPENMP
+        for(z=0; z<warpedImage->nz; z++)
+        {
+            index=(size_t)z*warpedImage->nx*warpedImage->ny;
+            voxel[2]=(double)z;
+            for(y=0; y<warpedImage->ny; y++)
+            {
+                voxel[1]=(double)y;
+                for(x=0; x<warpedImage->nx; x++)
+                {
+                    if(mask[index]>-1)
+                    {
+                        voxel[0]=(double)x;
+                        reg_mat44_mul(&transformationMatrix, voxel, position);
+                        world[0]=static_cast<float>(position[0]);
+                        world[1]=static_cast<float>(position[1]);
+                        world[2]=static_cast<float>(position[2]);
+                        intensity=ResampleImage3D_voxel<FloatingTYPE,WarpedTYPE,KernelTYPE>
+                                (floatingIntensity, floatingImage, floatingIJKMatrix, world, paddingValue);
+                        warpedIntensity[index]=static_cast<WarpedTYPE>(intensity);
+                    }
+                    else warpedIntensity[index]=paddingValue;
+                    index++;
+                }
+            }
+        }
+    }
+}
+/* *************************************************************** */
+#ifdef _USE_AVX
+/* *************************************************************** */
+/** The real positions of a slice of warped voxels are generated in a
+ * per-thread buffer that is then resampled using the vectorised trilinear
+ * kernel, the deformation field is thus never stored for the whole image.
+ * The positions are stored with the warped image precision.
+ */
+template<class FloatingTYPE, class WarpedTYPE>
+bool ResampleImage3D_affine_linearSIMD_run(nifti_image *floatingImage,
+                                           nifti_image *warpedImage,
+                                           mat44 *affineTransformation,
+                                           int *mask,
+                                           WarpedTYPE paddingValue)
+{
+    int simdLevel=reg_getSIMDLevel();
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    if(simdLevel==NR_SIMD_NONE || warpedImage->nt*warpedImage->nu>1 ||
+       floatingVoxelNumber>=(size_t)std::numeric_limits<int>::max())
+        return false;
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+    mat44 *referenceMatrix;
+    if(warpedImage->sform_code>0)
+        referenceMatrix=&(warpedImage->sto_xyz);
+    else referenceMatrix=&(warpedImage->qto_xyz);
+    mat44 transformationMatrix = reg_mat44_mul(affineTransformation, referenceMatrix);
+
+    FloatingTYPE *floatingIntensity = static_cast<FloatingTYPE *>(floatingImage->data);
+    WarpedTYPE *warpedIntensity = static_cast<WarpedTYPE *>(warpedImage->data);
+    size_t sliceVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny;
+
+    int threadNumber=1;
+    int tid=0;
+#if defined (_OPENMP)
+    threadNumber=omp_get_max_threads();
+#endif
+    // Every thread stores the positions of a slice, x then y then z
+    WarpedTYPE *sliceWorkspace=(WarpedTYPE *)malloc(3*(size_t)threadNumber*sliceVoxelNumber*sizeof(WarpedTYPE));
+
+    int x, y, z;
+    size_t index, sliceIndex;
+    double voxel[3], position[3];
+    WarpedTYPE *sliceField;
+    ResampleImage3D_voxelParams<FloatingTYPE,WarpedTYPE,WarpedTYPE> params;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(x, y, z, index, sliceIndex, voxel, position, sliceField, params, tid) \
+    shared(floatingImage, warpedImage, floatingIntensity, warpedIntensity, mask, \
+    sliceVoxelNumber, sliceWorkspace, transformationMatrix, floatingIJKMatrix, \
+    paddingValue, simdLevel)
+#endif // _OPENMP
+    for(z=0; z<warpedImage->nz; ++z)
+    {
+#if defined (_OPENMP)
+        tid=omp_get_thread_num();
+#endif
+        sliceField=&sliceWorkspace[3*(size_t)tid*sliceVoxelNumber];
+        index=(size_t)z*sliceVoxelNumber;
+        sliceIndex=0;
+        voxel[2]=(double)z;
+        for(y=0; y<warpedImage->ny; ++y)
+        {
+            voxel[1]=(double)y;
+            for(x=0; x<warpedImage->nx; ++x)
+            {
+                if(mask[index+sliceIndex]>-1)
+                {
+                    voxel[0]=(double)x;
+                    // Same arithmetic as reg_affine_getDeformationField
+                    reg_mat44_mul(&transformationMatrix, voxel, position);
+                    sliceField[sliceIndex]=(WarpedTYPE)position[0];
+                    sliceField[sliceIndex+sliceVoxelNumber]=(WarpedTYPE)position[1];
+                    sliceField[sliceIndex+2*sliceVoxelNumber]=(WarpedTYPE)position[2];
+                }
+                sliceIndex++;
+            }
+        }
+        params.floatingIntensity = floatingIntensity;
+        params.warpedIntensity = &warpedIntensity[index];
+        params.deformationFieldPtrX = sliceField;
+        params.deformationFieldPtrY = &sliceField[sliceVoxelNumber];
+        params.deformationFieldPtrZ = &sliceField[2*sliceVoxelNumber];
+        params.floatingImage = floatingImage;
+        params.floatingIJKMatrix = floatingIJKMatrix;
+        params.paddingValue = paddingValue;
+        if(simdLevel==NR_SIMD_AVX512)
+            reg_simd_linearResampling3D<NR_SIMD_AVX512,FloatingTYPE,WarpedTYPE,WarpedTYPE>
+                    (floatingIntensity, &floatingImage->nx, floatingIJKMatrix,
+                     sliceField, &warpedIntensity[index], &mask[index], sliceVoxelNumber,
+                     static_cast<double>(paddingValue),
+                     &ResampleImage3D_linearVoxel<FloatingTYPE,WarpedTYPE,WarpedTYPE>, &params);
+        else
+            reg_simd_linearResampling3D<NR_SIMD_AVX2,FloatingTYPE,WarpedTYPE,WarpedTYPE>
+                    (floatingIntensity, &floatingImage->nx, floatingIJKMatrix,
+                     sliceField, &warpedIntensity[index], &mask[index], sliceVoxelNumber,
+                     static_cast<double>(paddingValue),
+                     &ResampleImage3D_linearVoxel<FloatingTYPE,WarpedTYPE,WarpedTYPE>, &params);
+    }
+    free(sliceWorkspace);
+    return true;
+}
+#endif // _USE_AVX
+/* *************************************************************** */
+template<class FloatingTYPE, class WarpedTYPE>
+bool ResampleImage3D_affine_linearSIMD(nifti_image *floatingImage,
+                                       nifti_image *warpedImage,
+                                       mat44 *affineTransformation,
+                                       int *mask,
+                                       WarpedTYPE paddingValue)
+{
+#ifdef _USE_AVX
+    return ResampleImage3D_affine_linearSIMD_run<FloatingTYPE,WarpedTYPE>
+            (floatingImage, warpedImage, affineTransformation, mask, paddingValue);
+#else
+    return false;
+#endif
+}
+/* *************************************************************** */
+template<class FloatingTYPE>
+void reg_resampleImage_affine1(nifti_image *floatingImage,
+                               nifti_image *warpedImage,
+                               mat44 *affineTransformation,
+                               int *mask,
+                               int interp,
+                               float paddingValue)
+{
+    FloatingTYPE padding = static_cast<FloatingTYPE>(paddingValue);
+    switch(interp){
+    case 0:
+        ResampleImage3D_affine_core<FloatingTYPE,NearestNeighbourKernel,FloatingTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // nereast-neighboor interpolation
+    case 1:
+        if(!ResampleImage3D_affine_linearSIMD<FloatingTYPE,FloatingTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding))
+            ResampleImage3D_affine_core<FloatingTYPE,LinearKernel,FloatingTYPE>
+                    (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // linear interpolation
+    case 4:
+        ResampleImage3D_affine_core<FloatingTYPE,SincKernel,FloatingTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // sinc interpolation
+    default:
+        ResampleImage3D_affine_core<FloatingTYPE,CubicSplineKernel,FloatingTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+/** Resample an integer floating image into a warped image stored as
+ * WarpedTYPE.
+ */
+template<class WarpedTYPE, class FloatingTYPE>
+void reg_resampleImage_affine_nativeFloating2(nifti_image *floatingImage,
+                                              nifti_image *warpedImage,
+                                              mat44 *affineTransformation,
+                                              int *mask,
+                                              int interp,
+                                              float paddingValue)
+{
+    WarpedTYPE padding = static_cast<WarpedTYPE>(paddingValue);
+    switch(interp){
+    case 0:
+        ResampleImage3D_affine_core<FloatingTYPE,NearestNeighbourKernel,WarpedTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // nereast-neighboor interpolation
+    case 1:
+        if(!ResampleImage3D_affine_linearSIMD<FloatingTYPE,WarpedTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding))
+            ResampleImage3D_affine_core<FloatingTYPE,LinearKernel,WarpedTYPE>
+                    (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // linear interpolation
+    case 4:
+        ResampleImage3D_affine_core<FloatingTYPE,SincKernel,WarpedTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // sinc interpolation
+    default:
+        ResampleImage3D_affine_core<FloatingTYPE,CubicSplineKernel,WarpedTYPE>
+                (floatingImage,warpedImage,affineTransformation,mask,padding);
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+template<class WarpedTYPE>
+void reg_resampleImage_affine_nativeFloating1(nifti_image *floatingImage,
+                                              nifti_image *warpedImage,
+                                              mat44 *affineTransformation,
+                                              int *mask,
+                                              int interp,
+                                              float paddingValue)
+{
+    switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_UINT8:
+        reg_resampleImage_affine_nativeFloating2<WarpedTYPE,unsigned char>
+                (floatingImage,warpedImage,affineTransformation,mask,interp,paddingValue);
+        break;
+    case NIFTI_TYPE_INT16:
+        reg_resampleImage_affine_nativeFloating2<WarpedTYPE,short>
+                (floatingImage,warpedImage,affineTransformation,mask,interp,paddingValue);
+        break;
+    case NIFTI_TYPE_UINT16:
+        reg_resampleImage_affine_nativeFloating2<WarpedTYPE,unsigned short>
+                (floatingImage,warpedImage,affineTransformation,mask,interp,paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImage_affine_nativeFloating1");
+        reg_print_msg_error("The floating image data type is not supported");
+        reg_exit();
+    }
+}
+/* *************************************************************** */
+void reg_resampleImage_affine(nifti_image *floatingImage,
+                              nifti_image *warpedImage,
+                              mat44 *affineTransformation,
+                              int *mask,
+                              int interp,
+                              float paddingValue)
+{
+    // An integer floating image can be resampled into a floating point warped image
+    bool nativeFloating = floatingImage->datatype != warpedImage->datatype &&
+            reg_tools_hasNativeIntegerIntensities(floatingImage) &&
+            (warpedImage->datatype == NIFTI_TYPE_FLOAT32 ||
+             warpedImage->datatype == NIFTI_TYPE_FLOAT64);
+    if(floatingImage->datatype != warpedImage->datatype && !nativeFloating)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating and warped image should have the same data type");
+        reg_exit();
+    }
+    if(floatingImage->nt != warpedImage->nt)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating and warped images have different dimension along the time axis");
+        reg_exit();
+    }
+    if(warpedImage->nz<2)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("Only 3D images are supported");
+        reg_exit();
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    if(nativeFloating)
+    {
+        if(warpedImage->datatype==NIFTI_TYPE_FLOAT32)
+            reg_resampleImage_affine_nativeFloating1<float>(floatingImage, warpedImage, affineTransformation,
+                                                            mask, interp, paddingValue);
+        else reg_resampleImage_affine_nativeFloating1<double>(floatingImage, warpedImage, affineTransformation,
+                                                              mask, interp, paddingValue);
+    }
+    else switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleImage_affine1<float>(floatingImage, warpedImage, affineTransformation,
+                                         mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleImage_affine1<double>(floatingImage, warpedImage, affineTransformation,
+                                          mask, interp, paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating image data type is not supported");
+        reg_exit();
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
+template <class FieldTYPE>
+void reg_resampleImage_interleaved1(nifti_image *floatingImage,
+                                    nifti_image *warpedImage,
+                                    nifti_image *deformationField,
+                                    int *mask,
+                                    int interp,
+                                    float paddingValue)
+{
+    switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_UINT8:
+        ResampleImage3D_fused<unsigned char,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_INT8:
+        ResampleImage3D_fused<char,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_UINT16:
+        ResampleImage3D_fused<unsigned short,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_INT16:
+        ResampleImage3D_fused<short,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_UINT32:
+        ResampleImage3D_fused<unsigned int,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_INT32:
+        ResampleImage3D_fused<int,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_FLOAT32:
+        ResampleImage3D_fused<float,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        ResampleImage3D_fused<double,FieldTYPE>
+                (floatingImage,deformationField,warpedImage,mask,paddingValue,interp,true);
         break;
     default:
-        printf("Deformation field pixel type unsupported.");
+        reg_print_fct_error("reg_resampleImage_interleaved1");
+        reg_print_msg_error("Unsupported floating image datatype");
+        reg_exit();
+    }
+}
+/* *************************************************************** */
+void reg_resampleImage_interleaved(nifti_image *floatingImage,
+                                   nifti_image *warpedImage,
+                                   nifti_image *deformationField,
+                                   int *mask,
+                                   int interp,
+                                   float paddingValue)
+{
+    if(floatingImage->datatype != warpedImage->datatype)
+    {
+        reg_print_fct_error("reg_resampleImage_interleaved");
+        reg_print_msg_error("The floating and warped image should have the same data type");
+        reg_exit();
+    }
+    if(floatingImage->nt*floatingImage->nu != warpedImage->nt*warpedImage->nu)
+    {
+        reg_print_fct_error("reg_resampleImage_interleaved");
+        reg_print_msg_error("The floating and warped images have different number of volumes");
+        reg_exit();
+    }
+    if(deformationField->nz==1)
+    {
+        reg_print_fct_error("reg_resampleImage_interleaved");
+        reg_print_msg_error("Not implemented for 2D images yet");
+        reg_exit();
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        // voxels in the background are set to negative value so 0 corresponds to active voxel
+        mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    switch(deformationField->datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleImage_interleaved1<float>
+                (floatingImage,warpedImage,deformationField,mask,interp,paddingValue);
         break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleImage_interleaved1<double>
+                (floatingImage,warpedImage,deformationField,mask,interp,paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImage_interleaved");
+        reg_print_msg_error("Deformation field pixel type unsupported");
+        reg_exit();
     }
     if(MrPropreRules==true)
     {
@@ -2525,6 +3497,259 @@ void reg_resampleGradient(nifti_image *floatingImage,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE>
+inline void TrilinearImageGradient_voxel(FloatingTYPE *floatingIntensity,
+                                         nifti_image *floatingImage,
+                                         mat44 *floatingIJKMatrix,
+                                         FieldTYPE *world,
+                                         float paddingValue,
+                                         FieldTYPE *grad)
+{
+    int previous[3], a, b, c, X, Y, Z;
+    FieldTYPE position[3], xBasis[2], yBasis[2], zBasis[2];
+    FieldTYPE deriv[2];
+    deriv[0]=-1;
+    deriv[1]=1;
+    FieldTYPE relative, coeff;
+    FieldTYPE xxTempNewValue, yyTempNewValue, zzTempNewValue, xTempNewValue, yTempNewValue;
+    FloatingTYPE *zPointer, *xyzPointer;
+
+    grad[0]=0.0;
+    grad[1]=0.0;
+    grad[2]=0.0;
+
+    /* real -> voxel; floating space */
+    reg_mat44_mul(floatingIJKMatrix, world, position);
+
+    previous[0] = static_cast<int>(reg_floor(position[0]));
+    previous[1] = static_cast<int>(reg_floor(position[1]));
+    previous[2] = static_cast<int>(reg_floor(position[2]));
+    // basis values along the x axis
+    relative=position[0]-(FieldTYPE)previous[0];
+    xBasis[0]= (FieldTYPE)(1.0-relative);
+    xBasis[1]= relative;
+    // basis values along the y axis
+    relative=position[1]-(FieldTYPE)previous[1];
+    yBasis[0]= (FieldTYPE)(1.0-relative);
+    yBasis[1]= relative;
+    // basis values along the z axis
+    relative=position[2]-(FieldTYPE)previous[2];
+    zBasis[0]= (FieldTYPE)(1.0-relative);
+    zBasis[1]= relative;
+
+    // The padding value is used for interpolation if it is different from NaN
+    if(paddingValue==paddingValue)
+    {
+        for(c=0; c<2; c++)
+        {
+            Z=previous[2]+c;
+            if(Z>-1 && Z<floatingImage->nz)
+            {
+                zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+                xxTempNewValue=0.0;
+                yyTempNewValue=0.0;
+                zzTempNewValue=0.0;
+                for(b=0; b<2; b++)
+                {
+                    Y=previous[1]+b;
+                    if(Y>-1 && Y<floatingImage->ny)
+                    {
+                        xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+                        xTempNewValue=0.0;
+                        yTempNewValue=0.0;
+                        for(a=0; a<2; a++)
+                        {
+                            X=previous[0]+a;
+                            if(X>-1 && X<floatingImage->nx)
+                            {
+                                coeff = *xyzPointer;
+                                xTempNewValue +=  coeff * deriv[a];
+                                yTempNewValue +=  coeff * xBasis[a];
+                            } // end X in range
+                            else
+                            {
+                                xTempNewValue +=  paddingValue * deriv[a];
+                                yTempNewValue +=  paddingValue * xBasis[a];
+                            }
+                            xyzPointer++;
+                        } // end a
+                        xxTempNewValue += xTempNewValue * yBasis[b];
+                        yyTempNewValue += yTempNewValue * deriv[b];
+                        zzTempNewValue += yTempNewValue * yBasis[b];
+                    } // end Y in range
+                    else
+                    {
+                        xxTempNewValue += paddingValue * yBasis[b];
+                        yyTempNewValue += paddingValue * deriv[b];
+                        zzTempNewValue += paddingValue * yBasis[b];
+                    }
+                } // end b
+                grad[0] += xxTempNewValue * zBasis[c];
+                grad[1] += yyTempNewValue * zBasis[c];
+                grad[2] += zzTempNewValue * deriv[c];
+            } // end Z in range
+            else
+            {
+                grad[0] += paddingValue * zBasis[c];
+                grad[1] += paddingValue * zBasis[c];
+                grad[2] += paddingValue * deriv[c];
+            }
+        } // end c
+    } // end padding value is different from NaN
+    else if(previous[0]>=0.f && previous[0]<(floatingImage->nx-1) &&
+            previous[1]>=0.f && previous[1]<(floatingImage->ny-1) &&
+            previous[2]>=0.f && previous[2]<(floatingImage->nz-1) )
+    {
+        for(c=0; c<2; c++)
+        {
+            Z=previous[2]+c;
+            zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+            xxTempNewValue=0.0;
+            yyTempNewValue=0.0;
+            zzTempNewValue=0.0;
+            for(b=0; b<2; b++)
+            {
+                Y=previous[1]+b;
+                xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+                xTempNewValue=0.0;
+                yTempNewValue=0.0;
+                for(a=0; a<2; a++)
+                {
+                    X=previous[0]+a;
+                    coeff = *xyzPointer;
+                    xTempNewValue +=  coeff * deriv[a];
+                    yTempNewValue +=  coeff * xBasis[a];
+                    xyzPointer++;
+                } // end a
+                xxTempNewValue += xTempNewValue * yBasis[b];
+                yyTempNewValue += yTempNewValue * deriv[b];
+                zzTempNewValue += yTempNewValue * yBasis[b];
+            } // end b
+            grad[0] += xxTempNewValue * zBasis[c];
+            grad[1] += yyTempNewValue * zBasis[c];
+            grad[2] += zzTempNewValue * deriv[c];
+        } // end c
+    } // end padding value is NaN
+    else grad[0]=grad[1]=grad[2]=0;
+}
+#ifdef _USE_AVX
+/* *************************************************************** */
+template<class FloatingTYPE, class GradientTYPE>
+struct TrilinearImageGradient_voxelParams
+{
+    FloatingTYPE *floatingIntensity;
+    float *deformationFieldPtrX;
+    float *deformationFieldPtrY;
+    float *deformationFieldPtrZ;
+    GradientTYPE *warpedGradientPtrX;
+    GradientTYPE *warpedGradientPtrY;
+    GradientTYPE *warpedGradientPtrZ;
+    nifti_image *floatingImage;
+    mat44 *floatingIJKMatrix;
+    float paddingValue;
+};
+/* *************************************************************** */
+/** Scalar gradient of a single voxel, used by the vectorised kernels for
+ * the voxels that are close to the floating image boundaries */
+template<class FloatingTYPE, class GradientTYPE>
+void TrilinearImageGradient_linearVoxel(size_t index, void *params)
+{
+    TrilinearImageGradient_voxelParams<FloatingTYPE,GradientTYPE> *p =
+            static_cast<TrilinearImageGradient_voxelParams<FloatingTYPE,GradientTYPE> *>(params);
+    float world[3], grad[3];
+    world[0]=p->deformationFieldPtrX[index];
+    world[1]=p->deformationFieldPtrY[index];
+    world[2]=p->deformationFieldPtrZ[index];
+    TrilinearImageGradient_voxel<FloatingTYPE,float>
+            (p->floatingIntensity, p->floatingImage, p->floatingIJKMatrix, world, p->paddingValue, grad);
+    p->warpedGradientPtrX[index] = (GradientTYPE)grad[0];
+    p->warpedGradientPtrY[index] = (GradientTYPE)grad[1];
+    p->warpedGradientPtrZ[index] = (GradientTYPE)grad[2];
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class GradientTYPE>
+bool TrilinearImageGradient_SIMD_run(FloatingTYPE *floatingIntensity,
+                                     float *deformationFieldPtrX,
+                                     GradientTYPE *warpedGradientPtrX,
+                                     nifti_image *floatingImage,
+                                     mat44 *floatingIJKMatrix,
+                                     int *mask,
+                                     size_t referenceVoxelNumber,
+                                     float paddingValue)
+{
+    int simdLevel=reg_getSIMDLevel();
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    // The vectorised kernels use 32-bit indices
+    if(simdLevel==NR_SIMD_NONE ||
+       floatingVoxelNumber>=(size_t)std::numeric_limits<int>::max())
+        return false;
+
+    TrilinearImageGradient_voxelParams<FloatingTYPE,GradientTYPE> params;
+    params.floatingIntensity = floatingIntensity;
+    params.deformationFieldPtrX = deformationFieldPtrX;
+    params.deformationFieldPtrY = &params.deformationFieldPtrX[referenceVoxelNumber];
+    params.deformationFieldPtrZ = &params.deformationFieldPtrY[referenceVoxelNumber];
+    params.warpedGradientPtrX = warpedGradientPtrX;
+    params.warpedGradientPtrY = &params.warpedGradientPtrX[referenceVoxelNumber];
+    params.warpedGradientPtrZ = &params.warpedGradientPtrY[referenceVoxelNumber];
+    params.floatingImage = floatingImage;
+    params.floatingIJKMatrix = floatingIJKMatrix;
+    params.paddingValue = paddingValue;
+
+    if(simdLevel==NR_SIMD_AVX512)
+        reg_simd_linearGradient3D<NR_SIMD_AVX512,FloatingTYPE,GradientTYPE>
+                (floatingIntensity, &floatingImage->nx, floatingIJKMatrix, deformationFieldPtrX,
+                 warpedGradientPtrX, mask, referenceVoxelNumber,
+                 &TrilinearImageGradient_linearVoxel<FloatingTYPE,GradientTYPE>, &params);
+    else
+        reg_simd_linearGradient3D<NR_SIMD_AVX2,FloatingTYPE,GradientTYPE>
+                (floatingIntensity, &floatingImage->nx, floatingIJKMatrix, deformationFieldPtrX,
+                 warpedGradientPtrX, mask, referenceVoxelNumber,
+                 &TrilinearImageGradient_linearVoxel<FloatingTYPE,GradientTYPE>, &params);
+    return true;
+}
+#endif // _USE_AVX
+/* *************************************************************** */
+/** Use the AVX2/AVX-512 gradient kernel when the host supports it. Only the
+ * single and double precision floating images combined with a single
+ * precision deformation field are vectorised.
+ * @return true if the gradient has been computed
+ */
+template<class FloatingTYPE, class FieldTYPE, class GradientTYPE>
+bool TrilinearImageGradient_SIMD(FloatingTYPE *, FieldTYPE *, GradientTYPE *,
+                                 nifti_image *, mat44 *, int *, size_t, float)
+{
+    return false;
+}
+template<class GradientTYPE>
+bool TrilinearImageGradient_SIMD(float *floatingIntensity, float *deformationFieldPtrX,
+                                 GradientTYPE *warpedGradientPtrX, nifti_image *floatingImage,
+                                 mat44 *floatingIJKMatrix, int *mask, size_t referenceVoxelNumber,
+                                 float paddingValue)
+{
+#ifdef _USE_AVX
+    return TrilinearImageGradient_SIMD_run<float,GradientTYPE>
+            (floatingIntensity, deformationFieldPtrX, warpedGradientPtrX, floatingImage,
+             floatingIJKMatrix, mask, referenceVoxelNumber, paddingValue);
+#else
+    return false;
+#endif
+}
+template<class GradientTYPE>
+bool TrilinearImageGradient_SIMD(double *floatingIntensity, float *deformationFieldPtrX,
+                                 GradientTYPE *warpedGradientPtrX, nifti_image *floatingImage,
+                                 mat44 *floatingIJKMatrix, int *mask, size_t referenceVoxelNumber,
+                                 float paddingValue)
+{
+#ifdef _USE_AVX
+    return TrilinearImageGradient_SIMD_run<double,GradientTYPE>
+            (floatingIntensity, deformationFieldPtrX, warpedGradientPtrX, floatingImage,
+             floatingIJKMatrix, mask, referenceVoxelNumber, paddingValue);
+#else
+    return false;
+#endif
+}
+/* *************************************************************** */
 template<class FloatingTYPE, class GradientTYPE, class FieldTYPE>
 void TrilinearImageGradient(nifti_image *floatingImage,
                             nifti_image *deformationField,
@@ -2571,19 +3796,16 @@ void TrilinearImageGradient(nifti_image *floatingImage,
     reg_print_msg_debug(text);
 #endif
 
-    int previous[3], a, b, c, X, Y, Z;
-    FieldTYPE position[3], xBasis[2], yBasis[2], zBasis[2];
-    FieldTYPE deriv[2];
-    deriv[0]=-1;
-    deriv[1]=1;
-    FieldTYPE relative, world[3], grad[3], coeff;
-    FieldTYPE xxTempNewValue, yyTempNewValue, zzTempNewValue, xTempNewValue, yTempNewValue;
-    FloatingTYPE *zPointer, *xyzPointer;
+    if(TrilinearImageGradient_SIMD(floatingIntensity, deformationFieldPtrX, warpedGradientPtrX,
+                                   floatingImage, floatingIJKMatrix, mask,
+                                   (size_t)referenceVoxelNumber, paddingValue))
+        return;
+
+    FieldTYPE world[3], grad[3];
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-    private(index, world, position, previous, xBasis, yBasis, zBasis, relative, grad, coeff, \
-    a, b, c, X, Y, Z, zPointer, xyzPointer, xTempNewValue, yTempNewValue, xxTempNewValue, yyTempNewValue, zzTempNewValue) \
-    shared(floatingIntensity, referenceVoxelNumber, floatingVoxelNumber, deriv, paddingValue, \
+    private(index, world, grad) \
+    shared(floatingIntensity, referenceVoxelNumber, paddingValue, \
     deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, \
     floatingIJKMatrix, floatingImage, warpedGradientPtrX, warpedGradientPtrY, warpedGradientPtrZ)
 #endif // _OPENMP
@@ -2600,119 +3822,8 @@ void TrilinearImageGradient(nifti_image *floatingImage,
             world[1]=(FieldTYPE) deformationFieldPtrY[index];
             world[2]=(FieldTYPE) deformationFieldPtrZ[index];
 
-            /* real -> voxel; floating space */
-            reg_mat44_mul(floatingIJKMatrix, world, position);
-
-            previous[0] = static_cast<int>(reg_floor(position[0]));
-            previous[1] = static_cast<int>(reg_floor(position[1]));
-            previous[2] = static_cast<int>(reg_floor(position[2]));
-            // basis values along the x axis
-            relative=position[0]-(FieldTYPE)previous[0];
-            xBasis[0]= (FieldTYPE)(1.0-relative);
-            xBasis[1]= relative;
-            // basis values along the y axis
-            relative=position[1]-(FieldTYPE)previous[1];
-            yBasis[0]= (FieldTYPE)(1.0-relative);
-            yBasis[1]= relative;
-            // basis values along the z axis
-            relative=position[2]-(FieldTYPE)previous[2];
-            zBasis[0]= (FieldTYPE)(1.0-relative);
-            zBasis[1]= relative;
-
-            // The padding value is used for interpolation if it is different from NaN
-            if(paddingValue==paddingValue)
-            {
-                for(c=0; c<2; c++)
-                {
-                    Z=previous[2]+c;
-                    if(Z>-1 && Z<floatingImage->nz)
-                    {
-                        zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                        xxTempNewValue=0.0;
-                        yyTempNewValue=0.0;
-                        zzTempNewValue=0.0;
-                        for(b=0; b<2; b++)
-                        {
-                            Y=previous[1]+b;
-                            if(Y>-1 && Y<floatingImage->ny)
-                            {
-                                xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                                xTempNewValue=0.0;
-                                yTempNewValue=0.0;
-                                for(a=0; a<2; a++)
-                                {
-                                    X=previous[0]+a;
-                                    if(X>-1 && X<floatingImage->nx)
-                                    {
-                                        coeff = *xyzPointer;
-                                        xTempNewValue +=  coeff * deriv[a];
-                                        yTempNewValue +=  coeff * xBasis[a];
-                                    } // end X in range
-                                    else
-                                    {
-                                        xTempNewValue +=  paddingValue * deriv[a];
-                                        yTempNewValue +=  paddingValue * xBasis[a];
-                                    }
-                                    xyzPointer++;
-                                } // end a
-                                xxTempNewValue += xTempNewValue * yBasis[b];
-                                yyTempNewValue += yTempNewValue * deriv[b];
-                                zzTempNewValue += yTempNewValue * yBasis[b];
-                            } // end Y in range
-                            else
-                            {
-                                xxTempNewValue += paddingValue * yBasis[b];
-                                yyTempNewValue += paddingValue * deriv[b];
-                                zzTempNewValue += paddingValue * yBasis[b];
-                            }
-                        } // end b
-                        grad[0] += xxTempNewValue * zBasis[c];
-                        grad[1] += yyTempNewValue * zBasis[c];
-                        grad[2] += zzTempNewValue * deriv[c];
-                    } // end Z in range
-                    else
-                    {
-                        grad[0] += paddingValue * zBasis[c];
-                        grad[1] += paddingValue * zBasis[c];
-                        grad[2] += paddingValue * deriv[c];
-                    }
-                } // end c
-            } // end padding value is different from NaN
-            else if(previous[0]>=0.f && previous[0]<(floatingImage->nx-1) &&
-                    previous[1]>=0.f && previous[1]<(floatingImage->ny-1) &&
-                    previous[2]>=0.f && previous[2]<(floatingImage->nz-1) )
-            {
-                for(c=0; c<2; c++)
-                {
-                    Z=previous[2]+c;
-                    zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                    xxTempNewValue=0.0;
-                    yyTempNewValue=0.0;
-                    zzTempNewValue=0.0;
-                    for(b=0; b<2; b++)
-                    {
-                        Y=previous[1]+b;
-                        xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                        xTempNewValue=0.0;
-                        yTempNewValue=0.0;
-                        for(a=0; a<2; a++)
-                        {
-                            X=previous[0]+a;
-                            coeff = *xyzPointer;
-                            xTempNewValue +=  coeff * deriv[a];
-                            yTempNewValue +=  coeff * xBasis[a];
-                            xyzPointer++;
-                        } // end a
-                        xxTempNewValue += xTempNewValue * yBasis[b];
-                        yyTempNewValue += yTempNewValue * deriv[b];
-                        zzTempNewValue += yTempNewValue * yBasis[b];
-                    } // end b
-                    grad[0] += xxTempNewValue * zBasis[c];
-                    grad[1] += yyTempNewValue * zBasis[c];
-                    grad[2] += zzTempNewValue * deriv[c];
-                } // end c
-            } // end padding value is NaN
-            else grad[0]=grad[1]=grad[2]=0;
+            TrilinearImageGradient_voxel<FloatingTYPE,FieldTYPE>
+                    (floatingIntensity, floatingImage, floatingIJKMatrix, world, paddingValue, grad);
         } // end mask
 
         warpedGradientPtrX[index] = (GradientTYPE)grad[0];
@@ -21,6 +21,9 @@
  * Interpolation can be nearest Neighbor (0), linear (1) or cubic spline (3).
  * The cubic spline interpolation assume a padding value of 0
  * The padding value for the NN and the LIN interpolation are user defined.
+ * A floating image stored as unsigned char, short or unsigned short without
+ * intensity scaling can be resampled into a warped image that has the datatype
+ * of the deformation field; its intensities are then converted on the fly.
  * @param floatingImage Floating image that is interpolated
  * @param warpedImage Warped image that is being generated
  * @param deformationField Vector field image that contains the dense correspondences
@@ -42,6 +45,38 @@ void reg_resampleImage(nifti_image *floatingImage,
                        float paddingValue,
                        bool *dti_timepoint = NULL,
                        mat33 * jacMat = NULL);
+/** @brief Resample a multi-volume floating image whose intensities are stored
+ * with the volumes interleaved, i.e. all the volume values of a voxel are
+ * contiguous (see reg_tools_interleaveVolumes). The floating position and the
+ * interpolation weights are computed once per voxel and applied to all volumes.
+ * The warped image is generated using the same interleaved layout.
+ * Parameters are similar to reg_resampleImage; DTI resampling is not supported
+ * and only 3D images are handled.
+ */
+extern "C++"
+void reg_resampleImage_interleaved(nifti_image *floatingImage,
+                                   nifti_image *warpedImage,
+                                   nifti_image *deformationField,
+                                   int *mask,
+                                   int interp,
+                                   float paddingValue);
+/** @brief Resample a floating image using an affine transformation without
+ * generating any deformation field. The resampled intensities are identical to
+ * the ones obtained with reg_affine_getDeformationField and reg_resampleImage.
+ * Only 3D images are handled; DTI resampling is not supported. The warped image
+ * is stored as float or double while the floating image can also be an
+ * unscaled unsigned char, short or unsigned short image.
+ * @param affineTransformation Matrix that maps the real positions of the
+ * reference/warped image into the floating real space
+ * Other parameters are similar to reg_resampleImage
+ */
+extern "C++"
+void reg_resampleImage_affine(nifti_image *floatingImage,
+                              nifti_image *warpedImage,
+                              mat44 *affineTransformation,
+                              int *mask,
+                              int interp,
+                              float paddingValue);
 extern "C++"
 void reg_resampleImage_PSF(nifti_image *floatingImage,
                            nifti_image *warpedImage,
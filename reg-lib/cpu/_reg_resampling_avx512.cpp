@@ -0,0 +1,15 @@
+/*
+ *  _reg_resampling_avx512.cpp
+ *
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+// This file is compiled with the AVX512 instruction set enabled. Its content
+// is only executed when reg_getSIMDLevel() reports NR_SIMD_AVX512.
+#include "_reg_resampling_simd.h"
+
+REG_SIMD_INSTANTIATE(NR_SIMD_AVX512)
@@ -0,0 +1,497 @@
+/**
+ * @file _reg_resampling_simd.h
+ * @brief Explicitly vectorised trilinear resampling and gradient kernels.
+ * The kernels are compiled once per instruction set (AVX2 and AVX-512) and
+ * selected at run time by _reg_resampling.cpp using reg_getSIMDLevel().
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_RESAMPLING_SIMD_H
+#define _REG_RESAMPLING_SIMD_H
+
+#include "_reg_maths.h"
+
+/** @brief Scalar fall-back used by the vectorised kernels for the voxels
+ * whose trilinear neighbourhood is not fully inside the floating image.
+ * The function has to compute and store the value of the specified voxel.
+ */
+typedef void (*reg_simd_voxelFunction)(size_t index, void *params);
+
+/** @brief Trilinear resampling of a 3D floating image. The output is
+ * bit-identical to the scalar implementation as the arithmetic is performed
+ * in double precision and in the same order. The floating intensities can be
+ * stored as integers, in which case the warped image is stored with the
+ * deformation field precision.
+ * @param floatingIntensity Intensity of the floating image volume to resample
+ * @param floatingDim Dimension of the floating image (nx, ny, nz). The
+ * voxel number is expected to be smaller than INT_MAX
+ * @param floatingIJKMatrix Matrix from real to voxel space in the floating image
+ * @param deformationField Deformation field, x then y then z positions
+ * @param warpedIntensity Warped image intensity
+ * @param mask Mask defined in the reference space
+ * @param voxelNumber Number of voxel in the reference space
+ * @param paddingValue Value used for the voxels outside of the mask
+ * @param scalarVoxel Function used for voxels that are not fully inside
+ * @param scalarParams Parameters passed to the scalarVoxel function
+ */
+extern "C++" template<int SIMD, class FloatingTYPE, class FieldTYPE, class WarpedTYPE>
+void reg_simd_linearResampling3D(const FloatingTYPE *floatingIntensity,
+                                 const int *floatingDim,
+                                 const mat44 *floatingIJKMatrix,
+                                 const FieldTYPE *deformationField,
+                                 WarpedTYPE *warpedIntensity,
+                                 const int *mask,
+                                 size_t voxelNumber,
+                                 double paddingValue,
+                                 reg_simd_voxelFunction scalarVoxel,
+                                 void *scalarParams);
+
+/** @brief Spatial gradient of a 3D floating image resampled using trilinear
+ * interpolation. The arithmetic is performed in single precision, as in the
+ * scalar implementation, and the output is bit-identical.
+ * @param floatingIntensity Intensity of the floating image volume to use
+ * @param floatingDim Dimension of the floating image (nx, ny, nz). The
+ * voxel number is expected to be smaller than INT_MAX
+ * @param floatingIJKMatrix Matrix from real to voxel space in the floating image
+ * @param deformationField Deformation field, x then y then z positions
+ * @param warpedGradient Warped gradient, x then y then z components
+ * @param mask Mask defined in the reference space
+ * @param voxelNumber Number of voxel in the reference space
+ * @param scalarVoxel Function used for voxels that are not fully inside
+ * @param scalarParams Parameters passed to the scalarVoxel function
+ */
+extern "C++" template<int SIMD, class FloatingTYPE, class GradientTYPE>
+void reg_simd_linearGradient3D(const FloatingTYPE *floatingIntensity,
+                               const int *floatingDim,
+                               const mat44 *floatingIJKMatrix,
+                               const float *deformationField,
+                               GradientTYPE *warpedGradient,
+                               const int *mask,
+                               size_t voxelNumber,
+                               reg_simd_voxelFunction scalarVoxel,
+                               void *scalarParams);
+
+/* *************************************************************** */
+/* *************************************************************** */
+/* The implementation is only visible to the translation units compiled
+ * with the relevant instruction set enabled */
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+/* *************************************************************** */
+/** @brief Thin wrappers around the intrinsics of one instruction set.
+ * vdouble holds 'width' doubles, vfloat and vint hold 'width' floats
+ * and 32-bit integers.
+ */
+template<int SIMD> struct reg_simd_ops;
+/* *************************************************************** */
+template<> struct reg_simd_ops<NR_SIMD_AVX2>
+{
+   enum {width=4};
+   typedef __m256d vdouble;
+   typedef __m128 vfloat;
+   typedef __m128i vint;
+
+   static inline vdouble set1(double a){return _mm256_set1_pd(a);}
+   static inline vdouble add(vdouble a, vdouble b){return _mm256_add_pd(a,b);}
+   static inline vdouble sub(vdouble a, vdouble b){return _mm256_sub_pd(a,b);}
+   static inline vdouble mul(vdouble a, vdouble b){return _mm256_mul_pd(a,b);}
+   static inline vdouble floor(vdouble a){return _mm256_floor_pd(a);}
+   static inline vdouble clamp(vdouble a, vdouble lo, vdouble hi)
+   {return _mm256_min_pd(_mm256_max_pd(a,lo),hi);}
+   static inline int inRange(vdouble a, vdouble lo, vdouble hi)
+   {
+      return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(a,lo,_CMP_GE_OQ),
+                                              _mm256_cmp_pd(a,hi,_CMP_LE_OQ)));
+   }
+   static inline vint toInt(vdouble a){return _mm256_cvttpd_epi32(a);}
+   static inline vfloat toFloat(vdouble a){return _mm256_cvtpd_ps(a);}
+   static inline vdouble toDouble(vfloat a){return _mm256_cvtps_pd(a);}
+
+   static inline vfloat fset1(float a){return _mm_set1_ps(a);}
+   static inline vfloat fadd(vfloat a, vfloat b){return _mm_add_ps(a,b);}
+   static inline vfloat fsub(vfloat a, vfloat b){return _mm_sub_ps(a,b);}
+   static inline vfloat fmul(vfloat a, vfloat b){return _mm_mul_ps(a,b);}
+
+   static inline vint iadd(vint a, int b){return _mm_add_epi32(a,_mm_set1_epi32(b));}
+   static inline vint iadd(vint a, vint b){return _mm_add_epi32(a,b);}
+   static inline vint imul(vint a, int b){return _mm_mullo_epi32(a,_mm_set1_epi32(b));}
+
+   static inline int activeMask(const int *mask)
+   {
+      __m128i m=_mm_loadu_si128(reinterpret_cast<const __m128i *>(mask));
+      return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(m,_mm_set1_epi32(-1))));
+   }
+   // The field is converted to single precision, as in the scalar code
+   static inline vdouble loadPosition(const float *p){return _mm256_cvtps_pd(_mm_loadu_ps(p));}
+   static inline vdouble loadPosition(const double *p)
+   {return _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_loadu_pd(p)));}
+
+   static inline vdouble gatherDouble(const float *p, vint i)
+   {return _mm256_cvtps_pd(_mm_i32gather_ps(p,i,4));}
+   static inline vdouble gatherDouble(const double *p, vint i)
+   {return _mm256_i32gather_pd(p,i,8);}
+   // Integer intensities are loaded one by one and converted
+   template<class IntTYPE>
+   static inline vdouble gatherDouble(const IntTYPE *p, vint i)
+   {
+      int index[width];
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(index),i);
+      return _mm256_set_pd(p[index[3]],p[index[2]],p[index[1]],p[index[0]]);
+   }
+   static inline vfloat gatherFloat(const float *p, vint i)
+   {return _mm_i32gather_ps(p,i,4);}
+   static inline vfloat gatherFloat(const double *p, vint i)
+   {return _mm256_cvtpd_ps(_mm256_i32gather_pd(p,i,8));}
+
+   static inline void store(float *p, vdouble a){_mm_storeu_ps(p,_mm256_cvtpd_ps(a));}
+   static inline void store(double *p, vdouble a){_mm256_storeu_pd(p,a);}
+   static inline void store(float *p, vfloat a){_mm_storeu_ps(p,a);}
+   static inline void store(double *p, vfloat a){_mm256_storeu_pd(p,_mm256_cvtps_pd(a));}
+};
+/* *************************************************************** */
+#if defined(__AVX512F__)
+template<> struct reg_simd_ops<NR_SIMD_AVX512>
+{
+   enum {width=8};
+   typedef __m512d vdouble;
+   typedef __m256 vfloat;
+   typedef __m256i vint;
+
+   static inline vdouble set1(double a){return _mm512_set1_pd(a);}
+   static inline vdouble add(vdouble a, vdouble b){return _mm512_add_pd(a,b);}
+   static inline vdouble sub(vdouble a, vdouble b){return _mm512_sub_pd(a,b);}
+   static inline vdouble mul(vdouble a, vdouble b){return _mm512_mul_pd(a,b);}
+   static inline vdouble floor(vdouble a)
+   {return _mm512_roundscale_pd(a,_MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC);}
+   static inline vdouble clamp(vdouble a, vdouble lo, vdouble hi)
+   {return _mm512_min_pd(_mm512_max_pd(a,lo),hi);}
+   static inline int inRange(vdouble a, vdouble lo, vdouble hi)
+   {
+      return static_cast<int>(_mm512_cmp_pd_mask(a,lo,_CMP_GE_OQ) &
+                              _mm512_cmp_pd_mask(a,hi,_CMP_LE_OQ));
+   }
+   static inline vint toInt(vdouble a){return _mm512_cvttpd_epi32(a);}
+   static inline vfloat toFloat(vdouble a){return _mm512_cvtpd_ps(a);}
+   static inline vdouble toDouble(vfloat a){return _mm512_cvtps_pd(a);}
+
+   static inline vfloat fset1(float a){return _mm256_set1_ps(a);}
+   static inline vfloat fadd(vfloat a, vfloat b){return _mm256_add_ps(a,b);}
+   static inline vfloat fsub(vfloat a, vfloat b){return _mm256_sub_ps(a,b);}
+   static inline vfloat fmul(vfloat a, vfloat b){return _mm256_mul_ps(a,b);}
+
+   static inline vint iadd(vint a, int b){return _mm256_add_epi32(a,_mm256_set1_epi32(b));}
+   static inline vint iadd(vint a, vint b){return _mm256_add_epi32(a,b);}
+   static inline vint imul(vint a, int b){return _mm256_mullo_epi32(a,_mm256_set1_epi32(b));}
+
+   static inline int activeMask(const int *mask)
+   {
+      __m256i m=_mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask));
+      return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(m,_mm256_set1_epi32(-1))));
+   }
+   static inline vdouble loadPosition(const float *p){return _mm512_cvtps_pd(_mm256_loadu_ps(p));}
+   static inline vdouble loadPosition(const double *p)
+   {return _mm512_cvtps_pd(_mm512_cvtpd_ps(_mm512_loadu_pd(p)));}
+
+   static inline vdouble gatherDouble(const float *p, vint i)
+   {return _mm512_cvtps_pd(_mm256_i32gather_ps(p,i,4));}
+   static inline vdouble gatherDouble(const double *p, vint i)
+   {return _mm512_i32gather_pd(i,p,8);}
+   template<class IntTYPE>
+   static inline vdouble gatherDouble(const IntTYPE *p, vint i)
+   {
+      int index[width];
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(index),i);
+      return _mm512_set_pd(p[index[7]],p[index[6]],p[index[5]],p[index[4]],
+                           p[index[3]],p[index[2]],p[index[1]],p[index[0]]);
+   }
+   static inline vfloat gatherFloat(const float *p, vint i)
+   {return _mm256_i32gather_ps(p,i,4);}
+   static inline vfloat gatherFloat(const double *p, vint i)
+   {return _mm512_cvtpd_ps(_mm512_i32gather_pd(i,p,8));}
+
+   static inline void store(float *p, vdouble a){_mm256_storeu_ps(p,_mm512_cvtpd_ps(a));}
+   static inline void store(double *p, vdouble a){_mm512_storeu_pd(p,a);}
+   static inline void store(float *p, vfloat a){_mm256_storeu_ps(p,a);}
+   static inline void store(double *p, vfloat a){_mm512_storeu_pd(p,_mm512_cvtps_pd(a));}
+};
+#endif // __AVX512F__
+/* *************************************************************** */
+/* *************************************************************** */
+template<int SIMD, class FloatingTYPE, class FieldTYPE, class WarpedTYPE>
+void reg_simd_linearResampling3D(const FloatingTYPE *floatingIntensity,
+                                 const int *floatingDim,
+                                 const mat44 *floatingIJKMatrix,
+                                 const FieldTYPE *deformationField,
+                                 WarpedTYPE *warpedIntensity,
+                                 const int *mask,
+                                 size_t voxelNumber,
+                                 double paddingValue,
+                                 reg_simd_voxelFunction scalarVoxel,
+                                 void *scalarParams)
+{
+   typedef reg_simd_ops<SIMD> ops;
+   typedef typename ops::vdouble vdouble;
+   typedef typename ops::vint vint;
+   const int width = ops::width;
+
+   const FieldTYPE *deformationFieldPtrX = deformationField;
+   const FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[voxelNumber];
+   const FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[voxelNumber];
+   WarpedTYPE paddedIntensity = static_cast<WarpedTYPE>(paddingValue);
+
+   int nx=floatingDim[0];
+   int nxy=floatingDim[0]*floatingDim[1];
+
+   // The matrix is stored as doubles, as in reg_mat44_mul
+   double matrix[3][4];
+   for(int i=0; i<3; ++i)
+      for(int j=0; j<4; ++j)
+         matrix[i][j]=static_cast<double>(floatingIJKMatrix->m[i][j]);
+
+   long batchNumber = static_cast<long>(voxelNumber/width);
+   long batch;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(floatingIntensity, floatingDim, deformationFieldPtrX, deformationFieldPtrY, \
+   deformationFieldPtrZ, warpedIntensity, mask, matrix, batchNumber, scalarVoxel, scalarParams, \
+   paddedIntensity, nx, nxy)
+#endif // _OPENMP
+   for(batch=0; batch<batchNumber; ++batch)
+   {
+      size_t index=static_cast<size_t>(batch)*ops::width;
+      int active = ops::activeMask(&mask[index]);
+      int inside = 0;
+      if(active!=0)
+      {
+         vdouble world[3], previous[3], relative[3];
+         world[0]=ops::loadPosition(&deformationFieldPtrX[index]);
+         world[1]=ops::loadPosition(&deformationFieldPtrY[index]);
+         world[2]=ops::loadPosition(&deformationFieldPtrZ[index]);
+         inside = active;
+         for(int i=0; i<3; ++i)
+         {
+            // real -> voxel; floating space. Same operation order as reg_mat44_mul
+            vdouble position=ops::add(ops::add(ops::add(
+                                                  ops::mul(ops::set1(matrix[i][0]),world[0]),
+                                                  ops::mul(ops::set1(matrix[i][1]),world[1])),
+                                               ops::mul(ops::set1(matrix[i][2]),world[2])),
+                                      ops::set1(matrix[i][3]));
+            position=ops::toDouble(ops::toFloat(position));
+            previous[i]=ops::floor(position);
+            relative[i]=ops::sub(position,previous[i]);
+            // Only the voxels with a fully defined neighbourhood are vectorised
+            inside &= ops::inRange(previous[i],
+                                   ops::set1(0.),
+                                   ops::set1(static_cast<double>(floatingDim[i]-2)));
+            previous[i]=ops::clamp(previous[i],
+                                   ops::set1(0.),
+                                   ops::set1(static_cast<double>(floatingDim[i]>1?floatingDim[i]-2:0)));
+         }
+         if(inside!=0)
+         {
+            vint floatingIndex=ops::iadd(ops::iadd(ops::imul(ops::toInt(previous[2]),nxy),
+                                                   ops::imul(ops::toInt(previous[1]),nx)),
+                                         ops::toInt(previous[0]));
+            vdouble one=ops::set1(1.);
+            vdouble xBasis[2]={ops::sub(one,relative[0]),relative[0]};
+            vdouble yBasis[2]={ops::sub(one,relative[1]),relative[1]};
+            vdouble zBasis[2]={ops::sub(one,relative[2]),relative[2]};
+            vdouble intensity=ops::set1(0.);
+            for(int c=0; c<2; ++c)
+            {
+               vdouble yTempNewValue=ops::set1(0.);
+               for(int b=0; b<2; ++b)
+               {
+                  vint xyzIndex=ops::iadd(floatingIndex,c*nxy+b*nx);
+                  vdouble xTempNewValue=ops::set1(0.);
+                  xTempNewValue=ops::add(xTempNewValue,
+                                         ops::mul(ops::gatherDouble(floatingIntensity,xyzIndex),xBasis[0]));
+                  xTempNewValue=ops::add(xTempNewValue,
+                                         ops::mul(ops::gatherDouble(floatingIntensity,ops::iadd(xyzIndex,1)),xBasis[1]));
+                  yTempNewValue=ops::add(yTempNewValue,ops::mul(xTempNewValue,yBasis[b]));
+               }
+               intensity=ops::add(intensity,ops::mul(yTempNewValue,zBasis[c]));
+            }
+            ops::store(&warpedIntensity[index],intensity);
+         }
+      }
+      if(inside!=(1<<ops::width)-1)
+      {
+         for(int i=0; i<ops::width; ++i)
+         {
+            if((inside>>i)&1) continue;
+            if((active>>i)&1)
+               scalarVoxel(index+i,scalarParams);
+            else warpedIntensity[index+i]=paddedIntensity;
+         }
+      }
+   }
+   for(size_t index=static_cast<size_t>(batchNumber)*width; index<voxelNumber; ++index)
+   {
+      if(mask[index]>-1)
+         scalarVoxel(index,scalarParams);
+      else warpedIntensity[index]=paddedIntensity;
+   }
+}
+/* *************************************************************** */
+template<int SIMD, class FloatingTYPE, class GradientTYPE>
+void reg_simd_linearGradient3D(const FloatingTYPE *floatingIntensity,
+                               const int *floatingDim,
+                               const mat44 *floatingIJKMatrix,
+                               const float *deformationField,
+                               GradientTYPE *warpedGradient,
+                               const int *mask,
+                               size_t voxelNumber,
+                               reg_simd_voxelFunction scalarVoxel,
+                               void *scalarParams)
+{
+   typedef reg_simd_ops<SIMD> ops;
+   typedef typename ops::vdouble vdouble;
+   typedef typename ops::vfloat vfloat;
+   typedef typename ops::vint vint;
+   const int width = ops::width;
+
+   const float *deformationFieldPtrX = deformationField;
+   const float *deformationFieldPtrY = &deformationFieldPtrX[voxelNumber];
+   const float *deformationFieldPtrZ = &deformationFieldPtrY[voxelNumber];
+   GradientTYPE *warpedGradientPtrX = warpedGradient;
+   GradientTYPE *warpedGradientPtrY = &warpedGradientPtrX[voxelNumber];
+   GradientTYPE *warpedGradientPtrZ = &warpedGradientPtrY[voxelNumber];
+
+   int nx=floatingDim[0];
+   int nxy=floatingDim[0]*floatingDim[1];
+
+   double matrix[3][4];
+   for(int i=0; i<3; ++i)
+      for(int j=0; j<4; ++j)
+         matrix[i][j]=static_cast<double>(floatingIJKMatrix->m[i][j]);
+
+   long batchNumber = static_cast<long>(voxelNumber/width);
+   long batch;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(floatingIntensity, floatingDim, deformationFieldPtrX, deformationFieldPtrY, \
+   deformationFieldPtrZ, warpedGradientPtrX, warpedGradientPtrY, warpedGradientPtrZ, \
+   mask, matrix, batchNumber, scalarVoxel, scalarParams, nx, nxy)
+#endif // _OPENMP
+   for(batch=0; batch<batchNumber; ++batch)
+   {
+      size_t index=static_cast<size_t>(batch)*ops::width;
+      int active = ops::activeMask(&mask[index]);
+      int inside = 0;
+      if(active!=0)
+      {
+         vdouble world[3];
+         vfloat basis[3][2];
+         vint previous[3];
+         world[0]=ops::loadPosition(&deformationFieldPtrX[index]);
+         world[1]=ops::loadPosition(&deformationFieldPtrY[index]);
+         world[2]=ops::loadPosition(&deformationFieldPtrZ[index]);
+         inside = active;
+         for(int i=0; i<3; ++i)
+         {
+            vdouble position=ops::add(ops::add(ops::add(
+                                                  ops::mul(ops::set1(matrix[i][0]),world[0]),
+                                                  ops::mul(ops::set1(matrix[i][1]),world[1])),
+                                               ops::mul(ops::set1(matrix[i][2]),world[2])),
+                                      ops::set1(matrix[i][3]));
+            vfloat positionF=ops::toFloat(position);
+            vdouble previousD=ops::floor(ops::toDouble(positionF));
+            inside &= ops::inRange(previousD,
+                                   ops::set1(0.),
+                                   ops::set1(static_cast<double>(floatingDim[i]-2)));
+            previousD=ops::clamp(previousD,
+                                 ops::set1(0.),
+                                 ops::set1(static_cast<double>(floatingDim[i]>1?floatingDim[i]-2:0)));
+            previous[i]=ops::toInt(previousD);
+            // The relative position is computed in single precision and the
+            // first basis value in double precision, as in the scalar code
+            vfloat relative=ops::fsub(positionF,ops::toFloat(previousD));
+            basis[i][0]=ops::toFloat(ops::sub(ops::set1(1.),ops::toDouble(relative)));
+            basis[i][1]=relative;
+         }
+         if(inside!=0)
+         {
+            vint floatingIndex=ops::iadd(ops::iadd(ops::imul(previous[2],nxy),
+                                                   ops::imul(previous[1],nx)),
+                                         previous[0]);
+            vfloat deriv[2]={ops::fset1(-1.f),ops::fset1(1.f)};
+            vfloat grad[3]={ops::fset1(0.f),ops::fset1(0.f),ops::fset1(0.f)};
+            for(int c=0; c<2; ++c)
+            {
+               vfloat xxTempNewValue=ops::fset1(0.f);
+               vfloat yyTempNewValue=ops::fset1(0.f);
+               vfloat zzTempNewValue=ops::fset1(0.f);
+               for(int b=0; b<2; ++b)
+               {
+                  vint xyzIndex=ops::iadd(floatingIndex,c*nxy+b*nx);
+                  vfloat xTempNewValue=ops::fset1(0.f);
+                  vfloat yTempNewValue=ops::fset1(0.f);
+                  for(int a=0; a<2; ++a)
+                  {
+                     vfloat coeff=ops::gatherFloat(floatingIntensity,ops::iadd(xyzIndex,a));
+                     xTempNewValue=ops::fadd(xTempNewValue,ops::fmul(coeff,deriv[a]));
+                     yTempNewValue=ops::fadd(yTempNewValue,ops::fmul(coeff,basis[0][a]));
+                  }
+                  xxTempNewValue=ops::fadd(xxTempNewValue,ops::fmul(xTempNewValue,basis[1][b]));
+                  yyTempNewValue=ops::fadd(yyTempNewValue,ops::fmul(yTempNewValue,deriv[b]));
+                  zzTempNewValue=ops::fadd(zzTempNewValue,ops::fmul(yTempNewValue,basis[1][b]));
+               }
+               grad[0]=ops::fadd(grad[0],ops::fmul(xxTempNewValue,basis[2][c]));
+               grad[1]=ops::fadd(grad[1],ops::fmul(yyTempNewValue,basis[2][c]));
+               grad[2]=ops::fadd(grad[2],ops::fmul(zzTempNewValue,deriv[c]));
+            }
+            ops::store(&warpedGradientPtrX[index],grad[0]);
+            ops::store(&warpedGradientPtrY[index],grad[1]);
+            ops::store(&warpedGradientPtrZ[index],grad[2]);
+         }
+      }
+      if(inside!=(1<<ops::width)-1)
+      {
+         for(int i=0; i<ops::width; ++i)
+         {
+            if((inside>>i)&1) continue;
+            if((active>>i)&1)
+               scalarVoxel(index+i,scalarParams);
+            else warpedGradientPtrX[index+i]=warpedGradientPtrY[index+i]=warpedGradientPtrZ[index+i]=0;
+         }
+      }
+   }
+   for(size_t index=static_cast<size_t>(batchNumber)*width; index<voxelNumber; ++index)
+   {
+      if(mask[index]>-1)
+         scalarVoxel(index,scalarParams);
+      else warpedGradientPtrX[index]=warpedGradientPtrY[index]=warpedGradientPtrZ[index]=0;
+   }
+}
+/* *************************************************************** */
+#define REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,FLO,FIELD,WARPED) \
+   template void reg_simd_linearResampling3D<SIMD,FLO,FIELD,WARPED> \
+   (const FLO *, const int *, const mat44 *, const FIELD *, WARPED *, const int *, size_t, double, reg_simd_voxelFunction, void *);
+#define REG_SIMD_INSTANTIATE(SIMD) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,float,float,float) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,float,double,float) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,double,float,double) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,double,double,double) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,unsigned char,float,float) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,unsigned char,double,double) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,short,float,float) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,short,double,double) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,unsigned short,float,float) \
+   REG_SIMD_INSTANTIATE_RESAMPLING(SIMD,unsigned short,double,double) \
+   template void reg_simd_linearGradient3D<SIMD,float,float> \
+   (const float *, const int *, const mat44 *, const float *, float *, const int *, size_t, reg_simd_voxelFunction, void *); \
+   template void reg_simd_linearGradient3D<SIMD,float,double> \
+   (const float *, const int *, const mat44 *, const float *, double *, const int *, size_t, reg_simd_voxelFunction, void *); \
+   template void reg_simd_linearGradient3D<SIMD,double,float> \
+   (const double *, const int *, const mat44 *, const float *, float *, const int *, size_t, reg_simd_voxelFunction, void *); \
+   template void reg_simd_linearGradient3D<SIMD,double,double> \
+   (const double *, const int *, const mat44 *, const float *, double *, const int *, size_t, reg_simd_voxelFunction, void *);
+/* *************************************************************** */
+#endif // __AVX2__
+#endif // _REG_RESAMPLING_SIMD_H
@@ -751,5 +751,133 @@ template void get_GridValues<double>(int, int, int, nifti_image *,
 double *, double *, double *, double *, double *, double *, bool, bool);
 /* *************************************************************** */
 /* *************************************************************** */
+reg_splineBasisTable::reg_splineBasisTable(nifti_image *splineControlPoint,
+                                           nifti_image *referenceImage)
+{
+   this->datatype=splineControlPoint->datatype;
+   this->voxelNumber[0]=referenceImage->nx;
+   this->voxelNumber[1]=referenceImage->ny;
+   this->voxelNumber[2]=referenceImage->nz;
+   this->gridVoxelSpacing[0]=splineControlPoint->dx / referenceImage->dx;
+   this->gridVoxelSpacing[1]=splineControlPoint->dy / referenceImage->dy;
+   this->gridVoxelSpacing[2]=splineControlPoint->dz / referenceImage->dz;
+   for(int i=0; i<3; ++i)
+   {
+      this->pre[i]=NULL;
+      this->values[i]=NULL;
+      // A single period is stored when the spacing is an integer number of voxels
+      int period=reg_round(this->gridVoxelSpacing[i]);
+      this->compact[i] = period>0 && fabs(this->gridVoxelSpacing[i]-(double)period)<1.0e-4;
+      if(this->compact[i] && period>this->voxelNumber[i])
+         this->compact[i]=false;
+      this->entryNumber[i] = this->compact[i] ? period : this->voxelNumber[i];
+      switch(this->datatype)
+      {
+      case NIFTI_TYPE_FLOAT32:
+         this->TabulateAxis<float>(i);
+         break;
+      case NIFTI_TYPE_FLOAT64:
+         this->TabulateAxis<double>(i);
+         break;
+      default:
+         reg_print_fct_error("reg_splineBasisTable::reg_splineBasisTable");
+         reg_print_msg_error("Only single or double precision is implemented for the control point grid");
+         reg_exit();
+      }
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_splineBasisTable::reg_splineBasisTable");
+#endif
+}
+/* *************************************************************** */
+reg_splineBasisTable::~reg_splineBasisTable()
+{
+   for(int i=0; i<3; ++i)
+   {
+      if(this->pre[i]!=NULL)
+         free(this->pre[i]);
+      if(this->values[i]!=NULL)
+         free(this->values[i]);
+   }
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_splineBasisTable::~reg_splineBasisTable");
+#endif
+}
+/* *************************************************************** */
+template <class DTYPE>
+void reg_splineBasisTable::TabulateAxis(int axis)
+{
+   DTYPE *tablePtr=(DTYPE *)malloc(12*this->entryNumber[axis]*sizeof(DTYPE));
+   this->values[axis]=tablePtr;
+   if(!this->compact[axis])
+      this->pre[axis]=(int *)malloc(this->voxelNumber[axis]*sizeof(int));
+   DTYPE spacing=static_cast<DTYPE>(this->gridVoxelSpacing[axis]);
+   for(int e=0; e<this->entryNumber[axis]; ++e)
+   {
+      DTYPE basis;
+      if(this->compact[axis])
+         basis=static_cast<DTYPE>(e)/static_cast<DTYPE>(this->entryNumber[axis]);
+      else
+      {
+         this->pre[axis][e]=static_cast<int>(static_cast<DTYPE>(e)/spacing);
+         basis=static_cast<DTYPE>(e)/spacing-static_cast<DTYPE>(this->pre[axis][e]);
+         if(basis<0.0) basis=0.0; //rounding error
+      }
+      get_BSplineBasisValues<DTYPE>(basis,
+                                    &tablePtr[12*e],
+                                    &tablePtr[12*e+4],
+                                    &tablePtr[12*e+8]);
+   }
+}
+/* *************************************************************** */
+bool reg_splineBasisTable::IsValid(nifti_image *splineControlPoint,
+                                   nifti_image *referenceImage) const
+{
+   if(splineControlPoint->datatype!=this->datatype)
+      return false;
+   if(referenceImage->nx!=this->voxelNumber[0] ||
+         referenceImage->ny!=this->voxelNumber[1] ||
+         referenceImage->nz!=this->voxelNumber[2])
+      return false;
+   if(splineControlPoint->dx / referenceImage->dx != this->gridVoxelSpacing[0] ||
+         splineControlPoint->dy / referenceImage->dy != this->gridVoxelSpacing[1] ||
+         splineControlPoint->dz / referenceImage->dz != this->gridVoxelSpacing[2])
+      return false;
+   // The first voxel is expected to lie on the second control point of every axis
+   mat44 transformation;
+   if(referenceImage->sform_code>0)
+      transformation=referenceImage->sto_xyz;
+   else transformation=referenceImage->qto_xyz;
+   if(splineControlPoint->sform_code>0)
+      transformation=reg_mat44_mul(&(splineControlPoint->sto_ijk), &transformation);
+   else transformation=reg_mat44_mul(&(splineControlPoint->qto_ijk), &transformation);
+   for(int i=0; i<3; ++i)
+   {
+      for(int j=0; j<3; ++j)
+      {
+         double expected = i==j ? 1.0/this->gridVoxelSpacing[i] : 0.0;
+         if(fabs(transformation.m[i][j]-expected)>1.0e-4)
+            return false;
+      }
+      if(fabs(transformation.m[i][3]-1.0)>1.0e-3)
+         return false;
+   }
+   return true;
+}
+/* *************************************************************** */
+size_t reg_splineBasisTable::GetMemoryUsage() const
+{
+   size_t valueSize = this->datatype==NIFTI_TYPE_FLOAT64 ? sizeof(double) : sizeof(float);
+   size_t memory=sizeof(reg_splineBasisTable);
+   for(int i=0; i<3; ++i)
+   {
+      memory += 12 * (size_t)this->entryNumber[i] * valueSize;
+      if(!this->compact[i])
+         memory += (size_t)this->voxelNumber[i] * sizeof(int);
+   }
+   return memory;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 
 #endif
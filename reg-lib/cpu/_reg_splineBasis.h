@@ -129,4 +129,87 @@ void get_GridValues(int startX,
                     bool approx,
                     bool displacement);
 
+/* *************************************************************** */
+/** @class reg_splineBasisTable
+ * @brief Cubic B-Spline basis values and their first and second order
+ * derivatives tabulated along every axis of an image aligned with a control
+ * point grid.
+ *
+ * Within a resolution level, the position of a voxel relative to its control
+ * point cell never changes and the basis values are thus computed only once.
+ * When the grid spacing is an integer number of voxels along an axis, the
+ * values are periodic and only one period is stored (compact table).
+ * Otherwise one entry per voxel is stored (full table).
+ */
+class reg_splineBasisTable
+{
+public:
+   /// @brief Tabulates the basis values of a grid over a reference image
+   reg_splineBasisTable(nifti_image *splineControlPoint,
+                        nifti_image *referenceImage);
+   ~reg_splineBasisTable();
+   /// @brief Returns true if the tables match the provided grid and image
+   bool IsValid(nifti_image *splineControlPoint,
+                nifti_image *referenceImage) const;
+   /// @brief Returns true if a single period is stored along an axis
+   bool IsCompact(int axis) const
+   {
+      return this->compact[axis];
+   }
+   /// @brief Returns the memory used by the tables, in bytes
+   size_t GetMemoryUsage() const;
+   /** @brief Copies the basis values of a voxel along one axis and returns
+    * the index of the first control point of the voxel cell.
+    * @param axis Axis index, 0, 1 or 2
+    * @param voxel Voxel index along the axis
+    * @param values Array of four values that receives the basis values
+    * @param first Array of four values that receives the first derivatives,
+    * ignored if NULL
+    * @param second Array of four values that receives the second
+    * derivatives, ignored if NULL
+    */
+   template <class DTYPE>
+   int GetBasisValues(int axis,
+                      int voxel,
+                      DTYPE *values,
+                      DTYPE *first=NULL,
+                      DTYPE *second=NULL) const
+   {
+      int pre, entry;
+      if(this->compact[axis])
+      {
+         pre = voxel / this->entryNumber[axis];
+         entry = voxel - pre * this->entryNumber[axis];
+      }
+      else
+      {
+         pre = this->pre[axis][voxel];
+         entry = voxel;
+      }
+      const DTYPE *tablePtr = &static_cast<const DTYPE *>(this->values[axis])[12*entry];
+      for(int i=0; i<4; ++i)
+         values[i]=tablePtr[i];
+      if(first!=NULL)
+         for(int i=0; i<4; ++i)
+            first[i]=tablePtr[4+i];
+      if(second!=NULL)
+         for(int i=0; i<4; ++i)
+            second[i]=tablePtr[8+i];
+      return pre;
+   }
+
+private:
+   int datatype;
+   int voxelNumber[3];
+   double gridVoxelSpacing[3];
+   bool compact[3];
+   int entryNumber[3];
+   int *pre[3];
+   void *values[3];
+
+   template <class DTYPE>
+   void TabulateAxis(int axis);
+};
+/* *************************************************************** */
+
 #endif
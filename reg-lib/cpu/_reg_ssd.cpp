@@ -20,6 +20,8 @@ reg_ssd::reg_ssd()
    : reg_measure()
 {
    memset(this->normaliseTimePoint,0,255*sizeof(bool) );
+   memset(this->currentSum,0,255*sizeof(double) );
+   memset(this->currentWeightSum,0,255*sizeof(double) );
 #ifndef NDEBUG
    reg_print_msg_debug("reg_ssd constructor called");
 #endif
@@ -114,7 +116,9 @@ double reg_getSSDValue(nifti_image *referenceImage,
 							  nifti_image *jacobianDetImage,
 							  int *mask,
 							  float *currentValue,
-							  nifti_image *localWeightSimImage)
+							  nifti_image *localWeightSimImage,
+							  double *sumValues,
+							  double *weightSums)
 {
 #ifdef _WIN32
    long voxel;
@@ -194,6 +198,8 @@ double reg_getSSDValue(nifti_image *referenceImage,
             }
          }
 
+         if(sumValues!=NULL) sumValues[time]=SSD_local;
+         if(weightSums!=NULL) weightSums[time]=n;
          SSD_local *= timePointWeight[time];
          currentValue[time]=-SSD_local;
          SSD_global -= SSD_local/n;
@@ -201,8 +207,8 @@ double reg_getSSDValue(nifti_image *referenceImage,
    }
    return SSD_global;
 }
-template double reg_getSSDValue<float>(nifti_image *,nifti_image *,double *,nifti_image *,int *, float *, nifti_image *);
-template double reg_getSSDValue<double>(nifti_image *,nifti_image *,double *,nifti_image *,int *, float *, nifti_image *);
+template double reg_getSSDValue<float>(nifti_image *,nifti_image *,double *,nifti_image *,int *, float *, nifti_image *, double *, double *);
+template double reg_getSSDValue<double>(nifti_image *,nifti_image *,double *,nifti_image *,int *, float *, nifti_image *, double *, double *);
 /* *************************************************************** */
 double reg_ssd::GetSimilarityMeasureValue()
 {
@@ -224,7 +230,9 @@ double reg_ssd::GetSimilarityMeasureValue()
              NULL, // HERE TODO this->forwardJacDetImagePointer,
              this->referenceMaskPointer,
              this->currentValue,
-             this->forwardLocalWeightSimImagePointer
+             this->forwardLocalWeightSimImagePointer,
+             this->currentSum,
+             this->currentWeightSum
              );
       break;
    case NIFTI_TYPE_FLOAT64:
@@ -235,7 +243,9 @@ double reg_ssd::GetSimilarityMeasureValue()
              NULL, // HERE TODO this->forwardJacDetImagePointer,
              this->referenceMaskPointer,
              this->currentValue,
-             this->forwardLocalWeightSimImagePointer
+             this->forwardLocalWeightSimImagePointer,
+             this->currentSum,
+             this->currentWeightSum
              );
       break;
    default:
@@ -289,6 +299,120 @@ double reg_ssd::GetSimilarityMeasureValue()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class DTYPE>
+double reg_getRegionSSDValue(nifti_image *referenceImage,
+                             nifti_image *warpedImage,
+                             nifti_image *warpedRegion,
+                             const size_t *regionVoxels,
+                             double *timePointWeight,
+                             int *mask,
+                             double *sumValues,
+                             double *weightSums,
+                             nifti_image *localWeightSimImage)
+{
+   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   size_t regionVoxelNumber = (size_t)warpedRegion->nx*warpedRegion->ny*warpedRegion->nz;
+   DTYPE *referencePtr=static_cast<DTYPE *>(referenceImage->data);
+   DTYPE *warpedPtr=static_cast<DTYPE *>(warpedImage->data);
+   DTYPE *regionPtr=static_cast<DTYPE *>(warpedRegion->data);
+   DTYPE *localWeightPtr=NULL;
+   if(localWeightSimImage!=NULL)
+      localWeightPtr=static_cast<DTYPE *>(localWeightSimImage->data);
+
+   double SSD_global=0.0;
+   double refValue, oldValue, newValue, weight;
+   for(int time=0; time<referenceImage->nt; ++time)
+   {
+      if(timePointWeight[time] > 0.0)
+      {
+         DTYPE *currentRefPtr=&referencePtr[time*voxelNumber];
+         DTYPE *currentWarPtr=&warpedPtr[time*voxelNumber];
+         DTYPE *currentRegionPtr=&regionPtr[time*regionVoxelNumber];
+         // The contributions of the region voxels are replaced in the sums
+         double SSD_local=sumValues[time], n=weightSums[time];
+         for(size_t i=0; i<regionVoxelNumber; ++i)
+         {
+            size_t voxel=regionVoxels[i];
+            if(mask[voxel]>-1)
+            {
+               refValue = (double)(currentRefPtr[voxel] * referenceImage->scl_slope +
+                                   referenceImage->scl_inter);
+               if(refValue!=refValue) continue;
+               oldValue = (double)(currentWarPtr[voxel] * warpedImage->scl_slope +
+                                   warpedImage->scl_inter);
+               newValue = (double)(currentRegionPtr[i] * warpedImage->scl_slope +
+                                   warpedImage->scl_inter);
+               weight = localWeightPtr!=NULL?(double)localWeightPtr[voxel]:1.0;
+               if(oldValue==oldValue)
+               {
+#ifdef MRF_USE_SAD
+                  SSD_local -= fabs(refValue-oldValue) * weight;
+#else
+                  SSD_local -= reg_pow2(refValue-oldValue) * weight;
+#endif
+                  n -= weight;
+               }
+               if(newValue==newValue)
+               {
+#ifdef MRF_USE_SAD
+                  SSD_local += fabs(refValue-newValue) * weight;
+#else
+                  SSD_local += reg_pow2(refValue-newValue) * weight;
+#endif
+                  n += weight;
+               }
+            }
+         }
+         SSD_global -= timePointWeight[time] * SSD_local / n;
+      }
+   }
+   return SSD_global;
+}
+/* *************************************************************** */
+double reg_ssd::GetRegionSimilarityMeasureValue(nifti_image *warpedRegion,
+                                                const size_t *regionVoxels)
+{
+   if(warpedRegion->datatype != this->referenceImagePointer->datatype)
+   {
+      reg_print_fct_error("reg_ssd::GetRegionSimilarityMeasureValue");
+      reg_print_msg_error("Both input images are exepected to have the same type");
+      reg_exit();
+   }
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      return reg_getRegionSSDValue<float>
+            (this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             warpedRegion,
+             regionVoxels,
+             this->timePointWeight,
+             this->referenceMaskPointer,
+             this->currentSum,
+             this->currentWeightSum,
+             this->forwardLocalWeightSimImagePointer
+             );
+   case NIFTI_TYPE_FLOAT64:
+      return reg_getRegionSSDValue<double>
+            (this->referenceImagePointer,
+             this->warpedFloatingImagePointer,
+             warpedRegion,
+             regionVoxels,
+             this->timePointWeight,
+             this->referenceMaskPointer,
+             this->currentSum,
+             this->currentWeightSum,
+             this->forwardLocalWeightSimImagePointer
+             );
+   default:
+      reg_print_fct_error("reg_ssd::GetRegionSimilarityMeasureValue");
+      reg_print_msg_error("Warped pixel type unsupported");
+      reg_exit();
+   }
+   return 0.;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class DTYPE>
 void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
                                   nifti_image *warpedImage,
                                   nifti_image *warImgGradient,
@@ -773,7 +897,7 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
    size_t voxIndex, voxIndex_t;
    const int label_1D_number = (discretise_radius / discretise_step) * 2 + 1;
    const int label_2D_number = label_1D_number*label_1D_number;
-   const int label_nD_number = label_2D_number*label_1D_number;
+   int label_nD_number = label_2D_number*label_1D_number;
    //output matrix = discretisedValue (first dimension displacement label, second dim. control point)
    float gridVox[3], imageVox[3];
    float currentValue;
@@ -793,12 +917,12 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
       (int)reg_ceil(controlPointGridImage->dy / refImage->dy),
       (int)reg_ceil(controlPointGridImage->dz / refImage->dz),
    };
-   const int voxelBlockNumber = blockSize[0] * blockSize[1] * blockSize[2];
-   const int voxelBlockNumber_t = blockSize[0] * blockSize[1] * blockSize[2] * refImage->nt;
+   int voxelBlockNumber = blockSize[0] * blockSize[1] * blockSize[2];
+   int voxelBlockNumber_t = blockSize[0] * blockSize[1] * blockSize[2] * refImage->nt;
    int currentControlPoint = 0;
 
    // Pointers to the input image
-   const size_t voxelNumber = (size_t)refImage->nx*
+   size_t voxelNumber = (size_t)refImage->nx*
          refImage->ny*refImage->nz;
    DTYPE *refImgPtr = static_cast<DTYPE *>(refImage->data);
    DTYPE *warImgPtr = static_cast<DTYPE *>(warImage->data);
@@ -823,7 +947,8 @@ void GetDiscretisedValueSSD_core3D_2(nifti_image *controlPointGridImage,
 #pragma omp parallel for default(none) \
    shared(controlPointGridImage, refImage, warImage, grid2img_vox, blockSize, \
    padding_value, refBlockValue, mask, refImgPtr, warImgPtr, discretise_radius, \
-   discretise_step, discretisedValue) \
+   discretise_step, discretisedValue, voxelNumber, voxelBlockNumber, voxelBlockNumber_t, \
+   label_nD_number) \
    private(cpx, cpy, cpz, x, y, z, a, b, c, t, currentControlPoint, gridVox, imageVox, \
    voxIndex, idBlock, blockIndex, definedValueNumber, tid, \
    timeV, voxIndex_t, blockIndex_t, discretisedIndex, currentSum, currentValue)
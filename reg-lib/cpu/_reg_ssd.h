@@ -48,10 +48,20 @@ public:
                                     float *discretisedValue,
                                     int discretise_radius,
                                     int discretise_step);
+   /// @brief The value is a sum over the voxels when the measure is not symmetric
+   virtual bool IsLocallyDecomposable()
+   {
+      return !this->isSymmetric;
+   }
+   /// @brief Returns the ssd value obtained when a region of the warped image is replaced
+   virtual double GetRegionSimilarityMeasureValue(nifti_image *warpedRegion,
+                                                  const size_t *regionVoxels);
    /// @brief reg_ssd class desstructor
    ~reg_ssd() {}
 protected:
    float currentValue[255];
+   double currentSum[255];
+   double currentWeightSum[255];
 
 private:
    bool normaliseTimePoint[255];
@@ -68,6 +78,10 @@ private:
  * pointer is set to NULL
  * @param mask Array that contains a mask to specify which voxel
  * should be considered. If set to NULL, all voxels are considered
+ * @param sumValues Array that receives the unweighted sum of every time
+ * point. The argument is ignored if the pointer is set to NULL
+ * @param weightSums Array that receives the sum of the voxel weights of every
+ * time point. The argument is ignored if the pointer is set to NULL
  * @return Returns the computed sum squared difference
  */
 extern "C++" template <class DTYPE>
@@ -77,7 +91,9 @@ double reg_getSSDValue(nifti_image *referenceImage,
 							  nifti_image *jacobianDeterminantImage,
 							  int *mask,
 							  float *currentValue,
-							  nifti_image *localWeightImage
+							  nifti_image *localWeightImage,
+							  double *sumValues = NULL,
+							  double *weightSums = NULL
 							 );
 
 /** @brief Compute a voxel based gradient of the sum squared difference.
@@ -0,0 +1,210 @@
+/*
+ *  _reg_timer.cpp
+ *
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_TIMER_CPP
+#define _REG_TIMER_CPP
+
+#include "_reg_timer.h"
+#include "_reg_maths.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* *************************************************************** */
+struct reg_timer_statistics
+{
+   size_t count;
+   double total;
+   double max;
+   reg_timer_statistics() : count(0), total(0), max(0) {}
+};
+/* *************************************************************** */
+struct reg_timer_event
+{
+   std::string stage;
+   double start;
+   double duration;
+};
+/* *************************************************************** */
+struct reg_timer_state
+{
+   bool recordTrace;
+   double origin;
+   std::map<std::string, int> openStages;
+   std::map<std::string, reg_timer_statistics> statistics;
+   std::vector<reg_timer_event> events;
+   reg_timer_state() : recordTrace(false), origin(0) {}
+};
+/* *************************************************************** */
+// The flag is checked on its own so that disabled timers cost a single test
+static bool reg_timer_enabled=false;
+/* *************************************************************** */
+static reg_timer_state &reg_timer_getState()
+{
+   // Created on first use to avoid any static initialisation order issue
+   static reg_timer_state state;
+   return state;
+}
+/* *************************************************************** */
+double reg_timer_getTime()
+{
+#ifdef _WIN32
+   LARGE_INTEGER frequency, counter;
+   QueryPerformanceFrequency(&frequency);
+   QueryPerformanceCounter(&counter);
+   return 1.e6 * (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+   // The monotonic clock is not affected by the adjustments of the system time
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return 1.e6 * (double)time.tv_sec + 1.e-3 * (double)time.tv_nsec;
+#endif
+}
+/* *************************************************************** */
+static bool reg_timer_compareTotal(const std::pair<std::string, reg_timer_statistics> &a,
+                                   const std::pair<std::string, reg_timer_statistics> &b)
+{
+   return a.second.total > b.second.total;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+reg_stageTimer::reg_stageTimer(const char *stage)
+{
+   this->stage=NULL;
+   this->start=0;
+   if(!reg_timer_enabled) return;
+   bool outermost;
+#pragma omp critical(reg_timer)
+   {
+      outermost = reg_timer_getState().openStages[stage]++ == 0;
+   }
+   this->stage=stage;
+   // A negative start flags a stage nested within a stage of the same name
+   this->start=outermost?reg_timer_getTime():-1.;
+}
+/* *************************************************************** */
+reg_stageTimer::~reg_stageTimer()
+{
+   this->Stop();
+}
+/* *************************************************************** */
+void reg_stageTimer::Stop()
+{
+   if(this->stage==NULL) return;
+   double end=reg_timer_getTime();
+#pragma omp critical(reg_timer)
+   {
+      reg_timer_state &state=reg_timer_getState();
+      --state.openStages[this->stage];
+      if(this->start>=0)
+      {
+         double duration=end-this->start;
+         reg_timer_statistics &statistics=state.statistics[this->stage];
+         statistics.count++;
+         statistics.total += duration;
+         if(duration>statistics.max) statistics.max=duration;
+         if(state.recordTrace)
+         {
+            reg_timer_event event;
+            event.stage=this->stage;
+            event.start=this->start-state.origin;
+            event.duration=duration;
+            state.events.push_back(event);
+         }
+      }
+   }
+   this->stage=NULL;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+void reg_timer_enable(bool recordTrace)
+{
+#pragma omp critical(reg_timer)
+   {
+      reg_timer_state &state=reg_timer_getState();
+      if(!reg_timer_enabled)
+         state.origin=reg_timer_getTime();
+      state.recordTrace = state.recordTrace || recordTrace;
+      reg_timer_enabled=true;
+   }
+}
+/* *************************************************************** */
+bool reg_timer_isEnabled()
+{
+   return reg_timer_enabled;
+}
+/* *************************************************************** */
+void reg_timer_printLevelStatistics(const char *executableName,
+                                    unsigned int level)
+{
+   if(!reg_timer_enabled) return;
+   std::vector<std::pair<std::string, reg_timer_statistics> > statistics;
+#pragma omp critical(reg_timer)
+   {
+      reg_timer_state &state=reg_timer_getState();
+      statistics.assign(state.statistics.begin(), state.statistics.end());
+      state.statistics.clear();
+   }
+   // The most expensive stages are displayed first
+   std::sort(statistics.begin(), statistics.end(), reg_timer_compareTotal);
+   char text[255];
+   sprintf(text, "Stage timings of level %u - durations include the nested stages", level);
+   reg_print_info(executableName, text);
+   for(size_t i=0; i<statistics.size(); ++i)
+   {
+      const reg_timer_statistics &stage=statistics[i].second;
+      sprintf(text, "\t%-36s %7lu calls - total %9.3f s - mean %9.3f ms - max %9.3f ms",
+              statistics[i].first.c_str(),
+              (unsigned long)stage.count,
+              stage.total*1.e-6,
+              stage.total*1.e-3/(double)stage.count,
+              stage.max*1.e-3);
+      reg_print_info(executableName, text);
+   }
+}
+/* *************************************************************** */
+bool reg_timer_writeTrace(const char *filename)
+{
+   FILE *file=fopen(filename, "w");
+   if(file==NULL)
+   {
+      reg_print_fct_error("reg_timer_writeTrace");
+      reg_print_msg_error("The trace file can not be written:");
+      reg_print_msg_error(filename);
+      return false;
+   }
+   fprintf(file, "{\"traceEvents\":[");
+#pragma omp critical(reg_timer)
+   {
+      const std::vector<reg_timer_event> &events=reg_timer_getState().events;
+      for(size_t i=0; i<events.size(); ++i)
+      {
+         fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"niftyreg\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                 "\"ts\":%.3f,\"dur\":%.3f}",
+                 i==0?"":",",
+                 events[i].stage.c_str(),
+                 events[i].start,
+                 events[i].duration);
+      }
+   }
+   fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+   fclose(file);
+   return true;
+}
+/* *************************************************************** */
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * @file _reg_timer.h
+ * @brief Low overhead timers of the registration stages
+ *
+ * The stages of the registration are timed with scoped timers. When the
+ * timers are disabled, which is the default, a timer only checks a flag.
+ * Once enabled, the duration of every stage is accumulated to report per
+ * level statistics and can be recorded as a Chrome trace-event file that
+ * can be opened in chrome://tracing or Perfetto.
+ *
+ *  Copyright (c) 2012, University College London. All rights reserved.
+ *  Centre for Medical Image Computing (CMIC)
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_TIMER_H
+#define _REG_TIMER_H
+
+#include <stddef.h>
+
+/* *************************************************************** */
+/** @class reg_stageTimer
+ * @brief Measure the duration of a registration stage from its creation
+ * to its destruction or to the call to Stop.
+ *
+ * The durations include the nested stages. A stage nested within a stage
+ * of the same name, as when an overriding function calls the function of
+ * its base class, is not counted twice.
+ */
+class reg_stageTimer
+{
+public:
+   /// @brief Start timing a stage
+   /// @param stage Name of the stage, the string has to outlive the timer
+   reg_stageTimer(const char *stage);
+   /// @brief Stop timing the stage if it has not been stopped yet
+   ~reg_stageTimer();
+   /// @brief Stop timing the stage
+   void Stop();
+
+private:
+   const char *stage;
+   double start;
+};
+/* *************************************************************** */
+/// @brief Return the time elapsed since an arbitrary origin, in microseconds,
+/// from a monotonic clock
+extern "C++"
+double reg_timer_getTime();
+/* *************************************************************** */
+/** @brief Enable the stage timers
+ * @param recordTrace All the timed stages are also recorded to be written
+ * with reg_timer_writeTrace when set to true
+ */
+extern "C++"
+void reg_timer_enable(bool recordTrace=false);
+/* *************************************************************** */
+/// @brief Return true if the stage timers are enabled
+extern "C++"
+bool reg_timer_isEnabled();
+/* *************************************************************** */
+/** @brief Print the number of calls, the total, mean and maximal duration
+ * of every stage timed since the last call and reset the statistics
+ * @param executableName Name of the executable used as prefix
+ * @param level Index of the level, starting at 1, used to label the statistics
+ */
+extern "C++"
+void reg_timer_printLevelStatistics(const char *executableName,
+                                    unsigned int level);
+/* *************************************************************** */
+/** @brief Write all the recorded stages as a Chrome trace-event JSON file
+ * @param filename Filename of the trace file
+ * @return true if the file has been written
+ */
+extern "C++"
+bool reg_timer_writeTrace(const char *filename);
+/* *************************************************************** */
+
+#endif
@@ -14,6 +14,7 @@
 #define _REG_TOOLS_CPP
 
 #include <cmath>
+#include <complex>
 #include "_reg_tools.h"
 
 /* *************************************************************** */
@@ -282,6 +283,49 @@ void reg_tools_removeSCLInfo(nifti_image *image)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+void reg_tools_interleaveVolumes(nifti_image *image,
+                                 bool interleave)
+{
+   size_t voxelNumber = (size_t)image->nx*image->ny*image->nz;
+   size_t volumeNumber = image->nvox / voxelNumber;
+   if(volumeNumber<2)
+      return;
+   size_t byteNumber = image->nbyper;
+   char *inputPtr = static_cast<char *>(image->data);
+   char *outputPtr = (char *)malloc(image->nvox*byteNumber);
+   // The strides are swapped depending of the requested layout
+   size_t inputVoxelStride = interleave?1:volumeNumber;
+   size_t inputVolumeStride = interleave?voxelNumber:1;
+   size_t outputVoxelStride = interleave?volumeNumber:1;
+   size_t outputVolumeStride = interleave?1:voxelNumber;
+#ifdef _WIN32
+   long voxel;
+   long voxelNumber_l = (long)voxelNumber;
+#else
+   size_t voxel;
+   size_t voxelNumber_l = voxelNumber;
+#endif
+   size_t volume;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(voxelNumber_l, volumeNumber, byteNumber, inputPtr, outputPtr, \
+   inputVoxelStride, inputVolumeStride, outputVoxelStride, outputVolumeStride) \
+   private(voxel, volume)
+#endif // _OPENMP
+   for(voxel=0; voxel<voxelNumber_l; ++voxel)
+   {
+      for(volume=0; volume<volumeNumber; ++volume)
+      {
+         memcpy(&outputPtr[(voxel*outputVoxelStride+volume*outputVolumeStride)*byteNumber],
+                &inputPtr[(voxel*inputVoxelStride+volume*inputVolumeStride)*byteNumber],
+                byteNumber);
+      }
+   }
+   nifti_free_data(image->data);
+   image->data=static_cast<void *>(outputPtr);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 void reg_getRealImageSpacing(nifti_image *image,
                              float *spacingValues)
 {
@@ -497,7 +541,7 @@ void reg_tools_changeDatatype1(nifti_image *image,int type)
          reg_exit();
       }
    }
-   free(image->data);
+   nifti_free_data(image->data);
    image->nbyper = sizeof(NewTYPE);
    image->data = (void *)calloc(image->nvox,sizeof(NewTYPE));
    NewTYPE *dataPtr = static_cast<NewTYPE *>(image->data);
@@ -555,6 +599,21 @@ template void reg_tools_changeDatatype<float>(nifti_image *, int);
 template void reg_tools_changeDatatype<double>(nifti_image *, int);
 /* *************************************************************** */
 /* *************************************************************** */
+bool reg_tools_hasNativeIntegerIntensities(nifti_image *image)
+{
+   if(image->datatype!=NIFTI_TYPE_UINT8 &&
+         image->datatype!=NIFTI_TYPE_INT16 &&
+         image->datatype!=NIFTI_TYPE_UINT16)
+      return false;
+   // The scaling is ignored when the slope is null
+   if(image->scl_slope!=0.f && image->scl_slope!=1.f)
+      return false;
+   if(image->scl_slope!=0.f && image->scl_inter!=0.f)
+      return false;
+   return true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class TYPE1>
 void reg_tools_operationImageToImage(nifti_image *img1,
                                      nifti_image *img2,
@@ -1100,6 +1159,301 @@ void reg_tools_divideValueToImage(nifti_image *img1,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/** Compute the coefficients of the third order recursive Gaussian filter of
+ * van Vliet, Young and Verbeek (1998) for a standard deviation expressed in
+ * voxel. Their poles are scaled so that the variance of the filter matches
+ * sigma^2. The filter gain is stored first and followed by the three
+ * feedback coefficients.
+ * The boundary matrix maps the last three values of the causal pass onto the
+ * initial states of the anti-causal pass for a zero padded line (Triggs and
+ * Sdika, 2006). It is obtained by filtering the response of every state.
+ */
+void reg_tools_getRecursiveGaussianCoefficients(double sigma,
+                                                double *coefficients,
+                                                double *boundaryMatrix)
+{
+   const std::complex<double> basePoles[3] =
+   {
+      std::complex<double>(1.41650, 1.00829),
+      std::complex<double>(1.41650, -1.00829),
+      std::complex<double>(1.86543, 0.0)
+   };
+   std::complex<double> poles[3];
+   // The pole scaling is found by bisection on the filter variance
+   double qMin=1.0e-3, qMax=1.0e4, q=1.0;
+   for(int it=0; it<100; ++it)
+   {
+      q=sqrt(qMin*qMax);
+      double variance=0.0;
+      for(int i=0; i<3; ++i)
+      {
+         poles[i]=std::pow(basePoles[i], -1.0/q);
+         variance += (2.0*poles[i]/((1.0-poles[i])*(1.0-poles[i]))).real();
+      }
+      if(variance<sigma*sigma) qMin=q;
+      else qMax=q;
+   }
+   for(int i=0; i<3; ++i)
+      poles[i]=std::pow(basePoles[i], -1.0/q);
+   coefficients[1]=(poles[0]+poles[1]+poles[2]).real();
+   coefficients[2]=-(poles[0]*poles[1]+poles[0]*poles[2]+poles[1]*poles[2]).real();
+   coefficients[3]=(poles[0]*poles[1]*poles[2]).real();
+   coefficients[0]=1.0-coefficients[1]-coefficients[2]-coefficients[3];
+
+   // The causal response is extended until it has vanished
+   int length=static_cast<int>(70.0*q)+100;
+   double *response=(double *)malloc((length+3)*sizeof(double));
+   for(int state=0; state<3; ++state)
+   {
+      response[0]=response[1]=response[2]=0.0;
+      response[2-state]=1.0;
+      for(int n=3; n<length+3; ++n)
+         response[n]=coefficients[1]*response[n-1] +
+               coefficients[2]*response[n-2] +
+               coefficients[3]*response[n-3];
+      double y1=0.0, y2=0.0, y3=0.0;
+      for(int n=length+2; n>2; --n)
+      {
+         double y=coefficients[0]*response[n] +
+               coefficients[1]*y1 + coefficients[2]*y2 + coefficients[3]*y3;
+         y3=y2;
+         y2=y1;
+         y1=y;
+      }
+      boundaryMatrix[state]=y1;
+      boundaryMatrix[3+state]=y2;
+      boundaryMatrix[6+state]=y3;
+   }
+   free(response);
+}
+/* *************************************************************** */
+/** Smooth the intensity and density values along one axis using the
+ * recursive Gaussian filter. The cost per voxel does not depend on sigma
+ * and the lines are processed in parallel.
+ */
+template <class DTYPE>
+void reg_tools_recursiveGaussianAxis(DTYPE *intensityPtr,
+                                     float *densityPtr,
+                                     int *imageDim,
+                                     int axis,
+                                     double sigma)
+{
+   double coefficients[4], boundaryMatrix[9];
+   reg_tools_getRecursiveGaussianCoefficients(sigma, coefficients, boundaryMatrix);
+#ifndef NDEBUG
+   char text[255];
+   sprintf(text, "Recursive Gaussian dim[%i] sigma[%g] gain[%g]", axis, sigma, coefficients[0]);
+   reg_print_msg_debug(text);
+#endif
+
+   int planeNumber, lineOffset;
+   switch(axis)
+   {
+   case 0:
+      planeNumber = imageDim[1]*imageDim[2];
+      lineOffset = 1;
+      break;
+   case 1:
+      planeNumber = imageDim[0]*imageDim[2];
+      lineOffset = imageDim[0];
+      break;
+   default:
+      planeNumber = imageDim[0]*imageDim[1];
+      lineOffset = planeNumber;
+      break;
+   }
+   int lineLength = imageDim[axis];
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   // Every thread uses its own line buffers
+   double *lineBuffer = (double *)malloc(2*(size_t)threadNumber*lineLength*sizeof(double));
+
+   int planeIndex, n;
+   size_t realIndex;
+   double *bufferIntensity, *bufferDensity;
+   double wI[3], wD[3], yI[3], yD[3], valueI, valueD;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(intensityPtr, densityPtr, imageDim, axis, planeNumber, lineOffset, lineLength, \
+   lineBuffer, coefficients, boundaryMatrix) \
+   private(planeIndex, n, realIndex, tid, bufferIntensity, bufferDensity, \
+   wI, wD, yI, yD, valueI, valueD)
+#endif
+   for(planeIndex=0; planeIndex<planeNumber; ++planeIndex)
+   {
+#if defined (_OPENMP)
+      tid = omp_get_thread_num();
+#endif
+      bufferIntensity = &lineBuffer[2*(size_t)tid*lineLength];
+      bufferDensity = &bufferIntensity[lineLength];
+      switch(axis)
+      {
+      case 0:
+         realIndex = (size_t)planeIndex * imageDim[0];
+         break;
+      case 1:
+         realIndex = (size_t)(planeIndex/imageDim[0]) *
+               imageDim[0]*imageDim[1] +
+               planeIndex%imageDim[0];
+         break;
+      default:
+         realIndex = planeIndex;
+         break;
+      }
+      // Causal pass, the values outside of the line are zero
+      wI[0]=wI[1]=wI[2]=0.0;
+      wD[0]=wD[1]=wD[2]=0.0;
+      for(n=0; n<lineLength; ++n)
+      {
+         valueI = coefficients[0]*static_cast<double>(intensityPtr[realIndex+(size_t)n*lineOffset]) +
+               coefficients[1]*wI[0] + coefficients[2]*wI[1] + coefficients[3]*wI[2];
+         valueD = coefficients[0]*static_cast<double>(densityPtr[realIndex+(size_t)n*lineOffset]) +
+               coefficients[1]*wD[0] + coefficients[2]*wD[1] + coefficients[3]*wD[2];
+         wI[2]=wI[1];
+         wI[1]=wI[0];
+         wI[0]=valueI;
+         wD[2]=wD[1];
+         wD[1]=wD[0];
+         wD[0]=valueD;
+         bufferIntensity[n]=valueI;
+         bufferDensity[n]=valueD;
+      }
+      // Initial states of the anti-causal pass
+      for(n=0; n<3; ++n)
+      {
+         yI[n] = boundaryMatrix[3*n]*wI[0] + boundaryMatrix[3*n+1]*wI[1] + boundaryMatrix[3*n+2]*wI[2];
+         yD[n] = boundaryMatrix[3*n]*wD[0] + boundaryMatrix[3*n+1]*wD[1] + boundaryMatrix[3*n+2]*wD[2];
+      }
+      // Anti-causal pass
+      for(n=lineLength-1; n>=0; --n)
+      {
+         valueI = coefficients[0]*bufferIntensity[n] +
+               coefficients[1]*yI[0] + coefficients[2]*yI[1] + coefficients[3]*yI[2];
+         valueD = coefficients[0]*bufferDensity[n] +
+               coefficients[1]*yD[0] + coefficients[2]*yD[1] + coefficients[3]*yD[2];
+         yI[2]=yI[1];
+         yI[1]=yI[0];
+         yI[0]=valueI;
+         yD[2]=yD[1];
+         yD[1]=yD[0];
+         yD[0]=valueD;
+         intensityPtr[realIndex+(size_t)n*lineOffset]=static_cast<DTYPE>(valueI);
+         densityPtr[realIndex+(size_t)n*lineOffset]=static_cast<float>(valueD);
+      }
+   }
+   free(lineBuffer);
+}
+/* *************************************************************** */
+/** Sum the intensity and density values over a window of 2*radius+1 voxels
+ * along one axis. Every line is first replaced by its running (summed-area)
+ * sum so that each window sum is the difference of two entries, and the cost
+ * per voxel does not depend on the radius. Several images sharing the same
+ * density are filtered together and the lines are processed in parallel.
+ */
+template <class DTYPE>
+void reg_tools_boxFilterAxis(DTYPE **intensityPtr,
+                             int intensityNumber,
+                             float *densityPtr,
+                             int *imageDim,
+                             int axis,
+                             int radius)
+{
+   int planeNumber, lineOffset;
+   switch(axis)
+   {
+   case 0:
+      planeNumber = imageDim[1]*imageDim[2];
+      lineOffset = 1;
+      break;
+   case 1:
+      planeNumber = imageDim[0]*imageDim[2];
+      lineOffset = imageDim[0];
+      break;
+   default:
+      planeNumber = imageDim[0]*imageDim[1];
+      lineOffset = planeNumber;
+      break;
+   }
+   int lineLength = imageDim[axis];
+   // The running sums have one more entry than the line
+   size_t bufferSize = 2*(size_t)(lineLength+1);
+
+   int threadNumber = 1;
+   int tid = 0;
+#if defined (_OPENMP)
+   threadNumber = omp_get_max_threads();
+#endif
+   // Every thread uses its own line buffers
+   double *lineBuffer = (double *)malloc((size_t)threadNumber*bufferSize*sizeof(double));
+
+   int planeIndex, n, i, first, last;
+   size_t realIndex;
+   double *bufferDensity, *bufferIntensity;
+   DTYPE *currentIntensityPtr;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(intensityPtr, intensityNumber, densityPtr, imageDim, axis, radius, \
+   planeNumber, lineOffset, lineLength, bufferSize, lineBuffer) \
+   private(planeIndex, n, i, first, last, realIndex, tid, bufferDensity, \
+   bufferIntensity, currentIntensityPtr)
+#endif
+   for(planeIndex=0; planeIndex<planeNumber; ++planeIndex)
+   {
+#if defined (_OPENMP)
+      tid = omp_get_thread_num();
+#endif
+      bufferDensity = &lineBuffer[(size_t)tid*bufferSize];
+      switch(axis)
+      {
+      case 0:
+         realIndex = (size_t)planeIndex * imageDim[0];
+         break;
+      case 1:
+         realIndex = (size_t)(planeIndex/imageDim[0]) *
+               imageDim[0]*imageDim[1] +
+               planeIndex%imageDim[0];
+         break;
+      default:
+         realIndex = planeIndex;
+         break;
+      }
+      // Compute the running sums of the density and of every image
+      bufferDensity[0]=0.0;
+      for(n=0; n<lineLength; ++n)
+         bufferDensity[n+1] = bufferDensity[n] +
+               static_cast<double>(densityPtr[realIndex+(size_t)n*lineOffset]);
+      for(n=0; n<lineLength; ++n)
+      {
+         first = n-radius<0?0:n-radius;
+         last = n+radius+1>lineLength?lineLength:n+radius+1;
+         densityPtr[realIndex+(size_t)n*lineOffset] =
+               static_cast<float>(bufferDensity[last]-bufferDensity[first]);
+      }
+      for(i=0; i<intensityNumber; ++i)
+      {
+         bufferIntensity = &bufferDensity[lineLength+1];
+         currentIntensityPtr = &intensityPtr[i][realIndex];
+         bufferIntensity[0]=0.0;
+         for(n=0; n<lineLength; ++n)
+            bufferIntensity[n+1] = bufferIntensity[n] +
+                  static_cast<double>(currentIntensityPtr[(size_t)n*lineOffset]);
+         for(n=0; n<lineLength; ++n)
+         {
+            first = n-radius<0?0:n-radius;
+            last = n+radius+1>lineLength?lineLength:n+radius+1;
+            currentIntensityPtr[(size_t)n*lineOffset] =
+                  static_cast<DTYPE>(bufferIntensity[last]-bufferIntensity[first]);
+         }
+      }
+   }
+   free(lineBuffer);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 void reg_tools_kernelConvolution_core(nifti_image *image,
                                       float *sigma,
@@ -1108,11 +1462,6 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                                       bool *timePoint,
                                       bool *axis)
 {
-   if(image->nx>2048 || image->ny>2048 || image->nz>2048){
-      reg_print_fct_error("reg_tools_kernelConvolution_core");
-      reg_print_msg_error("This function does not support images with dimension > 2048");
-      reg_exit();
-   }
 #ifdef WIN32
    long index;
    long voxelNumber = (long)image->nx*image->ny*image->nz;
@@ -1153,6 +1502,17 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                double temp;
                if(sigma[t]>0) temp=sigma[t]/image->pixdim[n+1]; // mm to voxel
                else temp=fabs(sigma[t]); // voxel based if negative value
+               // The recursive filter is not accurate for small kernels,
+               // which are cheap to apply explicitly
+               if(kernelType==IIR_GAUSSIAN_KERNEL && temp>=0.5)
+               {
+                  reg_tools_recursiveGaussianAxis<DTYPE>(intensityPtr,
+                                                         densityPtr,
+                                                         imageDim,
+                                                         n,
+                                                         temp);
+                  continue;
+               }
                int radius=0;
                // Define the kernel size
                if(kernelType==MEAN_KERNEL || kernelType==LINEAR_KERNEL)
@@ -1160,7 +1520,7 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                   // Mean  or linear filtering
                   radius = static_cast<int>(temp);
                }
-               else if(kernelType==GAUSSIAN_KERNEL)
+               else if(kernelType==GAUSSIAN_KERNEL || kernelType==IIR_GAUSSIAN_KERNEL)
                {
                   // Gaussian kernel
                   radius=static_cast<int>(temp*3.0f);
@@ -1175,10 +1535,22 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                   reg_print_msg_error("Unknown kernel type");
                   reg_exit();
                }
+               // The mean filter relies on running sums rather than on a kernel
+               if(kernelType==MEAN_KERNEL)
+               {
+                  if(radius>0)
+                     reg_tools_boxFilterAxis<DTYPE>(&intensityPtr,
+                                                    1,
+                                                    densityPtr,
+                                                    imageDim,
+                                                    n,
+                                                    radius);
+                  continue;
+               }
                if(radius>0)
                {
                   // Allocate the kernel
-                  float kernel[4096];
+                  float *kernel=(float *)malloc((2*radius+1)*sizeof(float));
                   double kernelSum=0;
                   // Fill the kernel
                   if(kernelType==CUBIC_SPLINE_KERNEL)
@@ -1194,7 +1566,7 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                         kernelSum += kernel[i+radius];
                      }
                   }
-                  else if(kernelType==GAUSSIAN_KERNEL)
+                  else if(kernelType==GAUSSIAN_KERNEL || kernelType==IIR_GAUSSIAN_KERNEL)
                   {
                      // Compute the Gaussian kernel
                      for(int i=-radius; i<=radius; i++)
@@ -1215,16 +1587,6 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                         kernelSum += kernel[radius+i];
                      }
                   }
-                  else if(kernelType==MEAN_KERNEL && imageDim[2]==1)
-                  {
-                     // Compute the mean kernel
-                     for(int i=-radius; i<=radius; i++)
-                     {
-                        kernel[radius+i]= 1.f;
-                        kernelSum += kernel[radius+i];
-                     }
-                  }
-                  // No kernel is required for the mean filtering
                   // No need for kernel normalisation as this is handle by the density function
 #ifndef NDEBUG
                   char text[255];
@@ -1254,10 +1616,8 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                   double densitySum, intensitySum;
                   DTYPE *currentIntensityPtr=NULL;
                   float *currentDensityPtr = NULL;
-                  DTYPE bufferIntensity[2048];
-                  float bufferDensity[2048];
-                  double bufferIntensitycur=0;
-                  double bufferDensitycur=0;
+                  DTYPE *bufferIntensity;
+                  float *bufferDensity;
 
 #ifdef _USE_SSE
                   union
@@ -1268,27 +1628,41 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                   __m128 kernel_sse, intensity_sse, density_sse;
 #endif
 
+                  // Every thread uses its own line buffers
+                  int threadNumber = 1;
+                  int tid = 0;
+#if defined (_OPENMP)
+                  threadNumber = omp_get_max_threads();
+#endif
+                  DTYPE *lineIntensity = (DTYPE *)malloc((size_t)threadNumber*imageDim[n]*sizeof(DTYPE));
+                  float *lineDensity = (float *)malloc((size_t)threadNumber*imageDim[n]*sizeof(float));
+
 #if defined (_OPENMP)
 #ifdef _USE_SSE
 #pragma omp parallel for default(none) \
    shared(imageDim, intensityPtr, densityPtr, radius, kernel, lineOffset, n, \
-   planeNumber,kernelSum) \
+   planeNumber,kernelSum, lineIntensity, lineDensity) \
    private(realIndex,currentIntensityPtr,currentDensityPtr,lineIndex,bufferIntensity, \
    bufferDensity,shiftPre,shiftPst,kernelPtr,kernelValue,densitySum,intensitySum, \
-   k, bufferIntensitycur,bufferDensitycur, planeIndex, \
+   k, planeIndex, tid, \
    kernel_sse, intensity_sse, density_sse, intensity_sum_sse, density_sum_sse)
 #else
 #pragma omp parallel for default(none) \
    shared(imageDim, intensityPtr, densityPtr, radius, kernel, lineOffset, n, \
-   planeNumber,kernelSum) \
+   planeNumber,kernelSum, lineIntensity, lineDensity) \
    private(realIndex,currentIntensityPtr,currentDensityPtr,lineIndex,bufferIntensity, \
    bufferDensity,shiftPre,shiftPst,kernelPtr,kernelValue,densitySum,intensitySum, \
-   k, bufferIntensitycur,bufferDensitycur, planeIndex)
+   k, planeIndex, tid)
 #endif
 #endif // _OPENMP
                   // Loop over the different voxel
                   for(planeIndex=0; planeIndex<planeNumber; ++planeIndex)
                   {
+#if defined (_OPENMP)
+                     tid = omp_get_thread_num();
+#endif
+                     bufferIntensity = &lineIntensity[(size_t)tid*imageDim[n]];
+                     bufferDensity = &lineDensity[(size_t)tid*imageDim[n]];
 
                      switch(n)
                      {
@@ -1384,49 +1758,10 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                            realIndex += lineOffset;
                         } // line convolution
                      } // kernel sum
-                     else
-                     {
-                        for(lineIndex=1; lineIndex<imageDim[n]; ++lineIndex)
-                        {
-                           bufferIntensity[lineIndex]+=bufferIntensity[lineIndex-1];
-                           bufferDensity[lineIndex]+=bufferDensity[lineIndex-1];
-                        }
-                        shiftPre = -radius - 1;
-                        shiftPst = radius;
-                        for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex,++shiftPre,++shiftPst)
-                        {
-                           if(shiftPre>-1)
-                           {
-                              if(shiftPst<imageDim[n])
-                              {
-                                 bufferIntensitycur = bufferIntensity[shiftPre]-bufferIntensity[shiftPst];
-                                 bufferDensitycur = bufferDensity[shiftPre]-bufferDensity[shiftPst];
-                              }
-                              else
-                              {
-                                 bufferIntensitycur = bufferIntensity[shiftPre]-bufferIntensity[imageDim[n]-1];
-                                 bufferDensitycur = bufferDensity[shiftPre]-bufferDensity[imageDim[n]-1];
-                              }
-                           }
-                           else
-                           {
-                              if(shiftPst<imageDim[n])
-                              {
-                                 bufferIntensitycur = -bufferIntensity[shiftPst];
-                                 bufferDensitycur = -bufferDensity[shiftPst];
-                              }
-                              else{
-                                 bufferIntensitycur = 0;
-                                 bufferDensitycur = 0;
-                              }
-                           }
-                           intensityPtr[realIndex]=static_cast<DTYPE>(bufferIntensitycur);
-                           densityPtr[realIndex]=static_cast<float>(bufferDensitycur);
-
-                           realIndex += lineOffset;
-                        } // line convolution of mean filter
-                     } // No kernel computation
                   } // pixel in starting plane
+                  free(lineIntensity);
+                  free(lineDensity);
+                  free(kernel);
                } // radius > 0
             } // active axis
          } // axes
@@ -1736,6 +2071,134 @@ void reg_tools_kernelConvolution(nifti_image *image,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template <class DTYPE>
+void reg_tools_meanFilter_core(nifti_image **images,
+                               int imageNumber,
+                               float width,
+                               int *mask)
+{
+#ifdef WIN32
+   long index;
+   long voxelNumber = (long)images[0]->nx*images[0]->ny*images[0]->nz;
+#else
+   size_t index;
+   size_t voxelNumber = (size_t)images[0]->nx*images[0]->ny*images[0]->nz;
+#endif
+   int imageDim[3]= {images[0]->nx,images[0]->ny,images[0]->nz};
+
+   DTYPE **intensityPtr = (DTYPE **)malloc(imageNumber*sizeof(DTYPE *));
+   for(int i=0; i<imageNumber; ++i)
+      intensityPtr[i] = static_cast<DTYPE *>(images[i]->data);
+   bool *nanImagePtr = (bool *)calloc(voxelNumber, sizeof(bool));
+   float *densityPtr = (float *)calloc(voxelNumber, sizeof(float));
+
+   // The density is shared by all images, which thus have to share their NaN
+   // voxels
+   int i, nanNumber;
+   bool sharedNaN=true;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(densityPtr, intensityPtr, imageNumber, mask, nanImagePtr, voxelNumber, sharedNaN) \
+   private(index, i, nanNumber)
+#endif
+   for(index=0; index<voxelNumber; index++)
+   {
+      nanNumber=0;
+      for(i=0; i<imageNumber; ++i)
+         if(intensityPtr[i][index]!=intensityPtr[i][index])
+            ++nanNumber;
+      if(nanNumber>0 && nanNumber<imageNumber)
+         sharedNaN=false;
+      nanImagePtr[index] = mask[index]>=0 && nanNumber==0;
+      densityPtr[index] = nanImagePtr[index]?1.f:0.f;
+      if(nanImagePtr[index]==false)
+         for(i=0; i<imageNumber; ++i)
+            intensityPtr[i][index]=static_cast<DTYPE>(0);
+   }
+   if(!sharedNaN)
+   {
+      reg_print_fct_error("reg_tools_meanFilter");
+      reg_print_msg_error("The input images are expected to share their NaN voxels");
+      reg_exit();
+   }
+   // Loop over the x, y and z dimensions
+   for(int n=0; n<3; n++)
+   {
+      if(images[0]->dim[n+1]>1)
+      {
+         double temp;
+         if(width>0) temp=width/images[0]->pixdim[n+1]; // mm to voxel
+         else temp=fabs(width); // voxel based if negative value
+         int radius = static_cast<int>(temp);
+         if(radius>0)
+            reg_tools_boxFilterAxis<DTYPE>(intensityPtr,
+                                           imageNumber,
+                                           densityPtr,
+                                           imageDim,
+                                           n,
+                                           radius);
+      }
+   }
+   // Normalise the window sums
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(voxelNumber, intensityPtr, imageNumber, densityPtr, nanImagePtr) \
+   private(index, i)
+#endif
+   for(index=0; index<voxelNumber; ++index)
+   {
+      for(i=0; i<imageNumber; ++i)
+      {
+         if(nanImagePtr[index]!=0)
+            intensityPtr[i][index] = static_cast<DTYPE>(intensityPtr[i][index]/densityPtr[index]);
+         else intensityPtr[i][index] = std::numeric_limits<DTYPE>::quiet_NaN();
+      }
+   }
+   free(nanImagePtr);
+   free(densityPtr);
+   free(intensityPtr);
+}
+/* *************************************************************** */
+void reg_tools_meanFilter(nifti_image **images,
+                          int imageNumber,
+                          float width,
+                          int *mask)
+{
+   for(int i=1; i<imageNumber; ++i)
+   {
+      if(images[i]->nx!=images[0]->nx || images[i]->ny!=images[0]->ny ||
+            images[i]->nz!=images[0]->nz || images[i]->datatype!=images[0]->datatype)
+      {
+         reg_print_fct_error("reg_tools_meanFilter");
+         reg_print_msg_error("The input images are expected to have the same dimension and type");
+         reg_exit();
+      }
+   }
+   int *currentMask=NULL;
+   if(mask==NULL)
+   {
+      currentMask=(int *)calloc(images[0]->nx*images[0]->ny*images[0]->nz,sizeof(int));
+   }
+   else currentMask=mask;
+
+   switch(images[0]->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_tools_meanFilter_core<float>(images, imageNumber, width, currentMask);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_tools_meanFilter_core<double>(images, imageNumber, width, currentMask);
+      break;
+   default:
+      reg_print_fct_error("reg_tools_meanFilter");
+      reg_print_msg_error("The image data type is not supported");
+      reg_exit();
+   }
+
+   if(mask==NULL) free(currentMask);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class PrecisionTYPE, class ImageTYPE>
 void reg_downsampleImage1(nifti_image *image, int type, bool *downsampleAxis)
 {
@@ -1752,7 +2215,7 @@ void reg_downsampleImage1(nifti_image *image, int type, bool *downsampleAxis)
    ImageTYPE *oldValues = (ImageTYPE *)malloc(image->nvox * image->nbyper);
    ImageTYPE *imagePtr = static_cast<ImageTYPE *>(image->data);
    memcpy(oldValues, imagePtr, image->nvox*image->nbyper);
-   free(image->data);
+   nifti_free_data(image->data);
 
    // Keep the previous real to voxel qform
    mat44 real2Voxel_qform;
@@ -2172,15 +2635,20 @@ double reg_tools_getMeanRMS(nifti_image *imageA, nifti_image *imageB)
 /* *************************************************************** */
 /* *************************************************************** */
 template <class DTYPE>
-int reg_createImagePyramid(nifti_image *inputImage, nifti_image **pyramid, int unsigned levelNumber, int unsigned levelToPerform)
+int reg_createImagePyramid(nifti_image *inputImage, nifti_image **pyramid, int unsigned levelNumber, int unsigned levelToPerform, bool keepNativeFinestLevel)
 {
+   // The finest level can only keep its datatype when it is not downsampled
+   keepNativeFinestLevel = keepNativeFinestLevel && levelToPerform==levelNumber &&
+         reg_tools_hasNativeIntegerIntensities(inputImage);
+
    // FINEST LEVEL OF REGISTRATION
    pyramid[levelToPerform-1]=nifti_copy_nim_info(inputImage);
    pyramid[levelToPerform-1]->data = (void *)calloc(pyramid[levelToPerform-1]->nvox,
          pyramid[levelToPerform-1]->nbyper);
    memcpy(pyramid[levelToPerform-1]->data, inputImage->data,
          pyramid[levelToPerform-1]->nvox* pyramid[levelToPerform-1]->nbyper);
-   reg_tools_changeDatatype<DTYPE>(pyramid[levelToPerform-1]);
+   if(!keepNativeFinestLevel)
+      reg_tools_changeDatatype<DTYPE>(pyramid[levelToPerform-1]);
    reg_tools_removeSCLInfo(pyramid[levelToPerform-1]);
 
    // Images are downsampled if appropriate
@@ -2203,6 +2671,9 @@ int reg_createImagePyramid(nifti_image *inputImage, nifti_image **pyramid, int u
 
       memcpy(pyramid[l]->data, pyramid[l+1]->data,
             pyramid[l]->nvox* pyramid[l]->nbyper);
+      // The copy of a native finest level is converted
+      if(keepNativeFinestLevel && l==(int)levelToPerform-2)
+         reg_tools_changeDatatype<DTYPE>(pyramid[l]);
 
       // Downsample the image if appropriate
       bool downsampleAxis[8]= {false,true,true,true,false,false,false,false};
@@ -2213,8 +2684,8 @@ int reg_createImagePyramid(nifti_image *inputImage, nifti_image **pyramid, int u
    }
    return EXIT_SUCCESS;
 }
-template int reg_createImagePyramid<float>(nifti_image *, nifti_image **, unsigned int , unsigned int);
-template int reg_createImagePyramid<double>(nifti_image *, nifti_image **, unsigned int , unsigned int);
+template int reg_createImagePyramid<float>(nifti_image *, nifti_image **, unsigned int , unsigned int, bool);
+template int reg_createImagePyramid<double>(nifti_image *, nifti_image **, unsigned int , unsigned int, bool);
 /* *************************************************************** */
 /* *************************************************************** */
 template <class DTYPE>
@@ -2281,6 +2752,92 @@ template int reg_createMaskPyramid<float>(nifti_image *, int **, unsigned int ,
 template int reg_createMaskPyramid<double>(nifti_image *, int **, unsigned int , unsigned int , int *);
 /* *************************************************************** */
 /* *************************************************************** */
+template <class DTYPE>
+nifti_image *reg_createImagePyramidLevel(nifti_image *inputImage,
+                                         unsigned int levelNumber,
+                                         unsigned int levelToPerform,
+                                         unsigned int level,
+                                         bool keepNativeFinestLevel)
+{
+   // The finest level can only keep its datatype when it is not downsampled
+   keepNativeFinestLevel = keepNativeFinestLevel && levelToPerform==levelNumber &&
+         level==levelToPerform-1 && reg_tools_hasNativeIntegerIntensities(inputImage);
+
+   nifti_image *levelImage=nifti_copy_nim_info(inputImage);
+   levelImage->data = (void *)malloc(levelImage->nvox*levelImage->nbyper);
+   memcpy(levelImage->data, inputImage->data, levelImage->nvox*levelImage->nbyper);
+   if(!keepNativeFinestLevel)
+      reg_tools_changeDatatype<DTYPE>(levelImage);
+   reg_tools_removeSCLInfo(levelImage);
+
+   // The image is downsampled once per level, as in reg_createImagePyramid
+   for(unsigned int l=level+1; l<levelNumber; l++)
+   {
+      bool downsampleAxis[8]= {false,true,true,true,false,false,false,false};
+      if((levelImage->nx/2) < 32) downsampleAxis[1]=false;
+      if((levelImage->ny/2) < 32) downsampleAxis[2]=false;
+      if((levelImage->nz/2) < 32) downsampleAxis[3]=false;
+      reg_downsampleImage<DTYPE>(levelImage, 1, downsampleAxis);
+   }
+   return levelImage;
+}
+template nifti_image *reg_createImagePyramidLevel<float>(nifti_image *, unsigned int, unsigned int, unsigned int, bool);
+template nifti_image *reg_createImagePyramidLevel<double>(nifti_image *, unsigned int, unsigned int, unsigned int, bool);
+/* *************************************************************** */
+template <class DTYPE>
+int *reg_createMaskPyramidLevel(nifti_image *inputMaskImage,
+                                unsigned int levelNumber,
+                                unsigned int level,
+                                int *activeVoxelNumber)
+{
+   nifti_image *levelImage=nifti_copy_nim_info(inputMaskImage);
+   levelImage->data = (void *)malloc(levelImage->nvox*levelImage->nbyper);
+   memcpy(levelImage->data, inputMaskImage->data, levelImage->nvox*levelImage->nbyper);
+   reg_tools_binarise_image(levelImage);
+   reg_tools_changeDatatype<unsigned char>(levelImage);
+
+   for(unsigned int l=level+1; l<levelNumber; l++)
+   {
+      bool downsampleAxis[8]= {false,true,true,true,false,false,false,false};
+      if((levelImage->nx/2) < 32) downsampleAxis[1]=false;
+      if((levelImage->ny/2) < 32) downsampleAxis[2]=false;
+      if((levelImage->nz/2) < 32) downsampleAxis[3]=false;
+      reg_downsampleImage<DTYPE>(levelImage, 0, downsampleAxis);
+   }
+   *activeVoxelNumber=levelImage->nx*levelImage->ny*levelImage->nz;
+   int *mask=(int *)malloc(*activeVoxelNumber * sizeof(int));
+   reg_tools_binaryImage2int(levelImage, mask, *activeVoxelNumber);
+   nifti_image_free(levelImage);
+   return mask;
+}
+template int *reg_createMaskPyramidLevel<float>(nifti_image *, unsigned int, unsigned int, int *);
+template int *reg_createMaskPyramidLevel<double>(nifti_image *, unsigned int, unsigned int, int *);
+/* *************************************************************** */
+void reg_getPyramidLevelDim(nifti_image *inputImage,
+                            unsigned int levelNumber,
+                            unsigned int level,
+                            int dim[3],
+                            float pixdim[3])
+{
+   for(int i=0; i<3; ++i)
+   {
+      dim[i]=inputImage->dim[i+1];
+      pixdim[i]=inputImage->pixdim[i+1];
+   }
+   // Same rule as in reg_createImagePyramid and reg_downsampleImage
+   for(unsigned int l=level+1; l<levelNumber; l++)
+   {
+      for(int i=0; i<3; ++i)
+      {
+         if((dim[i]/2) < 32)
+            continue;
+         dim[i]=static_cast<int>(reg_ceil(dim[i]/2.0));
+         if(pixdim[i]>0) pixdim[i]*=2.0f;
+      }
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class TYPE1, class TYPE2>
 int reg_tools_nanMask_image2(nifti_image *image, nifti_image *maskImage, nifti_image *outputImage)
 {
@@ -3317,4 +3874,140 @@ void coordinateFromLinearIndex(int index, int maxValue_x, int maxValue_y, int &x
     z = index;
 }
 /* *************************************************************** */
+/* *************************************************************** */
+struct reg_tools_memoryTracker
+{
+   std::map<const void *, size_t> buffers;
+   size_t current;
+   size_t peak;
+   size_t levelPeak;
+   reg_tools_memoryTracker() : current(0), peak(0), levelPeak(0) {}
+};
+/* *************************************************************** */
+static reg_tools_memoryTracker &reg_tools_getMemoryTracker()
+{
+   // Created on first use to avoid any static initialisation order issue
+   static reg_tools_memoryTracker tracker;
+   return tracker;
+}
+/* *************************************************************** */
+void reg_tools_trackBuffer(void *ptr, size_t size)
+{
+   if(ptr==NULL) return;
+#pragma omp critical(reg_tools_memoryTracker)
+   {
+      reg_tools_memoryTracker &tracker=reg_tools_getMemoryTracker();
+      std::map<const void *, size_t>::iterator it=tracker.buffers.find(ptr);
+      if(it!=tracker.buffers.end())
+      {
+         tracker.current -= it->second;
+         it->second=size;
+      }
+      else tracker.buffers[ptr]=size;
+      tracker.current += size;
+      if(tracker.current>tracker.peak) tracker.peak=tracker.current;
+      if(tracker.current>tracker.levelPeak) tracker.levelPeak=tracker.current;
+   }
+}
+/* *************************************************************** */
+void reg_tools_untrackBuffer(const void *ptr)
+{
+   if(ptr==NULL) return;
+#pragma omp critical(reg_tools_memoryTracker)
+   {
+      reg_tools_memoryTracker &tracker=reg_tools_getMemoryTracker();
+      std::map<const void *, size_t>::iterator it=tracker.buffers.find(ptr);
+      if(it!=tracker.buffers.end())
+      {
+         tracker.current -= it->second;
+         tracker.buffers.erase(it);
+      }
+   }
+}
+/* *************************************************************** */
+void *reg_tools_trackedMalloc(size_t size)
+{
+   void *ptr=malloc(size);
+   reg_tools_trackBuffer(ptr,size);
+   return ptr;
+}
+/* *************************************************************** */
+void *reg_tools_trackedCalloc(size_t number, size_t size)
+{
+   void *ptr=calloc(number,size);
+   reg_tools_trackBuffer(ptr,number*size);
+   return ptr;
+}
+/* *************************************************************** */
+void reg_tools_trackedFree(void *ptr)
+{
+   reg_tools_untrackBuffer(ptr);
+   free(ptr);
+}
+/* *************************************************************** */
+void reg_tools_trackImage(nifti_image *image)
+{
+   if(image==NULL) return;
+   reg_tools_trackBuffer(image->data,image->nvox*image->nbyper);
+}
+/* *************************************************************** */
+void reg_tools_untrackImage(nifti_image *image)
+{
+   if(image==NULL) return;
+   reg_tools_untrackBuffer(image->data);
+}
+/* *************************************************************** */
+void reg_tools_freeTrackedImage(nifti_image *image)
+{
+   if(image==NULL) return;
+   reg_tools_untrackBuffer(image->data);
+   nifti_image_free(image);
+}
+/* *************************************************************** */
+size_t reg_tools_getTrackedMemory()
+{
+   size_t value;
+#pragma omp critical(reg_tools_memoryTracker)
+   value=reg_tools_getMemoryTracker().current;
+   return value;
+}
+/* *************************************************************** */
+size_t reg_tools_getPeakTrackedMemory()
+{
+   size_t value;
+#pragma omp critical(reg_tools_memoryTracker)
+   value=reg_tools_getMemoryTracker().peak;
+   return value;
+}
+/* *************************************************************** */
+size_t reg_tools_getLevelPeakTrackedMemory()
+{
+   size_t value;
+#pragma omp critical(reg_tools_memoryTracker)
+   value=reg_tools_getMemoryTracker().levelPeak;
+   return value;
+}
+/* *************************************************************** */
+void reg_tools_resetLevelPeakTrackedMemory()
+{
+#pragma omp critical(reg_tools_memoryTracker)
+   {
+      reg_tools_memoryTracker &tracker=reg_tools_getMemoryTracker();
+      tracker.levelPeak=tracker.current;
+   }
+}
+/* *************************************************************** */
+void reg_tools_printTrackedMemory(const char *executableName,
+                                  const char *stage)
+{
+   const double mb=1024.0*1024.0;
+   char text[255];
+   sprintf(text, "Memory usage (%s): current %.1f MB - level peak %.1f MB - peak %.1f MB",
+           stage,
+           (double)reg_tools_getTrackedMemory()/mb,
+           (double)reg_tools_getLevelPeakTrackedMemory()/mb,
+           (double)reg_tools_getPeakTrackedMemory()/mb);
+   reg_print_info(executableName, text);
+}
+/* *************************************************************** */
 #endif
@@ -23,7 +23,8 @@ typedef enum
    MEAN_KERNEL,
    LINEAR_KERNEL,
    GAUSSIAN_KERNEL,
-   CUBIC_SPLINE_KERNEL
+   CUBIC_SPLINE_KERNEL,
+   IIR_GAUSSIAN_KERNEL
 } NREG_CONV_KERNEL_TYPE;
 
 /* *************************************************************** */
@@ -70,6 +71,20 @@ void reg_intensityRescale(nifti_image *image,
 extern "C++"
 void reg_tools_removeSCLInfo(nifti_image *img);
 
+/* *************************************************************** */
+/** @brief Reorder the voxel intensities of a multi-volume image (nt*nu>1).
+ * By default, nifti images store each volume contiguously. When interleaved,
+ * all the volume values of a single voxel are stored contiguously instead,
+ * i.e. the value of volume v at voxel i is stored at i*nt*nu+v.
+ * The header is left unchanged.
+ * @param image Image whose data array is reordered in place
+ * @param interleave The volumes are interleaved if set to true and
+ * stored back contiguously if set to false
+ */
+extern "C++"
+void reg_tools_interleaveVolumes(nifti_image *image,
+                                 bool interleave);
+
 /* *************************************************************** */
 /** @brief reg_getRealImageSpacing
  * @param image image
@@ -83,6 +98,9 @@ void reg_getRealImageSpacing(nifti_image *image,
  * @param image Image to be smoothed
  * @param sigma Standard deviation of the Gaussian kernel
  * to use. The kernel is bounded between +/- 3 sigma.
+ * @param kernelType Type of kernel to use. The IIR_GAUSSIAN_KERNEL
+ * type approximates the Gaussian kernel with a recursive filter
+ * (van Vliet, Young and Verbeek, 1998) whose cost does not depend on sigma.
  * @param axis Boolean array to specify which axis have to be
  * smoothed. The array follow the dim array of the nifti header.
  */
@@ -93,6 +111,26 @@ void reg_tools_kernelConvolution(nifti_image *image,
                                  int *mask = NULL,
                                  bool *timePoints = NULL,
                                  bool *axis = NULL);
+/* *************************************************************** */
+/** @brief Smooth several images with the same mean kernel. The window
+ * sums are obtained from running sums along each axis, so the cost does not
+ * depend on the kernel width, and the normalisation by the number of active
+ * voxels is shared by all images.
+ * @param images Array of images to be smoothed in place. They must have the
+ * same dimension and type and only their first volume is considered. As the
+ * normalisation is shared, a voxel has to be NaN either in all images or in
+ * none of them; the function exits otherwise
+ * @param imageNumber Number of images in the array
+ * @param width Half-width of the kernel, in millimetre if positive and in
+ * voxel if negative
+ * @param mask Voxels with a negative mask value, or a NaN value in the
+ * images, are ignored and set to NaN. All voxels are considered if NULL
+ */
+extern "C++"
+void reg_tools_meanFilter(nifti_image **images,
+                          int imageNumber,
+                          float width,
+                          int *mask = NULL);
 
 /* *************************************************************** */
 /** @brief Smooth a label image using a Gaussian kernel
@@ -144,6 +182,15 @@ extern "C++" template <class NewTYPE>
 void reg_tools_changeDatatype(nifti_image *image,
                               int type=-1);
 /* *************************************************************** */
+/** @brief Check if the intensities of an image can be used as they
+ * are stored, without conversion to floating point
+ * @param image Image to be checked.
+ * @return True if the image is stored as unsigned char, short or
+ * unsigned short without intensity scaling.
+ */
+extern "C++"
+bool reg_tools_hasNativeIntegerIntensities(nifti_image *image);
+/* *************************************************************** */
 /** @brief Add two images.
  * @param img1 First image to consider
  * @param img2 Second image to consider
@@ -336,12 +383,18 @@ float reg_tools_getSTDValue(nifti_image *img);
  * 1 level corresponds to the original image resolution.
  * @param levelToPerform Number to level that will be perform during
  * the registration.
+ * @param keepNativeFinestLevel If true, the finest level of an unscaled
+ * unsigned char, short or unsigned short image that does not require
+ * downsampling keeps its datatype instead of being converted to DTYPE,
+ * see reg_tools_hasNativeIntegerIntensities. The other levels are always
+ * converted.
  */
 extern "C++" template<class DTYPE>
 int reg_createImagePyramid(nifti_image * input,
                            nifti_image **pyramid,
                            unsigned int levelNumber,
-                           unsigned int levelToPerform);
+                           unsigned int levelToPerform,
+                           bool keepNativeFinestLevel=false);
 /* *************************************************************** */
 /** @brief Generate a pyramid from an input mask image.
  * @param input Input image to be downsampled to create the pyramid
@@ -361,6 +414,54 @@ int reg_createMaskPyramid(nifti_image *input,
                           unsigned int levelToPerform,
                           int *activeVoxelNumber);
 /* *************************************************************** */
+/** @brief Generate a single level of a pyramid from an input image.
+ * The level is identical to the one generated by reg_createImagePyramid
+ * but the other levels are never allocated.
+ * @param input Input image to be downsampled
+ * @param levelNumber Number of level of the pyramid
+ * @param levelToPerform Number of level that will be performed during
+ * the registration
+ * @param level Index of the level to generate, 0 being the coarsest
+ * and levelToPerform-1 the finest
+ * @param keepNativeFinestLevel See reg_createImagePyramid
+ * @return Downsampled image
+ */
+extern "C++" template<class DTYPE>
+nifti_image *reg_createImagePyramidLevel(nifti_image *input,
+                                         unsigned int levelNumber,
+                                         unsigned int levelToPerform,
+                                         unsigned int level,
+                                         bool keepNativeFinestLevel=false);
+/* *************************************************************** */
+/** @brief Generate a single level of a pyramid from an input mask image.
+ * The level is identical to the one generated by reg_createMaskPyramid.
+ * @param input Input mask image to be downsampled
+ * @param levelNumber Number of level of the pyramid
+ * @param level Index of the level to generate, 0 being the coarsest
+ * @param activeVoxelNumber Number of voxel of the generated mask
+ * @return Mask array
+ */
+extern "C++" template<class DTYPE>
+int *reg_createMaskPyramidLevel(nifti_image *input,
+                                unsigned int levelNumber,
+                                unsigned int level,
+                                int *activeVoxelNumber);
+/* *************************************************************** */
+/** @brief Compute the dimension of a pyramid level without generating it
+ * @param input Input image of the pyramid
+ * @param levelNumber Number of level of the pyramid
+ * @param level Index of the level, 0 being the coarsest, as in
+ * reg_createImagePyramidLevel
+ * @param dim Output array that contains the level nx, ny and nz
+ * @param pixdim Output array that contains the level dx, dy and dz
+ */
+extern "C++"
+void reg_getPyramidLevelDim(nifti_image *input,
+                            unsigned int levelNumber,
+                            unsigned int level,
+                            int dim[3],
+                            float pixdim[3]);
+/* *************************************************************** */
 /** @brief this function will threshold an image to the values provided,
  * set the scl_slope and sct_inter of the image to 1 and 0
  * (SSD uses actual image data values),
@@ -463,4 +564,73 @@ void cPtrToMatmn(T** mat, T* cMat, unsigned int m, unsigned int n);
 /* *************************************************************** */
 void coordinateFromLinearIndex(int index, int maxValue_x, int maxValue_y, int &x, int &y, int &z);
 /* *************************************************************** */
+/* *************************************************************** */
+/** @brief Record a buffer in the memory tracker. The tracker sums the size
+ * of all the recorded buffers to report the current and peak memory usage
+ * of the registration. Recording a buffer twice updates its size.
+ * @param ptr Address of the buffer, ignored if NULL. The buffer is not
+ * read, it can thus be recorded before being initialised
+ * @param size Size of the buffer in bytes
+ */
+extern "C++"
+void reg_tools_trackBuffer(void *ptr, size_t size);
+/* *************************************************************** */
+/** @brief Remove a buffer from the memory tracker, the buffer is not freed
+ * @param ptr Address of the buffer, ignored if it is not recorded
+ */
+extern "C++"
+void reg_tools_untrackBuffer(const void *ptr);
+/* *************************************************************** */
+/// @brief malloc whose allocated buffer is recorded in the memory tracker
+extern "C++"
+void *reg_tools_trackedMalloc(size_t size);
+/* *************************************************************** */
+/// @brief calloc whose allocated buffer is recorded in the memory tracker
+extern "C++"
+void *reg_tools_trackedCalloc(size_t number, size_t size);
+/* *************************************************************** */
+/// @brief Remove a buffer from the memory tracker and free it
+extern "C++"
+void reg_tools_trackedFree(void *ptr);
+/* *************************************************************** */
+/** @brief Record the data array of an image in the memory tracker. It has
+ * to be called again whenever the data array is reallocated, for example
+ * after reg_tools_changeDatatype
+ */
+extern "C++"
+void reg_tools_trackImage(nifti_image *image);
+/* *************************************************************** */
+/// @brief Remove the data array of an image from the memory tracker
+extern "C++"
+void reg_tools_untrackImage(nifti_image *image);
+/* *************************************************************** */
+/// @brief Remove the data array of an image from the memory tracker and free the image
+extern "C++"
+void reg_tools_freeTrackedImage(nifti_image *image);
+/* *************************************************************** */
+/// @brief Return the size in bytes of all the buffers currently tracked
+extern "C++"
+size_t reg_tools_getTrackedMemory();
+/* *************************************************************** */
+/// @brief Return the largest tracked memory usage, in bytes
+extern "C++"
+size_t reg_tools_getPeakTrackedMemory();
+/* *************************************************************** */
+/// @brief Return the largest tracked memory usage since the last
+/// call to reg_tools_resetLevelPeakTrackedMemory, in bytes
+extern "C++"
+size_t reg_tools_getLevelPeakTrackedMemory();
+/* *************************************************************** */
+/// @brief Set the level peak memory usage to the current usage
+extern "C++"
+void reg_tools_resetLevelPeakTrackedMemory();
+/* *************************************************************** */
+/** @brief Print the current, level peak and peak tracked memory usage
+ * @param executableName Name of the executable used as prefix
+ * @param stage Description of the current stage of the registration
+ */
+extern "C++"
+void reg_tools_printTrackedMemory(const char *executableName,
+                                  const char *stage);
+/* *************************************************************** */
 #endif
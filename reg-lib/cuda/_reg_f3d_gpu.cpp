@@ -876,27 +876,35 @@ int reg_f3d_gpu::CheckMemoryMB()
 {
    if(!this->initialised) reg_f3d<float>::Initialise();
 
-   size_t referenceVoxelNumber=this->referencePyramid[this->levelToPerform-1]->nx *
-                               this->referencePyramid[this->levelToPerform-1]->ny *
-                               this->referencePyramid[this->levelToPerform-1]->nz;
-
-   size_t warpedVoxelNumber=this->referencePyramid[this->levelToPerform-1]->nx *
-                            this->referencePyramid[this->levelToPerform-1]->ny *
-                            this->referencePyramid[this->levelToPerform-1]->nz *
-                            this->floatingPyramid[this->levelToPerform-1]->nt ;
+   // The pyramid levels are only created when required, the size of the
+   // finest level is thus computed from the input images
+   int referenceDim[3], floatingDim[3];
+   float referencePixdim[3], floatingPixdim[3];
+   reg_getPyramidLevelDim(this->inputReference,this->levelNumber,
+                          this->levelToPerform-1,referenceDim,referencePixdim);
+   reg_getPyramidLevelDim(this->inputFloating,this->levelNumber,
+                          this->levelToPerform-1,floatingDim,floatingPixdim);
+
+   size_t referenceVoxelNumber=(size_t)referenceDim[0] *
+                               referenceDim[1] *
+                               referenceDim[2];
+
+   size_t warpedVoxelNumber=referenceVoxelNumber *
+                            this->inputFloating->nt ;
 
    size_t totalMemoryRequiered=0;
    // reference image
-   totalMemoryRequiered += this->referencePyramid[this->levelToPerform-1]->nvox * sizeof(float);
+   totalMemoryRequiered += referenceVoxelNumber * this->inputReference->nt * sizeof(float);
 
    // floating image
-   totalMemoryRequiered += this->floatingPyramid[this->levelToPerform-1]->nvox * sizeof(float);
+   totalMemoryRequiered += (size_t)floatingDim[0] * floatingDim[1] * floatingDim[2] *
+                           this->inputFloating->nt * sizeof(float);
 
    // warped image
    totalMemoryRequiered += warpedVoxelNumber * sizeof(float);
 
-   // mask image
-   totalMemoryRequiered += this->activeVoxelNumber[this->levelToPerform-1] * sizeof(int);
+   // mask image, all the voxels are assumed to be active
+   totalMemoryRequiered += referenceVoxelNumber * sizeof(int);
 
    // deformation field
    totalMemoryRequiered += referenceVoxelNumber * sizeof(float4);
@@ -909,15 +917,12 @@ int reg_f3d_gpu::CheckMemoryMB()
 
    // control point grid
    size_t cp=1;
-   cp *= (int)floor(this->referencePyramid[this->levelToPerform-1]->nx*
-                    this->referencePyramid[this->levelToPerform-1]->dx/
+   cp *= (int)floor(referenceDim[0]*referencePixdim[0]/
                     this->spacing[0])+5;
-   cp *= (int)floor(this->referencePyramid[this->levelToPerform-1]->ny*
-                    this->referencePyramid[this->levelToPerform-1]->dy/
+   cp *= (int)floor(referenceDim[1]*referencePixdim[1]/
                     this->spacing[1])+5;
-   if(this->referencePyramid[this->levelToPerform-1]->nz>1)
-      cp *= (int)floor(this->referencePyramid[this->levelToPerform-1]->nz*
-                       this->referencePyramid[this->levelToPerform-1]->dz/
+   if(referenceDim[2]>1)
+      cp *= (int)floor(referenceDim[2]*referencePixdim[2]/
                        this->spacing[2])+5;
    totalMemoryRequiered += cp * sizeof(float4);
 
@@ -0,0 +1,306 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_aladin_sym.h"
+#include "_reg_f3d.h"
+#include "_reg_blockMatching.h"
+#include "_reg_resampling.h"
+#include "_reg_localTrans.h"
+#include "_reg_nmi.h"
+#include "_reg_tools.h"
+#include "_reg_timer.h"
+#include "reg_test_phantom.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/* The computation times are stored in calibration units, i.e. as a multiple
+ * of the time taken by a fixed scalar loop on the same machine, so that the
+ * committed baselines remain meaningful on another computer. All the tests
+ * run on a single thread for the same reason.
+ */
+
+#define PHANTOM_SIZE 128
+
+/* *************************************************************** */
+/// @brief Return the time taken by a fixed scalar workload in seconds
+double GetCalibrationTime()
+{
+   double best=0;
+   for(int run=0; run<3; ++run)
+   {
+      double start=reg_timer_getTime();
+      volatile double sink=0;
+      double value=0;
+      for(int i=0; i<20000000; ++i)
+         value = value*0.999999 + sqrt((double)i);
+      sink=value;
+      (void)sink;
+      double duration=1.e-6*(reg_timer_getTime()-start);
+      if(run==0 || duration<best) best=duration;
+   }
+   return best;
+}
+/* *************************************************************** */
+/// @brief Return the peak resident memory of the process in MB
+double GetPeakMemoryMB()
+{
+#ifndef _WIN32
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+   return (double)usage.ru_maxrss/(1024.*1024.);
+#else
+   return (double)usage.ru_maxrss/1024.;
+#endif
+#else
+   return 0;
+#endif
+}
+/* *************************************************************** */
+/// @brief Return a deformation field close to the identity
+nifti_image *CreateDeformationField(nifti_image *reference, nifti_image **grid)
+{
+   *grid=CreateControlPointGrid(reference, 5.f, 1.f);
+   nifti_image *field=CreateVectorImage(reference);
+   reg_spline_getDeformationField(*grid, field, NULL, false, true);
+   return field;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+void RunAladin(nifti_image *reference, nifti_image *floating)
+{
+   reg_aladin_sym<float> *registration=new reg_aladin_sym<float>;
+   registration->SetInputReference(reference);
+   registration->SetInputFloating(floating);
+   registration->SetNumberOfLevels(3);
+   registration->SetLevelsToPerform(2);
+   registration->SetMaxIterations(5);
+   registration->SetVerbose(false);
+   registration->Run();
+   delete registration;
+}
+/* *************************************************************** */
+void RunF3D(nifti_image *reference, nifti_image *floating)
+{
+   reg_f3d<float> *registration=new reg_f3d<float>(reference->nt, floating->nt);
+   registration->SetReferenceImage(reference);
+   registration->SetFloatingImage(floating);
+   registration->SetLevelNumber(2);
+   registration->SetLevelToPerform(2);
+   registration->SetMaximalIterationNumber(10);
+   registration->DoNotPrintOutInformation();
+   registration->Run();
+   delete registration;
+}
+/* *************************************************************** */
+void RunNMI(nifti_image *reference, nifti_image *floating)
+{
+   nifti_image *grid=NULL;
+   nifti_image *field=CreateDeformationField(reference, &grid);
+   nifti_image *warped=nifti_copy_nim_info(reference);
+   warped->data=(void *)malloc(warped->nvox*warped->nbyper);
+   nifti_image *warpedGradient=CreateVectorImage(reference);
+   nifti_image *voxelGradient=CreateVectorImage(reference);
+   int *mask=(int *)calloc(reference->nvox, sizeof(int));
+   reg_nmi *nmi=new reg_nmi;
+   nmi->SetTimepointWeight(0, 1.);
+   nmi->InitialiseMeasure(reference, floating, mask, warped, warpedGradient, voxelGradient);
+   reg_resampleImage(floating, warped, field, mask, 1, 0.f);
+   reg_getImageGradient(floating, warpedGradient, field, mask, 1, 0.f, 0);
+   for(int i=0; i<10; ++i)
+   {
+      nmi->GetSimilarityMeasureValue();
+      nmi->GetVoxelBasedSimilarityMeasureGradient(0);
+   }
+   delete nmi;
+   free(mask);
+   nifti_image_free(voxelGradient);
+   nifti_image_free(warpedGradient);
+   nifti_image_free(warped);
+   nifti_image_free(field);
+   nifti_image_free(grid);
+}
+/* *************************************************************** */
+void RunResampling(nifti_image *reference, nifti_image *floating)
+{
+   nifti_image *grid=NULL;
+   nifti_image *field=CreateDeformationField(reference, &grid);
+   nifti_image *warped=nifti_copy_nim_info(reference);
+   warped->data=(void *)malloc(warped->nvox*warped->nbyper);
+   nifti_image *warpedGradient=CreateVectorImage(reference);
+   for(int i=0; i<10; ++i)
+   {
+      reg_resampleImage(floating, warped, field, NULL, 1, 0.f);
+      reg_resampleImage(floating, warped, field, NULL, 3, 0.f);
+      reg_getImageGradient(floating, warpedGradient, field, NULL, 1, 0.f, 0);
+   }
+   nifti_image_free(warpedGradient);
+   nifti_image_free(warped);
+   nifti_image_free(field);
+   nifti_image_free(grid);
+}
+/* *************************************************************** */
+void RunSpline(nifti_image *reference, nifti_image *)
+{
+   nifti_image *grid=NULL;
+   nifti_image *field=CreateDeformationField(reference, &grid);
+   nifti_image *gradient=nifti_copy_nim_info(grid);
+   gradient->data=(void *)calloc(gradient->nvox, gradient->nbyper);
+   for(int i=0; i<10; ++i)
+   {
+      reg_spline_getDeformationField(grid, field, NULL, false, true);
+      reg_spline_approxBendingEnergyGradient(grid, gradient, 1.f);
+   }
+   nifti_image_free(gradient);
+   nifti_image_free(field);
+   nifti_image_free(grid);
+}
+/* *************************************************************** */
+void RunBlockMatching(nifti_image *reference, nifti_image *floating)
+{
+   int *mask=(int *)calloc(reference->nvox, sizeof(int));
+   _reg_blockMatchingParam params;
+   initialise_block_matching_method(reference, &params, 50, 50, 1, mask);
+   mat44 transformation;
+   for(int i=0; i<2; ++i)
+   {
+      block_matching_method(reference, floating, &params, mask);
+      reg_mat44_eye(&transformation);
+      optimize(&params, &transformation, true);
+   }
+   free(mask);
+}
+/* *************************************************************** */
+/* *************************************************************** */
+/// @brief Read the baseline of a test, return false if it is not defined
+bool ReadBaseline(const char *filename, const std::string &test, double &time, double &memory)
+{
+   std::ifstream file(filename);
+   std::string line;
+   while(std::getline(file, line))
+   {
+      if(line.empty() || line[0]=='#') continue;
+      std::istringstream stream(line);
+      std::string name;
+      if(stream >> name >> time >> memory && name==test)
+         return true;
+   }
+   return false;
+}
+/* *************************************************************** */
+/// @brief Replace or append the baseline of a test
+bool WriteBaseline(const char *filename, const std::string &test, double time, double memory)
+{
+   std::vector<std::string> lines;
+   std::ifstream input(filename);
+   std::string line;
+   bool found=false;
+   char text[255];
+   sprintf(text, "%s %.3f %.1f", test.c_str(), time, memory);
+   while(std::getline(input, line))
+   {
+      std::istringstream stream(line);
+      std::string name;
+      if(line.size()>0 && line[0]!='#' && stream >> name && name==test)
+      {
+         line=text;
+         found=true;
+      }
+      lines.push_back(line);
+   }
+   input.close();
+   if(!found) lines.push_back(text);
+   std::ofstream output(filename);
+   if(!output) return false;
+   for(size_t i=0; i<lines.size(); ++i)
+      output << lines[i] << "\n";
+   return true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=5 && argc!=6)
+   {
+      fprintf(stderr, "Usage: %s <test> <baselineFile> <timeTolerance> <memoryTolerance> [-update]\n", argv[0]);
+      fprintf(stderr, "\t<test> is aladin, f3d, nmi, resampling, spline or blockMatching\n");
+      fprintf(stderr, "\tThe tolerances are the relative increases accepted, e.g. 0.5 for 50%%\n");
+      fprintf(stderr, "\t-update stores the measured values as the new baseline of the test\n");
+      return EXIT_FAILURE;
+   }
+   const std::string test(argv[1]);
+   const char *baselineFileName=argv[2];
+   const double timeTolerance=atof(argv[3]);
+   const double memoryTolerance=atof(argv[4]);
+   const bool update=argc==6 && strcmp(argv[5], "-update")==0;
+
+   void (*function)(nifti_image *, nifti_image *)=NULL;
+   if(test=="aladin") function=RunAladin;
+   else if(test=="f3d") function=RunF3D;
+   else if(test=="nmi") function=RunNMI;
+   else if(test=="resampling") function=RunResampling;
+   else if(test=="spline") function=RunSpline;
+   else if(test=="blockMatching") function=RunBlockMatching;
+   else
+   {
+      reg_print_msg_error("Unknown performance test:");
+      reg_print_msg_error(test.c_str());
+      return EXIT_FAILURE;
+   }
+
+#if defined (_OPENMP)
+   omp_set_num_threads(1);
+#endif
+   const double calibration=GetCalibrationTime();
+
+   nifti_image *reference=CreatePhantom(PHANTOM_SIZE, 0.f);
+   nifti_image *floating=CreatePhantom(PHANTOM_SIZE, 2.f);
+   double start=reg_timer_getTime();
+   function(reference, floating);
+   const double duration=1.e-6*(reg_timer_getTime()-start);
+   const double memory=GetPeakMemoryMB();
+   nifti_image_free(reference);
+   nifti_image_free(floating);
+
+   const double time=duration/calibration;
+   printf("%s: %g s - %g calibration units (1 unit = %g s) - peak memory %g MB\n",
+          test.c_str(), duration, time, calibration, memory);
+
+   if(update)
+   {
+      if(!WriteBaseline(baselineFileName, test, time, memory))
+      {
+         reg_print_msg_error("The baseline file could not be written");
+         return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+   }
+
+   double baselineTime, baselineMemory;
+   if(!ReadBaseline(baselineFileName, test, baselineTime, baselineMemory))
+   {
+      fprintf(stderr, "No baseline is defined for %s in %s\n", test.c_str(), baselineFileName);
+      return EXIT_FAILURE;
+   }
+   printf("%s baseline: %g calibration units - peak memory %g MB\n",
+          test.c_str(), baselineTime, baselineMemory);
+
+   int status=EXIT_SUCCESS;
+   if(time > baselineTime*(1.+timeTolerance))
+   {
+      fprintf(stderr, "reg_test_performance %s is too slow: %g (>%g)\n",
+              test.c_str(), time, baselineTime*(1.+timeTolerance));
+      status=EXIT_FAILURE;
+   }
+   if(memory>0 && baselineMemory>0 && memory > baselineMemory*(1.+memoryTolerance))
+   {
+      fprintf(stderr, "reg_test_performance %s uses too much memory: %g MB (>%g MB)\n",
+              test.c_str(), memory, baselineMemory*(1.+memoryTolerance));
+      status=EXIT_FAILURE;
+   }
+   return status;
+}
@@ -0,0 +1,132 @@
+#include "_reg_globalTrans.h"
+#include "_reg_maths.h"
+
+/* Noisy correspondences are generated using a known affine transformation
+ * and the least squares affine is estimated with the closed form normal
+ * equations, used by the block matching, and with the pseudo-inverse given by
+ * the SVD of the full system. The reference points either fill a cube
+ * (well-conditioned), a thin slab (ill-conditioned but still solved in closed
+ * form) or a nearly flat slab (degenerated, the SVD is used by both).
+ * Both transformations have to map the reference points to the same
+ * positions and the closed form solution cannot have a larger residual.
+ */
+
+// Tolerance on the transformed positions, in mm
+#define EPS 1.0e-3
+
+/* *************************************************************** */
+/// @brief Deterministic pseudo-random value in [-1,1]
+float GetRandomValue(unsigned int *seed)
+{
+   *seed=*seed*1664525u+1013904223u;
+   return (float)(*seed>>8)/(float)(1u<<23)-1.f;
+}
+/* *************************************************************** */
+/// @brief Root mean square distance between the transformed reference
+/// points and the warped points
+double GetResidual(mat44 *matrix, float **reference, float **warped, int pointNumber)
+{
+   double residual=0;
+   for(int k=0; k<pointNumber; ++k)
+   {
+      float position[3];
+      reg_mat44_mul(matrix, reference[k], position);
+      for(int d=0; d<3; ++d)
+         residual+=reg_pow2((double)position[d]-(double)warped[k][d]);
+   }
+   return sqrt(residual/(double)pointNumber);
+}
+/* *************************************************************** */
+/// @brief Largest distance between the reference points transformed by
+/// both matrices
+double GetTransformationDifference(mat44 *a, mat44 *b, float **reference, int pointNumber)
+{
+   double maxDifference=0;
+   for(int k=0; k<pointNumber; ++k)
+   {
+      float positionA[3], positionB[3];
+      reg_mat44_mul(a, reference[k], positionA);
+      reg_mat44_mul(b, reference[k], positionB);
+      double distance=sqrt(reg_pow2(positionA[0]-positionB[0]) +
+                           reg_pow2(positionA[1]-positionB[1]) +
+                           reg_pow2(positionA[2]-positionB[2]));
+      // A NaN is reported as an infinite difference
+      if(distance!=distance)
+         distance=std::numeric_limits<double>::infinity();
+      maxDifference=std::max(maxDifference, distance);
+   }
+   return maxDifference;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <conditioning>\n", argv[0]);
+      fprintf(stderr, "\t<conditioning> 0 for a cube, 1 for a thin slab, 2 for a nearly flat slab\n");
+      return EXIT_FAILURE;
+   }
+   int conditioning=atoi(argv[1]);
+   // Half thickness of the point cloud along z, in mm
+   float thickness=conditioning==0?50.f:(conditioning==1?0.05f:1.0e-4f);
+
+   mat44 affine;
+   reg_mat44_eye(&affine);
+   affine.m[0][0]=1.05f;
+   affine.m[0][1]=0.08f;
+   affine.m[0][2]=-0.04f;
+   affine.m[1][0]=-0.06f;
+   affine.m[1][1]=0.97f;
+   affine.m[1][2]=0.03f;
+   affine.m[2][0]=0.02f;
+   affine.m[2][1]=-0.05f;
+   affine.m[2][2]=1.1f;
+   affine.m[0][3]=3.5f;
+   affine.m[1][3]=-7.f;
+   affine.m[2][3]=2.f;
+
+   // The point cloud is not centred on the origin
+   int pointNumber=2000;
+   float **reference=reg_matrix2DAllocate<float>(pointNumber, 3);
+   float **warped=reg_matrix2DAllocate<float>(pointNumber, 3);
+   std::vector<_reg_sorted_point3D> points;
+   unsigned int seed=42;
+   for(int k=0; k<pointNumber; ++k)
+   {
+      reference[k][0]=20.f+50.f*GetRandomValue(&seed);
+      reference[k][1]=-30.f+50.f*GetRandomValue(&seed);
+      reference[k][2]=40.f+thickness*GetRandomValue(&seed);
+      reg_mat44_mul(&affine, reference[k], warped[k]);
+      for(int d=0; d<3; ++d)
+         warped[k][d]+=0.5f*GetRandomValue(&seed);
+      points.push_back(_reg_sorted_point3D(reference[k], warped[k], 0.));
+   }
+
+   mat44 closedFormMatrix, svdMatrix;
+   estimate_affine_transformation3D(points, &closedFormMatrix);
+   estimate_affine_transformation3D(reference, warped, pointNumber, &svdMatrix);
+   double difference=GetTransformationDifference(&closedFormMatrix, &svdMatrix, reference, pointNumber);
+   double closedFormResidual=GetResidual(&closedFormMatrix, reference, warped, pointNumber);
+   double svdResidual=GetResidual(&svdMatrix, reference, warped, pointNumber);
+   // Both estimations are identical when the SVD is used
+   bool identical=memcmp(&closedFormMatrix, &svdMatrix, sizeof(mat44))==0;
+   int status=EXIT_SUCCESS;
+   if(difference>EPS || closedFormResidual>svdResidual+EPS || (conditioning==2 && !identical))
+   {
+      fprintf(stderr, "reg_test_affineLeastSquares: difference %g mm, residuals %g and %g mm\n",
+              difference, closedFormResidual, svdResidual);
+      status=EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   else fprintf(stdout, "reg_test_affineLeastSquares: difference %g mm, residuals %g and %g mm\n",
+                difference, closedFormResidual, svdResidual);
+#endif
+
+   reg_matrix2DDeallocate(pointNumber, warped);
+   reg_matrix2DDeallocate(pointNumber, reference);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_affineLeastSquares ok\n");
+#endif
+   return status;
+}
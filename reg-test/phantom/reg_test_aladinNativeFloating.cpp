@@ -0,0 +1,89 @@
+#include "_reg_aladin.h"
+#include "reg_test_phantom.h"
+
+/* The same floating phantom is stored with integer intensities as int16 and
+ * as float. The affine registration of the int16 image, kept native at the
+ * finest level, has to give the matrix obtained with the float image.
+ */
+
+#define EPS 1.0e-5
+
+/* *************************************************************** */
+/// @brief Return the affine matrix obtained with reg_aladin
+mat44 GetAladinMatrix(nifti_image *reference,
+                      nifti_image *floating,
+                      bool nativeFinestFloating)
+{
+   reg_aladin<float> *aladin=new reg_aladin<float>;
+   aladin->SetInputReference(reference);
+   aladin->SetInputFloating(floating);
+   aladin->SetNumberOfLevels(2);
+   aladin->SetLevelsToPerform(2);
+   aladin->SetNativeFinestFloating(nativeFinestFloating);
+   aladin->SetVerbose(false);
+   aladin->Run();
+   mat44 matrix=*aladin->GetTransformationMatrix();
+   delete aladin;
+   return matrix;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=1)
+   {
+      fprintf(stderr, "Usage: %s\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   nifti_image *reference=CreatePhantom(32, 0.f);
+   nifti_image *floating=CreatePhantom(32, 2.f);
+
+   // The floating intensities are rounded so that both images are identical
+   nifti_image *nativeFloating=nifti_copy_nim_info(floating);
+   nativeFloating->datatype=NIFTI_TYPE_INT16;
+   nativeFloating->nbyper=sizeof(short);
+   nativeFloating->data=malloc(nativeFloating->nvox*nativeFloating->nbyper);
+   float *floatingPtr=static_cast<float *>(floating->data);
+   short *nativePtr=static_cast<short *>(nativeFloating->data);
+   for(size_t i=0; i<floating->nvox; ++i)
+   {
+      nativePtr[i]=static_cast<short>(reg_round(10.f*floatingPtr[i]));
+      floatingPtr[i]=static_cast<float>(nativePtr[i]);
+   }
+   if(!reg_tools_hasNativeIntegerIntensities(nativeFloating))
+   {
+      fprintf(stderr, "reg_test_aladinNativeFloating: the int16 phantom can not be kept native\n");
+      return EXIT_FAILURE;
+   }
+
+   mat44 floatMatrix=GetAladinMatrix(reference, floating, false);
+   mat44 nativeMatrix=GetAladinMatrix(reference, nativeFloating, true);
+
+   double maxDifference=0.;
+   for(int i=0; i<4; ++i)
+      for(int j=0; j<4; ++j)
+         maxDifference=std::max(maxDifference,
+                                (double)fabs(nativeMatrix.m[i][j]-floatMatrix.m[i][j]));
+   // The registration has to recover part of the simulated motion
+   double translation=fabs(floatMatrix.m[0][3])+fabs(floatMatrix.m[1][3])+fabs(floatMatrix.m[2][3]);
+
+   nifti_image_free(nativeFloating);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+
+   if(maxDifference>EPS)
+   {
+      fprintf(stderr, "reg_test_aladinNativeFloating: the native and float matrices differ by %g\n",
+              maxDifference);
+      return EXIT_FAILURE;
+   }
+   if(translation<1.)
+   {
+      fprintf(stderr, "reg_test_aladinNativeFloating: the registration did not recover the shift (%g)\n",
+              translation);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_aladinNativeFloating ok: %g (%g)\n", maxDifference, translation);
+#endif
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+#include "_reg_f3d.h"
+#include "reg_test_phantom.h"
+
+#define EPS 0.001
+// Ratio of the NMI derivatives that may differ, see below
+#define NMI_MISMATCH_RATIO 0.005
+
+/* The localised approximated gradient of reg_f3d is compared against the
+ * global finite differences of the objective function. The control point
+ * grid is initialised with a smooth displacement so that the bending and
+ * linear energies contribute to the gradient. The SSD is updated from the
+ * resampled region of every control point and the NMI from its joint
+ * histogram, through reg_getRegionNMIValue. As the intensities are binned,
+ * the float rounding of the perturbed deformation can move a voxel across a
+ * bin boundary in one computation only, which changes a few NMI derivatives.
+ * All the other derivatives have to agree.
+ */
+
+/* *************************************************************** */
+class reg_test_f3d : public reg_f3d<float>
+{
+public:
+   reg_test_f3d(int refTimePoint, int floTimePoint)
+      : reg_f3d<float>(refTimePoint, floTimePoint),
+        localised(false), checked(false),
+        maxDifference(0), maxGradient(0), mismatchNumber(0), dofNumber(0),
+        localise(true) {}
+
+   bool localised;
+   bool checked;
+   double maxDifference;
+   double maxGradient;
+   size_t mismatchNumber;
+   size_t dofNumber;
+
+protected:
+   bool localise;
+
+   virtual bool CanLocaliseApproximatedGradient()
+   {
+      return this->localise && reg_f3d<float>::CanLocaliseApproximatedGradient();
+   }
+   virtual void GetApproximatedGradient()
+   {
+      if(this->checked)
+      {
+         reg_f3d<float>::GetApproximatedGradient();
+         return;
+      }
+      this->dofNumber=this->transformationGradient->nvox;
+      float *gradPtr=static_cast<float *>(this->transformationGradient->data);
+      // The gradient is computed from the whole objective function first
+      this->localise=false;
+      reg_f3d<float>::GetApproximatedGradient();
+      float *globalGradient=(float *)malloc(dofNumber*sizeof(float));
+      memcpy(globalGradient, gradPtr, dofNumber*sizeof(float));
+      // The gradient is then computed from the support of every control point
+      this->localise=true;
+      this->localised=reg_f3d<float>::CanLocaliseApproximatedGradient();
+      reg_f3d<float>::GetApproximatedGradient();
+      for(size_t i=0; i<dofNumber; ++i)
+         this->maxGradient=fabs(globalGradient[i])>this->maxGradient?fabs(globalGradient[i]):this->maxGradient;
+      // The derivatives that differ by more than the tolerance are counted
+      for(size_t i=0; i<dofNumber; ++i)
+      {
+         double difference=fabs((double)gradPtr[i]-(double)globalGradient[i]);
+         if(difference > EPS*this->maxGradient)
+            ++this->mismatchNumber;
+         else this->maxDifference=difference>this->maxDifference?difference:this->maxDifference;
+      }
+      free(globalGradient);
+      this->checked=true;
+   }
+};
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <measure>\n", argv[0]);
+      fprintf(stderr, "\t<measure> 0 to include the SSD, 1 to check the penalty terms only, 2 to include the NMI\n");
+      return EXIT_FAILURE;
+   }
+   int measure=atoi(argv[1]);
+   if(measure<0 || measure>2)
+   {
+      fprintf(stderr, "reg_test_approxGradient: unknown measure %i\n", measure);
+      return EXIT_FAILURE;
+   }
+
+   nifti_image *reference=CreatePhantom(24, 0.f);
+   nifti_image *floating=CreatePhantom(24, 1.f);
+   nifti_image *grid=CreateControlPointGrid(reference, 5.f, 0.5f);
+
+   // The default bending and linear energy weights are used
+   reg_test_f3d *registration=new reg_test_f3d(reference->nt, floating->nt);
+   registration->SetReferenceImage(reference);
+   registration->SetFloatingImage(floating);
+   registration->SetControlPointGridImage(grid);
+   // The NMI is used when no other measure is set
+   if(measure<2)
+      registration->UseSSD(0, false);
+   if(measure==1)
+      registration->SetSSDWeight(0, 0.);
+   registration->UseApproximatedGradient();
+   registration->SetLevelNumber(1);
+   registration->SetLevelToPerform(1);
+   registration->SetMaximalIterationNumber(1);
+   registration->DoNotPrintOutInformation();
+   registration->Run();
+
+   bool localised=registration->localised;
+   bool checked=registration->checked;
+   double maxDifference=registration->maxDifference;
+   double maxGradient=registration->maxGradient;
+   size_t mismatchNumber=registration->mismatchNumber;
+   size_t dofNumber=registration->dofNumber;
+
+   delete registration;
+   nifti_image_free(grid);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+
+   if(!checked || !localised)
+   {
+      fprintf(stderr, "reg_test_approxGradient: the localised gradient has not been used\n");
+      return EXIT_FAILURE;
+   }
+   size_t maxMismatchNumber=measure==2?(size_t)(NMI_MISMATCH_RATIO*dofNumber):0;
+   if(maxGradient==0 || mismatchNumber > maxMismatchNumber)
+   {
+      fprintf(stderr, "reg_test_approxGradient error too large for %zu/%zu derivatives ( > %g)\n",
+              mismatchNumber, dofNumber, EPS*maxGradient);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_approxGradient ok: %g ( <= %g), %zu/%zu derivatives differ\n",
+           maxDifference, EPS*maxGradient, mismatchNumber, dofNumber);
+#endif
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include "_reg_ReadWriteAsync.h"
+#include "reg_test_phantom.h"
+#include <string>
+#include <vector>
+
+/* Phantoms of different sizes are saved, compressed or not, by
+ * reg_io_AsyncWriter and read back by reg_io_AsyncReader with several
+ * requests in flight. The images are retrieved in the reverse order of their
+ * requests, one file is requested twice, one is retrieved without request and
+ * one is requested but never retrieved. The writer has to save the images in
+ * the order they are queued, so that the last image queued for a filename is
+ * the one read back, and has to save the pending images when destroyed.
+ */
+
+#define IMAGE_NUMBER 6
+#define ROUND_NUMBER 4
+
+/* *************************************************************** */
+nifti_image *CopyImage(nifti_image *image)
+{
+   nifti_image *copy=nifti_copy_nim_info(image);
+   copy->data=malloc(copy->nvox*copy->nbyper);
+   memcpy(copy->data, image->data, copy->nvox*copy->nbyper);
+   return copy;
+}
+/* *************************************************************** */
+bool CompareImages(nifti_image *expected, nifti_image *image, const std::string &name)
+{
+   if(image==NULL)
+   {
+      fprintf(stderr, "reg_test_asyncReadWrite: %s - the image could not be read\n", name.c_str());
+      return false;
+   }
+   for(int i=0; i<8; ++i)
+   {
+      if(expected->dim[i]!=image->dim[i])
+      {
+         fprintf(stderr, "reg_test_asyncReadWrite: %s - dim[%i] %i != %i\n",
+                 name.c_str(), i, image->dim[i], expected->dim[i]);
+         return false;
+      }
+   }
+   if(expected->datatype!=image->datatype || expected->nvox!=image->nvox ||
+         memcmp(expected->data, image->data, expected->nvox*expected->nbyper)!=0)
+   {
+      fprintf(stderr, "reg_test_asyncReadWrite: %s - the voxel values differ\n", name.c_str());
+      return false;
+   }
+   return true;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <outputFolder>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   const std::string folder(argv[1]);
+
+   std::vector<nifti_image *> phantoms;
+   std::vector<std::string> filenames;
+   for(int i=0; i<IMAGE_NUMBER; ++i)
+   {
+      phantoms.push_back(CreatePhantom(24+8*i, 0.5f*i));
+      char name[64];
+      sprintf(name, "/reg_test_asyncReadWrite_%i.nii%s", i, i%2==0?".gz":"");
+      filenames.push_back(folder+name);
+   }
+   const std::string unwaitedName=folder+"/reg_test_asyncReadWrite_unwaited.nii.gz";
+
+   int status=EXIT_SUCCESS;
+   for(int round=0; round<ROUND_NUMBER; ++round)
+   {
+      // The last phantom is first queued with the content of the first one
+      // and then overwritten
+      reg_io_AsyncWriter writer;
+      writer.Write(CopyImage(phantoms[0]), filenames[IMAGE_NUMBER-1].c_str());
+      for(int i=0; i<IMAGE_NUMBER; ++i)
+         writer.Write(CopyImage(phantoms[i]), filenames[i].c_str());
+      writer.Wait();
+      // The destructor saves the images that are still queued
+      {
+         reg_io_AsyncWriter unwaitedWriter;
+         unwaitedWriter.Write(CopyImage(phantoms[1]), unwaitedName.c_str());
+      }
+
+      reg_io_AsyncReader reader(3);
+      for(int i=0; i<IMAGE_NUMBER; ++i)
+         reader.Request(filenames[i].c_str());
+      reader.Request(filenames[0].c_str());
+      reader.Request(unwaitedName.c_str());
+      for(int i=IMAGE_NUMBER-1; i>=0; --i)
+      {
+         nifti_image *image=reader.Get(filenames[i].c_str());
+         if(!CompareImages(phantoms[i], image, filenames[i]))
+            status=EXIT_FAILURE;
+         if(image!=NULL) nifti_image_free(image);
+      }
+      // Both requests of the same file give their own image
+      nifti_image *image=reader.Get(filenames[0].c_str());
+      if(!CompareImages(phantoms[0], image, filenames[0]+" requested twice"))
+         status=EXIT_FAILURE;
+      if(image!=NULL) nifti_image_free(image);
+      // A file that is not requested is read synchronously
+      image=reader.Get(filenames[1].c_str());
+      if(!CompareImages(phantoms[1], image, filenames[1]+" not requested"))
+         status=EXIT_FAILURE;
+      if(image!=NULL) nifti_image_free(image);
+      // The request of unwaitedName is never retrieved and freed by the reader
+      image=reg_io_ReadImageFile(unwaitedName.c_str());
+      if(!CompareImages(phantoms[1], image, unwaitedName))
+         status=EXIT_FAILURE;
+      if(image!=NULL) nifti_image_free(image);
+   }
+
+   for(int i=0; i<IMAGE_NUMBER; ++i)
+   {
+      remove(filenames[i].c_str());
+      nifti_image_free(phantoms[i]);
+   }
+   remove(unwaitedName.c_str());
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_asyncReadWrite ok\n");
+#endif
+   return status;
+}
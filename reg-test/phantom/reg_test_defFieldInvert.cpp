@@ -0,0 +1,88 @@
+#include "reg_test_phantom.h"
+
+/* A smooth deformation field is generated from a b-spline grid and
+ * inverted with the simplex optimisation and with Newton's method. Both
+ * inverses have to agree and the composition of the field with the Newton
+ * inverse has to be the identity, away from the image border where the
+ * inverse is not defined.
+ */
+
+#define EPS 0.001
+#define MARGIN 4
+
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=1)
+   {
+      fprintf(stderr, "Usage: %s\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   nifti_image *reference=CreatePhantom(32, 0.f);
+   nifti_image *grid=CreateControlPointGrid(reference, 5.f, 1.f);
+   nifti_image *field=CreateVectorImage(reference);
+   reg_spline_getDeformationField(grid, field, NULL, false, true);
+
+   nifti_image *simplexInverse=CreateVectorImage(reference);
+   nifti_image *newtonInverse=CreateVectorImage(reference);
+   reg_defFieldInvert(field, simplexInverse, 1.0e-6f);
+   reg_defFieldInvert(field, newtonInverse, 1.0e-5f, true);
+
+   // The field is applied to its Newton inverse
+   nifti_image *composition=CreateVectorImage(reference);
+   memcpy(composition->data, newtonInverse->data, composition->nvox*composition->nbyper);
+   reg_defField_compose(field, composition, NULL);
+
+   const size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   float *simplexPtr=static_cast<float *>(simplexInverse->data);
+   float *newtonPtr=static_cast<float *>(newtonInverse->data);
+   float *compositionPtr=static_cast<float *>(composition->data);
+   double maxInverseDifference=0., maxIdentityDifference=0.;
+   for(int z=MARGIN; z<reference->nz-MARGIN; ++z)
+   {
+      for(int y=MARGIN; y<reference->ny-MARGIN; ++y)
+      {
+         for(int x=MARGIN; x<reference->nx-MARGIN; ++x)
+         {
+            size_t index=(z*reference->ny+y)*reference->nx+x;
+            float position[3];
+            for(int i=0; i<3; ++i)
+               position[i]=reference->qto_xyz.m[i][0]*x+reference->qto_xyz.m[i][1]*y +
+                     reference->qto_xyz.m[i][2]*z+reference->qto_xyz.m[i][3];
+            for(int i=0; i<3; ++i)
+            {
+               size_t vectorIndex=index+i*voxelNumber;
+               maxInverseDifference=std::max(maxInverseDifference,
+                                             (double)fabs(newtonPtr[vectorIndex]-simplexPtr[vectorIndex]));
+               maxIdentityDifference=std::max(maxIdentityDifference,
+                                              (double)fabs(compositionPtr[vectorIndex]-position[i]));
+            }
+         }
+      }
+   }
+
+   nifti_image_free(composition);
+   nifti_image_free(newtonInverse);
+   nifti_image_free(simplexInverse);
+   nifti_image_free(field);
+   nifti_image_free(grid);
+   nifti_image_free(reference);
+
+   if(maxInverseDifference>EPS)
+   {
+      fprintf(stderr, "reg_test_defFieldInvert: the Newton and simplex inverses differ by %g mm\n",
+              maxInverseDifference);
+      return EXIT_FAILURE;
+   }
+   if(maxIdentityDifference>EPS)
+   {
+      fprintf(stderr, "reg_test_defFieldInvert: the composition differs from the identity by %g mm\n",
+              maxIdentityDifference);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_defFieldInvert ok: %g mm between the inverses, %g mm from the identity\n",
+           maxInverseDifference, maxIdentityDifference);
+#endif
+   return EXIT_SUCCESS;
+}
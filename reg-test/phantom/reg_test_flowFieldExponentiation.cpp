@@ -0,0 +1,226 @@
+#include "_reg_globalTrans.h"
+#include "_reg_localTrans.h"
+#include "reg_test_phantom.h"
+
+/* A smooth velocity field defined on an anisotropic grid is exponentiated with
+ * reg_defField_getDeformationFieldFromFlowField, which alternates the squaring
+ * steps between the flow and the deformation fields. The result is compared
+ * against the scaled field composed with itself using reg_defField_compose.
+ * When the affine extensions are provided, the velocity is defined around the
+ * first affine transformation and the second one is composed at the end. The
+ * number of squaring steps computed from the largest velocity, in voxel, is
+ * also checked.
+ */
+
+// Tolerance on the deformation, in mm
+#define EPS 1.0e-4
+
+/* *************************************************************** */
+nifti_image *CopyImage(nifti_image *image)
+{
+   nifti_image *copy=nifti_copy_nim_info(image);
+   copy->data=malloc(copy->nvox*copy->nbyper);
+   memcpy(copy->data, image->data, copy->nvox*copy->nbyper);
+   return copy;
+}
+/* *************************************************************** */
+/// @brief Position of a voxel, in double precision as the squaring steps
+/// amplify the rounding errors of the scaled field
+double GetPosition(mat44 *origin, int x, int y, int z, int d)
+{
+   return (double)origin->m[d][0]*x + (double)origin->m[d][1]*y +
+         (double)origin->m[d][2]*z + (double)origin->m[d][3];
+}
+/* *************************************************************** */
+/// @brief field = (field - inputOrigin) / scaling + outputOrigin
+void ChangeOrigin(nifti_image *field, mat44 *inputOrigin, mat44 *outputOrigin, double scaling)
+{
+   size_t voxelNumber=(size_t)field->nx*field->ny*field->nz;
+   float *fieldPtr=static_cast<float *>(field->data);
+   size_t index=0;
+   for(int z=0; z<field->nz; ++z)
+   {
+      for(int y=0; y<field->ny; ++y)
+      {
+         for(int x=0; x<field->nx; ++x)
+         {
+            for(int d=0; d<3; ++d)
+            {
+               float *value=&fieldPtr[index+d*voxelNumber];
+               *value=(float)(((double)*value-GetPosition(inputOrigin,x,y,z,d))/scaling +
+                              GetPosition(outputOrigin,x,y,z,d));
+            }
+            ++index;
+         }
+      }
+   }
+}
+/* *************************************************************** */
+/// @brief Largest norm of the velocity around the origin, in voxel
+double GetMaxVelocityNorm(nifti_image *flowField, mat44 *origin)
+{
+   size_t voxelNumber=(size_t)flowField->nx*flowField->ny*flowField->nz;
+   float *flowPtr=static_cast<float *>(flowField->data);
+   double maxNorm=0;
+   size_t index=0;
+   for(int z=0; z<flowField->nz; ++z)
+   {
+      for(int y=0; y<flowField->ny; ++y)
+      {
+         for(int x=0; x<flowField->nx; ++x)
+         {
+            double norm=0;
+            for(int d=0; d<3; ++d)
+               norm+=reg_pow2(((double)flowPtr[index+d*voxelNumber]-GetPosition(origin,x,y,z,d)) /
+                              flowField->pixdim[d+1]);
+            maxNorm=std::max(maxNorm, sqrt(norm));
+            ++index;
+         }
+      }
+   }
+   return maxNorm;
+}
+/* *************************************************************** */
+double GetMaxDifference(nifti_image *a, nifti_image *b)
+{
+   float *aPtr=static_cast<float *>(a->data);
+   float *bPtr=static_cast<float *>(b->data);
+   double maxDifference=0;
+   for(size_t i=0; i<a->nvox; ++i)
+   {
+      double difference=fabs((double)aPtr[i]-(double)bPtr[i]);
+      // A NaN in a single field is reported as an infinite difference
+      if(difference!=difference)
+         difference=aPtr[i]!=aPtr[i] && bPtr[i]!=bPtr[i]?0:std::numeric_limits<double>::infinity();
+      maxDifference=std::max(maxDifference, difference);
+   }
+   return maxDifference;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <stepNumber> <affine>\n", argv[0]);
+      fprintf(stderr, "\t<stepNumber> Number of squaring steps\n");
+      fprintf(stderr, "\t<affine> 1 to add the affine extensions to the flow field, 0 otherwise\n");
+      return EXIT_FAILURE;
+   }
+   int stepNumber=atoi(argv[1]);
+   bool useAffine=atoi(argv[2])==1;
+
+   // Anisotropic geometry, the squaring step number depends on the voxel size
+   nifti_image *reference=CreatePhantom(24, 0.f);
+   reference->pixdim[1]=reference->dx=1.5f;
+   reference->pixdim[3]=reference->dz=2.f;
+   reference->qto_xyz=nifti_quatern_to_mat44(0.f, 0.f, 0.f, -10.f, 5.f, 0.f,
+                                            1.5f, 1.f, 2.f, 1.f);
+   reference->qto_ijk=nifti_mat44_inverse(reference->qto_xyz);
+   nifti_image *flowField=CreateVectorImage(reference);
+   flowField->intent_p1=DEF_VEL_FIELD;
+   flowField->intent_p2=stepNumber;
+
+   // The velocity is defined around the first affine transformation if any
+   mat44 affine[2];
+   reg_mat44_eye(&affine[0]);
+   affine[0].m[0][1]=0.05f;
+   affine[0].m[1][2]=-0.04f;
+   affine[0].m[2][2]=1.05f;
+   affine[0].m[0][3]=1.5f;
+   affine[0].m[2][3]=-2.f;
+   reg_mat44_eye(&affine[1]);
+   affine[1].m[1][0]=0.03f;
+   affine[1].m[1][1]=0.97f;
+   affine[1].m[1][3]=0.8f;
+   if(useAffine)
+   {
+      nifti_add_extension(flowField, reinterpret_cast<const char *>(&affine[0]),
+                          sizeof(mat44), NIFTI_ECODE_IGNORE);
+      nifti_add_extension(flowField, reinterpret_cast<const char *>(&affine[1]),
+                          sizeof(mat44), NIFTI_ECODE_IGNORE);
+   }
+   mat44 identityOrigin=reference->qto_xyz;
+   mat44 velocityOrigin=useAffine?reg_mat44_mul(&affine[0], &reference->qto_xyz):identityOrigin;
+
+   // The flow field stores the velocity added to the origin positions
+   size_t voxelNumber=(size_t)flowField->nx*flowField->ny*flowField->nz;
+   float *flowPtr=static_cast<float *>(flowField->data);
+   size_t index=0;
+   for(int z=0; z<flowField->nz; ++z)
+   {
+      for(int y=0; y<flowField->ny; ++y)
+      {
+         for(int x=0; x<flowField->nx; ++x)
+         {
+            flowPtr[index]=(float)GetPosition(&velocityOrigin,x,y,z,0)+3.f*sinf(0.25f*x)*cosf(0.2f*z);
+            flowPtr[index+voxelNumber]=(float)GetPosition(&velocityOrigin,x,y,z,1)+2.f*cosf(0.3f*y)*sinf(0.15f*x);
+            flowPtr[index+2*voxelNumber]=(float)GetPosition(&velocityOrigin,x,y,z,2)-2.5f*sinf(0.2f*z+0.1f*y);
+            ++index;
+         }
+      }
+   }
+   nifti_image *inputFlowField=CopyImage(flowField);
+
+   // Exponentiation with the given number of squaring steps
+   nifti_image *deformationField=CreateVectorImage(reference);
+   reg_defField_getDeformationFieldFromFlowField(flowField, deformationField, false);
+
+   // The scaled field is composed with itself using reg_defField_compose
+   nifti_image *expectedField=CopyImage(inputFlowField);
+   ChangeOrigin(expectedField, &velocityOrigin, &identityOrigin, pow(2.0, stepNumber));
+   nifti_image *previousField=CopyImage(expectedField);
+   for(int i=0; i<stepNumber; ++i)
+   {
+      memcpy(previousField->data, expectedField->data, expectedField->nvox*expectedField->nbyper);
+      reg_defField_compose(previousField, expectedField, NULL);
+   }
+   if(useAffine)
+   {
+      ChangeOrigin(expectedField, &identityOrigin, &velocityOrigin, 1.);
+      reg_affine_getDeformationField(&affine[1], expectedField, true);
+   }
+   int status=EXIT_SUCCESS;
+   double maxDifference=GetMaxDifference(expectedField, deformationField);
+   if(maxDifference>EPS)
+   {
+      fprintf(stderr, "reg_test_flowFieldExponentiation: the deformation fields differ by %g mm\n",
+              maxDifference);
+      status=EXIT_FAILURE;
+   }
+
+   // The velocity is scaled up so that more squaring steps are required
+   nifti_image *scaledFlowField=CopyImage(inputFlowField);
+   ChangeOrigin(scaledFlowField, &velocityOrigin, &velocityOrigin, 1./pow(2.0, stepNumber-1));
+   double maxNorm=GetMaxVelocityNorm(scaledFlowField, &velocityOrigin);
+   int expectedStepNumber=0;
+   while(maxNorm>0.5)
+   {
+      maxNorm*=0.5;
+      ++expectedStepNumber;
+   }
+   expectedStepNumber=std::max(expectedStepNumber, 6);
+   reg_defField_getDeformationFieldFromFlowField(scaledFlowField, deformationField, true);
+   if(expectedStepNumber<=stepNumber || scaledFlowField->intent_p2!=expectedStepNumber)
+   {
+      fprintf(stderr, "reg_test_flowFieldExponentiation: %g squaring steps used, %i expected\n",
+              scaledFlowField->intent_p2, expectedStepNumber);
+      status=EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_flowFieldExponentiation: difference %g mm, %i squaring steps\n",
+           maxDifference, expectedStepNumber);
+#endif
+
+   nifti_image_free(scaledFlowField);
+   nifti_image_free(previousField);
+   nifti_image_free(expectedField);
+   nifti_image_free(deformationField);
+   nifti_image_free(inputFlowField);
+   nifti_image_free(flowField);
+   nifti_image_free(reference);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_flowFieldExponentiation ok\n");
+#endif
+   return status;
+}
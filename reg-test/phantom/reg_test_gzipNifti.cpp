@@ -0,0 +1,165 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteGzip.h"
+#include "reg_test_phantom.h"
+#include <zlib.h>
+#include <string>
+#include <vector>
+
+/* The phantom spans several gzip members of reg_io_writeGzipNifti. The file
+ * is read back in parallel and with the standard zlib stream. A file made of
+ * gzip members without index, as written by gzip or pigz, has to be rejected
+ * by reg_io_readGzipNifti and read through the nifti library instead.
+ */
+
+/* *************************************************************** */
+bool CompareImages(nifti_image *expected, nifti_image *image, const char *name)
+{
+   if(image==NULL)
+   {
+      fprintf(stderr, "reg_test_gzipNifti: %s - the image could not be read\n", name);
+      return false;
+   }
+   for(int i=0; i<8; ++i)
+   {
+      if(expected->dim[i]!=image->dim[i])
+      {
+         fprintf(stderr, "reg_test_gzipNifti: %s - dim[%i] %i != %i\n",
+                 name, i, image->dim[i], expected->dim[i]);
+         return false;
+      }
+   }
+   if(expected->datatype!=image->datatype || expected->nvox!=image->nvox ||
+         memcmp(expected->data, image->data, expected->nvox*expected->nbyper)!=0)
+   {
+      fprintf(stderr, "reg_test_gzipNifti: %s - the voxel values differ\n", name);
+      return false;
+   }
+   for(int i=0; i<4; ++i)
+   {
+      for(int j=0; j<4; ++j)
+      {
+         if(expected->qto_xyz.m[i][j]!=image->qto_xyz.m[i][j])
+         {
+            fprintf(stderr, "reg_test_gzipNifti: %s - the qform differs\n", name);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+/* *************************************************************** */
+bool ReadFile(const std::string &filename, std::vector<unsigned char> &content)
+{
+   FILE *file=fopen(filename.c_str(), "rb");
+   if(file==NULL)
+      return false;
+   unsigned char buffer[65536];
+   size_t readSize;
+   content.clear();
+   while((readSize=fread(buffer, 1, 65536, file))>0)
+      content.insert(content.end(), buffer, buffer+readSize);
+   fclose(file);
+   return true;
+}
+/* *************************************************************** */
+/// @brief Return the number of gzip members that hold the NR size subfield
+int CountIndexedMembers(const std::vector<unsigned char> &content)
+{
+   int memberNumber=0;
+   for(size_t i=0; i+14<content.size(); ++i)
+   {
+      if(content[i]==0x1f && content[i+1]==0x8b && content[i+2]==8 && content[i+3]==4 &&
+            content[i+12]=='N' && content[i+13]=='R')
+         ++memberNumber;
+   }
+   return memberNumber;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <outputFolder>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   const std::string folder(argv[1]);
+   const std::string indexedName=folder+"/reg_test_gzipNifti_indexed.nii.gz";
+   const std::string plainName=folder+"/reg_test_gzipNifti_plain.nii";
+   const std::string unindexedName=folder+"/reg_test_gzipNifti_unindexed.nii.gz";
+
+   // The phantom is larger than a gzip member of reg_io_writeGzipNifti
+   nifti_image *phantom=CreatePhantom(96, 1.f);
+   int status=EXIT_SUCCESS;
+
+   // Write the phantom as indexed gzip members
+   nifti_set_filenames(phantom, indexedName.c_str(), 0, 0);
+   if(!reg_io_writeGzipNifti(phantom))
+   {
+      fprintf(stderr, "reg_test_gzipNifti: the indexed file could not be written\n");
+      nifti_image_free(phantom);
+      return EXIT_FAILURE;
+   }
+   std::vector<unsigned char> content;
+   ReadFile(indexedName, content);
+   int memberNumber=CountIndexedMembers(content);
+   if(memberNumber<2)
+   {
+      fprintf(stderr, "reg_test_gzipNifti: %i indexed member(s) written, several expected\n",
+              memberNumber);
+      status=EXIT_FAILURE;
+   }
+
+   // Read the indexed members in parallel
+   nifti_image *image=reg_io_readGzipNifti(indexedName.c_str());
+   if(!CompareImages(phantom, image, "parallel reading"))
+      status=EXIT_FAILURE;
+   if(image!=NULL) nifti_image_free(image);
+
+   // The indexed file remains a valid gzip stream for the nifti library
+   image=nifti_image_read(indexedName.c_str(), true);
+   if(!CompareImages(phantom, image, "zlib reading"))
+      status=EXIT_FAILURE;
+   if(image!=NULL) nifti_image_free(image);
+
+   // Split an uncompressed copy of the phantom into two unindexed members
+   nifti_set_filenames(phantom, plainName.c_str(), 0, 0);
+   nifti_image_write(phantom);
+   ReadFile(plainName, content);
+   size_t half=content.size()/2;
+   gzFile gzfile=gzopen(unindexedName.c_str(), "wb");
+   gzwrite(gzfile, &content[0], (unsigned)half);
+   gzclose(gzfile);
+   gzfile=gzopen(unindexedName.c_str(), "ab");
+   gzwrite(gzfile, &content[half], (unsigned)(content.size()-half));
+   gzclose(gzfile);
+
+   // The parallel reader has to reject it and the generic reader to read it
+   image=reg_io_readGzipNifti(unindexedName.c_str());
+   if(image!=NULL)
+   {
+      fprintf(stderr, "reg_test_gzipNifti: unindexed members read in parallel\n");
+      nifti_image_free(image);
+      status=EXIT_FAILURE;
+   }
+   image=reg_io_ReadImageFile(unindexedName.c_str());
+   if(!CompareImages(phantom, image, "unindexed members"))
+      status=EXIT_FAILURE;
+   if(image!=NULL) nifti_image_free(image);
+
+   // Write and read through the generic functions
+   reg_io_WriteImageFile(phantom, indexedName.c_str());
+   image=reg_io_ReadImageFile(indexedName.c_str());
+   if(!CompareImages(phantom, image, "generic reading"))
+      status=EXIT_FAILURE;
+   if(image!=NULL) nifti_image_free(image);
+
+   nifti_image_free(phantom);
+   remove(indexedName.c_str());
+   remove(plainName.c_str());
+   remove(unindexedName.c_str());
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_gzipNifti ok: %i indexed members\n", memberNumber);
+#endif
+   return status;
+}
@@ -0,0 +1,180 @@
+#include "_reg_aladin.h"
+#include "_reg_blockMatching.h"
+#include "_reg_globalTrans.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "reg_test_phantom.h"
+
+/* The floating phantom is warped with an affine transformation composed with
+ * a smooth deformation, so that the blocks have different displacements. The
+ * block matching is performed with the exhaustive and with the hierarchical
+ * searches. The hierarchical search refines the best displacement of a coarse
+ * lattice and stops on the first local maximum of the correlation. The
+ * texture of the phantom is smooth at the scale of a block and most
+ * displacements give a correlation above 0.99, so that a large ratio of the
+ * blocks ends on a local maximum. The ratio of the blocks that differ is
+ * bounded, and so is the distance between the affine transformations that
+ * are estimated from both sets of correspondences, and the one between the
+ * matrices given by reg_aladin.
+ */
+
+// Maximal ratio of the defined blocks whose displacements differ
+#define MAX_DISAGREEMENT_RATIO 0.35
+// Maximal distance between the block positions transformed by the affine
+// transformations obtained with both searches, in step size
+#define MAX_AFFINE_DIFFERENCE 0.5
+
+/* *************************************************************** */
+/// @brief Largest distance between the positions of the blocks transformed
+/// by both matrices
+double GetTransformationDifference(mat44 *a, mat44 *b, _reg_blockMatchingParam *params)
+{
+   double maxDifference=0.;
+   for(int i=0; i<params->activeBlockNumber; ++i)
+   {
+      float positionA[3], positionB[3];
+      reg_mat44_mul(a, &params->referencePosition[3*i], positionA);
+      reg_mat44_mul(b, &params->referencePosition[3*i], positionB);
+      double distance=sqrt(reg_pow2(positionA[0]-positionB[0]) +
+                           reg_pow2(positionA[1]-positionB[1]) +
+                           reg_pow2(positionA[2]-positionB[2]));
+      maxDifference=std::max(maxDifference, distance);
+   }
+   return maxDifference;
+}
+/* *************************************************************** */
+mat44 GetAladinMatrix(nifti_image *reference,
+                      nifti_image *floating,
+                      int stepSize,
+                      bool hierarchicalSearch)
+{
+   reg_aladin<float> *aladin=new reg_aladin<float>;
+   aladin->SetInputReference(reference);
+   aladin->SetInputFloating(floating);
+   aladin->SetNumberOfLevels(2);
+   aladin->SetLevelsToPerform(2);
+   aladin->SetBlockStepSize(stepSize);
+   aladin->SetHierarchicalSearch(hierarchicalSearch);
+   aladin->SetVerbose(false);
+   aladin->Run();
+   mat44 matrix=*aladin->GetTransformationMatrix();
+   delete aladin;
+   return matrix;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <captureRange> <stepSize>\n", argv[0]);
+      fprintf(stderr, "\t<captureRange> Largest displacement tested along every axis, in voxels\n");
+      fprintf(stderr, "\t<stepSize> Step between the tested displacements, in voxels\n");
+      return EXIT_FAILURE;
+   }
+   int captureRange=atoi(argv[1]);
+   int stepSize=atoi(argv[2]);
+
+   nifti_image *reference=CreatePhantom(48, 0.f);
+   nifti_image *floating=CreatePhantom(48, 0.f);
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   int *mask=(int *)calloc(voxelNumber, sizeof(int));
+
+   _reg_blockMatchingParam params;
+   initialise_block_matching_method(reference, &params, 50, 50, stepSize, mask);
+   params.voxelCaptureRange=captureRange;
+
+   mat44 affine;
+   reg_mat44_eye(&affine);
+   affine.m[0][1]=0.04f;
+   affine.m[1][0]=-0.03f;
+   affine.m[2][2]=1.03f;
+   affine.m[0][3]=0.3f*captureRange;
+   affine.m[1][3]=-0.2f*captureRange;
+   affine.m[2][3]=0.5f;
+
+   // The smooth deformation is composed with the affine transformation
+   nifti_image *grid=CreateControlPointGrid(reference, 8.f, 1.f);
+   nifti_image *field=CreateVectorImage(reference);
+   reg_affine_getDeformationField(&affine, field, false, mask);
+   reg_spline_getDeformationField(grid, field, mask, true, true);
+   nifti_image *warped=nifti_copy_nim_info(reference);
+   warped->data=calloc(warped->nvox, warped->nbyper);
+   reg_resampleImage(floating, warped, field, mask, 1, std::numeric_limits<float>::quiet_NaN());
+
+   size_t blockNumber=(size_t)params.activeBlockNumber*params.dim;
+   params.hierarchicalSearch=false;
+   block_matching_method(reference, warped, &params, mask);
+   float *exhaustivePosition=(float *)malloc(blockNumber*sizeof(float));
+   memcpy(exhaustivePosition, params.warpedPosition, blockNumber*sizeof(float));
+   int exhaustiveDefinedNumber=params.definedActiveBlockNumber;
+   mat44 exhaustiveAffine;
+   reg_mat44_eye(&exhaustiveAffine);
+   optimize(&params, &exhaustiveAffine);
+
+   params.hierarchicalSearch=true;
+   block_matching_method(reference, warped, &params, mask);
+   int disagreementNumber=0;
+   for(int b=0; b<params.activeBlockNumber; ++b)
+   {
+      for(unsigned int d=0; d<params.dim; ++d)
+      {
+         float exhaustive=exhaustivePosition[b*params.dim+d];
+         float hierarchical=params.warpedPosition[b*params.dim+d];
+         bool bothNaN=exhaustive!=exhaustive && hierarchical!=hierarchical;
+         if(!bothNaN && exhaustive!=hierarchical)
+         {
+            ++disagreementNumber;
+            break;
+         }
+      }
+   }
+   mat44 hierarchicalAffine;
+   reg_mat44_eye(&hierarchicalAffine);
+   optimize(&params, &hierarchicalAffine);
+   double affineDifference=GetTransformationDifference(&exhaustiveAffine, &hierarchicalAffine, &params);
+
+   int status=EXIT_SUCCESS;
+   if(exhaustiveDefinedNumber==0 ||
+         disagreementNumber > MAX_DISAGREEMENT_RATIO*exhaustiveDefinedNumber)
+   {
+      fprintf(stderr, "reg_test_hierarchicalBlockMatching: %i/%i blocks differ\n",
+              disagreementNumber, exhaustiveDefinedNumber);
+      status=EXIT_FAILURE;
+   }
+   if(affineDifference>MAX_AFFINE_DIFFERENCE*stepSize)
+   {
+      fprintf(stderr, "reg_test_hierarchicalBlockMatching: the affine transformations differ by %g mm\n",
+              affineDifference);
+      status=EXIT_FAILURE;
+   }
+
+   // The phantom is shifted and rotated rather than warped
+   nifti_image *shifted=CreatePhantom(48, 1.5f);
+   mat44 exhaustiveMatrix=GetAladinMatrix(reference, shifted, stepSize, false);
+   mat44 hierarchicalMatrix=GetAladinMatrix(reference, shifted, stepSize, true);
+   double aladinDifference=GetTransformationDifference(&exhaustiveMatrix, &hierarchicalMatrix, &params);
+   if(aladinDifference>MAX_AFFINE_DIFFERENCE*stepSize)
+   {
+      fprintf(stderr, "reg_test_hierarchicalBlockMatching: the reg_aladin matrices differ by %g mm\n",
+              aladinDifference);
+      status=EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_hierarchicalBlockMatching: %i/%i blocks differ, differences %g and %g mm\n",
+           disagreementNumber, exhaustiveDefinedNumber, affineDifference, aladinDifference);
+#endif
+
+   nifti_image_free(shifted);
+   free(exhaustivePosition);
+   nifti_image_free(warped);
+   nifti_image_free(field);
+   nifti_image_free(grid);
+   free(mask);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_hierarchicalBlockMatching ok\n");
+#endif
+   return status;
+}
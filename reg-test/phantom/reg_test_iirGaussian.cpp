@@ -0,0 +1,88 @@
+#include "_reg_tools.h"
+#include "reg_test_phantom.h"
+
+/* The phantom is smoothed with the explicit Gaussian kernel, bounded at
+ * 3 sigma, and with its recursive approximation for several standard
+ * deviations, in voxel and in millimetre. The phantom contains sharp edges
+ * and the optional mask excludes the first slices and scattered voxels, so
+ * that the normalisation by the density is also compared. The largest
+ * difference has to stay within a small fraction of the intensity range.
+ */
+
+// Tolerance relative to the intensity range of the phantom. The explicit
+// kernel is truncated and the recursive one approximates the whole Gaussian,
+// while a 10% error on sigma gives differences of 1.5% to 3% of the range
+#define EPS 0.0075
+
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <mask>\n", argv[0]);
+      fprintf(stderr, "\t<mask> 1 to exclude part of the image, 0 to use all voxels\n");
+      return EXIT_FAILURE;
+   }
+   bool useMask=atoi(argv[1])==1;
+
+   nifti_image *phantom=CreatePhantom(48, 0.f);
+   // The voxels are anisotropic for the kernels defined in millimetre
+   phantom->pixdim[3]=phantom->dz=1.5f;
+   size_t voxelNumber=(size_t)phantom->nx*phantom->ny*phantom->nz;
+   int *mask=(int *)calloc(voxelNumber, sizeof(int));
+   if(useMask)
+   {
+      for(size_t i=0; i<voxelNumber; ++i)
+         if(i%11==0 || i<voxelNumber/8) mask[i]=-1;
+   }
+   float minValue=reg_tools_getMinValue(phantom, -1);
+   float maxValue=reg_tools_getMaxValue(phantom, -1);
+   double tolerance=EPS*(maxValue-minValue);
+
+   // Negative values are expressed in voxel and positive ones in millimetre
+   const float sigmas[5]= {-0.7f, -1.f, -2.f, -4.f, 3.f};
+   int status=EXIT_SUCCESS;
+   nifti_image *expected=nifti_copy_nim_info(phantom);
+   expected->data=malloc(expected->nvox*expected->nbyper);
+   nifti_image *recursive=nifti_copy_nim_info(phantom);
+   recursive->data=malloc(recursive->nvox*recursive->nbyper);
+   for(int s=0; s<5; ++s)
+   {
+      float sigma=sigmas[s];
+      memcpy(expected->data, phantom->data, phantom->nvox*phantom->nbyper);
+      memcpy(recursive->data, phantom->data, phantom->nvox*phantom->nbyper);
+      reg_tools_kernelConvolution(expected, &sigma, GAUSSIAN_KERNEL, mask);
+      reg_tools_kernelConvolution(recursive, &sigma, IIR_GAUSSIAN_KERNEL, mask);
+      float *expectedPtr=static_cast<float *>(expected->data);
+      float *recursivePtr=static_cast<float *>(recursive->data);
+      double maxDifference=0;
+      for(size_t i=0; i<voxelNumber; ++i)
+      {
+         bool bothNaN=expectedPtr[i]!=expectedPtr[i] && recursivePtr[i]!=recursivePtr[i];
+         double difference=bothNaN?0:fabs((double)expectedPtr[i]-(double)recursivePtr[i]);
+         // A NaN in a single image fails the comparison
+         if(!(difference<=maxDifference))
+            maxDifference=difference!=difference?std::numeric_limits<double>::infinity():difference;
+      }
+      if(maxDifference>tolerance)
+      {
+         fprintf(stderr, "reg_test_iirGaussian: sigma %g - difference %g ( > %g)\n",
+                 sigma, maxDifference, tolerance);
+         status=EXIT_FAILURE;
+      }
+#ifndef NDEBUG
+      else fprintf(stdout, "reg_test_iirGaussian: sigma %g - difference %g ( <= %g)\n",
+                   sigma, maxDifference, tolerance);
+#endif
+   }
+
+   nifti_image_free(recursive);
+   nifti_image_free(expected);
+   free(mask);
+   nifti_image_free(phantom);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_iirGaussian ok\n");
+#endif
+   return status;
+}
@@ -0,0 +1,181 @@
+#include "_reg_lncc.h"
+#include "_reg_resampling.h"
+#include "reg_test_phantom.h"
+
+/* The LNCC is evaluated for several transformations of a level, some of them
+ * moving part of the floating image out of the field of view. The reference
+ * statistics have to be computed once for the whole level. The LNCC values
+ * are compared to the previous implementation, where all the statistics are
+ * computed over the voxels that are defined in both images.
+ */
+
+// Relative tolerance when the warped image is defined everywhere
+#define EPS 1.0e-5
+// Relative tolerance when the warped NaN voxels, up to a quarter of the
+// image, are extrapolated instead of being excluded from the statistics
+#define EPS_NAN 0.02
+
+/* *************************************************************** */
+class reg_test_lncc : public reg_lncc
+{
+public:
+   int GetStatUpdateNumber()
+   {
+      return this->statUpdateNumber;
+   }
+   int GetStatReuseNumber()
+   {
+      return this->statReuseNumber;
+   }
+};
+/* *************************************************************** */
+/// @brief Return the LNCC with the statistics computed over the defined voxels
+double GetBaselineLNCC(nifti_image *reference,
+                       nifti_image *warped,
+                       int *mask,
+                       float kernelStdDev,
+                       int kernelType)
+{
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   int *combinedMask=(int *)malloc(voxelNumber*sizeof(int));
+   memcpy(combinedMask, mask, voxelNumber*sizeof(int));
+   reg_tools_removeNanFromMask(reference, combinedMask);
+   reg_tools_removeNanFromMask(warped, combinedMask);
+
+   nifti_image *stats[5];
+   for(int i=0; i<5; ++i)
+   {
+      stats[i]=nifti_copy_nim_info(reference);
+      stats[i]->data=malloc(stats[i]->nvox*stats[i]->nbyper);
+   }
+   float *refPtr=static_cast<float *>(reference->data);
+   float *warPtr=static_cast<float *>(warped->data);
+   float *statPtr[5];
+   for(int i=0; i<5; ++i)
+      statPtr[i]=static_cast<float *>(stats[i]->data);
+   for(size_t i=0; i<voxelNumber; ++i)
+   {
+      statPtr[0][i]=refPtr[i];
+      statPtr[1][i]=refPtr[i]*refPtr[i];
+      statPtr[2][i]=warPtr[i];
+      statPtr[3][i]=warPtr[i]*warPtr[i];
+      statPtr[4][i]=refPtr[i]*warPtr[i];
+   }
+   for(int i=0; i<5; ++i)
+      reg_tools_kernelConvolution(stats[i], &kernelStdDev, kernelType, combinedMask);
+
+   double lnccSum=0., activeVoxelNumber=0.;
+   for(size_t i=0; i<voxelNumber; ++i)
+   {
+      if(combinedMask[i]<0) continue;
+      float refSdev=sqrtf(statPtr[1][i]-reg_pow2(statPtr[0][i]));
+      float warSdev=sqrtf(statPtr[3][i]-reg_pow2(statPtr[2][i]));
+      if(refSdev<1.e-06f) refSdev=0.f;
+      if(warSdev<1.e-06f) warSdev=0.f;
+      double lncc=(statPtr[4][i]-statPtr[0][i]*statPtr[2][i])/(refSdev*warSdev);
+      if(lncc==lncc && isinf(lncc)==0)
+      {
+         lnccSum += fabs(lncc);
+         ++activeVoxelNumber;
+      }
+   }
+   for(int i=0; i<5; ++i)
+      nifti_image_free(stats[i]);
+   free(combinedMask);
+   return lnccSum/activeVoxelNumber;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <kernelType>\n", argv[0]);
+      fprintf(stderr, "\t<kernelType> %i for the Gaussian kernel, %i for the mean kernel\n",
+              GAUSSIAN_KERNEL, MEAN_KERNEL);
+      return EXIT_FAILURE;
+   }
+   int kernelType=atoi(argv[1]);
+   const float kernelStdDev=2.f;
+
+   nifti_image *reference=CreatePhantom(32, 0.f);
+   nifti_image *floating=CreatePhantom(32, 1.f);
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   int *mask=(int *)calloc(voxelNumber, sizeof(int));
+   nifti_image *warped=nifti_copy_nim_info(reference);
+   warped->data=malloc(warped->nvox*warped->nbyper);
+   nifti_image *warpedGradient=CreateVectorImage(reference);
+   nifti_image *voxelGradient=CreateVectorImage(reference);
+   nifti_image *field=CreateVectorImage(reference);
+
+   reg_test_lncc *lncc=new reg_test_lncc;
+   lncc->SetTimepointWeight(0, 1.);
+   lncc->SetKernelStandardDeviation(0, kernelStdDev);
+   lncc->SetKernelType(kernelType);
+   // The images are rescaled when the measure is initialised
+   lncc->InitialiseMeasure(reference, floating, mask, warped, warpedGradient, voxelGradient);
+   int initialUpdateNumber=lncc->GetStatUpdateNumber();
+
+   // Every translation is evaluated as in an iteration of a registration. The
+   // warped image of the first one is padded with zero and defined everywhere
+   const float shifts[4][3]= {{0.f, 0.f, 0.f}, {1.5f, -0.5f, 0.f}, {-2.25f, 1.f, 3.f}, {0.f, 4.f, -1.f}};
+   float *fieldPtr=static_cast<float *>(field->data);
+   int status=EXIT_SUCCESS;
+   for(int s=0; s<4; ++s)
+   {
+      for(int i=0; i<3; ++i)
+         for(size_t v=0; v<voxelNumber; ++v)
+            fieldPtr[i*voxelNumber+v]=shifts[s][i];
+      field->intent_p1=DISP_FIELD;
+      reg_getDeformationFromDisplacement(field);
+      float padding=s==0?0.f:std::numeric_limits<float>::quiet_NaN();
+      reg_resampleImage(floating, warped, field, mask, 1, padding);
+      reg_getImageGradient(floating, warpedGradient, field, mask, 1, padding, 0);
+      size_t nanNumber=0;
+      float *warpedPtr=static_cast<float *>(warped->data);
+      for(size_t v=0; v<voxelNumber; ++v)
+         if(warpedPtr[v]!=warpedPtr[v]) ++nanNumber;
+
+      double value=lncc->GetSimilarityMeasureValue();
+      reg_tools_multiplyValueToImage(voxelGradient, voxelGradient, 0.f);
+      lncc->GetVoxelBasedSimilarityMeasureGradient(0);
+      double expected=GetBaselineLNCC(reference, warped, mask, kernelStdDev, kernelType);
+      double tolerance=nanNumber>0?EPS_NAN:EPS;
+      if(fabs(value-expected)>tolerance*fabs(expected))
+      {
+         fprintf(stderr, "reg_test_lncc: shift %i (%zu NaN voxels) - LNCC %g != %g\n",
+                 s, nanNumber, value, expected);
+         status=EXIT_FAILURE;
+      }
+#ifndef NDEBUG
+      fprintf(stdout, "reg_test_lncc: shift %i (%zu NaN voxels) - LNCC %g, baseline %g\n",
+              s, nanNumber, value, expected);
+#endif
+   }
+   // The reference statistics are only computed when the measure is initialised
+   if(initialUpdateNumber!=1 || lncc->GetStatUpdateNumber()!=1)
+   {
+      fprintf(stderr, "reg_test_lncc: the reference statistics are computed %i times over the level\n",
+              lncc->GetStatUpdateNumber());
+      status=EXIT_FAILURE;
+   }
+   if(lncc->GetStatReuseNumber()!=8)
+   {
+      fprintf(stderr, "reg_test_lncc: the reference statistics are reused %i times instead of 8\n",
+              lncc->GetStatReuseNumber());
+      status=EXIT_FAILURE;
+   }
+
+   delete lncc;
+   nifti_image_free(field);
+   nifti_image_free(voxelGradient);
+   nifti_image_free(warpedGradient);
+   nifti_image_free(warped);
+   free(mask);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_lncc ok\n");
+#endif
+   return status;
+}
@@ -0,0 +1,157 @@
+#include "_reg_ReadWriteImage.h"
+#include "reg_test_phantom.h"
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+/* An uncompressed nifti file is read back through reg_io_ReadImageFile,
+ * which maps it in memory on Linux. The values have to match the phantom and
+ * the changes made in memory must not reach the file. The file is then
+ * overwritten while it is mapped and read by another thread: that thread
+ * has to keep seeing the values that were read, never zeros or the new ones.
+ */
+
+#define OVERWRITE_NUMBER 10
+
+/* *************************************************************** */
+bool HasSameValues(nifti_image *expected, nifti_image *image, const char *name)
+{
+   if(image==NULL)
+   {
+      fprintf(stderr, "reg_test_mappedNifti: %s - the image could not be read\n", name);
+      return false;
+   }
+   if(expected->datatype!=image->datatype || expected->nvox!=image->nvox ||
+         memcmp(expected->data, image->data, expected->nvox*expected->nbyper)!=0)
+   {
+      fprintf(stderr, "reg_test_mappedNifti: %s - the voxel values differ\n", name);
+      return false;
+   }
+   return true;
+}
+/* *************************************************************** */
+#ifdef __linux__
+/// @brief Return true if the file is mapped in the memory of the process
+bool IsMapped(const std::string &filename)
+{
+   char *path=realpath(filename.c_str(), NULL);
+   if(path==NULL)
+      return false;
+   FILE *maps=fopen("/proc/self/maps", "r");
+   bool mapped=false;
+   char line[4096];
+   while(maps!=NULL && fgets(line, 4096, maps)!=NULL)
+   {
+      if(strstr(line, path)!=NULL)
+         mapped=true;
+   }
+   if(maps!=NULL) fclose(maps);
+   free(path);
+   return mapped;
+}
+/* *************************************************************** */
+struct ReaderData
+{
+   nifti_image *image;
+   nifti_image *expected;
+   volatile bool running;
+   size_t differenceNumber;
+};
+/// @brief Compare the image to its expected values until it is stopped
+void *ReadContinuously(void *arg)
+{
+   ReaderData *data=static_cast<ReaderData *>(arg);
+   do
+   {
+      if(memcmp(data->expected->data, data->image->data,
+                data->expected->nvox*data->expected->nbyper)!=0)
+         ++data->differenceNumber;
+   }
+   while(data->running);
+   return NULL;
+}
+#endif
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <outputFolder>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   const std::string filename=std::string(argv[1])+"/reg_test_mappedNifti.nii";
+   nifti_image *phantom=CreatePhantom(64, 0.f);
+   nifti_image *other=CreatePhantom(64, 2.f);
+   int status=EXIT_SUCCESS;
+
+   // Round trip
+   reg_io_WriteImageFile(phantom, filename.c_str());
+   nifti_image *image=reg_io_ReadImageFile(filename.c_str());
+   if(!HasSameValues(phantom, image, "round trip"))
+      status=EXIT_FAILURE;
+#ifdef __linux__
+   if(!IsMapped(filename))
+   {
+      fprintf(stderr, "reg_test_mappedNifti: the file is not mapped in memory\n");
+      status=EXIT_FAILURE;
+   }
+#endif
+   // The mapping is private
+   if(image!=NULL)
+   {
+      reg_tools_multiplyValueToImage(image, image, 2.f);
+      nifti_image *reread=reg_io_ReadImageFile(filename.c_str());
+      if(!HasSameValues(phantom, reread, "private mapping"))
+         status=EXIT_FAILURE;
+      if(reread!=NULL) nifti_image_free(reread);
+      nifti_image_free(image);
+   }
+#ifdef __linux__
+   if(IsMapped(filename))
+   {
+      fprintf(stderr, "reg_test_mappedNifti: the file is still mapped after the images are freed\n");
+      status=EXIT_FAILURE;
+   }
+
+   // Overwrite the file while it is mapped and read by another thread
+   size_t differenceNumber=0;
+   for(int i=0; i<OVERWRITE_NUMBER; ++i)
+   {
+      reg_io_WriteImageFile(phantom, filename.c_str());
+      ReaderData data;
+      data.image=reg_io_ReadImageFile(filename.c_str());
+      data.expected=phantom;
+      data.running=true;
+      data.differenceNumber=0;
+      pthread_t thread;
+      pthread_create(&thread, NULL, ReadContinuously, &data);
+      reg_io_WriteImageFile(other, filename.c_str());
+      data.running=false;
+      pthread_join(thread, NULL);
+      differenceNumber+=data.differenceNumber;
+      if(!HasSameValues(phantom, data.image, "overwritten file"))
+         status=EXIT_FAILURE;
+      nifti_image_free(data.image);
+      image=reg_io_ReadImageFile(filename.c_str());
+      if(!HasSameValues(other, image, "overwriting file"))
+         status=EXIT_FAILURE;
+      if(image!=NULL) nifti_image_free(image);
+   }
+   if(differenceNumber>0)
+   {
+      fprintf(stderr, "reg_test_mappedNifti: %zu incorrect reads while the file is overwritten\n",
+              differenceNumber);
+      status=EXIT_FAILURE;
+   }
+#endif
+
+   nifti_image_free(other);
+   nifti_image_free(phantom);
+   remove(filename.c_str());
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_mappedNifti ok\n");
+#endif
+   return status;
+}
@@ -0,0 +1,84 @@
+#include "_reg_f3d.h"
+#include "reg_test_phantom.h"
+
+// Relative tolerance between the estimated and the tracked peak memory
+#define TOLERANCE 0.1
+
+/* The peak memory estimated by reg_f3d from the input images and options,
+ * before the registration is run, is compared against the peak memory
+ * recorded by the reg_tools memory tracker during the registration of a
+ * phantom. The input images are recorded in the tracker by the test, as they
+ * are part of the estimate. The estimate has to be an upper bound of the
+ * tracked peak, within the tolerance.
+ */
+
+/* *************************************************************** */
+class reg_test_f3d : public reg_f3d<float>
+{
+public:
+   reg_test_f3d(int refTimePoint, int floTimePoint)
+      : reg_f3d<float>(refTimePoint, floTimePoint) {}
+   size_t GetEstimatedPeakMemory()
+   {
+      return this->EstimatePeakMemory();
+   }
+};
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <jacobian>\n", argv[0]);
+      fprintf(stderr, "\t<jacobian> 1 to use the non-approximated jacobian penalty term, 0 otherwise\n");
+      return EXIT_FAILURE;
+   }
+   bool useJacobian=atoi(argv[1])==1;
+
+   nifti_image *reference=CreatePhantom(48, 0.f);
+   nifti_image *floating=CreatePhantom(40, 1.f);
+   reg_tools_trackImage(reference);
+   reg_tools_trackImage(floating);
+
+   reg_test_f3d *registration=new reg_test_f3d(reference->nt, floating->nt);
+   registration->SetReferenceImage(reference);
+   registration->SetFloatingImage(floating);
+   registration->UseSSD(0, false);
+   // The penalty gradient then uses the jacobian matrices of all the voxels
+   if(useJacobian)
+   {
+      registration->SetJacobianLogWeight(0.01);
+      registration->DoNotApproximateJacobianLog();
+   }
+   registration->SetLevelNumber(2);
+   registration->SetLevelToPerform(2);
+   registration->SetMaximalIterationNumber(5);
+   registration->DoNotPrintOutInformation();
+   size_t estimated=registration->GetEstimatedPeakMemory();
+   int estimatedMB=registration->CheckMemoryMB();
+   registration->Run();
+   size_t tracked=reg_tools_getPeakTrackedMemory();
+   delete registration;
+
+   reg_tools_untrackImage(floating);
+   reg_tools_untrackImage(reference);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+
+   if(estimatedMB!=(int)ceil((double)estimated/(1024.0*1024.0)))
+   {
+      fprintf(stderr, "reg_test_peakMemory: CheckMemoryMB returned %i MB for %zu bytes\n",
+              estimatedMB, estimated);
+      return EXIT_FAILURE;
+   }
+   if(estimated < tracked || (double)estimated > (1.+TOLERANCE)*(double)tracked)
+   {
+      fprintf(stderr, "reg_test_peakMemory: estimated %zu bytes, tracked peak %zu bytes\n",
+              estimated, tracked);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_peakMemory ok: estimated %zu bytes, tracked peak %zu bytes\n",
+           estimated, tracked);
+#endif
+   return EXIT_SUCCESS;
+}
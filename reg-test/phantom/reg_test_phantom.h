@@ -0,0 +1,94 @@
+/**
+ * @file reg_test_phantom.h
+ * @brief Generation of the phantoms used by the unit tests that do not
+ * require any external data
+ *
+ * Copyright (c) 2012, University College London. All rights reserved.
+ * Centre for Medical Image Computing (CMIC)
+ * See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_TEST_PHANTOM_H
+#define _REG_TEST_PHANTOM_H
+
+#include "_reg_tools.h"
+#include "_reg_localTrans.h"
+
+/* *************************************************************** */
+/// @brief Create a cubic phantom, the floating phantom is shifted and rotated
+inline nifti_image *CreatePhantom(int size, float shift)
+{
+   int dim[8]= {3, size, size, size, 1, 1, 1, 1};
+   nifti_image *image=nifti_make_new_nim(dim, NIFTI_TYPE_FLOAT32, true);
+   for(int i=4; i<8; ++i)
+   {
+      image->dim[i]=1;
+      image->pixdim[i]=1.f;
+   }
+   image->nt=image->nu=image->nv=image->nw=1;
+   image->dt=image->du=image->dv=image->dw=1.f;
+   image->scl_slope=1.f;
+   image->scl_inter=0.f;
+   image->qform_code=1;
+   image->sform_code=0;
+   image->qto_xyz=nifti_quatern_to_mat44(0.f, 0.f, 0.f, 0.f, 0.f, 0.f,
+                                        1.f, 1.f, 1.f, 1.f);
+   image->qto_ijk=nifti_mat44_inverse(image->qto_xyz);
+   float *imagePtr=static_cast<float *>(image->data);
+   const float centre=0.5f*(float)(size-1);
+   const float angle=0.02f*shift;
+   size_t index=0;
+   for(int z=0; z<size; ++z)
+   {
+      for(int y=0; y<size; ++y)
+      {
+         for(int x=0; x<size; ++x)
+         {
+            const float px=cosf(angle)*((float)x-centre)-sinf(angle)*((float)y-centre)+shift;
+            const float py=sinf(angle)*((float)x-centre)+cosf(angle)*((float)y-centre)-0.5f*shift;
+            const float pz=(float)z-centre+0.25f*shift;
+            // Nested ellipsoids with a smooth texture
+            float value=20.f*sinf(0.2f*px)*cosf(0.15f*py)*sinf(0.1f*pz);
+            if(reg_pow2(px/(0.4f*size))+reg_pow2(py/(0.35f*size))+reg_pow2(pz/(0.3f*size))<1.f)
+               value += 100.f;
+            if(reg_pow2((px-0.1f*size)/(0.12f*size))+reg_pow2(py/(0.1f*size))+reg_pow2(pz/(0.15f*size))<1.f)
+               value += 80.f;
+            imagePtr[index++]=value;
+         }
+      }
+   }
+   return image;
+}
+/* *************************************************************** */
+/// @brief Create a cubic b-spline grid whose displacements are smooth but non-null
+inline nifti_image *CreateControlPointGrid(nifti_image *reference, float spacing, float amplitude)
+{
+   float spacingMillimeter[3]= {spacing, spacing, spacing};
+   nifti_image *grid=NULL;
+   reg_createControlPointGrid<float>(&grid, reference, spacingMillimeter);
+   float *gridPtr=static_cast<float *>(grid->data);
+   for(size_t i=0; i<grid->nvox; ++i)
+      gridPtr[i]=amplitude*sinf(0.1f*(float)i);
+   grid->intent_p1=DISP_FIELD;
+   reg_getDeformationFromDisplacement(grid);
+   grid->intent_p1=CUB_SPLINE_GRID;
+   return grid;
+}
+/* *************************************************************** */
+/// @brief Create a deformation field image with the geometry of the reference
+inline nifti_image *CreateVectorImage(nifti_image *reference)
+{
+   nifti_image *image=nifti_copy_nim_info(reference);
+   image->dim[0]=image->ndim=5;
+   image->dim[5]=image->nu=3;
+   image->nvox=(size_t)image->nx*image->ny*image->nz*image->nu;
+   image->data=(void *)calloc(image->nvox, image->nbyper);
+   image->intent_code=NIFTI_INTENT_VECTOR;
+   memset(image->intent_name, 0, 16);
+   strcpy(image->intent_name,"NREG_TRANS");
+   image->intent_p1=DEF_FIELD;
+   return image;
+}
+/* *************************************************************** */
+#endif
@@ -0,0 +1,200 @@
+#include "_reg_ReadWriteImage.h"
+#include "reg_test_phantom.h"
+#include <string>
+
+/* A phantom with two time points and an oblique qform and sform is saved
+ * uncompressed and compressed. Regions read with reg_io_ReadImageROI are
+ * compared to the corresponding blocks of the full image and their origins
+ * to the position of the first voxel of the region in the full image.
+ */
+
+#define EPS 0.0001
+
+/* *************************************************************** */
+nifti_image *CreateObliquePhantom()
+{
+   nifti_image *phantom=CreatePhantom(32, 1.f);
+   // A second time point is added to check the volume offsets
+   nifti_image *image=nifti_copy_nim_info(phantom);
+   image->ndim=image->dim[0]=4;
+   image->nt=image->dim[4]=2;
+   image->nvox=2*phantom->nvox;
+   image->data=malloc(image->nvox*image->nbyper);
+   float *phantomPtr=static_cast<float *>(phantom->data);
+   float *imagePtr=static_cast<float *>(image->data);
+   for(size_t i=0; i<phantom->nvox; ++i)
+   {
+      imagePtr[i]=phantomPtr[i];
+      imagePtr[i+phantom->nvox]=2.f*phantomPtr[i]+(float)i;
+   }
+   nifti_image_free(phantom);
+
+   image->pixdim[1]=image->dx=1.5f;
+   image->pixdim[2]=image->dy=2.f;
+   image->pixdim[3]=image->dz=2.5f;
+   image->quatern_b=0.1f;
+   image->quatern_c=-0.2f;
+   image->quatern_d=0.15f;
+   image->qoffset_x=-20.f;
+   image->qoffset_y=12.f;
+   image->qoffset_z=-7.f;
+   image->qfac=image->pixdim[0]=1.f;
+   image->qform_code=1;
+   image->qto_xyz=nifti_quatern_to_mat44(image->quatern_b, image->quatern_c, image->quatern_d,
+                                        image->qoffset_x, image->qoffset_y, image->qoffset_z,
+                                        image->dx, image->dy, image->dz, image->qfac);
+   image->qto_ijk=nifti_mat44_inverse(image->qto_xyz);
+   image->sform_code=2;
+   const float sform[3][4]= {{1.4f, 0.2f, -0.1f, 30.f},
+      {-0.3f, 1.9f, 0.25f, -15.f},
+      {0.1f, -0.2f, 2.4f, 4.f}
+   };
+   for(int i=0; i<3; ++i)
+      for(int j=0; j<4; ++j)
+         image->sto_xyz.m[i][j]=sform[i][j];
+   image->sto_xyz.m[3][0]=image->sto_xyz.m[3][1]=image->sto_xyz.m[3][2]=0.f;
+   image->sto_xyz.m[3][3]=1.f;
+   image->sto_ijk=nifti_mat44_inverse(image->sto_xyz);
+   return image;
+}
+/* *************************************************************** */
+/// @brief Check that the origin of the region is the position of its first voxel
+bool CheckOrigin(const mat44 &fullMatrix, const mat44 &roiMatrix, const int start[3],
+                 const char *name, const char *matrixName)
+{
+   for(int r=0; r<3; ++r)
+   {
+      float expected=fullMatrix.m[r][0]*start[0]+fullMatrix.m[r][1]*start[1] +
+            fullMatrix.m[r][2]*start[2]+fullMatrix.m[r][3];
+      if(fabs(roiMatrix.m[r][3]-expected)>EPS*(1.+fabs(expected)))
+      {
+         fprintf(stderr, "reg_test_readImageROI: %s - %s origin[%i] %g != %g\n",
+                 name, matrixName, r, roiMatrix.m[r][3], expected);
+         return false;
+      }
+      for(int c=0; c<3; ++c)
+      {
+         if(fabs(roiMatrix.m[r][c]-fullMatrix.m[r][c])>EPS)
+         {
+            fprintf(stderr, "reg_test_readImageROI: %s - %s orientation differs\n",
+                    name, matrixName);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+/* *************************************************************** */
+bool CheckROI(nifti_image *full, const char *filename, const int start[3], const int size[3])
+{
+   char name[255];
+   sprintf(name, "%s [%i,%i,%i]+[%i,%i,%i]", filename,
+           start[0], start[1], start[2], size[0], size[1], size[2]);
+   nifti_image *roi=reg_io_ReadImageROI(filename, start, size);
+   if(roi==NULL)
+   {
+      fprintf(stderr, "reg_test_readImageROI: %s - the region could not be read\n", name);
+      return false;
+   }
+   bool success=true;
+   if(roi->nx!=size[0] || roi->ny!=size[1] || roi->nz!=size[2] || roi->nt!=full->nt ||
+         roi->datatype!=full->datatype)
+   {
+      fprintf(stderr, "reg_test_readImageROI: %s - wrong dimension %ix%ix%ix%i\n",
+              name, roi->nx, roi->ny, roi->nz, roi->nt);
+      success=false;
+   }
+   else
+   {
+      float *fullPtr=static_cast<float *>(full->data);
+      float *roiPtr=static_cast<float *>(roi->data);
+      size_t roiIndex=0;
+      for(int t=0; t<full->nt && success; ++t)
+      {
+         for(int z=start[2]; z<start[2]+size[2] && success; ++z)
+         {
+            for(int y=start[1]; y<start[1]+size[1] && success; ++y)
+            {
+               for(int x=start[0]; x<start[0]+size[0]; ++x)
+               {
+                  size_t fullIndex=((t*full->nz+z)*full->ny+y)*full->nx+x;
+                  if(roiPtr[roiIndex++]!=fullPtr[fullIndex])
+                  {
+                     fprintf(stderr, "reg_test_readImageROI: %s - value differs at [%i,%i,%i,%i]\n",
+                             name, x, y, z, t);
+                     success=false;
+                     break;
+                  }
+               }
+            }
+         }
+      }
+   }
+   if(roi->qform_code!=full->qform_code || roi->sform_code!=full->sform_code)
+   {
+      fprintf(stderr, "reg_test_readImageROI: %s - the form codes differ\n", name);
+      success=false;
+   }
+   if(!CheckOrigin(full->qto_xyz, roi->qto_xyz, start, name, "qform"))
+      success=false;
+   if(!CheckOrigin(full->sto_xyz, roi->sto_xyz, start, name, "sform"))
+      success=false;
+   nifti_image_free(roi);
+   return success;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <outputFolder>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   const std::string folder(argv[1]);
+   const std::string filenames[2]=
+   {
+      folder+"/reg_test_readImageROI.nii",
+      folder+"/reg_test_readImageROI.nii.gz"
+   };
+   // Partial rows, full rows, full slices and the whole image
+   const int starts[4][3]= {{3, 5, 7}, {0, 10, 2}, {0, 0, 11}, {0, 0, 0}};
+   const int sizes[4][3]= {{9, 4, 6}, {32, 7, 5}, {32, 32, 8}, {32, 32, 32}};
+
+   nifti_image *phantom=CreateObliquePhantom();
+   int status=EXIT_SUCCESS;
+   for(int f=0; f<2; ++f)
+   {
+      reg_io_WriteImageFile(phantom, filenames[f].c_str());
+      // The reference is the full image as stored in the file
+      nifti_image *full=reg_io_ReadImageFile(filenames[f].c_str());
+      if(full==NULL)
+      {
+         fprintf(stderr, "reg_test_readImageROI: %s could not be read\n", filenames[f].c_str());
+         status=EXIT_FAILURE;
+         continue;
+      }
+      for(int r=0; r<4; ++r)
+      {
+         if(!CheckROI(full, filenames[f].c_str(), starts[r], sizes[r]))
+            status=EXIT_FAILURE;
+      }
+      // A region outside of the image has to be rejected
+      const int start[3]= {30, 0, 0}, size[3]= {4, 4, 4};
+      nifti_image *roi=reg_io_ReadImageROI(filenames[f].c_str(), start, size);
+      if(roi!=NULL)
+      {
+         fprintf(stderr, "reg_test_readImageROI: %s - a region outside of the image is read\n",
+                 filenames[f].c_str());
+         nifti_image_free(roi);
+         status=EXIT_FAILURE;
+      }
+      nifti_image_free(full);
+      remove(filenames[f].c_str());
+   }
+   nifti_image_free(phantom);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_readImageROI ok\n");
+#endif
+   return status;
+}
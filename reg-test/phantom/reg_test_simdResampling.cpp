@@ -0,0 +1,126 @@
+#include "_reg_resampling.h"
+#include "reg_test_phantom.h"
+
+/* The phantom is resampled with the trilinear interpolation using every
+ * vectorised kernel supported by the host, and with the scalar code. The
+ * deformation moves part of the reference space outside of the floating
+ * image so that the scalar fall-back of the vectorised kernels is used. The
+ * warped images and their spatial gradients have to be bit-identical.
+ */
+
+/* *************************************************************** */
+template <class DTYPE>
+size_t CountDifferences(nifti_image *expected, nifti_image *image)
+{
+   DTYPE *expectedPtr=static_cast<DTYPE *>(expected->data);
+   DTYPE *imagePtr=static_cast<DTYPE *>(image->data);
+   size_t differenceNumber=0;
+   for(size_t i=0; i<expected->nvox; ++i)
+   {
+      bool bothNaN=expectedPtr[i]!=expectedPtr[i] && imagePtr[i]!=imagePtr[i];
+      if(!bothNaN && expectedPtr[i]!=imagePtr[i])
+         ++differenceNumber;
+   }
+   return differenceNumber;
+}
+/* *************************************************************** */
+template <class DTYPE>
+int TestSIMDResampling(bool useMask)
+{
+   nifti_image *reference=CreatePhantom(40, 0.f);
+   nifti_image *floating=CreatePhantom(40, 1.f);
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+
+   // A smooth deformation that is shifted out of the floating image
+   nifti_image *grid=CreateControlPointGrid(reference, 5.f, 2.f);
+   nifti_image *field=CreateVectorImage(reference);
+   reg_spline_getDeformationField(grid, field, NULL, false, true);
+   float *fieldPtr=static_cast<float *>(field->data);
+   for(size_t i=0; i<voxelNumber; ++i)
+      fieldPtr[i] += 3.5f;
+
+   int *mask=(int *)calloc(voxelNumber, sizeof(int));
+   // The first slices and scattered voxels are excluded
+   if(useMask)
+   {
+      for(size_t i=0; i<voxelNumber; ++i)
+         if(i%7==0 || i<voxelNumber/5) mask[i]=-1;
+   }
+   if(sizeof(DTYPE)==sizeof(double))
+   {
+      reg_tools_changeDatatype<double>(floating);
+      reg_tools_changeDatatype<double>(field);
+   }
+   nifti_image *warped[2], *gradient[2];
+   for(int i=0; i<2; ++i)
+   {
+      warped[i]=nifti_copy_nim_info(floating);
+      warped[i]->dim[1]=warped[i]->nx=reference->nx;
+      warped[i]->dim[2]=warped[i]->ny=reference->ny;
+      warped[i]->dim[3]=warped[i]->nz=reference->nz;
+      warped[i]->nvox=voxelNumber;
+      warped[i]->data=calloc(warped[i]->nvox, warped[i]->nbyper);
+      gradient[i]=CreateVectorImage(warped[i]);
+   }
+
+   // The scalar implementation is used as the reference
+   int hostLevel=reg_getSIMDLevel();
+   reg_setSIMDLevel(NR_SIMD_NONE);
+   reg_resampleImage(floating, warped[0], field, mask, 1, std::numeric_limits<float>::quiet_NaN());
+   reg_getImageGradient(floating, gradient[0], field, mask, 1, std::numeric_limits<float>::quiet_NaN(), 0);
+
+   int status=EXIT_SUCCESS;
+   int testedLevelNumber=0;
+   for(int level=NR_SIMD_AVX2; level<=hostLevel; ++level)
+   {
+      reg_setSIMDLevel(level);
+      memset(warped[1]->data, 0, warped[1]->nvox*warped[1]->nbyper);
+      memset(gradient[1]->data, 0, gradient[1]->nvox*gradient[1]->nbyper);
+      reg_resampleImage(floating, warped[1], field, mask, 1, std::numeric_limits<float>::quiet_NaN());
+      reg_getImageGradient(floating, gradient[1], field, mask, 1, std::numeric_limits<float>::quiet_NaN(), 0);
+      size_t warpedDifferences=CountDifferences<DTYPE>(warped[0], warped[1]);
+      size_t gradientDifferences=CountDifferences<DTYPE>(gradient[0], gradient[1]);
+      if(warpedDifferences>0 || gradientDifferences>0)
+      {
+         fprintf(stderr, "reg_test_simdResampling: SIMD level %i - %zu warped and %zu gradient values differ\n",
+                 level, warpedDifferences, gradientDifferences);
+         status=EXIT_FAILURE;
+      }
+      ++testedLevelNumber;
+   }
+   reg_setSIMDLevel(hostLevel);
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_simdResampling: %i vectorised kernel(s) tested\n", testedLevelNumber);
+#endif
+
+   for(int i=0; i<2; ++i)
+   {
+      nifti_image_free(warped[i]);
+      nifti_image_free(gradient[i]);
+   }
+   free(mask);
+   nifti_image_free(field);
+   nifti_image_free(grid);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+   return status;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <double> <mask>\n", argv[0]);
+      fprintf(stderr, "\t<double> 1 to use double precision images, 0 for single precision\n");
+      fprintf(stderr, "\t<mask> 1 to exclude part of the reference space, 0 to use all voxels\n");
+      return EXIT_FAILURE;
+   }
+   bool useDouble=atoi(argv[1])==1;
+   bool useMask=atoi(argv[2])==1;
+   int status=useDouble ? TestSIMDResampling<double>(useMask) : TestSIMDResampling<float>(useMask);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_simdResampling ok\n");
+#endif
+   return status;
+}
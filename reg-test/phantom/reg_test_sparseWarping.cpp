@@ -0,0 +1,153 @@
+#include "_reg_aladin.h"
+#include "_reg_blockMatching.h"
+#include "_reg_globalTrans.h"
+#include "_reg_resampling.h"
+#include "reg_test_phantom.h"
+
+/* The floating phantom is warped densely and only over the support of the
+ * active blocks. The block matching has to give the same displacements with
+ * both warped images, and so does the affine update. The same holds for
+ * the final matrix of reg_aladin with and without the sparse warping.
+ */
+
+// Tolerance on the block positions and on the matrix coefficients, in mm
+#define EPS 1.0e-5
+
+/* *************************************************************** */
+double GetMatrixDifference(mat44 *a, mat44 *b)
+{
+   double maxDifference=0.;
+   for(int i=0; i<4; ++i)
+      for(int j=0; j<4; ++j)
+         maxDifference=std::max(maxDifference, (double)fabs(a->m[i][j]-b->m[i][j]));
+   return maxDifference;
+}
+/* *************************************************************** */
+mat44 GetAladinMatrix(nifti_image *reference,
+                      nifti_image *floating,
+                      int interpolation,
+                      bool sparseWarping)
+{
+   reg_aladin<float> *aladin=new reg_aladin<float>;
+   aladin->SetInputReference(reference);
+   aladin->SetInputFloating(floating);
+   aladin->SetNumberOfLevels(2);
+   aladin->SetLevelsToPerform(2);
+   aladin->SetInterpolation(interpolation);
+   aladin->SetSparseWarping(sparseWarping);
+   aladin->SetVerbose(false);
+   aladin->Run();
+   mat44 matrix=*aladin->GetTransformationMatrix();
+   delete aladin;
+   return matrix;
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <interpolation>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   int interpolation=atoi(argv[1]);
+
+   nifti_image *reference=CreatePhantom(32, 0.f);
+   nifti_image *floating=CreatePhantom(32, 1.5f);
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   // The first slices are excluded from the mask
+   int *mask=(int *)calloc(voxelNumber, sizeof(int));
+   for(size_t i=0; i<4*(size_t)reference->nx*reference->ny; ++i)
+      mask[i]=-1;
+
+   _reg_blockMatchingParam params;
+   initialise_block_matching_method(reference, &params, 50, 50, 1, mask);
+   int *supportMask=(int *)malloc(voxelNumber*sizeof(int));
+   block_matching_support_mask(reference, &params, mask, supportMask);
+   size_t supportNumber=0;
+   for(size_t i=0; i<voxelNumber; ++i)
+      if(supportMask[i]>-1) ++supportNumber;
+
+   mat44 affine;
+   reg_mat44_eye(&affine);
+   affine.m[0][1]=0.03f;
+   affine.m[1][0]=-0.02f;
+   affine.m[2][2]=1.02f;
+   affine.m[0][3]=-1.2f;
+   affine.m[1][3]=0.6f;
+   affine.m[2][3]=0.4f;
+
+   // Dense warping, as with the GPU platforms
+   nifti_image *field=CreateVectorImage(reference);
+   reg_affine_getDeformationField(&affine, field, false, mask);
+   nifti_image *denseWarped=nifti_copy_nim_info(reference);
+   denseWarped->data=calloc(denseWarped->nvox, denseWarped->nbyper);
+   reg_resampleImage(floating, denseWarped, field, mask, interpolation,
+                     std::numeric_limits<float>::quiet_NaN());
+   // Sparse warping, as with the CPU platform
+   nifti_image *sparseWarped=nifti_copy_nim_info(reference);
+   sparseWarped->data=calloc(sparseWarped->nvox, sparseWarped->nbyper);
+   reg_resampleImage_affine(floating, sparseWarped, &affine, supportMask, interpolation,
+                            std::numeric_limits<float>::quiet_NaN());
+
+   int status=EXIT_SUCCESS;
+   size_t blockNumber=(size_t)params.activeBlockNumber*params.dim;
+   block_matching_method(reference, denseWarped, &params, mask);
+   float *densePosition=(float *)malloc(blockNumber*sizeof(float));
+   memcpy(densePosition, params.warpedPosition, blockNumber*sizeof(float));
+   int denseDefinedNumber=params.definedActiveBlockNumber;
+   mat44 denseAffine=affine;
+   optimize(&params, &denseAffine);
+
+   block_matching_method(reference, sparseWarped, &params, mask);
+   size_t disagreementNumber=0;
+   for(size_t i=0; i<blockNumber; ++i)
+   {
+      bool bothNaN=densePosition[i]!=densePosition[i] &&
+            params.warpedPosition[i]!=params.warpedPosition[i];
+      if(!bothNaN && !(fabs(densePosition[i]-params.warpedPosition[i])<=EPS))
+         ++disagreementNumber;
+   }
+   if(disagreementNumber>0 || denseDefinedNumber!=params.definedActiveBlockNumber)
+   {
+      fprintf(stderr, "reg_test_sparseWarping: %zu block coordinates and %i/%i defined blocks differ\n",
+              disagreementNumber, denseDefinedNumber, params.definedActiveBlockNumber);
+      status=EXIT_FAILURE;
+   }
+   mat44 sparseAffine=affine;
+   optimize(&params, &sparseAffine);
+   double blockMatchingDifference=GetMatrixDifference(&denseAffine, &sparseAffine);
+   if(blockMatchingDifference>EPS)
+   {
+      fprintf(stderr, "reg_test_sparseWarping: the block matching updates differ by %g\n",
+              blockMatchingDifference);
+      status=EXIT_FAILURE;
+   }
+
+   mat44 denseMatrix=GetAladinMatrix(reference, floating, interpolation, false);
+   mat44 sparseMatrix=GetAladinMatrix(reference, floating, interpolation, true);
+   double aladinDifference=GetMatrixDifference(&denseMatrix, &sparseMatrix);
+   if(aladinDifference>EPS)
+   {
+      fprintf(stderr, "reg_test_sparseWarping: the reg_aladin matrices differ by %g\n",
+              aladinDifference);
+      status=EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_sparseWarping: support of %zu/%zu voxels, differences %g and %g\n",
+           supportNumber, voxelNumber, blockMatchingDifference, aladinDifference);
+#endif
+
+   free(densePosition);
+   nifti_image_free(sparseWarped);
+   nifti_image_free(denseWarped);
+   nifti_image_free(field);
+   free(supportMask);
+   free(mask);
+   nifti_image_free(floating);
+   nifti_image_free(reference);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_sparseWarping ok\n");
+#endif
+   return status;
+}
@@ -0,0 +1,141 @@
+#include "_reg_globalTrans.h"
+#include "_reg_localTrans.h"
+#include "reg_test_phantom.h"
+
+/* The dense deformation field of a cubic spline grid is computed one control
+ * point cell at a time when no composition is required. It is compared against
+ * the per-voxel evaluation, which is still used for the composition and is
+ * obtained here by composing the grid with the identity transformation. The
+ * grid spacing is not a multiple of the voxel size along every axis, so that
+ * the cells do not all contain the same number of voxels. For the cubic
+ * B-Spline, the evaluation using the tabulated basis values is also compared.
+ * The voxels outside of the mask are expected to be set to zero.
+ */
+
+// Tolerance on the deformation, in mm. Both evaluations only differ by the
+// order of the summations
+#define EPS 1.0e-4
+
+/* *************************************************************** */
+/// @brief Largest difference over the voxels of the mask and largest value
+/// outside of the mask
+void GetMaxDifference(nifti_image *expected,
+                      nifti_image *field,
+                      int *mask,
+                      double *maxDifference,
+                      double *maxMaskedValue)
+{
+   size_t voxelNumber=(size_t)field->nx*field->ny*field->nz;
+   float *expectedPtr=static_cast<float *>(expected->data);
+   float *fieldPtr=static_cast<float *>(field->data);
+   *maxDifference=0;
+   *maxMaskedValue=0;
+   for(size_t i=0; i<voxelNumber; ++i)
+   {
+      for(int d=0; d<3; ++d)
+      {
+         double value=fieldPtr[i+d*voxelNumber];
+         double difference=mask[i]>-1?fabs(value-(double)expectedPtr[i+d*voxelNumber]):fabs(value);
+         // A NaN is reported as an infinite difference
+         if(difference!=difference)
+            difference=std::numeric_limits<double>::infinity();
+         if(mask[i]>-1)
+            *maxDifference=std::max(*maxDifference, difference);
+         else *maxMaskedValue=std::max(*maxMaskedValue, difference);
+      }
+   }
+}
+/* *************************************************************** */
+int main(int argc, char **argv)
+{
+   if(argc!=3)
+   {
+      fprintf(stderr, "Usage: %s <bspline> <mask>\n", argv[0]);
+      fprintf(stderr, "\t<bspline> 1 for a cubic B-Spline, 0 for an interpolant cubic spline\n");
+      fprintf(stderr, "\t<mask> 1 to exclude part of the image, 0 to use all voxels\n");
+      return EXIT_FAILURE;
+   }
+   bool bspline=atoi(argv[1])==1;
+   bool useMask=atoi(argv[2])==1;
+
+   // Anisotropic geometry, the grid spacing is 3.33, 5 and 2.5 voxels
+   nifti_image *reference=CreatePhantom(36, 0.f);
+   reference->pixdim[1]=reference->dx=1.5f;
+   reference->pixdim[3]=reference->dz=2.f;
+   reference->qoffset_x=-10.f;
+   reference->qoffset_y=5.f;
+   reference->qto_xyz=nifti_quatern_to_mat44(0.f, 0.f, 0.f, -10.f, 5.f, 0.f,
+                                            1.5f, 1.f, 2.f, 1.f);
+   reference->qto_ijk=nifti_mat44_inverse(reference->qto_xyz);
+   nifti_image *grid=CreateControlPointGrid(reference, 5.f, 2.f);
+   size_t voxelNumber=(size_t)reference->nx*reference->ny*reference->nz;
+   int *mask=(int *)calloc(voxelNumber, sizeof(int));
+   if(useMask)
+   {
+      for(size_t i=0; i<voxelNumber; ++i)
+         if(i%7==0 || i<voxelNumber/5) mask[i]=-1;
+   }
+
+   // Per-voxel evaluation, from the positions of the voxels
+   mat44 identity;
+   reg_mat44_eye(&identity);
+   nifti_image *expectedField=CreateVectorImage(reference);
+   reg_affine_getDeformationField(&identity, expectedField, false, NULL);
+   reg_spline_getDeformationField(grid, expectedField, NULL, true, bspline);
+
+   // Per-cell evaluation, the field is not initialised
+   nifti_image *deformationField=CreateVectorImage(reference);
+   float *fieldPtr=static_cast<float *>(deformationField->data);
+   for(size_t i=0; i<deformationField->nvox; ++i)
+      fieldPtr[i]=std::numeric_limits<float>::quiet_NaN();
+   reg_spline_getDeformationField(grid, deformationField, mask, false, bspline);
+
+   int status=EXIT_SUCCESS;
+   double maxDifference, maxMaskedValue;
+   GetMaxDifference(expectedField, deformationField, mask, &maxDifference, &maxMaskedValue);
+   if(maxDifference>EPS || maxMaskedValue!=0)
+   {
+      fprintf(stderr, "reg_test_splineDeformationField: difference %g mm, %g outside of the mask\n",
+              maxDifference, maxMaskedValue);
+      status=EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   else fprintf(stdout, "reg_test_splineDeformationField: difference %g mm\n", maxDifference);
+#endif
+
+   // Per-cell evaluation using the tabulated basis values
+   if(bspline)
+   {
+      reg_splineBasisTable basisTable(grid, deformationField);
+      if(!basisTable.IsValid(grid, deformationField) || !basisTable.IsCompact(1) || basisTable.IsCompact(0))
+      {
+         fprintf(stderr, "reg_test_splineDeformationField: unexpected basis table\n");
+         status=EXIT_FAILURE;
+      }
+      for(size_t i=0; i<deformationField->nvox; ++i)
+         fieldPtr[i]=std::numeric_limits<float>::quiet_NaN();
+      reg_spline_getDeformationField(grid, deformationField, mask, false, true, false, &basisTable);
+      GetMaxDifference(expectedField, deformationField, mask, &maxDifference, &maxMaskedValue);
+      if(maxDifference>EPS || maxMaskedValue!=0)
+      {
+         fprintf(stderr, "reg_test_splineDeformationField: difference %g mm, %g outside of the mask, with the basis table\n",
+                 maxDifference, maxMaskedValue);
+         status=EXIT_FAILURE;
+      }
+#ifndef NDEBUG
+      else fprintf(stdout, "reg_test_splineDeformationField: difference %g mm with the basis table\n",
+                   maxDifference);
+#endif
+   }
+
+   nifti_image_free(deformationField);
+   nifti_image_free(expectedField);
+   free(mask);
+   nifti_image_free(grid);
+   nifti_image_free(reference);
+#ifndef NDEBUG
+   if(status==EXIT_SUCCESS)
+      fprintf(stdout, "reg_test_splineDeformationField ok\n");
+#endif
+   return status;
+}